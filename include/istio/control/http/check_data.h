@@ -19,6 +19,7 @@
 #include <map>
 #include <string>
 
+#include "google/protobuf/map.h"
 #include "src/istio/authn/context.pb.h"
 
 namespace istio {
@@ -44,6 +45,16 @@ class CheckData {
   // Get request HTTP headers
   virtual std::map<std::string, std::string> GetRequestHeaders() const = 0;
 
+  // Add request HTTP headers to a protobuf map, the request.headers
+  // attribute. The default implementation copies GetRequestHeaders(); an
+  // environment should add them directly to skip the intermediate map.
+  virtual void AddRequestHeaders(
+      ::google::protobuf::Map<std::string, std::string> *headers) const {
+    for (const auto &it : GetRequestHeaders()) {
+      (*headers)[it.first] = it.second;
+    }
+  }
+
   // Returns true if connection is mutual TLS enabled.
   virtual bool IsMutualTLS() const = 0;
 
@@ -85,6 +96,14 @@ class CheckData {
   // If the request has authentication result in header, parses data into the
   // output result; returns true if success. Otherwise, returns false.
   virtual bool GetAuthenticationResult(istio::authn::Result *result) const = 0;
+
+  // Returns the authentication result kept in memory by the environment for
+  // this request, e.g. by the authentication filter of the same stream, or
+  // nullptr if it is not. The attributes are then built straight from it,
+  // without the copy of GetAuthenticationResult().
+  virtual const istio::authn::Result *FindAuthenticationResult() const {
+    return nullptr;
+  }
 };
 
 // An interfact to update request HTTP headers with Istio attributes.
@@ -95,7 +114,7 @@ class HeaderUpdate {
   // Remove "x-istio-attributes" HTTP header.
   virtual void RemoveIstioAttributes() = 0;
 
-  // Base64 encode data, and add it as "x-istio-attributes" HTTP header.
+  // Add the base64 encoded data as "x-istio-attributes" HTTP header.
   virtual void AddIstioAttributes(const std::string &data) = 0;
 };
 
@@ -20,6 +20,8 @@
 #include "include/istio/mixerclient/client.h"
 #include "mixer/v1/config/client/client_config.pb.h"
 
+#include <unordered_set>
+
 namespace istio {
 namespace control {
 namespace http {
@@ -55,6 +57,13 @@ class Controller {
     // If it is empty, destination_service is used to lookup
     // service_configs map in the HttpClientConfig.
     std::string service_config_id;
+
+    // The service config interned by the route when it was loaded, and its
+    // hash. If it is not nullptr, the service context is looked up by the
+    // hash only, and the string keys above are not used.
+    const ::istio::mixer::v1::config::client::ServiceConfig* service_config{
+        nullptr};
+    uint64_t service_config_hash{0};
   };
 
   // Creates a HTTP request handler.
@@ -64,6 +73,15 @@ class Controller {
   virtual std::unique_ptr<RequestHandler> CreateRequestHandler(
       const PerRouteConfig& per_route_config) = 0;
 
+  // Reports a request rejected before the Mixer filter runs with the
+  // attributes of Options::rejection_report_attributes and the static
+  // attributes of the client config. Like a request handler, it is not
+  // reported if the service config of per_route_config disables report
+  // calls, but it extracts no header map.
+  virtual void ReportRejection(const PerRouteConfig& per_route_config,
+                               CheckData* check_data,
+                               ReportData* report_data) = 0;
+
   // The initial data required by the Controller. It needs:
   // * client_config: the mixer client config.
   // * some functions provided by the environment (Envoy)
@@ -81,13 +99,116 @@ class Controller {
     // The LRU cache size for service config.
     // If not set or is 0 default value, the cache size is 1000.
     int service_config_cache_size{};
+
+    // The maximum number of destination services with their own
+    // Statistics::service_stats, the other services share one entry.
+    // If not set or is 0, no service stats are kept.
+    int max_service_stats{};
+
+    // Optional check cache shared by the controllers of all threads.
+    // It is created by CreateSharedCheckCache().
+    std::shared_ptr<::istio::mixerclient::CheckCache> shared_check_cache;
+
+    // Optional quota cache shared by the controllers of all threads.
+    // It is created by CreateSharedQuotaCache().
+    std::shared_ptr<::istio::mixerclient::QuotaCache> shared_quota_cache;
+
+    // The attributes of the rejection reports. Supported are source.ip,
+    // source.port, source.principal, request.host, request.path,
+    // request.method, request.scheme, request.useragent, request.referer,
+    // request.time, request.total_size, response.code, response.time,
+    // response.duration, response.total_size and context.protocol, the
+    // others are ignored. If empty, a default subset is reported.
+    std::unordered_set<std::string> rejection_report_attributes;
+
+    // If positive, the rejections with the same source.ip and
+    // response.code within this window are aggregated into one report,
+    // with their number in context.rejected_count.
+    int rejection_aggregate_window_ms{};
+
+    // If not empty, the reports not acknowledged at the end of a shutdown
+    // drain are saved to this file, and sent by the next controller
+    // created with it, see DrainReports().
+    std::string report_spill_file;
+
+    // If positive, the string and bytes values of the reports are cut to
+    // this many bytes.
+    int report_max_value_bytes{};
+
+    // If not empty, the words appended to the global dictionary of the
+    // Check and Report calls, see
+    // ::istio::mixerclient::ReadDictionaryExtension().
+    std::shared_ptr<const std::vector<std::string>> global_words_extension;
+
+    // If positive, the report batches adapt to the load to send about
+    // this many remote report calls per second, each of at most
+    // report_target_batch_bytes if positive.
+    int report_target_calls_per_second{};
+    int64_t report_target_batch_bytes{};
+
+    // Optional report batch shared by the HTTP and TCP controllers of a
+    // thread. It is created by CreateSharedReportBatch().
+    std::shared_ptr<::istio::mixerclient::ReportBatch> shared_report_batch;
+
+    // Optional process wide budget of the check and quota cache capacity,
+    // shared by the controllers with their own caches.
+    std::shared_ptr<::istio::mixerclient::CacheBudget> cache_budget;
+
+    // The mixer client options set by the proxy.
+    ::istio::mixerclient::ClientTuning client_tuning;
   };
 
   // The factory function to create a new instance of the controller.
   static std::unique_ptr<Controller> Create(const Options& options);
 
+  // Creates a check cache to be shared by the controllers created from
+  // the same config, e.g. by all Envoy worker threads.
+  // Returns nullptr if check cache is disabled by the config.
+  // If snapshot_file is not empty, the cache is preloaded from, and saved
+  // periodically and when destroyed to, the file of this prefix and of a
+  // suffix of the cache config. If node_cache_file is not empty, its
+  // misses go to the check cache shared by the proxies of the node through
+  // this file, for the responses of the same mesh_config_id. The cache
+  // options set by the proxy, e.g. its partition attribute and TTL tiers,
+  // are the ones of tuning, see ClientTuning.
+  static std::shared_ptr<::istio::mixerclient::CheckCache>
+  CreateSharedCheckCache(
+      const ::istio::mixer::v1::config::client::HttpClientConfig& config,
+      const std::string& snapshot_file = "",
+      const std::string& node_cache_file = "",
+      const std::string& mesh_config_id = "",
+      const ::istio::mixerclient::ClientTuning& tuning =
+          ::istio::mixerclient::ClientTuning());
+
+  // Creates a quota cache to be shared by the controllers created from
+  // the same config, so that all Envoy worker threads prefetch quota into
+  // one pool per quota key. Returns nullptr if quota cache is disabled by
+  // the config. The cache options set by the proxy are the ones of tuning.
+  static std::shared_ptr<::istio::mixerclient::QuotaCache>
+  CreateSharedQuotaCache(
+      const ::istio::mixer::v1::config::client::HttpClientConfig& config,
+      const ::istio::mixerclient::ClientTuning& tuning =
+          ::istio::mixerclient::ClientTuning());
+
+  // Creates a report batch to be shared by the HTTP and TCP controllers of
+  // a thread with the same SharedReportBatchKey(), so that they fill the
+  // same batches. It reports with options.env, which has to outlive it.
+  static std::shared_ptr<::istio::mixerclient::ReportBatch>
+  CreateSharedReportBatch(const Options& options);
+
+  // Returns the key of the report cluster and the report options.
+  static std::string SharedReportBatchKey(const Options& options);
+
   // Get statistics.
   virtual void GetStatistics(::istio::mixerclient::Statistics* stat) const = 0;
+
+  // Sets whether the proxy is short of memory or CPU, Mixer work is shed
+  // while it is, see ::istio::mixerclient::MixerClient::SetOverloaded().
+  virtual void SetOverloaded(bool overloaded) {}
+
+  // Starts draining the reports before a shutdown, see
+  // ::istio::mixerclient::MixerClient::DrainReports().
+  virtual void DrainReports(int deadline_ms) {}
 };
 
 }  // namespace http
@@ -18,6 +18,9 @@
 
 #include <chrono>
 #include <map>
+#include <string>
+
+#include "google/protobuf/map.h"
 
 namespace istio {
 namespace control {
@@ -32,6 +35,15 @@ class ReportData {
   // Get response HTTP headers.
   virtual std::map<std::string, std::string> GetResponseHeaders() const = 0;
 
+  // Add response HTTP headers to a protobuf map, the response.headers
+  // attribute. The default implementation copies GetResponseHeaders().
+  virtual void AddResponseHeaders(
+      ::google::protobuf::Map<std::string, std::string>* headers) const {
+    for (const auto& it : GetResponseHeaders()) {
+      (*headers)[it.first] = it.second;
+    }
+  }
+
   // Get additional report info.
   struct ReportInfo {
     uint64_t response_total_size;
@@ -60,6 +60,10 @@ class RequestHandler {
   //   handler->Report();
   //
   virtual void ExtractRequestAttributes(CheckData* check_data) = 0;
+
+  // Returns why the done Check call missed the caches, NONE for a cache
+  // hit or if no Check call was made.
+  virtual ::istio::mixerclient::CheckMissReason check_miss_reason() const = 0;
 };
 
 }  // namespace http
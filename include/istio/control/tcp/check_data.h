@@ -37,6 +37,10 @@ class CheckData {
   // Returns true if connection is mutual TLS enabled.
   virtual bool IsMutualTLS() const = 0;
 
+  // Get the local address the downstream tcp connection is accepted on,
+  // with its port.
+  virtual bool GetLocalAddress(std::string* address) const = 0;
+
   // Get downstream tcp connection id.
   virtual std::string GetConnectionId() const = 0;
 };
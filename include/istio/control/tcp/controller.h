@@ -47,11 +47,30 @@ class Controller {
 
     // Some plaform functions for mixer client library.
     ::istio::mixerclient::Environment env;
+
+    // If positive, a connection allowed by a check cache hit lets the next
+    // connections with the same source principal, source IP and local
+    // address skip the Check call for this many milliseconds. Not used
+    // with a connection quota spec.
+    int connection_decision_ttl_ms{0};
+
+    // Optional report batch shared by the HTTP and TCP controllers of a
+    // thread. It is created by CreateSharedReportBatch().
+    std::shared_ptr<::istio::mixerclient::ReportBatch> shared_report_batch;
   };
 
   // The factory function to create a new instance of the controller.
   static std::unique_ptr<Controller> Create(const Options& options);
 
+  // Creates a report batch to be shared by the HTTP and TCP controllers of
+  // a thread with the same SharedReportBatchKey(), so that they fill the
+  // same batches. It reports with options.env, which has to outlive it.
+  static std::shared_ptr<::istio::mixerclient::ReportBatch>
+  CreateSharedReportBatch(const Options& options);
+
+  // Returns the key of the report cluster and the report options.
+  static std::string SharedReportBatchKey(const Options& options);
+
   // Get statistics.
   virtual void GetStatistics(::istio::mixerclient::Statistics* stat) const = 0;
 };
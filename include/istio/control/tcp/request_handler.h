@@ -32,6 +32,9 @@ class RequestHandler {
   // Perform a Check call. It will:
   // * extract downstream tcp connection attributes
   // * check config, make a Check call if necessary.
+  // The Check call is skipped for a connection tuple recently allowed by a
+  // check cache hit, check_data is then used by the first report and has to
+  // stay valid until then.
   virtual ::istio::mixerclient::CancelFunc Check(
       CheckData* check_data, ::istio::mixerclient::DoneFunc on_done) = 0;
 
@@ -46,6 +49,10 @@ class RequestHandler {
   // If is_final_report is true, report all attributes. Otherwise, report delta
   // attributes.
   virtual void Report(ReportData* report_data, bool is_final_report) = 0;
+
+  // Returns why the done Check call missed the caches, NONE for a cache
+  // hit or if no Check call was made.
+  virtual ::istio::mixerclient::CheckMissReason check_miss_reason() const = 0;
 };
 
 }  // namespace tcp
@@ -0,0 +1,115 @@
+/* Copyright 2018 Istio Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ISTIO_MIXERCLIENT_CACHE_BUDGET_H
+#define ISTIO_MIXERCLIENT_CACHE_BUDGET_H
+
+#include <stdint.h>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace istio {
+namespace mixerclient {
+
+// Shares process wide budgets of check and quota cache capacity between
+// the caches of multiple clients, e.g. one client per worker thread, so a
+// busy worker takes the capacity an idle one doesn't need. Rebalance(),
+// called periodically, gives each cache an even floor of half the budget
+// and the other half in proportion to its recent demand: the misses and
+// the evictions since the previous call. The quota capacity is in the
+// units of the quota caches, bytes if QuotaOptions::max_bytes is set.
+//
+// A client applies its capacities and publishes its demand on its own
+// thread, every sync_interval_ms, so a thread confined cache is never
+// touched by the thread calling Rebalance(). This interface is thread
+// safe.
+class CacheBudget {
+ public:
+  // The capacities and the demand of the caches of a client. The
+  // capacities are set by Rebalance(), the demand counts are published by
+  // the client.
+  struct Share {
+    std::atomic<int64_t> check_capacity{0};
+    std::atomic<int64_t> quota_capacity{0};
+    // The total misses and evictions of the caches.
+    std::atomic<uint64_t> check_demand{0};
+    std::atomic<uint64_t> quota_demand{0};
+  };
+
+  // A budget of 0 leaves the caches of that kind as configured.
+  CacheBudget(int64_t check_capacity, int64_t quota_capacity,
+              int sync_interval_ms = 1000);
+
+  // Returns the process wide budget of these capacities, shared by all
+  // its callers while one of them holds it.
+  static std::shared_ptr<CacheBudget> GetShared(int64_t check_capacity,
+                                                int64_t quota_capacity,
+                                                int sync_interval_ms);
+
+  // Adds a client and splits the budget again, the new client without any
+  // demand yet. It leaves the budget once it drops the share.
+  std::shared_ptr<Share> Join();
+
+  // Sets the capacities of the clients from their demand since the last
+  // call.
+  void Rebalance();
+
+  // Calls Rebalance() unless it was called by this less than half of
+  // sync_interval_ms before now_ms, so that the owners of a shared budget
+  // can all call it periodically. Returns true if it did.
+  bool RebalanceIfDue(int64_t now_ms);
+
+  int64_t check_capacity() const { return check_capacity_; }
+  int64_t quota_capacity() const { return quota_capacity_; }
+  int sync_interval_ms() const { return sync_interval_ms_; }
+
+ private:
+  // A client, its last demand counts and smoothed demand are only used by
+  // Rebalance().
+  struct Member {
+    std::weak_ptr<Share> share;
+    uint64_t last_check_demand;
+    uint64_t last_quota_demand;
+    double check_weight;
+    double quota_weight;
+  };
+
+  // Drops the members which left and splits both budgets between the
+  // others. Called with mutex_.
+  void SplitAllWithLock();
+
+  // Splits a budget by the weights of the members. Called with mutex_.
+  void SplitWithLock(int64_t budget, double Member::*weight,
+                     std::atomic<int64_t> Share::*capacity,
+                     const std::vector<std::shared_ptr<Share>>& shares);
+
+  const int64_t check_capacity_;
+  const int64_t quota_capacity_;
+  const int sync_interval_ms_;
+
+  // Mutex guarding members_ and the last rebalance time.
+  std::mutex mutex_;
+  std::vector<Member> members_;
+  // The time of the last RebalanceIfDue() which rebalanced, if any.
+  bool rebalanced_ = false;
+  int64_t last_rebalance_ms_ = 0;
+};
+
+}  // namespace mixerclient
+}  // namespace istio
+
+#endif  // ISTIO_MIXERCLIENT_CACHE_BUDGET_H
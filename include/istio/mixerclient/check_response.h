@@ -21,6 +21,23 @@
 namespace istio {
 namespace mixerclient {
 
+// Why a check was not answered by the caches, so it waited for a remote
+// call. NONE for the cache hits, and if no cache is used.
+enum class CheckMissReason {
+  NONE,
+  // No learned Referenced shape matches the request.
+  NO_SHAPE,
+  // A shape matches, but no response is cached for the request.
+  NO_ITEM,
+  // The cached response expired by its valid duration.
+  EXPIRED,
+  // The cached response was used its valid use count times.
+  USE_COUNT_EXHAUSTED,
+  // The check is a cache hit, but the quota cache could not grant the
+  // quotas.
+  QUOTA,
+};
+
 // The CheckResponseInfo holds response information in detail.
 struct CheckResponseInfo {
   // Whether this check response is from cache.
@@ -29,9 +46,14 @@ struct CheckResponseInfo {
   // Whether this quota response is from cache.
   bool is_quota_cache_hit{false};
 
-  // The check and quota response status.
-  ::google::protobuf::util::Status response_status{
-      ::google::protobuf::util::Status::UNKNOWN};
+  // Why the check or the quotas missed the caches.
+  CheckMissReason miss_reason{CheckMissReason::NONE};
+
+  // The check and quota response status. It points to a status interned by
+  // the check cache, or held by the client for the call, so a cache hit
+  // passes it without a copy. It is only valid while the done callback
+  // runs, copy the status to keep it.
+  const ::google::protobuf::util::Status* response_status{nullptr};
 };
 
 }  // namespace mixerclient
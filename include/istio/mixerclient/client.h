@@ -16,10 +16,12 @@
 #ifndef ISTIO_MIXERCLIENT_CLIENT_H
 #define ISTIO_MIXERCLIENT_CLIENT_H
 
+#include "cache_budget.h"
 #include "environment.h"
 #include "include/istio/quota_config/requirement.h"
 #include "options.h"
 
+#include <string>
 #include <vector>
 
 namespace istio {
@@ -46,9 +48,77 @@ struct MixerClientOptions {
   QuotaOptions quota_options;
   // The environment functions.
   Environment env;
+  // If not empty, the words appended to the global dictionary, read by
+  // ReadDictionaryExtension(). Mixer must have the same words.
+  std::shared_ptr<const std::vector<std::string>> global_words_extension;
+  // If not nullptr, the capacities of the check and quota caches of the
+  // client, unless shared, are set from this process wide budget. It
+  // requires a timer in the environment.
+  std::shared_ptr<CacheBudget> cache_budget;
 };
 
 // The statistics recorded by mixerclient library.
+// Check cache statistics for one ReferencedAttributes shape.
+struct ReferencedShapeStats {
+  // The referenced attribute names of the shape, for display only.
+  std::string shape;
+  // Number of check calls found in the cache using this shape.
+  uint64_t hits;
+  // Number of check calls matched this shape but not found in the cache.
+  uint64_t misses;
+};
+
+// Quota cache statistics for one quota name. The prefetch counters are
+// summed over the cached items of the quota, so they drop when an item is
+// removed from the cache.
+struct QuotaNameStats {
+  // The quota name.
+  std::string name;
+  // Number of quota checks served by a cached item.
+  uint64_t hits;
+  // Number of quota checks not found in the cache.
+  uint64_t misses;
+  // Number of prefetch calls.
+  uint64_t prefetch_calls;
+  // Total amount granted by the server, passed to checks, and expired
+  // before it was used.
+  uint64_t granted_amount;
+  uint64_t used_amount;
+  uint64_t expired_amount;
+  // Number of checks made while a prefetch was in flight, and the number
+  // of them rejected.
+  uint64_t inflight_checks;
+  uint64_t inflight_rejections;
+  // Total milliseconds in the close mode, after a prefetch was not fully
+  // granted.
+  uint64_t close_time_ms;
+  // Current number of prefetch queue slots.
+  uint64_t queue_depth;
+  // Number of quota checks rejected locally by a recent zero grant from
+  // the server, see QuotaOptions::max_rejected_signatures.
+  uint64_t negative_hits;
+};
+
+// Statistics of the requests to one destination service, only kept by
+// the HTTP controller if enabled.
+struct ServiceStats {
+  // The destination service, kOtherServiceStats for the services over the
+  // limit.
+  std::string service;
+  // Number of check calls, the ones served by the check cache, and the
+  // blocking remote check calls for the others.
+  uint64_t check_calls;
+  uint64_t check_cache_hits;
+  uint64_t blocking_remote_check_calls;
+  // Number of check calls with quotas served by the quota cache.
+  uint64_t quota_cache_hits;
+  // Number of report calls.
+  uint64_t report_calls;
+};
+
+// The service name of the ServiceStats of the services over the limit.
+const char kOtherServiceStats[] = "_other";
+
 struct Statistics {
   // Total number of check calls.
   uint64_t total_check_calls;
@@ -56,6 +126,10 @@ struct Statistics {
   uint64_t total_remote_check_calls;
   // Total number of remote check calls that blocking origin requests.
   uint64_t total_blocking_remote_check_calls;
+  // Total number of check calls waiting for an identical remote check call.
+  uint64_t total_coalesced_check_calls;
+  // Total number of hedged remote check calls.
+  uint64_t total_hedged_check_calls;
 
   // Total number of quota calls.
   uint64_t total_quota_calls;
@@ -63,13 +137,79 @@ struct Statistics {
   uint64_t total_remote_quota_calls;
   // Total number of remote quota calls that blocking origin requests.
   uint64_t total_blocking_remote_quota_calls;
+  // Total number of quota prefetch calls batched into another remote call.
+  uint64_t total_batched_quota_calls;
 
   // Total number of report calls.
   uint64_t total_report_calls;
   // Total number of remote report calls.
   uint64_t total_remote_report_calls;
+  // Total number of report calls dropped or sampled out while the
+  // in-flight window of remote report calls is full.
+  uint64_t total_dropped_report_calls;
+  // Total number of report batches finished by their reason: full of
+  // max_batch_entries reports or of max_batch_bytes, by the
+  // max_batch_time_ms timer or a flush, by a report not delta encoded
+  // with the batch, or to open a batch over max_open_batches.
+  uint64_t total_report_batches_full_entries;
+  uint64_t total_report_batches_full_bytes;
+  uint64_t total_report_batches_timed;
+  uint64_t total_report_batches_delta_break;
+  uint64_t total_report_batches_evicted;
+  // Total number of remote check calls not made while overloaded, the
+  // check calls are answered as for a network failure.
+  uint64_t total_overload_shed_check_calls;
+  // Total number of report calls sampled out while overloaded.
+  uint64_t total_overload_dropped_report_calls;
+  // Total number of report batches appended to the spill ring, see
+  // ReportOptions::spill_ring_file.
+  uint64_t total_spilled_report_batches;
+  // Total number of check cache items evicted when becoming overloaded.
+  uint64_t total_overload_evicted_cache_items;
+  // Total number of remote check calls not made while the check circuit
+  // breaker is open, the check calls are answered as for a network
+  // failure.
+  uint64_t total_breaker_shed_check_calls;
+  // Current number of remote report calls in flight.
+  uint64_t inflight_report_batches;
+  // Current bytes of the reports not sent yet.
+  uint64_t buffered_report_bytes;
+  // Current number of open report batches and of the reports in them.
+  uint64_t open_report_batches;
+  uint64_t open_report_entries;
+  // Current number of words in the global dictionary.
+  uint64_t global_dictionary_words;
+
+  // Current number of items in the check cache.
+  uint64_t check_cache_entries;
+  // Current bytes of check cache items and learned ReferencedAttributes.
+  uint64_t check_cache_bytes;
+  // Current number of items in the quota cache.
+  uint64_t quota_cache_entries;
+  // Current bytes of quota cache items.
+  uint64_t quota_cache_bytes;
+  // Total number of expired check cache items removed by the background
+  // sweep.
+  uint64_t check_cache_swept_items;
+  // Total number of idle quota cache items removed by the background sweep.
+  uint64_t quota_cache_swept_items;
+
+  // Check cache statistics per ReferencedAttributes shape,
+  // ordered from the most hit shape.
+  std::vector<ReferencedShapeStats> check_cache_shapes;
+
+  // Quota cache statistics per quota name, ordered by name.
+  std::vector<QuotaNameStats> quota_stats;
+
+  // Statistics per destination service, ordered by service.
+  std::vector<ServiceStats> service_stats;
 };
 
+// Defines a function prototype to add the attributes deferred by a caller
+// of MixerClient::Check().
+using FillAttributesFunc =
+    std::function<void(::istio::mixer::v1::Attributes* attributes)>;
+
 class MixerClient {
  public:
   // Destructor
@@ -89,17 +229,72 @@ class MixerClient {
       const std::vector<::istio::quota_config::Requirement>& quotas,
       TransportCheckFunc transport, CheckDoneFunc on_done) = 0;
 
+  // A check call with the attributes named in deferred_names not extracted
+  // yet, so their extraction is skipped for a check cache hit not using
+  // them. fill_deferred adds them to attributes; it is only called before
+  // this call returns. The default implementation always calls it.
+  virtual CancelFunc Check(
+      ::istio::mixer::v1::Attributes* attributes,
+      const std::vector<std::string>& deferred_names,
+      FillAttributesFunc fill_deferred,
+      const std::vector<::istio::quota_config::Requirement>& quotas,
+      TransportCheckFunc transport, CheckDoneFunc on_done) {
+    fill_deferred(attributes);
+    return Check(*attributes, quotas, transport, on_done);
+  }
+
   // A report call.
   virtual void Report(const ::istio::mixer::v1::Attributes& attributes) = 0;
 
+  // A report call taking the content of the attributes, so they can be
+  // queued without a copy. The default implementation copies them.
+  virtual void Report(::istio::mixer::v1::Attributes&& attributes) {
+    Report(static_cast<const ::istio::mixer::v1::Attributes&>(attributes));
+  }
+
   // Get statistics.
   virtual void GetStatistics(Statistics* stat) const = 0;
+
+  // Sets whether the proxy is short of memory or CPU. While overloaded, the
+  // check calls missing the cache don't make remote calls, and most report
+  // calls are dropped. The check cache is shrunk when it becomes
+  // overloaded. The quota cache is kept, dropping its prefetched amounts
+  // would only add remote calls. The default implementation ignores it.
+  virtual void SetOverloaded(bool overloaded) {}
+
+  // Starts draining the reports before a shutdown, see
+  // ReportOptions::spill_file. The pending and the next reports are sent
+  // right away, and after deadline_ms the unacknowledged ones are saved.
+  // The default implementation ignores it.
+  virtual void DrainReports(int deadline_ms) {}
 };
 
 // Creates a MixerClient object.
 std::unique_ptr<MixerClient> CreateMixerClient(
     const MixerClientOptions& options);
 
+// Creates a check cache object to be shared by multiple MixerClient objects.
+// Pass it in CheckOptions::shared_cache.
+std::shared_ptr<CheckCache> CreateSharedCheckCache(
+    const CheckOptions& options);
+
+// Creates a quota cache object to be shared by multiple MixerClient objects.
+// Pass it in QuotaOptions::shared_cache.
+std::shared_ptr<QuotaCache> CreateSharedQuotaCache(
+    const QuotaOptions& options);
+
+// Creates a report batch object to be shared by multiple MixerClient
+// objects, with its own attribute compressor. It uses the report options
+// and the report transports, timer, stats sink and threading model of
+// options.env. Pass it in ReportOptions::shared_batch.
+std::shared_ptr<ReportBatch> CreateSharedReportBatch(
+    const MixerClientOptions& options);
+
+// Gets the report statistics of a batch. The MixerClient objects using a
+// shared batch only report their own report calls, so the owner of the
+// batch gets the rest with this and reports them once.
+void GetReportBatchStatistics(ReportBatch& batch, Statistics* stat);
+
 }  // namespace mixerclient
 }  // namespace istio
 
@@ -0,0 +1,73 @@
+/* Copyright 2018 Istio Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ISTIO_MIXERCLIENT_DICTIONARY_EXTENSION_H
+#define ISTIO_MIXERCLIENT_DICTIONARY_EXTENSION_H
+
+#include "mixer/v1/attributes.pb.h"
+
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace istio {
+namespace mixerclient {
+
+// A global dictionary extension is the list of words a deployment appends
+// to the global words, e.g. its service names, header names and JWT claim
+// keys, so that they are not sent in the per message words of every call.
+// It is built from a traffic capture by the create_dictionary_extension
+// tool, and Mixer must be given the same words after its global words.
+// A Mixer without them rejects the global_word_count of the calls, the
+// client then falls back to the base global dictionary and probes the
+// extended one again later.
+//
+// The file is a text header "istio-mixer-dictionary-1", the number and
+// the fingerprint of the global words it extends, then one word per line.
+// It is only valid for the global words it was built for.
+
+// Counts the words of the captured attributes missing from the global
+// dictionary and picks the ones saving the most bytes.
+class DictionaryExtensionBuilder {
+ public:
+  // Counts the attribute names, the string values and the string map
+  // keys and values of the attributes.
+  void Add(const ::istio::mixer::v1::Attributes& attributes);
+
+  // Returns up to max_words words seen at least min_count times, the ones
+  // saving the most bytes first.
+  std::vector<std::string> Build(size_t max_words, int64_t min_count) const;
+
+ private:
+  void AddWord(const std::string& word);
+
+  std::unordered_map<std::string, int64_t> counts_;
+};
+
+// Writes the extension words for the global words of this binary. Returns
+// false if the file could not be written.
+bool WriteDictionaryExtension(const std::string& file,
+                              const std::vector<std::string>& words);
+
+// Reads the extension words. Returns false and logs the reason if the file
+// is invalid or was built for other global words.
+bool ReadDictionaryExtension(const std::string& file,
+                             std::vector<std::string>* words);
+
+}  // namespace mixerclient
+}  // namespace istio
+
+#endif  // ISTIO_MIXERCLIENT_DICTIONARY_EXTENSION_H
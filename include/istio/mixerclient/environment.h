@@ -19,8 +19,12 @@
 #include "check_response.h"
 #include "google/protobuf/stubs/status.h"
 #include "mixer/v1/service.pb.h"
+#include "options.h"
 #include "timer.h"
 
+#include <memory>
+#include <vector>
+
 namespace istio {
 namespace mixerclient {
 
@@ -49,6 +53,46 @@ using TransportReportFunc = std::function<CancelFunc(
 // Defines a function prototype to generate an UUID
 using UUIDGenerateFunc = std::function<std::string()>;
 
+class TrafficCapture;
+
+// The counters pushed to a StatsSink, see Statistics for their meaning.
+enum class StatsCounter {
+  CHECK_CALLS = 0,
+  REMOTE_CHECK_CALLS,
+  BLOCKING_REMOTE_CHECK_CALLS,
+  COALESCED_CHECK_CALLS,
+  QUOTA_CALLS,
+  REMOTE_QUOTA_CALLS,
+  BLOCKING_REMOTE_QUOTA_CALLS,
+  REPORT_CALLS,
+  REMOTE_REPORT_CALLS,
+  DROPPED_REPORT_CALLS,
+  CHECK_CACHE_SWEPT_ITEMS,
+  QUOTA_CACHE_SWEPT_ITEMS,
+  REPORT_BATCHES_FULL_ENTRIES,
+  REPORT_BATCHES_FULL_BYTES,
+  REPORT_BATCHES_TIMED,
+  REPORT_BATCHES_DELTA_BREAK,
+  REPORT_BATCHES_EVICTED,
+  OVERLOAD_SHED_CHECK_CALLS,
+  OVERLOAD_DROPPED_REPORT_CALLS,
+  OVERLOAD_EVICTED_CACHE_ITEMS,
+  BREAKER_SHED_CHECK_CALLS,
+  SPILLED_REPORT_BATCHES,
+};
+
+// Receives the counter increments of a mixer client as they happen, so
+// that they can be exported without polling GetStatistics(). It is called
+// by the threads calling the client and by its timers, possibly with a
+// lock of the client held, so it must not call back into the client.
+class StatsSink {
+ public:
+  virtual ~StatsSink() {}
+
+  // Adds value to a counter.
+  virtual void AddCounter(StatsCounter counter, uint64_t value) = 0;
+};
+
 // Store functions provided by the Environments, such as
 // * transport function to make remote Check and Report calls
 // * timer function to create a timer
@@ -56,6 +100,10 @@ struct Environment {
   // Transport functions.
   TransportCheckFunc check_transport;
   TransportReportFunc report_transport;
+  // Optional more report transports, e.g. over other connections to
+  // Mixer. The batches are then spread over report_transport and these,
+  // see ReportOptions::channel_max_backoff_ms.
+  std::vector<TransportReportFunc> extra_report_transports;
 
   // Timer create function.
   // Usually there are some restrictions on timer_create_func.
@@ -66,6 +114,18 @@ struct Environment {
   // UUID generating function
   UUIDGenerateFunc uuid_generate_func;
 
+  // Optional sink the counters are pushed to.
+  std::shared_ptr<StatsSink> stats_sink;
+
+  // Optional capture of the sampled Check and Report calls of the client
+  // contexts, see traffic_capture.h.
+  std::shared_ptr<TrafficCapture> traffic_capture;
+
+  // THREAD_CONFINED if the client is only used by one thread, which runs
+  // all the transport callbacks and timers. It does not apply to the
+  // shared check and quota caches, which are always thread safe.
+  ThreadingModel threading_model = ThreadingModel::SHARED;
+
   // TODO: Add logging function here.
 };
 
@@ -16,13 +16,35 @@
 #ifndef ISTIO_MIXERCLIENT_OPTIONS_H
 #define ISTIO_MIXERCLIENT_OPTIONS_H
 
+#include <stdint.h>
 #include <memory>
 #include <set>
+#include <string>
 #include <vector>
 
 namespace istio {
 namespace mixerclient {
 
+// The check cache object, it is thread safe.
+class CheckCache;
+
+// The quota cache object, it is thread safe.
+class QuotaCache;
+
+// The report batch object, it is thread safe.
+class ReportBatch;
+
+// How the objects of a mixer client are used by threads.
+enum class ThreadingModel {
+  // Used by any thread, e.g. shared by multiple clients. Every access is
+  // guarded by mutexes.
+  SHARED,
+  // Only used by the thread of the client, and its transports and timers
+  // call back on the same thread, e.g. the client of an Envoy worker. No
+  // mutex is taken.
+  THREAD_CONFINED,
+};
+
 // Options controlling check behavior.
 struct CheckOptions {
   // Default constructor.
@@ -40,6 +62,127 @@ struct CheckOptions {
 
   // If true, Check is passed for any network failures.
   bool network_fail_open = true;
+
+  // If positive, denied check responses are cached for at most this
+  // many milliseconds, even if Mixer returns a longer valid_duration.
+  int negative_cache_ttl_ms = 0;
+
+  // If positive, while remote check calls are failing with network errors,
+  // expired cache items are still used with their last known status for
+  // at most this many milliseconds after they expired.
+  int stale_while_unavailable_ms = 0;
+
+  // The CheckOptions::refresh_ahead_fraction of the check cache.
+  double refresh_ahead_fraction = 0;
+
+  // The CheckOptions::overload_cache_fraction and
+  // ReportOptions::overload_sample_rate of an overloaded client.
+  double overload_cache_fraction = 0.5;
+  int overload_report_sample_rate = 10;
+
+  // The CheckOptions::max_bytes and QuotaOptions::max_bytes of the caches.
+  int64_t check_cache_max_bytes = 0;
+  int64_t quota_cache_max_bytes = 0;
+
+  // The QuotaOptions of the quota prefetch batching.
+  int quota_batch_window_ms = 0;
+  int max_batch_quotas = 16;
+
+  // The QuotaOptions::adaptive_prefetch of the quota cache.
+  bool adaptive_prefetch = false;
+
+  // The QuotaOptions::minimize_quota_requests of the quota prefetch calls.
+  bool minimize_quota_requests = false;
+
+  // The QuotaOptions::max_rejected_signatures of the quota cache.
+  int max_rejected_signatures = 1000;
+
+  // If in (0, 1), once a cache item has used this fraction of its
+  // valid_duration or valid_use_count, a cache hit will trigger one
+  // non-blocking remote check call to renew it before it expires.
+  double refresh_ahead_fraction = 0;
+
+  // If positive, the maximum bytes of check cache items. Items are evicted
+  // when either num_entries or max_bytes is reached.
+  int64_t max_bytes = 0;
+
+  // If not empty, the cache items are partitioned by the value of this
+  // attribute, e.g. "destination.service". When a shard is full, the least
+  // recently used items of the partitions holding more than an equal share
+  // of the shard are evicted first, so that a high cardinality partition
+  // can't evict the items of all the others.
+  std::string partition_attribute;
+
+  // If true, concurrent check cache misses with the same signature are
+  // coalesced into one remote check call, and share its response.
+  // Check calls with quotas are never coalesced.
+  bool coalesce_misses = true;
+
+  // If not empty, the check cache is preloaded from this file when it is
+  // created, and its learned Referenced shapes and unexpired items are
+  // saved to it when it is destroyed. It lets a restarted proxy start
+  // with a warm cache instead of a burst of remote check calls. Each cache
+  // needs its own file.
+  std::string snapshot_file;
+
+  // If > 0, the snapshot is also saved every this many milliseconds, not
+  // to lose it to a crash. The clients using the cache take turns, only
+  // one of them saves it each interval.
+  int snapshot_interval_ms = 60000;
+
+  // If not empty, the check cache misses are looked up in the node check
+  // cache mapped from this file, shared by all the proxies of the node,
+  // and the denied remote check responses are stored in it. Any proxy of
+  // the node can write the file, so OK responses are never shared through
+  // it. It is created with node_cache_entries entries if it doesn't
+  // exist. Only the responses cached with the same node_cache_config_id,
+  // e.g. of the same mesh config and Mixer cluster, are used.
+  std::string node_cache_file;
+  int node_cache_entries = 65536;
+  std::string node_cache_config_id;
+
+  // Number of shards of the check cache. Each shard has its own lock, so
+  // lookups for different signatures don't serialize each other.
+  // It is useful for a cache shared by multiple threads.
+  int num_shards = 1;
+
+  // If in (0, 100), a remote check call that has not returned after this
+  // percentile of the recent round trip times is hedged: the request is
+  // sent again with the same deduplication_id, and the first response is
+  // used.
+  int hedge_percentile = 0;
+
+  // The minimum delay before a remote check call is hedged.
+  int hedge_min_delay_ms = 1;
+
+  // The circuit breaker of the remote check calls. It opens after
+  // breaker_consecutive_failures transport failures in a row, if positive,
+  // or once breaker_error_percent of breaker_window_calls calls failed, if
+  // in (0, 100]. While it is open, the checks missing the cache are
+  // answered at once as for a network failure, by network_fail_open. After
+  // breaker_cooldown_ms, one probe call at a time is made until one
+  // succeeds. Disabled by default.
+  int breaker_consecutive_failures = 0;
+  int breaker_error_percent = 0;
+  int breaker_window_calls = 100;
+  int breaker_cooldown_ms = 5000;
+
+  // If positive, expired check cache items are removed in the background
+  // every this many milliseconds, at most sweep_max_items items visited
+  // each time. It requires a timer in the environment.
+  int sweep_interval_ms = 0;
+  int sweep_max_items = 1000;
+
+  // When the client becomes overloaded, see MixerClient::SetOverloaded(),
+  // the least recently used cache items are evicted until each shard holds
+  // at most this fraction of its capacity.
+  double overload_cache_fraction = 0.5;
+
+  // If set, this check cache is used instead of creating a new one.
+  // It is created by CreateSharedCheckCache() and can be shared by
+  // multiple MixerClient objects, e.g. by all Envoy worker threads.
+  // If not set, each MixerClient object has its own check cache.
+  std::shared_ptr<CheckCache> shared_cache;
 };
 
 // Options controlling report batch.
@@ -58,6 +201,110 @@ struct ReportOptions {
 
   // Maximum milliseconds a report item stayed in the buffer for batching.
   const int max_batch_time_ms;
+
+  // If > 0, a batch is flushed once its encoded reports take this many
+  // bytes, even if the in-flight window is full.
+  int64_t max_batch_bytes = 0;
+
+  // Maximum number of batches open at the same time. A report without
+  // some attributes of the last report in a batch can not be delta
+  // encoded onto it. With several open batches, reports with the same
+  // attribute names go to the same batch instead of flushing each other's
+  // batches. The oldest batch is flushed to open a new one.
+  int max_open_batches = 1;
+
+  // If > 0, reports are queued as they are and compressed into the batch
+  // by a separate stage, run from a timer, so the reporting thread never
+  // waits for a batch to be compressed or sent. The stage also runs once
+  // this many reports are queued.
+  int pipeline_queue_size = 0;
+
+  // If > 0, at most this many remote report calls are in flight. While
+  // they are, reports keep merging into the current batch, which may grow
+  // past max_batch_entries, and finished batches are held.
+  int max_inflight_batches = 0;
+
+  // If > 0, reports are dropped while the in-flight window is full and
+  // the batched and held reports take this many bytes.
+  int64_t max_buffered_bytes = 0;
+
+  // If > 1, only one in this many reports is kept while the in-flight
+  // window is full.
+  int overflow_sample_rate = 0;
+
+  // While the client is overloaded, see MixerClient::SetOverloaded(), only
+  // one in this many reports is kept. If <= 1, none is dropped.
+  int overload_sample_rate = 10;
+
+  // If not empty, reports with the same values of these attributes are
+  // folded into one report until the batch is flushed. A folded report
+  // only has these attributes and the summed ones.
+  std::vector<std::string> aggregation_keys;
+
+  // The int64 and duration attributes summed in a folded report.
+  std::vector<std::string> aggregation_sums;
+
+  // If not empty, the int64 attribute set to the number of reports folded
+  // into a folded report.
+  std::string aggregation_count_attribute;
+
+  // If > 0, one in this many folded reports is also sent in full.
+  int full_report_sample_rate = 0;
+
+  // If not empty, the report batches not acknowledged by Mixer when a
+  // shutdown drain ends, see MixerClient::DrainReports(), are appended to
+  // this file instead of being sent through a transport being torn down.
+  // The next client created with the file claims it, at construction or at
+  // a flush until it claimed one, and sends them, e.g. the one of the new
+  // process of a hot restart. Each client needs its own file.
+  std::string spill_file;
+
+  // If not empty, the report batches failed by a transport error are
+  // appended to a ring of spill_ring_bytes mapped from this file, instead
+  // of being dropped, as are the held batches once max_buffered_bytes is
+  // reached. After a failure, the batches are spilled without a call for a
+  // back-off starting at channel_initial_backoff_ms and doubling up to
+  // channel_max_backoff_ms. The spilled batches are sent again, at most
+  // spill_drain_batches_per_second, once the back-off ends. The ring
+  // survives a restart, the oldest batches are dropped once it is full.
+  // Each client needs its own file. A file still locked by another client,
+  // e.g. of the old process of a hot restart, is opened by a later flush.
+  // It requires a timer in the environment.
+  std::string spill_ring_file;
+  int64_t spill_ring_bytes = 64 * 1024 * 1024;
+  int spill_drain_batches_per_second = 10;
+
+  // With Environment::extra_report_transports, each transport is a
+  // channel the batches are spread over in turn. A channel whose call
+  // fails is skipped for a back-off starting at channel_initial_backoff_ms
+  // and doubling up to channel_max_backoff_ms, until a call succeeds.
+  int channel_initial_backoff_ms = 100;
+  int channel_max_backoff_ms = 10000;
+
+  // If > 0, the string, bytes and string map values of the reports are
+  // cut to this many bytes, followed by "...", so that a few long values
+  // such as user agents or JWT claims don't blow up the batches.
+  int max_attribute_value_bytes = 0;
+
+  // If > 0, the batching adapts to the load to send about this many remote
+  // report calls per second. The batch window is 1000 / this many
+  // milliseconds, widened to the observed transport latency, and the
+  // entry cap is the observed report rate divided by this rate, also
+  // bounded by target_batch_bytes if > 0. max_batch_time_ms and
+  // max_batch_entries stay the upper bounds, min_batch_time_ms the lower
+  // bound of the window. So reports sit little at low traffic, while high
+  // traffic is sent in few large batches.
+  int target_report_calls_per_second = 0;
+  int64_t target_batch_bytes = 0;
+  int min_batch_time_ms = 10;
+
+  // If not nullptr, the reports are batched by this shared batch, and the
+  // other report options are not used. It is created by
+  // CreateSharedReportBatch() and can be shared by the MixerClient objects
+  // of a thread reporting to the same Mixer, so that they fill the same
+  // batches. These objects only count their own report calls, see
+  // GetReportBatchStatistics().
+  std::shared_ptr<ReportBatch> shared_batch;
 };
 
 // Options controlling quota behavior.
@@ -78,6 +325,94 @@ struct QuotaOptions {
 
   // Maximum milliseconds before an idle cached quota should be deleted.
   const int expiration_ms;
+
+  // If positive, the cache is limited by the bytes of its items instead
+  // of num_entries.
+  int64_t max_bytes = 0;
+
+  // If positive, non-blocking quota prefetch calls from different requests
+  // are batched into one remote check call for at most this many
+  // milliseconds. It requires a timer in the environment.
+  int batch_window_ms = 0;
+
+  // Maximum number of quotas in one batched quota prefetch call.
+  int max_batch_quotas = 16;
+
+  // If true, a non-blocking quota prefetch call only sends the attributes
+  // referenced by its quotas, if they are all known from cached items.
+  bool minimize_quota_requests = false;
+
+  // If true, quota prefetch amounts are scaled to the observed latency of
+  // quota allocations instead of a fixed one second window.
+  bool adaptive_prefetch = false;
+
+  // Number of shards of the quota cache. Each shard has its own lock and
+  // holds the quotas whose names hash to it.
+  int num_shards = 1;
+
+  // If positive, idle quota cache items are removed in the background
+  // every this many milliseconds, at most sweep_max_items items visited
+  // in each shard each time. It requires a timer in the environment.
+  int sweep_interval_ms = 0;
+  int sweep_max_items = 1000;
+
+  // A quota rejected by Mixer with a zero grant and a valid duration is
+  // rejected locally for that duration, for the attributes it referenced,
+  // even without a cache item, e.g. for a cold key or if the cache is not
+  // used. At most this many rejected signatures are kept, none if 0.
+  int max_rejected_signatures = 1000;
+
+  // If set, this quota cache is used instead of creating a new one.
+  // It is created by CreateSharedQuotaCache() and can be shared by
+  // multiple MixerClient objects, so they draw from one prefetched pool
+  // per quota key instead of prefetching independently.
+  std::shared_ptr<QuotaCache> shared_cache;
+};
+
+// The options of a mixer client set by the proxy, e.g. from Envoy runtime
+// keys, on top of the ones the control library derives from the transport
+// config. See CheckOptions for their meaning.
+struct ClientTuning {
+  // The CheckOptions of check hedging.
+  int hedge_percentile = 0;
+  int hedge_min_delay_ms = 1;
+
+  // The CheckOptions of the check circuit breaker.
+  int breaker_consecutive_failures = 0;
+  int breaker_error_percent = 0;
+  int breaker_window_calls = 100;
+  int breaker_cooldown_ms = 5000;
+
+  // The CheckOptions::partition_attribute of the check cache.
+  std::string check_partition_attribute;
+
+  // The CheckOptions of the negative and stale-while-unavailable tiers of
+  // the check cache.
+  int negative_cache_ttl_ms = 0;
+  int stale_while_unavailable_ms = 0;
+
+  // The ReportOptions::spill_ring_file of the report spill ring.
+  std::string spill_ring_file;
+
+  // The ReportOptions::pipeline_queue_size of the report pipeline.
+  int report_pipeline_queue_size = 0;
+
+  // The ReportOptions of the in-flight report window.
+  int report_max_inflight_batches = 0;
+  int64_t report_max_buffered_bytes = 0;
+  int report_overflow_sample_rate = 0;
+
+  // The ReportOptions::max_batch_bytes of the report batches.
+  int64_t report_max_batch_bytes = 0;
+
+  // The ReportOptions::max_open_batches of the report batches.
+  int report_max_open_batches = 1;
+
+  // The ReportOptions of the report aggregation.
+  std::vector<std::string> report_aggregation_keys;
+  std::vector<std::string> report_aggregation_sums;
+  std::string report_aggregation_count_attribute;
+  int report_full_sample_rate = 0;
 };
 
 }  // namespace mixerclient
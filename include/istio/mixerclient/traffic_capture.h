@@ -0,0 +1,97 @@
+/* Copyright 2018 Istio Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ISTIO_MIXERCLIENT_TRAFFIC_CAPTURE_H
+#define ISTIO_MIXERCLIENT_TRAFFIC_CAPTURE_H
+
+#include "include/istio/quota_config/requirement.h"
+#include "mixer/v1/attributes.pb.h"
+
+#include <stdint.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace istio {
+namespace mixerclient {
+
+// The options of a traffic capture.
+struct TrafficCaptureOptions {
+  // The file the records are written to, it is truncated.
+  std::string file;
+
+  // Captures one of every sample_every calls, all of them if 1.
+  uint32_t sample_every{100};
+
+  // The maximum number of records queued for the writer thread, the
+  // records captured while it is full are dropped.
+  uint32_t max_pending_records{4096};
+
+  // The maximum number of records written, the capture stops after them.
+  uint64_t max_records{1000000};
+};
+
+// The type of a captured call.
+enum class TrafficCaptureType {
+  CHECK = 1,
+  REPORT = 2,
+};
+
+// A captured call.
+struct TrafficCaptureRecord {
+  TrafficCaptureType type;
+  // The microseconds since the capture was started.
+  uint64_t time_us;
+  ::istio::mixer::v1::Attributes attributes;
+  // The quotas of a Check call.
+  std::vector<::istio::quota_config::Requirement> quotas;
+};
+
+// Captures the attributes of sampled Check and Report calls to a file, to
+// reproduce their performance offline with the traffic_replay tool.
+// Capture() only serializes the sampled calls and queues them, they are
+// written by a background thread. The file is a header followed by
+// length-prefixed records in host byte order, it is meant to be replayed
+// on a machine of the same architecture.
+class TrafficCapture {
+ public:
+  virtual ~TrafficCapture() {}
+
+  // Captures a call if it is sampled. It is thread safe and never blocks
+  // on the file.
+  virtual void Capture(
+      TrafficCaptureType type, const ::istio::mixer::v1::Attributes& attributes,
+      const std::vector<::istio::quota_config::Requirement>& quotas) = 0;
+
+  // The number of records written and dropped.
+  virtual uint64_t written_records() const = 0;
+  virtual uint64_t dropped_records() const = 0;
+};
+
+// Creates a traffic capture writing to options.file. Returns nullptr if the
+// file cannot be opened. The queued records are written when it is
+// destroyed.
+std::shared_ptr<TrafficCapture> CreateTrafficCapture(
+    const TrafficCaptureOptions& options);
+
+// Reads the records of a capture file. Returns false if the file cannot be
+// read or a record is truncated, the records before it are kept.
+bool ReadTrafficCapture(const std::string& file,
+                        std::vector<TrafficCaptureRecord>* records);
+
+}  // namespace mixerclient
+}  // namespace istio
+
+#endif  // ISTIO_MIXERCLIENT_TRAFFIC_CAPTURE_H
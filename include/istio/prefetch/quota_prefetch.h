@@ -16,9 +16,11 @@
 #ifndef ISTIO_PREFETCH_QUOTA_PREFETCH_H_
 #define ISTIO_PREFETCH_QUOTA_PREFETCH_H_
 
+#include <stdint.h>
 #include <chrono>
 #include <functional>
 #include <memory>
+#include <string>
 
 namespace istio {
 namespace prefetch {
@@ -45,10 +47,62 @@ class QuotaPrefetch {
     // negative. (Its request amount is not granted).
     std::chrono::milliseconds close_wait_window;
 
+    // If true, the prefetch amount is scaled to the observed latency of
+    // quota allocations instead of the predict window. A prefetch is made
+    // when the available amount only covers the requests in rtt *
+    // rtt_safety_factor.
+    bool adaptive;
+
+    // The number of round trips the available amount should cover.
+    double rtt_safety_factor;
+
+    // The maximum window the prefetch amount is scaled to.
+    std::chrono::milliseconds max_adaptive_window;
+
+    // The number of the latest prefetch events kept for DumpTrace().
+    // Tracing is disabled if it is 0.
+    int trace_size;
+
+    // If false, the prefetch is only used by one thread, including its
+    // transport callbacks, and takes no mutex.
+    bool thread_safe;
+
     // Constructor with default values.
     Options();
   };
 
+  // The current estimates of the prefetch.
+  struct Stats {
+    // The smoothed latency of quota allocations, 0 before any response.
+    std::chrono::milliseconds rtt;
+
+    // The window the prefetch amount covers.
+    std::chrono::milliseconds predict_window;
+
+    // The amount of the last prefetch.
+    int last_prefetch_amount;
+
+    // The current number of slots in the prefetch queue.
+    int queue_depth;
+
+    // The number of prefetch calls.
+    uint64_t prefetch_calls;
+    // The total amount granted by the server.
+    uint64_t granted_amount;
+    // The total amount passed to checks.
+    uint64_t used_amount;
+    // The total amount expired before it was used.
+    uint64_t expired_amount;
+
+    // The number of checks made while a prefetch was in flight, and the
+    // number of them rejected, i.e. the prefetch came too late.
+    uint64_t inflight_checks;
+    uint64_t inflight_rejections;
+
+    // The total time in the close mode, as of the last mode change.
+    std::chrono::milliseconds close_time;
+  };
+
   // Define the transport.
   // The callback function after quota allocation is done from the server.
   // Set amount = -1 If there are any network failures.
@@ -67,6 +121,15 @@ class QuotaPrefetch {
 
   // Perform a quota check with the amount. Return true if granted.
   virtual bool Check(int amount, Tick t) = 0;
+
+  // Returns the approximate memory size of the object in bytes.
+  virtual size_t ByteSize() = 0;
+
+  // Gets the current estimates.
+  virtual void GetStats(Stats* stats) = 0;
+
+  // Returns the traced prefetch events, one per line, the oldest first.
+  virtual std::string DumpTrace() = 0;
 };
 
 }  // namespace prefetch
@@ -35,6 +35,14 @@ class ConfigParser {
   virtual void GetRequirements(const ::istio::mixer::v1::Attributes& attributes,
                                std::vector<Requirement>* results) const = 0;
 
+  // If all the rules apply to all requests, i.e. have no match, adds their
+  // requirements and returns true. Otherwise returns false and adds none,
+  // the requirements depend on the attributes.
+  virtual bool GetUnconditionalRequirements(
+      std::vector<Requirement>* results) const {
+    return false;
+  }
+
   // The factory function to create a new instance of the parser.
   static std::unique_ptr<ConfigParser> Create(
       const ::istio::mixer::v1::config::client::QuotaSpec& spec_pb);
@@ -0,0 +1,99 @@
+/* Copyright 2018 Istio Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ISTIO_UTILS_ALLOC_ACCOUNTING_H_
+#define ISTIO_UTILS_ALLOC_ACCOUNTING_H_
+
+#include <stdint.h>
+
+namespace istio {
+namespace utils {
+
+// Heap allocation accounting per subsystem: the allocations of each thread
+// are counted by the tag of its innermost ScopedAllocTag. It is only built
+// with one of the allocators:
+//   bazel build --define alloc_accounting=tcmalloc
+// counts them with a tcmalloc new hook, with the default allocator of
+// Envoy, and
+//   bazel build --define alloc_accounting=enabled --define tcmalloc=disabled
+// replaces the global operator new to count them on top of the libc
+// malloc. tcmalloc has to be disabled there since it replaces operator new
+// as well. In default builds, ScopedAllocTag is empty and all stats are
+// zero.
+
+// The subsystems whose allocations are accounted.
+enum class AllocTag {
+  UNTAGGED = 0,
+  MIXER_CHECK,
+  MIXER_REPORT,
+  JWT_VERIFY,
+  AUTHN,
+};
+const int kNumAllocTags = 5;
+
+// The allocation stats of a tag.
+struct AllocStats {
+  // The number of scopes entered with the tag, e.g. requests.
+  uint64_t scopes;
+  // The number of allocations and their requested bytes.
+  uint64_t allocations;
+  uint64_t bytes;
+};
+
+#ifdef ISTIO_ALLOC_ACCOUNTING
+
+// Tags the allocations of the calling thread until it is destroyed,
+// including the ones of the callbacks called in the scope.
+class ScopedAllocTag {
+ public:
+  explicit ScopedAllocTag(AllocTag tag);
+  ~ScopedAllocTag();
+
+ private:
+  AllocTag prev_;
+};
+
+// Gets the allocation stats of the calling thread for a tag.
+void GetThreadAllocStats(AllocTag tag, AllocStats* stats);
+
+#else
+
+class ScopedAllocTag {
+ public:
+  explicit ScopedAllocTag(AllocTag tag) {}
+};
+
+inline void GetThreadAllocStats(AllocTag tag, AllocStats* stats) {
+  *stats = AllocStats();
+}
+
+#endif  // ISTIO_ALLOC_ACCOUNTING
+
+// Gets the allocations and bytes of the calling thread for all the tags,
+// e.g. to count the allocations of a benchmark whatever its code is tagged.
+inline void GetThreadTotalAllocStats(AllocStats* stats) {
+  *stats = AllocStats();
+  for (int i = 0; i < kNumAllocTags; ++i) {
+    AllocStats tag_stats;
+    GetThreadAllocStats(static_cast<AllocTag>(i), &tag_stats);
+    stats->allocations += tag_stats.allocations;
+    stats->bytes += tag_stats.bytes;
+  }
+}
+
+}  // namespace utils
+}  // namespace istio
+
+#endif  // ISTIO_UTILS_ALLOC_ACCOUNTING_H_
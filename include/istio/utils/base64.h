@@ -0,0 +1,41 @@
+/* Copyright 2018 Istio Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ISTIO_UTILS_BASE64_H_
+#define ISTIO_UTILS_BASE64_H_
+
+#include <string>
+
+#include "absl/strings/string_view.h"
+
+namespace istio {
+namespace utils {
+
+// Encodes data with the standard base64 alphabet and padding, the same as
+// Envoy's Base64::encode.
+std::string Base64Encode(absl::string_view data);
+
+// Decodes standard base64 with padding into output, replacing its content
+// so that a reused output keeps its capacity. Returns false with an empty
+// output if data is not valid, the same as Envoy's Base64::decode.
+bool Base64Decode(absl::string_view data, std::string* output);
+
+// Decodes base64url with or without padding into output, the same way.
+bool Base64UrlDecode(absl::string_view data, std::string* output);
+
+}  // namespace utils
+}  // namespace istio
+
+#endif  // ISTIO_UTILS_BASE64_H_
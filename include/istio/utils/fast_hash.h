@@ -0,0 +1,100 @@
+/* Copyright 2017 Istio Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ISTIO_UTILS_FAST_HASH_H_
+#define ISTIO_UTILS_FAST_HASH_H_
+
+#include <stdint.h>
+#include <string.h>
+#include <string>
+
+namespace istio {
+namespace utils {
+
+// A fast non-cryptographic 128 bit hash, MurmurHash3_x64_128.
+// It has the same interface as MD5, but the digest is a POD Key
+// which can be used as a hash map key without heap allocation.
+class FastHash {
+ public:
+  // The 128 bit digest.
+  struct Key {
+    uint64_t high;
+    uint64_t low;
+
+    bool operator==(const Key& b) const {
+      return high == b.high && low == b.low;
+    }
+    bool operator!=(const Key& b) const { return !(*this == b); }
+  };
+
+  // A hash functor for Key to be used by hash maps.
+  struct KeyHash {
+    size_t operator()(const Key& key) const {
+      return static_cast<size_t>(key.low ^ (key.high * 31));
+    }
+  };
+
+  FastHash();
+
+  // Updates the context with data.
+  FastHash& Update(const void* data, size_t size);
+
+  // A helper function for const char*
+  FastHash& Update(const char* str) { return Update(str, strlen(str)); }
+
+  // A helper function for const string
+  FastHash& Update(const std::string& str) {
+    return Update(str.data(), str.size());
+  }
+
+  // A helper function for int
+  FastHash& Update(int d) { return Update(&d, sizeof(d)); }
+
+  // Returns the digest.
+  Key Digest();
+
+  // A short form of generating the hash for a string
+  Key operator()(const void* data, size_t size);
+
+  // Converts a digest to a printable string.
+  // It is for debugging and unit-test only.
+  static std::string DebugString(const Key& digest);
+
+ private:
+  // Processes one 16 bytes block.
+  void ProcessBlock(const uint8_t* block);
+
+  // The block size of the hash function.
+  static const int kBlockSize = 16;
+
+  // The hash state.
+  uint64_t h1_;
+  uint64_t h2_;
+  // The total number of bytes.
+  uint64_t length_;
+  // The buffer for the partial block.
+  uint8_t buffer_[kBlockSize];
+  // The number of bytes in the buffer.
+  size_t buffer_size_;
+  // The final digest.
+  Key digest_;
+  // A flag to indicate if the digest is finalized.
+  bool finalized_;
+};
+
+}  // namespace utils
+}  // namespace istio
+
+#endif  // ISTIO_UTILS_FAST_HASH_H_
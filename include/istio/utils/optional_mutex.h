@@ -0,0 +1,71 @@
+/* Copyright 2018 Istio Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ISTIO_UTILS_OPTIONAL_MUTEX_H_
+#define ISTIO_UTILS_OPTIONAL_MUTEX_H_
+
+namespace istio {
+namespace utils {
+
+// A Mutex, std::mutex or std::shared_timed_mutex, which is only taken if
+// the object it guards is used by multiple threads. An object confined to
+// one thread disables it once, before it is used, and then every lock
+// costs a predictable branch instead of two atomic operations. It is a
+// drop-in for the standard lock guards.
+template <class Mutex>
+class OptionalMutex {
+ public:
+  OptionalMutex() : enabled_(true) {}
+
+  // Enables or disables the mutex. It must not be locked.
+  void set_enabled(bool enabled) { enabled_ = enabled; }
+  bool enabled() const { return enabled_; }
+
+  void lock() {
+    if (enabled_) {
+      mutex_.lock();
+    }
+  }
+  bool try_lock() { return !enabled_ || mutex_.try_lock(); }
+  void unlock() {
+    if (enabled_) {
+      mutex_.unlock();
+    }
+  }
+
+  // Only for a shared Mutex.
+  void lock_shared() {
+    if (enabled_) {
+      mutex_.lock_shared();
+    }
+  }
+  void unlock_shared() {
+    if (enabled_) {
+      mutex_.unlock_shared();
+    }
+  }
+
+ private:
+  bool enabled_;
+  Mutex mutex_;
+
+  OptionalMutex(const OptionalMutex&) = delete;
+  OptionalMutex& operator=(const OptionalMutex&) = delete;
+};
+
+}  // namespace utils
+}  // namespace istio
+
+#endif  // ISTIO_UTILS_OPTIONAL_MUTEX_H_
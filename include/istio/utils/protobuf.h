@@ -17,10 +17,12 @@
 #define ISTIO_UTILS_PROTOBUF_H_
 
 #include "google/protobuf/duration.pb.h"
+#include "google/protobuf/message_lite.h"
 #include "google/protobuf/stubs/status.h"
 #include "google/protobuf/timestamp.pb.h"
 
 #include <chrono>
+#include <string>
 
 namespace istio {
 namespace utils {
@@ -38,6 +40,11 @@ std::chrono::milliseconds ToMilliseonds(
 
 bool InvalidDictionaryStatus(const ::google::protobuf::util::Status& status);
 
+// Serializes a message with the map entries in a stable order, so messages
+// with the same content have the same serialization.
+std::string SerializeDeterministic(
+    const ::google::protobuf::MessageLite& message);
+
 }  // namespace utils
 }  // namespace istio
 
@@ -0,0 +1,395 @@
+/* Copyright 2017 Istio Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// A concurrent LRU cache that maps from type Key to Value*.
+//
+// . Keys are spread over independently locked shards by their hash. Each
+//   shard holds its part of the total units with its own eviction list, so
+//   the eviction order is only LRU within a shard.
+//
+// . The API follows SimpleLRUCache: ScopedLookup pins a value until it
+//   goes out of scope, Insert takes the ownership of a value, and Remove
+//   defers the deletion of a pinned value until it is released. A pinned
+//   value is not locked; concurrent users of the same value have to
+//   synchronize their access to it.
+//
+// . A lookup hit takes the exclusive lock of its shard to move the entry
+//   to the front of the list. With approximate recency, a hit only takes
+//   the shared lock and marks the entry as referenced. Eviction then works
+//   CLOCK-style: a referenced entry at the end of the list is moved to the
+//   front once instead of being evicted.
+//
+// . SetMaxIdleSeconds() and SetAgeBasedEviction() work as in
+//   SimpleLRUCache. An expired entry is a miss on lookup, and is removed by
+//   the next Insert() into its shard or by RemoveExpiredEntries().
+//
+// . Pinned entries are never evicted for space, so a shard can be overfull
+//   until the next Insert() after they are released.
+
+#ifndef ISTIO_UTILS_SHARDED_LRU_CACHE_H_
+#define ISTIO_UTILS_SHARDED_LRU_CACHE_H_
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cmath>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "simple_lru_cache_inl.h"
+
+namespace istio {
+namespace utils {
+
+template <typename Key, typename Value, typename H = std::hash<Key>,
+          typename EQ = std::equal_to<Key> >
+class ShardedLRUCache {
+ private:
+  struct Elem;
+
+ public:
+  // The default number of shards.
+  static const int kDefaultNumShards = 16;
+
+  // Automatically releases a looked up value when it goes out of scope.
+  // Example:
+  //   ShardedLRUCache<...>::ScopedLookup lookup(&cache, key);
+  //   if (lookup.Found()) {
+  //     ...
+  //
+  // Unlike SimpleLRUCache, no lock is held by the caller: the lookup and
+  // the release lock the shard by themselves.
+  class ScopedLookup {
+   public:
+    ScopedLookup(ShardedLRUCache* cache, const Key& key)
+        : cache_(cache), elem_(cache->Lookup(key)) {}
+
+    ~ScopedLookup() {
+      if (elem_ != nullptr) cache_->Release(elem_);
+    }
+    Value* value() const { return elem_ ? elem_->value : nullptr; }
+    bool Found() const { return elem_ != nullptr; }
+
+   private:
+    ShardedLRUCache* const cache_;
+    Elem* const elem_;
+
+    GOOGLE_DISALLOW_EVIL_CONSTRUCTORS(ScopedLookup);
+  };
+
+  // Create a cache that will hold up to the specified number of units over
+  // num_shards shards. If approximate_recency is true, lookup hits don't
+  // reorder the eviction list; see the comment at the top of the file.
+  explicit ShardedLRUCache(int64_t total_units,
+                           int num_shards = kDefaultNumShards,
+                           bool approximate_recency = false)
+      : max_idle_(-1), lru_(true), approximate_recency_(approximate_recency) {
+    num_shards = static_cast<int>(
+        std::max<int64_t>(1, std::min<int64_t>(num_shards, total_units)));
+    for (int i = 0; i < num_shards; ++i) {
+      shards_.emplace_back(new Shard(total_units / num_shards));
+    }
+  }
+
+  // Deletes all values. No value may be pinned.
+  ~ShardedLRUCache() {
+    for (auto& shard : shards_) {
+      for (const auto& it : shard->table) {
+        assert(it.second->pin.load() == 0);
+        delete it.second->value;
+        delete it.second;
+      }
+    }
+  }
+
+  // Change the max idle time to the specified number of seconds. If
+  // "seconds" is a negative number, it sets the max idle time to infinity.
+  // Not thread safe: call it before the cache is shared.
+  void SetMaxIdleSeconds(double seconds) { SetTimeout(seconds, true); }
+
+  // Stop using the LRU eviction policy and instead expire anything that
+  // has been in the cache for more than the specified number of seconds.
+  // Lookups in this mode always take the shared lock.
+  // Not thread safe: call it before the cache is shared.
+  void SetAgeBasedEviction(double seconds) { SetTimeout(seconds, false); }
+
+  // Insert the specified "k,value" pair in the cache, taking the ownership
+  // of value. Any old entry for "k" is removed. Expired entries and, if the
+  // shard is overfull, the least recently used unpinned ones are evicted.
+  void Insert(const Key& k, Value* value, size_t units) {
+    Shard* shard = GetShard(k);
+    const int64_t now = SimpleCycleTimer::Now();
+    std::lock_guard<std::shared_timed_mutex> lock(shard->mutex);
+    auto it = shard->table.find(k);
+    if (it != shard->table.end()) {
+      Remove(shard, it->second);
+    }
+    Elem* e = new Elem(k, value, units, now);
+    e->Link(&shard->head);
+    shard->table.emplace(k, e);
+    shard->units += units;
+    Evict(shard, now);
+  }
+
+  // Remove any entry corresponding to "k" from the cache. A pinned entry
+  // disappears from further lookups, but is deleted when it is released.
+  void Remove(const Key& k) {
+    Shard* shard = GetShard(k);
+    std::lock_guard<std::shared_timed_mutex> lock(shard->mutex);
+    auto it = shard->table.find(k);
+    if (it != shard->table.end()) {
+      Remove(shard, it->second);
+    }
+  }
+
+  // Removes all entries from the cache, deferring the pinned ones.
+  void RemoveAll() {
+    for (auto& shard : shards_) {
+      std::lock_guard<std::shared_timed_mutex> lock(shard->mutex);
+      while (shard->head.next != &shard->head) {
+        Remove(shard.get(), shard->head.next);
+      }
+    }
+  }
+
+  // Remove all entries which have exceeded their max idle time or age.
+  void RemoveExpiredEntries() {
+    if (max_idle_ < 0) return;
+    const int64_t now = SimpleCycleTimer::Now();
+    for (auto& shard : shards_) {
+      std::lock_guard<std::shared_timed_mutex> lock(shard->mutex);
+      Elem* e = shard->head.prev;
+      while (e != &shard->head) {
+        Elem* prev = e->prev;
+        if (IsExpired(e, now)) {
+          Remove(shard.get(), e);
+        }
+        e = prev;
+      }
+    }
+  }
+
+  // Return the current size of the cache.
+  int64_t Size() const {
+    int64_t units = 0;
+    for (const auto& shard : shards_) {
+      std::shared_lock<std::shared_timed_mutex> lock(shard->mutex);
+      units += shard->units;
+    }
+    return units;
+  }
+
+  // Return the number of entries in the cache.
+  int64_t Entries() const {
+    int64_t entries = 0;
+    for (const auto& shard : shards_) {
+      std::shared_lock<std::shared_timed_mutex> lock(shard->mutex);
+      entries += shard->table.size();
+    }
+    return entries;
+  }
+
+  // Return the number of shards.
+  int NumShards() const { return shards_.size(); }
+
+ private:
+  struct Elem {
+    Elem(const Key& k, Value* v, size_t u, int64_t now)
+        : key(k),
+          value(v),
+          units(u),
+          pin(0),
+          referenced(false),
+          last_use(now),
+          removed(false),
+          next(this),
+          prev(this) {}
+
+    void Unlink() {
+      next->prev = prev;
+      prev->next = next;
+      next = prev = this;
+    }
+
+    void Link(Elem* head) {
+      next = head->next;
+      prev = head;
+      next->prev = this;
+      head->next = this;
+    }
+
+    const Key key;
+    Value* const value;
+    const size_t units;
+    // The pin count. Changed with at least the shared lock held, and only
+    // read to decide on a removal with the exclusive lock held.
+    std::atomic<int> pin;
+    // Set by a lookup hit with approximate recency.
+    std::atomic<bool> referenced;
+    // The time of last use in LRU mode, or of insertion in age-based mode.
+    std::atomic<int64_t> last_use;
+    // True once removed from the table while pinned, the last release
+    // deletes it. Set with the exclusive lock held.
+    bool removed;
+    // The eviction list, the most recently used first. Changed with the
+    // exclusive lock held.
+    Elem* next;
+    Elem* prev;
+  };
+
+  struct Shard {
+    Shard(int64_t max_units)
+        : head(Key(), nullptr, 0, 0), units(0), max_units(max_units) {}
+
+    // Guards the table and the list. Hits with approximate recency and
+    // releases take the shared lock.
+    mutable std::shared_timed_mutex mutex;
+    std::unordered_map<Key, Elem*, H, EQ> table;
+    // Dummy head of the eviction list.
+    Elem head;
+    // The combined units of the entries in the table.
+    int64_t units;
+    const int64_t max_units;
+  };
+
+  Shard* GetShard(const Key& k) const {
+    return shards_[H()(k) % shards_.size()].get();
+  }
+
+  bool IsExpired(const Elem* e, int64_t now) const {
+    return max_idle_ >= 0 && now - e->last_use.load() > max_idle_;
+  }
+
+  // Returns the pinned entry of k, or nullptr.
+  Elem* Lookup(const Key& k) {
+    Shard* shard = GetShard(k);
+    const int64_t now = SimpleCycleTimer::Now();
+    if (approximate_recency_ || !lru_) {
+      std::shared_lock<std::shared_timed_mutex> lock(shard->mutex);
+      auto it = shard->table.find(k);
+      if (it == shard->table.end() || IsExpired(it->second, now)) {
+        return nullptr;
+      }
+      Elem* e = it->second;
+      ++e->pin;
+      if (lru_) {
+        e->referenced.store(true, std::memory_order_relaxed);
+        e->last_use.store(now, std::memory_order_relaxed);
+      }
+      return e;
+    }
+
+    std::lock_guard<std::shared_timed_mutex> lock(shard->mutex);
+    auto it = shard->table.find(k);
+    if (it == shard->table.end() || IsExpired(it->second, now)) {
+      return nullptr;
+    }
+    Elem* e = it->second;
+    ++e->pin;
+    e->last_use.store(now, std::memory_order_relaxed);
+    e->Unlink();
+    e->Link(&shard->head);
+    return e;
+  }
+
+  // Releases an entry pinned by Lookup.
+  void Release(Elem* e) {
+    Shard* shard = GetShard(e->key);
+    std::shared_lock<std::shared_timed_mutex> lock(shard->mutex);
+    if (--e->pin == 0 && e->removed) {
+      // Removed from the table, nobody else can reach it.
+      delete e->value;
+      delete e;
+    }
+  }
+
+  // Removes an entry from the table and the list. Called with the
+  // exclusive lock held.
+  void Remove(Shard* shard, Elem* e) {
+    shard->table.erase(e->key);
+    e->Unlink();
+    shard->units -= e->units;
+    if (e->pin.load() == 0) {
+      delete e->value;
+      delete e;
+    } else {
+      e->removed = true;
+    }
+  }
+
+  // Evicts the expired entries from the end of the list, then unpinned
+  // entries until the shard is not overfull. A referenced entry gets a
+  // second chance at the front of the list. Called with the exclusive lock
+  // held.
+  void Evict(Shard* shard, int64_t now) {
+    Elem* const head = &shard->head;
+    while (head->prev != head && IsExpired(head->prev, now)) {
+      Remove(shard, head->prev);
+    }
+
+    // Each entry is visited at most twice, once before and once after its
+    // second chance.
+    size_t budget = 2 * shard->table.size();
+    Elem* e = head->prev;
+    while (shard->units > shard->max_units && e != head && budget-- > 0) {
+      Elem* prev = e->prev;
+      if (e->pin.load() == 0) {
+        if (e->referenced.exchange(false, std::memory_order_relaxed)) {
+          e->Unlink();
+          e->Link(head);
+        } else {
+          Remove(shard, e);
+        }
+      }
+      e = prev;
+    }
+  }
+
+  void SetTimeout(double seconds, bool lru) {
+    // Can't set both a max idle time and age-based eviction.
+    assert(max_idle_ < 0 || lru == lru_);
+    lru_ = lru;
+    if (seconds < 0 || std::isinf(seconds)) {
+      max_idle_ = -1;
+      return;
+    }
+    const double timeout_cycles = seconds * SimpleCycleTimer::Frequency();
+    if (timeout_cycles >= std::numeric_limits<int64_t>::max()) {
+      max_idle_ = std::numeric_limits<int64_t>::max();
+    } else {
+      max_idle_ = static_cast<int64_t>(timeout_cycles);
+    }
+  }
+
+  // Maximum number of idle cycles, or -1 for no expiration.
+  int64_t max_idle_;
+  // LRU or age-based eviction?
+  bool lru_;
+  // If true, lookup hits only mark the entries as referenced.
+  const bool approximate_recency_;
+  std::vector<std::unique_ptr<Shard>> shards_;
+
+  GOOGLE_DISALLOW_EVIL_CONSTRUCTORS(ShardedLRUCache);
+};
+
+}  // namespace utils
+}  // namespace istio
+
+#endif  // ISTIO_UTILS_SHARDED_LRU_CACHE_H_
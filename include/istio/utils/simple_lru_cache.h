@@ -28,6 +28,14 @@ namespace utils {
 namespace internal {
 template <typename T>
 struct SimpleLRUHash : public std::hash<T> {};
+
+// Own() returns the key stored by Insert() for the given key. A key type
+// which may refer to memory owned by the caller, like StringKey,
+// specializes it to return an owning copy.
+template <typename T>
+struct SimpleLRUKeyTraits {
+  static const T& Own(const T& key) { return key; }
+};
 }  // namespace internal
 
 template <typename Key, typename Value,
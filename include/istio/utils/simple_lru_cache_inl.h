@@ -41,6 +41,10 @@
 //
 // . We also provide support for a strict age-based eviction policy
 //   instead of LRU.  See SetAgeBasedEviction().
+//
+// . In LRU mode, the CLOCK and segmented LRU policies approximate LRU
+//   with a cheaper hit or a better resistance to scans.  See
+//   SimpleLRUEvictionPolicy.
 
 #ifndef ISTIO_UTILS_SIMPLE_LRU_CACHE_INL_H_
 #define ISTIO_UTILS_SIMPLE_LRU_CACHE_INL_H_
@@ -160,6 +164,8 @@ struct SimpleLRUCacheElem {
   SimpleLRUCacheElem* prev = nullptr;  // Prev entry in LRU chain
   int64_t last_use_;                   // Timestamp of last use (in LRU mode)
   //     or creation (in age-based mode)
+  bool referenced = false;    // Hit since last visited by CLOCK eviction
+  bool is_protected = false;  // In the protected segment of segmented LRU
 
   SimpleLRUCacheElem(const Key& k, Value* v, int p, size_t u, int64_t last_use)
       : key(k), value(v), pin(p), units(u), last_use_(last_use) {}
@@ -192,6 +198,23 @@ struct SimpleLRUCacheElem {
 template <typename Key, typename Value>
 const int64_t SimpleLRUCacheElem<Key, Value>::kNeverUsed;
 
+// The eviction policy of the LRU mode, set by SetEvictionPolicy().
+enum class SimpleLRUEvictionPolicy {
+  // Each hit moves the entry to the front of the list.
+  LRU,
+  // A hit only sets the reference bit of the entry, which keeps its
+  // position in the list.  Eviction moves a referenced entry to the front
+  // once and clears the bit, instead of evicting it.  Entries stay on the
+  // list while pinned.
+  CLOCK,
+  // New entries go to a probation segment, and move to a protected segment
+  // on their first hit.  The protected segment holds up to 80% of the
+  // units, its least recently used entries go back to probation.  Eviction
+  // takes the probation entries first, so a burst of one-off keys doesn't
+  // flush the entries used more than once.
+  SEGMENTED_LRU,
+};
+
 // A simple class passed into various cache methods to change the
 // behavior for that single call.
 class SimpleLRUCacheOptions {
@@ -318,6 +341,13 @@ class SimpleLRUCacheBase {
     SetTimeout(seconds, false /* lru */);
   }
 
+  // Change the eviction policy of the LRU mode.  The default is LRU.
+  // The cache must be empty.
+  void SetEvictionPolicy(SimpleLRUEvictionPolicy policy) {
+    assert(table_.empty());
+    policy_ = policy;
+  }
+
   // If cache contains an entry for "k", return a pointer to it.
   // Else return nullptr.
   //
@@ -412,6 +442,12 @@ class SimpleLRUCacheBase {
     if (max_idle_ >= 0) DiscardIdle(max_idle_);
   }
 
+  // Same as RemoveExpiredEntries(), but visits at most max_entries entries
+  // from the least recently used end, so that the work done with the cache
+  // lock held is bounded. Expired entries are removed a batch at a time by
+  // calling it periodically. Returns the number of removed entries.
+  int64_t SweepExpiredEntries(int64_t max_entries);
+
   // Return current size of cache
   int64_t Size() const { return units_; }
 
@@ -539,15 +575,43 @@ class SimpleLRUCacheBase {
   Elem head_;             // Dummy head of LRU list (next is mru elem)
   int64_t max_idle_;      // Maximum number of idle cycles
   bool lru_;              // LRU or age-based eviction?
+  SimpleLRUEvictionPolicy policy_;  // Eviction policy of the LRU mode
+  // Dummy head of the protected segment list, and the combined units of
+  // the protected elements, in segmented LRU.  head_ is the probation list.
+  Elem protected_head_;
+  int64_t protected_units_;
 
   // Representation invariants:
   // . LRU list is circular doubly-linked list
   // . Each live "Elem" is either in "table_" or "defer_"
   // . LRU list contains elements in "table_" that can be removed to free space
   // . Each "Elem" in "defer_" has a non-zero pin count
+  // . With the CLOCK policy, the LRU list also contains pinned elements
+  // . With the segmented LRU policy, elements with is_protected are in
+  //   "protected_head_" instead of the LRU list
+
+  // The protected units over which segmented LRU demotes elements.
+  int64_t MaxProtectedUnits() const { return max_units_ / 5 * 4; }
+
+  // Takes an element out of the protected segment accounting.
+  void Unprotect(Elem* e) {
+    if (e->is_protected) {
+      protected_units_ -= e->units;
+      e->is_protected = false;
+    }
+  }
+
+  // Links an unpinned element into the list of its segment.
+  void LinkUnpinned(Elem* e);
+
+  // Returns true if the LRU list is not sorted by last use.
+  bool ApproximateOrder() const {
+    return lru_ && policy_ != SimpleLRUEvictionPolicy::LRU;
+  }
 
   void Discard(Elem* e) {
     assert(e->pin == 0);
+    Unprotect(e);
     units_ -= e->units;
     RemoveElement(e->key, e->value);
     delete e;
@@ -561,7 +625,11 @@ class SimpleLRUCacheBase {
   bool InDeferredTable(const Key& k, const Value* value) const;
 
   void GarbageCollect();               // Discard to meet space constraints
+  void GarbageCollect(Elem* head);     // Same for the list of "head"
   void DiscardIdle(int64_t max_idle);  // Discard to meet idle-time constraints
+  void DiscardIdle(Elem* head, int64_t threshold);  // Same for a list
+  // Discards idle elements of a list, visiting at most max_visits of them.
+  int64_t SweepIdle(Elem* head, int64_t threshold, int64_t max_visits);
 
   void SetTimeout(double seconds, bool lru);
 
@@ -580,7 +648,8 @@ class SimpleLRUCacheBase {
 template <class Key, class Value, class MapType, class EQ>
 SimpleLRUCacheBase<Key, Value, MapType, EQ>::SimpleLRUCacheBase(
     int64_t total_units)
-    : head_(Key(), nullptr, 0, 0, Elem::kNeverUsed) {
+    : head_(Key(), nullptr, 0, 0, Elem::kNeverUsed),
+      protected_head_(Key(), nullptr, 0, 0, Elem::kNeverUsed) {
   units_ = 0;
   pinned_units_ = 0;
   max_units_ = total_units;
@@ -588,6 +657,10 @@ SimpleLRUCacheBase<Key, Value, MapType, EQ>::SimpleLRUCacheBase(
   head_.prev = &head_;
   max_idle_ = -1;  // Stands for "no expiration"
   lru_ = true;     // default to LRU, not age-based
+  policy_ = SimpleLRUEvictionPolicy::LRU;
+  protected_head_.next = &protected_head_;
+  protected_head_.prev = &protected_head_;
+  protected_units_ = 0;
 }
 
 template <class Key, class Value, class MapType, class EQ>
@@ -639,10 +712,12 @@ void SimpleLRUCacheBase<Key, Value, MapType, EQ>::RemoveAll() {
 
 template <class Key, class Value, class MapType, class EQ>
 void SimpleLRUCacheBase<Key, Value, MapType, EQ>::RemoveUnpinned() {
-  for (Elem* e = head_.next; e != &head_;) {
-    Elem* next = e->next;
-    if (e->pin == 0) Remove(e->key);
-    e = next;
+  for (Elem* head : {&head_, &protected_head_}) {
+    for (Elem* e = head->next; e != head;) {
+      Elem* next = e->next;
+      if (e->pin == 0) Remove(e->key);
+      e = next;
+    }
   }
 }
 
@@ -665,8 +740,11 @@ void SimpleLRUCacheBase<Key, Value, MapType, EQ>::Clear() {
   table_.clear();
   head_.next = &head_;
   head_.prev = &head_;
+  protected_head_.next = &protected_head_;
+  protected_head_.prev = &protected_head_;
   units_ = 0;
   pinned_units_ = 0;
+  protected_units_ = 0;
 }
 
 template <class Key, class Value, class MapType, class EQ>
@@ -678,11 +756,28 @@ Value* SimpleLRUCacheBase<Key, Value, MapType, EQ>::LookupWithOptions(
   if (iter != table_.end()) {
     // We set last_use_ upon Release, not during Lookup.
     Elem* e = iter->second;
+    if (ApproximateOrder() && max_idle_ >= 0 &&
+        e->last_use_ < SimpleCycleTimer::Now() - max_idle_) {
+      // Not at the end of the list, so missed by RemoveExpiredEntries().
+      Remove(k);
+      return nullptr;
+    }
+    const bool update = lru_ && options.update_eviction_order();
     if (e->pin == 0) {
       pinned_units_ += e->units;
       // We are pinning this entry, take it off the LRU list if we are in LRU
       // mode. In strict age-based mode entries stay on the list while pinned.
-      if (lru_ && options.update_eviction_order()) e->Unlink();
+      if (update && policy_ != SimpleLRUEvictionPolicy::CLOCK) e->Unlink();
+    }
+    if (update) {
+      if (policy_ == SimpleLRUEvictionPolicy::CLOCK) {
+        e->referenced = true;
+      } else if (policy_ == SimpleLRUEvictionPolicy::SEGMENTED_LRU &&
+                 !e->is_protected) {
+        // Promoted on Release.
+        e->is_protected = true;
+        protected_units_ += e->units;
+      }
     }
     e->pin++;
     return e->value;
@@ -738,7 +833,7 @@ void SimpleLRUCacheBase<Key, Value, MapType, EQ>::ReleaseWithOptions(
     e->pin--;
 
     if (e->pin == 0) {
-      if (lru_ && options.update_eviction_order()) e->Link(&head_);
+      if (lru_ && options.update_eviction_order()) LinkUnpinned(e);
       pinned_units_ -= e->units;
       if (IsOverfullInternal()) {
         // This element is no longer needed, and we are full.  So kick it out.
@@ -755,18 +850,19 @@ void SimpleLRUCacheBase<Key, Value, MapType, EQ>::InsertPinned(const Key& k,
   // Get rid of older entry (if any) from table
   Remove(k);
 
-  // Make new element
-  Elem* e = new Elem(k, value, 1, units, SimpleCycleTimer::Now());
+  // Make new element, with a key which doesn't refer to the caller's memory.
+  const Key& owned_key = internal::SimpleLRUKeyTraits<Key>::Own(k);
+  Elem* e = new Elem(owned_key, value, 1, units, SimpleCycleTimer::Now());
 
   // Adjust table, total units fields.
   units_ += units;
   pinned_units_ += units;
-  table_[k] = e;
+  table_[owned_key] = e;
 
   // If we are in the strict age-based eviction mode, the entry goes on the LRU
   // list now and is never removed. In the LRU mode, the list will only contain
-  // unpinned entries.
-  if (!lru_) e->Link(&head_);
+  // unpinned entries, except with the CLOCK policy.
+  if (!lru_ || policy_ == SimpleLRUEvictionPolicy::CLOCK) e->Link(&head_);
   GarbageCollect();
 }
 
@@ -782,6 +878,9 @@ void SimpleLRUCacheBase<Key, Value, MapType, EQ>::UpdateSize(const Key& k,
     if (e->pin > 0) {
       pinned_units_ -= e->units;
     }
+    if (e->is_protected) {
+      protected_units_ += units - e->units;
+    }
     e->units = units;
     units_ += e->units;
     if (e->pin > 0) {
@@ -847,6 +946,7 @@ void SimpleLRUCacheBase<Key, Value, MapType, EQ>::Remove(Elem* e) {
   // Unlink e whether it is in the LRU or the deferred list. It is safe to call
   // Unlink() if it is not in either list.
   e->Unlink();
+  Unprotect(e);
   if (e->pin > 0) {
     pinned_units_ -= e->units;
 
@@ -866,12 +966,50 @@ void SimpleLRUCacheBase<Key, Value, MapType, EQ>::Remove(Elem* e) {
   }
 }
 
+template <class Key, class Value, class MapType, class EQ>
+void SimpleLRUCacheBase<Key, Value, MapType, EQ>::LinkUnpinned(Elem* e) {
+  if (policy_ == SimpleLRUEvictionPolicy::CLOCK) {
+    // Never unlinked while pinned.
+    return;
+  }
+  if (!e->is_protected) {
+    e->Link(&head_);
+    return;
+  }
+  e->Link(&protected_head_);
+  // Demote the least recently used protected elements to probation.
+  while (protected_units_ > MaxProtectedUnits() &&
+         protected_head_.prev != &protected_head_) {
+    Elem* demoted = protected_head_.prev;
+    demoted->Unlink();
+    Unprotect(demoted);
+    demoted->Link(&head_);
+  }
+}
+
 template <class Key, class Value, class MapType, class EQ>
 void SimpleLRUCacheBase<Key, Value, MapType, EQ>::GarbageCollect() {
-  Elem* e = head_.prev;
-  while (IsOverfullInternal() && (e != &head_)) {
+  GarbageCollect(&head_);
+  if (policy_ == SimpleLRUEvictionPolicy::SEGMENTED_LRU) {
+    GarbageCollect(&protected_head_);
+  }
+}
+
+template <class Key, class Value, class MapType, class EQ>
+void SimpleLRUCacheBase<Key, Value, MapType, EQ>::GarbageCollect(Elem* head) {
+  Elem* e = head->prev;
+  while (IsOverfullInternal() && (e != head)) {
     Elem* prev = e->prev;
     if (e->pin == 0) {
+      if (e->referenced) {
+        // CLOCK: give it a second chance. It is visited again before
+        // reaching the head.
+        e->referenced = false;
+        e->Unlink();
+        e->Link(head);
+        e = prev;
+        continue;
+      }
       // Erase from hash-table
       TableIterator iter = table_.find(e->key);
       assert(iter != table_.end());
@@ -892,12 +1030,21 @@ void SimpleLRUCacheBase<Key, Value, MapType, EQ>::DiscardIdle(
     int64_t max_idle) {
   if (max_idle < 0) return;
 
-  Elem* e = head_.prev;
   const int64_t threshold = SimpleCycleTimer::Now() - max_idle;
+  DiscardIdle(&head_, threshold);
+  if (policy_ == SimpleLRUEvictionPolicy::SEGMENTED_LRU) {
+    DiscardIdle(&protected_head_, threshold);
+  }
+}
+
+template <class Key, class Value, class MapType, class EQ>
+void SimpleLRUCacheBase<Key, Value, MapType, EQ>::DiscardIdle(
+    Elem* head, int64_t threshold) {
+  Elem* e = head->prev;
 #ifndef NDEBUG
   int64_t last = 0;
 #endif
-  while ((e != &head_) && (e->last_use_ < threshold)) {
+  while ((e != head) && (e->last_use_ < threshold)) {
 // Sanity check: LRU list should be sorted by last_use_.  We could
 // check the entire list, but that gives quadratic behavior.
 //
@@ -915,19 +1062,53 @@ void SimpleLRUCacheBase<Key, Value, MapType, EQ>::DiscardIdle(
 //
 // fixes the problem.
 #ifndef NDEBUG
-    assert(last <= e->last_use_ + kAcceptableClockSynchronizationDriftCycles);
+    assert(ApproximateOrder() ||
+           last <= e->last_use_ + kAcceptableClockSynchronizationDriftCycles);
     last = e->last_use_;
 #endif
 
     Elem* prev = e->prev;
     // There are no pinned elements on the list in the LRU mode, and in the
     // age-based mode we push them out of the main table regardless of pinning.
-    assert(e->pin == 0 || !lru_);
+    // CLOCK keeps pinned elements on the list, they are pushed out as well.
+    assert(e->pin == 0 || !lru_ || policy_ == SimpleLRUEvictionPolicy::CLOCK);
     Remove(e->key);
     e = prev;
   }
 }
 
+template <class Key, class Value, class MapType, class EQ>
+int64_t SimpleLRUCacheBase<Key, Value, MapType, EQ>::SweepExpiredEntries(
+    int64_t max_entries) {
+  if (max_idle_ < 0) return 0;
+
+  const int64_t threshold = SimpleCycleTimer::Now() - max_idle_;
+  int64_t removed = SweepIdle(&head_, threshold, max_entries);
+  if (policy_ == SimpleLRUEvictionPolicy::SEGMENTED_LRU) {
+    removed += SweepIdle(&protected_head_, threshold, max_entries);
+  }
+  return removed;
+}
+
+template <class Key, class Value, class MapType, class EQ>
+int64_t SimpleLRUCacheBase<Key, Value, MapType, EQ>::SweepIdle(
+    Elem* head, int64_t threshold, int64_t max_visits) {
+  int64_t removed = 0;
+  Elem* e = head->prev;
+  for (int64_t i = 0; i < max_visits && e != head; ++i) {
+    Elem* prev = e->prev;
+    if (e->last_use_ < threshold) {
+      Remove(e->key);
+      ++removed;
+    } else if (!ApproximateOrder()) {
+      // The rest of the list is newer.
+      break;
+    }
+    e = prev;
+  }
+  return removed;
+}
+
 template <class Key, class Value, class MapType, class EQ>
 void SimpleLRUCacheBase<Key, Value, MapType, EQ>::CountDeferredEntries(
     int64_t* num_entries, int64_t* total_size) const {
@@ -961,8 +1142,10 @@ int64_t SimpleLRUCacheBase<Key, Value, MapType, EQ>::DeferredEntries() const {
 template <class Key, class Value, class MapType, class EQ>
 int64_t SimpleLRUCacheBase<Key, Value, MapType,
                            EQ>::AgeOfLRUItemInMicroseconds() const {
-  if (head_.prev == &head_) return 0;
-  return kSecToUsec * (SimpleCycleTimer::Now() - head_.prev->last_use_) /
+  // With segmented LRU, the end of the probation list comes first.
+  const Elem* e = head_.prev != &head_ ? head_.prev : protected_head_.prev;
+  if (e == &protected_head_) return 0;
+  return kSecToUsec * (SimpleCycleTimer::Now() - e->last_use_) /
          SimpleCycleTimer::Frequency();
 }
 
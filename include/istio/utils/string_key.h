@@ -0,0 +1,93 @@
+/* Copyright 2017 Istio Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ISTIO_UTILS_STRING_KEY_H_
+#define ISTIO_UTILS_STRING_KEY_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <utility>
+
+#include "absl/strings/string_view.h"
+#include "simple_lru_cache.h"
+
+namespace istio {
+namespace utils {
+
+// A string key of SimpleLRUCache which either owns its string or refers to
+// one owned by the caller. A cache of StringKeys is probed with a
+// reference key, so a lookup never copies the string:
+//
+//   SimpleLRUCache<StringKey, Value, StringKey::Hash> cache(size);
+//   Cache::ScopedLookup lookup(&cache, StringKey::Ref(name));
+//
+// Copies of a reference key still refer to the same string. Insert()
+// stores an owning copy of the key, see SimpleLRUKeyTraits.
+class StringKey {
+ public:
+  StringKey() : is_ref_(false) {}
+
+  // An owning key.
+  StringKey(std::string str) : str_(std::move(str)), is_ref_(false) {}
+
+  // Returns a key referring to str, which must outlive the key.
+  static StringKey Ref(absl::string_view str) {
+    StringKey key;
+    key.ref_ = str;
+    key.is_ref_ = true;
+    return key;
+  }
+
+  absl::string_view view() const {
+    return is_ref_ ? ref_ : absl::string_view(str_);
+  }
+
+  bool operator==(const StringKey& b) const { return view() == b.view(); }
+  bool operator!=(const StringKey& b) const { return !(*this == b); }
+
+  // A hash functor, 64 bit FNV-1a of the string.
+  struct Hash {
+    size_t operator()(const StringKey& key) const {
+      uint64_t h = 14695981039346656037ULL;
+      for (char c : key.view()) {
+        h = (h ^ static_cast<uint8_t>(c)) * 1099511628211ULL;
+      }
+      return static_cast<size_t>(h);
+    }
+  };
+
+ private:
+  // The owned string, empty for a reference key.
+  std::string str_;
+  // The referenced string of a reference key.
+  absl::string_view ref_;
+  bool is_ref_;
+};
+
+namespace internal {
+
+template <>
+struct SimpleLRUKeyTraits<StringKey> {
+  static StringKey Own(const StringKey& key) {
+    return StringKey(std::string(key.view()));
+  }
+};
+
+}  // namespace internal
+}  // namespace utils
+}  // namespace istio
+
+#endif  // ISTIO_UTILS_STRING_KEY_H_
@@ -0,0 +1,58 @@
+/* Copyright 2018 Istio Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ISTIO_UTILS_TRACEPOINT_H_
+#define ISTIO_UTILS_TRACEPOINT_H_
+
+// Static user space tracepoints (USDT probes) in the provider "istio", for
+// tracing with bpftrace, bcc or perf. They are only built with
+//   bazel build --define usdt=enabled
+// which needs <sys/sdt.h> from systemtap, e.g. the systemtap-sdt-dev
+// package. A probe is a nop until a tracer attaches to it, and its
+// arguments are only read then. In default builds the probes are empty.
+//
+// The probes and their arguments:
+//   check_cache_hit(shape_index)    the index of the hit shape, by hits.
+//   check_cache_miss(shapes)        the number of shapes probed.
+//   remote_check_start(id, blocking)
+//   remote_check_done(id, status)   id pairs them, status is the error
+//                                   code of the transport.
+//   report_batch_flush(entries, bytes)
+//   quota_prefetch_request(id, amount)
+//   quota_prefetch_response(id, amount)  id is the send tick, amount is -1
+//                                   on failures.
+//   jwks_fetch_start(uri)
+//   jwks_fetch_done(uri, status)    status is the JWT status code.
+//
+// For example, the remote check latency:
+//   bpftrace -e 'usdt:./envoy:istio:remote_check_start { @s[arg0] = nsecs; }
+//     usdt:./envoy:istio:remote_check_done /@s[arg0]/ {
+//       @ns = hist(nsecs - @s[arg0]); delete(@s[arg0]); }'
+
+#ifdef ISTIO_USDT
+
+#include <sys/sdt.h>
+
+#define ISTIO_TRACEPOINT1(name, a) DTRACE_PROBE1(istio, name, a)
+#define ISTIO_TRACEPOINT2(name, a, b) DTRACE_PROBE2(istio, name, a, b)
+
+#else
+
+#define ISTIO_TRACEPOINT1(name, a)
+#define ISTIO_TRACEPOINT2(name, a, b)
+
+#endif  // ISTIO_USDT
+
+#endif  // ISTIO_UTILS_TRACEPOINT_H_
@@ -58,3 +58,6 @@ make build
 
 echo 'Bazel Tests'
 make test
+
+echo 'Allocation Accounting Tests'
+make test_alloc_accounting
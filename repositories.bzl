@@ -113,6 +113,32 @@ cc_library(
             actual = "@googletest_git//:googletest_prod",
         )
 
+def re2_repositories(bind=True):
+    git_repository(
+        name = "com_googlesource_code_re2",
+        tag = "2018-04-01",
+        remote = "https://github.com/google/re2.git",
+    )
+
+    if bind:
+        native.bind(
+            name = "re2",
+            actual = "@com_googlesource_code_re2//:re2",
+        )
+
+def googlebenchmark_repositories(bind=True):
+    git_repository(
+        name = "googlebenchmark_git",
+        tag = "v1.4.1",
+        remote = "https://github.com/google/benchmark.git",
+    )
+
+    if bind:
+        native.bind(
+            name = "benchmark",
+            actual = "@googlebenchmark_git//:benchmark",
+        )
+
 ISTIO_API = "78da6e6eb4ad4f158fb58e02f94efde4abf4cabf"
 
 def mixerapi_repositories(bind=True):
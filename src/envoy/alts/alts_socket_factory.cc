@@ -20,6 +20,7 @@
 #include "common/protobuf/utility.h"
 #include "envoy/registry/registry.h"
 #include "envoy/server/transport_socket_config.h"
+#include "envoy/stats/stats_macros.h"
 #include "src/envoy/alts/alts_socket.pb.h"
 #include "src/envoy/alts/alts_socket.pb.validate.h"
 #include "src/envoy/alts/transport_security_interface_wrapper.h"
@@ -32,6 +33,21 @@ namespace Configuration {
 
 using ::google::protobuf::RepeatedPtrField;
 
+// Returns the maximum frame size in config, or the default if not set.
+static size_t maxFrameSize(const envoy::security::v2::AltsSocket &config) {
+  return config.max_frame_size() > 0 ? config.max_frame_size()
+                                     : Security::kDefaultMaxFrameSize;
+}
+
+// Creates the TSI socket stats with the prefix in scope.
+static Security::TsiSocketStatsSharedPtr createStats(
+    Stats::Scope &scope, const std::string &prefix) {
+  return std::make_shared<Security::TsiSocketStats>(
+      Security::TsiSocketStats{ALL_TSI_SOCKET_STATS(
+          POOL_COUNTER_PREFIX(scope, prefix), POOL_GAUGE_PREFIX(scope, prefix),
+          POOL_HISTOGRAM_PREFIX(scope, prefix))});
+}
+
 // Returns true if the peer's service account is found in peers, otherwise
 // returns false and fills out err with an error message.
 static bool doValidate(const tsi_peer &peer,
@@ -52,6 +68,32 @@ static bool doValidate(const tsi_peer &peer,
   return false;
 }
 
+// Returns the factory of the handshakers with handshaker_service. The
+// credentials options are created once per socket factory, instead of once
+// per connection, and shared by all its handshakers.
+static Security::HandshakerFactory createHandshakerFactory(
+    const std::string &handshaker_service, bool is_client) {
+  std::shared_ptr<grpc_alts_credentials_options> options(
+      is_client ? grpc_alts_credentials_client_options_create()
+                : grpc_alts_credentials_server_options_create(),
+      grpc_alts_credentials_options_destroy);
+  return [handshaker_service, is_client,
+          options](Event::Dispatcher &dispatcher) {
+    tsi_handshaker *handshaker = nullptr;
+
+    // Specifying target name as empty for clients since TSI won't take care
+    // of validating peer identity in this use case. The validation will be
+    // implemented in TsiSocket later.
+    alts_tsi_handshaker_create(options.get(), is_client ? "" : nullptr,
+                               handshaker_service.c_str(), is_client,
+                               &handshaker);
+
+    ASSERT(handshaker != nullptr);
+
+    return std::make_unique<Security::TsiHandshaker>(handshaker, dispatcher);
+  };
+}
+
 ProtobufTypes::MessagePtr
 AltsTransportSocketConfigFactory::createEmptyConfigProto() {
   return std::make_unique<envoy::security::v2::AltsSocket>();
@@ -64,7 +106,7 @@ Envoy::Server::Configuration::AltsTransportSocketConfigFactory::name() const {
 
 Network::TransportSocketFactoryPtr
 UpstreamAltsTransportSocketConfigFactory::createTransportSocketFactory(
-    const Protobuf::Message &message, TransportSocketFactoryContext &) {
+    const Protobuf::Message &message, TransportSocketFactoryContext &context) {
   auto config =
       MessageUtil::downcastAndValidate<const envoy::security::v2::AltsSocket &>(
           message);
@@ -83,32 +125,16 @@ UpstreamAltsTransportSocketConfigFactory::createTransportSocketFactory(
   }
 
   return std::make_unique<Security::TsiSocketFactory>(
-      [handshaker_service](Event::Dispatcher &dispatcher) {
-        grpc_alts_credentials_options *options =
-            grpc_alts_credentials_client_options_create();
-
-        tsi_handshaker *handshaker = nullptr;
-
-        // Specifying target name as empty since TSI won't take care of
-        // validating peer identity in this use case. The validation will be
-        // implemented in TsiSocket later.
-        alts_tsi_handshaker_create(options, "", handshaker_service.c_str(),
-                                   true /* is_client */, &handshaker);
-
-        ASSERT(handshaker != nullptr);
-
-        grpc_alts_credentials_options_destroy(options);
-
-        return std::make_unique<Security::TsiHandshaker>(handshaker,
-                                                         dispatcher);
-      },
-      validator);
+      createHandshakerFactory(handshaker_service, true /* is_client */),
+      validator, maxFrameSize(config), config.max_concurrent_handshakes(),
+      createStats(context.statsScope(), "alts.client."),
+      config.coalesce_writes());
 }
 
 Network::TransportSocketFactoryPtr
 DownstreamAltsTransportSocketConfigFactory::createTransportSocketFactory(
     const std::string &, const std::vector<std::string> &, bool,
-    const Protobuf::Message &message, TransportSocketFactoryContext &) {
+    const Protobuf::Message &message, TransportSocketFactoryContext &context) {
   auto config =
       MessageUtil::downcastAndValidate<const envoy::security::v2::AltsSocket &>(
           message);
@@ -127,23 +153,10 @@ DownstreamAltsTransportSocketConfigFactory::createTransportSocketFactory(
   }
 
   return std::make_unique<Security::TsiSocketFactory>(
-      [handshaker_service](Event::Dispatcher &dispatcher) {
-        grpc_alts_credentials_options *options =
-            grpc_alts_credentials_server_options_create();
-
-        tsi_handshaker *handshaker = nullptr;
-
-        alts_tsi_handshaker_create(options, nullptr, handshaker_service.c_str(),
-                                   false /* is_client */, &handshaker);
-
-        ASSERT(handshaker != nullptr);
-
-        grpc_alts_credentials_options_destroy(options);
-
-        return std::make_unique<Security::TsiHandshaker>(handshaker,
-                                                         dispatcher);
-      },
-      validator);
+      createHandshakerFactory(handshaker_service, false /* is_client */),
+      validator, maxFrameSize(config), config.max_concurrent_handshakes(),
+      createStats(context.statsScope(), "alts.server."),
+      config.coalesce_writes());
 }
 
 static Registry::RegisterFactory<UpstreamAltsTransportSocketConfigFactory,
@@ -0,0 +1,58 @@
+/* Copyright 2018 Istio Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "src/envoy/alts/handshake_limiter.h"
+
+#include "common/common/assert.h"
+
+namespace Envoy {
+namespace Security {
+
+HandshakeLimiter::HandshakeLimiter(uint32_t max_handshakes)
+    : max_handshakes_(max_handshakes) {}
+
+bool HandshakeLimiter::acquire(Callbacks &callbacks) {
+  ASSERT(index_.find(&callbacks) == index_.end());
+  if (max_handshakes_ == 0 || active_ < max_handshakes_) {
+    ++active_;
+    return true;
+  }
+  queue_.push_back(&callbacks);
+  index_.emplace(&callbacks, std::prev(queue_.end()));
+  return false;
+}
+
+void HandshakeLimiter::cancel(Callbacks &callbacks) {
+  auto it = index_.find(&callbacks);
+  if (it != index_.end()) {
+    queue_.erase(it->second);
+    index_.erase(it);
+  }
+}
+
+void HandshakeLimiter::release() {
+  ASSERT(active_ > 0);
+  if (queue_.empty()) {
+    --active_;
+    return;
+  }
+  // The slot is handed over to the first queued handshake.
+  Callbacks *callbacks = queue_.front();
+  queue_.pop_front();
+  index_.erase(callbacks);
+  callbacks->onHandshakeSlot();
+}
+
+}  // namespace Security
+}  // namespace Envoy
@@ -0,0 +1,89 @@
+/* Copyright 2018 Istio Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include <iterator>
+#include <list>
+#include <memory>
+#include <unordered_map>
+
+#include "envoy/common/pure.h"
+
+namespace Envoy {
+namespace Security {
+
+/**
+ * Limits the number of concurrent handshakes of a worker, the handshakes over
+ * the limit wait in a FIFO queue. It is not thread safe, each worker thread
+ * has its own instance.
+ */
+class HandshakeLimiter {
+ public:
+  /**
+   * An interface to get notified when a queued handshake may start.
+   */
+  class Callbacks {
+   public:
+    virtual ~Callbacks() {}
+
+    /**
+     * Called when a handshake slot is acquired for a queued handshake.
+     */
+    virtual void onHandshakeSlot() PURE;
+  };
+
+  /**
+   * @param max_handshakes supplies the maximum number of concurrent
+   * handshakes, 0 means no limit.
+   */
+  explicit HandshakeLimiter(uint32_t max_handshakes);
+
+  /**
+   * Acquires a handshake slot.
+   * @param callbacks supplies the callbacks to call once a slot is available
+   * if it is not available now.
+   * @return true if the slot is acquired, false if the handshake is queued.
+   */
+  bool acquire(Callbacks& callbacks);
+
+  /**
+   * Removes a queued handshake from the queue, no-op if it is not queued.
+   */
+  void cancel(Callbacks& callbacks);
+
+  /**
+   * Releases an acquired slot and gives it to the first queued handshake.
+   */
+  void release();
+
+  uint32_t active() const { return active_; }
+  size_t pending() const { return queue_.size(); }
+
+ private:
+  typedef std::list<Callbacks*> Queue;
+
+  const uint32_t max_handshakes_;
+  // The number of acquired slots.
+  uint32_t active_{};
+  // The queued handshakes, the oldest first.
+  Queue queue_;
+  // The queued handshakes indexed by callbacks.
+  std::unordered_map<Callbacks*, Queue::iterator> index_;
+};
+
+typedef std::shared_ptr<HandshakeLimiter> HandshakeLimiterSharedPtr;
+
+}  // namespace Security
+}  // namespace Envoy
@@ -0,0 +1,107 @@
+/* Copyright 2018 Istio Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/envoy/alts/handshake_limiter.h"
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+using testing::InSequence;
+using testing::StrictMock;
+
+namespace Envoy {
+namespace Security {
+namespace {
+
+class MockCallbacks : public HandshakeLimiter::Callbacks {
+ public:
+  MOCK_METHOD0(onHandshakeSlot, void());
+};
+
+TEST(HandshakeLimiterTest, NoLimit) {
+  HandshakeLimiter limiter(0);
+  StrictMock<MockCallbacks> callbacks[3];
+  for (auto& c : callbacks) {
+    EXPECT_TRUE(limiter.acquire(c));
+  }
+  EXPECT_EQ(3U, limiter.active());
+  EXPECT_EQ(0U, limiter.pending());
+
+  for (int i = 0; i < 3; ++i) {
+    limiter.release();
+  }
+  EXPECT_EQ(0U, limiter.active());
+}
+
+TEST(HandshakeLimiterTest, QueueOverLimit) {
+  HandshakeLimiter limiter(1);
+  StrictMock<MockCallbacks> first, second, third;
+  EXPECT_TRUE(limiter.acquire(first));
+  // The handshakes over the limit are not admitted, they wait.
+  EXPECT_FALSE(limiter.acquire(second));
+  EXPECT_FALSE(limiter.acquire(third));
+  EXPECT_EQ(1U, limiter.active());
+  EXPECT_EQ(2U, limiter.pending());
+}
+
+TEST(HandshakeLimiterTest, ReleaseInOrder) {
+  HandshakeLimiter limiter(1);
+  StrictMock<MockCallbacks> first, second, third;
+  EXPECT_TRUE(limiter.acquire(first));
+  EXPECT_FALSE(limiter.acquire(second));
+  EXPECT_FALSE(limiter.acquire(third));
+
+  // The slot is handed over to the oldest queued handshake, it stays active.
+  {
+    InSequence s;
+    EXPECT_CALL(second, onHandshakeSlot());
+    EXPECT_CALL(third, onHandshakeSlot());
+  }
+  limiter.release();
+  EXPECT_EQ(1U, limiter.active());
+  EXPECT_EQ(1U, limiter.pending());
+  limiter.release();
+  EXPECT_EQ(1U, limiter.active());
+  EXPECT_EQ(0U, limiter.pending());
+
+  limiter.release();
+  EXPECT_EQ(0U, limiter.active());
+  EXPECT_TRUE(limiter.acquire(first));
+}
+
+TEST(HandshakeLimiterTest, CancelQueued) {
+  HandshakeLimiter limiter(1);
+  StrictMock<MockCallbacks> first, second, third;
+  EXPECT_TRUE(limiter.acquire(first));
+  EXPECT_FALSE(limiter.acquire(second));
+  EXPECT_FALSE(limiter.acquire(third));
+
+  // A cancelled handshake never gets a slot.
+  limiter.cancel(second);
+  EXPECT_EQ(1U, limiter.pending());
+  EXPECT_CALL(third, onHandshakeSlot());
+  limiter.release();
+  EXPECT_EQ(0U, limiter.pending());
+
+  // Cancelling a handshake which is not queued is a no-op.
+  limiter.cancel(first);
+  limiter.cancel(third);
+  EXPECT_EQ(1U, limiter.active());
+  limiter.release();
+  EXPECT_EQ(0U, limiter.active());
+}
+
+}  // namespace
+}  // namespace Security
+}  // namespace Envoy
@@ -1,48 +1,82 @@
 #include "src/envoy/alts/tsi_frame_protector.h"
 
+#include <algorithm>
+
+#include "common/buffer/buffer_impl.h"
 #include "common/common/assert.h"
 
 namespace Envoy {
 namespace Security {
 
-TsiFrameProtector::TsiFrameProtector(tsi_frame_protector *frame_protector)
-    : frame_protector_(frame_protector) {}
+namespace {
+// The number of input slices processed before the input is drained.
+const uint64_t kMaxInputSlices = 16;
+
+// An ALTS frame starts with the length of the rest of the frame, a 4 bytes
+// little endian integer, followed by a 4 bytes message type and the
+// encrypted payload with a 16 bytes AES-GCM tag.
+const size_t kFrameLengthFieldSize = 4;
+const size_t kFrameOverhead = 4 + 16;
+
+// The largest frame supported by the ALTS frame protector, it bounds the
+// reservation for a frame with a corrupted length.
+const size_t kMaxFrameSize = 1024 * 1024;
+}  // namespace
+
+TsiFrameProtector::TsiFrameProtector(tsi_frame_protector *frame_protector,
+                                     size_t max_frame_size)
+    : frame_protector_(frame_protector), max_frame_size_(max_frame_size) {}
 
 tsi_result TsiFrameProtector::protect(Buffer::Instance &input,
                                       Buffer::Instance &output) {
   ASSERT(frame_protector_);
 
-  // TODO(lizan): tune size later
-  unsigned char protected_buffer[4096];
-  size_t protected_buffer_size = sizeof(protected_buffer);
   while (input.length() > 0) {
-    auto *message_bytes =
-        reinterpret_cast<unsigned char *>(input.linearize(input.length()));
-    size_t protected_buffer_size_to_send = protected_buffer_size;
-    size_t processed_message_size = input.length();
-    tsi_result result = tsi_frame_protector_protect(
-        frame_protector_.get(), message_bytes, &processed_message_size,
-        protected_buffer, &protected_buffer_size_to_send);
+    Buffer::RawSlice slices[kMaxInputSlices];
+    const uint64_t num_slices = input.getRawSlices(slices, kMaxInputSlices);
+    uint64_t processed_size = 0;
+    tsi_result result = TSI_OK;
+    for (uint64_t i = 0; i < num_slices && result == TSI_OK; ++i) {
+      auto *message_bytes = static_cast<const unsigned char *>(slices[i].mem_);
+      size_t message_size = slices[i].len_;
+      while (message_size > 0) {
+        Buffer::RawSlice out;
+        output.reserve(max_frame_size_, &out, 1);
+        size_t out_size = out.len_;
+        size_t processed_message_size = message_size;
+        result = tsi_frame_protector_protect(
+            frame_protector_.get(), message_bytes, &processed_message_size,
+            static_cast<unsigned char *>(out.mem_), &out_size);
+        if (result != TSI_OK) {
+          break;
+        }
+        commit(out, out_size, output);
+        message_bytes += processed_message_size;
+        message_size -= processed_message_size;
+        processed_size += processed_message_size;
+      }
+    }
+    input.drain(processed_size);
     if (result != TSI_OK) {
       ASSERT(result != TSI_INVALID_ARGUMENT && result != TSI_UNIMPLEMENTED);
       return result;
     }
-    output.add(protected_buffer, protected_buffer_size_to_send);
-    input.drain(processed_message_size);
   }
 
   ASSERT(input.length() == 0);
   size_t still_pending_size;
   do {
-    size_t protected_buffer_size_to_send = protected_buffer_size;
+    Buffer::RawSlice out;
+    output.reserve(max_frame_size_, &out, 1);
+    size_t out_size = out.len_;
     tsi_result result = tsi_frame_protector_protect_flush(
-        frame_protector_.get(), protected_buffer,
-        &protected_buffer_size_to_send, &still_pending_size);
+        frame_protector_.get(), static_cast<unsigned char *>(out.mem_),
+        &out_size, &still_pending_size);
     if (result != TSI_OK) {
       ASSERT(result != TSI_INVALID_ARGUMENT && result != TSI_UNIMPLEMENTED);
       return result;
     }
-    output.add(protected_buffer, protected_buffer_size_to_send);
+    commit(out, out_size, output);
   } while (still_pending_size > 0);
 
   return TSI_OK;
@@ -52,28 +86,101 @@ tsi_result TsiFrameProtector::unprotect(Buffer::Instance &input,
                                         Buffer::Instance &output) {
   ASSERT(frame_protector_);
 
-  // TODO(lizan): Tune the buffer size.
-  unsigned char unprotected_buffer[4096];
-  size_t unprotected_buffer_size = sizeof(unprotected_buffer);
-
-  while (input.length() > 0) {
-    auto *message_bytes =
-        reinterpret_cast<unsigned char *>(input.linearize(input.length()));
-    size_t unprotected_buffer_size_to_send = unprotected_buffer_size;
-    size_t processed_message_size = input.length();
-    tsi_result result = tsi_frame_protector_unprotect(
-        frame_protector_.get(), message_bytes, &processed_message_size,
-        unprotected_buffer, &unprotected_buffer_size_to_send);
+  bool need_more_data = false;
+  while (input.length() > 0 && !need_more_data) {
+    Buffer::RawSlice slices[kMaxInputSlices];
+    const uint64_t num_slices = input.getRawSlices(slices, kMaxInputSlices);
+    uint64_t processed_size = 0;
+    tsi_result result = TSI_OK;
+    for (uint64_t i = 0; i < num_slices && result == TSI_OK && !need_more_data;
+         ++i) {
+      auto *message_bytes = static_cast<const unsigned char *>(slices[i].mem_);
+      size_t message_size = slices[i].len_;
+      while (message_size > 0) {
+        if (frame_remaining_size_ == 0 &&
+            !readFrameHeader(input, processed_size)) {
+          // Wait for the rest of the header, the bytes read so far are left
+          // in input.
+          need_more_data = true;
+          break;
+        }
+        // Feed at most the rest of the current frame so that the next call
+        // starts at a frame header.
+        size_t processed_message_size =
+            std::min(message_size, frame_remaining_size_);
+        Buffer::RawSlice out;
+        output.reserve(frame_payload_size_, &out, 1);
+        size_t out_size = out.len_;
+        result = tsi_frame_protector_unprotect(
+            frame_protector_.get(), message_bytes, &processed_message_size,
+            static_cast<unsigned char *>(out.mem_), &out_size);
+        if (result != TSI_OK) {
+          break;
+        }
+        commit(out, out_size, output);
+        message_bytes += processed_message_size;
+        message_size -= processed_message_size;
+        processed_size += processed_message_size;
+        frame_remaining_size_ -= processed_message_size;
+      }
+    }
+    input.drain(processed_size);
     if (result != TSI_OK) {
       ASSERT(result != TSI_INVALID_ARGUMENT && result != TSI_UNIMPLEMENTED);
       return result;
     }
-    output.add(unprotected_buffer, unprotected_buffer_size_to_send);
-    input.drain(processed_message_size);
   }
 
   return TSI_OK;
 }
 
+tsi_result TsiFrameProtector::protectWholeFrames(Buffer::Instance &input,
+                                                 Buffer::Instance &output) {
+  const size_t payload_size = maxFramePayloadSize();
+  const uint64_t size = input.length() / payload_size * payload_size;
+  if (size == 0) {
+    return TSI_OK;
+  }
+  if (size == input.length()) {
+    return protect(input, output);
+  }
+  Buffer::OwnedImpl frames;
+  frames.move(input, size);
+  return protect(frames, output);
+}
+
+size_t TsiFrameProtector::maxFramePayloadSize() const {
+  return max_frame_size_ - kFrameLengthFieldSize - kFrameOverhead;
+}
+
+bool TsiFrameProtector::readFrameHeader(const Buffer::Instance &input,
+                                        uint64_t offset) {
+  if (input.length() - offset < kFrameLengthFieldSize) {
+    return false;
+  }
+  unsigned char header[kFrameLengthFieldSize];
+  input.copyOut(offset, kFrameLengthFieldSize, header);
+  const size_t frame_length = static_cast<size_t>(header[0]) |
+                              static_cast<size_t>(header[1]) << 8 |
+                              static_cast<size_t>(header[2]) << 16 |
+                              static_cast<size_t>(header[3]) << 24;
+  frame_remaining_size_ = kFrameLengthFieldSize + frame_length;
+  // A frame too short to hold the overhead is rejected by the frame
+  // protector, the reservation size does not matter then.
+  frame_payload_size_ =
+      frame_length > kFrameOverhead
+          ? std::min(frame_length - kFrameOverhead, kMaxFrameSize)
+          : max_frame_size_;
+  return true;
+}
+
+void TsiFrameProtector::commit(Buffer::RawSlice &slice, size_t size,
+                               Buffer::Instance &output) {
+  if (size > 0) {
+    slice.len_ = size;
+    output.commit(&slice, 1);
+  }
+}
+
 }  // namespace Security
 }  // namespace Envoy
\ No newline at end of file
@@ -26,6 +26,12 @@ namespace Security {
 typedef CSmartPtr<tsi_frame_protector, tsi_frame_protector_destroy>
     CFrameProtectorPtr;
 
+/**
+ * The default maximum size of a protected frame, the default frame size of
+ * the ALTS frame protector.
+ */
+constexpr size_t kDefaultMaxFrameSize = 16 * 1024;
+
 /**
  * A C++ wrapper for tsi_frame_protector interface.
  * For detail of tsi_frame_protector, see
@@ -35,13 +41,21 @@ typedef CSmartPtr<tsi_frame_protector, tsi_frame_protector_destroy>
  */
 class TsiFrameProtector final {
  public:
-  explicit TsiFrameProtector(tsi_frame_protector* frame_protector);
+  /**
+   * @param frame_protector supplies the frame protector to wrap.
+   * @param max_frame_size supplies the maximum size of a protected frame the
+   * frame protector was created with. Output is written in chunks of this
+   * size so that a whole frame is produced by a single call.
+   */
+  TsiFrameProtector(tsi_frame_protector* frame_protector,
+                    size_t max_frame_size = kDefaultMaxFrameSize);
 
   /**
    * Wrapper for tsi_frame_protector_protect
    * @param input supplies the input buffer, the method will drain it when it is
-   * protected.
-   * @param output supplies the output buffer
+   * protected. It is read slice by slice without being linearized.
+   * @param output supplies the output buffer, the protected frames are written
+   * into space reserved in it.
    * @return tsi_result the status.
    */
   tsi_result protect(Buffer::Instance& input, Buffer::Instance& output);
@@ -49,14 +63,48 @@ class TsiFrameProtector final {
   /**
    * Wrapper for tsi_frame_protector_unprotect
    * @param input supplies the input buffer, the method will drain it when it is
-   * protected.
-   * @param output supplies the output buffer
+   * unprotected. It is read slice by slice without being linearized.
+   * @param output supplies the output buffer, the unprotected data is written
+   * into space reserved in it, sized from the frame headers.
    * @return tsi_result the status.
    */
   tsi_result unprotect(Buffer::Instance& input, Buffer::Instance& output);
 
+  /**
+   * Like protect(), but only protects the plaintext filling whole frames of
+   * the maximum size.
+   * @param input supplies the input buffer, the rest short of a whole frame
+   * is left in it.
+   * @param output supplies the output buffer.
+   * @return tsi_result the status.
+   */
+  tsi_result protectWholeFrames(Buffer::Instance& input,
+                                Buffer::Instance& output);
+
+  /**
+   * @return the size of the plaintext that fills a protected frame of the
+   * maximum size.
+   */
+  size_t maxFramePayloadSize() const;
+
  private:
+  // Reads the length of the ALTS frame starting at offset in input and sets
+  // the size of the frame and its payload. Returns false if the header is
+  // not complete yet.
+  bool readFrameHeader(const Buffer::Instance& input, uint64_t offset);
+
+  // Commits the first size bytes of the slice reserved in output.
+  static void commit(Buffer::RawSlice& slice, size_t size,
+                     Buffer::Instance& output);
+
   CFrameProtectorPtr frame_protector_;
+  const size_t max_frame_size_;
+  // The number of bytes of the frame being unprotected not yet passed to the
+  // frame protector, 0 at a frame boundary.
+  size_t frame_remaining_size_{};
+  // The payload size of the frame being unprotected, the size reserved in the
+  // output for it.
+  size_t frame_payload_size_{};
 };
 
 typedef std::unique_ptr<TsiFrameProtector> TsiFrameProtectorPtr;
@@ -0,0 +1,75 @@
+/* Copyright 2018 Istio Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/envoy/alts/tsi_frame_protector.h"
+#include "common/buffer/buffer_impl.h"
+#include "gtest/gtest.h"
+#include "src/core/tsi/fake_transport_security.h"
+
+namespace Envoy {
+namespace Security {
+namespace {
+
+// The frames are sized like ALTS ones, the fake frame protector has less
+// overhead.
+const size_t kFrameSize = 1024;
+
+class TsiFrameProtectorTest : public ::testing::Test {
+ public:
+  TsiFrameProtectorTest() {
+    size_t frame_size = kFrameSize;
+    protector_ = std::make_unique<TsiFrameProtector>(
+        tsi_create_fake_frame_protector(&frame_size), kFrameSize);
+  }
+
+  std::unique_ptr<TsiFrameProtector> protector_;
+};
+
+TEST_F(TsiFrameProtectorTest, ProtectWholeFramesKeepsTail) {
+  const size_t payload_size = protector_->maxFramePayloadSize();
+  Buffer::OwnedImpl input(std::string(2 * payload_size + 10, 'a'));
+  Buffer::OwnedImpl output;
+  EXPECT_EQ(TSI_OK, protector_->protectWholeFrames(input, output));
+  // The tail short of a frame is left for the next writes.
+  EXPECT_EQ(10U, input.length());
+  EXPECT_GT(output.length(), 2 * payload_size);
+
+  // Then it is protected on its own.
+  uint64_t protected_size = output.length();
+  EXPECT_EQ(TSI_OK, protector_->protect(input, output));
+  EXPECT_EQ(0U, input.length());
+  EXPECT_GT(output.length(), protected_size + 10);
+}
+
+TEST_F(TsiFrameProtectorTest, ProtectWholeFramesShortOfFrame) {
+  Buffer::OwnedImpl input(std::string(10, 'a'));
+  Buffer::OwnedImpl output;
+  EXPECT_EQ(TSI_OK, protector_->protectWholeFrames(input, output));
+  EXPECT_EQ(10U, input.length());
+  EXPECT_EQ(0U, output.length());
+}
+
+TEST_F(TsiFrameProtectorTest, ProtectWholeFramesExact) {
+  const size_t payload_size = protector_->maxFramePayloadSize();
+  Buffer::OwnedImpl input(std::string(3 * payload_size, 'a'));
+  Buffer::OwnedImpl output;
+  EXPECT_EQ(TSI_OK, protector_->protectWholeFrames(input, output));
+  EXPECT_EQ(0U, input.length());
+  EXPECT_GT(output.length(), 3 * payload_size);
+}
+
+}  // namespace
+}  // namespace Security
+}  // namespace Envoy
@@ -20,11 +20,29 @@
 namespace Envoy {
 namespace Security {
 
+// True if debug messages are logged by the connection logger.
+#define TSI_DEBUG_LOG_ENABLED() ENVOY_LOGGER().should_log(spdlog::level::debug)
+
+// Like ENVOY_CONN_LOG(debug, ...), but the arguments are only evaluated if
+// debug messages are logged, so the I/O paths do no formatting work and no
+// log argument calls otherwise.
+#define TSI_DEBUG_LOG(...)                \
+  do {                                    \
+    if (TSI_DEBUG_LOG_ENABLED()) {        \
+      ENVOY_CONN_LOG(debug, __VA_ARGS__); \
+    }                                     \
+  } while (0)
+
 TsiSocket::TsiSocket(HandshakerFactory handshaker_factory,
-                     HandshakeValidator handshake_validator)
+                     HandshakeValidator handshake_validator,
+                     size_t max_frame_size, TsiSocketStatsSharedPtr stats,
+                     HandshakeLimiterSharedPtr handshake_limiter,
+                     bool coalesce_writes)
     : handshaker_factory_(handshaker_factory),
       handshake_validator_(handshake_validator),
-      raw_buffer_callbacks_(*this) {
+      max_frame_size_(max_frame_size), stats_(stats),
+      handshake_limiter_(handshake_limiter), raw_buffer_callbacks_(*this),
+      coalesce_writes_(coalesce_writes) {
   raw_buffer_socket_.setTransportSocketCallbacks(raw_buffer_callbacks_);
 }
 
@@ -42,17 +60,87 @@ std::string TsiSocket::protocol() const { return ""; }
 
 Network::PostIoAction TsiSocket::doHandshake() {
   ASSERT(!handshake_complete_);
-  ENVOY_CONN_LOG(debug, "TSI: doHandshake", callbacks_->connection());
+  TSI_DEBUG_LOG("TSI: doHandshake", callbacks_->connection());
+
+  if (!handshake_started_) {
+    handshake_started_ = true;
+    handshake_start_time_ = std::chrono::steady_clock::now();
+    if (handshake_limiter_ && !handshake_limiter_->acquire(*this)) {
+      TSI_DEBUG_LOG("TSI: handshake queued: active: {} pending: {}",
+                    callbacks_->connection(), handshake_limiter_->active(),
+                    handshake_limiter_->pending());
+      handshake_queued_ = true;
+      if (stats_) {
+        stats_->handshake_queued_.inc();
+        stats_->handshake_pending_.inc();
+      }
+    } else {
+      handshake_slot_ = handshake_limiter_ != nullptr;
+      if (stats_) {
+        stats_->handshake_active_.inc();
+      }
+    }
+  }
 
-  if (!handshaker_next_calling_) {
+  // A queued handshake is started by onHandshakeSlot(), the data received
+  // meanwhile stays in raw_read_buffer_.
+  if (!handshake_queued_ && !handshaker_next_calling_) {
     doHandshakeNext();
   }
   return Network::PostIoAction::KeepOpen;
 }
 
+void TsiSocket::onHandshakeSlot() {
+  ASSERT(handshake_queued_);
+  TSI_DEBUG_LOG("TSI: handshake dequeued", callbacks_->connection());
+  handshake_queued_ = false;
+  handshake_slot_ = true;
+  if (stats_) {
+    stats_->handshake_pending_.dec();
+    stats_->handshake_active_.inc();
+  }
+  if (!handshaker_next_calling_) {
+    doHandshakeNext();
+  }
+}
+
+void TsiSocket::endHandshake(bool success) {
+  if (!handshake_started_) {
+    return;
+  }
+  handshake_started_ = false;
+
+  if (stats_) {
+    if (handshake_queued_) {
+      stats_->handshake_pending_.dec();
+    } else {
+      stats_->handshake_active_.dec();
+    }
+    if (success) {
+      stats_->handshake_success_.inc();
+      stats_->handshake_latency_ms_.recordValue(
+          std::chrono::duration_cast<std::chrono::milliseconds>(
+              std::chrono::steady_clock::now() - handshake_start_time_)
+              .count());
+    } else {
+      stats_->handshake_failure_.inc();
+    }
+  }
+
+  if (handshake_queued_) {
+    handshake_queued_ = false;
+    handshake_limiter_->cancel(*this);
+  }
+  if (handshake_slot_) {
+    handshake_slot_ = false;
+    // This may start the next queued handshake in line.
+    handshake_limiter_->release();
+  }
+}
+
 void TsiSocket::doHandshakeNext() {
-  ENVOY_CONN_LOG(debug, "TSI: doHandshake next: received: {}",
-                 callbacks_->connection(), raw_read_buffer_.length());
+  TSI_DEBUG_LOG("TSI: doHandshake next: received: {}",
+                callbacks_->connection(), raw_read_buffer_.length());
   handshaker_next_calling_ = true;
   Buffer::OwnedImpl handshaker_buffer;
   handshaker_buffer.move(raw_read_buffer_);
@@ -63,16 +151,16 @@ Network::PostIoAction TsiSocket::doHandshakeNextDone(
     NextResultPtr &&next_result) {
   ASSERT(next_result);
 
-  ENVOY_CONN_LOG(debug, "TSI: doHandshake next done: status: {} to_send: {}",
-                 callbacks_->connection(), next_result->status_,
-                 next_result->to_send_->length());
+  TSI_DEBUG_LOG("TSI: doHandshake next done: status: {} to_send: {}",
+                callbacks_->connection(), next_result->status_,
+                next_result->to_send_->length());
 
   tsi_result status = next_result->status_;
   tsi_handshaker_result *handshaker_result = next_result->result_.get();
 
   if (status != TSI_INCOMPLETE_DATA && status != TSI_OK) {
-    ENVOY_CONN_LOG(debug, "TSI: Handshake failed: status: {}",
-                   callbacks_->connection(), status);
+    TSI_DEBUG_LOG("TSI: Handshake failed: status: {}",
+                  callbacks_->connection(), status);
     return Network::PostIoAction::Close;
   }
 
@@ -83,13 +171,15 @@ Network::PostIoAction TsiSocket::doHandshakeNextDone(
   if (status == TSI_OK && handshaker_result != nullptr) {
     tsi_peer peer;
     tsi_handshaker_result_extract_peer(handshaker_result, &peer);
-    ENVOY_CONN_LOG(debug, "TSI: Handshake successful: peer properties: {}",
-                   callbacks_->connection(), peer.property_count);
-    for (size_t i = 0; i < peer.property_count; ++i) {
-      ENVOY_CONN_LOG(debug, "  {}: {}", callbacks_->connection(),
-                     peer.properties[i].name,
-                     std::string(peer.properties[i].value.data,
-                                 peer.properties[i].value.length));
+    if (TSI_DEBUG_LOG_ENABLED()) {
+      ENVOY_CONN_LOG(debug, "TSI: Handshake successful: peer properties: {}",
+                     callbacks_->connection(), peer.property_count);
+      for (size_t i = 0; i < peer.property_count; ++i) {
+        ENVOY_CONN_LOG(debug, "  {}: {}", callbacks_->connection(),
+                       peer.properties[i].name,
+                       std::string(peer.properties[i].value.data,
+                                   peer.properties[i].value.length));
+      }
     }
     if (handshake_validator_) {
       std::string err;
@@ -118,16 +208,23 @@ Network::PostIoAction TsiSocket::doHandshakeNextDone(
     if (unused_byte_size > 0) {
       raw_read_buffer_.add(unused_bytes, unused_byte_size);
     }
-    ENVOY_CONN_LOG(debug, "TSI: Handshake successful: unused_bytes: {}",
-                   callbacks_->connection(), unused_byte_size);
+    TSI_DEBUG_LOG("TSI: Handshake successful: unused_bytes: {}",
+                  callbacks_->connection(), unused_byte_size);
 
+    // The frame protector clamps the requested size to the range it
+    // supports and returns the size actually used.
     tsi_frame_protector *frame_protector;
+    size_t max_frame_size = max_frame_size_;
     status = tsi_handshaker_result_create_frame_protector(
-        handshaker_result, NULL, &frame_protector);
+        handshaker_result, &max_frame_size, &frame_protector);
     ASSERT(status == TSI_OK);
-    frame_protector_ = std::make_unique<TsiFrameProtector>(frame_protector);
+    TSI_DEBUG_LOG("TSI: max frame size: {}", callbacks_->connection(),
+                  max_frame_size);
+    frame_protector_ =
+        std::make_unique<TsiFrameProtector>(frame_protector, max_frame_size);
 
     handshake_complete_ = true;
+    endHandshake(true);
     callbacks_->raiseEvent(Network::ConnectionEvent::Connected);
   }
 
@@ -139,9 +236,9 @@ Network::PostIoAction TsiSocket::doHandshakeNextDone(
 
 Network::IoResult TsiSocket::doRead(Buffer::Instance &buffer) {
   Network::IoResult result = raw_buffer_socket_.doRead(raw_read_buffer_);
-  ENVOY_CONN_LOG(debug, "TSI: raw read result action {} bytes {} end_stream {}",
-                 callbacks_->connection(), enumToInt(result.action_),
-                 result.bytes_processed_, result.end_stream_read_);
+  TSI_DEBUG_LOG("TSI: raw read result action {} bytes {} end_stream {}",
+                callbacks_->connection(), enumToInt(result.action_),
+                result.bytes_processed_, result.end_stream_read_);
   if (result.action_ == Network::PostIoAction::Close &&
       result.bytes_processed_ == 0) {
     return result;
@@ -158,18 +255,18 @@ Network::IoResult TsiSocket::doRead(Buffer::Instance &buffer) {
     ASSERT(frame_protector_);
 
     uint64_t read_size = raw_read_buffer_.length();
-    ENVOY_CONN_LOG(debug, "TSI: unprotecting buffer size: {}",
-                   callbacks_->connection(), raw_read_buffer_.length());
+    TSI_DEBUG_LOG("TSI: unprotecting buffer size: {}",
+                  callbacks_->connection(), raw_read_buffer_.length());
     tsi_result status = frame_protector_->unprotect(raw_read_buffer_, buffer);
-    ENVOY_CONN_LOG(debug, "TSI: unprotected buffer left: {} result: {}",
-                   callbacks_->connection(), raw_read_buffer_.length(),
-                   tsi_result_to_string(status));
+    TSI_DEBUG_LOG("TSI: unprotected buffer left: {} result: {}",
+                  callbacks_->connection(), raw_read_buffer_.length(),
+                  tsi_result_to_string(status));
     result.bytes_processed_ = read_size - raw_read_buffer_.length();
   }
 
-  ENVOY_CONN_LOG(debug, "TSI: do read result action {} bytes {} end_stream {}",
-                 callbacks_->connection(), enumToInt(result.action_),
-                 result.bytes_processed_, result.end_stream_read_);
+  TSI_DEBUG_LOG("TSI: do read result action {} bytes {} end_stream {}",
+                callbacks_->connection(), enumToInt(result.action_),
+                result.bytes_processed_, result.end_stream_read_);
   return result;
 }
 
@@ -182,24 +279,51 @@ Network::IoResult TsiSocket::doWrite(Buffer::Instance &buffer,
     }
   }
 
+  // With coalesce_writes_, the plaintext short of a whole frame is left in
+  // buffer, the connection write buffer, while the raw socket is backed up.
+  // The write event following once it drains calls this again with the
+  // newer writes appended, and a flushing close waits for it.
+  const bool coalesce = coalesce_writes_ && !end_stream;
   if (handshake_complete_) {
     ASSERT(frame_protector_);
-    ENVOY_CONN_LOG(debug, "TSI: protecting buffer size: {}",
-                   callbacks_->connection(), buffer.length());
-    tsi_result status = frame_protector_->protect(buffer, raw_write_buffer_);
-    ENVOY_CONN_LOG(debug, "TSI: protected buffer left: {} result: {}",
-                   callbacks_->connection(), buffer.length(),
-                   tsi_result_to_string(status));
-  }
-
-  ENVOY_CONN_LOG(debug, "TSI: raw_write length {} end_stream {}",
-                 callbacks_->connection(), raw_write_buffer_.length(),
-                 end_stream);
-  return raw_buffer_socket_.doWrite(raw_write_buffer_,
-                                    end_stream && (buffer.length() == 0));
+    protect(buffer, coalesce);
+  }
+
+  TSI_DEBUG_LOG("TSI: raw_write length {} end_stream {}",
+                callbacks_->connection(), raw_write_buffer_.length(),
+                end_stream);
+  Network::IoResult result = raw_buffer_socket_.doWrite(
+      raw_write_buffer_, end_stream && (buffer.length() == 0));
+  if (!coalesce || !handshake_complete_ || buffer.length() == 0 ||
+      raw_write_buffer_.length() > 0 ||
+      result.action_ == Network::PostIoAction::Close) {
+    return result;
+  }
+
+  // The raw socket took everything, so no write event may follow: the rest
+  // is written now.
+  protect(buffer, false);
+  Network::IoResult rest = raw_buffer_socket_.doWrite(raw_write_buffer_, false);
+  rest.bytes_processed_ += result.bytes_processed_;
+  return rest;
+}
+
+void TsiSocket::protect(Buffer::Instance &buffer, bool whole_frames) {
+  TSI_DEBUG_LOG("TSI: protecting buffer size: {} whole frames: {}",
+                callbacks_->connection(), buffer.length(), whole_frames);
+  tsi_result status =
+      whole_frames
+          ? frame_protector_->protectWholeFrames(buffer, raw_write_buffer_)
+          : frame_protector_->protect(buffer, raw_write_buffer_);
+  TSI_DEBUG_LOG("TSI: protected buffer left: {} result: {}",
+                callbacks_->connection(), buffer.length(),
+                tsi_result_to_string(status));
 }
 
 void TsiSocket::closeSocket(Network::ConnectionEvent) {
+  // A connection closed before the handshake completes, including while it
+  // is queued, counts as a handshake failure.
+  endHandshake(false);
   handshaker_.release()->deferredDelete();
 }
 
@@ -210,19 +334,41 @@ void TsiSocket::onNextDone(NextResultPtr &&result) {
 
   Network::PostIoAction action = doHandshakeNextDone(std::move(result));
   if (action == Network::PostIoAction::Close) {
+    endHandshake(false);
     callbacks_->connection().close(Network::ConnectionCloseType::NoFlush);
   }
 }
 
 TsiSocketFactory::TsiSocketFactory(HandshakerFactory handshaker_factory,
-                                   HandshakeValidator handshake_validator)
+                                   HandshakeValidator handshake_validator,
+                                   size_t max_frame_size,
+                                   uint32_t max_handshakes,
+                                   TsiSocketStatsSharedPtr stats,
+                                   bool coalesce_writes)
     : handshaker_factory_(std::move(handshaker_factory)),
-      handshake_validator_(std::move(handshake_validator)) {}
+      handshake_validator_(std::move(handshake_validator)),
+      max_frame_size_(max_frame_size), max_handshakes_(max_handshakes),
+      stats_(std::move(stats)), coalesce_writes_(coalesce_writes) {}
 
 bool TsiSocketFactory::implementsSecureTransport() const { return true; }
 
 Network::TransportSocketPtr TsiSocketFactory::createTransportSocket() const {
-  return std::make_unique<TsiSocket>(handshaker_factory_, handshake_validator_);
+  return std::make_unique<TsiSocket>(handshaker_factory_, handshake_validator_,
+                                     max_frame_size_, stats_,
+                                     threadHandshakeLimiter(),
+                                     coalesce_writes_);
+}
+
+HandshakeLimiterSharedPtr TsiSocketFactory::threadHandshakeLimiter() const {
+  if (max_handshakes_ == 0) {
+    return nullptr;
+  }
+  std::lock_guard<std::mutex> lock(limiters_mutex_);
+  HandshakeLimiterSharedPtr &limiter = limiters_[std::this_thread::get_id()];
+  if (!limiter) {
+    limiter = std::make_shared<HandshakeLimiter>(max_handshakes_);
+  }
+  return limiter;
 }
 }  // namespace Security
 }  // namespace Envoy
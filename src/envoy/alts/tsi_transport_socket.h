@@ -14,9 +14,16 @@
  */
 #pragma once
 
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
 #include "common/buffer/buffer_impl.h"
 #include "common/network/raw_buffer_socket.h"
 #include "envoy/network/transport_socket.h"
+#include "envoy/stats/stats_macros.h"
+#include "src/envoy/alts/handshake_limiter.h"
 #include "src/envoy/alts/tsi_frame_protector.h"
 #include "src/envoy/alts/tsi_handshaker.h"
 
@@ -35,11 +42,35 @@ typedef std::function<TsiHandshakerPtr(Event::Dispatcher&)> HandshakerFactory;
 typedef std::function<bool(const tsi_peer& peer, std::string& err)>
     HandshakeValidator;
 
+/**
+ * All TSI socket stats. @see stats_macros.h
+ */
+// clang-format off
+#define ALL_TSI_SOCKET_STATS(COUNTER, GAUGE, HISTOGRAM)                       \
+  COUNTER(handshake_success)                                                  \
+  COUNTER(handshake_failure)                                                  \
+  COUNTER(handshake_queued)                                                   \
+  GAUGE(handshake_active)                                                     \
+  GAUGE(handshake_pending)                                                    \
+  HISTOGRAM(handshake_latency_ms)
+// clang-format on
+
+/**
+ * Struct definition for all TSI socket stats. @see stats_macros.h
+ */
+struct TsiSocketStats {
+  ALL_TSI_SOCKET_STATS(GENERATE_COUNTER_STRUCT, GENERATE_GAUGE_STRUCT,
+                       GENERATE_HISTOGRAM_STRUCT)
+};
+
+typedef std::shared_ptr<TsiSocketStats> TsiSocketStatsSharedPtr;
+
 /**
  * A implementation of Network::TransportSocket based on gRPC TSI
  */
 class TsiSocket : public Network::TransportSocket,
                   public TsiHandshakerCallbacks,
+                  public HandshakeLimiter::Callbacks,
                   public Logger::Loggable<Logger::Id::connection> {
  public:
   /**
@@ -47,9 +78,21 @@ class TsiSocket : public Network::TransportSocket,
    * @param handshake_validator a function to validate the peer. Called right
    * after the handshake completed with peer data to do the peer validation.
    * The connection will be closed immediately if it returns false.
+   * @param max_frame_size the maximum size of a protected frame requested
+   * from the frame protector.
+   * @param stats the stats to record the handshake in, may be nullptr.
+   * @param handshake_limiter the limiter of concurrent handshakes of the
+   * worker, may be nullptr for no limit.
+   * @param coalesce_writes if true, the data short of a whole frame is left in
+   * the connection write buffer while the socket is backed up, so that it is
+   * protected together with the next writes.
    */
   TsiSocket(HandshakerFactory handshaker_factory,
-            HandshakeValidator handshake_validator);
+            HandshakeValidator handshake_validator,
+            size_t max_frame_size = kDefaultMaxFrameSize,
+            TsiSocketStatsSharedPtr stats = nullptr,
+            HandshakeLimiterSharedPtr handshake_limiter = nullptr,
+            bool coalesce_writes = false);
   virtual ~TsiSocket();
 
   // Network::TransportSocket
@@ -67,6 +110,9 @@ class TsiSocket : public Network::TransportSocket,
   // TsiHandshakerCallbacks
   void onNextDone(NextResultPtr&& result) override;
 
+  // HandshakeLimiter::Callbacks
+  void onHandshakeSlot() override;
+
  private:
   /**
    * Callbacks for underlying RawBufferSocket, it proxies fd() and connection()
@@ -92,11 +138,26 @@ class TsiSocket : public Network::TransportSocket,
   Network::PostIoAction doHandshake();
   void doHandshakeNext();
   Network::PostIoAction doHandshakeNextDone(NextResultPtr&& next_result);
+  // Ends the handshake, records its outcome and releases its slot.
+  void endHandshake(bool success);
+  // Protects buffer into raw_write_buffer_, only the whole frames of it if
+  // whole_frames is true.
+  void protect(Buffer::Instance& buffer, bool whole_frames);
 
   HandshakerFactory handshaker_factory_;
   HandshakeValidator handshake_validator_;
+  const size_t max_frame_size_;
+  TsiSocketStatsSharedPtr stats_;
+  HandshakeLimiterSharedPtr handshake_limiter_;
   TsiHandshakerPtr handshaker_{};
   bool handshaker_next_calling_{};
+  // True once the handshake is started, it may wait for a slot then.
+  bool handshake_started_{};
+  // True while the handshake waits in the handshake limiter queue.
+  bool handshake_queued_{};
+  // True while the handshake holds a slot of the handshake limiter.
+  bool handshake_slot_{};
+  std::chrono::steady_clock::time_point handshake_start_time_;
   // TODO(lizan): wrap frame protector in a C++ class
   TsiFrameProtectorPtr frame_protector_;
 
@@ -106,6 +167,8 @@ class TsiSocket : public Network::TransportSocket,
 
   Envoy::Buffer::OwnedImpl raw_read_buffer_;
   Envoy::Buffer::OwnedImpl raw_write_buffer_;
+
+  const bool coalesce_writes_;
   bool handshake_complete_{};
 };
 
@@ -114,8 +177,18 @@ class TsiSocket : public Network::TransportSocket,
  */
 class TsiSocketFactory : public Network::TransportSocketFactory {
  public:
+  /**
+   * @param max_handshakes the maximum number of concurrent handshakes per
+   * worker thread, 0 means no limit.
+   * @param stats the stats shared by the sockets, may be nullptr.
+   * @param coalesce_writes if true, the sockets coalesce small writes.
+   */
   TsiSocketFactory(HandshakerFactory handshaker_factory,
-                   HandshakeValidator handshake_validator);
+                   HandshakeValidator handshake_validator,
+                   size_t max_frame_size = kDefaultMaxFrameSize,
+                   uint32_t max_handshakes = 0,
+                   TsiSocketStatsSharedPtr stats = nullptr,
+                   bool coalesce_writes = false);
 
   bool implementsSecureTransport() const override;
   Network::TransportSocketPtr createTransportSocket() const override;
@@ -123,6 +196,20 @@ class TsiSocketFactory : public Network::TransportSocketFactory {
  private:
   HandshakerFactory handshaker_factory_;
   HandshakeValidator handshake_validator_;
+  const size_t max_frame_size_;
+  const uint32_t max_handshakes_;
+  TsiSocketStatsSharedPtr stats_;
+  const bool coalesce_writes_;
+
+  // Returns the handshake limiter of the calling worker thread.
+  HandshakeLimiterSharedPtr threadHandshakeLimiter() const;
+
+  // The handshake limiter of each worker thread, created on its first socket.
+  // Sockets share the ownership so a limiter outlives the factory as long as
+  // a socket uses it.
+  mutable std::mutex limiters_mutex_;
+  mutable std::unordered_map<std::thread::id, HandshakeLimiterSharedPtr>
+      limiters_;
 };
 }  // namespace Security
 }  // namespace Envoy
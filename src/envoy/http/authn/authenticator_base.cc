@@ -36,6 +36,7 @@ bool AuthenticatorBase::validateX509(const iaapi::MutualTls& mtls,
   const Network::Connection* connection = filter_context_.connection();
   if (connection == nullptr || connection->ssl() == nullptr) {
     // Not a TLS connection
+    recordMtls(false);
     return false;
   }
 
@@ -43,25 +44,41 @@ bool AuthenticatorBase::validateX509(const iaapi::MutualTls& mtls,
       connection->ssl()->peerCertificatePresented() &&
       Utils::GetSourceUser(connection, payload->mutable_x509()->mutable_user());
 
-  return has_user || mtls.allow_tls();
+  bool success = has_user || mtls.allow_tls();
+  recordMtls(success);
+  return success;
+}
+
+void AuthenticatorBase::recordMtls(bool success) const {
+  AuthnStats* stats = filter_context_.stats();
+  if (stats == nullptr) {
+    return;
+  }
+  if (success) {
+    stats->filter().mtls_success_.inc();
+  } else {
+    stats->filter().mtls_failure_.inc();
+  }
 }
 
 bool AuthenticatorBase::validateJwt(const iaapi::Jwt& jwt, Payload* payload) {
   Envoy::Http::HeaderMap& header = *filter_context()->headers();
 
-  auto iter =
-      filter_context()->filter_config().jwt_output_payload_locations().find(
-          jwt.issuer());
-  if (iter ==
-      filter_context()->filter_config().jwt_output_payload_locations().end()) {
+  const LowerCaseString* header_key =
+      filter_context()->plan().jwtPayloadHeader(jwt.issuer());
+  if (header_key == nullptr) {
     ENVOY_LOG(warn, "No JWT payload header location is found for the issuer {}",
               jwt.issuer());
     return false;
   }
 
-  LowerCaseString header_key(iter->second);
-  return AuthnUtils::GetJWTPayloadFromHeaders(header, header_key,
-                                              payload->mutable_jwt());
+  bool success = AuthnUtils::GetJWTPayloadFromHeaders(header, *header_key,
+                                                      payload->mutable_jwt());
+  AuthnStats* stats = filter_context()->stats();
+  if (stats != nullptr) {
+    stats->recordJwt(jwt.issuer(), success);
+  }
+  return success;
 }
 
 }  // namespace AuthN
@@ -53,6 +53,9 @@ class AuthenticatorBase : public Logger::Loggable<Logger::Id::filter> {
   FilterContext* filter_context() { return &filter_context_; }
 
  private:
+  // Counts the outcome of a mTLS method, if the stats are recorded.
+  void recordMtls(bool success) const;
+
   // Pointer to filter state. Do not own.
   FilterContext& filter_context_;
 };
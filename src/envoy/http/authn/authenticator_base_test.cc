@@ -64,9 +64,8 @@ class AuthenticatorBaseTest : public testing::Test,
   NiceMock<Envoy::Network::MockConnection> connection_{};
   NiceMock<Envoy::Ssl::MockConnection> ssl_{};
   FilterConfig filter_config_{};
-  FilterContext filter_context_{&request_headers_, &connection_,
-                                istio::envoy::config::filter::http::authn::
-                                    v2alpha1::FilterConfig::default_instance()};
+  PolicyPlan plan_{FilterConfig::default_instance()};
+  FilterContext filter_context_{&request_headers_, &connection_, plan_};
 
   MockAuthenticatorBase authenticator_{&filter_context_};
 
@@ -165,6 +164,21 @@ TEST_F(AuthenticatorBaseTest, ValidateMtlsOnSslConnectionWithPeerSpiffeCert) {
   EXPECT_EQ(payload_->x509().user(), "foo");
 }
 
+TEST_F(AuthenticatorBaseTest, ValidateMtlsParsesPeerCertOncePerConnection) {
+  EXPECT_CALL(Const(connection_), ssl()).WillRepeatedly(Return(&ssl_));
+  EXPECT_CALL(Const(ssl_), peerCertificatePresented())
+      .WillRepeatedly(Return(true));
+  // The source user is extracted by the first request of the connection.
+  EXPECT_CALL(ssl_, uriSanPeerCertificate())
+      .Times(1)
+      .WillOnce(Return("spiffe://foo"));
+  for (int i = 0; i < 2; ++i) {
+    Payload payload;
+    EXPECT_TRUE(authenticator_.validateX509(mtls_params_, &payload));
+    EXPECT_EQ(payload.x509().user(), "foo");
+  }
+}
+
 TEST_F(AuthenticatorBaseTest, ValidateTlsOnSslConnectionWithPeerSpiffeCert) {
   mtls_params_.set_allow_tls(true);  // allow TLS connection
   EXPECT_CALL(Const(connection_), ssl()).WillRepeatedly(Return(&ssl_));
@@ -240,8 +254,8 @@ TEST_F(AuthenticatorBaseTest, ValidateJwtWithNoIssuer) {
         )",
       &filter_config, options);
   Http::TestHeaderMapImpl empty_request_headers{};
-  FilterContext filter_context{&empty_request_headers, &connection_,
-                               filter_config};
+  PolicyPlan plan{filter_config};
+  FilterContext filter_context{&empty_request_headers, &connection_, plan};
   MockAuthenticatorBase authenticator{&filter_context};
 
   // When there is no issuer in the JWT config, validateJwt() should return
@@ -264,8 +278,8 @@ TEST_F(AuthenticatorBaseTest, ValidateJwtWithEmptyJwtOutputPayloadLocations) {
            }
         )",
       &filter_config, options);
-  FilterContext filter_context{&request_headers_with_jwt, &connection_,
-                               filter_config};
+  PolicyPlan plan{filter_config};
+  FilterContext filter_context{&request_headers_with_jwt, &connection_, plan};
   MockAuthenticatorBase authenticator{&filter_context};
   // authenticator has empty jwt_output_payload_locations in Istio authn config
   // When there is no matching jwt_output_payload_locations for the issuer in
@@ -288,8 +302,8 @@ TEST_F(AuthenticatorBaseTest, ValidateJwtWithNoJwtInHeader) {
         )",
       &filter_config, options);
   Http::TestHeaderMapImpl empty_request_headers{};
-  FilterContext filter_context{&empty_request_headers, &connection_,
-                               filter_config};
+  PolicyPlan plan{filter_config};
+  FilterContext filter_context{&empty_request_headers, &connection_, plan};
   MockAuthenticatorBase authenticator{&filter_context};
   // When there is no JWT in the HTTP header, validateJwt() should return
   // nullptr and failure.
@@ -312,8 +326,8 @@ TEST_F(AuthenticatorBaseTest, ValidateJwtWithJwtInHeader) {
            }
         )",
       &filter_config, options);
-  FilterContext filter_context{&request_headers_with_jwt, &connection_,
-                               filter_config};
+  PolicyPlan plan{filter_config};
+  FilterContext filter_context{&request_headers_with_jwt, &connection_, plan};
   MockAuthenticatorBase authenticator{&filter_context};
   Payload expected_payload;
   JsonStringToMessage(
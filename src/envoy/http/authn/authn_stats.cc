@@ -0,0 +1,82 @@
+/* Copyright 2018 Istio Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/envoy/http/authn/authn_stats.h"
+
+#include <cctype>
+
+using istio::envoy::config::filter::http::authn::v2alpha1::FilterConfig;
+
+namespace Envoy {
+namespace Http {
+namespace Istio {
+namespace AuthN {
+namespace {
+
+// Returns the issuer as a stat name element, with the characters other
+// than letters, digits, '-' and '_' replaced by '_'. Issuers are often
+// URLs, whose '.' would split the stat name.
+std::string IssuerStatName(const std::string& issuer) {
+  std::string name = issuer;
+  for (char& c : name) {
+    if (!isalnum(static_cast<unsigned char>(c)) && c != '-' && c != '_') {
+      c = '_';
+    }
+  }
+  return name;
+}
+
+}  // namespace
+
+AuthnStats::AuthnStats(const FilterConfig& filter_config,
+                       const std::string& prefix, Stats::Scope& scope)
+    : filter_{ALL_AUTHN_FILTER_STATS(POOL_COUNTER_PREFIX(scope, prefix),
+                                     POOL_GAUGE_PREFIX(scope, prefix),
+                                     POOL_HISTOGRAM_PREFIX(scope, prefix))} {
+  auto add_issuer = [this, &prefix, &scope](const std::string& issuer) {
+    if (issuers_.count(issuer) > 0) {
+      return;
+    }
+    const std::string name = prefix + "jwt." + IssuerStatName(issuer) + ".";
+    issuers_.emplace(issuer, IssuerStats{scope.counter(name + "success"),
+                                         scope.counter(name + "failure")});
+  };
+  const auto& policy = filter_config.policy();
+  for (const auto& method : policy.peers()) {
+    if (method.has_jwt()) {
+      add_issuer(method.jwt().issuer());
+    }
+  }
+  for (const auto& method : policy.origins()) {
+    add_issuer(method.jwt().issuer());
+  }
+}
+
+void AuthnStats::recordJwt(const std::string& issuer, bool success) {
+  auto it = issuers_.find(issuer);
+  if (it == issuers_.end()) {
+    return;
+  }
+  if (success) {
+    it->second.success.inc();
+  } else {
+    it->second.failure.inc();
+  }
+}
+
+}  // namespace AuthN
+}  // namespace Istio
+}  // namespace Http
+}  // namespace Envoy
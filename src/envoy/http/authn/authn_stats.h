@@ -0,0 +1,101 @@
+/* Copyright 2018 Istio Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "envoy/config/filter/http/authn/v2alpha1/config.pb.h"
+#include "envoy/stats/stats.h"
+#include "envoy/stats/stats_macros.h"
+#include "src/envoy/utils/phase_timer.h"
+
+#include <string>
+#include <unordered_map>
+
+namespace Envoy {
+namespace Http {
+namespace Istio {
+namespace AuthN {
+
+/**
+ * The per-request nanoseconds of the authn filter decodeHeaders(), only in
+ * the phase_timing builds. @see src/envoy/utils/phase_timer.h
+ */
+// clang-format off
+#ifdef ISTIO_PHASE_TIMING
+#define AUTHN_PHASE_TIMING_STATS(HISTOGRAM)                                   \
+  HISTOGRAM(decode_headers_ns)
+#else
+#define AUTHN_PHASE_TIMING_STATS(HISTOGRAM)
+#endif
+// clang-format on
+
+/**
+ * All authn filter stats. @see stats_macros.h
+ */
+// clang-format off
+#define ALL_AUTHN_FILTER_STATS(COUNTER, GAUGE, HISTOGRAM)                     \
+  COUNTER(peer_success)                                                       \
+  COUNTER(peer_failure)                                                       \
+  COUNTER(origin_success)                                                     \
+  COUNTER(origin_failure)                                                     \
+  COUNTER(mtls_success)                                                       \
+  COUNTER(mtls_failure)                                                       \
+  HISTOGRAM(peer_latency_us)                                                  \
+  HISTOGRAM(origin_latency_us)                                                \
+  AUTHN_PHASE_TIMING_STATS(HISTOGRAM)
+// clang-format on
+
+/**
+ * Struct definition for all authn filter stats. @see stats_macros.h
+ */
+struct AuthnFilterStats {
+  ALL_AUTHN_FILTER_STATS(GENERATE_COUNTER_STRUCT, GENERATE_GAUGE_STRUCT,
+                         GENERATE_HISTOGRAM_STRUCT)
+};
+
+// AuthnStats holds the stats of an authn filter config: the filter stats,
+// and the JWT outcome of each issuer of the policy. The stats are created
+// once with the config, the requests only increment them.
+class AuthnStats {
+ public:
+  AuthnStats(
+      const istio::envoy::config::filter::http::authn::v2alpha1::FilterConfig&
+          filter_config,
+      const std::string& prefix, Stats::Scope& scope);
+
+  // Accessor to the filter stats.
+  AuthnFilterStats& filter() { return filter_; }
+
+  // Counts the outcome of a JWT method of the issuer.
+  void recordJwt(const std::string& issuer, bool success);
+
+ private:
+  // The JWT stats of an issuer.
+  struct IssuerStats {
+    Stats::Counter& success;
+    Stats::Counter& failure;
+  };
+
+  // The filter stats.
+  AuthnFilterStats filter_;
+
+  // The JWT stats, indexed by issuer.
+  std::unordered_map<std::string, IssuerStats> issuers_;
+};
+
+}  // namespace AuthN
+}  // namespace Istio
+}  // namespace Http
+}  // namespace Envoy
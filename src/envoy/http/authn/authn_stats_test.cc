@@ -0,0 +1,69 @@
+/* Copyright 2018 Istio Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/envoy/http/authn/authn_stats.h"
+#include "common/protobuf/protobuf.h"
+#include "common/stats/stats_impl.h"
+#include "test/test_common/utility.h"
+
+using istio::envoy::config::filter::http::authn::v2alpha1::FilterConfig;
+
+namespace Envoy {
+namespace Http {
+namespace Istio {
+namespace AuthN {
+namespace {
+
+TEST(AuthnStatsTest, IssuerStats) {
+  FilterConfig filter_config;
+  ASSERT_TRUE(Protobuf::TextFormat::ParseFromString(R"(
+    policy {
+      peers {
+        jwt {
+          issuer: "peer@foo.com"
+        }
+      }
+      origins {
+        jwt {
+          issuer: "https://example.com"
+        }
+      }
+    }
+  )",
+                                                    &filter_config));
+  Stats::IsolatedStoreImpl store;
+  AuthnStats stats(filter_config, "test.", store);
+
+  stats.recordJwt("https://example.com", true);
+  stats.recordJwt("https://example.com", false);
+  stats.recordJwt("https://example.com", true);
+  stats.recordJwt("peer@foo.com", false);
+  // Issuers not in the policy are not counted.
+  stats.recordJwt("unknown@foo.com", true);
+
+  EXPECT_EQ(2, store.counter("test.jwt.https___example_com.success").value());
+  EXPECT_EQ(1, store.counter("test.jwt.https___example_com.failure").value());
+  EXPECT_EQ(0, store.counter("test.jwt.peer_foo_com.success").value());
+  EXPECT_EQ(1, store.counter("test.jwt.peer_foo_com.failure").value());
+
+  stats.filter().peer_success_.inc();
+  EXPECT_EQ(1, store.counter("test.peer_success").value());
+}
+
+}  // namespace
+}  // namespace AuthN
+}  // namespace Istio
+}  // namespace Http
+}  // namespace Envoy
@@ -30,10 +30,10 @@ void FilterContext::setPeerResult(const Payload* payload) {
   if (payload != nullptr) {
     switch (payload->payload_case()) {
       case Payload::kX509:
-        result_.set_peer_user(payload->x509().user());
+        result_->set_peer_user(payload->x509().user());
         break;
       case Payload::kJwt:
-        result_.set_peer_user(payload->jwt().user());
+        result_->set_peer_user(payload->jwt().user());
         break;
       default:
         ENVOY_LOG(warn,
@@ -49,17 +49,17 @@ void FilterContext::setOriginResult(const Payload* payload) {
   // At the moment, only JWT can be used for origin authentication, so
   // it's ok just to check jwt payload.
   if (payload != nullptr && payload->has_jwt()) {
-    *result_.mutable_origin() = payload->jwt();
+    *result_->mutable_origin() = payload->jwt();
   }
 }
 
 void FilterContext::setPrincipal(const iaapi::PrincipalBinding& binding) {
   switch (binding) {
     case iaapi::PrincipalBinding::USE_PEER:
-      result_.set_principal(result_.peer_user());
+      result_->set_principal(result_->peer_user());
       return;
     case iaapi::PrincipalBinding::USE_ORIGIN:
-      result_.set_principal(result_.origin().user());
+      result_->set_principal(result_->origin().user());
       return;
     default:
       // Should never come here.
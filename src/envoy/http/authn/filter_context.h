@@ -18,6 +18,9 @@
 #include "authentication/v1alpha1/policy.pb.h"
 #include "common/common/logger.h"
 #include "envoy/config/filter/http/authn/v2alpha1/config.pb.h"
+#include "google/protobuf/arena.h"
+#include "src/envoy/http/authn/authn_stats.h"
+#include "src/envoy/http/authn/policy_plan.h"
 #include "src/istio/authn/context.pb.h"
 
 namespace Envoy {
@@ -29,14 +32,25 @@ namespace AuthN {
 // result data for authentication process.
 class FilterContext : public Logger::Loggable<Logger::Id::filter> {
  public:
-  FilterContext(
-      HeaderMap* headers, const Network::Connection* connection,
-      const istio::envoy::config::filter::http::authn::v2alpha1::FilterConfig&
-          filter_config)
+  // The stats are optional, nullptr if they are not recorded. The result is
+  // allocated on the arena if there is one, it must outlive the context.
+  FilterContext(HeaderMap* headers, const Network::Connection* connection,
+                const PolicyPlan& plan, AuthnStats* stats = nullptr,
+                google::protobuf::Arena* arena = nullptr)
       : headers_(headers),
         connection_(connection),
-        filter_config_(filter_config) {}
-  virtual ~FilterContext() {}
+        result_(google::protobuf::Arena::CreateMessage<istio::authn::Result>(
+            arena)),
+        plan_(plan),
+        stats_(stats) {}
+  virtual ~FilterContext() {
+    if (result_->GetArena() == nullptr) {
+      delete result_;
+    }
+  }
+
+  FilterContext(const FilterContext&) = delete;
+  FilterContext& operator=(const FilterContext&) = delete;
 
   // Sets peer result based on authenticated payload. Input payload can be null,
   // which basically changes nothing.
@@ -52,7 +66,7 @@ class FilterContext : public Logger::Loggable<Logger::Id::filter> {
       const istio::authentication::v1alpha1::PrincipalBinding& binding);
 
   // Returns the authentication result.
-  const istio::authn::Result& authenticationResult() { return result_; }
+  const istio::authn::Result& authenticationResult() { return *result_; }
 
   // Accessor to headers.
   HeaderMap* headers() { return headers_; }
@@ -61,8 +75,12 @@ class FilterContext : public Logger::Loggable<Logger::Id::filter> {
   // Accessor to the filter config
   const istio::envoy::config::filter::http::authn::v2alpha1::FilterConfig&
   filter_config() const {
-    return filter_config_;
+    return plan_.filter_config();
   }
+  // Accessor to the compiled filter config
+  const PolicyPlan& plan() const { return plan_; }
+  // Accessor to the stats, nullptr if they are not recorded
+  AuthnStats* stats() { return stats_; }
 
  private:
   // Pointer to the headers of the request.
@@ -71,12 +89,14 @@ class FilterContext : public Logger::Loggable<Logger::Id::filter> {
   // Pointer to network connection of the request.
   const Network::Connection* connection_;
 
-  // Holds authentication attribute outputs.
-  istio::authn::Result result_;
+  // Holds authentication attribute outputs, owned unless on an arena.
+  istio::authn::Result* result_;
 
-  // Store the Istio authn filter config.
-  const istio::envoy::config::filter::http::authn::v2alpha1::FilterConfig&
-      filter_config_;
+  // Store the compiled Istio authn filter config.
+  const PolicyPlan& plan_;
+
+  // The stats of the filter config, not owned.
+  AuthnStats* stats_;
 };
 
 }  // namespace AuthN
@@ -34,9 +34,9 @@ class FilterContextTest : public testing::Test {
 
   // This test suit does not use headers nor connection, so ok to use null for
   // them.
-  FilterContext filter_context_{nullptr, nullptr,
-                                istio::envoy::config::filter::http::authn::
-                                    v2alpha1::FilterConfig::default_instance()};
+  PolicyPlan plan_{istio::envoy::config::filter::http::authn::v2alpha1::
+                      FilterConfig::default_instance()};
+  FilterContext filter_context_{nullptr, nullptr, plan_};
 
   Payload x509_payload_{TestUtilities::CreateX509Payload("foo")};
   Payload jwt_payload_{TestUtilities::CreateJwtPayload("bar", "istio.io")};
@@ -119,6 +119,22 @@ TEST_F(FilterContextTest, PrincipalUsePeerOnEmptyPeer) {
                                       filter_context_.authenticationResult()));
 }
 
+TEST_F(FilterContextTest, ResultOnArena) {
+  google::protobuf::Arena arena;
+  FilterContext filter_context{nullptr, nullptr, plan_, nullptr, &arena};
+  filter_context.setPeerResult(&x509_payload_);
+  filter_context.setOriginResult(&jwt_payload_);
+  EXPECT_EQ(filter_context.authenticationResult().GetArena(), &arena);
+  EXPECT_TRUE(TestUtility::protoEqual(TestUtilities::AuthNResultFromString(R"(
+        peer_user: "foo"
+        origin {
+          user: "bar"
+          presenter: "istio.io"
+        }
+      )"),
+                                      filter_context.authenticationResult()));
+}
+
 }  // namespace
 }  // namespace AuthN
 }  // namespace Istio
@@ -17,13 +17,19 @@
 #include "authentication/v1alpha1/policy.pb.h"
 #include "common/http/utility.h"
 #include "envoy/config/filter/http/authn/v2alpha1/config.pb.h"
+#include "include/istio/utils/alloc_accounting.h"
 #include "src/envoy/http/authn/origin_authenticator.h"
 #include "src/envoy/http/authn/peer_authenticator.h"
 #include "src/envoy/utils/authn.h"
 #include "src/envoy/utils/utils.h"
 
+#include <algorithm>
+#include <chrono>
+#include <list>
+#include <map>
+#include <vector>
+
 using istio::authn::Payload;
-using istio::envoy::config::filter::http::authn::v2alpha1::FilterConfig;
 
 namespace iaapi = istio::authentication::v1alpha1;
 
@@ -31,51 +37,197 @@ namespace Envoy {
 namespace Http {
 namespace Istio {
 namespace AuthN {
+namespace {
+
+// The maximum number of connections with a cached peer result per thread.
+const size_t kPeerResultCacheSize = 1000;
+
+// The peer authentication result of a connection.
+struct PeerResult {
+  bool success;
+  Payload payload;
+};
+
+// A LRU cache of the peer authentication results, indexed by the connection
+// id and the policy plan version. Connection ids are never reused, so the
+// results of closed connections are simply evicted.
+class PeerResultCache {
+ public:
+  typedef std::pair<uint64_t, uint64_t> Key;
+
+  static PeerResultCache& threadLocal() {
+    static thread_local PeerResultCache cache;
+    return cache;
+  }
+
+  const PeerResult* lookup(const Key& key) {
+    auto it = index_.find(key);
+    if (it == index_.end()) {
+      return nullptr;
+    }
+    entries_.splice(entries_.begin(), entries_, it->second);
+    return &it->second->second;
+  }
+
+  void insert(const Key& key, const PeerResult& result) {
+    if (entries_.size() >= kPeerResultCacheSize) {
+      index_.erase(entries_.back().first);
+      entries_.pop_back();
+    }
+    entries_.emplace_front(key, result);
+    index_[key] = entries_.begin();
+  }
+
+ private:
+  typedef std::list<std::pair<Key, PeerResult>> EntryList;
+
+  // The entries, the most recently used first.
+  EntryList entries_;
+  // The entries indexed by key.
+  std::map<Key, EntryList::iterator> index_;
+};
 
-AuthenticationFilter::AuthenticationFilter(const FilterConfig& filter_config)
-    : filter_config_(filter_config) {}
+// The first block size of a request arena. It holds the payloads and the
+// result of a request with a JWT of about 20 claims.
+const size_t kRequestArenaBlockSize = 4 * 1024;
 
-AuthenticationFilter::~AuthenticationFilter() {}
+// The maximum number of free request arenas kept per thread, about the
+// number of requests authenticated concurrently by a worker.
+const size_t kMaxFreeRequestArenas = 64;
+
+// Returns the microseconds from start to end.
+uint64_t MicrosecondsBetween(std::chrono::steady_clock::time_point start,
+                             std::chrono::steady_clock::time_point end) {
+  return std::chrono::duration_cast<std::chrono::microseconds>(end - start)
+      .count();
+}
+
+}  // namespace
+
+// The arena keeps its first block across resets, so a reused arena
+// allocates nothing for most requests.
+class RequestArena {
+ public:
+  RequestArena()
+      : block_(new char[kRequestArenaBlockSize]),
+        arena_(options(block_.get())) {}
+
+  google::protobuf::Arena* arena() { return &arena_; }
+
+  // Returns an arena from the free arenas of the thread, or a new one.
+  static std::unique_ptr<RequestArena> get() {
+    auto& free_arenas = freeArenas();
+    if (free_arenas.empty()) {
+      return std::unique_ptr<RequestArena>(new RequestArena);
+    }
+    std::unique_ptr<RequestArena> request_arena =
+        std::move(free_arenas.back());
+    free_arenas.pop_back();
+    return request_arena;
+  }
+
+  // Resets the arena and gives it back to the free arenas of the thread.
+  // The messages on the arena must not be used afterwards.
+  static void release(std::unique_ptr<RequestArena> request_arena) {
+    auto& free_arenas = freeArenas();
+    if (free_arenas.size() < kMaxFreeRequestArenas) {
+      request_arena->arena_.Reset();
+      free_arenas.push_back(std::move(request_arena));
+    }
+  }
+
+ private:
+  static google::protobuf::ArenaOptions options(char* block) {
+    google::protobuf::ArenaOptions options;
+    options.initial_block = block;
+    options.initial_block_size = kRequestArenaBlockSize;
+    options.start_block_size = kRequestArenaBlockSize;
+    return options;
+  }
+
+  static std::vector<std::unique_ptr<RequestArena>>& freeArenas() {
+    static thread_local std::vector<std::unique_ptr<RequestArena>> arenas;
+    return arenas;
+  }
+
+  std::unique_ptr<char[]> block_;
+  google::protobuf::Arena arena_;
+};
+
+AuthenticationFilter::AuthenticationFilter(const PolicyPlan& plan,
+                                           AuthnStats& stats)
+    : plan_(plan), stats_(stats) {}
+
+AuthenticationFilter::~AuthenticationFilter() { releaseArena(); }
 
 void AuthenticationFilter::onDestroy() {
   ENVOY_LOG(debug, "Called AuthenticationFilter : {}", __func__);
+  if (filter_context_) {
+    Utils::Authentication::ClearResultInStream(*filter_context_->headers());
+  }
+  releaseArena();
+}
+
+void AuthenticationFilter::releaseArena() {
+  // The result of the context is on the arena.
+  filter_context_.reset();
+  if (request_arena_) {
+    RequestArena::release(std::move(request_arena_));
+  }
 }
 
 FilterHeadersStatus AuthenticationFilter::decodeHeaders(HeaderMap& headers,
                                                         bool) {
+  ::istio::utils::ScopedAllocTag alloc_tag(::istio::utils::AllocTag::AUTHN);
+  ISTIO_TIME_PHASE(stats_.filter().decode_headers_ns_);
   ENVOY_LOG(debug, "Called AuthenticationFilter : {}", __func__);
   state_ = State::PROCESSING;
 
-  filter_context_.reset(new Istio::AuthN::FilterContext(
-      &headers, decoder_callbacks_->connection(), filter_config_));
+  if (!request_arena_) {
+    request_arena_ = RequestArena::get();
+  }
+  google::protobuf::Arena* arena = request_arena_->arena();
+  filter_context_.emplace(&headers, decoder_callbacks_->connection(), plan_,
+                          &stats_, arena);
 
-  Payload payload;
+  Payload& payload = *google::protobuf::Arena::CreateMessage<Payload>(arena);
 
-  if (!createPeerAuthenticator(filter_context_.get())->run(&payload)) {
+  auto start = std::chrono::steady_clock::now();
+  bool success = authenticatePeer(&payload);
+  auto peer_done = std::chrono::steady_clock::now();
+  stats_.filter().peer_latency_us_.recordValue(
+      MicrosecondsBetween(start, peer_done));
+  if (!success) {
+    stats_.filter().peer_failure_.inc();
     rejectRequest("Peer authentication failed.");
     return FilterHeadersStatus::StopIteration;
   }
+  stats_.filter().peer_success_.inc();
 
-  bool success =
-      createOriginAuthenticator(filter_context_.get())->run(&payload);
+  success = runOriginAuthentication(&filter_context_.value(), &payload);
+  stats_.filter().origin_latency_us_.recordValue(
+      MicrosecondsBetween(peer_done, std::chrono::steady_clock::now()));
+  if (success) {
+    stats_.filter().origin_success_.inc();
+  } else {
+    stats_.filter().origin_failure_.inc();
+  }
 
   // After Istio authn, the JWT headers consumed by Istio authn should be
   // removed.
   // TODO: remove internal headers used to pass data between filters
   // https://github.com/istio/istio/issues/4689
-  for (auto const iter : filter_config_.jwt_output_payload_locations()) {
-    filter_context_->headers()->remove(LowerCaseString(iter.second));
-  }
+  removeJwtPayloadHeaders();
 
   if (!success) {
     rejectRequest("Origin authentication failed.");
     return FilterHeadersStatus::StopIteration;
   }
 
-  // Put authentication result to headers.
-  if (filter_context_ != nullptr) {
-    Utils::Authentication::SaveResultToHeader(
-        filter_context_->authenticationResult(), filter_context_->headers());
+  // Put authentication result to the stream state.
+  if (filter_context_) {
+    Utils::Authentication::SaveResultToStream(
+        filter_context_->authenticationResult(), *filter_context_->headers());
   }
   state_ = State::COMPLETE;
   return FilterHeadersStatus::Continue;
@@ -106,6 +258,56 @@ void AuthenticationFilter::setDecoderFilterCallbacks(
   decoder_callbacks_ = &callbacks;
 }
 
+bool AuthenticationFilter::authenticatePeer(Payload* payload) {
+  const Network::Connection* connection = filter_context_->connection();
+  if (connection == nullptr || !plan_.peerByConnection()) {
+    return runPeerAuthentication(&filter_context_.value(), payload);
+  }
+
+  // The peer identity is fixed for the connection, only the first stream
+  // authenticates it.
+  PeerResultCache::Key key(connection->id(), plan_.version());
+  const PeerResult* cached = PeerResultCache::threadLocal().lookup(key);
+  if (cached != nullptr) {
+    *payload = cached->payload;
+    if (cached->success) {
+      filter_context_->setPeerResult(payload);
+    }
+    return cached->success;
+  }
+
+  bool success = runPeerAuthentication(&filter_context_.value(), payload);
+  PeerResultCache::threadLocal().insert(key, PeerResult{success, *payload});
+  return success;
+}
+
+void AuthenticationFilter::removeJwtPayloadHeaders() {
+  if (plan_.jwtPayloadHeaders().empty()) {
+    return;
+  }
+  // Find the headers present in one pass, then remove only those.
+  struct Context {
+    const PolicyPlan& plan;
+    std::vector<const LowerCaseString*> found;
+  };
+  Context ctx{plan_, {}};
+  filter_context_->headers()->iterate(
+      [](const HeaderEntry& header, void* context) -> HeaderMap::Iterate {
+        Context* ctx = static_cast<Context*>(context);
+        const LowerCaseString* key = ctx->plan.findJwtPayloadHeader(
+            std::string(header.key().c_str(), header.key().size()));
+        if (key != nullptr && std::find(ctx->found.begin(), ctx->found.end(),
+                                        key) == ctx->found.end()) {
+          ctx->found.push_back(key);
+        }
+        return HeaderMap::Iterate::Continue;
+      },
+      &ctx);
+  for (const LowerCaseString* key : ctx.found) {
+    filter_context_->headers()->remove(*key);
+  }
+}
+
 void AuthenticationFilter::rejectRequest(const std::string& message) {
   if (state_ != State::PROCESSING) {
     ENVOY_LOG(error, "State {} is not PROCESSING.", state_);
@@ -116,18 +318,18 @@ void AuthenticationFilter::rejectRequest(const std::string& message) {
                           message);
 }
 
-std::unique_ptr<Istio::AuthN::AuthenticatorBase>
-AuthenticationFilter::createPeerAuthenticator(
-    Istio::AuthN::FilterContext* filter_context) {
-  return std::make_unique<Istio::AuthN::PeerAuthenticator>(
-      filter_context, filter_config_.policy());
+bool AuthenticationFilter::runPeerAuthentication(
+    Istio::AuthN::FilterContext* filter_context, Payload* payload) {
+  Istio::AuthN::PeerAuthenticator authenticator(
+      filter_context, plan_.filter_config().policy());
+  return authenticator.run(payload);
 }
 
-std::unique_ptr<Istio::AuthN::AuthenticatorBase>
-AuthenticationFilter::createOriginAuthenticator(
-    Istio::AuthN::FilterContext* filter_context) {
-  return std::make_unique<Istio::AuthN::OriginAuthenticator>(
-      filter_context, filter_config_.policy());
+bool AuthenticationFilter::runOriginAuthentication(
+    Istio::AuthN::FilterContext* filter_context, Payload* payload) {
+  Istio::AuthN::OriginAuthenticator authenticator(
+      filter_context, plan_.filter_config().policy());
+  return authenticator.run(payload);
 }
 
 }  // namespace AuthN
@@ -18,21 +18,27 @@
 #include "common/common/logger.h"
 #include "envoy/config/filter/http/authn/v2alpha1/config.pb.h"
 #include "envoy/http/filter.h"
+#include "absl/types/optional.h"
 #include "src/envoy/http/authn/authenticator_base.h"
+#include "src/envoy/http/authn/authn_stats.h"
 #include "src/envoy/http/authn/filter_context.h"
+#include "src/envoy/http/authn/policy_plan.h"
+
+#include <memory>
 
 namespace Envoy {
 namespace Http {
 namespace Istio {
 namespace AuthN {
 
+// The pooled memory of the authentication of a request.
+class RequestArena;
+
 // The authentication filter.
 class AuthenticationFilter : public StreamDecoderFilter,
                              public Logger::Loggable<Logger::Id::filter> {
  public:
-  AuthenticationFilter(
-      const istio::envoy::config::filter::http::authn::v2alpha1::FilterConfig&
-          config);
+  AuthenticationFilter(const PolicyPlan& plan, AuthnStats& stats);
   ~AuthenticationFilter();
 
   // Http::StreamFilterBase
@@ -49,24 +55,36 @@ class AuthenticationFilter : public StreamDecoderFilter,
   // Convenient function to call decoder_callbacks_ only when stopped_ is true.
   void continueDecoding();
 
+  // Authenticates the peer, with the result cached for the connection if the
+  // policy allows it.
+  bool authenticatePeer(istio::authn::Payload* payload);
+
+  // Removes the JWT payload headers consumed by the authentication.
+  void removeJwtPayloadHeaders();
+
   // Convenient function to reject request.
   void rejectRequest(const std::string& message);
 
-  // Creates peer authenticator. This is made virtual function for
-  // testing.
-  virtual std::unique_ptr<Istio::AuthN::AuthenticatorBase>
+  // Runs peer authentication with an authenticator on the stack. This is made
+  // virtual function for testing.
+  virtual bool runPeerAuthentication(
+      Istio::AuthN::FilterContext* filter_context,
+      istio::authn::Payload* payload);
 
-  createPeerAuthenticator(Istio::AuthN::FilterContext* filter_context);
+  // Runs origin authentication.
+  virtual bool runOriginAuthentication(
+      Istio::AuthN::FilterContext* filter_context,
+      istio::authn::Payload* payload);
 
-  // Creates origin authenticator.
-  virtual std::unique_ptr<Istio::AuthN::AuthenticatorBase>
+ private:
+  // Destroys the context and gives the request arena back.
+  void releaseArena();
 
-  createOriginAuthenticator(Istio::AuthN::FilterContext* filter_context);
+  // Store the compiled config.
+  const PolicyPlan& plan_;
 
- private:
-  // Store the config.
-  const istio::envoy::config::filter::http::authn::v2alpha1::FilterConfig&
-      filter_config_;
+  // The stats of the filter config.
+  AuthnStats& stats_;
 
   StreamDecoderFilterCallbacks* decoder_callbacks_{};
 
@@ -75,8 +93,13 @@ class AuthenticationFilter : public StreamDecoderFilter,
   State state_{State::INIT};
 
   // Context for authentication process. Created in decodeHeader to start
-  // authentication process.
-  std::unique_ptr<Istio::AuthN::FilterContext> filter_context_;
+  // authentication process, in place.
+  absl::optional<Istio::AuthN::FilterContext> filter_context_;
+
+  // Holds the payload and the result of filter_context_, borrowed by
+  // decodeHeaders and given back to its thread pool when the filter is
+  // destroyed.
+  std::unique_ptr<RequestArena> request_arena_;
 };
 
 }  // namespace AuthN
@@ -29,21 +29,24 @@ namespace Configuration {
 namespace {
 // The name for the Istio authentication filter.
 const std::string kAuthnFactoryName("istio_authn");
+
+// The prefix of the Istio authentication filter stats.
+const std::string kAuthnStatsPrefix("istio_authn.");
 }  // namespace
 
 class AuthnFilterConfig : public NamedHttpFilterConfigFactory,
                           public Logger::Loggable<Logger::Id::filter> {
  public:
   HttpFilterFactoryCb createFilterFactory(const Json::Object& config,
-                                          const std::string&,
-                                          FactoryContext&) override {
+                                          const std::string& stats_prefix,
+                                          FactoryContext& context) override {
     ENVOY_LOG(debug, "Called AuthnFilterConfig : {}", __func__);
 
     google::protobuf::util::Status status =
         Utils::ParseJsonMessage(config.asJsonString(), &filter_config_);
     ENVOY_LOG(debug, "Called AuthnFilterConfig : Utils::ParseJsonMessage()");
     if (status.ok()) {
-      return createFilter();
+      return createFilter(stats_prefix, context);
     } else {
       ENVOY_LOG(critical, "Utils::ParseJsonMessage() return value is: " +
                               status.ToString());
@@ -55,10 +58,10 @@ class AuthnFilterConfig : public NamedHttpFilterConfigFactory,
   }
 
   HttpFilterFactoryCb createFilterFactoryFromProto(
-      const Protobuf::Message& proto_config, const std::string&,
-      FactoryContext&) override {
+      const Protobuf::Message& proto_config, const std::string& stats_prefix,
+      FactoryContext& context) override {
     filter_config_ = dynamic_cast<const FilterConfig&>(proto_config);
-    return createFilter();
+    return createFilter(stats_prefix, context);
   }
 
   ProtobufTypes::MessagePtr createEmptyConfigProto() override {
@@ -69,13 +72,19 @@ class AuthnFilterConfig : public NamedHttpFilterConfigFactory,
   std::string name() override { return kAuthnFactoryName; }
 
  private:
-  HttpFilterFactoryCb createFilter() {
+  HttpFilterFactoryCb createFilter(const std::string& stats_prefix,
+                                   FactoryContext& context) {
     ENVOY_LOG(debug, "Called AuthnFilterConfig : {}", __func__);
 
-    return [&](Http::FilterChainFactoryCallbacks& callbacks) -> void {
+    // The policy is compiled once for all the requests.
+    auto plan =
+        std::make_shared<Http::Istio::AuthN::PolicyPlan>(filter_config_);
+    auto stats = std::make_shared<Http::Istio::AuthN::AuthnStats>(
+        filter_config_, stats_prefix + kAuthnStatsPrefix, context.scope());
+    return [plan, stats](Http::FilterChainFactoryCallbacks& callbacks) -> void {
       callbacks.addStreamDecoderFilter(
-          std::make_shared<Http::Istio::AuthN::AuthenticationFilter>(
-              filter_config_));
+          std::make_shared<Http::Istio::AuthN::AuthenticationFilter>(*plan,
+                                                                     *stats));
     };
   }
 
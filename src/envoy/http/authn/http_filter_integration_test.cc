@@ -2,9 +2,7 @@
 #include "src/istio/authn/context.pb.h"
 #include "test/integration/http_integration.h"
 
-using google::protobuf::util::MessageDifferencer;
 using istio::authn::Payload;
-using istio::authn::Result;
 
 namespace Envoy {
 namespace {
@@ -175,53 +173,29 @@ TEST_P(AuthenticationFilterIntegrationTest, CheckConsumedJwtHeadersAreRemoved) {
   EXPECT_TRUE(nullptr == upstream_request_->headers().get(header_location));
 }
 
-TEST_P(AuthenticationFilterIntegrationTest, CheckAuthnResultIsExpected) {
+TEST_P(AuthenticationFilterIntegrationTest, AuthnResultIsNotForwarded) {
   createTestServer(
       "src/envoy/http/authn/testdata/envoy_origin_jwt_authn_only.conf",
       {"http"});
 
   // The AuthN filter requires JWT and the http request contains validated JWT.
-  // In this case, the authentication should succeed and an authn result
-  // should be generated.
+  // In this case, the authentication should succeed and the authn result
+  // is kept in the stream state for the following filters only.
   codec_client_ =
       makeHttpConnection(makeClientConnection((lookupPort("http"))));
   codec_client_->makeHeaderOnlyRequest(request_headers_with_jwt_, *response_);
 
   // Wait for request to upstream[0] (backend)
   waitForNextUpstreamRequest(0);
+  EXPECT_EQ(nullptr,
+            upstream_request_->headers().get(kSecIstioAuthnPayloadHeaderKey));
+  // Send backend response.
+  upstream_request_->encodeHeaders(Http::TestHeaderMapImpl{{":status", "200"}},
+                                   true);
 
-  // Authn result should be as expected
-  const Envoy::Http::HeaderString &header_value =
-      upstream_request_->headers().get(kSecIstioAuthnPayloadHeaderKey)->value();
-  std::string value_base64(header_value.c_str(), header_value.size());
-  const std::string value = Base64::decode(value_base64);
-  Result result;
-  google::protobuf::util::JsonParseOptions options;
-  Result expected_result;
-
-  bool parse_ret = result.ParseFromString(value);
-  EXPECT_TRUE(parse_ret);
-  JsonStringToMessage(
-      R"(
-          {
-            "origin": {
-              "user": "628645741881-noabiu23f5a8m8ovd8ucv698lj78vv0l@developer.gserviceaccount.com/628645741881-noabiu23f5a8m8ovd8ucv698lj78vv0l@developer.gserviceaccount.com",
-              "audiences": [
-               "bookstore-esp-echo.cloudendpointsapis.com"
-              ],
-              "presenter": "",
-              "claims": {
-               "aud": "bookstore-esp-echo.cloudendpointsapis.com",
-               "iss": "628645741881-noabiu23f5a8m8ovd8ucv698lj78vv0l@developer.gserviceaccount.com",
-               "sub": "628645741881-noabiu23f5a8m8ovd8ucv698lj78vv0l@developer.gserviceaccount.com"
-              }
-            }
-          }
-      )",
-      &expected_result, options);
-  // Note: TestUtility::protoEqual() uses SerializeAsString() and the output
-  // is non-deterministic. Thus, MessageDifferencer::Equals() is used.
-  EXPECT_TRUE(MessageDifferencer::Equals(expected_result, result));
+  response_->waitForEndStream();
+  EXPECT_TRUE(response_->complete());
+  EXPECT_STREQ("200", response_->headers().Status()->value().c_str());
 }
 
 }  // namespace
@@ -16,6 +16,7 @@
 #include "src/envoy/http/authn/http_filter.h"
 #include "common/common/base64.h"
 #include "common/http/header_map_impl.h"
+#include "common/stats/stats_impl.h"
 #include "envoy/config/filter/http/authn/v2alpha1/config.pb.h"
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
@@ -23,6 +24,7 @@
 #include "src/envoy/http/authn/test_utils.h"
 #include "src/envoy/utils/authn.h"
 #include "test/mocks/http/mocks.h"
+#include "test/mocks/network/mocks.h"
 #include "test/test_common/utility.h"
 
 using Envoy::Http::Istio::AuthN::AuthenticatorBase;
@@ -32,6 +34,7 @@ using istio::authn::Result;
 using istio::envoy::config::filter::http::authn::v2alpha1::FilterConfig;
 using testing::Invoke;
 using testing::NiceMock;
+using testing::Return;
 using testing::StrictMock;
 using testing::_;
 
@@ -41,47 +44,41 @@ namespace Istio {
 namespace AuthN {
 namespace {
 
-// Create a fake authenticator for test. This authenticator do nothing except
-// making the authentication fail.
-std::unique_ptr<AuthenticatorBase> createAlwaysFailAuthenticator(
-    FilterContext* filter_context) {
-  class _local : public AuthenticatorBase {
-   public:
-    _local(FilterContext* filter_context) : AuthenticatorBase(filter_context) {}
-    bool run(Payload*) override { return false; }
-  };
-  return std::make_unique<_local>(filter_context);
+// A fake authentication for test. It does nothing except making the
+// authentication fail.
+bool runAlwaysFailAuthentication(FilterContext*, Payload*) { return false; }
+
+// A fake authentication for test. It does nothing except making the
+// authentication successful.
+bool runAlwaysPassAuthentication(FilterContext* filter_context, Payload*) {
+  // Set some data to verify authentication result later.
+  auto payload = TestUtilities::CreateX509Payload("foo");
+  filter_context->setPeerResult(&payload);
+  return true;
 }
 
-// Create a fake authenticator for test. This authenticator do nothing except
-// making the authentication successful.
-std::unique_ptr<AuthenticatorBase> createAlwaysPassAuthenticator(
-    FilterContext* filter_context) {
-  class _local : public AuthenticatorBase {
-   public:
-    _local(FilterContext* filter_context) : AuthenticatorBase(filter_context) {}
-    bool run(Payload*) override {
-      // Set some data to verify authentication result later.
-      auto payload = TestUtilities::CreateX509Payload("foo");
-      filter_context()->setPeerResult(&payload);
-      return true;
-    }
-  };
-  return std::make_unique<_local>(filter_context);
+// We'll use fake authentication for test, so policy is not really needed. Use
+// default config for simplicity.
+const PolicyPlan& defaultPlan() {
+  static const PolicyPlan plan(FilterConfig::default_instance());
+  return plan;
+}
+
+// The stats of the test filters.
+AuthnStats& testStats() {
+  static Stats::IsolatedStoreImpl store;
+  static AuthnStats stats(FilterConfig::default_instance(), "test.", store);
+  return stats;
 }
 
 class MockAuthenticationFilter : public AuthenticationFilter {
  public:
-  // We'll use fake authenticator for test, so policy is not really needed. Use
-  // default config for simplicity.
-  MockAuthenticationFilter()
-      : AuthenticationFilter(FilterConfig::default_instance()) {}
+  MockAuthenticationFilter(const PolicyPlan& plan = defaultPlan())
+      : AuthenticationFilter(plan, testStats()) {}
   ~MockAuthenticationFilter(){};
 
-  MOCK_METHOD1(createPeerAuthenticator,
-               std::unique_ptr<AuthenticatorBase>(FilterContext*));
-  MOCK_METHOD1(createOriginAuthenticator,
-               std::unique_ptr<AuthenticatorBase>(FilterContext*));
+  MOCK_METHOD2(runPeerAuthentication, bool(FilterContext*, Payload*));
+  MOCK_METHOD2(runOriginAuthentication, bool(FilterContext*, Payload*));
 };
 
 class AuthenticationFilterTest : public testing::Test {
@@ -103,9 +100,9 @@ class AuthenticationFilterTest : public testing::Test {
 TEST_F(AuthenticationFilterTest, PeerFail) {
   // Peer authentication fail, request should be rejected with 401. No origin
   // authentiation needed.
-  EXPECT_CALL(filter_, createPeerAuthenticator(_))
+  EXPECT_CALL(filter_, runPeerAuthentication(_, _))
       .Times(1)
-      .WillOnce(Invoke(createAlwaysFailAuthenticator));
+      .WillOnce(Invoke(runAlwaysFailAuthentication));
   EXPECT_CALL(decoder_callbacks_, encodeHeaders_(_, _))
       .Times(1)
       .WillOnce(testing::Invoke([](Http::HeaderMap& headers, bool) {
@@ -119,12 +116,12 @@ TEST_F(AuthenticationFilterTest, PeerFail) {
 TEST_F(AuthenticationFilterTest, PeerPassOrginFail) {
   // Peer pass thus origin authentication must be called. Final result should
   // fail as origin authn fails.
-  EXPECT_CALL(filter_, createPeerAuthenticator(_))
+  EXPECT_CALL(filter_, runPeerAuthentication(_, _))
       .Times(1)
-      .WillOnce(Invoke(createAlwaysPassAuthenticator));
-  EXPECT_CALL(filter_, createOriginAuthenticator(_))
+      .WillOnce(Invoke(runAlwaysPassAuthentication));
+  EXPECT_CALL(filter_, runOriginAuthentication(_, _))
       .Times(1)
-      .WillOnce(Invoke(createAlwaysFailAuthenticator));
+      .WillOnce(Invoke(runAlwaysFailAuthentication));
   EXPECT_CALL(decoder_callbacks_, encodeHeaders_(_, _))
       .Times(1)
       .WillOnce(testing::Invoke([](Http::HeaderMap& headers, bool) {
@@ -136,19 +133,66 @@ TEST_F(AuthenticationFilterTest, PeerPassOrginFail) {
 }
 
 TEST_F(AuthenticationFilterTest, AllPass) {
-  EXPECT_CALL(filter_, createPeerAuthenticator(_))
+  EXPECT_CALL(filter_, runPeerAuthentication(_, _))
       .Times(1)
-      .WillOnce(Invoke(createAlwaysPassAuthenticator));
-  EXPECT_CALL(filter_, createOriginAuthenticator(_))
+      .WillOnce(Invoke(runAlwaysPassAuthentication));
+  EXPECT_CALL(filter_, runOriginAuthentication(_, _))
       .Times(1)
-      .WillOnce(Invoke(createAlwaysPassAuthenticator));
+      .WillOnce(Invoke(runAlwaysPassAuthentication));
   EXPECT_EQ(Http::FilterHeadersStatus::Continue,
             filter_.decodeHeaders(request_headers_, true));
+  EXPECT_FALSE(Utils::Authentication::HasResultInHeader(request_headers_));
   Result authn;
-  EXPECT_TRUE(
-      Utils::Authentication::FetchResultFromHeader(request_headers_, &authn));
+  EXPECT_TRUE(Utils::Authentication::FetchResult(request_headers_, &authn));
   EXPECT_TRUE(TestUtility::protoEqual(
       TestUtilities::AuthNResultFromString(R"(peer_user: "foo")"), authn));
+
+  // The result is cleared with the stream.
+  filter_.onDestroy();
+  EXPECT_FALSE(Utils::Authentication::FetchResult(request_headers_, &authn));
+}
+
+TEST_F(AuthenticationFilterTest, PeerResultCachedForConnection) {
+  FilterConfig filter_config;
+  ASSERT_TRUE(Protobuf::TextFormat::ParseFromString(R"(
+    policy {
+      peers {
+        mtls {
+        }
+      }
+    }
+  )",
+                                                    &filter_config));
+  PolicyPlan plan(filter_config);
+  NiceMock<Network::MockConnection> connection;
+  ON_CALL(decoder_callbacks_, connection()).WillByDefault(Return(&connection));
+
+  // Only the first stream of the connection authenticates the peer.
+  StrictMock<MockAuthenticationFilter> first_filter(plan);
+  first_filter.setDecoderFilterCallbacks(decoder_callbacks_);
+  EXPECT_CALL(first_filter, runPeerAuthentication(_, _))
+      .WillOnce(Invoke([](FilterContext* filter_context, Payload* payload) {
+        *payload = TestUtilities::CreateX509Payload("foo");
+        filter_context->setPeerResult(payload);
+        return true;
+      }));
+  EXPECT_CALL(first_filter, runOriginAuthentication(_, _))
+      .WillOnce(Return(true));
+  EXPECT_EQ(Http::FilterHeadersStatus::Continue,
+            first_filter.decodeHeaders(request_headers_, true));
+  first_filter.onDestroy();
+
+  StrictMock<MockAuthenticationFilter> second_filter(plan);
+  second_filter.setDecoderFilterCallbacks(decoder_callbacks_);
+  EXPECT_CALL(second_filter, runOriginAuthentication(_, _))
+      .WillOnce(Return(true));
+  Http::TestHeaderMapImpl request_headers{{":method", "GET"}, {":path", "/"}};
+  EXPECT_EQ(Http::FilterHeadersStatus::Continue,
+            second_filter.decodeHeaders(request_headers, true));
+  Result authn;
+  EXPECT_TRUE(Utils::Authentication::FetchResult(request_headers, &authn));
+  EXPECT_EQ("foo", authn.peer_user());
+  second_filter.onDestroy();
 }
 
 }  // namespace
@@ -122,9 +122,9 @@ class OriginAuthenticatorTest : public testing::TestWithParam<bool> {
  protected:
   std::unique_ptr<StrictMock<MockOriginAuthenticator>> authenticator_;
   Http::TestHeaderMapImpl request_headers_;
-  FilterContext filter_context_{&request_headers_, nullptr,
-                                istio::envoy::config::filter::http::authn::
-                                    v2alpha1::FilterConfig::default_instance()};
+  PolicyPlan plan_{istio::envoy::config::filter::http::authn::v2alpha1::
+                      FilterConfig::default_instance()};
+  FilterContext filter_context_{&request_headers_, nullptr, plan_};
   iaapi::Policy policy_;
 
   Payload* payload_;
@@ -68,9 +68,9 @@ class PeerAuthenticatorTest : public testing::Test {
  protected:
   std::unique_ptr<StrictMock<MockPeerAuthenticator>> authenticator_;
   Http::TestHeaderMapImpl request_headers_;
-  FilterContext filter_context_{&request_headers_, nullptr,
-                                istio::envoy::config::filter::http::authn::
-                                    v2alpha1::FilterConfig::default_instance()};
+  PolicyPlan plan_{istio::envoy::config::filter::http::authn::v2alpha1::
+                      FilterConfig::default_instance()};
+  FilterContext filter_context_{&request_headers_, nullptr, plan_};
 
   iaapi::Policy policy_;
   Payload* payload_;
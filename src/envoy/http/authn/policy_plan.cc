@@ -0,0 +1,77 @@
+/* Copyright 2018 Istio Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/envoy/http/authn/policy_plan.h"
+
+#include <atomic>
+
+using istio::envoy::config::filter::http::authn::v2alpha1::FilterConfig;
+
+namespace iaapi = istio::authentication::v1alpha1;
+
+namespace Envoy {
+namespace Http {
+namespace Istio {
+namespace AuthN {
+namespace {
+
+// The version of the next plan.
+std::atomic<uint64_t> next_version(1);
+
+}  // namespace
+
+PolicyPlan::PolicyPlan(const FilterConfig& filter_config)
+    : filter_config_(filter_config),
+      version_(next_version++),
+      peer_by_connection_(filter_config_.policy().peers_size() > 0) {
+  for (const auto& method : filter_config_.policy().peers()) {
+    if (method.params_case() !=
+        iaapi::PeerAuthenticationMethod::ParamsCase::kMtls) {
+      peer_by_connection_ = false;
+    }
+  }
+  for (const auto& it : filter_config_.jwt_output_payload_locations()) {
+    LowerCaseString header(it.second);
+    auto header_it =
+        header_index_.emplace(header.get(), jwt_payload_headers_.size());
+    if (header_it.second) {
+      jwt_payload_headers_.push_back(header);
+    }
+    issuer_headers_.emplace(it.first, header_it.first->second);
+  }
+}
+
+const LowerCaseString* PolicyPlan::jwtPayloadHeader(
+    const std::string& issuer) const {
+  auto it = issuer_headers_.find(issuer);
+  if (it == issuer_headers_.end()) {
+    return nullptr;
+  }
+  return &jwt_payload_headers_[it->second];
+}
+
+const LowerCaseString* PolicyPlan::findJwtPayloadHeader(
+    const std::string& key) const {
+  auto it = header_index_.find(key);
+  if (it == header_index_.end()) {
+    return nullptr;
+  }
+  return &jwt_payload_headers_[it->second];
+}
+
+}  // namespace AuthN
+}  // namespace Istio
+}  // namespace Http
+}  // namespace Envoy
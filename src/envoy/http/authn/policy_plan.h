@@ -0,0 +1,92 @@
+/* Copyright 2018 Istio Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "envoy/config/filter/http/authn/v2alpha1/config.pb.h"
+#include "envoy/http/header_map.h"
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace Envoy {
+namespace Http {
+namespace Istio {
+namespace AuthN {
+
+// PolicyPlan holds the filter config with what the authentication of each
+// request needs from it, compiled once when the config is loaded: the JWT
+// payload header of each issuer, already lowered.
+class PolicyPlan {
+ public:
+  PolicyPlan(
+      const istio::envoy::config::filter::http::authn::v2alpha1::FilterConfig&
+          filter_config);
+
+  // Accessor to the filter config.
+  const istio::envoy::config::filter::http::authn::v2alpha1::FilterConfig&
+  filter_config() const {
+    return filter_config_;
+  }
+
+  // Returns the version of the plan, unique in the process. It tells apart the
+  // results of different policies cached with the plan version.
+  uint64_t version() const { return version_; }
+
+  // Returns true if the peer authentication only depends on the connection,
+  // so its result can be cached for the connection: all the peer methods are
+  // mTLS.
+  bool peerByConnection() const { return peer_by_connection_; }
+
+  // Returns the header with the JWT payload of the issuer, or nullptr if the
+  // config has no payload location for the issuer.
+  const LowerCaseString* jwtPayloadHeader(const std::string& issuer) const;
+
+  // Returns the JWT payload header with the key, or nullptr if the key is not
+  // a JWT payload header of any issuer.
+  const LowerCaseString* findJwtPayloadHeader(const std::string& key) const;
+
+  // Returns the JWT payload headers of all the issuers, each one once.
+  const std::vector<LowerCaseString>& jwtPayloadHeaders() const {
+    return jwt_payload_headers_;
+  }
+
+ private:
+  // A copy of the filter config, owned by the plan.
+  const istio::envoy::config::filter::http::authn::v2alpha1::FilterConfig
+      filter_config_;
+
+  // The version of the plan.
+  const uint64_t version_;
+
+  // True if all the peer methods are mTLS.
+  bool peer_by_connection_;
+
+  // The distinct JWT payload headers.
+  std::vector<LowerCaseString> jwt_payload_headers_;
+
+  // The position of each JWT payload header in jwt_payload_headers_.
+  std::unordered_map<std::string, size_t> header_index_;
+
+  // The position of the JWT payload header of each issuer in
+  // jwt_payload_headers_.
+  std::unordered_map<std::string, size_t> issuer_headers_;
+};
+
+}  // namespace AuthN
+}  // namespace Istio
+}  // namespace Http
+}  // namespace Envoy
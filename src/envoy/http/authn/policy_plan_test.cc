@@ -0,0 +1,63 @@
+/* Copyright 2018 Istio Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/envoy/http/authn/policy_plan.h"
+#include "google/protobuf/util/json_util.h"
+#include "test/test_common/utility.h"
+
+using google::protobuf::util::JsonStringToMessage;
+using istio::envoy::config::filter::http::authn::v2alpha1::FilterConfig;
+
+namespace Envoy {
+namespace Http {
+namespace Istio {
+namespace AuthN {
+namespace {
+
+const char kFilterConfig[] = R"(
+{
+  "jwt_output_payload_locations": {
+    "issuer1@foo.com": "Sec-Istio-Auth-Userinfo",
+    "issuer2@foo.com": "sec-istio-auth-userinfo",
+    "issuer3@foo.com": "other-userinfo"
+  }
+}
+)";
+
+TEST(PolicyPlanTest, JwtPayloadHeaders) {
+  FilterConfig filter_config;
+  ASSERT_TRUE(JsonStringToMessage(kFilterConfig, &filter_config).ok());
+  PolicyPlan plan(filter_config);
+
+  // The headers are lowered, each one is kept once.
+  EXPECT_EQ(2, plan.jwtPayloadHeaders().size());
+  const LowerCaseString* header = plan.jwtPayloadHeader("issuer1@foo.com");
+  ASSERT_TRUE(header != nullptr);
+  EXPECT_EQ("sec-istio-auth-userinfo", header->get());
+  EXPECT_EQ(header, plan.jwtPayloadHeader("issuer2@foo.com"));
+  header = plan.jwtPayloadHeader("issuer3@foo.com");
+  ASSERT_TRUE(header != nullptr);
+  EXPECT_EQ("other-userinfo", header->get());
+  EXPECT_EQ(nullptr, plan.jwtPayloadHeader("unknown@foo.com"));
+
+  EXPECT_EQ(header, plan.findJwtPayloadHeader("other-userinfo"));
+  EXPECT_EQ(nullptr, plan.findJwtPayloadHeader("userinfo"));
+}
+
+}  // namespace
+}  // namespace AuthN
+}  // namespace Istio
+}  // namespace Http
+}  // namespace Envoy
@@ -0,0 +1,145 @@
+/* Copyright 2018 Istio Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Checks the allocation accounting with the allocator of the Envoy build:
+//   bazel test --define alloc_accounting=tcmalloc
+//   bazel test --define alloc_accounting=enabled --define tcmalloc=disabled
+// see include/istio/utils/alloc_accounting.h and "make test_alloc_accounting".
+
+#include "google/protobuf/util/json_util.h"
+#include "gtest/gtest.h"
+#include "include/istio/utils/alloc_accounting.h"
+#include "src/envoy/http/jwt_auth/jwt_authenticator.h"
+#include "test/mocks/upstream/mocks.h"
+#include "test/test_common/utility.h"
+
+#ifndef ISTIO_ALLOC_ACCOUNTING
+#error "Only built with --define alloc_accounting=tcmalloc or enabled."
+#endif
+
+using ::envoy::config::filter::http::jwt_authn::v2alpha::JwtAuthentication;
+using ::istio::utils::AllocStats;
+using ::istio::utils::AllocTag;
+using ::istio::utils::GetThreadAllocStats;
+using ::testing::NiceMock;
+
+namespace Envoy {
+namespace Http {
+namespace JwtAuth {
+namespace {
+
+// The RS256 JWKS of kRsaToken, from jwt_authenticator_test.cc.
+const char kJwks[] =
+    "{\"keys\": [{\"kty\": \"RSA\","
+    "\"n\": "
+    "\"up97uqrF9MWOPaPkwSaBeuAPLOr9FKcaWGdVEGzQ4f3Zq5WKVZowx9TCBxmImNJ1q"
+    "mUi13pB8otwM_l5lfY1AFBMxVbQCUXntLovhDaiSvYp4wGDjFzQiYA-pUq8h6MUZBnhleYrk"
+    "U7XlCBwNVyN8qNMkpLA7KFZYz-486GnV2NIJJx_4BGa3HdKwQGxi2tjuQsQvao5W4xmSVaaE"
+    "WopBwMy2QmlhSFQuPUpTaywTqUcUq_6SfAHhZ4IDa_FxEd2c2z8gFGtfst9cY3lRYf-c_Zdb"
+    "oY3mqN9Su3-j3z5r2SHWlhB_LNAjyWlBGsvbGPlTqDziYQwZN4aGsqVKQb9Vw\","
+    "\"e\": \"AQAB\","
+    "\"alg\": \"RS256\"}]}";
+
+// A RS256 token without kid, for the audience example_service.
+const std::string kRsaToken =
+    "eyJhbGciOiJSUzI1NiIsInR5cCI6IkpXVCJ9.eyJpc3MiOiJodHRwczovL2V4YW1wbGUu"
+    "Y29tIiwic3ViIjoidGVzdEBleGFtcGxlLmNvbSIsImV4cCI6MjAwMTAwMTAwMSwiY"
+    "XVkIjoiZXhhbXBsZV9zZXJ2aWNlIn0.cuui_Syud76B0tqvjESE8IZbX7vzG6xA-M"
+    "Daof1qEFNIoCFT_YQPkseLSUSR2Od3TJcNKk-dKjvUEL1JW3kGnyC1dBx4f3-Xxro"
+    "yL23UbR2eS8TuxO9ZcNCGkjfvH5O4mDb6cVkFHRDEolGhA7XwNiuVgkGJ5Wkrvshi"
+    "h6nqKXcPNaRx9lOaRWg2PkE6ySNoyju7rNfunXYtVxPuUIkl0KMq3WXWRb_cb8a_Z"
+    "EprqSZUzi_ZzzYzqBNVhIJujcNWij7JRra2sXXiSAfKjtxHQoxrX8n4V1ySWJ3_1T"
+    "H_cJcdfS_RKP7YgXRWC0L16PNF5K7iqRqmjKALNe83ZFnFIw";
+
+// The issuer of kRsaToken, its JWKS is set inline.
+const char kConfig[] = R"(
+{
+   "rules": [
+      {
+         "issuer": "https://example.com",
+         "audiences": [
+            "example_service"
+          ],
+         "forward_payload_header": "sec-istio-auth-userinfo"
+      }
+   ]
+}
+)";
+
+class OkCallbacks : public JwtAuthenticator::Callbacks {
+ public:
+  void onDone(const Status& status) override { ok_ = status == Status::OK; }
+
+  bool ok_ = false;
+};
+
+class AllocAccountingTest : public ::testing::Test {
+ public:
+  void SetUp() {
+    ::google::protobuf::util::JsonStringToMessage(kConfig, &config_);
+    config_.mutable_rules(0)->mutable_local_jwks()->set_inline_string(kJwks);
+    store_.reset(new JwtAuthStore(config_));
+  }
+
+  // Verifies kRsaToken and returns the JWT_VERIFY stats it added.
+  AllocStats Verify() {
+    AllocStats before, after;
+    GetThreadAllocStats(AllocTag::JWT_VERIFY, &before);
+    auto headers = TestHeaderMapImpl{{"Authorization", "Bearer " + kRsaToken}};
+    OkCallbacks callbacks;
+    JwtAuthenticator authenticator(cm_, *store_);
+    authenticator.Verify(headers, &callbacks);
+    EXPECT_TRUE(callbacks.ok_);
+    GetThreadAllocStats(AllocTag::JWT_VERIFY, &after);
+    AllocStats added;
+    added.scopes = after.scopes - before.scopes;
+    added.allocations = after.allocations - before.allocations;
+    added.bytes = after.bytes - before.bytes;
+    return added;
+  }
+
+  JwtAuthentication config_;
+  NiceMock<Upstream::MockClusterManager> cm_;
+  std::unique_ptr<JwtAuthStore> store_;
+};
+
+TEST_F(AllocAccountingTest, TestVerify) {
+  // The first verification decodes the token and verifies its signature.
+  AllocStats uncached = Verify();
+  EXPECT_EQ(uncached.scopes, 1);
+  EXPECT_GT(uncached.allocations, 0);
+  EXPECT_GE(uncached.bytes, uncached.allocations);
+
+  // The next one is served by the verified token cache, with fewer
+  // allocations.
+  AllocStats cached = Verify();
+  EXPECT_EQ(cached.scopes, 1);
+  EXPECT_LT(cached.allocations, uncached.allocations);
+}
+
+TEST_F(AllocAccountingTest, TestUntagged) {
+  // Allocations outside of the tagged scopes are not counted for the tag.
+  AllocStats before, after;
+  GetThreadAllocStats(AllocTag::JWT_VERIFY, &before);
+  auto headers = TestHeaderMapImpl{{"Authorization", "Bearer " + kRsaToken}};
+  std::string payload(kRsaToken + kRsaToken);
+  GetThreadAllocStats(AllocTag::JWT_VERIFY, &after);
+  EXPECT_EQ(after.allocations, before.allocations);
+}
+
+}  // namespace
+}  // namespace JwtAuth
+}  // namespace Http
+}  // namespace Envoy
@@ -17,24 +17,46 @@
 
 #include "common/common/logger.h"
 #include "envoy/config/filter/http/jwt_authn/v2alpha/config.pb.h"
+#include "envoy/init/init.h"
 #include "envoy/server/filter_config.h"
 #include "envoy/thread_local/thread_local.h"
+#include "src/envoy/utils/phase_timer.h"
 #include "src/envoy/http/jwt_auth/pubkey_cache.h"
+#include "src/envoy/http/jwt_auth/pubkey_fetcher.h"
+#include "src/envoy/http/jwt_auth/token_cache.h"
 #include "src/envoy/http/jwt_auth/token_extractor.h"
+#include "src/envoy/http/jwt_auth/verifier_pool.h"
 
 namespace Envoy {
 namespace Http {
 namespace JwtAuth {
+namespace {
+// The runtime key of the number of threads to verify JWT signatures off
+// the worker threads. They are verified on the worker threads if it is 0.
+const std::string kVerifierThreadsKey = "jwt_auth.verifier_threads";
+// The histogram of the per-request Verify() nanoseconds, only in the
+// phase_timing builds.
+const std::string kVerifyNsStat = "jwt_auth_filter.verify_ns";
+// The runtime key of the milliseconds the listener initialization waits
+// for the remote pubkeys to be fetched. It does not wait if it is 0.
+const std::string kPrewarmTimeoutKey = "jwt_auth.prewarm_timeout_ms";
+}  // namespace
 
 // The JWT auth store object to store config and caches.
-// It only has pubkey_cache for now. In the future it will have token cache.
+// It has the pubkey cache, the pubkey fetchers and the verified token cache.
 // It is per-thread and stored in thread local.
 class JwtAuthStore : public ThreadLocal::ThreadLocalObject {
  public:
   // Load the config from envoy config.
+  // The remote pubkeys are refreshed in the background with a dispatcher,
+  // which is not needed when the factory shares them with all threads.
   JwtAuthStore(const ::envoy::config::filter::http::jwt_authn::v2alpha::
-                   JwtAuthentication& config)
-      : config_(config), pubkey_cache_(config_), token_extractor_(config_) {}
+                   JwtAuthentication& config,
+               Event::Dispatcher* dispatcher = nullptr)
+      : config_(config),
+        dispatcher_(dispatcher),
+        pubkey_cache_(config_),
+        token_extractor_(config_) {}
 
   // Get the Config.
   const ::envoy::config::filter::http::jwt_authn::v2alpha::JwtAuthentication&
@@ -45,41 +67,199 @@ class JwtAuthStore : public ThreadLocal::ThreadLocalObject {
   // Get the pubkey cache.
   PubkeyCache& pubkey_cache() { return pubkey_cache_; }
 
+  // Get the pubkey fetcher of an issuer.
+  PubkeyFetcher& pubkey_fetcher(PubkeyCacheItem& issuer) {
+    auto& fetcher = pubkey_fetchers_[issuer.jwt_config().issuer()];
+    if (!fetcher) {
+      fetcher.reset(new PubkeyFetcher(issuer, dispatcher_));
+    }
+    return *fetcher;
+  }
+
+  // Get the verified token cache.
+  TokenCache& token_cache() { return token_cache_; }
+
   // Get the private token extractor.
   const JwtTokenExtractor& token_extractor() const { return token_extractor_; }
 
+  // Verify the signatures in the pool, the results are posted to dispatcher.
+  void set_verifier_pool(VerifierPool* pool, Event::Dispatcher& dispatcher) {
+    verifier_pool_ = pool;
+    verifier_dispatcher_ = &dispatcher;
+  }
+
+  // Get the verifier pool, nullptr if the signatures are verified inline.
+  VerifierPool* verifier_pool() { return verifier_pool_; }
+
+  // Get the dispatcher to post the verification results to.
+  Event::Dispatcher& verifier_dispatcher() { return *verifier_dispatcher_; }
+
+  // Record the nanoseconds of JwtAuthenticator::Verify() to the histogram,
+  // only in the phase_timing builds.
+  void set_verify_ns(Stats::Histogram* histogram) { verify_ns_ = histogram; }
+
+  // Get the Verify() histogram, nullptr if not set.
+  Stats::Histogram* verify_ns() { return verify_ns_; }
+
  private:
   // Store the config.
   const ::envoy::config::filter::http::jwt_authn::v2alpha::JwtAuthentication&
       config_;
+  // The dispatcher of the thread.
+  Event::Dispatcher* dispatcher_;
   // The public key cache, indexed by issuer.
   PubkeyCache pubkey_cache_;
+  // The pubkey fetchers, indexed by issuer.
+  std::unordered_map<std::string, std::unique_ptr<PubkeyFetcher>>
+      pubkey_fetchers_;
+  // The verified tokens.
+  TokenCache token_cache_;
   // The object to extract token.
   JwtTokenExtractor token_extractor_;
+  // The pool to verify the signatures, shared by all the threads.
+  VerifierPool* verifier_pool_{};
+  // The dispatcher of the thread, for the verification results.
+  Event::Dispatcher* verifier_dispatcher_{};
+  // The histogram of the Verify() nanoseconds, shared by all the threads.
+  Stats::Histogram* verify_ns_{};
 };
 
 // The factory to create per-thread auth store object.
-class JwtAuthStoreFactory : public Logger::Loggable<Logger::Id::config> {
+// The remote pubkeys are fetched and parsed on the main thread, then shared
+// with all the per-thread stores. They are refreshed there before they
+// expire. A thread only fetches them itself while they are missing or
+// expired. With a prewarm timeout, the listener is only initialized once
+// they are all fetched, or once the timeout expires, so that the first
+// requests don't wait for them.
+class JwtAuthStoreFactory : public Init::Target,
+                            public Logger::Loggable<Logger::Id::config> {
  public:
   JwtAuthStoreFactory(const ::envoy::config::filter::http::jwt_authn::v2alpha::
                           JwtAuthentication& config,
                       Server::Configuration::FactoryContext& context)
-      : config_(config), tls_(context.threadLocal().allocateSlot()) {
-    tls_->set(
-        [this](Event::Dispatcher&) -> ThreadLocal::ThreadLocalObjectSharedPtr {
-          return std::make_shared<JwtAuthStore>(config_);
-        });
+      : config_(config),
+        tls_(context.threadLocal().allocateSlot()),
+        pubkey_cache_(config_) {
+    uint64_t verifier_threads =
+        context.runtime().snapshot().getInteger(kVerifierThreadsKey, 0);
+    if (verifier_threads > 0) {
+      verifier_pool_.reset(new VerifierPool(verifier_threads));
+    }
+#ifdef ISTIO_PHASE_TIMING
+    verify_ns_ = &context.scope().histogram(kVerifyNsStat);
+#endif
+    tls_->set([this](Event::Dispatcher& dispatcher)
+                  -> ThreadLocal::ThreadLocalObjectSharedPtr {
+      auto store = std::make_shared<JwtAuthStore>(config_);
+      if (verifier_pool_) {
+        store->set_verifier_pool(verifier_pool_.get(), dispatcher);
+      }
+      store->set_verify_ns(verify_ns_);
+      return store;
+    });
     ENVOY_LOG(info, "Loaded JwtAuthConfig: {}", config_.DebugString());
+
+    for (const auto& rule : config_.rules()) {
+      if (!rule.has_remote_jwks()) {
+        continue;
+      }
+      auto issuer = pubkey_cache_.LookupByIssuer(rule.issuer());
+      pubkey_fetchers_.emplace_back(
+          new PubkeyFetcher(*issuer, &context.dispatcher()));
+      pubkey_fetchers_.back()->set_update_func(
+          [this](const PubkeyCacheItem& item) { PublishPubkey(item); });
+      pubkey_fetchers_.back()->Refresh(context.clusterManager());
+    }
+
+    prewarm_timeout_ms_ =
+        context.runtime().snapshot().getInteger(kPrewarmTimeoutKey, 0);
+    if (prewarm_timeout_ms_ > 0 && !pubkey_fetchers_.empty()) {
+      dispatcher_ = &context.dispatcher();
+      context.initManager().registerTarget(*this);
+    }
+  }
+
+  // Init::Target
+  void initialize(std::function<void()> callback) override {
+    if (AllPubkeysFetched()) {
+      callback();
+      return;
+    }
+    init_callback_ = callback;
+    prewarm_timer_ = dispatcher_->createTimer([this]() {
+      ENVOY_LOG(warn, "Initialized before all the remote pubkeys are fetched");
+      CompleteInit();
+    });
+    prewarm_timer_->enableTimer(std::chrono::milliseconds(prewarm_timeout_ms_));
   }
 
   // Get per-thread auth store object.
   JwtAuthStore& store() { return tls_->getTyped<JwtAuthStore>(); }
 
  private:
+  // Returns true if the pubkeys of all the remote jwks are fetched.
+  bool AllPubkeysFetched() {
+    for (const auto& rule : config_.rules()) {
+      if (rule.has_remote_jwks() &&
+          !pubkey_cache_.LookupByIssuer(rule.issuer())->pubkey()) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // Completes the initialization waiting for the pubkeys, if any.
+  void CompleteInit() {
+    if (prewarm_timer_) {
+      prewarm_timer_->disableTimer();
+      prewarm_timer_.reset();
+    }
+    if (init_callback_) {
+      auto callback = init_callback_;
+      init_callback_ = nullptr;
+      callback();
+    }
+  }
+
+  // Share the pubkey fetched on the main thread with all the threads.
+  void PublishPubkey(const PubkeyCacheItem& item) {
+    auto pubkey = item.shared_pubkey();
+    std::string issuer = item.jwt_config().issuer();
+    std::string pubkey_str = item.pubkey_str();
+    auto expire = item.expiration_time();
+    tls_->runOnAllThreads([this, pubkey, issuer, pubkey_str, expire]() {
+      auto thread_item = store().pubkey_cache().LookupByIssuer(issuer);
+      if (thread_item) {
+        thread_item->SetParsedKey(pubkey, pubkey_str, expire);
+      }
+    });
+    if (init_callback_ && AllPubkeysFetched()) {
+      CompleteInit();
+    }
+  }
+
   // The auth config.
   ::envoy::config::filter::http::jwt_authn::v2alpha::JwtAuthentication config_;
+  // The pool to verify the signatures off the worker threads, if enabled.
+  // It outlives the per-thread stores using it.
+  std::unique_ptr<VerifierPool> verifier_pool_;
   // Thread local slot to store per-thread auth store
   ThreadLocal::SlotPtr tls_;
+  // The pubkeys fetched on the main thread.
+  PubkeyCache pubkey_cache_;
+  // The main thread pubkey fetchers.
+  std::vector<std::unique_ptr<PubkeyFetcher>> pubkey_fetchers_;
+  // The histogram of the Verify() nanoseconds, nullptr if not recorded.
+  Stats::Histogram* verify_ns_{};
+  // How long the listener initialization waits for the pubkeys, 0 if it
+  // does not.
+  uint64_t prewarm_timeout_ms_{};
+  // The main thread dispatcher, for the prewarm timer.
+  Event::Dispatcher* dispatcher_{};
+  // Ends the wait for the pubkeys.
+  Event::TimerPtr prewarm_timer_;
+  // Called once the pubkeys are fetched, while the listener waits for them.
+  std::function<void()> init_callback_;
 };
 
 }  // namespace JwtAuth
@@ -19,6 +19,7 @@
 #include "common/common/base64.h"
 #include "common/common/utility.h"
 #include "common/json/json_loader.h"
+#include "include/istio/utils/base64.h"
 #include "openssl/bn.h"
 #include "openssl/ecdsa.h"
 #include "openssl/evp.h"
@@ -71,75 +72,6 @@ std::string StatusToString(Status status) {
 
 namespace {
 
-// Conversion table is taken from
-// https://opensource.apple.com/source/QuickTimeStreamingServer/QuickTimeStreamingServer-452/CommonUtilitiesLib/base64.c
-//
-// and modified the position of 62 ('+' to '-') and 63 ('/' to '_')
-const uint8_t kReverseLookupTableBase64Url[256] = {
-    64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64,
-    64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64,
-    64, 64, 64, 64, 64, 64, 64, 62, 64, 64, 52, 53, 54, 55, 56, 57, 58, 59, 60,
-    61, 64, 64, 64, 64, 64, 64, 64, 0,  1,  2,  3,  4,  5,  6,  7,  8,  9,  10,
-    11, 12, 13, 14, 15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 64, 64, 64, 64,
-    63, 64, 26, 27, 28, 29, 30, 31, 32, 33, 34, 35, 36, 37, 38, 39, 40, 41, 42,
-    43, 44, 45, 46, 47, 48, 49, 50, 51, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64,
-    64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64,
-    64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64,
-    64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64,
-    64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64,
-    64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64,
-    64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64,
-    64, 64, 64, 64, 64, 64, 64, 64, 64};
-
-bool IsNotBase64UrlChar(int8_t c) {
-  return kReverseLookupTableBase64Url[static_cast<int32_t>(c)] & 64;
-}
-
-}  // namespace
-
-std::string Base64UrlDecode(std::string input) {
-  // allow at most 2 padding letters at the end of the input, only if input
-  // length is divisible by 4
-  int len = input.length();
-  if (len % 4 == 0) {
-    if (input[len - 1] == '=') {
-      input.pop_back();
-      if (input[len - 2] == '=') {
-        input.pop_back();
-      }
-    }
-  }
-  // if input contains non-base64url character, return empty string
-  // Note: padding letter must not be contained
-  if (std::find_if(input.begin(), input.end(), IsNotBase64UrlChar) !=
-      input.end()) {
-    return "";
-  }
-
-  // base64url is using '-', '_' instead of '+', '/' in base64 string.
-  std::replace(input.begin(), input.end(), '-', '+');
-  std::replace(input.begin(), input.end(), '_', '/');
-
-  // base64 string should be padded with '=' so as to the length of the string
-  // is divisible by 4.
-  switch (input.length() % 4) {
-    case 0:
-      break;
-    case 2:
-      input += "==";
-      break;
-    case 3:
-      input += "=";
-      break;
-    default:
-      // * an invalid base64url input. return empty string.
-      return "";
-  }
-  return Base64::decode(input);
-}
-
-namespace {
-
 const uint8_t *CastToUChar(const std::string &str) {
   return reinterpret_cast<const uint8_t *>(str.c_str());
 }
@@ -213,8 +145,8 @@ class EvpPkeyGetter : public WithStatus {
   }
 
   bssl::UniquePtr<BIGNUM> BigNumFromBase64UrlString(const std::string &s) {
-    std::string s_decoded = Base64UrlDecode(s);
-    if (s_decoded == "") {
+    std::string s_decoded;
+    if (!::istio::utils::Base64UrlDecode(s, &s_decoded) || s_decoded.empty()) {
       return nullptr;
     }
     return bssl::UniquePtr<BIGNUM>(
@@ -239,36 +171,403 @@ class EvpPkeyGetter : public WithStatus {
 
 }  // namespace
 
-Jwt::Jwt(const std::string &jwt) {
-  // jwt must have exactly 2 dots
-  if (std::count(jwt.begin(), jwt.end(), '.') != 2) {
-    UpdateStatus(Status::JWT_BAD_FORMAT);
-    return;
+namespace {
+
+// The type of a JSON value.
+enum class JsonType { STRING, NUMBER, OBJECT, ARRAY, LITERAL };
+
+// The maximum nesting of the JSON values.
+const int kMaxJsonDepth = 64;
+
+// A minimal JSON scanner to read the claims of a JWT header or payload
+// without building a JSON object tree. It validates the whole JSON text, but
+// only the values of the members looked up are decoded.
+class JsonScanner {
+ public:
+  JsonScanner(absl::string_view json)
+      : pos_(json.data()), end_(json.data() + json.size()) {}
+
+  // Scans a JSON object and calls on_member(name, type, value) for each top
+  // level member, value is the JSON text of the member value. Returns false
+  // if the JSON is not valid or not an object.
+  template <class OnMember>
+  bool ScanObject(OnMember on_member) {
+    SkipSpaces();
+    if (!Consume('{')) {
+      return false;
+    }
+    std::string name;
+    SkipSpaces();
+    if (!Consume('}')) {
+      do {
+        SkipSpaces();
+        if (!ScanString(&name)) {
+          return false;
+        }
+        SkipSpaces();
+        if (!Consume(':')) {
+          return false;
+        }
+        SkipSpaces();
+        const char *value_begin = pos_;
+        JsonType type;
+        if (!ScanValue(&type, 1)) {
+          return false;
+        }
+        on_member(name, type,
+                  absl::string_view(value_begin, pos_ - value_begin));
+        SkipSpaces();
+      } while (Consume(','));
+      if (!Consume('}')) {
+        return false;
+      }
+    }
+    SkipSpaces();
+    return pos_ == end_;
   }
-  auto jwt_split = StringUtil::splitToken(jwt, ".");
-  if (jwt_split.size() != 3) {
-    UpdateStatus(Status::JWT_BAD_FORMAT);
-    return;
+
+  // Decodes a JSON string value.
+  static bool ParseString(absl::string_view json, std::string *value) {
+    JsonScanner scanner(json);
+    return scanner.ScanString(value) && scanner.pos_ == scanner.end_;
+  }
+
+  // Decodes a JSON integer value.
+  static bool ParseInteger(absl::string_view json, int64_t *value) {
+    bool negative = !json.empty() && json[0] == '-';
+    if (negative) {
+      json.remove_prefix(1);
+    }
+    if (json.empty()) {
+      return false;
+    }
+    uint64_t result = 0;
+    for (char c : json) {
+      if (c < '0' || c > '9' ||
+          result > (static_cast<uint64_t>(INT64_MAX) - (c - '0')) / 10) {
+        // Not an integer or out of range.
+        return false;
+      }
+      result = result * 10 + (c - '0');
+    }
+    *value = negative ? -static_cast<int64_t>(result)
+                      : static_cast<int64_t>(result);
+    return true;
+  }
+
+  // Decodes a JSON array of strings.
+  static bool ParseStringArray(absl::string_view json,
+                               std::vector<std::string> *value) {
+    JsonScanner scanner(json);
+    if (!scanner.Consume('[')) {
+      return false;
+    }
+    scanner.SkipSpaces();
+    if (scanner.Consume(']')) {
+      return scanner.pos_ == scanner.end_;
+    }
+    std::string item;
+    do {
+      scanner.SkipSpaces();
+      if (!scanner.ScanString(&item)) {
+        return false;
+      }
+      value->push_back(item);
+      scanner.SkipSpaces();
+    } while (scanner.Consume(','));
+    return scanner.Consume(']') && scanner.pos_ == scanner.end_;
+  }
+
+ private:
+  bool Consume(char c) {
+    if (pos_ < end_ && *pos_ == c) {
+      ++pos_;
+      return true;
+    }
+    return false;
+  }
+
+  bool ConsumeLiteral(absl::string_view literal) {
+    if (static_cast<size_t>(end_ - pos_) < literal.size() ||
+        absl::string_view(pos_, literal.size()) != literal) {
+      return false;
+    }
+    pos_ += literal.size();
+    return true;
+  }
+
+  void SkipSpaces() {
+    while (pos_ < end_ &&
+           (*pos_ == ' ' || *pos_ == '\t' || *pos_ == '\n' || *pos_ == '\r')) {
+      ++pos_;
+    }
+  }
+
+  bool ConsumeDigits() {
+    const char *begin = pos_;
+    while (pos_ < end_ && *pos_ >= '0' && *pos_ <= '9') {
+      ++pos_;
+    }
+    return pos_ > begin;
+  }
+
+  bool ScanNumber() {
+    Consume('-');
+    if (!Consume('0') && !ConsumeDigits()) {
+      return false;
+    }
+    if (Consume('.') && !ConsumeDigits()) {
+      return false;
+    }
+    if (Consume('e') || Consume('E')) {
+      if (!Consume('+')) {
+        Consume('-');
+      }
+      if (!ConsumeDigits()) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // Reads the 4 hex digits of a \u escape.
+  bool ScanHex4(uint32_t *code) {
+    if (end_ - pos_ < 4) {
+      return false;
+    }
+    *code = 0;
+    for (int i = 0; i < 4; ++i) {
+      char c = *pos_++;
+      *code <<= 4;
+      if (c >= '0' && c <= '9') {
+        *code |= c - '0';
+      } else if (c >= 'a' && c <= 'f') {
+        *code |= c - 'a' + 10;
+      } else if (c >= 'A' && c <= 'F') {
+        *code |= c - 'A' + 10;
+      } else {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  static void AppendUtf8(uint32_t code, std::string *value) {
+    if (code < 0x80) {
+      value->push_back(code);
+    } else if (code < 0x800) {
+      value->push_back(0xC0 | (code >> 6));
+      value->push_back(0x80 | (code & 0x3F));
+    } else if (code < 0x10000) {
+      value->push_back(0xE0 | (code >> 12));
+      value->push_back(0x80 | ((code >> 6) & 0x3F));
+      value->push_back(0x80 | (code & 0x3F));
+    } else {
+      value->push_back(0xF0 | (code >> 18));
+      value->push_back(0x80 | ((code >> 12) & 0x3F));
+      value->push_back(0x80 | ((code >> 6) & 0x3F));
+      value->push_back(0x80 | (code & 0x3F));
+    }
   }
 
-  // Parse header json
-  header_str_base64url_ = std::string(jwt_split[0].begin(), jwt_split[0].end());
-  header_str_ = Base64UrlDecode(header_str_base64url_);
+  // Scans a string, decoded to value if it is not nullptr.
+  bool ScanString(std::string *value) {
+    if (!Consume('"')) {
+      return false;
+    }
+    if (value) {
+      value->clear();
+    }
+    while (pos_ < end_) {
+      // Copy the unescaped characters at once.
+      const char *begin = pos_;
+      while (pos_ < end_ && *pos_ != '"' && *pos_ != '\\' &&
+             static_cast<unsigned char>(*pos_) >= 0x20) {
+        ++pos_;
+      }
+      if (value) {
+        value->append(begin, pos_ - begin);
+      }
+      if (pos_ == end_ || static_cast<unsigned char>(*pos_) < 0x20) {
+        return false;
+      }
+      if (*pos_++ == '"') {
+        return true;
+      }
+      if (pos_ == end_) {
+        return false;
+      }
+      char c = *pos_++;
+      uint32_t code;
+      switch (c) {
+        case '"':
+        case '\\':
+        case '/':
+          break;
+        case 'b':
+          c = '\b';
+          break;
+        case 'f':
+          c = '\f';
+          break;
+        case 'n':
+          c = '\n';
+          break;
+        case 'r':
+          c = '\r';
+          break;
+        case 't':
+          c = '\t';
+          break;
+        case 'u':
+          if (!ScanHex4(&code)) {
+            return false;
+          }
+          if (code >= 0xD800 && code <= 0xDBFF) {
+            // A surrogate pair.
+            uint32_t low;
+            if (!Consume('\\') || !Consume('u') || !ScanHex4(&low) ||
+                low < 0xDC00 || low > 0xDFFF) {
+              return false;
+            }
+            code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+          }
+          if (value) {
+            AppendUtf8(code, value);
+          }
+          continue;
+        default:
+          return false;
+      }
+      if (value) {
+        value->push_back(c);
+      }
+    }
+    return false;
+  }
+
+  // Scans any value.
+  bool ScanValue(JsonType *type, int depth) {
+    if (pos_ == end_ || depth > kMaxJsonDepth) {
+      return false;
+    }
+    JsonType item_type;
+    switch (*pos_) {
+      case '"':
+        *type = JsonType::STRING;
+        return ScanString(nullptr);
+      case '{':
+        *type = JsonType::OBJECT;
+        ++pos_;
+        SkipSpaces();
+        if (Consume('}')) {
+          return true;
+        }
+        do {
+          SkipSpaces();
+          if (!ScanString(nullptr)) {
+            return false;
+          }
+          SkipSpaces();
+          if (!Consume(':')) {
+            return false;
+          }
+          SkipSpaces();
+          if (!ScanValue(&item_type, depth + 1)) {
+            return false;
+          }
+          SkipSpaces();
+        } while (Consume(','));
+        return Consume('}');
+      case '[':
+        *type = JsonType::ARRAY;
+        ++pos_;
+        SkipSpaces();
+        if (Consume(']')) {
+          return true;
+        }
+        do {
+          SkipSpaces();
+          if (!ScanValue(&item_type, depth + 1)) {
+            return false;
+          }
+          SkipSpaces();
+        } while (Consume(','));
+        return Consume(']');
+      case 't':
+        *type = JsonType::LITERAL;
+        return ConsumeLiteral("true");
+      case 'f':
+        *type = JsonType::LITERAL;
+        return ConsumeLiteral("false");
+      case 'n':
+        *type = JsonType::LITERAL;
+        return ConsumeLiteral("null");
+      default:
+        *type = JsonType::NUMBER;
+        return ScanNumber();
+    }
+  }
+
+  // The current position.
+  const char *pos_;
+  // The end of the JSON text.
+  const char *end_;
+};
+
+// Returns the JSON object, or nullptr if the JSON is not valid.
+Json::ObjectSharedPtr ParseJson(const std::string &json) {
   try {
-    header_ = Json::Factory::loadFromString(header_str_);
+    return Json::Factory::loadFromString(json);
   } catch (Json::Exception &e) {
+    return nullptr;
+  }
+}
+
+}  // namespace
+
+Jwt::Jwt(const std::string &jwt) {
+  // jwt must have exactly 2 dots, separating non empty parts.
+  const size_t dot1 = jwt.find('.');
+  const size_t dot2 =
+      dot1 == std::string::npos ? dot1 : jwt.find('.', dot1 + 1);
+  if (dot2 == std::string::npos ||
+      jwt.find('.', dot2 + 1) != std::string::npos || dot1 == 0 ||
+      dot2 == dot1 + 1 || dot2 + 1 == jwt.length()) {
+    UpdateStatus(Status::JWT_BAD_FORMAT);
+    return;
+  }
+  const absl::string_view token(jwt);
+
+  // Parse header json, only the claims are read, the JSON object is built
+  // when Header() is called.
+  header_str_base64url_ = jwt.substr(0, dot1);
+  ::istio::utils::Base64UrlDecode(token.substr(0, dot1), &header_str_);
+  bool has_alg = false;
+  bool bad_alg = false;
+  bool bad_kid = false;
+  bool header_ok = JsonScanner(header_str_).ScanObject(
+      [&](const std::string &name, JsonType type, absl::string_view value) {
+        if (name == "alg") {
+          has_alg = true;
+          bad_alg = type != JsonType::STRING ||
+                    !JsonScanner::ParseString(value, &alg_);
+        } else if (name == "kid") {
+          bad_kid = type != JsonType::STRING ||
+                    !JsonScanner::ParseString(value, &kid_);
+        }
+      });
+  if (!header_ok) {
     UpdateStatus(Status::JWT_HEADER_PARSE_ERROR);
     return;
   }
 
   // Header should contain "alg".
-  if (!header_->hasObject("alg")) {
+  if (!has_alg) {
     UpdateStatus(Status::JWT_HEADER_NO_ALG);
     return;
   }
-  try {
-    alg_ = header_->getString("alg");
-  } catch (Json::Exception &e) {
+  if (bad_alg) {
     UpdateStatus(Status::JWT_HEADER_BAD_ALG);
     return;
   }
@@ -285,66 +584,76 @@ Jwt::Jwt(const std::string &jwt) {
   }
 
   // Header may contain "kid", which should be a string if exists.
-  try {
-    kid_ = header_->getString("kid", "");
-  } catch (Json::Exception &e) {
+  if (bad_kid) {
+    kid_.clear();
     UpdateStatus(Status::JWT_HEADER_BAD_KID);
     return;
   }
 
-  // Parse payload json
-  payload_str_base64url_ =
-      std::string(jwt_split[1].begin(), jwt_split[1].end());
-  payload_str_ = Base64UrlDecode(payload_str_base64url_);
-  try {
-    payload_ = Json::Factory::loadFromString(payload_str_);
-  } catch (Json::Exception &e) {
+  // Parse payload json, only the claims are read, the JSON object is built
+  // when Payload() is called.
+  payload_str_base64url_ = jwt.substr(dot1 + 1, dot2 - dot1 - 1);
+  ::istio::utils::Base64UrlDecode(token.substr(dot1 + 1, dot2 - dot1 - 1),
+                                 &payload_str_);
+  bool bad_claim = false;
+  bool payload_ok = JsonScanner(payload_str_).ScanObject(
+      [&](const std::string &name, JsonType type, absl::string_view value) {
+        if (name == "iss") {
+          bad_claim |= type != JsonType::STRING ||
+                       !JsonScanner::ParseString(value, &iss_);
+        } else if (name == "sub") {
+          bad_claim |= type != JsonType::STRING ||
+                       !JsonScanner::ParseString(value, &sub_);
+        } else if (name == "exp") {
+          bad_claim |= type != JsonType::NUMBER ||
+                       !JsonScanner::ParseInteger(value, &exp_);
+        } else if (name == "aud") {
+          // "aud" can be either string array or string.
+          aud_.clear();
+          if (type == JsonType::ARRAY) {
+            bad_claim |= !JsonScanner::ParseStringArray(value, &aud_);
+          } else {
+            aud_.emplace_back();
+            bad_claim |= type != JsonType::STRING ||
+                         !JsonScanner::ParseString(value, &aud_.back());
+          }
+        }
+      });
+  if (!payload_ok || bad_claim) {
     UpdateStatus(Status::JWT_PAYLOAD_PARSE_ERROR);
     return;
   }
 
-  iss_ = payload_->getString("iss", "");
-  sub_ = payload_->getString("sub", "");
-  exp_ = payload_->getInteger("exp", 0);
-
-  // "aud" can be either string array or string.
-  // Try as string array, read it as empty array if doesn't exist.
-  try {
-    aud_ = payload_->getStringArray("aud", true);
-  } catch (Json::Exception &e) {
-    // Try as string
-    try {
-      auto audience = payload_->getString("aud");
-      aud_.push_back(audience);
-    } catch (Json::Exception &e) {
-      UpdateStatus(Status::JWT_PAYLOAD_PARSE_ERROR);
-      return;
-    }
-  }
-
   // Set up signature
-  signature_ =
-      Base64UrlDecode(std::string(jwt_split[2].begin(), jwt_split[2].end()));
-  if (signature_ == "") {
+  signed_data_ = jwt.substr(0, dot2);
+  if (!::istio::utils::Base64UrlDecode(token.substr(dot2 + 1), &signature_)) {
     // Signature is a bad Base64url input.
     UpdateStatus(Status::JWT_SIGNATURE_PARSE_ERROR);
     return;
   }
 }
 
-bool Verifier::VerifySignatureRSA(EVP_PKEY *key, const EVP_MD *md,
+bool Verifier::VerifySignatureRSA(RSA *key, const EVP_MD *md,
                                   const uint8_t *signature,
                                   size_t signature_len,
                                   const uint8_t *signed_data,
                                   size_t signed_data_len) {
-  bssl::UniquePtr<EVP_MD_CTX> md_ctx(EVP_MD_CTX_create());
-
-  EVP_DigestVerifyInit(md_ctx.get(), nullptr, md, nullptr, key);
-  EVP_DigestVerifyUpdate(md_ctx.get(), signed_data, signed_data_len);
-  return (EVP_DigestVerifyFinal(md_ctx.get(), signature, signature_len) == 1);
+  // Digested on the stack and verified with the RSA key directly, which
+  // saves the digest and key contexts EVP_DigestVerify*() allocate on each
+  // call. The Montgomery context of the key is cached by BoringSSL on its
+  // first verification.
+  uint8_t digest[EVP_MAX_MD_SIZE];
+  unsigned int digest_len;
+  if (key == nullptr ||
+      EVP_Digest(signed_data, signed_data_len, digest, &digest_len, md,
+                 nullptr) != 1) {
+    return false;
+  }
+  return RSA_verify(EVP_MD_type(md), digest, digest_len, signature,
+                    signature_len, key) == 1;
 }
 
-bool Verifier::VerifySignatureRSA(EVP_PKEY *key, const EVP_MD *md,
+bool Verifier::VerifySignatureRSA(RSA *key, const EVP_MD *md,
                                   const std::string &signature,
                                   const std::string &signed_data) {
   return VerifySignatureRSA(key, md, CastToUChar(signature), signature.length(),
@@ -363,14 +672,18 @@ bool Verifier::VerifySignatureEC(EC_KEY *key, const uint8_t *signature,
   uint8_t digest[SHA256_DIGEST_LENGTH];
   SHA256(signed_data, signed_data_len, digest);
 
-  bssl::UniquePtr<ECDSA_SIG> ecdsa_sig(ECDSA_SIG_new());
+  // Reused by the verifications of the thread, BN_bin2bn() keeps the
+  // buffers of r and s.
+  static thread_local bssl::UniquePtr<ECDSA_SIG> ecdsa_sig(ECDSA_SIG_new());
   if (!ecdsa_sig) {
     UpdateStatus(Status::FAILED_CREATE_ECDSA_SIGNATURE);
     return false;
   }
 
-  BN_bin2bn(signature, 32, ecdsa_sig->r);
-  BN_bin2bn(signature + 32, 32, ecdsa_sig->s);
+  if (!BN_bin2bn(signature, 32, ecdsa_sig->r) ||
+      !BN_bin2bn(signature + 32, 32, ecdsa_sig->s)) {
+    return false;
+  }
   return (ECDSA_do_verify(digest, SHA256_DIGEST_LENGTH, ecdsa_sig.get(), key) ==
           1);
 }
@@ -394,31 +707,44 @@ bool Verifier::Verify(const Jwt &jwt, const Pubkeys &pubkeys) {
     return false;
   }
 
-  std::string signed_data =
-      jwt.header_str_base64url_ + '.' + jwt.payload_str_base64url_;
+  const std::string &signed_data = jwt.signed_data_;
   bool kid_alg_matched = false;
-  for (auto &pubkey : pubkeys.keys_) {
-    // If kid is specified in JWT, JWK with the same kid is used for
-    // verification.
-    // If kid is not specified in JWT, try all JWK.
-    if (jwt.kid_ != "" && pubkey->kid_specified_ && pubkey->kid_ != jwt.kid_) {
-      continue;
-    }
-
+  auto verify_key = [&](const Pubkeys::Pubkey &pubkey) {
     // The same alg must be used.
-    if (pubkey->alg_specified_ && pubkey->alg_ != jwt.alg_) {
-      continue;
+    if (pubkey.alg_specified_ && pubkey.alg_ != jwt.alg_) {
+      return false;
     }
     kid_alg_matched = true;
 
-    if (pubkey->kty_ == "EC" &&
-        VerifySignatureEC(pubkey->ec_key_.get(), jwt.signature_, signed_data)) {
-      // Verification succeeded.
+    // A key of another type can not verify the signature.
+    if (pubkey.kty_ == "EC") {
+      return jwt.alg_ == "ES256" &&
+             VerifySignatureEC(pubkey.ec_key_.get(), jwt.signature_,
+                               signed_data);
+    }
+    return (pubkey.pem_format_ || pubkey.kty_ == "RSA") &&
+           jwt.alg_ != "ES256" &&
+           VerifySignatureRSA(EVP_PKEY_get0_RSA(pubkey.evp_pkey_.get()),
+                              jwt.md_, jwt.signature_, signed_data);
+  };
+
+  // If kid is specified in JWT, JWK with the same kid is used for
+  // verification.
+  // If kid is not specified in JWT, try all JWK, starting with the one which
+  // verified the last JWT without kid.
+  const Pubkeys::Pubkey *last = nullptr;
+  if (jwt.kid_.empty()) {
+    last = pubkeys.last_verified_.load(std::memory_order_relaxed);
+    if (last && verify_key(*last)) {
       return true;
-    } else if ((pubkey->pem_format_ || pubkey->kty_ == "RSA") &&
-               VerifySignatureRSA(pubkey->evp_pkey_.get(), jwt.md_,
-                                  jwt.signature_, signed_data)) {
+    }
+  }
+  for (const auto *pubkey : pubkeys.LookupByKid(jwt.kid_)) {
+    if (pubkey != last && verify_key(*pubkey)) {
       // Verification succeeded.
+      if (jwt.kid_.empty()) {
+        pubkeys.last_verified_.store(pubkey, std::memory_order_relaxed);
+      }
       return true;
     }
   }
@@ -433,7 +759,12 @@ bool Verifier::Verify(const Jwt &jwt, const Pubkeys &pubkeys) {
 }
 
 // Returns the parsed header.
-Json::ObjectSharedPtr Jwt::Header() { return header_; }
+Json::ObjectSharedPtr Jwt::Header() {
+  if (!header_ && !header_str_.empty()) {
+    header_ = ParseJson(header_str_);
+  }
+  return header_;
+}
 
 const std::string &Jwt::HeaderStr() { return header_str_; }
 const std::string &Jwt::HeaderStrBase64Url() { return header_str_base64url_; }
@@ -441,7 +772,12 @@ const std::string &Jwt::Alg() { return alg_; }
 const std::string &Jwt::Kid() { return kid_; }
 
 // Returns payload JSON.
-Json::ObjectSharedPtr Jwt::Payload() { return payload_; }
+Json::ObjectSharedPtr Jwt::Payload() {
+  if (!payload_ && !payload_str_.empty()) {
+    payload_ = ParseJson(payload_str_);
+  }
+  return payload_;
+}
 
 const std::string &Jwt::PayloadStr() { return payload_str_; }
 const std::string &Jwt::PayloadStrBase64Url() { return payload_str_base64url_; }
@@ -460,6 +796,7 @@ void Pubkeys::CreateFromPemCore(const std::string &pkey_pem) {
   if (e.GetStatus() == Status::OK) {
     keys_.push_back(std::move(key_ptr));
   }
+  BuildIndex();
 }
 
 void Pubkeys::CreateFromJwksCore(const std::string &pkey_jwks) {
@@ -495,6 +832,38 @@ void Pubkeys::CreateFromJwksCore(const std::string &pkey_jwks) {
   if (keys_.size() == 0) {
     UpdateStatus(Status::JWK_NO_VALID_PUBKEY);
   }
+  BuildIndex();
+}
+
+void Pubkeys::BuildIndex() {
+  for (const auto &key : keys_) {
+    all_keys_.push_back(key.get());
+    if (key->kid_specified_) {
+      kid_index_[key->kid_];
+    }
+  }
+  for (const auto &key : keys_) {
+    if (key->kid_specified_) {
+      kid_index_[key->kid_].push_back(key.get());
+    } else {
+      no_kid_keys_.push_back(key.get());
+      for (auto &it : kid_index_) {
+        it.second.push_back(key.get());
+      }
+    }
+  }
+}
+
+const std::vector<const Pubkeys::Pubkey *> &Pubkeys::LookupByKid(
+    const std::string &kid) const {
+  if (kid.empty()) {
+    return all_keys_;
+  }
+  auto it = kid_index_.find(kid);
+  if (it == kid_index_.end()) {
+    return no_kid_keys_;
+  }
+  return it->second;
 }
 
 void Pubkeys::ExtractPubkeyFromJwk(Json::ObjectSharedPtr jwk_json) {
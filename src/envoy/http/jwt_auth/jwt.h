@@ -15,11 +15,14 @@
 
 #pragma once
 
+#include "absl/strings/string_view.h"
 #include "envoy/json/json_object.h"
 #include "openssl/ec.h"
 #include "openssl/evp.h"
 
+#include <atomic>
 #include <string>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 
@@ -109,8 +112,6 @@ enum class Status {
 
 std::string StatusToString(Status status);
 
-std::string Base64UrlDecode(std::string input);
-
 // Base class to keep the status that represents "OK" or the first failure
 // reason
 class WithStatus {
@@ -160,10 +161,10 @@ class Verifier : public WithStatus {
   // Functions to verify with single public key.
   // (Note: Pubkeys object passed to Verify() may contains multiple public keys)
   // When verification fails, UpdateStatus() is NOT called.
-  bool VerifySignatureRSA(EVP_PKEY* key, const EVP_MD* md,
+  bool VerifySignatureRSA(RSA* key, const EVP_MD* md,
                           const uint8_t* signature, size_t signature_len,
                           const uint8_t* signed_data, size_t signed_data_len);
-  bool VerifySignatureRSA(EVP_PKEY* key, const EVP_MD* md,
+  bool VerifySignatureRSA(RSA* key, const EVP_MD* md,
                           const std::string& signature,
                           const std::string& signed_data);
   bool VerifySignatureEC(EC_KEY* key, const std::string& signature,
@@ -190,6 +191,7 @@ class Jwt : public WithStatus {
   // It returns a pointer to a JSON object of the header of the given JWT.
   // When the given JWT has a format error, it returns nullptr.
   // It returns the header JSON even if the signature is invalid.
+  // The JSON object is built on the first call.
   Json::ObjectSharedPtr Header();
 
   // They return a string (or base64url-encoded string) of the header JSON of
@@ -207,6 +209,8 @@ class Jwt : public WithStatus {
   // It returns a pointer to a JSON object of the payload of the given JWT.
   // When the given jWT has a format error, it returns nullptr.
   // It returns the payload JSON even if the signature is invalid.
+  // The JSON object is built on the first call, the claims below are read
+  // without it.
   Json::ObjectSharedPtr Payload();
 
   // They return a string (or base64url-encoded string) of the payload JSON of
@@ -231,7 +235,7 @@ class Jwt : public WithStatus {
   int64_t Exp();
 
  private:
-  const EVP_MD* md_;
+  const EVP_MD* md_{};
 
   Json::ObjectSharedPtr header_;
   std::string header_str_;
@@ -239,13 +243,15 @@ class Jwt : public WithStatus {
   Json::ObjectSharedPtr payload_;
   std::string payload_str_;
   std::string payload_str_base64url_;
+  // The signed part of the JWT, the base64url header and payload.
+  std::string signed_data_;
   std::string signature_;
   std::string alg_;
   std::string kid_;
   std::string iss_;
   std::vector<std::string> aud_;
   std::string sub_;
-  int64_t exp_;
+  int64_t exp_{};
 
   /*
    * TODO: try not to use friend function
@@ -275,6 +281,8 @@ class Pubkeys : public WithStatus {
   void ExtractPubkeyFromJwk(Json::ObjectSharedPtr jwk_json);
   void ExtractPubkeyFromJwkRSA(Json::ObjectSharedPtr jwk_json);
   void ExtractPubkeyFromJwkEC(Json::ObjectSharedPtr jwk_json);
+  // Indexes keys_ by kid.
+  void BuildIndex();
 
   class Pubkey {
    public:
@@ -290,6 +298,20 @@ class Pubkeys : public WithStatus {
   };
   std::vector<std::unique_ptr<Pubkey> > keys_;
 
+  // Returns the keys to verify a JWT with the kid, in JWKS order: the keys
+  // with the same kid and the ones without kid. All keys if kid is empty.
+  const std::vector<const Pubkey*>& LookupByKid(const std::string& kid) const;
+
+  // The keys of each kid, with the keys without kid.
+  std::unordered_map<std::string, std::vector<const Pubkey*> > kid_index_;
+  // The keys without kid, for an unknown kid.
+  std::vector<const Pubkey*> no_kid_keys_;
+  // All the keys, for an empty kid.
+  std::vector<const Pubkey*> all_keys_;
+  // The key which verified the last JWT without kid, tried first for the
+  // next one. Pubkeys may be shared by threads.
+  mutable std::atomic<const Pubkey*> last_verified_{nullptr};
+
   /*
    * TODO: try not to use friend function
    */
@@ -14,8 +14,7 @@
  */
 
 #include "src/envoy/http/jwt_auth/jwt_authenticator.h"
-#include "common/http/message_impl.h"
-#include "common/http/utility.h"
+#include "include/istio/utils/alloc_accounting.h"
 
 namespace Envoy {
 namespace Http {
@@ -25,28 +24,6 @@ namespace {
 // The HTTP header to pass verified token payload.
 const LowerCaseString kJwtPayloadKey("sec-istio-auth-userinfo");
 
-// Extract host and path from a URI
-void ExtractUriHostPath(const std::string& uri, std::string* host,
-                        std::string* path) {
-  // Example:
-  // uri  = "https://example.com/certs"
-  // pos  :          ^
-  // pos1 :                     ^
-  // host = "example.com"
-  // path = "/certs"
-  auto pos = uri.find("://");
-  pos = pos == std::string::npos ? 0 : pos + 3;  // Start position of host
-  auto pos1 = uri.find("/", pos);
-  if (pos1 == std::string::npos) {
-    // If uri doesn't have "/", the whole string is treated as host.
-    *host = uri.substr(pos);
-    *path = "/";
-  } else {
-    *host = uri.substr(pos, pos1 - pos);
-    *path = "/" + uri.substr(pos1 + 1);
-  }
-}
-
 }  // namespace
 
 JwtAuthenticator::JwtAuthenticator(Upstream::ClusterManager& cm,
@@ -56,13 +33,16 @@ JwtAuthenticator::JwtAuthenticator(Upstream::ClusterManager& cm,
 // Verify a JWT token.
 void JwtAuthenticator::Verify(HeaderMap& headers,
                               JwtAuthenticator::Callbacks* callback) {
+  ::istio::utils::ScopedAllocTag alloc_tag(
+      ::istio::utils::AllocTag::JWT_VERIFY);
+  ISTIO_TIME_PHASE(store_.verify_ns());
   headers_ = &headers;
   callback_ = callback;
 
   ENVOY_LOG(debug, "Jwt authentication starts");
-  std::vector<std::unique_ptr<JwtTokenExtractor::Token>> tokens;
-  store_.token_extractor().Extract(headers, &tokens);
-  if (tokens.size() == 0) {
+  // Only take the first one now. It refers to the headers, which are not
+  // changed before the authentication is done.
+  if (!store_.token_extractor().ExtractFirst(headers, &token_)) {
     if (OkToBypass()) {
       DoneWithStatus(Status::OK);
     } else {
@@ -71,27 +51,28 @@ void JwtAuthenticator::Verify(HeaderMap& headers,
     return;
   }
 
-  // Only take the first one now.
-  token_.swap(tokens[0]);
+  const auto unix_timestamp =
+      std::chrono::duration_cast<std::chrono::seconds>(
+          std::chrono::system_clock::now().time_since_epoch())
+          .count();
+  if (VerifyCachedToken(unix_timestamp)) {
+    return;
+  }
 
-  jwt_.reset(new Jwt(token_->token()));
+  jwt_.reset(new Jwt(std::string(token_.token())));
   if (jwt_->GetStatus() != Status::OK) {
     DoneWithStatus(jwt_->GetStatus());
     return;
   }
 
   // Check "exp" claim.
-  const auto unix_timestamp =
-      std::chrono::duration_cast<std::chrono::seconds>(
-          std::chrono::system_clock::now().time_since_epoch())
-          .count();
   if (jwt_->Exp() < unix_timestamp) {
     DoneWithStatus(Status::JWT_EXPIRED);
     return;
   }
 
   // Check if token is extracted from the location specified by the issuer.
-  if (!token_->IsIssuerAllowed(jwt_->Iss())) {
+  if (!token_.IsIssuerAllowed(jwt_->Iss())) {
     ENVOY_LOG(debug, "Token for issuer {} did not specify extract location",
               jwt_->Iss());
     DoneWithStatus(Status::JWT_UNKNOWN_ISSUER);
@@ -120,96 +101,107 @@ void JwtAuthenticator::Verify(HeaderMap& headers,
 }
 
 void JwtAuthenticator::FetchPubkey(PubkeyCacheItem* issuer) {
-  uri_ = issuer->jwt_config().remote_jwks().http_uri().uri();
-  std::string host, path;
-  ExtractUriHostPath(uri_, &host, &path);
-
-  MessagePtr message(new RequestMessageImpl());
-  message->headers().insertMethod().value().setReference(
-      Http::Headers::get().MethodValues.Get);
-  message->headers().insertPath().value(path);
-  message->headers().insertHost().value(host);
-
-  const auto& cluster = issuer->jwt_config().remote_jwks().http_uri().cluster();
-  if (cm_.get(cluster) == nullptr) {
-    DoneWithStatus(Status::FAILED_FETCH_PUBKEY);
-    return;
-  }
-
-  ENVOY_LOG(debug, "fetch pubkey from [uri = {}]: start", uri_);
-  request_ = cm_.httpAsyncClientForCluster(cluster).send(
-      std::move(message), *this, absl::optional<std::chrono::milliseconds>());
+  fetcher_ = &store_.pubkey_fetcher(*issuer);
+  fetcher_->Fetch(cm_, this);
 }
 
-void JwtAuthenticator::onSuccess(MessagePtr&& response) {
-  request_ = nullptr;
-  uint64_t status_code = Http::Utility::getResponseStatus(response->headers());
-  if (status_code == 200) {
-    ENVOY_LOG(debug, "fetch pubkey [uri = {}]: success", uri_);
-    std::string body;
-    if (response->body()) {
-      auto len = response->body()->length();
-      body = std::string(static_cast<char*>(response->body()->linearize(len)),
-                         len);
-    } else {
-      ENVOY_LOG(debug, "fetch pubkey [uri = {}]: body is empty", uri_);
-    }
-    OnFetchPubkeyDone(body);
-  } else {
-    ENVOY_LOG(debug, "fetch pubkey [uri = {}]: response status code {}", uri_,
-              status_code);
-    DoneWithStatus(Status::FAILED_FETCH_PUBKEY);
+void JwtAuthenticator::OnPubkeyFetched(const Status& status) {
+  fetcher_ = nullptr;
+  if (status != Status::OK) {
+    DoneWithStatus(status);
+    return;
   }
+  auto issuer = store_.pubkey_cache().LookupByIssuer(jwt_->Iss());
+  VerifyKey(*issuer);
 }
 
-void JwtAuthenticator::onFailure(AsyncClient::FailureReason) {
-  request_ = nullptr;
-  ENVOY_LOG(debug, "fetch pubkey [uri = {}]: failed", uri_);
-  DoneWithStatus(Status::FAILED_FETCH_PUBKEY);
+void JwtAuthenticator::onDestroy() {
+  if (fetcher_) {
+    fetcher_->Cancel(this);
+    fetcher_ = nullptr;
+  }
+  if (verify_request_) {
+    verify_request_->Cancel();
+    verify_request_ = nullptr;
+  }
 }
 
-void JwtAuthenticator::onDestroy() {
-  if (request_) {
-    request_->cancel();
-    request_ = nullptr;
-    ENVOY_LOG(debug, "fetch pubkey [uri = {}]: canceled", uri_);
+// Verify with a specific public key.
+void JwtAuthenticator::VerifyKey(const PubkeyCacheItem& issuer_item) {
+  uint64_t pubkey_version = issuer_item.pubkey_version();
+  VerifierPool* pool = store_.verifier_pool();
+  if (pool) {
+    // The pubkey cache items live as long as the store.
+    const PubkeyCacheItem* item = &issuer_item;
+    verify_request_ = pool->Verify(
+        jwt_, issuer_item.shared_pubkey(), store_.verifier_dispatcher(),
+        [this, item, pubkey_version](const Status& status) {
+          verify_request_ = nullptr;
+          OnSignatureVerified(*item, pubkey_version, status);
+        });
+    return;
   }
+
+  JwtAuth::Verifier v;
+  OnSignatureVerified(
+      issuer_item, pubkey_version,
+      v.Verify(*jwt_, *issuer_item.pubkey()) ? Status::OK : v.GetStatus());
 }
 
-// Handle the public key fetch done event.
-void JwtAuthenticator::OnFetchPubkeyDone(const std::string& pubkey) {
-  auto issuer = store_.pubkey_cache().LookupByIssuer(jwt_->Iss());
-  Status status = issuer->SetRemoteJwks(pubkey);
+void JwtAuthenticator::OnSignatureVerified(const PubkeyCacheItem& issuer_item,
+                                           uint64_t pubkey_version,
+                                           const Status& status) {
   if (status != Status::OK) {
     DoneWithStatus(status);
-  } else {
-    VerifyKey(*issuer);
+    return;
   }
+
+  store_.token_cache().Insert(
+      token_.token(), VerifiedToken{jwt_->Iss(), jwt_->Exp(), pubkey_version,
+                                     jwt_->PayloadStrBase64Url()});
+  ForwardPayload(issuer_item, jwt_->PayloadStrBase64Url());
 }
 
-// Verify with a specific public key.
-void JwtAuthenticator::VerifyKey(const PubkeyCacheItem& issuer_item) {
-  JwtAuth::Verifier v;
-  if (!v.Verify(*jwt_, *issuer_item.pubkey())) {
-    DoneWithStatus(v.GetStatus());
-    return;
+// Accept a token verified before, if it is still valid.
+bool JwtAuthenticator::VerifyCachedToken(int64_t unix_timestamp) {
+  const VerifiedToken* verified =
+      store_.token_cache().Lookup(token_.token(), unix_timestamp);
+  if (!verified) {
+    return false;
+  }
+
+  // The token is verified again once the issuer pubkeys are changed or
+  // expired. The issuer config and the audiences were checked before.
+  auto issuer = store_.pubkey_cache().LookupByIssuer(verified->issuer);
+  if (!issuer || !issuer->pubkey() || issuer->Expired() ||
+      issuer->pubkey_version() != verified->pubkey_version ||
+      !token_.IsIssuerAllowed(verified->issuer)) {
+    return false;
   }
 
+  ENVOY_LOG(debug, "Jwt for issuer {} is verified before", verified->issuer);
+  ForwardPayload(*issuer, verified->payload_base64url);
+  return true;
+}
+
+// Forward the verified payload and complete.
+void JwtAuthenticator::ForwardPayload(const PubkeyCacheItem& issuer_item,
+                                      const std::string& payload) {
   // TODO(lei-tang): remove this backward compatibility.
   // Tracking issue: https://github.com/istio/istio/issues/4744
-  headers_->addReferenceKey(kJwtPayloadKey, jwt_->PayloadStrBase64Url());
+  headers_->addReferenceKey(kJwtPayloadKey, payload);
 
   if (!issuer_item.jwt_config().forward_payload_header().empty()) {
     const LowerCaseString key(
         issuer_item.jwt_config().forward_payload_header());
     if (key.get() != kJwtPayloadKey.get()) {
-      headers_->addCopy(key, jwt_->PayloadStrBase64Url());
+      headers_->addCopy(key, payload);
     }
   }
 
   if (!issuer_item.jwt_config().forward()) {
     // Remove JWT from headers.
-    token_->Remove(headers_);
+    token_.Remove(headers_);
   }
 
   DoneWithStatus(Status::OK);
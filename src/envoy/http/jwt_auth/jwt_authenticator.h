@@ -27,7 +27,7 @@ namespace JwtAuth {
 // A per-request JWT authenticator to handle all JWT authentication:
 // * fetch remote public keys and cache them.
 class JwtAuthenticator : public Logger::Loggable<Logger::Id::filter>,
-                         public AsyncClient::Callbacks {
+                         public PubkeyFetcher::Waiter {
  public:
   JwtAuthenticator(Upstream::ClusterManager& cm, JwtAuthStore& store);
 
@@ -48,15 +48,24 @@ class JwtAuthenticator : public Logger::Loggable<Logger::Id::filter>,
  private:
   // Fetch a remote public key.
   void FetchPubkey(PubkeyCacheItem* issuer);
-  // Following two functions are for AyncClient::Callbacks
-  void onSuccess(MessagePtr&& response);
-  void onFailure(AsyncClient::FailureReason);
+  // For PubkeyFetcher::Waiter
+  void OnPubkeyFetched(const Status& status) override;
 
   // Verify with a specific public key.
   void VerifyKey(const PubkeyCacheItem& issuer);
 
-  // Handle the public key fetch done event.
-  void OnFetchPubkeyDone(const std::string& pubkey);
+  // Complete once the signature is verified with the issuer pubkeys of
+  // pubkey_version.
+  void OnSignatureVerified(const PubkeyCacheItem& issuer,
+                           uint64_t pubkey_version, const Status& status);
+
+  // Return true and complete if the token was verified before, skipping
+  // its decoding and signature verification.
+  bool VerifyCachedToken(int64_t unix_timestamp);
+
+  // Forward the verified payload to the upstream and complete.
+  void ForwardPayload(const PubkeyCacheItem& issuer,
+                      const std::string& payload);
 
   // Calls the callback with status.
   void DoneWithStatus(const Status& status);
@@ -68,20 +77,21 @@ class JwtAuthenticator : public Logger::Loggable<Logger::Id::filter>,
   Upstream::ClusterManager& cm_;
   // The cache object.
   JwtAuthStore& store_;
-  // The JWT object.
-  std::unique_ptr<JwtAuth::Jwt> jwt_;
+  // The JWT object, shared with the verifier pool.
+  std::shared_ptr<JwtAuth::Jwt> jwt_;
   // The token data
-  std::unique_ptr<JwtTokenExtractor::Token> token_;
+  JwtTokenExtractor::Token token_;
 
   // The HTTP request headers
   HeaderMap* headers_{};
   // The on_done function.
   Callbacks* callback_{};
 
-  // The pending uri_, only used for logging.
-  std::string uri_;
-  // The pending remote request so it can be canceled.
-  AsyncClient::Request* request_{};
+  // The fetcher of the pending public key fetch so it can be canceled.
+  PubkeyFetcher* fetcher_{};
+
+  // The pending signature verification in the pool so it can be canceled.
+  VerifierPool::RequestSharedPtr verify_request_;
 };
 
 }  // namespace JwtAuth
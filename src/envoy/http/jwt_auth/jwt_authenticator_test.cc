@@ -17,9 +17,14 @@
 #include "common/http/message_impl.h"
 #include "common/json/json_loader.h"
 #include "gtest/gtest.h"
+#include "test/mocks/event/mocks.h"
 #include "test/mocks/upstream/mocks.h"
 #include "test/test_common/utility.h"
 
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+
 using ::envoy::config::filter::http::jwt_authn::v2alpha::JwtAuthentication;
 using ::testing::Invoke;
 using ::testing::NiceMock;
@@ -337,6 +342,66 @@ TEST_F(JwtAuthenticatorTest, TestOkJWTandCache) {
   EXPECT_EQ(mock_pubkey.called_count(), 1);
 }
 
+TEST_F(JwtAuthenticatorTest, TestVerifiedTokenCache) {
+  MockUpstream mock_pubkey(mock_cm_, kPublicKey);
+
+  for (int i = 0; i < 2; i++) {
+    auto headers = TestHeaderMapImpl{{"Authorization", "Bearer " + kGoodToken}};
+    MockJwtAuthenticatorCallbacks mock_cb;
+    EXPECT_CALL(mock_cb, onDone(_)).WillOnce(Invoke([](const Status &status) {
+      ASSERT_EQ(status, Status::OK);
+    }));
+    auth_->Verify(headers, &mock_cb);
+    EXPECT_EQ(headers.get_("sec-istio-auth-userinfo"),
+              "eyJpc3MiOiJodHRwczovL2V4YW1wbGUuY29tIiwic3ViIjoidGVzdEBleGFtcG"
+              "xlLmNvbSIsImV4cCI6MjAwMTAwMTAwMSwiYXVkIjoiZXhhbXBsZV9zZXJ2"
+              "aWNlIn0");
+    EXPECT_FALSE(headers.Authorization());
+  }
+  EXPECT_EQ(store_->token_cache().size(), 1);
+  const VerifiedToken *verified = store_->token_cache().Lookup(kGoodToken, 0);
+  ASSERT_TRUE(verified != nullptr);
+  EXPECT_EQ(verified->issuer, "https://example.com");
+  EXPECT_EQ(verified->exp, 2001001001);
+
+  // The token is not reused after its expiration.
+  EXPECT_TRUE(store_->token_cache().Lookup(kGoodToken, 2001001002) == nullptr);
+  EXPECT_EQ(store_->token_cache().size(), 0);
+}
+
+TEST_F(JwtAuthenticatorTest, TestVerifiedTokenCacheWithNewPubkey) {
+  MockUpstream mock_pubkey(mock_cm_, kPublicKey);
+  auto headers = TestHeaderMapImpl{{"Authorization", "Bearer " + kGoodToken}};
+  MockJwtAuthenticatorCallbacks mock_cb;
+  EXPECT_CALL(mock_cb, onDone(_)).WillOnce(Invoke([](const Status &status) {
+    ASSERT_EQ(status, Status::OK);
+  }));
+  auth_->Verify(headers, &mock_cb);
+
+  // The same pubkeys fetched again keep the cached token.
+  auto issuer = store_->pubkey_cache().LookupByIssuer("https://example.com");
+  ASSERT_EQ(issuer->SetRemoteJwks(kPublicKey), Status::OK);
+  const VerifiedToken *verified = store_->token_cache().Lookup(kGoodToken, 0);
+  ASSERT_TRUE(verified != nullptr);
+  EXPECT_EQ(verified->pubkey_version, issuer->pubkey_version());
+
+  // Once the pubkeys are changed, the cached token is verified again.
+  ASSERT_EQ(issuer->SetRemoteJwks(kPublicKey + "\n"), Status::OK);
+  verified = store_->token_cache().Lookup(kGoodToken, 0);
+  ASSERT_TRUE(verified != nullptr);
+  EXPECT_NE(verified->pubkey_version, issuer->pubkey_version());
+
+  headers = TestHeaderMapImpl{{"Authorization", "Bearer " + kGoodToken}};
+  MockJwtAuthenticatorCallbacks mock_cb1;
+  EXPECT_CALL(mock_cb1, onDone(_)).WillOnce(Invoke([](const Status &status) {
+    ASSERT_EQ(status, Status::OK);
+  }));
+  auth_->Verify(headers, &mock_cb1);
+  verified = store_->token_cache().Lookup(kGoodToken, 0);
+  ASSERT_TRUE(verified != nullptr);
+  EXPECT_EQ(verified->pubkey_version, issuer->pubkey_version());
+}
+
 TEST_F(JwtAuthenticatorTest, TestOkJWTPubkeyNoAlg) {
   // Test OK pubkey with no "alg" claim.
   std::string alg_claim = "  \"alg\": \"RS256\",";
@@ -683,6 +748,178 @@ TEST_F(JwtAuthenticatorTest, TestPubkeyFetchFail) {
   callbacks->onSuccess(std::move(response_message));
 }
 
+TEST_F(JwtAuthenticatorTest, TestConcurrentPubkeyFetch) {
+  NiceMock<Http::MockAsyncClient> async_client;
+  EXPECT_CALL(mock_cm_, httpAsyncClientForCluster(_))
+      .WillOnce(Invoke([&](const std::string &cluster) -> Http::AsyncClient & {
+        EXPECT_EQ(cluster, "pubkey_cluster");
+        return async_client;
+      }));
+
+  // Only one fetch is sent for all the pending requests.
+  MockAsyncClientRequest request(&async_client);
+  AsyncClient::Callbacks *callbacks;
+  EXPECT_CALL(async_client, send_(_, _, _))
+      .WillOnce(Invoke([&](MessagePtr &, AsyncClient::Callbacks &cb,
+                           const absl::optional<std::chrono::milliseconds> &)
+                           -> AsyncClient::Request * {
+        callbacks = &cb;
+        return &request;
+      }));
+
+  const int kNumRequests = 3;
+  std::vector<std::unique_ptr<JwtAuthenticator>> auths;
+  std::vector<TestHeaderMapImpl> headers(
+      kNumRequests,
+      TestHeaderMapImpl{{"Authorization", "Bearer " + kGoodToken}});
+  MockJwtAuthenticatorCallbacks mock_cb;
+  EXPECT_CALL(mock_cb, onDone(_))
+      .Times(kNumRequests)
+      .WillRepeatedly(
+          Invoke([](const Status &status) { ASSERT_EQ(status, Status::OK); }));
+  for (int i = 0; i < kNumRequests; i++) {
+    auths.emplace_back(new JwtAuthenticator(mock_cm_, *store_));
+    auths.back()->Verify(headers[i], &mock_cb);
+  }
+
+  Http::MessagePtr response_message(new ResponseMessageImpl(
+      HeaderMapPtr{new TestHeaderMapImpl{{":status", "200"}}}));
+  response_message->body().reset(new Buffer::OwnedImpl(kPublicKey));
+  callbacks->onSuccess(std::move(response_message));
+
+  for (int i = 0; i < kNumRequests; i++) {
+    EXPECT_TRUE(headers[i].has("sec-istio-auth-userinfo"));
+  }
+}
+
+TEST_F(JwtAuthenticatorTest, TestConditionalPubkeyFetch) {
+  NiceMock<Http::MockAsyncClient> async_client;
+  EXPECT_CALL(mock_cm_, httpAsyncClientForCluster(_))
+      .WillRepeatedly(
+          Invoke([&](const std::string &) -> Http::AsyncClient & {
+            return async_client;
+          }));
+
+  MockAsyncClientRequest request(&async_client);
+  std::vector<TestHeaderMapImpl> request_headers;
+  AsyncClient::Callbacks *callbacks;
+  EXPECT_CALL(async_client, send_(_, _, _))
+      .Times(2)
+      .WillRepeatedly(
+          Invoke([&](MessagePtr &message, AsyncClient::Callbacks &cb,
+                     const absl::optional<std::chrono::milliseconds> &)
+                     -> AsyncClient::Request * {
+            request_headers.emplace_back(message->headers());
+            callbacks = &cb;
+            return &request;
+          }));
+
+  MockJwtAuthenticatorCallbacks mock_cb;
+  EXPECT_CALL(mock_cb, onDone(_))
+      .Times(2)
+      .WillRepeatedly(
+          Invoke([](const Status &status) { ASSERT_EQ(status, Status::OK); }));
+  auto headers = TestHeaderMapImpl{{"Authorization", "Bearer " + kGoodToken}};
+  auth_->Verify(headers, &mock_cb);
+
+  // The first fetch is not conditional.
+  ASSERT_EQ(request_headers.size(), 1);
+  EXPECT_FALSE(request_headers[0].has("if-none-match"));
+  Http::MessagePtr response_message(new ResponseMessageImpl(
+      HeaderMapPtr{new TestHeaderMapImpl{
+          {":status", "200"},
+          {"etag", "\"v1\""},
+          {"last-modified", "Wed, 21 Oct 2015 07:28:00 GMT"}}}));
+  response_message->body().reset(new Buffer::OwnedImpl(kPublicKey));
+  callbacks->onSuccess(std::move(response_message));
+
+  // Once expired, the keys are fetched again with the validators.
+  auto issuer = store_->pubkey_cache().LookupByIssuer("https://example.com");
+  uint64_t pubkey_version = issuer->pubkey_version();
+  issuer->ExtendExpiration(std::chrono::steady_clock::now());
+  headers = TestHeaderMapImpl{{"Authorization", "Bearer " + kGoodToken}};
+  auth_->Verify(headers, &mock_cb);
+  ASSERT_EQ(request_headers.size(), 2);
+  EXPECT_EQ(request_headers[1].get_("if-none-match"), "\"v1\"");
+  EXPECT_EQ(request_headers[1].get_("if-modified-since"),
+            "Wed, 21 Oct 2015 07:28:00 GMT");
+
+  // Not modified, the parsed keys are kept.
+  response_message.reset(new ResponseMessageImpl(
+      HeaderMapPtr{new TestHeaderMapImpl{{":status", "304"}}}));
+  callbacks->onSuccess(std::move(response_message));
+  EXPECT_TRUE(headers.has("sec-istio-auth-userinfo"));
+  EXPECT_EQ(issuer->pubkey_version(), pubkey_version);
+  EXPECT_FALSE(issuer->Expired());
+}
+
+TEST_F(JwtAuthenticatorTest, TestOnDestroyWithPendingFetch) {
+  NiceMock<Http::MockAsyncClient> async_client;
+  EXPECT_CALL(mock_cm_, httpAsyncClientForCluster(_))
+      .WillOnce(Invoke([&](const std::string &cluster) -> Http::AsyncClient & {
+        return async_client;
+      }));
+
+  MockAsyncClientRequest request(&async_client);
+  AsyncClient::Callbacks *callbacks;
+  EXPECT_CALL(async_client, send_(_, _, _))
+      .WillOnce(Invoke([&](MessagePtr &, AsyncClient::Callbacks &cb,
+                           const absl::optional<std::chrono::milliseconds> &)
+                           -> AsyncClient::Request * {
+        callbacks = &cb;
+        return &request;
+      }));
+  // The fetch is kept for the other pending request.
+  EXPECT_CALL(request, cancel()).Times(0);
+
+  JwtAuthenticator auth(mock_cm_, *store_);
+  auto headers = TestHeaderMapImpl{{"Authorization", "Bearer " + kGoodToken}};
+  auto headers1 = TestHeaderMapImpl{{"Authorization", "Bearer " + kGoodToken}};
+  MockJwtAuthenticatorCallbacks mock_cb;
+  EXPECT_CALL(mock_cb, onDone(_)).Times(0);
+  EXPECT_CALL(mock_cb_, onDone(_)).WillOnce(Invoke([](const Status &status) {
+    ASSERT_EQ(status, Status::OK);
+  }));
+  auth.Verify(headers, &mock_cb);
+  auth_->Verify(headers1, &mock_cb_);
+  auth.onDestroy();
+
+  Http::MessagePtr response_message(new ResponseMessageImpl(
+      HeaderMapPtr{new TestHeaderMapImpl{{":status", "200"}}}));
+  response_message->body().reset(new Buffer::OwnedImpl(kPublicKey));
+  callbacks->onSuccess(std::move(response_message));
+}
+
+TEST_F(JwtAuthenticatorTest, TestPubkeyRefresh) {
+  NiceMock<Event::MockDispatcher> dispatcher;
+  auto timer = new NiceMock<Event::MockTimer>(&dispatcher);
+  store_.reset(new JwtAuthStore(config_, &dispatcher));
+  auth_.reset(new JwtAuthenticator(mock_cm_, *store_));
+  MockUpstream mock_pubkey(mock_cm_, kPublicKey);
+
+  // The keys are refreshed at 90% of the cache duration, 600 seconds.
+  EXPECT_CALL(*timer, enableTimer(_))
+      .Times(2)
+      .WillRepeatedly(Invoke([](const std::chrono::milliseconds &ms) {
+        EXPECT_GT(ms.count(), 530000);
+        EXPECT_LE(ms.count(), 540000);
+      }));
+
+  auto headers = TestHeaderMapImpl{{"Authorization", "Bearer " + kGoodToken}};
+  MockJwtAuthenticatorCallbacks mock_cb;
+  EXPECT_CALL(mock_cb, onDone(_)).WillOnce(Invoke([](const Status &status) {
+    ASSERT_EQ(status, Status::OK);
+  }));
+  auth_->Verify(headers, &mock_cb);
+  EXPECT_EQ(mock_pubkey.called_count(), 1);
+
+  timer->callback_();
+  EXPECT_EQ(mock_pubkey.called_count(), 2);
+  auto issuer = store_->pubkey_cache().LookupByIssuer("https://example.com");
+  EXPECT_TRUE(issuer->pubkey() != nullptr);
+  EXPECT_FALSE(issuer->Expired());
+}
+
 TEST_F(JwtAuthenticatorTest, TestInvalidPubkey) {
   NiceMock<Http::MockAsyncClient> async_client;
   EXPECT_CALL(mock_cm_, httpAsyncClientForCluster(_))
@@ -757,6 +994,92 @@ TEST_F(JwtAuthenticatorTest, TestOnDestroy) {
   auth_->onDestroy();
 }
 
+// A dispatcher which queues the callbacks posted from the verifier pool.
+class PostedCallbacks {
+ public:
+  PostedCallbacks(NiceMock<Event::MockDispatcher> &dispatcher) {
+    ON_CALL(dispatcher, post(_))
+        .WillByDefault(Invoke([this](std::function<void()> callback) {
+          std::lock_guard<std::mutex> lock(mutex_);
+          callbacks_.push_back(callback);
+          cv_.notify_one();
+        }));
+  }
+
+  // Waits for a posted callback and runs it.
+  void RunNext() {
+    std::function<void()> callback;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      cv_.wait(lock, [this]() { return !callbacks_.empty(); });
+      callback = callbacks_.front();
+      callbacks_.pop_front();
+    }
+    callback();
+  }
+
+ private:
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::deque<std::function<void()>> callbacks_;
+};
+
+TEST_F(JwtAuthenticatorTest, TestVerifierPool) {
+  NiceMock<Event::MockDispatcher> dispatcher;
+  PostedCallbacks posted(dispatcher);
+  VerifierPool pool(2);
+  store_->set_verifier_pool(&pool, dispatcher);
+  MockUpstream mock_pubkey(mock_cm_, kPublicKey);
+
+  auto headers = TestHeaderMapImpl{{"Authorization", "Bearer " + kGoodToken}};
+  MockJwtAuthenticatorCallbacks mock_cb;
+  EXPECT_CALL(mock_cb, onDone(_)).Times(0);
+  auth_->Verify(headers, &mock_cb);
+  ::testing::Mock::VerifyAndClearExpectations(&mock_cb);
+
+  // The authenticator resumes once the result is posted back.
+  EXPECT_CALL(mock_cb, onDone(_)).WillOnce(Invoke([](const Status &status) {
+    ASSERT_EQ(status, Status::OK);
+  }));
+  posted.RunNext();
+  EXPECT_EQ(headers.get_("sec-istio-auth-userinfo"),
+            "eyJpc3MiOiJodHRwczovL2V4YW1wbGUuY29tIiwic3ViIjoidGVzdEBleGFtcG"
+            "xlLmNvbSIsImV4cCI6MjAwMTAwMTAwMSwiYXVkIjoiZXhhbXBsZV9zZXJ2"
+            "aWNlIn0");
+}
+
+TEST_F(JwtAuthenticatorTest, TestOnDestroyWithPendingVerification) {
+  NiceMock<Event::MockDispatcher> dispatcher;
+  PostedCallbacks posted(dispatcher);
+  VerifierPool pool(1);
+  store_->set_verifier_pool(&pool, dispatcher);
+  MockUpstream mock_pubkey(mock_cm_, kPublicKey);
+
+  // onDone() should not be called.
+  EXPECT_CALL(mock_cb_, onDone(_)).Times(0);
+
+  auto headers = TestHeaderMapImpl{{"Authorization", "Bearer " + kGoodToken}};
+  auth_->Verify(headers, &mock_cb_);
+  auth_->onDestroy();
+
+  // The pool either skips the canceled verification, or its result is
+  // dropped. A second verification is done after it by the same thread.
+  JwtAuthenticator other_auth(mock_cm_, *store_);
+  MockJwtAuthenticatorCallbacks other_cb;
+  bool done = false;
+  EXPECT_CALL(other_cb, onDone(_)).WillOnce(Invoke([&](const Status &status) {
+    ASSERT_EQ(status, Status::OK);
+    done = true;
+  }));
+  auto other_headers =
+      TestHeaderMapImpl{{"Authorization", "Bearer " + kGoodToken}};
+  other_auth.Verify(other_headers, &other_cb);
+  while (!done) {
+    posted.RunNext();
+  }
+  EXPECT_FALSE(headers.has("sec-istio-auth-userinfo"));
+}
+
 TEST_F(JwtAuthenticatorTest, TestNoForwardPayloadHeader) {
   // In this config, there is no forward_payload_header
   SetupConfig(kExampleConfigWithoutForwardPayloadHeader);
@@ -0,0 +1,119 @@
+/* Copyright 2018 Istio Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/envoy/http/jwt_auth/jwt_payload_cache.h"
+#include "common/json/json_loader.h"
+#include "include/istio/utils/base64.h"
+#include "src/envoy/http/jwt_auth/jwt.h"
+
+#include <list>
+#include <unordered_map>
+
+namespace Envoy {
+namespace Http {
+namespace JwtAuth {
+namespace {
+
+// The maximum number of payloads cached per thread.
+const size_t kJwtPayloadCacheSize = 1000;
+
+// The JWT audience key name
+const std::string kJwtAudienceKey = "aud";
+
+std::shared_ptr<const JwtPayloadClaims> Decode(
+    absl::string_view payload_base64url) {
+  std::string payload_str;
+  if (!::istio::utils::Base64UrlDecode(payload_base64url, &payload_str) ||
+      payload_str.empty()) {
+    return nullptr;
+  }
+  Json::ObjectSharedPtr json_obj;
+  try {
+    json_obj = Json::Factory::loadFromString(payload_str);
+  } catch (...) {
+    return nullptr;
+  }
+
+  std::shared_ptr<JwtPayloadClaims> payload(new JwtPayloadClaims());
+  json_obj->iterate(
+      [&payload](const std::string& key, const Json::Object& obj) -> bool {
+        // Only string objects are extracted into claims, asString() throws
+        // an exception for the others.
+        try {
+          payload->claims[key] = obj.asString();
+        } catch (Json::Exception& e) {
+        }
+        return true;
+      });
+  // "aud" can be either string array or string.
+  auto it = payload->claims.find(kJwtAudienceKey);
+  if (it != payload->claims.end()) {
+    payload->audiences.push_back(it->second);
+  } else {
+    try {
+      payload->audiences = json_obj->getStringArray(kJwtAudienceKey);
+    } catch (Json::Exception& e) {
+      // Not convertable to string array
+    }
+  }
+  return payload;
+}
+
+// A LRU cache of the decoded payloads, indexed by the encoded payload.
+class JwtPayloadCache {
+ public:
+  std::shared_ptr<const JwtPayloadClaims> Get(
+      absl::string_view payload_base64url) {
+    std::string key(payload_base64url);
+    auto it = index_.find(key);
+    if (it != index_.end()) {
+      entries_.splice(entries_.begin(), entries_, it->second);
+      return it->second->second;
+    }
+    auto payload = Decode(payload_base64url);
+    if (!payload) {
+      return nullptr;
+    }
+    if (entries_.size() >= kJwtPayloadCacheSize) {
+      index_.erase(entries_.back().first);
+      entries_.pop_back();
+    }
+    entries_.emplace_front(key, payload);
+    index_.emplace(key, entries_.begin());
+    return payload;
+  }
+
+ private:
+  typedef std::list<
+      std::pair<std::string, std::shared_ptr<const JwtPayloadClaims>>>
+      EntryList;
+
+  // The entries, the most recently used first.
+  EntryList entries_;
+  // The entries indexed by the encoded payload.
+  std::unordered_map<std::string, EntryList::iterator> index_;
+};
+
+}  // namespace
+
+std::shared_ptr<const JwtPayloadClaims> DecodeJwtPayload(
+    absl::string_view payload_base64url) {
+  static thread_local JwtPayloadCache cache;
+  return cache.Get(payload_base64url);
+}
+
+}  // namespace JwtAuth
+}  // namespace Http
+}  // namespace Envoy
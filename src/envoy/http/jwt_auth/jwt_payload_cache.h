@@ -0,0 +1,47 @@
+/* Copyright 2018 Istio Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "absl/strings/string_view.h"
+
+namespace Envoy {
+namespace Http {
+namespace JwtAuth {
+
+// The claims of a verified JWT payload.
+struct JwtPayloadClaims {
+  // The claims with a string value.
+  std::map<std::string, std::string> claims;
+  // The "aud" claim, either a string or a string array.
+  std::vector<std::string> audiences;
+};
+
+// Returns the claims of a base64url encoded JWT payload, as added to the
+// request headers by the JWT filter, or nullptr if it is not valid.
+// The JWT filter forwards the same payload for all the requests with the
+// same token, and the authn and Mixer filters both read it, so the decoded
+// claims are cached per thread, indexed by the encoded payload.
+std::shared_ptr<const JwtPayloadClaims> DecodeJwtPayload(
+    absl::string_view payload_base64url);
+
+}  // namespace JwtAuth
+}  // namespace Http
+}  // namespace Envoy
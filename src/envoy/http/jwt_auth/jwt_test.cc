@@ -551,6 +551,35 @@ TEST_F(JwtTestPem, InvalidAlg) {
          Status::ALG_NOT_IMPLEMENTED, nullptr);
 }
 
+TEST(JwtClaimsTest, EscapedAndNestedClaims) {
+  // header: {"alg":"RS256","kid":"k\/1"}
+  // payload: {"iss":"https:\/\/example.com","aud":"svc","exp":1,
+  //           "nested":{"a":[1,{"b":"\"}"}]}}
+  Jwt jwt(
+      "eyJhbGciOiJSUzI1NiIsImtpZCI6ImtcLzEifQ."
+      "eyJpc3MiOiJodHRwczpcL1wvZXhhbXBsZS5jb20iLCJhdWQiOiJzdmMiLCJleHAiOjEsIm5l"
+      "c3RlZCI6eyJhIjpbMSx7ImIiOiJcIn0ifV19fQ.c2lnbmF0dXJl");
+  ASSERT_EQ(jwt.GetStatus(), Status::OK);
+  EXPECT_EQ(jwt.Alg(), "RS256");
+  EXPECT_EQ(jwt.Kid(), "k/1");
+  EXPECT_EQ(jwt.Iss(), "https://example.com");
+  EXPECT_EQ(jwt.Aud(), std::vector<std::string>{"svc"});
+  EXPECT_EQ(jwt.Exp(), 1);
+  EXPECT_EQ(jwt.Sub(), "");
+
+  // The JSON objects are built on demand.
+  ASSERT_TRUE(jwt.Payload());
+  EXPECT_EQ(jwt.Payload()->getString("iss"), "https://example.com");
+  ASSERT_TRUE(jwt.Header());
+  EXPECT_EQ(jwt.Header()->getString("kid"), "k/1");
+}
+
+TEST(JwtClaimsTest, BadClaimType) {
+  // payload: {"iss":1}
+  Jwt jwt("eyJhbGciOiJSUzI1NiJ9.eyJpc3MiOjF9.c2lnbmF0dXJl");
+  EXPECT_EQ(jwt.GetStatus(), Status::JWT_PAYLOAD_PARSE_ERROR);
+}
+
 TEST(JwtSubExtractionTest, NonEmptyJwtSubShouldEqual) {
   DatasetPem ds;
   Jwt jwt(ds.kJwt);
@@ -611,6 +640,23 @@ TEST_F(JwtTestJwks, OkCorrectKid) {
          payload);
 }
 
+TEST_F(JwtTestJwks, OkNoKidWithSharedPubkeys) {
+  // The second key verifies the JWT, it is tried first the next times.
+  auto key = Pubkeys::CreateFrom(ds.kPublicKeyRSA, Pubkeys::Type::JWKS);
+  for (int i = 0; i < 2; i++) {
+    Jwt jwt(ds.kJwtNoKid);
+    Verifier v;
+    EXPECT_TRUE(v.Verify(jwt, *key));
+    EXPECT_EQ(Status::OK, v.GetStatus());
+  }
+
+  // A JWT with kid only uses the keys with its kid.
+  Jwt jwt(ds.kJwtWithIncorrectKid);
+  Verifier v;
+  EXPECT_FALSE(v.Verify(jwt, *key));
+  EXPECT_EQ(Status::JWT_INVALID_SIGNATURE, v.GetStatus());
+}
+
 TEST_F(JwtTestJwks, IncorrectKid) {
   DoTest(ds.kJwtWithIncorrectKid, ds.kPublicKeyRSA, "jwks", false,
          Status::JWT_INVALID_SIGNATURE, nullptr);
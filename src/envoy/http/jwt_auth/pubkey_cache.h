@@ -16,11 +16,15 @@
 #pragma once
 
 #include <chrono>
+#include <memory>
 #include <unordered_map>
+#include <unordered_set>
 
+#include "absl/strings/string_view.h"
 #include "common/common/logger.h"
 #include "common/config/datasource.h"
 #include "envoy/config/filter/http/jwt_authn/v2alpha/config.pb.h"
+#include "include/istio/utils/string_key.h"
 #include "src/envoy/http/jwt_auth/jwt.h"
 
 namespace Envoy {
@@ -44,9 +48,10 @@ class PubkeyCacheItem : public Logger::Loggable<Logger::Id::filter> {
       const ::envoy::config::filter::http::jwt_authn::v2alpha::JwtRule&
           jwt_config)
       : jwt_config_(jwt_config) {
-    // Convert proto repeated fields to std::set.
+    // Convert proto repeated fields to a hash set.
     for (const auto& aud : jwt_config_.audiences()) {
-      audiences_.insert(SanitizeAudience(aud));
+      audiences_.insert(
+          ::istio::utils::StringKey(std::string(SanitizeAudience(aud))));
     }
 
     auto inline_jwks = Config::DataSource::read(jwt_config_.local_jwks(), true);
@@ -75,21 +80,75 @@ class PubkeyCacheItem : public Logger::Loggable<Logger::Id::filter> {
   // Get the pubkey object.
   const Pubkeys* pubkey() const { return pubkey_.get(); }
 
-  // Check if an audience is allowed.
-  bool IsAudienceAllowed(const std::vector<std::string>& jwt_audiences) {
+  // Get the pubkey object to share it with other threads, it is immutable.
+  std::shared_ptr<const Pubkeys> shared_pubkey() const { return pubkey_; }
+
+  // Get the pubkey as string.
+  const std::string& pubkey_str() const { return pubkey_str_; }
+
+  // Get the pubkey version, changed each time the pubkey is set.
+  uint64_t pubkey_version() const { return pubkey_version_; }
+
+  // Check if an audience is allowed. The audiences are looked up by
+  // reference, without copying them. The tokens found in the token cache
+  // are not checked again, they were only inserted if allowed.
+  bool IsAudienceAllowed(const std::vector<std::string>& jwt_audiences) const {
     if (audiences_.empty()) {
       return true;
     }
     for (const auto& aud : jwt_audiences) {
-      if (audiences_.find(SanitizeAudience(aud)) != audiences_.end()) {
+      if (audiences_.count(
+              ::istio::utils::StringKey::Ref(SanitizeAudience(aud))) > 0) {
         return true;
       }
     }
     return false;
   }
 
-  Status SetRemoteJwks(const std::string& pubkey_str) {
-    return SetKey(pubkey_str, GetRemoteJwksExpirationTime());
+  // Set the fetched remote pubkey. The etag and last_modified validators
+  // of the response are kept to fetch it again conditionally.
+  Status SetRemoteJwks(const std::string& pubkey_str,
+                       const std::string& etag = "",
+                       const std::string& last_modified = "") {
+    Status status = SetKey(pubkey_str, GetRemoteJwksExpirationTime());
+    if (status == Status::OK) {
+      etag_ = etag;
+      last_modified_ = last_modified;
+    }
+    return status;
+  }
+
+  // Keep the remote pubkey, not modified since it was fetched, for another
+  // cache duration.
+  void SetRemoteJwksNotModified() {
+    expiration_time_ = GetRemoteJwksExpirationTime();
+  }
+
+  // Get the validators of the fetched remote pubkey, empty if none.
+  const std::string& etag() const { return etag_; }
+  const std::string& last_modified() const { return last_modified_; }
+
+  // Set a pubkey parsed by another thread.
+  void SetParsedKey(std::shared_ptr<const Pubkeys> pubkey,
+                    const std::string& pubkey_str,
+                    std::chrono::steady_clock::time_point expire) {
+    expiration_time_ = expire;
+    if (pubkey_ == pubkey || (pubkey_ && pubkey_str == pubkey_str_)) {
+      return;
+    }
+    pubkey_ = std::move(pubkey);
+    pubkey_str_ = pubkey_str;
+    ++pubkey_version_;
+  }
+
+  // Get the pubkey expiration time.
+  std::chrono::steady_clock::time_point expiration_time() const {
+    return expiration_time_;
+  }
+
+  // Keep using the current pubkey until a new expiration time.
+  void ExtendExpiration(std::chrono::steady_clock::time_point expire) {
+    expiration_time_ = expire;
   }
 
  private:
@@ -110,47 +169,52 @@ class PubkeyCacheItem : public Logger::Loggable<Logger::Id::filter> {
   // Set a pubkey as string.
   Status SetKey(const std::string& pubkey_str,
                 std::chrono::steady_clock::time_point expire) {
+    // The keys are often unchanged when refreshed, so the tokens verified
+    // with them are still valid.
+    if (pubkey_ && pubkey_str == pubkey_str_) {
+      expiration_time_ = expire;
+      return Status::OK;
+    }
     auto pubkey = Pubkeys::CreateFrom(pubkey_str, Pubkeys::JWKS);
     if (pubkey->GetStatus() != Status::OK) {
       return pubkey->GetStatus();
     }
     pubkey_ = std::move(pubkey);
+    pubkey_str_ = pubkey_str;
+    ++pubkey_version_;
     expiration_time_ = expire;
     return Status::OK;
   }
 
   // Searches protocol scheme prefix and trailing slash from aud, and
   // returns aud without these prefix and suffix.
-  std::string SanitizeAudience(const std::string& aud) {
-    int beg = 0;
-    int end = aud.length() - 1;
-    bool sanitize_aud = false;
-    // Point beg to first character after protocol scheme prefix in audience.
+  static absl::string_view SanitizeAudience(absl::string_view aud) {
     if (aud.compare(0, kHTTPSchemePrefix.length(), kHTTPSchemePrefix) == 0) {
-      beg = kHTTPSchemePrefix.length();
-      sanitize_aud = true;
+      aud.remove_prefix(kHTTPSchemePrefix.length());
     } else if (aud.compare(0, kHTTPSSchemePrefix.length(),
                            kHTTPSSchemePrefix) == 0) {
-      beg = kHTTPSSchemePrefix.length();
-      sanitize_aud = true;
-    }
-    // Point end to trailing slash in aud.
-    if (end >= 0 && aud[end] == '/') {
-      --end;
-      sanitize_aud = true;
+      aud.remove_prefix(kHTTPSSchemePrefix.length());
     }
-    if (sanitize_aud) {
-      return aud.substr(beg, end - beg + 1);
+    if (!aud.empty() && aud.back() == '/') {
+      aud.remove_suffix(1);
     }
     return aud;
   }
 
   // The issuer config
   const ::envoy::config::filter::http::jwt_authn::v2alpha::JwtRule& jwt_config_;
-  // Use set for fast lookup
-  std::set<std::string> audiences_;
+  // The sanitized audiences, in a hash set for fast lookup.
+  std::unordered_set<::istio::utils::StringKey, ::istio::utils::StringKey::Hash>
+      audiences_;
   // The generated pubkey object.
-  std::unique_ptr<Pubkeys> pubkey_;
+  std::shared_ptr<const Pubkeys> pubkey_;
+  // The pubkey as string.
+  std::string pubkey_str_;
+  // The ETag and Last-Modified headers of the remote pubkey response.
+  std::string etag_;
+  std::string last_modified_;
+  // The pubkey version, the tokens verified with older ones are not reused.
+  uint64_t pubkey_version_{};
   // The pubkey expiration time.
   std::chrono::steady_clock::time_point expiration_time_;
 };
@@ -0,0 +1,231 @@
+/* Copyright 2018 Istio Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/envoy/http/jwt_auth/pubkey_fetcher.h"
+#include "common/http/message_impl.h"
+#include "common/http/utility.h"
+#include "include/istio/utils/tracepoint.h"
+
+namespace Envoy {
+namespace Http {
+namespace JwtAuth {
+namespace {
+
+// The delay to retry a failed background fetch without keys.
+const int kPubkeyFetchRetryMs = 10000;
+
+// The headers of the conditional fetches.
+const LowerCaseString kETagHeader("etag");
+const LowerCaseString kLastModifiedHeader("last-modified");
+const LowerCaseString kIfNoneMatchHeader("if-none-match");
+const LowerCaseString kIfModifiedSinceHeader("if-modified-since");
+
+// Get a response header, empty if missing.
+std::string GetHeader(const HeaderMap& headers, const LowerCaseString& key) {
+  const HeaderEntry* entry = headers.get(key);
+  return entry ? std::string(entry->value().c_str(), entry->value().size())
+               : "";
+}
+
+// Extract host and path from a URI
+void ExtractUriHostPath(const std::string& uri, std::string* host,
+                        std::string* path) {
+  // Example:
+  // uri  = "https://example.com/certs"
+  // pos  :          ^
+  // pos1 :                     ^
+  // host = "example.com"
+  // path = "/certs"
+  auto pos = uri.find("://");
+  pos = pos == std::string::npos ? 0 : pos + 3;  // Start position of host
+  auto pos1 = uri.find("/", pos);
+  if (pos1 == std::string::npos) {
+    // If uri doesn't have "/", the whole string is treated as host.
+    *host = uri.substr(pos);
+    *path = "/";
+  } else {
+    *host = uri.substr(pos, pos1 - pos);
+    *path = "/" + uri.substr(pos1 + 1);
+  }
+}
+
+}  // namespace
+
+PubkeyFetcher::~PubkeyFetcher() {
+  if (request_) {
+    request_->cancel();
+  }
+}
+
+void PubkeyFetcher::Fetch(Upstream::ClusterManager& cm, Waiter* waiter) {
+  waiters_.push_back(waiter);
+  cm_ = &cm;
+  if (in_flight_) {
+    ENVOY_LOG(debug, "fetch pubkey from [uri = {}]: wait for the pending one",
+              issuer_.jwt_config().remote_jwks().http_uri().uri());
+    return;
+  }
+  Send();
+}
+
+void PubkeyFetcher::Send() {
+  const auto& cluster = issuer_.jwt_config().remote_jwks().http_uri().cluster();
+  if (cm_->get(cluster) == nullptr) {
+    Done(Status::FAILED_FETCH_PUBKEY);
+    return;
+  }
+
+  const auto& uri = issuer_.jwt_config().remote_jwks().http_uri().uri();
+  std::string host, path;
+  ExtractUriHostPath(uri, &host, &path);
+
+  MessagePtr message(new RequestMessageImpl());
+  message->headers().insertMethod().value().setReference(
+      Http::Headers::get().MethodValues.Get);
+  message->headers().insertPath().value(path);
+  message->headers().insertHost().value(host);
+  // The keys rarely change, not to fetch and parse them again.
+  if (issuer_.pubkey()) {
+    if (!issuer_.etag().empty()) {
+      message->headers().addCopy(kIfNoneMatchHeader, issuer_.etag());
+    }
+    if (!issuer_.last_modified().empty()) {
+      message->headers().addCopy(kIfModifiedSinceHeader,
+                                 issuer_.last_modified());
+    }
+  }
+
+  ENVOY_LOG(debug, "fetch pubkey from [uri = {}]: start", uri);
+  ISTIO_TRACEPOINT1(jwks_fetch_start, uri.c_str());
+  in_flight_ = true;
+  auto request = cm_->httpAsyncClientForCluster(cluster).send(
+      std::move(message), *this, absl::optional<std::chrono::milliseconds>());
+  // The request may be done inline.
+  if (in_flight_) {
+    request_ = request;
+  }
+}
+
+void PubkeyFetcher::Cancel(Waiter* waiter) {
+  waiters_.remove(waiter);
+  // A refresh is kept even if its waiters are gone.
+  if (waiters_.empty() && request_ && !refreshing_) {
+    request_->cancel();
+    request_ = nullptr;
+    in_flight_ = false;
+    ENVOY_LOG(debug, "fetch pubkey [uri = {}]: canceled",
+              issuer_.jwt_config().remote_jwks().http_uri().uri());
+  }
+}
+
+void PubkeyFetcher::onSuccess(MessagePtr&& response) {
+  request_ = nullptr;
+  const auto& uri = issuer_.jwt_config().remote_jwks().http_uri().uri();
+  uint64_t status_code = Http::Utility::getResponseStatus(response->headers());
+  if (status_code == 200) {
+    ENVOY_LOG(debug, "fetch pubkey [uri = {}]: success", uri);
+    std::string body;
+    if (response->body()) {
+      auto len = response->body()->length();
+      body = std::string(static_cast<char*>(response->body()->linearize(len)),
+                         len);
+    } else {
+      ENVOY_LOG(debug, "fetch pubkey [uri = {}]: body is empty", uri);
+    }
+    Done(issuer_.SetRemoteJwks(
+        body, GetHeader(response->headers(), kETagHeader),
+        GetHeader(response->headers(), kLastModifiedHeader)));
+  } else if (status_code == 304 && issuer_.pubkey()) {
+    ENVOY_LOG(debug, "fetch pubkey [uri = {}]: not modified", uri);
+    issuer_.SetRemoteJwksNotModified();
+    Done(Status::OK);
+  } else {
+    ENVOY_LOG(debug, "fetch pubkey [uri = {}]: response status code {}", uri,
+              status_code);
+    Done(Status::FAILED_FETCH_PUBKEY);
+  }
+}
+
+void PubkeyFetcher::onFailure(AsyncClient::FailureReason) {
+  request_ = nullptr;
+  ENVOY_LOG(debug, "fetch pubkey [uri = {}]: failed",
+            issuer_.jwt_config().remote_jwks().http_uri().uri());
+  Done(Status::FAILED_FETCH_PUBKEY);
+}
+
+void PubkeyFetcher::Done(const Status& status) {
+  ISTIO_TRACEPOINT2(jwks_fetch_done,
+                    issuer_.jwt_config().remote_jwks().http_uri().uri().c_str(),
+                    static_cast<int>(status));
+  in_flight_ = false;
+  const bool refreshing = refreshing_;
+  refreshing_ = false;
+  if (dispatcher_) {
+    const auto now = std::chrono::steady_clock::now();
+    std::chrono::milliseconds delay(kPubkeyFetchRetryMs);
+    if (status == Status::OK) {
+      // Refresh at 90% of the cache duration.
+      refresh_margin_ = std::chrono::duration_cast<std::chrono::milliseconds>(
+                            issuer_.expiration_time() - now) /
+                        10;
+    } else if (issuer_.pubkey() && !issuer_.Expired()) {
+      // The refresh failed, keep the current keys until the retry is done.
+      issuer_.ExtendExpiration(now + 2 * refresh_margin_);
+    }
+    if (issuer_.pubkey() && !issuer_.Expired()) {
+      delay = std::chrono::duration_cast<std::chrono::milliseconds>(
+                  issuer_.expiration_time() - now) -
+              refresh_margin_;
+    }
+    // The keys are refreshed once fetched, and a failed background fetch
+    // without keys is retried.
+    if (status == Status::OK || issuer_.pubkey() || refreshing) {
+      if (!refresh_timer_) {
+        refresh_timer_ =
+            dispatcher_->createTimer([this]() { OnRefreshTimer(); });
+      }
+      refresh_timer_->enableTimer(delay);
+    }
+  }
+  if (status == Status::OK && update_func_) {
+    update_func_(issuer_);
+  }
+
+  // A waiter may start a new fetch once notified.
+  std::list<Waiter*> waiters;
+  waiters.swap(waiters_);
+  for (auto waiter : waiters) {
+    waiter->OnPubkeyFetched(status);
+  }
+}
+
+void PubkeyFetcher::Refresh(Upstream::ClusterManager& cm) {
+  cm_ = &cm;
+  OnRefreshTimer();
+}
+
+void PubkeyFetcher::OnRefreshTimer() {
+  if (in_flight_) {
+    return;
+  }
+  ENVOY_LOG(debug, "fetch pubkey [uri = {}]: refresh",
+            issuer_.jwt_config().remote_jwks().http_uri().uri());
+  refreshing_ = true;
+  Send();
+}
+
+}  // namespace JwtAuth
+}  // namespace Http
+}  // namespace Envoy
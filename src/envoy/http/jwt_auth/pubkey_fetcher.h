@@ -0,0 +1,108 @@
+/* Copyright 2018 Istio Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <functional>
+#include <list>
+
+#include "common/common/logger.h"
+#include "envoy/event/dispatcher.h"
+#include "envoy/http/async_client.h"
+#include "envoy/upstream/cluster_manager.h"
+#include "src/envoy/http/jwt_auth/pubkey_cache.h"
+
+namespace Envoy {
+namespace Http {
+namespace JwtAuth {
+
+// Fetches the remote public keys of an issuer. Concurrent fetches are
+// coalesced: the requests needing the keys while a fetch is in flight wait
+// for it instead of sending their own.
+// With a dispatcher, the fetched keys are refreshed in the background
+// shortly before they expire, so requests don't wait for the fetch. If the
+// refresh fails, the current keys are used a bit longer and the refresh is
+// retried.
+// It is per-thread and stored in the JwtAuthStore.
+class PubkeyFetcher : public Logger::Loggable<Logger::Id::filter>,
+                      public AsyncClient::Callbacks {
+ public:
+  PubkeyFetcher(PubkeyCacheItem& issuer, Event::Dispatcher* dispatcher)
+      : issuer_(issuer), dispatcher_(dispatcher) {}
+  ~PubkeyFetcher();
+
+  // The interface to notify the waiters once the fetch is done.
+  class Waiter {
+   public:
+    virtual ~Waiter() {}
+    // Called with OK once the fetched keys are set in the issuer cache item.
+    virtual void OnPubkeyFetched(const Status& status) PURE;
+  };
+
+  // Add a waiter and start a fetch if none is in flight. The waiter may be
+  // called before this returns.
+  void Fetch(Upstream::ClusterManager& cm, Waiter* waiter);
+
+  // Remove a waiter, the fetch is canceled if no waiter is left.
+  void Cancel(Waiter* waiter);
+
+  // Start a fetch without waiter to fetch the keys in the background. With
+  // a dispatcher, it is retried until it succeeds.
+  void Refresh(Upstream::ClusterManager& cm);
+
+  // Set the function called each time a fetch has set the keys.
+  void set_update_func(std::function<void(const PubkeyCacheItem&)> func) {
+    update_func_ = func;
+  }
+
+ private:
+  // Following two functions are for AyncClient::Callbacks
+  void onSuccess(MessagePtr&& response) override;
+  void onFailure(AsyncClient::FailureReason) override;
+
+  // Send the fetch request.
+  void Send();
+
+  // Notify all the waiters and schedule the next refresh.
+  void Done(const Status& status);
+
+  // Called by the refresh timer.
+  void OnRefreshTimer();
+
+  // The issuer cache item to set the fetched keys.
+  PubkeyCacheItem& issuer_;
+  // The dispatcher to create the refresh timer, nullptr to not refresh.
+  Event::Dispatcher* dispatcher_;
+  // The cluster manager of the last fetch, used to refresh.
+  Upstream::ClusterManager* cm_{};
+  // The refresh timer.
+  Event::TimerPtr refresh_timer_;
+  // How long before the expiration the keys are refreshed.
+  std::chrono::milliseconds refresh_margin_{};
+  // Called each time a fetch has set the keys.
+  std::function<void(const PubkeyCacheItem&)> update_func_;
+  // The waiters of the fetch in flight.
+  std::list<Waiter*> waiters_;
+  // True while a fetch is in flight.
+  bool in_flight_{};
+  // True while the fetch in flight is a background refresh.
+  bool refreshing_{};
+  // The pending remote request so it can be canceled.
+  AsyncClient::Request* request_{};
+};
+
+}  // namespace JwtAuth
+}  // namespace Http
+}  // namespace Envoy
@@ -0,0 +1,122 @@
+/* Copyright 2018 Istio Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "absl/strings/string_view.h"
+
+#include <list>
+#include <string>
+#include <unordered_map>
+
+namespace Envoy {
+namespace Http {
+namespace JwtAuth {
+namespace {
+// The maximum number of verified tokens cached per thread.
+const size_t kTokenCacheSize = 1000;
+}  // namespace
+
+// A verified token, enough to accept the same token again without decoding
+// and verifying it.
+struct VerifiedToken {
+  // The "iss" claim.
+  std::string issuer;
+  // The "exp" claim, in seconds since epoch.
+  int64_t exp;
+  // The version of the issuer pubkeys the token was verified with.
+  uint64_t pubkey_version;
+  // The payload, base64url encoded.
+  std::string payload_base64url;
+};
+
+// A LRU cache of the verified tokens, indexed by the raw token. The whole
+// token is compared on lookup so different tokens never share an entry.
+// It is per-thread, owned by the JwtAuthStore.
+class TokenCache {
+ public:
+  TokenCache(size_t max_size = kTokenCacheSize) : max_size_(max_size) {}
+
+  // Returns the verified token if it is cached and not expired at now, in
+  // seconds since epoch, otherwise nullptr. The returned object is valid
+  // until the next Insert().
+  const VerifiedToken* Lookup(absl::string_view token, int64_t now) {
+    auto it = index_.find(token);
+    if (it == index_.end()) {
+      return nullptr;
+    }
+    if (it->second->second.exp < now) {
+      // The key refers to the entry, it is removed first.
+      auto entry = it->second;
+      index_.erase(it);
+      entries_.erase(entry);
+      return nullptr;
+    }
+    // Move to the front as the most recently used.
+    entries_.splice(entries_.begin(), entries_, it->second);
+    return &it->second->second;
+  }
+
+  // Caches a verified token, evicting the least recently used one if full.
+  void Insert(absl::string_view token, const VerifiedToken& verified) {
+    auto it = index_.find(token);
+    if (it != index_.end()) {
+      it->second->second = verified;
+      entries_.splice(entries_.begin(), entries_, it->second);
+      return;
+    }
+    if (entries_.size() >= max_size_) {
+      index_.erase(entries_.back().first);
+      entries_.pop_back();
+    }
+    entries_.emplace_front(std::string(token), verified);
+    index_.emplace(entries_.front().first, entries_.begin());
+  }
+
+  // Removes all the entries.
+  void Clear() {
+    index_.clear();
+    entries_.clear();
+  }
+
+  size_t size() const { return entries_.size(); }
+
+ private:
+  typedef std::list<std::pair<std::string, VerifiedToken>> EntryList;
+
+  // The maximum number of entries.
+  const size_t max_size_;
+  // The entries, the most recently used first.
+  EntryList entries_;
+  // A hash functor of the tokens, 64 bit FNV-1a.
+  struct TokenHash {
+    size_t operator()(absl::string_view token) const {
+      uint64_t h = 14695981039346656037ULL;
+      for (char c : token) {
+        h = (h ^ static_cast<uint8_t>(c)) * 1099511628211ULL;
+      }
+      return static_cast<size_t>(h);
+    }
+  };
+
+  // The entries indexed by token, referring to the tokens of the entries,
+  // so that a lookup copies nothing.
+  std::unordered_map<absl::string_view, EntryList::iterator, TokenHash>
+      index_;
+};
+
+}  // namespace JwtAuth
+}  // namespace Http
+}  // namespace Envoy
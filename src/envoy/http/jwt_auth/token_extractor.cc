@@ -15,7 +15,8 @@
 
 #include "src/envoy/http/jwt_auth/token_extractor.h"
 #include "common/common/utility.h"
-#include "common/http/utility.h"
+
+#include "absl/strings/string_view.h"
 
 using ::envoy::config::filter::http::jwt_authn::v2alpha::JwtAuthentication;
 
@@ -33,77 +34,155 @@ const std::string kParamAccessToken = "access_token";
 }  // namespace
 
 JwtTokenExtractor::JwtTokenExtractor(const JwtAuthentication& config) {
+  // The locations to set of issuers, ordered by name as they are checked.
+  std::map<std::string, std::set<std::string>> header_maps;
+  std::map<std::string, std::set<std::string>> param_maps;
+  std::set<std::string> authorization_issuers;
   for (const auto& jwt : config.rules()) {
+    issuer_index_.emplace(jwt.issuer(), issuer_index_.size());
     bool use_default = true;
     if (jwt.from_headers_size() > 0) {
       use_default = false;
       for (const auto& header : jwt.from_headers()) {
-        auto& issuers = header_maps_[LowerCaseString(header.name())];
+        auto& issuers = header_maps[LowerCaseString(header.name()).get()];
         issuers.insert(jwt.issuer());
       }
     }
     if (jwt.from_params_size() > 0) {
       use_default = false;
       for (const std::string& param : jwt.from_params()) {
-        auto& issuers = param_maps_[param];
+        auto& issuers = param_maps[param];
         issuers.insert(jwt.issuer());
       }
     }
 
     // If not specified, use default
     if (use_default) {
-      authorization_issuers_.insert(jwt.issuer());
+      authorization_issuers.insert(jwt.issuer());
 
-      auto& param_issuers = param_maps_[kParamAccessToken];
+      auto& param_issuers = param_maps[kParamAccessToken];
       param_issuers.insert(jwt.issuer());
     }
   }
+
+  use_authorization_ = !authorization_issuers.empty();
+  authorization_issuers_ = ToIssuerSet(authorization_issuers);
+  for (const auto& header_it : header_maps) {
+    header_index_.emplace(header_it.first, header_names_.size());
+    header_names_.emplace_back(header_it.first);
+    header_issuers_.push_back(ToIssuerSet(header_it.second));
+  }
+  for (const auto& param_it : param_maps) {
+    param_index_.emplace(param_it.first, param_issuers_.size());
+    param_issuers_.push_back(ToIssuerSet(param_it.second));
+  }
+}
+
+JwtTokenExtractor::IssuerSet JwtTokenExtractor::ToIssuerSet(
+    const std::set<std::string>& issuers) const {
+  IssuerSet issuer_set(issuer_index_.size());
+  for (const std::string& issuer : issuers) {
+    issuer_set[issuer_index_.at(issuer)] = true;
+  }
+  return issuer_set;
 }
 
 void JwtTokenExtractor::Extract(
     const HeaderMap& headers,
     std::vector<std::unique_ptr<JwtTokenExtractor::Token>>* tokens) const {
-  if (!authorization_issuers_.empty()) {
+  Token token;
+  if (ExtractFirst(headers, &token)) {
+    tokens->emplace_back(new Token(token));
+  }
+}
+
+bool JwtTokenExtractor::ExtractFirst(const HeaderMap& headers,
+                                     Token* token) const {
+  if (use_authorization_) {
     const HeaderEntry* entry = headers.Authorization();
     if (entry) {
       // Extract token from header.
       const HeaderString& value = entry->value();
       if (StringUtil::startsWith(value.c_str(), kBearerPrefix, true)) {
-        tokens->emplace_back(new Token(value.c_str() + kBearerPrefix.length(),
-                                       authorization_issuers_, true, nullptr));
+        *token = Token(absl::string_view(value.c_str(), value.size())
+                           .substr(kBearerPrefix.length()),
+                       *this, authorization_issuers_, true, nullptr);
         // Only take the first one.
-        return;
+        return true;
       }
     }
   }
 
-  // Check header first
-  for (const auto& header_it : header_maps_) {
-    const HeaderEntry* entry = headers.get(header_it.first);
-    if (entry) {
-      tokens->emplace_back(
-          new Token(std::string(entry->value().c_str(), entry->value().size()),
-                    header_it.second, false, &header_it.first));
+  // Check header first, in one pass over the headers. If several custom
+  // headers are present, the first one in header_names_ is taken.
+  if (!header_index_.empty()) {
+    struct Context {
+      const std::unordered_map<std::string, size_t>& index;
+      size_t found;
+      const HeaderEntry* entry;
+    };
+    Context ctx{header_index_, header_names_.size(), nullptr};
+    headers.iterate(
+        [](const HeaderEntry& header,
+           void* context) -> HeaderMap::Iterate {
+          Context* ctx = static_cast<Context*>(context);
+          auto it = ctx->index.find(
+              std::string(header.key().c_str(), header.key().size()));
+          if (it != ctx->index.end() && it->second < ctx->found) {
+            ctx->found = it->second;
+            ctx->entry = &header;
+            if (ctx->found == 0) {
+              return HeaderMap::Iterate::Break;
+            }
+          }
+          return HeaderMap::Iterate::Continue;
+        },
+        &ctx);
+    if (ctx.entry) {
+      *token = Token(absl::string_view(ctx.entry->value().c_str(),
+                                       ctx.entry->value().size()),
+                     *this, header_issuers_[ctx.found], false,
+                     &header_names_[ctx.found]);
       // Only take the first one.
-      return;
+      return true;
     }
   }
 
-  if (param_maps_.empty() || headers.Path() == nullptr) {
-    return;
+  if (param_index_.empty() || headers.Path() == nullptr) {
+    return false;
   }
 
-  const auto& params = Utility::parseQueryString(std::string(
-      headers.Path()->value().c_str(), headers.Path()->value().size()));
-  for (const auto& param_it : param_maps_) {
-    const auto& it = params.find(param_it.first);
-    if (it != params.end()) {
-      tokens->emplace_back(
-          new Token(it->second, param_it.second, false, nullptr));
-      // Only take the first one.
-      return;
+  // Look up the parameters in one pass over the query string. Only the first
+  // value of a parameter is used, and if several parameters are present, the
+  // first one in param_issuers_ is taken.
+  absl::string_view path(headers.Path()->value().c_str(),
+                         headers.Path()->value().size());
+  size_t start = path.find('?');
+  if (start == absl::string_view::npos) {
+    return false;
+  }
+  size_t found = param_issuers_.size();
+  absl::string_view found_value;
+  for (++start; start < path.size() && found > 0;) {
+    size_t end = path.find('&', start);
+    if (end == absl::string_view::npos) {
+      end = path.size();
+    }
+    absl::string_view param = path.substr(start, end - start);
+    start = end + 1;
+    size_t equal = param.find('=');
+    auto it = param_index_.find(std::string(param.substr(0, equal)));
+    if (it != param_index_.end() && it->second < found) {
+      found = it->second;
+      found_value = equal == absl::string_view::npos ? absl::string_view()
+                                                     : param.substr(equal + 1);
     }
   }
+  if (found == param_issuers_.size()) {
+    return false;
+  }
+  *token = Token(found_value, *this, param_issuers_[found], false, nullptr);
+  return true;
 }
 
 }  // namespace JwtAuth
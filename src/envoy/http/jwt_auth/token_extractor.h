@@ -15,9 +15,13 @@
 
 #pragma once
 
+#include "absl/strings/string_view.h"
 #include "common/common/logger.h"
 #include "envoy/config/filter/http/jwt_authn/v2alpha/config.pb.h"
 
+#include <unordered_map>
+#include <vector>
+
 namespace Envoy {
 namespace Http {
 namespace JwtAuth {
@@ -38,22 +42,36 @@ class JwtTokenExtractor : public Logger::Loggable<Logger::Id::filter> {
   JwtTokenExtractor(const ::envoy::config::filter::http::jwt_authn::v2alpha::
                         JwtAuthentication& config);
 
+  // The set of issuers allowed at a token location, indexed by the order
+  // of the issuers in the config.
+  typedef std::vector<bool> IssuerSet;
+
   // The object to store extracted token.
   // Based on the location the token is extracted from, it also
   // has the allowed issuers that have specified the location.
+  // The token refers to the header value it is extracted from, it is valid
+  // as long as the headers are not changed.
   class Token {
    public:
-    Token(const std::string& token, const std::set<std::string>& issuers,
-          bool from_authorization, const LowerCaseString* header_name)
+    Token() {}
+    Token(absl::string_view token, const JwtTokenExtractor& extractor,
+          const IssuerSet& issuers, bool from_authorization,
+          const LowerCaseString* header_name)
         : token_(token),
-          allowed_issuers_(issuers),
+          extractor_(&extractor),
+          allowed_issuers_(&issuers),
           from_authorization_(from_authorization),
           header_name_(header_name) {}
 
-    const std::string& token() const { return token_; }
+    absl::string_view token() const { return token_; }
 
     bool IsIssuerAllowed(const std::string& issuer) const {
-      return allowed_issuers_.find(issuer) != allowed_issuers_.end();
+      if (extractor_ == nullptr) {
+        return false;
+      }
+      auto it = extractor_->issuer_index_.find(issuer);
+      return it != extractor_->issuer_index_.end() &&
+             (*allowed_issuers_)[it->second];
     }
 
     // TODO: to remove token from query parameter.
@@ -67,34 +85,49 @@ class JwtTokenExtractor : public Logger::Loggable<Logger::Id::filter> {
 
    private:
     // Extracted token.
-    std::string token_;
+    absl::string_view token_;
+    // The extractor, with the index of the issuers, nullptr if there is no
+    // token.
+    const JwtTokenExtractor* extractor_{};
     // Allowed issuers specified the location the token is extacted from.
-    const std::set<std::string>& allowed_issuers_;
+    const IssuerSet* allowed_issuers_{};
     // True if token is extracted from default Authorization header
-    bool from_authorization_;
+    bool from_authorization_{};
     // Not nullptr if token is extracted from custom header.
-    const LowerCaseString* header_name_;
+    const LowerCaseString* header_name_{};
   };
 
   // Return the extracted JWT tokens.
-  // Only extract one token for now.
+  // Only extract one token for now. The headers are scanned at most once,
+  // and so is the query string.
   void Extract(const HeaderMap& headers,
                std::vector<std::unique_ptr<Token>>* tokens) const;
 
+  // Extracts the first token, from the same locations as Extract(), and
+  // returns false if there is none. The scan stops at the first token,
+  // nothing is allocated for a token in the Authorization header.
+  bool ExtractFirst(const HeaderMap& headers, Token* token) const;
+
  private:
-  struct LowerCaseStringCmp {
-    bool operator()(const LowerCaseString& lhs,
-                    const LowerCaseString& rhs) const {
-      return lhs.get() < rhs.get();
-    }
-  };
-  // The map of header to set of issuers
-  std::map<LowerCaseString, std::set<std::string>, LowerCaseStringCmp>
-      header_maps_;
-  // The map of parameters to set of issuers.
-  std::map<std::string, std::set<std::string>> param_maps_;
+  // Returns the issuers of the issuer names.
+  IssuerSet ToIssuerSet(const std::set<std::string>& issuers) const;
+
+  // The index of each issuer in the config.
+  std::unordered_map<std::string, size_t> issuer_index_;
+  // The custom headers, in the order they are checked.
+  std::vector<LowerCaseString> header_names_;
+  // The issuers of each custom header, in the same order.
+  std::vector<IssuerSet> header_issuers_;
+  // The position of each custom header in header_names_.
+  std::unordered_map<std::string, size_t> header_index_;
+  // The issuers of each parameter, in the order they are checked.
+  std::vector<IssuerSet> param_issuers_;
+  // The position of each parameter in param_issuers_.
+  std::unordered_map<std::string, size_t> param_index_;
   // Special handling of Authorization header.
-  std::set<std::string> authorization_issuers_;
+  IssuerSet authorization_issuers_;
+  // True if any issuer uses the Authorization header.
+  bool use_authorization_{false};
 };
 
 }  // namespace JwtAuth
@@ -179,6 +179,41 @@ TEST_F(JwtTokenExtractorTest, TestMultipleTokens) {
   EXPECT_EQ(tokens[0]->token(), "header_token");
 }
 
+TEST_F(JwtTokenExtractorTest, TestMultipleParamTokens) {
+  auto headers = TestHeaderMapImpl{
+      {":path",
+       "/path?token_param=param_token&access_token=token1"
+       "&access_token=token2"}};
+  std::vector<std::unique_ptr<JwtTokenExtractor::Token>> tokens;
+  extractor_->Extract(headers, &tokens);
+  EXPECT_EQ(tokens.size(), 1);
+
+  // The parameters are checked by name, the first value is taken.
+  EXPECT_EQ(tokens[0]->token(), "token1");
+  EXPECT_TRUE(tokens[0]->IsIssuerAllowed("issuer1"));
+  EXPECT_FALSE(tokens[0]->IsIssuerAllowed("issuer3"));
+}
+
+TEST_F(JwtTokenExtractorTest, TestExtractFirst) {
+  JwtTokenExtractor::Token token;
+  EXPECT_FALSE(extractor_->ExtractFirst(TestHeaderMapImpl{}, &token));
+  EXPECT_FALSE(token.IsIssuerAllowed("issuer1"));
+
+  auto headers = TestHeaderMapImpl{{"Authorization", "Bearer jwt_token"},
+                                   {"token-header", "header_token"}};
+  EXPECT_TRUE(extractor_->ExtractFirst(headers, &token));
+  // The token refers to the header value.
+  EXPECT_EQ(token.token(), "jwt_token");
+  EXPECT_EQ(token.token().data(),
+            headers.Authorization()->value().c_str() + 7);
+  EXPECT_TRUE(token.IsIssuerAllowed("issuer1"));
+  EXPECT_FALSE(token.IsIssuerAllowed("issuer2"));
+
+  token.Remove(&headers);
+  EXPECT_FALSE(headers.Authorization());
+  EXPECT_TRUE(headers.get(LowerCaseString("token-header")));
+}
+
 }  // namespace JwtAuth
 }  // namespace Http
 }  // namespace Envoy
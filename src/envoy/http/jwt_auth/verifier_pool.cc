@@ -0,0 +1,85 @@
+/* Copyright 2018 Istio Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/envoy/http/jwt_auth/verifier_pool.h"
+
+namespace Envoy {
+namespace Http {
+namespace JwtAuth {
+
+VerifierPool::VerifierPool(size_t num_threads) {
+  ENVOY_LOG(info, "JWT signatures are verified by {} threads", num_threads);
+  for (size_t i = 0; i < num_threads; ++i) {
+    threads_.emplace_back([this]() { Run(); });
+  }
+}
+
+VerifierPool::~VerifierPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  cv_.notify_all();
+  for (auto& thread : threads_) {
+    thread.join();
+  }
+}
+
+VerifierPool::RequestSharedPtr VerifierPool::Verify(
+    std::shared_ptr<const Jwt> jwt, std::shared_ptr<const Pubkeys> pubkeys,
+    Event::Dispatcher& dispatcher, DoneFunc done) {
+  RequestSharedPtr request(new Request());
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    queue_.push_back(Job{jwt, pubkeys, &dispatcher, done, request});
+  }
+  cv_.notify_one();
+  return request;
+}
+
+void VerifierPool::Run() {
+  std::vector<Job> batch;
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      cv_.wait(lock, [this]() { return stop_ || !queue_.empty(); });
+      if (stop_) {
+        return;
+      }
+      batch.swap(queue_);
+    }
+
+    for (auto& job : batch) {
+      if (job.request->canceled_) {
+        continue;
+      }
+      Verifier v;
+      Status status =
+          v.Verify(*job.jwt, *job.pubkeys) ? Status::OK : v.GetStatus();
+      RequestSharedPtr request = job.request;
+      DoneFunc done = job.done;
+      job.dispatcher->post([request, done, status]() {
+        if (!request->canceled_) {
+          done(status);
+        }
+      });
+    }
+    batch.clear();
+  }
+}
+
+}  // namespace JwtAuth
+}  // namespace Http
+}  // namespace Envoy
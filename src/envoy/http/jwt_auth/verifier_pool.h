@@ -0,0 +1,93 @@
+/* Copyright 2018 Istio Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "common/common/logger.h"
+#include "envoy/event/dispatcher.h"
+#include "src/envoy/http/jwt_auth/jwt.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace Envoy {
+namespace Http {
+namespace JwtAuth {
+
+// A pool of threads to verify JWT signatures off the worker threads.
+// The verifications queued while all the threads are busy are taken in one
+// batch by the next free thread. The result is posted to the dispatcher of
+// the thread which asked for the verification.
+class VerifierPool : public Logger::Loggable<Logger::Id::filter> {
+ public:
+  // A pending verification. It is only canceled on the thread which asked
+  // for it, the done function is then not called.
+  class Request {
+   public:
+    void Cancel() { canceled_ = true; }
+
+   private:
+    std::atomic<bool> canceled_{false};
+
+    friend class VerifierPool;
+  };
+  typedef std::shared_ptr<Request> RequestSharedPtr;
+
+  // The function called with the verification status.
+  typedef std::function<void(const Status& status)> DoneFunc;
+
+  VerifierPool(size_t num_threads);
+
+  // Stops the threads, the queued verifications are dropped.
+  ~VerifierPool();
+
+  // Verifies the signature of the JWT with the pubkeys on a pool thread, then
+  // posts done to the dispatcher, unless the request is canceled before.
+  RequestSharedPtr Verify(std::shared_ptr<const Jwt> jwt,
+                          std::shared_ptr<const Pubkeys> pubkeys,
+                          Event::Dispatcher& dispatcher, DoneFunc done);
+
+ private:
+  // A queued verification.
+  struct Job {
+    std::shared_ptr<const Jwt> jwt;
+    std::shared_ptr<const Pubkeys> pubkeys;
+    Event::Dispatcher* dispatcher;
+    DoneFunc done;
+    RequestSharedPtr request;
+  };
+
+  // The loop of a pool thread.
+  void Run();
+
+  // Protects the queue and stop_.
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  // The verifications not taken by a thread yet.
+  std::vector<Job> queue_;
+  // True once the pool is being destroyed.
+  bool stop_{false};
+  // The pool threads.
+  std::vector<std::thread> threads_;
+};
+
+}  // namespace JwtAuth
+}  // namespace Http
+}  // namespace Envoy
@@ -0,0 +1,108 @@
+/* Copyright 2018 Istio Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/envoy/http/mixer/bypass_matcher.h"
+
+#include <string.h>
+#include <algorithm>
+#include <sstream>
+
+#include "absl/strings/string_view.h"
+
+namespace Envoy {
+namespace Http {
+namespace Mixer {
+namespace {
+
+// Splits a comma separated list, skipping the empty items.
+std::vector<std::string> SplitList(const std::string& str) {
+  std::vector<std::string> items;
+  std::stringstream stream(str);
+  std::string item;
+  while (std::getline(stream, item, ',')) {
+    if (!item.empty()) {
+      items.push_back(item);
+    }
+  }
+  return items;
+}
+
+// Returns true if the header value starts with any of the prefixes.
+bool StartsWithAny(const HeaderEntry* entry,
+                   const std::vector<std::string>& prefixes) {
+  if (entry == nullptr) {
+    return false;
+  }
+  const HeaderString& value = entry->value();
+  for (const auto& prefix : prefixes) {
+    if (value.size() >= prefix.size() &&
+        memcmp(value.c_str(), prefix.data(), prefix.size()) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+}  // namespace
+
+BypassMatcher::BypassMatcher(const std::string& paths,
+                             const std::string& user_agent_prefixes,
+                             const std::string& source_cidrs)
+    : user_agent_prefixes_(SplitList(user_agent_prefixes)) {
+  for (const auto& path : SplitList(paths)) {
+    if (path[0] == '/' && path.find('?') == std::string::npos) {
+      paths_.push_back(path);
+    }
+  }
+  for (const auto& cidr : SplitList(source_cidrs)) {
+    Network::Address::CidrRange range =
+        Network::Address::CidrRange::create(cidr);
+    if (range.isValid()) {
+      source_ranges_.push_back(range);
+    }
+  }
+}
+
+bool BypassMatcher::Matches(const HeaderMap& headers,
+                            const Network::Connection* connection) const {
+  if (empty() || connection == nullptr || headers.Path() == nullptr) {
+    return false;
+  }
+  // An exact match, "/healthz/../admin" is not "/healthz".
+  const HeaderString& value = headers.Path()->value();
+  absl::string_view path(value.c_str(), value.size());
+  path = path.substr(0, path.find('?'));
+  if (std::find_if(paths_.begin(), paths_.end(),
+                   [path](const std::string& bypass_path) {
+                     return bypass_path == path;
+                   }) == paths_.end()) {
+    return false;
+  }
+  if (!user_agent_prefixes_.empty() &&
+      !StartsWithAny(headers.UserAgent(), user_agent_prefixes_)) {
+    return false;
+  }
+  const auto& address = connection->remoteAddress();
+  for (const auto& range : source_ranges_) {
+    if (range.isInRange(*address)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+}  // namespace Mixer
+}  // namespace Http
+}  // namespace Envoy
@@ -0,0 +1,64 @@
+/* Copyright 2018 Istio Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "common/network/cidr_range.h"
+#include "envoy/http/header_map.h"
+#include "envoy/network/connection.h"
+
+namespace Envoy {
+namespace Http {
+namespace Mixer {
+
+// Matches the requests which skip all Mixer processing, e.g. the health
+// checks and the probes of the load balancers and of Kubernetes. They are
+// neither checked nor reported, and the path and the user agent are set by
+// any client, so a request only matches if all of these hold: it comes
+// from one of the source CIDR ranges, its path without the query is one of
+// the exact paths, and its user agent starts with one of the prefixes, if
+// any is set. The lists are parsed once, a request is matched with the
+// inline headers and the downstream remote address only.
+class BypassMatcher {
+ public:
+  BypassMatcher() {}
+
+  // Parses comma separated lists. Invalid CIDR ranges, and paths not
+  // starting with '/' or with a query, are skipped.
+  BypassMatcher(const std::string& paths,
+                const std::string& user_agent_prefixes,
+                const std::string& source_cidrs);
+
+  // Returns true if no request is bypassed, without paths or source
+  // ranges.
+  bool empty() const { return paths_.empty() || source_ranges_.empty(); }
+
+  // Returns true if the request matches all of the lists. The connection
+  // may be nullptr.
+  bool Matches(const HeaderMap& headers,
+               const Network::Connection* connection) const;
+
+ private:
+  std::vector<std::string> paths_;
+  std::vector<std::string> user_agent_prefixes_;
+  std::vector<Network::Address::CidrRange> source_ranges_;
+};
+
+}  // namespace Mixer
+}  // namespace Http
+}  // namespace Envoy
@@ -0,0 +1,124 @@
+/* Copyright 2018 Istio Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/envoy/http/mixer/bypass_matcher.h"
+#include "common/network/utility.h"
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "test/mocks/network/mocks.h"
+#include "test/test_common/utility.h"
+
+using testing::NiceMock;
+
+namespace Envoy {
+namespace Http {
+namespace Mixer {
+namespace {
+
+class BypassMatcherTest : public ::testing::Test {
+ public:
+  void SetUp() { SetRemoteAddress("10.1.2.3"); }
+
+  void SetRemoteAddress(const std::string& address) {
+    connection_.remote_address_ =
+        Network::Utility::parseInternetAddress(address, 8080);
+  }
+
+  NiceMock<Network::MockConnection> connection_;
+};
+
+TEST_F(BypassMatcherTest, TestEmpty) {
+  EXPECT_TRUE(BypassMatcher().empty());
+  EXPECT_TRUE(BypassMatcher("", "", "").empty());
+  // Neither the path nor the user agent is enough.
+  EXPECT_TRUE(BypassMatcher("/healthz", "kube-probe/", "").empty());
+  EXPECT_TRUE(BypassMatcher("", "kube-probe/", "10.0.0.0/8").empty());
+  EXPECT_FALSE(BypassMatcher("/healthz", "", "10.0.0.0/8").empty());
+
+  TestHeaderMapImpl headers{{":path", "/healthz"},
+                            {"user-agent", "kube-probe/1.10"}};
+  BypassMatcher no_ranges("/healthz", "kube-probe/", "");
+  EXPECT_FALSE(no_ranges.Matches(headers, &connection_));
+}
+
+TEST_F(BypassMatcherTest, TestParse) {
+  // The empty items, the invalid ranges and the invalid paths are skipped.
+  EXPECT_TRUE(
+      BypassMatcher("/healthz", "", ",not-a-cidr,10.0.0.0/33,").empty());
+  EXPECT_TRUE(
+      BypassMatcher("healthz,/ready?full=1,", "", "10.0.0.0/8").empty());
+
+  BypassMatcher matcher(",/healthz,,/ready", "", "not-a-cidr,10.0.0.0/8");
+  EXPECT_FALSE(matcher.empty());
+  TestHeaderMapImpl healthz{{":path", "/healthz"}};
+  TestHeaderMapImpl ready{{":path", "/ready"}};
+  EXPECT_TRUE(matcher.Matches(healthz, &connection_));
+  EXPECT_TRUE(matcher.Matches(ready, &connection_));
+}
+
+TEST_F(BypassMatcherTest, TestExactPath) {
+  BypassMatcher matcher("/healthz", "", "10.0.0.0/8");
+  TestHeaderMapImpl query{{":path", "/healthz?verbose=1"}};
+  EXPECT_TRUE(matcher.Matches(query, &connection_));
+
+  for (const char* path : {"/healthz/../admin", "/healthz/", "/healthzz",
+                           "/he%61lthz", "/", ""}) {
+    TestHeaderMapImpl headers{{":path", path}};
+    EXPECT_FALSE(matcher.Matches(headers, &connection_)) << path;
+  }
+  TestHeaderMapImpl no_path{{"user-agent", "kube-probe/1.10"}};
+  EXPECT_FALSE(matcher.Matches(no_path, &connection_));
+}
+
+TEST_F(BypassMatcherTest, TestUserAgentPrefix) {
+  BypassMatcher matcher("/healthz", "kube-probe/,ELB-HealthChecker",
+                        "10.0.0.0/8");
+  TestHeaderMapImpl kube{{":path", "/healthz"},
+                         {"user-agent", "kube-probe/1.10"}};
+  TestHeaderMapImpl elb{{":path", "/healthz"},
+                        {"user-agent", "ELB-HealthChecker/2.0"}};
+  TestHeaderMapImpl curl{{":path", "/healthz"}, {"user-agent", "curl/7.58"}};
+  TestHeaderMapImpl short_agent{{":path", "/healthz"},
+                                {"user-agent", "kube"}};
+  TestHeaderMapImpl no_agent{{":path", "/healthz"}};
+  EXPECT_TRUE(matcher.Matches(kube, &connection_));
+  EXPECT_TRUE(matcher.Matches(elb, &connection_));
+  EXPECT_FALSE(matcher.Matches(curl, &connection_));
+  EXPECT_FALSE(matcher.Matches(short_agent, &connection_));
+  EXPECT_FALSE(matcher.Matches(no_agent, &connection_));
+}
+
+TEST_F(BypassMatcherTest, TestAllCriteria) {
+  BypassMatcher matcher("/healthz", "kube-probe/", "10.0.0.0/8,fd00::/8");
+  TestHeaderMapImpl probe{{":path", "/healthz"},
+                          {"user-agent", "kube-probe/1.10"}};
+  TestHeaderMapImpl other_path{{":path", "/admin"},
+                               {"user-agent", "kube-probe/1.10"}};
+  EXPECT_TRUE(matcher.Matches(probe, &connection_));
+  EXPECT_FALSE(matcher.Matches(other_path, &connection_));
+
+  SetRemoteAddress("fd00::1");
+  EXPECT_TRUE(matcher.Matches(probe, &connection_));
+
+  // The right path and user agent from another source.
+  SetRemoteAddress("192.168.1.1");
+  EXPECT_FALSE(matcher.Matches(probe, &connection_));
+  EXPECT_FALSE(matcher.Matches(probe, nullptr));
+}
+
+}  // namespace
+}  // namespace Mixer
+}  // namespace Http
+}  // namespace Envoy
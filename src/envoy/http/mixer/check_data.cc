@@ -14,9 +14,9 @@
  */
 
 #include "src/envoy/http/mixer/check_data.h"
-#include "common/common/base64.h"
-#include "src/envoy/http/jwt_auth/jwt.h"
+#include "include/istio/utils/base64.h"
 #include "src/envoy/http/jwt_auth/jwt_authenticator.h"
+#include "src/envoy/http/jwt_auth/jwt_payload_cache.h"
 #include "src/envoy/utils/authn.h"
 #include "src/envoy/utils/utils.h"
 
@@ -29,23 +29,57 @@ namespace {
 // The HTTP header to forward Istio attributes.
 const LowerCaseString kIstioAttributeHeader("x-istio-attributes");
 
-// Referer header
-const LowerCaseString kRefererHeaderKey("referer");
+// The cookie header, there may be several of them.
+const LowerCaseString kCookieHeader("cookie");
 
 // Set of headers excluded from request.headers attribute.
 const std::set<std::string> RequestHeaderExclusives = {
     kIstioAttributeHeader.get(),
 };
 
+// The header names of the CheckData created without them.
+const HeaderNames& DefaultHeaderNames() {
+  static const HeaderNames* names = new HeaderNames;
+  return *names;
+}
+
 }  // namespace
 
 CheckData::CheckData(const HeaderMap& headers,
-                     const Network::Connection* connection)
-    : headers_(headers), connection_(connection) {
-  if (headers_.Path()) {
-    query_params_ = Utility::parseQueryString(std::string(
-        headers_.Path()->value().c_str(), headers_.Path()->value().size()));
+                     const Network::Connection* connection,
+                     const Utils::HeaderFilter* header_filter,
+                     const ConnectionAttributes* connection_attributes,
+                     const HeaderNames* header_names)
+    : headers_(headers),
+      connection_(connection),
+      header_filter_(header_filter),
+      connection_attributes_(connection_attributes),
+      header_names_(header_names ? *header_names : DefaultHeaderNames()),
+      query_params_parsed_(false),
+      cookies_parsed_(false) {}
+
+const HeaderEntry* CheckData::FindRegisteredHeader(size_t index) const {
+  if (registered_headers_.empty()) {
+    registered_headers_.resize(header_names_.size(), nullptr);
+    struct Context {
+      const HeaderNames& names;
+      std::vector<const HeaderEntry*>& found;
+    };
+    Context ctx{header_names_, registered_headers_};
+    headers_.iterate(
+        [](const HeaderEntry& header, void* context) -> HeaderMap::Iterate {
+          Context* ctx = static_cast<Context*>(context);
+          size_t index = ctx->names.Find(
+              absl::string_view(header.key().c_str(), header.key().size()));
+          // The first header of a name is used, like HeaderMap::get().
+          if (index != HeaderNames::npos && !ctx->found[index]) {
+            ctx->found[index] = &header;
+          }
+          return HeaderMap::Iterate::Continue;
+        },
+        &ctx);
   }
+  return registered_headers_[index];
 }
 
 const LowerCaseString& CheckData::IstioAttributeHeader() {
@@ -54,16 +88,25 @@ const LowerCaseString& CheckData::IstioAttributeHeader() {
 
 bool CheckData::ExtractIstioAttributes(std::string* data) const {
   // Extract attributes from x-istio-attributes header
-  const HeaderEntry* entry = headers_.get(kIstioAttributeHeader);
+  const HeaderEntry* entry =
+      FindRegisteredHeader(HeaderNames::ISTIO_ATTRIBUTES);
   if (entry) {
-    *data = Base64::decode(
-        std::string(entry->value().c_str(), entry->value().size()));
+    // It is read once, then removed by HeaderUpdate.
+    registered_headers_[HeaderNames::ISTIO_ATTRIBUTES] = nullptr;
+    ::istio::utils::Base64Decode(
+        absl::string_view(entry->value().c_str(), entry->value().size()),
+        data);
     return true;
   }
   return false;
 }
 
 bool CheckData::GetSourceIpPort(std::string* ip, int* port) const {
+  if (connection_attributes_) {
+    *ip = connection_attributes_->source_ip;
+    *port = connection_attributes_->source_port;
+    return connection_attributes_->has_source_ip;
+  }
   if (connection_) {
     return Utils::GetIpPort(connection_->remoteAddress()->ip(), ip, port);
   }
@@ -71,6 +114,10 @@ bool CheckData::GetSourceIpPort(std::string* ip, int* port) const {
 }
 
 bool CheckData::GetSourceUser(std::string* user) const {
+  if (connection_attributes_) {
+    *user = connection_attributes_->source_user;
+    return connection_attributes_->has_source_user;
+  }
   return Utils::GetSourceUser(connection_, user);
 }
 
@@ -78,7 +125,20 @@ std::map<std::string, std::string> CheckData::GetRequestHeaders() const {
   return Utils::ExtractHeaders(headers_, RequestHeaderExclusives);
 }
 
-bool CheckData::IsMutualTLS() const { return Utils::IsMutualTLS(connection_); }
+void CheckData::AddRequestHeaders(
+    ::google::protobuf::Map<std::string, std::string>* headers) const {
+  Utils::ExtractHeaders(headers_, header_filter_, headers);
+  for (const auto& name : RequestHeaderExclusives) {
+    headers->erase(name);
+  }
+}
+
+bool CheckData::IsMutualTLS() const {
+  if (connection_attributes_) {
+    return connection_attributes_->mutual_tls;
+  }
+  return Utils::IsMutualTLS(connection_);
+}
 
 bool CheckData::FindHeaderByType(HttpCheckData::HeaderType header_type,
                                  std::string* value) const {
@@ -119,7 +179,8 @@ bool CheckData::FindHeaderByType(HttpCheckData::HeaderType header_type,
       }
       break;
     case HttpCheckData::HEADER_REFERER: {
-      const HeaderEntry* referer = headers_.get(kRefererHeaderKey);
+      const HeaderEntry* referer =
+          FindRegisteredHeader(HeaderNames::REFERER);
       if (referer) {
         *value = std::string(referer->value().c_str(), referer->value().size());
         return true;
@@ -131,7 +192,11 @@ bool CheckData::FindHeaderByType(HttpCheckData::HeaderType header_type,
 
 bool CheckData::FindHeaderByName(const std::string& name,
                                  std::string* value) const {
-  const HeaderEntry* entry = headers_.get(LowerCaseString(name));
+  // The name is lower case, a registered one is found without a copy.
+  size_t index = header_names_.Find(name);
+  const HeaderEntry* entry = index != HeaderNames::npos
+                                 ? FindRegisteredHeader(index)
+                                 : headers_.get(LowerCaseString(name));
   if (entry) {
     *value = std::string(entry->value().c_str(), entry->value().size());
     return true;
@@ -139,61 +204,134 @@ bool CheckData::FindHeaderByName(const std::string& name,
   return false;
 }
 
+void CheckData::ParseQueryParameters() const {
+  query_params_parsed_ = true;
+  if (!headers_.Path()) {
+    return;
+  }
+  // The same as Utility::parseQueryString, without copying the path.
+  absl::string_view path(headers_.Path()->value().c_str(),
+                         headers_.Path()->value().size());
+  size_t start = path.find('?');
+  if (start == absl::string_view::npos) {
+    return;
+  }
+  ++start;
+  while (start < path.size()) {
+    size_t end = path.find('&', start);
+    if (end == absl::string_view::npos) {
+      end = path.size();
+    }
+    absl::string_view param = path.substr(start, end - start);
+    size_t equal = param.find('=');
+    if (equal != absl::string_view::npos) {
+      query_params_.emplace_back(param.substr(0, equal),
+                                 param.substr(equal + 1));
+    } else {
+      query_params_.emplace_back(param, absl::string_view());
+    }
+    start = end + 1;
+  }
+}
+
 bool CheckData::FindQueryParameter(const std::string& name,
                                    std::string* value) const {
-  const auto& it = query_params_.find(name);
-  if (it != query_params_.end()) {
-    *value = it->second;
-    return true;
+  if (!query_params_parsed_) {
+    ParseQueryParameters();
+  }
+  // The first parameter of a name is used.
+  for (const auto& param : query_params_) {
+    if (param.first == name) {
+      *value = std::string(param.second);
+      return true;
+    }
   }
   return false;
 }
 
+void CheckData::ParseCookies() const {
+  cookies_parsed_ = true;
+  // The same as Utility::parseCookieValue, for all the cookies at once.
+  headers_.iterate(
+      [](const HeaderEntry& header, void* context) -> HeaderMap::Iterate {
+        if (absl::string_view(header.key().c_str(), header.key().size()) !=
+            kCookieHeader.get()) {
+          return HeaderMap::Iterate::Continue;
+        }
+        auto* cookies = static_cast<
+            std::vector<std::pair<absl::string_view, absl::string_view>>*>(
+            context);
+        absl::string_view value(header.value().c_str(), header.value().size());
+        size_t start = 0;
+        while (start < value.size()) {
+          size_t end = value.find(';', start);
+          if (end == absl::string_view::npos) {
+            end = value.size();
+          }
+          absl::string_view cookie = value.substr(start, end - start);
+          start = end + 1;
+          size_t first = cookie.find_first_not_of(' ');
+          size_t equal = cookie.find('=');
+          // A cookie without "=" is malformed.
+          if (first == absl::string_view::npos ||
+              equal == absl::string_view::npos) {
+            continue;
+          }
+          absl::string_view cookie_value = cookie.substr(equal + 1);
+          // Cookie values may be wrapped in double quotes.
+          if (cookie_value.size() >= 2 && cookie_value.front() == '"' &&
+              cookie_value.back() == '"') {
+            cookie_value = cookie_value.substr(1, cookie_value.size() - 2);
+          }
+          cookies->emplace_back(cookie.substr(first, equal - first),
+                                cookie_value);
+        }
+        return HeaderMap::Iterate::Continue;
+      },
+      &cookies_);
+}
+
 bool CheckData::FindCookie(const std::string& name, std::string* value) const {
-  std::string cookie = Utility::parseCookieValue(headers_, name);
-  if (cookie != "") {
-    *value = cookie;
-    return true;
+  if (!cookies_parsed_) {
+    ParseCookies();
+  }
+  // The first cookie of a name is used, an empty one is not found.
+  for (const auto& cookie : cookies_) {
+    if (cookie.first == name) {
+      if (cookie.second.empty()) {
+        return false;
+      }
+      *value = std::string(cookie.second);
+      return true;
+    }
   }
   return false;
 }
 
 bool CheckData::GetJWTPayload(
     std::map<std::string, std::string>* payload) const {
-  const HeaderEntry* entry =
-      headers_.get(JwtAuth::JwtAuthenticator::JwtPayloadKey());
+  const HeaderEntry* entry = FindRegisteredHeader(HeaderNames::JWT_PAYLOAD);
   if (!entry) {
     return false;
   }
-  std::string value(entry->value().c_str(), entry->value().size());
-  std::string payload_str = JwtAuth::Base64UrlDecode(value);
-  // Return an empty string if Base64 decode fails.
-  if (payload_str.empty()) {
-    ENVOY_LOG(error, "Invalid {} header, invalid base64: {}",
-              JwtAuth::JwtAuthenticator::JwtPayloadKey().get(), value);
-    return false;
-  }
-  try {
-    auto json_obj = Json::Factory::loadFromString(payload_str);
-    json_obj->iterate(
-        [payload](const std::string& key, const Json::Object& obj) -> bool {
-          // will throw execption if value type is not string.
-          try {
-            (*payload)[key] = obj.asString();
-          } catch (...) {
-          }
-          return true;
-        });
-  } catch (...) {
-    ENVOY_LOG(error, "Invalid {} header, invalid json: {}",
-              JwtAuth::JwtAuthenticator::JwtPayloadKey().get(), payload_str);
+  absl::string_view value(entry->value().c_str(), entry->value().size());
+  auto decoded = JwtAuth::DecodeJwtPayload(value);
+  if (!decoded) {
+    ENVOY_LOG(error, "Invalid {} header: {}",
+              JwtAuth::JwtAuthenticator::JwtPayloadKey().get(),
+              std::string(value));
     return false;
   }
+  *payload = decoded->claims;
   return true;
 }
 
 bool CheckData::GetAuthenticationResult(istio::authn::Result* result) const {
-  return Utils::Authentication::FetchResultFromHeader(headers_, result);
+  return Utils::Authentication::FetchResult(headers_, result);
+}
+
+const istio::authn::Result* CheckData::FindAuthenticationResult() const {
+  return Utils::Authentication::FindResultInStream(headers_);
 }
 
 }  // namespace Mixer
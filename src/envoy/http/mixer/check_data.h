@@ -15,10 +15,17 @@
 
 #pragma once
 
+#include <utility>
+#include <vector>
+
+#include "absl/strings/string_view.h"
 #include "common/common/logger.h"
 #include "common/http/utility.h"
 #include "envoy/http/header_map.h"
 #include "include/istio/control/http/controller.h"
+#include "src/envoy/http/mixer/connection_attributes.h"
+#include "src/envoy/http/mixer/header_names.h"
+#include "src/envoy/utils/utils.h"
 #include "src/istio/authn/context.pb.h"
 
 namespace Envoy {
@@ -28,7 +35,15 @@ namespace Mixer {
 class CheckData : public ::istio::control::http::CheckData,
                   public Logger::Loggable<Logger::Id::filter> {
  public:
-  CheckData(const HeaderMap& headers, const Network::Connection* connection);
+  // If header_filter is not nullptr, it selects the headers added by
+  // AddRequestHeaders(). If connection_attributes is not nullptr, the
+  // connection attributes are read from it instead of the connection. The
+  // headers of header_names, or of the default ones if nullptr, are found
+  // in one pass.
+  CheckData(const HeaderMap& headers, const Network::Connection* connection,
+            const Utils::HeaderFilter* header_filter = nullptr,
+            const ConnectionAttributes* connection_attributes = nullptr,
+            const HeaderNames* header_names = nullptr);
 
   // Find "x-istio-attributes" headers, if found base64 decode
   // its value and remove it from the headers.
@@ -40,6 +55,9 @@ class CheckData : public ::istio::control::http::CheckData,
 
   std::map<std::string, std::string> GetRequestHeaders() const override;
 
+  void AddRequestHeaders(::google::protobuf::Map<std::string, std::string>*
+                             headers) const override;
+
   bool IsMutualTLS() const override;
 
   bool FindHeaderByType(
@@ -59,12 +77,39 @@ class CheckData : public ::istio::control::http::CheckData,
 
   bool GetAuthenticationResult(istio::authn::Result* result) const override;
 
+  const istio::authn::Result* FindAuthenticationResult() const override;
+
   static const LowerCaseString& IstioAttributeHeader();
 
  private:
+  // Parses the query parameters of the path on the first lookup.
+  void ParseQueryParameters() const;
+
+  // Parses the cookies of the cookie headers on the first lookup.
+  void ParseCookies() const;
+
+  // Finds the header registered at index, finding all the registered
+  // headers on the first lookup.
+  const HeaderEntry* FindRegisteredHeader(size_t index) const;
+
   const HeaderMap& headers_;
   const Network::Connection* connection_;
-  Utility::QueryParams query_params_;
+  const Utils::HeaderFilter* header_filter_;
+  const ConnectionAttributes* connection_attributes_;
+  const HeaderNames& header_names_;
+  // The first header of each registered name, nullptr if absent, filled on
+  // the first lookup. The headers are not removed while they are used.
+  mutable std::vector<const HeaderEntry*> registered_headers_;
+  // The query parameters in the order of the path, pointing into the path
+  // header value.
+  mutable bool query_params_parsed_;
+  mutable std::vector<std::pair<absl::string_view, absl::string_view>>
+      query_params_;
+  // The cookies in the order of the headers, pointing into the cookie
+  // header values.
+  mutable bool cookies_parsed_;
+  mutable std::vector<std::pair<absl::string_view, absl::string_view>>
+      cookies_;
 };
 
 }  // namespace Mixer
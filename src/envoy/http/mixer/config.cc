@@ -24,6 +24,7 @@ Config::Config(
     const ::istio::mixer::v1::config::client::HttpClientConfig& config_pb)
     : config_pb_(config_pb) {
   Utils::SetDefaultMixerClusters(config_pb_.mutable_transport());
+  header_names_.AddApiKeyHeaders(config_pb_);
 }
 
 }  // namespace Mixer
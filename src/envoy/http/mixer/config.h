@@ -16,6 +16,7 @@
 #pragma once
 
 #include "mixer/v1/config/client/client_config.pb.h"
+#include "src/envoy/http/mixer/header_names.h"
 
 namespace Envoy {
 namespace Http {
@@ -41,9 +42,14 @@ class Config {
     return config_pb_.transport().report_cluster();
   }
 
+  // The request headers found in one pass, with the api key headers of
+  // the config.
+  const HeaderNames& header_names() const { return header_names_; }
+
  private:
   // The Http client config.
   ::istio::mixer::v1::config::client::HttpClientConfig config_pb_;
+  HeaderNames header_names_;
 };
 
 }  // namespace Mixer
@@ -0,0 +1,48 @@
+/* Copyright 2018 Istio Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/envoy/http/mixer/connection_attributes.h"
+#include "src/envoy/utils/utils.h"
+
+namespace Envoy {
+namespace Http {
+namespace Mixer {
+
+std::shared_ptr<const ConnectionAttributes> ConnectionAttributesCache::Get(
+    const Network::Connection& connection) {
+  {
+    LRUCache::ScopedLookup lookup(&cache_, connection.id());
+    if (lookup.Found()) {
+      return lookup.value()->attributes;
+    }
+  }
+
+  auto attributes = std::make_shared<ConnectionAttributes>();
+  attributes->has_source_ip =
+      Utils::GetIpPort(connection.remoteAddress()->ip(),
+                       &attributes->source_ip, &attributes->source_port);
+  attributes->has_source_user =
+      Utils::GetSourceUser(&connection, &attributes->source_user);
+  attributes->mutual_tls = Utils::IsMutualTLS(&connection);
+
+  CacheElem* cache_elem = new CacheElem;
+  cache_elem->attributes = attributes;
+  cache_.Insert(connection.id(), cache_elem, 1);
+  return attributes;
+}
+
+}  // namespace Mixer
+}  // namespace Http
+}  // namespace Envoy
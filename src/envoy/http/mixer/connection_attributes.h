@@ -0,0 +1,65 @@
+/* Copyright 2018 Istio Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <memory>
+#include <string>
+
+#include "envoy/network/connection.h"
+#include "include/istio/utils/simple_lru_cache.h"
+#include "include/istio/utils/simple_lru_cache_inl.h"
+
+namespace Envoy {
+namespace Http {
+namespace Mixer {
+
+// The attributes of a downstream connection, the same for all its streams.
+struct ConnectionAttributes {
+  // The source IP in binary, and the source port.
+  bool has_source_ip = false;
+  std::string source_ip;
+  int source_port = 0;
+  // The source user from the peer certificate.
+  bool has_source_user = false;
+  std::string source_user;
+  // True if the connection is mutual TLS.
+  bool mutual_tls = false;
+};
+
+// The attributes of the recent downstream connections of a worker thread,
+// so the streams of a HTTP/2 connection extract them once. Connection ids
+// are never reused, so the entry of a closed connection is not looked up
+// again and it is evicted as the least recently used.
+class ConnectionAttributesCache {
+ public:
+  ConnectionAttributesCache(int cache_size) : cache_(cache_size) {}
+  ~ConnectionAttributesCache() { cache_.RemoveAll(); }
+
+  // Returns the attributes of a connection, extracted by its first stream.
+  std::shared_ptr<const ConnectionAttributes> Get(
+      const Network::Connection& connection);
+
+ private:
+  struct CacheElem {
+    std::shared_ptr<const ConnectionAttributes> attributes;
+  };
+  using LRUCache = ::istio::utils::SimpleLRUCache<uint64_t, CacheElem>;
+  LRUCache cache_;
+};
+
+}  // namespace Mixer
+}  // namespace Http
+}  // namespace Envoy
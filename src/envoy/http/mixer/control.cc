@@ -15,35 +15,299 @@
 
 #include "src/envoy/http/mixer/control.h"
 
+#include "common/memory/stats.h"
+#include "google/protobuf/io/coded_stream.h"
+#include "google/protobuf/io/zero_copy_stream_impl_lite.h"
+#include "include/istio/utils/fast_hash.h"
+
+#include <algorithm>
+
 namespace Envoy {
 namespace Http {
 namespace Mixer {
+namespace {
+
+// The number of recent downstream connections whose attributes are kept.
+const int kConnectionAttributesCacheSize = 1000;
+
+// The stats prefix of the destination services, followed by their names.
+const std::string kServiceStatsPrefix("http_mixer_filter.service.");
+
+// The interval to check the heap size against overload_memory_bytes.
+const int kOverloadCheckIntervalMs = 1000;
+
+// The interval to poll the drain decision of the listener.
+const int kDrainCheckIntervalMs = 1000;
+
+// The interval to re-read the request options from runtime.
+const int kRuntimeRefreshIntervalMs = 1000;
+
+// The runtime key for the deadline of Check calls to Mixer in milliseconds,
+// the gRPC transport default if not set.
+const std::string kCheckTimeoutRuntimeKey("mixer.check_timeout_ms");
+
+// The runtime key to send a hash key of the destination service with Check
+// calls to Mixer.
+const std::string kCheckHashKeyRuntimeKey("mixer.check_hash_key");
+
+// The runtime keys of comma separated header names. If an allowlist is set,
+// only its headers are sent in request.headers or response.headers, the
+// headers of a denylist are never sent.
+const std::string kRequestHeadersAllowlistRuntimeKey(
+    "mixer.request_headers_allowlist");
+const std::string kRequestHeadersDenylistRuntimeKey(
+    "mixer.request_headers_denylist");
+const std::string kResponseHeadersAllowlistRuntimeKey(
+    "mixer.response_headers_allowlist");
+const std::string kResponseHeadersDenylistRuntimeKey(
+    "mixer.response_headers_denylist");
+
+// The runtime keys for the maximum length of the header values sent in
+// request.headers or response.headers, the longer ones are truncated. Not
+// limited if not set.
+const std::string kRequestHeaderMaxLengthRuntimeKey(
+    "mixer.request_header_max_length");
+const std::string kResponseHeaderMaxLengthRuntimeKey(
+    "mixer.response_header_max_length");
+
+// The runtime key to report the requests rejected by other filters before
+// the Mixer filter runs with a small set of attributes, instead of a full
+// report built from the route config.
+const std::string kRejectionReportRuntimeKey("mixer.rejection_report");
+
+// The runtime keys for the requests which skip all Mixer processing, e.g.
+// health checks and probes: comma separated exact paths, user agent
+// prefixes and source CIDR ranges. A request is bypassed only if it
+// matches all of them, the user agents are optional. They are not checked
+// nor reported, only counted. None is bypassed without paths and source
+// ranges.
+const std::string kBypassPathsRuntimeKey("mixer.bypass_paths");
+const std::string kBypassUserAgentsRuntimeKey("mixer.bypass_user_agents");
+const std::string kBypassSourceCidrsRuntimeKey("mixer.bypass_source_cidrs");
+
+// Returns the suffix of the files of a per-thread client: the hash of the
+// filter config, the same in the next process unlike its address, and
+// the client index.
+std::string ClientFileSuffix(
+    const ::istio::mixer::v1::config::client::HttpClientConfig& config,
+    int client_index) {
+  // The maps of the config are serialized in the same order every time.
+  std::string data;
+  {
+    ::google::protobuf::io::StringOutputStream stream(&data);
+    ::google::protobuf::io::CodedOutputStream output(&stream);
+    output.SetSerializationDeterministic(true);
+    config.SerializeToCodedStream(&output);
+  }
+  return ".http." +
+         ::istio::utils::FastHash::DebugString(
+             ::istio::utils::FastHash()(data.data(), data.size())) +
+         "." + std::to_string(client_index);
+}
+
+}  // namespace
+
+void ReadRequestRuntimeOptions(const Runtime::Snapshot& snapshot,
+                               RuntimeOptions* options) {
+  options->check_timeout_ms = snapshot.getInteger(kCheckTimeoutRuntimeKey, 0);
+  options->check_hash_key =
+      snapshot.getInteger(kCheckHashKeyRuntimeKey, 0) != 0;
+  Utils::HeaderFilter request_headers;
+  Utils::ParseHeaderNames(snapshot.get(kRequestHeadersAllowlistRuntimeKey),
+                          &request_headers.allowed);
+  Utils::ParseHeaderNames(snapshot.get(kRequestHeadersDenylistRuntimeKey),
+                          &request_headers.denied);
+  request_headers.max_value_length =
+      snapshot.getInteger(kRequestHeaderMaxLengthRuntimeKey, 0);
+  options->request_headers = std::move(request_headers);
+  Utils::HeaderFilter response_headers;
+  Utils::ParseHeaderNames(snapshot.get(kResponseHeadersAllowlistRuntimeKey),
+                          &response_headers.allowed);
+  Utils::ParseHeaderNames(snapshot.get(kResponseHeadersDenylistRuntimeKey),
+                          &response_headers.denied);
+  response_headers.max_value_length =
+      snapshot.getInteger(kResponseHeaderMaxLengthRuntimeKey, 0);
+  options->response_headers = std::move(response_headers);
+  options->rejection_report =
+      snapshot.getInteger(kRejectionReportRuntimeKey, 0) != 0;
+  options->bypass = BypassMatcher(snapshot.get(kBypassPathsRuntimeKey),
+                                  snapshot.get(kBypassUserAgentsRuntimeKey),
+                                  snapshot.get(kBypassSourceCidrsRuntimeKey));
+}
 
 Control::Control(const Config& config, Upstream::ClusterManager& cm,
                  Event::Dispatcher& dispatcher,
-                 Runtime::RandomGenerator& random, Stats::Scope& scope,
-                 Utils::MixerFilterStats& stats)
+                 Runtime::RandomGenerator& random, Runtime::Loader& runtime,
+                 Stats::Scope& scope, Utils::MixerFilterStats& stats,
+                 std::shared_ptr<::istio::mixerclient::CheckCache>
+                     shared_check_cache,
+                 std::shared_ptr<::istio::mixerclient::QuotaCache>
+                     shared_quota_cache,
+                 const RuntimeOptions& runtime_options,
+                 RouteConfigCache& route_config_cache,
+                 Network::DrainDecision& drain_decision, int client_index)
     : config_(config),
+      runtime_(runtime),
+      runtime_options_(runtime_options),
+      stats_(stats),
+      route_config_cache_(route_config_cache),
+      connection_attributes_cache_(kConnectionAttributesCacheSize),
+      drain_decision_(drain_decision),
       check_client_factory_(Utils::GrpcClientFactoryForCluster(
           config_.check_cluster(), cm, scope)),
       report_client_factory_(Utils::GrpcClientFactoryForCluster(
           config_.report_cluster(), cm, scope)),
+      check_client_(check_client_factory_->create()),
+      report_client_(config_.report_cluster() == config_.check_cluster()
+                         ? nullptr
+                         : report_client_factory_->create()),
       stats_obj_(dispatcher, stats,
                  config_.config_pb().transport().stats_update_interval(),
                  [this](::istio::mixerclient::Statistics* stat) -> bool {
                    return GetStats(stat);
                  }) {
+  stats_obj_.PublishTo(Utils::MixerStatsRegistry::Get(), "http");
   ::istio::control::http::Controller::Options options(config_.config_pb());
+  options.shared_check_cache = shared_check_cache;
+  options.shared_quota_cache = shared_quota_cache;
+  if (runtime_options_.max_service_stats > 0) {
+    options.max_service_stats = runtime_options_.max_service_stats;
+    stats_obj_.EnableServiceStats(scope, kServiceStatsPrefix);
+  }
+  if (runtime_options_.rejection_report) {
+    options.rejection_report_attributes =
+        runtime_options_.rejection_report_attributes;
+    options.rejection_aggregate_window_ms =
+        runtime_options_.rejection_aggregate_window_ms;
+  }
+  std::string file_suffix = ClientFileSuffix(config_.config_pb(), client_index);
+  if (!runtime_options_.report_spill_file.empty()) {
+    options.report_spill_file =
+        runtime_options_.report_spill_file + file_suffix;
+  }
+  options.report_max_value_bytes = runtime_options_.report_max_value_bytes;
+  options.global_words_extension = runtime_options_.global_words_extension;
+  options.report_target_calls_per_second =
+      runtime_options_.report_target_calls_per_second;
+  options.report_target_batch_bytes =
+      runtime_options_.report_target_batch_bytes;
+  options.cache_budget = runtime_options_.cache_budget;
+  options.client_tuning = runtime_options_.client_tuning;
+  if (!runtime_options_.report_spill_ring_file.empty()) {
+    options.client_tuning.spill_ring_file =
+        runtime_options_.report_spill_ring_file + file_suffix;
+  }
 
-  Utils::CreateEnvironment(dispatcher, random, *check_client_factory_,
-                           *report_client_factory_, &options.env);
+  Utils::CreateEnvironment(dispatcher, random, *check_client_,
+                           report_client_ ? *report_client_ : *check_client_,
+                           &options.env);
+  if (runtime_options_.compress_report) {
+    options.env.report_transport = Utils::CompressedReportTransport::GetFunc(
+        cm, config_.report_cluster());
+  }
+  for (const auto& cluster : runtime_options_.report_channel_clusters) {
+    Utils::ReportTransport::Func transport;
+    if (runtime_options_.compress_report) {
+      transport = Utils::CompressedReportTransport::GetFunc(cm, cluster);
+    } else {
+      channel_client_factories_.push_back(
+          Utils::GrpcClientFactoryForCluster(cluster, cm, scope));
+      channel_clients_.push_back(channel_client_factories_.back()->create());
+      transport = Utils::ReportTransport::GetFunc(*channel_clients_.back());
+    }
+    options.env.extra_report_transports.push_back(
+        Utils::RecordReportStats(transport, stats_));
+  }
+  options.env.stats_sink = std::make_shared<Utils::MixerStatsSink>(stats_);
+  options.env.traffic_capture = runtime_options_.traffic_capture;
+  options.env.check_transport =
+      Utils::RecordCheckStats(options.env.check_transport, stats_);
+  options.env.report_transport =
+      Utils::RecordReportStats(options.env.report_transport, stats_);
+  // The batches spread over more report channels are not shared.
+  if (runtime_options_.shared_report_batch &&
+      runtime_options_.report_channel_clusters.empty()) {
+    // The batch shared by the filters of the thread has its own files.
+    ::istio::control::http::Controller::Options shared_options(options);
+    std::string shared_suffix = ".http.shared." + std::to_string(client_index);
+    if (!runtime_options_.report_spill_file.empty()) {
+      shared_options.report_spill_file =
+          runtime_options_.report_spill_file + shared_suffix;
+    }
+    if (!runtime_options_.report_spill_ring_file.empty()) {
+      shared_options.client_tuning.spill_ring_file =
+          runtime_options_.report_spill_ring_file + shared_suffix;
+    }
+    options.shared_report_batch = Utils::GetSharedReportBatch(
+        config_.report_cluster(), runtime_options_.compress_report,
+        ::istio::control::http::Controller::SharedReportBatchKey(
+            shared_options),
+        cm, dispatcher, random, scope,
+        [&shared_options](const ::istio::mixerclient::Environment& env) {
+          ::istio::control::http::Controller::Options batch_options(
+              shared_options);
+          batch_options.env = env;
+          return ::istio::control::http::Controller::CreateSharedReportBatch(
+              batch_options);
+        });
+  }
 
   controller_ = ::istio::control::http::Controller::Create(options);
+
+  if (runtime_options_.overload_memory_bytes > 0) {
+    overload_timer_ = dispatcher.createTimer([this]() { CheckOverload(); });
+    overload_timer_->enableTimer(
+        std::chrono::milliseconds(kOverloadCheckIntervalMs));
+  }
+  if (runtime_options_.report_drain_deadline_ms > 0) {
+    drain_timer_ = dispatcher.createTimer([this]() { CheckDrain(); });
+    drain_timer_->enableTimer(std::chrono::milliseconds(kDrainCheckIntervalMs));
+  }
+  runtime_timer_ =
+      dispatcher.createTimer([this]() { RefreshRuntimeOptions(); });
+  runtime_timer_->enableTimer(
+      std::chrono::milliseconds(kRuntimeRefreshIntervalMs));
+}
+
+void Control::CheckOverload() {
+  controller_->SetOverloaded(Memory::Stats::totalCurrentlyAllocated() >
+                             runtime_options_.overload_memory_bytes);
+  overload_timer_->enableTimer(
+      std::chrono::milliseconds(kOverloadCheckIntervalMs));
+}
+
+void Control::CheckDrain() {
+  // Filters get no drain callback, drainClose() turns true once the drain
+  // starts. Polled until then, the reports are drained once.
+  if (drain_decision_.drainClose()) {
+    controller_->DrainReports(runtime_options_.report_drain_deadline_ms);
+    return;
+  }
+  drain_timer_->enableTimer(std::chrono::milliseconds(kDrainCheckIntervalMs));
+}
+
+void Control::RefreshRuntimeOptions() {
+  // The options are only used on this thread, by the filters of this
+  // worker, and not held across the dispatcher callbacks.
+  ReadRequestRuntimeOptions(runtime_.snapshot(), &runtime_options_);
+  runtime_timer_->enableTimer(
+      std::chrono::milliseconds(kRuntimeRefreshIntervalMs));
 }
 
 Utils::CheckTransport::Func Control::GetCheckTransport(
-    const HeaderMap* headers) {
-  return Utils::CheckTransport::GetFunc(*check_client_factory_, headers);
+    const HeaderMap* headers, int request_timeout_ms,
+    const std::string& hash_key, Tracing::Span* span) {
+  int timeout_ms = runtime_options_.check_timeout_ms > 0
+                       ? runtime_options_.check_timeout_ms
+                       : Utils::kDefaultGrpcTimeoutMs;
+  if (request_timeout_ms > 0) {
+    timeout_ms = std::min(timeout_ms, request_timeout_ms);
+  }
+  return Utils::RecordCheckStats(
+      Utils::CheckTransport::GetFunc(
+          *check_client_, headers, timeout_ms,
+          runtime_options_.check_hash_key ? hash_key : "", span),
+      stats_);
 }
 
 // Call controller to get statistics.
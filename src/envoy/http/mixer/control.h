@@ -16,46 +16,190 @@
 #pragma once
 
 #include "envoy/event/dispatcher.h"
+#include "envoy/network/drain_decision.h"
 #include "envoy/runtime/runtime.h"
 #include "envoy/thread_local/thread_local.h"
 #include "envoy/upstream/cluster_manager.h"
 #include "include/istio/control/http/controller.h"
+#include "src/envoy/http/mixer/bypass_matcher.h"
 #include "src/envoy/http/mixer/config.h"
+#include "src/envoy/http/mixer/connection_attributes.h"
+#include "src/envoy/http/mixer/route_config.h"
 #include "src/envoy/utils/grpc_transport.h"
 #include "src/envoy/utils/mixer_control.h"
 #include "src/envoy/utils/stats.h"
+#include "src/envoy/utils/utils.h"
 
 namespace Envoy {
 namespace Http {
 namespace Mixer {
 
+// The options set by runtime keys, see README.md. The request options,
+// read by ReadRequestRuntimeOptions(), follow the runtime while the listener
+// runs. The other ones are read once when the listener is created.
+struct RuntimeOptions {
+  // If true, Report requests are gzip compressed.
+  bool compress_report = false;
+  // If positive, the deadline of Check calls.
+  int check_timeout_ms = 0;
+  // If true, Check calls carry a hash key of the destination service, for
+  // a hash based load balancer in front of Mixer.
+  bool check_hash_key = false;
+  // The mixer client options, e.g. of check hedging and circuit breaking.
+  ::istio::mixerclient::ClientTuning client_tuning;
+  // The headers extracted into request.headers and response.headers.
+  Utils::HeaderFilter request_headers;
+  Utils::HeaderFilter response_headers;
+  // If positive, the maximum number of destination services with their
+  // own stats.
+  int max_service_stats = 0;
+  // If not nullptr, the capture of the sampled calls.
+  std::shared_ptr<::istio::mixerclient::TrafficCapture> traffic_capture;
+  // If true, the requests rejected before the Mixer filter runs are
+  // reported with rejection_report_attributes only, see
+  // ::istio::control::http::Controller::ReportRejection().
+  bool rejection_report = false;
+  std::unordered_set<std::string> rejection_report_attributes;
+  // If positive, the window to aggregate the rejection reports.
+  int rejection_aggregate_window_ms = 0;
+  // If positive, the Mixer work is shed while the heap is over this many
+  // bytes, see ::istio::control::http::Controller::SetOverloaded().
+  uint64_t overload_memory_bytes = 0;
+  // If positive, the reports are drained for this long once the listener
+  // drains, see ::istio::control::http::Controller::DrainReports().
+  int report_drain_deadline_ms = 0;
+  // If not empty, the prefix of the files the reports not acknowledged at
+  // the end of the drain are saved to, sent by the workers of the next
+  // process. Each client has its own file.
+  std::string report_spill_file;
+  // If not empty, the prefix of the ring files the failed report batches
+  // are spilled to, one per client.
+  std::string report_spill_ring_file;
+  // The clusters of more report channels, the batches are spread over
+  // them and the report cluster.
+  std::vector<std::string> report_channel_clusters;
+  // If positive, the string and bytes values of the reports are cut to
+  // this many bytes.
+  int report_max_value_bytes = 0;
+  // If not empty, the words appended to the global dictionary, read once
+  // from the dictionary extension file.
+  std::shared_ptr<const std::vector<std::string>> global_words_extension;
+  // If positive, the report batches adapt to the load to send about this
+  // many remote calls per second, of at most so many bytes if positive.
+  int report_target_calls_per_second = 0;
+  int64_t report_target_batch_bytes = 0;
+  // If true, the reports are batched with the ones of the TCP filter with
+  // the same report cluster and options.
+  bool shared_report_batch = false;
+  // The requests skipping all Mixer processing, only counted in
+  // total_bypassed_requests.
+  BypassMatcher bypass;
+  // The cache capacity budget shared by the workers, nullptr if each
+  // worker has its configured capacity.
+  std::shared_ptr<::istio::mixerclient::CacheBudget> cache_budget;
+};
+
+// Reads the request options: the check deadline and hash key, the headers
+// extracted, the rejection reports and the bypassed requests.
+void ReadRequestRuntimeOptions(const Runtime::Snapshot& snapshot,
+                               RuntimeOptions* options);
+
 // The control object created per-thread.
 class Control final : public ThreadLocal::ThreadLocalObject {
  public:
-  // The constructor.
+  // The constructor. The client index, of the worker thread, tells apart
+  // the files of the per-thread clients of a filter config, the clients of
+  // the same index and config of the next process use the same files. The
+  // request options are re-read from runtime every second.
   Control(const Config& config, Upstream::ClusterManager& cm,
           Event::Dispatcher& dispatcher, Runtime::RandomGenerator& random,
-          Stats::Scope& scope, Utils::MixerFilterStats& stats);
+          Runtime::Loader& runtime, Stats::Scope& scope,
+          Utils::MixerFilterStats& stats,
+          std::shared_ptr<::istio::mixerclient::CheckCache> shared_check_cache,
+          std::shared_ptr<::istio::mixerclient::QuotaCache> shared_quota_cache,
+          const RuntimeOptions& runtime_options,
+          RouteConfigCache& route_config_cache,
+          Network::DrainDecision& drain_decision, int client_index);
 
   // Get low-level controller object.
   ::istio::control::http::Controller* controller() { return controller_.get(); }
 
-  // Create a per-request Check transport function.
-  Utils::CheckTransport::Func GetCheckTransport(const HeaderMap* headers);
+  // Get the options set by runtime keys.
+  const RuntimeOptions& runtime_options() const { return runtime_options_; }
+
+  // Get the request headers found in one pass by CheckData.
+  const HeaderNames& header_names() const { return config_.header_names(); }
+
+  // Get the filter stats shared by all workers.
+  Utils::MixerFilterStats& stats() { return stats_; }
+
+  // Get the v1 route configs shared by all workers.
+  RouteConfigCache& route_config_cache() { return route_config_cache_; }
+
+  // Get the attributes of the downstream connections of this worker.
+  ConnectionAttributesCache& connection_attributes_cache() {
+    return connection_attributes_cache_;
+  }
+
+  // Create a per-request Check transport function. If request_timeout_ms
+  // is positive, the check deadline is not longer than it. The hash key is
+  // only sent if enabled by RuntimeOptions::check_hash_key. If span is not
+  // nullptr, the remote calls are traced by its child spans.
+  Utils::CheckTransport::Func GetCheckTransport(
+      const HeaderMap* headers, int request_timeout_ms = 0,
+      const std::string& hash_key = "", Tracing::Span* span = nullptr);
 
  private:
   // Call controller to get statistics.
   bool GetStats(::istio::mixerclient::Statistics* stat);
 
-  // The mixer config.
+  // Checks the heap size against RuntimeOptions::overload_memory_bytes,
+  // and re-arms overload_timer_.
+  void CheckOverload();
+
+  // Starts draining the reports once the listener drains, or re-arms
+  // drain_timer_.
+  void CheckDrain();
+
+  // Re-reads the request options, and re-arms runtime_timer_.
+  void RefreshRuntimeOptions();
+
+  // The mixer config, owned by the ControlFactory and shared by all workers.
   const Config& config_;
+  // The runtime of the request options.
+  Runtime::Loader& runtime_;
+  // The options set by runtime keys.
+  RuntimeOptions runtime_options_;
+  // The filter stats, shared by all workers.
+  Utils::MixerFilterStats& stats_;
+  // The v1 route configs, shared by all workers.
+  RouteConfigCache& route_config_cache_;
+  // The attributes of the downstream connections of this worker.
+  ConnectionAttributesCache connection_attributes_cache_;
+  // The drain decision of the listener.
+  Network::DrainDecision& drain_decision_;
   // The mixer control
   std::unique_ptr<::istio::control::http::Controller> controller_;
   // async client factories
   Grpc::AsyncClientFactoryPtr check_client_factory_;
   Grpc::AsyncClientFactoryPtr report_client_factory_;
+  // async clients shared by all calls of this worker. report_client_ is
+  // nullptr if report calls go to the check cluster and share its client.
+  Grpc::AsyncClientPtr check_client_;
+  Grpc::AsyncClientPtr report_client_;
+  // The clients of the extra report channels.
+  std::vector<Grpc::AsyncClientFactoryPtr> channel_client_factories_;
+  std::vector<Grpc::AsyncClientPtr> channel_clients_;
   // The stats object.
   Utils::MixerStatsObject stats_obj_;
+  // The timer to check the heap size, nullptr if the work is never shed.
+  // Declared last so that it is disabled first at destruction.
+  Event::TimerPtr overload_timer_;
+  // The timer to poll the drain decision, nullptr if the reports are not
+  // drained.
+  Event::TimerPtr drain_timer_;
+  // The timer to re-read the request options.
+  Event::TimerPtr runtime_timer_;
 };
 
 }  // namespace Mixer
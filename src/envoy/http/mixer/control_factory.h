@@ -16,9 +16,12 @@
 #pragma once
 
 #include "common/common/logger.h"
+#include "include/istio/mixerclient/dictionary_extension.h"
 #include "src/envoy/http/mixer/control.h"
 #include "src/envoy/utils/stats.h"
 
+#include <sstream>
+
 namespace Envoy {
 namespace Http {
 namespace Mixer {
@@ -27,6 +30,255 @@ namespace {
 // Envoy stats perfix for HTTP filter stats.
 const std::string kHttpStatsPrefix("http_mixer_filter.");
 
+// The runtime key to share one check cache by all worker threads.
+const std::string kSharedCheckCacheRuntimeKey("mixer.shared_check_cache");
+
+// The runtime key to share one quota cache by all worker threads, so they
+// draw from one prefetched pool per quota key.
+const std::string kSharedQuotaCacheRuntimeKey("mixer.shared_quota_cache");
+
+// The runtime key for the prefix of the files to save the shared check
+// caches to, one per cache config, so that they are warm started after a
+// restart.
+const std::string kCheckCacheSnapshotRuntimeKey(
+    "mixer.check_cache_snapshot_file");
+
+// The runtime key for the file of the check cache shared by the proxies
+// of the node, e.g. on a volume of the node mounted by each pod. The
+// misses of the shared check cache look it up. Not used if not set.
+const std::string kNodeCheckCacheFileRuntimeKey("mixer.node_check_cache_file");
+
+// The runtime key for the id of the mesh config, only the node check
+// cache responses of the same id are used.
+const std::string kMeshConfigIdRuntimeKey("mixer.mesh_config_id");
+
+// The runtime key for the attribute partitioning the check cache items,
+// e.g. "destination.service", so that the misses of one partition can't
+// evict the items of all the others. Not partitioned if not set.
+const std::string kCheckCachePartitionRuntimeKey(
+    "mixer.check_cache_partition_attribute");
+
+// The runtime keys of the check cache tiers: the denials are cached for at
+// most the negative TTL in milliseconds, and while the Check calls to Mixer
+// fail with network errors, the expired items are still used for this many
+// milliseconds. Not used if not set.
+const std::string kCheckNegativeCacheTtlRuntimeKey(
+    "mixer.check_negative_cache_ttl_ms");
+const std::string kCheckStaleWhileUnavailableRuntimeKey(
+    "mixer.check_stale_while_unavailable_ms");
+
+// The runtime key for the percent of the valid duration or use count of a
+// check cache item after which a hit renews it with a non-blocking Check
+// call to Mixer, in (0, 100). Not renewed ahead if not set.
+const std::string kCheckRefreshAheadPercentRuntimeKey(
+    "mixer.check_refresh_ahead_percent");
+
+// The runtime keys for the maximum bytes of the items of each check cache
+// and quota cache, on top of their maximum entries. Not limited if not
+// set.
+const std::string kCheckCacheMaxBytesRuntimeKey("mixer.check_cache_max_bytes");
+const std::string kQuotaCacheMaxBytesRuntimeKey("mixer.quota_cache_max_bytes");
+
+// The runtime keys to batch the quota prefetch calls to Mixer of different
+// requests: they are gathered for at most this many milliseconds, or up to
+// the maximum quotas, into one Check call. Not batched if not set.
+const std::string kQuotaBatchWindowRuntimeKey("mixer.quota_batch_window_ms");
+const std::string kMaxBatchQuotasRuntimeKey("mixer.quota_max_batch_quotas");
+
+// The runtime key to scale the quota prefetch amounts to the observed
+// latency of the quota calls to Mixer, instead of a fixed one second
+// window.
+const std::string kAdaptiveQuotaPrefetchRuntimeKey(
+    "mixer.quota_adaptive_prefetch");
+
+// The runtime key to send only the attributes referenced by the quotas in
+// the quota prefetch calls to Mixer, once they are known.
+const std::string kMinimizeQuotaRequestsRuntimeKey(
+    "mixer.quota_minimize_requests");
+
+// The runtime key for the maximum number of request signatures a quota
+// exhausted by Mixer is rejected locally for, 1000 if not set. Not
+// rejected locally if 0.
+const std::string kMaxRejectedQuotaSignaturesRuntimeKey(
+    "mixer.quota_max_rejected_signatures");
+
+// The runtime key to gzip compress the Report requests to Mixer.
+const std::string kCompressReportRuntimeKey("mixer.compress_report");
+
+// The runtime keys to hedge the Check calls to Mixer blocking a request:
+// one not returned after this percentile of the recent round trip times,
+// but at least after the minimum delay in milliseconds, is sent again.
+// Not hedged if not set.
+const std::string kCheckHedgePercentileRuntimeKey(
+    "mixer.check_hedge_percentile");
+const std::string kCheckHedgeMinDelayRuntimeKey(
+    "mixer.check_hedge_min_delay_ms");
+
+// The runtime keys of the circuit breaker of the Check calls to Mixer: it
+// opens after this many transport failures in a row, or once this percent
+// of a window of calls failed. While open, the checks missing the cache
+// fail open or closed at once, until a probe call succeeds after the
+// cooldown in milliseconds. Not used if not set.
+const std::string kCheckBreakerFailuresRuntimeKey(
+    "mixer.check_breaker_consecutive_failures");
+const std::string kCheckBreakerErrorPercentRuntimeKey(
+    "mixer.check_breaker_error_percent");
+const std::string kCheckBreakerWindowCallsRuntimeKey(
+    "mixer.check_breaker_window_calls");
+const std::string kCheckBreakerCooldownRuntimeKey(
+    "mixer.check_breaker_cooldown_ms");
+
+// The runtime key for the maximum number of destination services with
+// their own stats, under http_mixer_filter.service.<name>. Disabled if
+// not set.
+const std::string kMaxServiceStatsRuntimeKey("mixer.max_service_stats");
+
+// The runtime key of the comma separated attributes of the rejection
+// reports, a default set if not set.
+const std::string kRejectionReportAttributesRuntimeKey(
+    "mixer.rejection_report_attributes");
+
+// The runtime key for the window in milliseconds to aggregate the
+// rejections with the same source ip and response code into one report.
+// Not aggregated if not set.
+const std::string kRejectionAggregateWindowRuntimeKey(
+    "mixer.rejection_aggregate_window_ms");
+
+// The runtime key for the heap size in bytes over which the Mixer work is
+// shed: check calls missing the cache fail open or closed without a remote
+// call, most reports are dropped and the check cache is shrunk. Not shed
+// if not set.
+const std::string kOverloadMemoryRuntimeKey("mixer.overload_memory_bytes");
+
+// The runtime keys of the shedding while overloaded: the percent of its
+// capacity each check cache shard is shrunk to, 50 if not set, and one in
+// how many reports is kept, 10 if not set.
+const std::string kOverloadCachePercentRuntimeKey(
+    "mixer.overload_cache_percent");
+const std::string kOverloadReportSampleRateRuntimeKey(
+    "mixer.overload_report_sample_rate");
+
+// The runtime key for how long the reports are drained once the listener
+// drains: they are sent right away, without waiting for a full batch. Not
+// drained if not set.
+const std::string kReportDrainDeadlineRuntimeKey(
+    "mixer.report_drain_deadline_ms");
+
+// The runtime key for the prefix of the files the reports not acknowledged
+// at the end of the drain are saved to, one per worker and filter. The
+// workers of the process started by a hot restart send them. Not saved if
+// not set.
+const std::string kReportSpillFileRuntimeKey("mixer.report_spill_file");
+
+// The runtime key for the prefix of the ring files the report batches
+// failed by Mixer are spilled to, one per worker and filter, sent again
+// once Mixer recovers. They survive a restart. Not spilled if not set.
+const std::string kReportSpillRingFileRuntimeKey(
+    "mixer.report_spill_ring_file");
+
+// The runtime key for a comma separated list of clusters, e.g. more
+// definitions of the Mixer service, each one a report channel with its
+// own connections. The report batches are spread over them and the report
+// cluster, a channel backing off after an error. Not spread if not set.
+const std::string kReportChannelClustersRuntimeKey(
+    "mixer.report_channel_clusters");
+
+// The runtime key to queue the reports as they are and compress them into
+// the batches from a timer, off the request path, also once this many
+// reports are queued. Compressed inline if not set.
+const std::string kReportPipelineQueueSizeRuntimeKey(
+    "mixer.report_pipeline_queue_size");
+
+// The runtime keys of the in-flight window of the Report calls to Mixer:
+// at most this many calls are in flight, the reports merge into larger
+// batches meanwhile. While it is full, only one in the sample rate of the
+// reports is kept if > 1, and the reports are dropped once the batched
+// ones take the maximum bytes. Not limited if not set.
+const std::string kReportMaxInflightBatchesRuntimeKey(
+    "mixer.report_max_inflight_batches");
+const std::string kReportMaxBufferedBytesRuntimeKey(
+    "mixer.report_max_buffered_bytes");
+const std::string kReportOverflowSampleRateRuntimeKey(
+    "mixer.report_overflow_sample_rate");
+
+// The runtime key for the bytes of the encoded reports of a batch after
+// which it is sent to Mixer, e.g. to stay under the gRPC message limit.
+// Not limited if not set.
+const std::string kReportMaxBatchBytesRuntimeKey(
+    "mixer.report_max_batch_bytes");
+
+// The runtime key for the number of report batches open at the same time,
+// the reports with the same attribute names go to the same one so that
+// they are delta encoded. One if not set.
+const std::string kReportMaxOpenBatchesRuntimeKey(
+    "mixer.report_max_open_batches");
+
+// The runtime keys to fold the reports with the same values of the comma
+// separated key attributes into one report until the batch is sent, with
+// the comma separated int64 or duration attributes summed, and the count
+// of folded reports in the count attribute if set. One in the sample rate
+// of the folded reports is also sent in full if > 0. Not folded if not
+// set.
+const std::string kReportAggregationKeysRuntimeKey(
+    "mixer.report_aggregation_keys");
+const std::string kReportAggregationSumsRuntimeKey(
+    "mixer.report_aggregation_sums");
+const std::string kReportAggregationCountRuntimeKey(
+    "mixer.report_aggregation_count_attribute");
+const std::string kReportFullSampleRateRuntimeKey(
+    "mixer.report_full_sample_rate");
+
+// The runtime key for the maximum bytes of a string, bytes or string map
+// value in a report, longer ones are cut and end with "...". The check
+// calls keep the full values. Not cut if not set.
+const std::string kReportMaxValueBytesRuntimeKey(
+    "mixer.report_max_value_bytes");
+
+// The runtime key for a global dictionary extension file, built from a
+// traffic capture by the create_dictionary_extension tool. Its words are
+// appended to the global dictionary, Mixer must be given the same words.
+// Not extended if not set or if the file is invalid.
+const std::string kGlobalDictionaryFileRuntimeKey(
+    "mixer.global_dictionary_file");
+
+// The runtime keys for the adaptive report batching: the target number of
+// remote report calls per second, and the target bytes of a batch. The
+// batch window and entry cap follow the report rate and the transport
+// latency, within the configured batch limits. Fixed if not set.
+const std::string kReportTargetCallsRuntimeKey(
+    "mixer.report_target_calls_per_second");
+const std::string kReportTargetBatchBytesRuntimeKey(
+    "mixer.report_target_batch_bytes");
+
+// The runtime keys for process wide budgets of the check and quota cache
+// capacity. They are split between the worker threads by their misses and
+// evictions, rebalanced on the main thread every interval, instead of each
+// worker caching the configured entries. Not budgeted if not set, nor for
+// the shared caches.
+const std::string kCacheBudgetCheckEntriesRuntimeKey(
+    "mixer.cache_budget_check_entries");
+const std::string kCacheBudgetQuotaEntriesRuntimeKey(
+    "mixer.cache_budget_quota_entries");
+const std::string kCacheBudgetIntervalRuntimeKey(
+    "mixer.cache_budget_interval_ms");
+
+// The default milliseconds between the cache budget rebalances.
+const int kDefaultCacheBudgetIntervalMs = 10000;
+
+// The number of v1 route configs kept parsed.
+const int kRouteConfigCacheSize = 1000;
+
+// Appends the non-empty names of a comma separated list.
+void ParseNameList(const std::string& value, std::vector<std::string>* names) {
+  std::stringstream stream(value);
+  std::string name;
+  while (std::getline(stream, name, ',')) {
+    if (!name.empty()) {
+      names->push_back(name);
+    }
+  }
+}
+
 }  // namespace
 
 // This object is globally per listener.
@@ -36,16 +288,164 @@ class ControlFactory : public Logger::Loggable<Logger::Id::config> {
   ControlFactory(std::unique_ptr<Config> config,
                  Server::Configuration::FactoryContext& context)
       : config_(std::move(config)),
+        route_config_cache_(kRouteConfigCacheSize),
         tls_(context.threadLocal().allocateSlot()),
         stats_{ALL_MIXER_FILTER_STATS(
-            POOL_COUNTER_PREFIX(context.scope(), kHttpStatsPrefix))} {
+            POOL_COUNTER_PREFIX(context.scope(), kHttpStatsPrefix),
+            POOL_GAUGE_PREFIX(context.scope(), kHttpStatsPrefix),
+            POOL_HISTOGRAM_PREFIX(context.scope(), kHttpStatsPrefix))} {
     Upstream::ClusterManager& cm = context.clusterManager();
     Runtime::RandomGenerator& random = context.random();
+    Runtime::Loader& runtime = context.runtime();
     Stats::Scope& scope = context.scope();
-    tls_->set([this, &cm, &random, &scope](Event::Dispatcher& dispatcher)
+    runtime_options_.compress_report =
+        context.runtime().snapshot().getInteger(kCompressReportRuntimeKey,
+                                                0) != 0;
+    runtime_options_.max_service_stats =
+        context.runtime().snapshot().getInteger(kMaxServiceStatsRuntimeKey,
+                                                0);
+    const auto& snapshot = context.runtime().snapshot();
+    auto& tuning = runtime_options_.client_tuning;
+    tuning.hedge_percentile =
+        snapshot.getInteger(kCheckHedgePercentileRuntimeKey, 0);
+    tuning.hedge_min_delay_ms = snapshot.getInteger(
+        kCheckHedgeMinDelayRuntimeKey, tuning.hedge_min_delay_ms);
+    tuning.breaker_consecutive_failures =
+        snapshot.getInteger(kCheckBreakerFailuresRuntimeKey, 0);
+    tuning.breaker_error_percent =
+        snapshot.getInteger(kCheckBreakerErrorPercentRuntimeKey, 0);
+    tuning.breaker_window_calls = snapshot.getInteger(
+        kCheckBreakerWindowCallsRuntimeKey, tuning.breaker_window_calls);
+    tuning.breaker_cooldown_ms = snapshot.getInteger(
+        kCheckBreakerCooldownRuntimeKey, tuning.breaker_cooldown_ms);
+    tuning.check_partition_attribute =
+        snapshot.get(kCheckCachePartitionRuntimeKey);
+    tuning.negative_cache_ttl_ms =
+        snapshot.getInteger(kCheckNegativeCacheTtlRuntimeKey, 0);
+    tuning.stale_while_unavailable_ms =
+        snapshot.getInteger(kCheckStaleWhileUnavailableRuntimeKey, 0);
+    tuning.refresh_ahead_fraction =
+        snapshot.getInteger(kCheckRefreshAheadPercentRuntimeKey, 0) / 100.0;
+    tuning.check_cache_max_bytes =
+        snapshot.getInteger(kCheckCacheMaxBytesRuntimeKey, 0);
+    tuning.overload_cache_fraction =
+        snapshot.getInteger(kOverloadCachePercentRuntimeKey, 50) / 100.0;
+    tuning.overload_report_sample_rate =
+        snapshot.getInteger(kOverloadReportSampleRateRuntimeKey,
+                            tuning.overload_report_sample_rate);
+    tuning.quota_cache_max_bytes =
+        snapshot.getInteger(kQuotaCacheMaxBytesRuntimeKey, 0);
+    tuning.quota_batch_window_ms =
+        snapshot.getInteger(kQuotaBatchWindowRuntimeKey, 0);
+    tuning.max_batch_quotas =
+        snapshot.getInteger(kMaxBatchQuotasRuntimeKey, tuning.max_batch_quotas);
+    tuning.adaptive_prefetch =
+        snapshot.getInteger(kAdaptiveQuotaPrefetchRuntimeKey, 0) != 0;
+    tuning.minimize_quota_requests =
+        snapshot.getInteger(kMinimizeQuotaRequestsRuntimeKey, 0) != 0;
+    tuning.max_rejected_signatures = snapshot.getInteger(
+        kMaxRejectedQuotaSignaturesRuntimeKey, tuning.max_rejected_signatures);
+    tuning.report_pipeline_queue_size =
+        snapshot.getInteger(kReportPipelineQueueSizeRuntimeKey, 0);
+    tuning.report_max_inflight_batches =
+        snapshot.getInteger(kReportMaxInflightBatchesRuntimeKey, 0);
+    tuning.report_max_buffered_bytes =
+        snapshot.getInteger(kReportMaxBufferedBytesRuntimeKey, 0);
+    tuning.report_overflow_sample_rate =
+        snapshot.getInteger(kReportOverflowSampleRateRuntimeKey, 0);
+    tuning.report_max_batch_bytes =
+        snapshot.getInteger(kReportMaxBatchBytesRuntimeKey, 0);
+    tuning.report_max_open_batches = snapshot.getInteger(
+        kReportMaxOpenBatchesRuntimeKey, tuning.report_max_open_batches);
+    ParseNameList(snapshot.get(kReportAggregationKeysRuntimeKey),
+                  &tuning.report_aggregation_keys);
+    ParseNameList(snapshot.get(kReportAggregationSumsRuntimeKey),
+                  &tuning.report_aggregation_sums);
+    tuning.report_aggregation_count_attribute =
+        snapshot.get(kReportAggregationCountRuntimeKey);
+    tuning.report_full_sample_rate =
+        snapshot.getInteger(kReportFullSampleRateRuntimeKey, 0);
+    // The shared caches have the same cache options as the per-worker
+    // ones.
+    if (snapshot.getInteger(kSharedCheckCacheRuntimeKey, 0) != 0) {
+      shared_check_cache_ =
+          ::istio::control::http::Controller::CreateSharedCheckCache(
+              config_->config_pb(),
+              snapshot.get(kCheckCacheSnapshotRuntimeKey),
+              snapshot.get(kNodeCheckCacheFileRuntimeKey),
+              snapshot.get(kMeshConfigIdRuntimeKey), tuning);
+    }
+    if (snapshot.getInteger(kSharedQuotaCacheRuntimeKey, 0) != 0) {
+      shared_quota_cache_ =
+          ::istio::control::http::Controller::CreateSharedQuotaCache(
+              config_->config_pb(), tuning);
+    }
+    ReadRequestRuntimeOptions(snapshot, &runtime_options_);
+    runtime_options_.traffic_capture = Utils::GetTrafficCapture(snapshot);
+    runtime_options_.shared_report_batch =
+        Utils::SharedReportBatchEnabled(snapshot);
+    Utils::ParseHeaderNames(snapshot.get(kRejectionReportAttributesRuntimeKey),
+                            &runtime_options_.rejection_report_attributes);
+    runtime_options_.rejection_aggregate_window_ms =
+        snapshot.getInteger(kRejectionAggregateWindowRuntimeKey, 0);
+    runtime_options_.overload_memory_bytes =
+        snapshot.getInteger(kOverloadMemoryRuntimeKey, 0);
+    runtime_options_.report_drain_deadline_ms =
+        snapshot.getInteger(kReportDrainDeadlineRuntimeKey, 0);
+    runtime_options_.report_spill_file =
+        snapshot.get(kReportSpillFileRuntimeKey);
+    runtime_options_.report_spill_ring_file =
+        snapshot.get(kReportSpillRingFileRuntimeKey);
+    ParseNameList(snapshot.get(kReportChannelClustersRuntimeKey),
+                  &runtime_options_.report_channel_clusters);
+    runtime_options_.report_max_value_bytes =
+        snapshot.getInteger(kReportMaxValueBytesRuntimeKey, 0);
+    runtime_options_.report_target_calls_per_second =
+        snapshot.getInteger(kReportTargetCallsRuntimeKey, 0);
+    runtime_options_.report_target_batch_bytes =
+        snapshot.getInteger(kReportTargetBatchBytesRuntimeKey, 0);
+    const std::string& dictionary_file =
+        snapshot.get(kGlobalDictionaryFileRuntimeKey);
+    std::vector<std::string> words;
+    if (!dictionary_file.empty() &&
+        ::istio::mixerclient::ReadDictionaryExtension(dictionary_file,
+                                                      &words)) {
+      ENVOY_LOG(info, "Extend the global dictionary with {} words from {}",
+                words.size(), dictionary_file);
+      runtime_options_.global_words_extension =
+          std::make_shared<const std::vector<std::string>>(std::move(words));
+    }
+    int64_t check_budget =
+        snapshot.getInteger(kCacheBudgetCheckEntriesRuntimeKey, 0);
+    int64_t quota_budget =
+        snapshot.getInteger(kCacheBudgetQuotaEntriesRuntimeKey, 0);
+    if (check_budget > 0 || quota_budget > 0) {
+      int interval_ms = snapshot.getInteger(kCacheBudgetIntervalRuntimeKey,
+                                            kDefaultCacheBudgetIntervalMs);
+      // One budget for all the filter configs of the process. Each of
+      // them rebalances it, at most once per half interval.
+      runtime_options_.cache_budget =
+          ::istio::mixerclient::CacheBudget::GetShared(
+              check_budget, quota_budget, interval_ms);
+      // The workers apply their capacities on their own threads.
+      budget_timer_ = context.dispatcher().createTimer([this, interval_ms]() {
+        runtime_options_.cache_budget->RebalanceIfDue(
+            std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now().time_since_epoch())
+                .count());
+        budget_timer_->enableTimer(std::chrono::milliseconds(interval_ms));
+      });
+      budget_timer_->enableTimer(std::chrono::milliseconds(interval_ms));
+    }
+    Utils::MixerStatsRegistry::Get().AddAdminHandler(context.admin());
+    Network::DrainDecision& drain_decision = context.drainDecision();
+    tls_->set([this, &cm, &random, &runtime, &scope,
+               &drain_decision](Event::Dispatcher& dispatcher)
                   -> ThreadLocal::ThreadLocalObjectSharedPtr {
-      return std::make_shared<Control>(*config_, cm, dispatcher, random, scope,
-                                       stats_);
+      return std::make_shared<Control>(
+          *config_, cm, dispatcher, random, runtime, scope, stats_,
+          shared_check_cache_, shared_quota_cache_, runtime_options_,
+          route_config_cache_, drain_decision, Utils::ThreadIndex());
     });
   }
 
@@ -54,10 +454,21 @@ class ControlFactory : public Logger::Loggable<Logger::Id::config> {
  private:
   // Own the config object.
   std::unique_ptr<Config> config_;
+  // The v1 route configs parsed for all worker threads. It outlives the
+  // per-thread Control objects referring to it.
+  RouteConfigCache route_config_cache_;
   // Thread local slot.
   ThreadLocal::SlotPtr tls_;
   // This stats object.
   Utils::MixerFilterStats stats_;
+  // The check cache shared by all worker threads, nullptr if not shared.
+  std::shared_ptr<::istio::mixerclient::CheckCache> shared_check_cache_;
+  // The quota cache shared by all worker threads, nullptr if not shared.
+  std::shared_ptr<::istio::mixerclient::QuotaCache> shared_quota_cache_;
+  // The options from runtime keys, as the listener is created.
+  RuntimeOptions runtime_options_;
+  // The main thread timer rebalancing the cache budget.
+  Event::TimerPtr budget_timer_;
 };
 
 }  // namespace Mixer
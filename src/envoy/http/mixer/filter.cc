@@ -15,15 +15,15 @@
 
 #include "src/envoy/http/mixer/filter.h"
 
-#include "common/common/base64.h"
+#include "common/tracing/http_tracer_impl.h"
 #include "include/istio/utils/status.h"
 #include "src/envoy/http/mixer/check_data.h"
 #include "src/envoy/http/mixer/header_update.h"
 #include "src/envoy/http/mixer/report_data.h"
 #include "src/envoy/utils/authn.h"
+#include "src/envoy/utils/phase_timer.h"
 
 using ::google::protobuf::util::Status;
-using ::istio::mixer::v1::config::client::ServiceConfig;
 
 namespace Envoy {
 namespace Http {
@@ -36,6 +36,28 @@ const std::string kPerRouteDestinationService("destination.service");
 const std::string kPerRouteMixer("mixer");
 // Per route opaque data name "mixer_sha" is SHA(JSON(ServiceConfig))
 const std::string kPerRouteMixerSha("mixer_sha");
+// Per route opaque data "mixer_async_check" is "true" if requests continue
+// on a check cache miss. The stream is reset if the check fails before it
+// is done.
+const std::string kPerRouteMixerAsyncCheck("mixer_async_check");
+// Per route opaque data "mixer_speculative_forward" is "true" if requests
+// with a safe method are forwarded upstream on a check cache miss,
+// but their response is held back until the check passes. If the check
+// fails, the upstream request is reset with the stream.
+const std::string kPerRouteMixerSpeculativeForward(
+    "mixer_speculative_forward");
+
+// Returns true if the request method is safe, RFC 7231 4.2.1, so that it
+// can be forwarded before it is checked. PUT and DELETE are idempotent but
+// not safe, a denied one would already have changed the upstream state.
+bool IsSafeMethod(const HeaderMap& headers) {
+  if (!headers.Method()) {
+    return false;
+  }
+  const std::string method = headers.Method()->value().c_str();
+  return method == "GET" || method == "HEAD" || method == "OPTIONS" ||
+         method == "TRACE";
+}
 
 // Read a string value from a string map.
 bool ReadStringMap(const std::multimap<std::string, std::string>& string_map,
@@ -54,10 +76,17 @@ Filter::Filter(Control& control)
     : control_(control),
       state_(NotStarted),
       initiating_call_(false),
-      headers_(nullptr) {
+      async_check_pending_(false),
+      hold_response_(false),
+      response_held_(false),
+      bypassed_(false),
+      headers_(nullptr),
+      alive_(std::make_shared<bool>(true)) {
   ENVOY_LOG(debug, "Called Mixer::Filter : {}", __func__);
 }
 
+Filter::~Filter() {}
+
 void Filter::ReadPerRouteConfig(
     const Router::RouteEntry* entry,
     ::istio::control::http::Controller::PerRouteConfig* config) {
@@ -68,11 +97,8 @@ void Filter::ReadPerRouteConfig(
   // Check v2 per-route config.
   auto route_cfg = entry->perFilterConfigTyped<PerRouteServiceConfig>("mixer");
   if (route_cfg) {
-    if (!control_.controller()->LookupServiceConfig(route_cfg->hash)) {
-      control_.controller()->AddServiceConfig(route_cfg->hash,
-                                              route_cfg->config);
-    }
-    config->service_config_id = route_cfg->hash;
+    config->service_config = &route_cfg->config;
+    config->service_config_hash = route_cfg->hash;
     return;
   }
 
@@ -80,67 +106,133 @@ void Filter::ReadPerRouteConfig(
   ReadStringMap(string_map, kPerRouteDestinationService,
                 &config->destination_service);
 
-  if (!ReadStringMap(string_map, kPerRouteMixerSha,
-                     &config->service_config_id) ||
-      config->service_config_id.empty()) {
-    return;
-  }
-
-  if (control_.controller()->LookupServiceConfig(config->service_config_id)) {
+  std::string sha;
+  if (!ReadStringMap(string_map, kPerRouteMixerSha, &sha) || sha.empty()) {
     return;
   }
 
-  std::string config_base64;
-  if (!ReadStringMap(string_map, kPerRouteMixer, &config_base64)) {
-    ENVOY_LOG(warn, "Service {} missing [mixer] per-route attribute",
-              config->destination_service);
-    return;
-  }
-  std::string config_json = Base64::decode(config_base64);
-  if (config_json.empty()) {
-    ENVOY_LOG(warn, "Service {} invalid base64 config data",
-              config->destination_service);
-    return;
+  // The config of a sha is only parsed once for all workers.
+  RouteConfigCache& route_config_cache = control_.route_config_cache();
+  if (!route_config_cache.Lookup(sha, &route_config_)) {
+    auto it = string_map.find(kPerRouteMixer);
+    if (it == string_map.end()) {
+      ENVOY_LOG(warn, "Service {} missing [mixer] per-route attribute",
+                config->destination_service);
+      return;
+    }
+    route_config_ =
+        route_config_cache.Get(sha, it->second, config->destination_service);
   }
-  ServiceConfig config_pb;
-  auto status = Utils::ParseJsonMessage(config_json, &config_pb);
-  if (!status.ok()) {
-    ENVOY_LOG(warn,
-              "Service {} failed to convert JSON config to protobuf, error: {}",
-              config->destination_service, status.ToString());
-    return;
+  if (route_config_) {
+    config->service_config = &route_config_->config;
+    config->service_config_hash = route_config_->hash;
   }
-  control_.controller()->AddServiceConfig(config->service_config_id, config_pb);
-  ENVOY_LOG(info, "Service {}, config_id {}, config: {}",
-            config->destination_service, config->service_config_id,
-            config_pb.DebugString());
 }
 
 FilterHeadersStatus Filter::decodeHeaders(HeaderMap& headers, bool) {
+  const BypassMatcher& bypass = control_.runtime_options().bypass;
+  if (!bypass.empty() &&
+      bypass.Matches(headers, decoder_callbacks_->connection())) {
+    control_.stats().total_bypassed_requests_.inc();
+    // The headers meant for the Mixer filter are not forwarded either.
+    Envoy::Utils::Authentication::ClearResult(&headers);
+    HeaderUpdate(&headers).RemoveIstioAttributes();
+    bypassed_ = true;
+    state_ = Complete;
+    return FilterHeadersStatus::Continue;
+  }
+  ISTIO_TIME_PHASE(control_.stats().decode_headers_ns_);
   ENVOY_LOG(debug, "Called Mixer::Filter : {}", __func__);
   request_total_size_ += headers.byteSize();
 
   ::istio::control::http::Controller::PerRouteConfig config;
   auto route = decoder_callbacks_->route();
+  bool async_check = false;
+  bool speculative_forward = false;
+  // A check that can not finish within the route timeout fails early, by
+  // the network fail policy.
+  int request_timeout_ms = 0;
   if (route) {
     ReadPerRouteConfig(route->routeEntry(), &config);
+    if (route->routeEntry()) {
+      request_timeout_ms = route->routeEntry()->timeout().count();
+    }
+    std::string value;
+    async_check = route->routeEntry() &&
+                  ReadStringMap(route->routeEntry()->opaqueConfig(),
+                                kPerRouteMixerAsyncCheck, &value) &&
+                  value == "true";
+    speculative_forward =
+        route->routeEntry() &&
+        ReadStringMap(route->routeEntry()->opaqueConfig(),
+                      kPerRouteMixerSpeculativeForward, &value) &&
+        value == "true" && IsSafeMethod(headers);
   }
   handler_ = control_.controller()->CreateRequestHandler(config);
 
   state_ = Calling;
   initiating_call_ = true;
-  CheckData check_data(headers, decoder_callbacks_->connection());
+  // The connection attributes are extracted by the first stream of the
+  // connection.
+  const Network::Connection* connection = decoder_callbacks_->connection();
+  std::shared_ptr<const ConnectionAttributes> connection_attributes;
+  if (connection) {
+    connection_attributes =
+        control_.connection_attributes_cache().Get(*connection);
+  }
+  CheckData check_data(headers, connection,
+                       &control_.runtime_options().request_headers,
+                       connection_attributes.get(), &control_.header_names());
   HeaderUpdate header_update(&headers);
   headers_ = &headers;
+  // Hash Check calls by the destination service, or by the host.
+  std::string hash_key = config.destination_service;
+  if (hash_key.empty() && headers.Host()) {
+    hash_key = std::string(headers.Host()->value().c_str(),
+                           headers.Host()->value().size());
+  }
+  ::istio::mixerclient::DoneFunc on_done = [this](const Status& status) {
+    completeCheck(status);
+  };
+  if (async_check || speculative_forward) {
+    // Not cancelled by the filter, the response still fills the cache once
+    // the request is done. The call keeps the request handler alive.
+    std::weak_ptr<bool> alive = alive_;
+    std::shared_ptr<::istio::control::http::RequestHandler> handler =
+        handler_;
+    on_done = [this, alive, handler](const Status& status) {
+      if (!alive.expired()) {
+        completeCheck(status);
+      }
+    };
+  }
+  // Without tracing the active span is a NullSpan, which injects no
+  // context, the transport forwards the trace headers instead.
+  Tracing::Span* span = &decoder_callbacks_->activeSpan();
+  if (dynamic_cast<Tracing::NullSpan*>(span) != nullptr) {
+    span = nullptr;
+  }
   cancel_check_ = handler_->Check(
-      &check_data, &header_update, control_.GetCheckTransport(&headers),
-      [this](const Status& status) { completeCheck(status); });
+      &check_data, &header_update,
+      control_.GetCheckTransport(&headers, request_timeout_ms, hash_key, span),
+      on_done);
   initiating_call_ = false;
 
   if (state_ == Complete) {
     return FilterHeadersStatus::Continue;
   }
+  if ((async_check || speculative_forward) && state_ == Calling) {
+    ENVOY_LOG(debug, "Called Mixer::Filter : {} Continue before check",
+              __func__);
+    hold_response_ = speculative_forward;
+    Envoy::Utils::Authentication::ClearResult(headers_);
+    headers_ = nullptr;
+    async_check_pending_ = true;
+    state_ = Complete;
+    return FilterHeadersStatus::Continue;
+  }
   ENVOY_LOG(debug, "Called Mixer::Filter : {} Stop", __func__);
+  blocked_start_ = std::chrono::steady_clock::now();
   return FilterHeadersStatus::StopIteration;
 }
 
@@ -169,19 +261,79 @@ void Filter::setDecoderFilterCallbacks(
   decoder_callbacks_ = &callbacks;
 }
 
+void Filter::setEncoderFilterCallbacks(
+    StreamEncoderFilterCallbacks& callbacks) {
+  encoder_callbacks_ = &callbacks;
+}
+
+FilterHeadersStatus Filter::encodeHeaders(HeaderMap&, bool) {
+  if (hold_response_ && async_check_pending_ && state_ != Responded) {
+    ENVOY_LOG(debug, "Called Mixer::Filter : {} hold response", __func__);
+    response_held_ = true;
+    return FilterHeadersStatus::StopIteration;
+  }
+  return FilterHeadersStatus::Continue;
+}
+
+FilterDataStatus Filter::encodeData(Buffer::Instance&, bool) {
+  if (response_held_) {
+    return FilterDataStatus::StopIterationAndWatermark;
+  }
+  return FilterDataStatus::Continue;
+}
+
+FilterTrailersStatus Filter::encodeTrailers(HeaderMap&) {
+  if (response_held_) {
+    return FilterTrailersStatus::StopIteration;
+  }
+  return FilterTrailersStatus::Continue;
+}
+
 void Filter::completeCheck(const Status& status) {
   ENVOY_LOG(debug, "Called Mixer::Filter : check complete {}",
             status.ToString());
   // Remove Istio authentication header after Check() is completed
   if (nullptr != headers_) {
-    Envoy::Utils::Authentication::ClearResultInHeader(headers_);
+    Envoy::Utils::Authentication::ClearResult(headers_);
     headers_ = nullptr;
   }
 
+  // The request has continued, reset it if it is still in progress.
+  if (async_check_pending_) {
+    async_check_pending_ = false;
+    cancel_check_ = nullptr;
+    if (state_ == Responded) {
+      return;
+    }
+    if (!status.ok()) {
+      state_ = Responded;
+      // A speculative forward is denied like a regular request while
+      // nothing was sent downstream, the upstream request is reset with
+      // the stream.
+      if (hold_response_ && !response_held_) {
+        int status_code = ::istio::utils::StatusHttpCode(status.error_code());
+        Utility::sendLocalReply(*decoder_callbacks_, false, Code(status_code),
+                                status.ToString());
+      } else {
+        decoder_callbacks_->resetStream();
+      }
+      return;
+    }
+    if (response_held_) {
+      response_held_ = false;
+      encoder_callbacks_->continueEncoding();
+    }
+    return;
+  }
+
   // This stream has been reset, abort the callback.
   if (state_ == Responded) {
     return;
   }
+  if (!initiating_call_) {
+    Envoy::Utils::RecordCheckBlocked(
+        control_.stats(), handler_->check_miss_reason(), blocked_start_);
+  }
   if (!status.ok() && state_ != Responded) {
     state_ = Responded;
     int status_code = ::istio::utils::StatusHttpCode(status.error_code());
@@ -198,6 +350,12 @@ void Filter::completeCheck(const Status& status) {
 
 void Filter::onDestroy() {
   ENVOY_LOG(debug, "Called Mixer::Filter : {} state: {}", __func__, state_);
+  // The async check goes on to fill the cache.
+  if (async_check_pending_) {
+    cancel_check_ = nullptr;
+    state_ = Responded;
+    return;
+  }
   if (state_ != Calling) {
     cancel_check_ = nullptr;
   }
@@ -212,6 +370,10 @@ void Filter::onDestroy() {
 void Filter::log(const HeaderMap* request_headers,
                  const HeaderMap* response_headers,
                  const RequestInfo::RequestInfo& request_info) {
+  if (bypassed_) {
+    return;
+  }
+  ISTIO_TIME_PHASE(control_.stats().log_ns_);
   ENVOY_LOG(debug, "Called Mixer::Filter : {}", __func__);
   if (!handler_) {
     if (request_headers == nullptr) {
@@ -221,13 +383,23 @@ void Filter::log(const HeaderMap* request_headers,
     // Here Request is rejected by other filters, Mixer filter is not called.
     ::istio::control::http::Controller::PerRouteConfig config;
     ReadPerRouteConfig(request_info.routeEntry(), &config);
+    if (control_.runtime_options().rejection_report) {
+      CheckData check_data(*request_headers, decoder_callbacks_->connection());
+      ReportData report_data(response_headers, request_info,
+                             request_total_size_);
+      control_.controller()->ReportRejection(config, &check_data, &report_data);
+      return;
+    }
     handler_ = control_.controller()->CreateRequestHandler(config);
 
-    CheckData check_data(*request_headers, nullptr);
+    CheckData check_data(*request_headers, nullptr,
+                         &control_.runtime_options().request_headers, nullptr,
+                         &control_.header_names());
     handler_->ExtractRequestAttributes(&check_data);
   }
   // response trailer header is not counted to response total size.
-  ReportData report_data(response_headers, request_info, request_total_size_);
+  ReportData report_data(response_headers, request_info, request_total_size_,
+                         &control_.runtime_options().response_headers);
   handler_->Report(&report_data);
 }
 
@@ -19,25 +19,18 @@
 #include "envoy/access_log/access_log.h"
 #include "envoy/http/filter.h"
 #include "src/envoy/http/mixer/control.h"
+#include "src/envoy/http/mixer/route_config.h"
 
 namespace Envoy {
 namespace Http {
 namespace Mixer {
 
-// The struct to store per-route service config and its hash.
-struct PerRouteServiceConfig : public Router::RouteSpecificFilterConfig {
-  // The per_route service config.
-  ::istio::mixer::v1::config::client::ServiceConfig config;
-
-  // Its config hash
-  std::string hash;
-};
-
-class Filter : public Http::StreamDecoderFilter,
+class Filter : public Http::StreamFilter,
                public AccessLog::Instance,
                public Logger::Loggable<Logger::Id::filter> {
  public:
   Filter(Control& control);
+  ~Filter();
 
   // Implementing virtual functions for StreamDecoderFilter
   FilterHeadersStatus decodeHeaders(HeaderMap& headers, bool) override;
@@ -46,6 +39,18 @@ class Filter : public Http::StreamDecoderFilter,
   void setDecoderFilterCallbacks(
       StreamDecoderFilterCallbacks& callbacks) override;
 
+  // Implementing virtual functions for StreamEncoderFilter, the response is
+  // held back while a speculative check is in flight.
+  FilterHeadersStatus encode100ContinueHeaders(HeaderMap&) override {
+    return FilterHeadersStatus::Continue;
+  }
+  FilterHeadersStatus encodeHeaders(HeaderMap& headers,
+                                    bool end_stream) override;
+  FilterDataStatus encodeData(Buffer::Instance& data, bool end_stream) override;
+  FilterTrailersStatus encodeTrailers(HeaderMap& trailers) override;
+  void setEncoderFilterCallbacks(
+      StreamEncoderFilterCallbacks& callbacks) override;
+
   // Http::StreamFilterBase
   void onDestroy() override;
 
@@ -65,8 +70,12 @@ class Filter : public Http::StreamDecoderFilter,
 
   // The control object.
   Control& control_;
-  // The request handler.
-  std::unique_ptr<::istio::control::http::RequestHandler> handler_;
+  // The request handler, shared with the done function of an async check,
+  // which may finish after the filter is destroyed.
+  std::shared_ptr<::istio::control::http::RequestHandler> handler_;
+  // The v1 route config read by ReadPerRouteConfig, kept until the request
+  // handler is created with it.
+  std::shared_ptr<const PerRouteServiceConfig> route_config_;
   // The pending callback object.
   istio::mixerclient::CancelFunc cancel_check_;
 
@@ -74,16 +83,35 @@ class Filter : public Http::StreamDecoderFilter,
   // The state
   State state_;
   bool initiating_call_;
+  // True if the request continued before its check is done.
+  bool async_check_pending_;
+  // True if the response is held back until the pending async check
+  // passes, for a speculative forward.
+  bool hold_response_;
+  // True if the response headers are held back.
+  bool response_held_;
+  // True if the request skips all Mixer processing, see
+  // RuntimeOptions::bypass.
+  bool bypassed_;
 
   // Point to the request HTTP headers
   HeaderMap* headers_;
 
+  // When decodeHeaders() stopped the request for its check.
+  std::chrono::steady_clock::time_point blocked_start_;
+
   // Total number of bytes received, including request headers, body, and
   // trailers.
   uint64_t request_total_size_{0};
 
+  // Only weakly referenced by the done function of an async check, which
+  // no longer calls the filter once it is destroyed.
+  std::shared_ptr<bool> alive_;
+
   // The stream decoder filter callback.
   StreamDecoderFilterCallbacks* decoder_callbacks_{nullptr};
+  // The stream encoder filter callback.
+  StreamEncoderFilterCallbacks* encoder_callbacks_{nullptr};
 };
 
 }  // namespace Mixer
@@ -63,7 +63,7 @@ class MixerConfigFactory : public NamedHttpFilterConfigFactory {
     // TODO: use downcastAndValidate once client_config.proto adds validate
     // rules.
     obj->config = dynamic_cast<const ServiceConfig&>(config);
-    obj->hash = std::to_string(MessageUtil::hash(obj->config));
+    obj->hash = MessageUtil::hash(obj->config);
     return obj;
   }
 
@@ -81,8 +81,7 @@ class MixerConfigFactory : public NamedHttpFilterConfigFactory {
                Http::FilterChainFactoryCallbacks& callbacks) -> void {
       std::shared_ptr<Http::Mixer::Filter> instance =
           std::make_shared<Http::Mixer::Filter>(control_factory->control());
-      callbacks.addStreamDecoderFilter(
-          Http::StreamDecoderFilterSharedPtr(instance));
+      callbacks.addStreamFilter(Http::StreamFilterSharedPtr(instance));
       callbacks.addAccessLogHandler(AccessLog::InstanceSharedPtr(instance));
     };
   }
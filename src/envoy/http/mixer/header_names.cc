@@ -0,0 +1,63 @@
+/* Copyright 2018 Istio Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/envoy/http/mixer/header_names.h"
+#include "src/envoy/http/jwt_auth/jwt_authenticator.h"
+#include "src/envoy/http/mixer/check_data.h"
+
+#include <algorithm>
+
+using ::istio::mixer::v1::config::client::APIKey;
+using ::istio::mixer::v1::config::client::HttpClientConfig;
+
+namespace Envoy {
+namespace Http {
+namespace Mixer {
+
+HeaderNames::HeaderNames() {
+  // In the order of the indexes.
+  Add("referer");
+  Add(CheckData::IstioAttributeHeader().get());
+  Add(JwtAuth::JwtAuthenticator::JwtPayloadKey().get());
+  // The api key header of the specs without api keys.
+  Add("x-api-key");
+}
+
+size_t HeaderNames::Add(const std::string& name) {
+  std::string lower = name;
+  std::transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+  size_t index = Find(lower);
+  if (index != npos) {
+    return index;
+  }
+  names_.push_back(lower);
+  return names_.size() - 1;
+}
+
+void HeaderNames::AddApiKeyHeaders(const HttpClientConfig& config) {
+  for (const auto& service : config.service_configs()) {
+    for (const auto& api_spec : service.second.http_api_spec()) {
+      for (const auto& api_key : api_spec.api_keys()) {
+        if (api_key.key_case() == APIKey::kHeader) {
+          Add(api_key.header());
+        }
+      }
+    }
+  }
+}
+
+}  // namespace Mixer
+}  // namespace Http
+}  // namespace Envoy
@@ -0,0 +1,71 @@
+/* Copyright 2018 Istio Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "absl/strings/string_view.h"
+#include "mixer/v1/config/client/client_config.pb.h"
+
+namespace Envoy {
+namespace Http {
+namespace Mixer {
+
+// The lower case names of the request headers that CheckData finds in one
+// pass over the headers, on its first lookup by name. The names read by
+// CheckData itself are always registered, the config consumers register
+// theirs when the config is loaded. The other names are looked up one by
+// one. It is immutable once shared by the workers.
+class HeaderNames {
+ public:
+  // The indexes of the names registered by the constructor.
+  enum : size_t {
+    REFERER = 0,
+    ISTIO_ATTRIBUTES,
+    JWT_PAYLOAD,
+    API_KEY,
+  };
+  static const size_t npos = static_cast<size_t>(-1);
+
+  HeaderNames();
+
+  // Registers a header name, lowercased. Returns its index.
+  size_t Add(const std::string& name);
+
+  // Registers the api key headers of the HTTP api specs of the config.
+  void AddApiKeyHeaders(
+      const ::istio::mixer::v1::config::client::HttpClientConfig& config);
+
+  // Returns the index of a lower case name, npos if it is not registered.
+  size_t Find(absl::string_view name) const {
+    for (size_t i = 0; i < names_.size(); ++i) {
+      if (names_[i] == name) {
+        return i;
+      }
+    }
+    return npos;
+  }
+
+  size_t size() const { return names_.size(); }
+
+ private:
+  std::vector<std::string> names_;
+};
+
+}  // namespace Mixer
+}  // namespace Http
+}  // namespace Envoy
@@ -35,11 +35,10 @@ class HeaderUpdate : public ::istio::control::http::HeaderUpdate,
     headers_->remove(CheckData::IstioAttributeHeader());
   }
 
-  // base64 encode data, and add it to the HTTP header.
+  // Add the base64 encoded data to the HTTP header.
   void AddIstioAttributes(const std::string& data) override {
-    std::string base64 = Base64::encode(data.c_str(), data.size());
-    ENVOY_LOG(debug, "Mixer forward attributes set: {}", base64);
-    headers_->addReferenceKey(CheckData::IstioAttributeHeader(), base64);
+    ENVOY_LOG(debug, "Mixer forward attributes set: {}", data);
+    headers_->addReferenceKey(CheckData::IstioAttributeHeader(), data);
   }
 };
 
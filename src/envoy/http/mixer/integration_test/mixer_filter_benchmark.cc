@@ -0,0 +1,393 @@
+/* Copyright 2018 Istio Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// A load benchmark of the HTTP and TCP Mixer filters running in an Envoy
+// test server. Requests and connections go through the filters to fake
+// backends, and the filters call a fake Mixer gRPC server that answers each
+// Check and Report a set latency after receiving it. Its Check responses
+// carry the given cache directives (valid duration and use count) and
+// reference the attributes making a workload cache hit or miss heavy.
+//
+// Each workload prints its requests/s, the p50 and p99 latency per request
+// and the latency the Mixer filter adds to them, measured against the same
+// listener without it, the Mixer filter allocations per request, only
+// counted in the alloc_accounting builds, and the ratio of remote Check and
+// Report calls. The cache hit heavy workloads send 10 distinct requests, the
+// cache miss heavy ones only distinct requests.
+//
+// It is a manual target, run with e.g.
+//   bazel test -c opt --test_output=streamed \
+//     --test_env=MIXER_LATENCY_MS=5 \
+//     //src/envoy/http/mixer:mixer_filter_benchmark
+// MIXER_LATENCY_MS, MIXER_VALID_USE_COUNT and BENCHMARK_REQUESTS set the
+// Mixer latency, the valid use count of its Check responses and the number of
+// requests of each workload.
+
+#include "common/event/dispatcher_impl.h"
+#include "mixer/v1/check.pb.h"
+#include "mixer/v1/report.pb.h"
+#include "test/integration/http_integration.h"
+#include "test/integration/utility.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std::chrono;
+using ::istio::mixer::v1::CheckResponse;
+using ::istio::mixer::v1::ReferencedAttributes;
+using ::istio::mixer::v1::ReportResponse;
+
+namespace Envoy {
+namespace {
+
+const char kConfigPath[] =
+    "src/envoy/http/mixer/integration_test/mixer_filter_benchmark.conf";
+const char kCheckPath[] = "/istio.mixer.v1.Mixer/Check";
+
+// The number of distinct requests of the cache hit heavy workloads.
+const int kNumHitRequests = 10;
+
+// Long enough for the last Report batch, sent at most a second after its
+// first report, and the filter stats, updated every 100ms, to be counted.
+const milliseconds kFlushWait(1500);
+
+int GetEnvInt(const char* name, int default_value) {
+  const char* value = getenv(name);
+  return value ? atoi(value) : default_value;
+}
+
+// The fake Mixer server: a thread answering the Check and Report calls of
+// Envoy in the order they arrive, each one the latency after it was received.
+// Serial answers keep it simple, and the requests of a workload are serial
+// anyway, with only Report batches sent alongside.
+class FakeMixer {
+ public:
+  FakeMixer(FakeUpstream& upstream, milliseconds latency, int valid_use_count,
+            const std::vector<std::string>& referenced)
+      : upstream_(upstream), latency_(latency), stop_(false), stopped_(false) {
+    auto precondition = check_response_.mutable_precondition();
+    precondition->mutable_valid_duration()->set_seconds(60);
+    precondition->set_valid_use_count(valid_use_count);
+    auto attributes = precondition->mutable_referenced_attributes();
+    for (const auto& name : referenced) {
+      attributes->add_words(name);
+      auto match = attributes->add_attribute_matches();
+      // Negative indexes name the words of the message.
+      match->set_name(-attributes->words_size());
+      match->set_condition(ReferencedAttributes::EXACT);
+    }
+    thread_ = std::thread([this]() { Run(); });
+  }
+
+  // Makes the server stop after answering its next call, which the caller
+  // has to trigger.
+  void Stop() { stop_ = true; }
+  bool stopped() const { return stopped_; }
+  void Join() { thread_.join(); }
+
+  // Closes the connection from Envoy, once the server stopped.
+  void Close() {
+    connection_->close();
+    connection_->waitForDisconnect();
+  }
+
+ private:
+  void Run() {
+    Event::DispatcherImpl dispatcher;
+    connection_ = upstream_.waitForHttpConnection(dispatcher);
+    while (true) {
+      FakeStreamPtr stream = connection_->waitForNewStream(dispatcher, true);
+      stream->waitForEndStream(dispatcher);
+      std::this_thread::sleep_for(latency_);
+      stream->startGrpcStream();
+      const std::string path = stream->headers().Path()->value().c_str();
+      if (path == kCheckPath) {
+        stream->sendGrpcMessage(check_response_);
+      } else {
+        stream->sendGrpcMessage(ReportResponse());
+      }
+      stream->finishGrpcStream(Grpc::Status::Ok);
+      // The streams have to outlive their responses, sent by the upstream.
+      streams_.push_back(std::move(stream));
+      if (stop_) {
+        break;
+      }
+    }
+    stopped_ = true;
+  }
+
+  FakeUpstream& upstream_;
+  const milliseconds latency_;
+  CheckResponse check_response_;
+  std::atomic<bool> stop_;
+  std::atomic<bool> stopped_;
+  FakeHttpConnectionPtr connection_;
+  std::vector<FakeStreamPtr> streams_;
+  std::thread thread_;
+};
+
+// The Mixer filter counters of a workload, per request.
+struct FilterStats {
+  std::string allocations;
+  double remote_checks;
+  double remote_reports;
+};
+
+double Percentile(const std::vector<int64_t>& sorted_ns, int percent) {
+  return sorted_ns[sorted_ns.size() * percent / 100] / 1000.0;
+}
+
+void Print(const char* name, std::vector<int64_t> direct_ns,
+           std::vector<int64_t> mixer_ns, nanoseconds elapsed,
+           const FilterStats& stats) {
+  std::sort(direct_ns.begin(), direct_ns.end());
+  std::sort(mixer_ns.begin(), mixer_ns.end());
+  double p50 = Percentile(mixer_ns, 50);
+  double p99 = Percentile(mixer_ns, 99);
+  printf(
+      "%-10s %9.0f req/s  p50 %8.1f us (+%7.1f)  p99 %8.1f us (+%7.1f)  "
+      "%8s allocs/req  remote checks %5.3f  remote reports %5.3f\n",
+      name, mixer_ns.size() / duration<double>(elapsed).count(), p50,
+      p50 - Percentile(direct_ns, 50), p99, p99 - Percentile(direct_ns, 99),
+      stats.allocations.c_str(), stats.remote_checks, stats.remote_reports);
+}
+
+}  // namespace
+
+class MixerFilterBenchmark
+    : public HttpIntegrationTest,
+      public testing::TestWithParam<Network::Address::IpVersion> {
+ public:
+  MixerFilterBenchmark()
+      : HttpIntegrationTest(Http::CodecClient::Type::HTTP1, GetParam()),
+        num_requests_(GetEnvInt("BENCHMARK_REQUESTS", 2000)),
+        latency_(GetEnvInt("MIXER_LATENCY_MS", 1)),
+        valid_use_count_(GetEnvInt("MIXER_VALID_USE_COUNT", 10000)) {}
+
+  void SetUp() override {
+    // The HTTP backend, the Mixer server and the TCP backend.
+    fake_upstreams_.emplace_back(
+        new FakeUpstream(0, FakeHttpConnection::Type::HTTP1, version_));
+    registerPort("upstream_0",
+                 fake_upstreams_.back()->localAddress()->ip()->port());
+    fake_upstreams_.emplace_back(
+        new FakeUpstream(0, FakeHttpConnection::Type::HTTP2, version_));
+    registerPort("upstream_1",
+                 fake_upstreams_.back()->localAddress()->ip()->port());
+    fake_upstreams_.emplace_back(
+        new FakeUpstream(0, FakeHttpConnection::Type::HTTP1, version_));
+    registerPort("upstream_2",
+                 fake_upstreams_.back()->localAddress()->ip()->port());
+  }
+
+  void TearDown() override {
+    if (codec_client_) {
+      codec_client_->close();
+    }
+    if (backend_connection_) {
+      backend_connection_->close();
+      backend_connection_->waitForDisconnect();
+    }
+    if (mixer_) {
+      mixer_->Close();
+    }
+    test_server_.reset();
+    mixer_.reset();
+    fake_upstreams_.clear();
+  }
+
+ protected:
+  // Runs the HTTP workload sending num_distinct distinct requests, with the
+  // fake Mixer referencing their path.
+  void RunHttp(const char* name, int num_distinct) {
+    Start({"destination.service", "request.path"});
+    std::vector<std::string> paths;
+    for (int i = 0; i < num_distinct; ++i) {
+      paths.push_back("/books/" + std::to_string(i));
+    }
+
+    std::vector<int64_t> direct_ns;
+    codec_client_ = makeHttpConnection(lookupPort("http_direct"));
+    for (int i = 0; i < num_requests_; ++i) {
+      direct_ns.push_back(SendRequest(paths[i % num_distinct]));
+    }
+    codec_client_->close();
+
+    std::vector<int64_t> mixer_ns;
+    codec_client_ = makeHttpConnection(lookupPort("http"));
+    auto start = steady_clock::now();
+    for (int i = 0; i < num_requests_; ++i) {
+      mixer_ns.push_back(SendRequest(paths[i % num_distinct]));
+    }
+    auto elapsed = steady_clock::now() - start;
+    Print(name, direct_ns, mixer_ns, elapsed,
+          WaitForStats("http_mixer_filter."));
+
+    // Stops the fake Mixer with the Check of a path never sent before, left
+    // unanswered.
+    mixer_->Stop();
+    IntegrationStreamDecoderPtr response(
+        new IntegrationStreamDecoder(*dispatcher_));
+    codec_client_->makeHeaderOnlyRequest(Headers("/stop"), *response);
+    WaitForMixerStopped();
+  }
+
+  // Runs the TCP workload, with the fake Mixer referencing the attributes.
+  void RunTcp(const char* name, const std::vector<std::string>& referenced) {
+    Start(referenced);
+
+    std::vector<int64_t> direct_ns;
+    for (int i = 0; i < num_requests_; ++i) {
+      direct_ns.push_back(SendConnection("tcp_direct"));
+    }
+
+    std::vector<int64_t> mixer_ns;
+    auto start = steady_clock::now();
+    for (int i = 0; i < num_requests_; ++i) {
+      mixer_ns.push_back(SendConnection("tcp"));
+    }
+    auto elapsed = steady_clock::now() - start;
+    Print(name, direct_ns, mixer_ns, elapsed,
+          WaitForStats("tcp_mixer_filter."));
+
+    // Stops the fake Mixer with the Check of a connection to the listener
+    // with another destination service, left unanswered.
+    mixer_->Stop();
+    IntegrationTcpClientPtr client = makeTcpConnection(lookupPort("tcp_stop"));
+    client->write("stop");
+    WaitForMixerStopped();
+    client->close();
+  }
+
+ private:
+  // Starts the fake Mixer referencing the attributes, then Envoy.
+  void Start(const std::vector<std::string>& referenced) {
+    mixer_.reset(new FakeMixer(*fake_upstreams_[1], latency_,
+                               valid_use_count_, referenced));
+    createTestServer(kConfigPath,
+                     {"http", "http_direct", "tcp", "tcp_direct", "tcp_stop"});
+  }
+
+  Http::TestHeaderMapImpl Headers(const std::string& path) {
+    return Http::TestHeaderMapImpl{
+        {":method", "GET"}, {":path", path}, {":authority", "books"}};
+  }
+
+  // Sends a request for the path to the current client connection, answered
+  // by the backend, and returns its latency.
+  int64_t SendRequest(const std::string& path) {
+    auto start = steady_clock::now();
+    IntegrationStreamDecoderPtr response(
+        new IntegrationStreamDecoder(*dispatcher_));
+    codec_client_->makeHeaderOnlyRequest(Headers(path), *response);
+    if (!backend_connection_) {
+      backend_connection_ =
+          fake_upstreams_[0]->waitForHttpConnection(*dispatcher_);
+    }
+    FakeStreamPtr stream = backend_connection_->waitForNewStream(*dispatcher_);
+    stream->waitForEndStream(*dispatcher_);
+    stream->encodeHeaders(Http::TestHeaderMapImpl{{":status", "200"}}, true);
+    response->waitForEndStream();
+    auto latency = steady_clock::now() - start;
+    EXPECT_STREQ("200", response->headers().Status()->value().c_str());
+    return duration_cast<nanoseconds>(latency).count();
+  }
+
+  // Opens a connection to the listener, sends data answered by the backend,
+  // and returns the latency of the answer.
+  int64_t SendConnection(const std::string& listener) {
+    auto start = steady_clock::now();
+    IntegrationTcpClientPtr client = makeTcpConnection(lookupPort(listener));
+    client->write("hello");
+    FakeRawConnectionPtr backend = fake_upstreams_[2]->waitForRawConnection();
+    backend->waitForData(5);
+    backend->write("world");
+    client->waitForData("world");
+    auto latency = steady_clock::now() - start;
+    client->close();
+    backend->waitForDisconnect();
+    return duration_cast<nanoseconds>(latency).count();
+  }
+
+  // Waits for the filter counters to include all the Checks and Reports of
+  // the workload, and returns them per request.
+  FilterStats WaitForStats(const std::string& prefix) {
+    std::this_thread::sleep_for(kFlushWait);
+    test_server_->waitForCounterGe(prefix + "total_check_calls", num_requests_);
+    test_server_->waitForCounterGe(prefix + "total_report_calls",
+                                   num_requests_);
+    auto counter = [this, &prefix](const std::string& name) -> double {
+      return test_server_->counter(prefix + name)->value();
+    };
+    FilterStats stats;
+#ifdef ISTIO_ALLOC_ACCOUNTING
+    stats.allocations = std::to_string(
+        static_cast<int64_t>((counter("alloc_mixer_check_allocations") +
+                              counter("alloc_mixer_report_allocations")) /
+                             num_requests_));
+#else
+    stats.allocations = "-";
+#endif
+    stats.remote_checks =
+        counter("total_remote_check_calls") / counter("total_check_calls");
+    stats.remote_reports =
+        counter("total_remote_report_calls") / counter("total_report_calls");
+    return stats;
+  }
+
+  // Waits for the fake Mixer to stop, running the client connections meanwhile
+  // to send the call stopping it.
+  void WaitForMixerStopped() {
+    while (!mixer_->stopped()) {
+      dispatcher_->run(Event::Dispatcher::RunType::NonBlock);
+      std::this_thread::sleep_for(milliseconds(1));
+    }
+    mixer_->Join();
+  }
+
+ protected:
+  const int num_requests_;
+
+ private:
+  const milliseconds latency_;
+  const int valid_use_count_;
+  std::unique_ptr<FakeMixer> mixer_;
+  FakeHttpConnectionPtr backend_connection_;
+};
+
+INSTANTIATE_TEST_CASE_P(
+    IpVersions, MixerFilterBenchmark,
+    testing::ValuesIn(TestEnvironment::getIpVersionsForTest()));
+
+TEST_P(MixerFilterBenchmark, HttpHit) { RunHttp("http.hit", kNumHitRequests); }
+
+TEST_P(MixerFilterBenchmark, HttpMiss) { RunHttp("http.miss", num_requests_); }
+
+TEST_P(MixerFilterBenchmark, TcpHit) {
+  RunTcp("tcp.hit", {"destination.service", "source.ip"});
+}
+
+TEST_P(MixerFilterBenchmark, TcpMiss) {
+  RunTcp("tcp.miss", {"destination.service", "connection.id"});
+}
+
+}  // namespace Envoy
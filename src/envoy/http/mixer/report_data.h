@@ -31,14 +31,19 @@ const std::set<std::string> ResponseHeaderExclusives = {};
 
 class ReportData : public ::istio::control::http::ReportData {
   const HeaderMap *headers_;
+  const Utils::HeaderFilter *header_filter_;
   const RequestInfo::RequestInfo &info_;
   uint64_t response_total_size_;
   uint64_t request_total_size_;
 
  public:
+  // If header_filter is not nullptr, it selects the headers added by
+  // AddResponseHeaders().
   ReportData(const HeaderMap *headers, const RequestInfo::RequestInfo &info,
-             uint64_t request_total_size)
+             uint64_t request_total_size,
+             const Utils::HeaderFilter *header_filter = nullptr)
       : headers_(headers),
+        header_filter_(header_filter),
         info_(info),
         response_total_size_(info.bytesSent()),
         request_total_size_(request_total_size) {
@@ -54,6 +59,14 @@ class ReportData : public ::istio::control::http::ReportData {
     return std::map<std::string, std::string>();
   }
 
+  void AddResponseHeaders(
+      ::google::protobuf::Map<std::string, std::string> *headers)
+      const override {
+    if (headers_) {
+      Utils::ExtractHeaders(*headers_, header_filter_, headers);
+    }
+  }
+
   void GetReportInfo(
       ::istio::control::http::ReportData::ReportInfo *data) const override {
     data->request_body_size = info_.bytesReceived();
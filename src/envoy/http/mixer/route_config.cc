@@ -0,0 +1,93 @@
+/* Copyright 2018 Istio Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/envoy/http/mixer/route_config.h"
+
+#include "common/common/base64.h"
+#include "common/protobuf/utility.h"
+#include "src/envoy/utils/proto_log.h"
+#include "src/envoy/utils/utils.h"
+
+using ::istio::mixer::v1::config::client::ServiceConfig;
+using ::istio::utils::StringKey;
+
+namespace Envoy {
+namespace Http {
+namespace Mixer {
+
+bool RouteConfigCache::Lookup(
+    const std::string& sha,
+    std::shared_ptr<const PerRouteServiceConfig>* config) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  LRUCache::ScopedLookup lookup(&cache_, StringKey::Ref(sha));
+  if (!lookup.Found()) {
+    return false;
+  }
+  *config = lookup.value()->config;
+  return true;
+}
+
+std::shared_ptr<const PerRouteServiceConfig> RouteConfigCache::Get(
+    const std::string& sha, const std::string& config_base64,
+    const std::string& destination_service) {
+  std::shared_ptr<const PerRouteServiceConfig> config;
+  if (Lookup(sha, &config)) {
+    return config;
+  }
+
+  // Parse without the lock, the first parsed config of a sha is kept.
+  config = Parse(config_base64, destination_service);
+  std::lock_guard<std::mutex> lock(mutex_);
+  {
+    LRUCache::ScopedLookup lookup(&cache_, StringKey::Ref(sha));
+    if (lookup.Found()) {
+      return lookup.value()->config;
+    }
+  }
+  CacheElem* cache_elem = new CacheElem;
+  cache_elem->config = config;
+  cache_.Insert(StringKey::Ref(sha), cache_elem, 1);
+  if (config) {
+    ENVOY_LOG(info, "Service {}, config_id {}, config: {}",
+              destination_service, sha, Utils::ProtoSummary(config->config));
+    ENVOY_LOG(debug, "Service {} config: {}", destination_service,
+              Utils::ProtoDebugString(config->config));
+  }
+  return config;
+}
+
+std::shared_ptr<const PerRouteServiceConfig> RouteConfigCache::Parse(
+    const std::string& config_base64, const std::string& destination_service) {
+  std::string config_json = Base64::decode(config_base64);
+  if (config_json.empty()) {
+    ENVOY_LOG(warn, "Service {} invalid base64 config data",
+              destination_service);
+    return nullptr;
+  }
+  auto config = std::make_shared<PerRouteServiceConfig>();
+  auto status = Utils::ParseJsonMessage(config_json, &config->config);
+  if (!status.ok()) {
+    ENVOY_LOG(warn,
+              "Service {} failed to convert JSON config to protobuf, error: {}",
+              destination_service, status.ToString());
+    return nullptr;
+  }
+  config->hash = MessageUtil::hash(config->config);
+  return config;
+}
+
+}  // namespace Mixer
+}  // namespace Http
+}  // namespace Envoy
@@ -0,0 +1,77 @@
+/* Copyright 2018 Istio Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <memory>
+#include <mutex>
+
+#include "common/common/logger.h"
+#include "envoy/router/router.h"
+#include "include/istio/utils/simple_lru_cache.h"
+#include "include/istio/utils/simple_lru_cache_inl.h"
+#include "include/istio/utils/string_key.h"
+#include "mixer/v1/config/client/client_config.pb.h"
+
+namespace Envoy {
+namespace Http {
+namespace Mixer {
+
+// The struct to store per-route service config and its hash.
+struct PerRouteServiceConfig : public Router::RouteSpecificFilterConfig {
+  // The per_route service config.
+  ::istio::mixer::v1::config::client::ServiceConfig config;
+
+  // Its config hash, computed when the route is loaded.
+  uint64_t hash;
+};
+
+// The service configs of the v1 opaque route configs, parsed once and
+// shared by all worker threads. They are kept by their "mixer_sha".
+class RouteConfigCache : public Logger::Loggable<Logger::Id::config> {
+ public:
+  RouteConfigCache(int cache_size) : cache_(cache_size) {}
+  ~RouteConfigCache() { cache_.RemoveAll(); }
+
+  // Returns the config of a route with the sha, only parsing config_base64
+  // if the sha is not in the cache. Returns nullptr if it is not valid.
+  std::shared_ptr<const PerRouteServiceConfig> Get(
+      const std::string& sha, const std::string& config_base64,
+      const std::string& destination_service);
+
+  // Returns the cached config of the sha. Returns false if it is not in
+  // the cache, the config is nullptr if it is not valid.
+  bool Lookup(const std::string& sha,
+              std::shared_ptr<const PerRouteServiceConfig>* config);
+
+ private:
+  // Parses the base64 JSON config, returns nullptr if it is not valid.
+  std::shared_ptr<const PerRouteServiceConfig> Parse(
+      const std::string& config_base64, const std::string& destination_service);
+
+  struct CacheElem {
+    std::shared_ptr<const PerRouteServiceConfig> config;
+  };
+  using LRUCache =
+      ::istio::utils::SimpleLRUCache<::istio::utils::StringKey, CacheElem,
+                                     ::istio::utils::StringKey::Hash>;
+  // Mutex guarding cache_.
+  std::mutex mutex_;
+  LRUCache cache_;
+};
+
+}  // namespace Mixer
+}  // namespace Http
+}  // namespace Envoy
@@ -0,0 +1,74 @@
+/* Copyright 2018 Istio Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/envoy/tcp/mixer/check_admission.h"
+
+using std::chrono::steady_clock;
+
+namespace Envoy {
+namespace Tcp {
+namespace Mixer {
+namespace {
+
+// The moving average latency is only used for this long after its last
+// sample.
+const std::chrono::seconds kLatencyWindow(1);
+
+// The weight of a new latency sample is 1/kLatencyWeight.
+const int kLatencyWeight = 8;
+
+}  // namespace
+
+CheckAdmission::CheckAdmission(int max_pending_checks, int latency_budget_ms,
+                               bool fail_open)
+    : max_pending_checks_(max_pending_checks),
+      latency_budget_(latency_budget_ms),
+      fail_open_(fail_open),
+      pending_checks_(0),
+      latency_(steady_clock::duration::zero()) {}
+
+void CheckAdmission::SetLimits(int max_pending_checks, int latency_budget_ms,
+                               bool fail_open) {
+  max_pending_checks_ = max_pending_checks;
+  latency_budget_ = std::chrono::milliseconds(latency_budget_ms);
+  fail_open_ = fail_open;
+}
+
+CheckAdmission::Decision CheckAdmission::Admit(steady_clock::time_point now) {
+  bool overloaded =
+      (max_pending_checks_ > 0 && pending_checks_ >= max_pending_checks_) ||
+      (latency_budget_.count() > 0 && latency_ > latency_budget_ &&
+       now - latency_time_ < kLatencyWindow);
+  if (!overloaded) {
+    ++pending_checks_;
+    return Decision::Check;
+  }
+  if (!fail_open_) {
+    return Decision::Reject;
+  }
+  ++pending_checks_;
+  return Decision::CheckAsync;
+}
+
+void CheckAdmission::OnCheckDone(steady_clock::time_point start,
+                                 steady_clock::time_point now) {
+  --pending_checks_;
+  latency_ += (now - start - latency_) / kLatencyWeight;
+  latency_time_ = now;
+}
+
+}  // namespace Mixer
+}  // namespace Tcp
+}  // namespace Envoy
@@ -0,0 +1,76 @@
+/* Copyright 2018 Istio Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <chrono>
+
+namespace Envoy {
+namespace Tcp {
+namespace Mixer {
+
+// Tracks the Check calls of a worker thread, so the checks of new
+// connections are shed while Mixer is overloaded, instead of holding the
+// connections for a slow Check call. The worker is overloaded while too
+// many checks are pending, or while the recent check latency is over the
+// budget.
+class CheckAdmission {
+ public:
+  enum class Decision {
+    // Make a Check call before reading the connection.
+    Check,
+    // Read the connection while the Check call is pending.
+    CheckAsync,
+    // Close the connection without a Check call.
+    Reject,
+  };
+
+  // A threshold of 0 is not used. If fail_open is true, an overloaded
+  // worker checks asynchronously, otherwise it rejects the connections.
+  CheckAdmission(int max_pending_checks, int latency_budget_ms,
+                 bool fail_open);
+
+  // Changes the thresholds and the policy. The pending checks and the
+  // latency are kept.
+  void SetLimits(int max_pending_checks, int latency_budget_ms,
+                 bool fail_open);
+
+  // Decides how to check a new connection. Unless it is Reject, the check
+  // is pending until OnCheckDone() or OnCheckCancelled() is called.
+  Decision Admit(std::chrono::steady_clock::time_point now);
+
+  // Called when a check is done, to record its latency.
+  void OnCheckDone(std::chrono::steady_clock::time_point start,
+                   std::chrono::steady_clock::time_point now);
+
+  // Called when a check is cancelled.
+  void OnCheckCancelled() { --pending_checks_; }
+
+ private:
+  int max_pending_checks_;
+  std::chrono::milliseconds latency_budget_;
+  bool fail_open_;
+  // The number of pending checks.
+  int pending_checks_;
+  // The moving average of the check latency, and the time of its last
+  // sample. An old average is not used, so a worker rejecting all checks
+  // tries again.
+  std::chrono::steady_clock::duration latency_;
+  std::chrono::steady_clock::time_point latency_time_;
+};
+
+}  // namespace Mixer
+}  // namespace Tcp
+}  // namespace Envoy
@@ -0,0 +1,123 @@
+/* Copyright 2018 Istio Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/envoy/tcp/mixer/check_admission.h"
+#include "gtest/gtest.h"
+
+using std::chrono::milliseconds;
+using std::chrono::steady_clock;
+
+namespace Envoy {
+namespace Tcp {
+namespace Mixer {
+namespace {
+
+typedef CheckAdmission::Decision Decision;
+
+TEST(CheckAdmissionTest, TestNoThresholds) {
+  CheckAdmission admission(0, 0, false);
+  steady_clock::time_point now = steady_clock::now();
+  for (int i = 0; i < 100; ++i) {
+    EXPECT_EQ(admission.Admit(now), Decision::Check);
+  }
+  // A slow check doesn't shed the other ones without a budget.
+  admission.OnCheckDone(now, now + std::chrono::seconds(10));
+  EXPECT_EQ(admission.Admit(now + std::chrono::seconds(10)), Decision::Check);
+}
+
+TEST(CheckAdmissionTest, TestMaxPendingChecks) {
+  CheckAdmission admission(2, 0, false);
+  steady_clock::time_point now = steady_clock::now();
+  EXPECT_EQ(admission.Admit(now), Decision::Check);
+  EXPECT_EQ(admission.Admit(now), Decision::Check);
+  EXPECT_EQ(admission.Admit(now), Decision::Reject);
+  // A rejected connection has no pending check to release.
+  EXPECT_EQ(admission.Admit(now), Decision::Reject);
+
+  // Both a done and a cancelled check release their slot.
+  admission.OnCheckDone(now, now + milliseconds(1));
+  EXPECT_EQ(admission.Admit(now), Decision::Check);
+  EXPECT_EQ(admission.Admit(now), Decision::Reject);
+  admission.OnCheckCancelled();
+  EXPECT_EQ(admission.Admit(now), Decision::Check);
+  EXPECT_EQ(admission.Admit(now), Decision::Reject);
+}
+
+TEST(CheckAdmissionTest, TestLatencyBudget) {
+  CheckAdmission admission(0, 10, false);
+  steady_clock::time_point now = steady_clock::now();
+  for (int i = 0; i < 3; ++i) {
+    EXPECT_EQ(admission.Admit(now), Decision::Check);
+  }
+  // The average moves by 1/8 of each sample: 100ms gives 12.5ms.
+  admission.OnCheckDone(now, now + milliseconds(100));
+  now += milliseconds(100);
+  EXPECT_EQ(admission.Admit(now), Decision::Reject);
+
+  // Then 12.5 * 7 / 8 = 10.9ms, still over the budget, and 9.6ms.
+  admission.OnCheckDone(now, now);
+  EXPECT_EQ(admission.Admit(now), Decision::Reject);
+  admission.OnCheckDone(now, now);
+  EXPECT_EQ(admission.Admit(now), Decision::Check);
+}
+
+TEST(CheckAdmissionTest, TestLatencyWindow) {
+  CheckAdmission admission(0, 10, false);
+  steady_clock::time_point now = steady_clock::now();
+  EXPECT_EQ(admission.Admit(now), Decision::Check);
+  admission.OnCheckDone(now, now + milliseconds(100));
+  now += milliseconds(100);
+  EXPECT_EQ(admission.Admit(now + milliseconds(999)), Decision::Reject);
+  // Without a recent sample, a worker rejecting all checks tries again.
+  EXPECT_EQ(admission.Admit(now + milliseconds(1000)), Decision::Check);
+}
+
+TEST(CheckAdmissionTest, TestFailOpenStillChecks) {
+  CheckAdmission admission(1, 0, true);
+  steady_clock::time_point now = steady_clock::now();
+  EXPECT_EQ(admission.Admit(now), Decision::Check);
+  // An overloaded worker still checks the connections, asynchronously, and
+  // they are pending.
+  EXPECT_EQ(admission.Admit(now), Decision::CheckAsync);
+  EXPECT_EQ(admission.Admit(now), Decision::CheckAsync);
+
+  admission.OnCheckDone(now, now);
+  admission.OnCheckCancelled();
+  EXPECT_EQ(admission.Admit(now), Decision::CheckAsync);
+  admission.OnCheckDone(now, now);
+  admission.OnCheckDone(now, now);
+  EXPECT_EQ(admission.Admit(now), Decision::Check);
+}
+
+TEST(CheckAdmissionTest, TestSetLimits) {
+  CheckAdmission admission(1, 0, false);
+  steady_clock::time_point now = steady_clock::now();
+  EXPECT_EQ(admission.Admit(now), Decision::Check);
+  EXPECT_EQ(admission.Admit(now), Decision::Reject);
+
+  // The pending check counts against the new thresholds.
+  admission.SetLimits(2, 0, false);
+  EXPECT_EQ(admission.Admit(now), Decision::Check);
+  EXPECT_EQ(admission.Admit(now), Decision::Reject);
+  admission.SetLimits(2, 0, true);
+  EXPECT_EQ(admission.Admit(now), Decision::CheckAsync);
+  admission.SetLimits(0, 0, false);
+  EXPECT_EQ(admission.Admit(now), Decision::Check);
+}
+
+}  // namespace
+}  // namespace Mixer
+}  // namespace Tcp
+}  // namespace Envoy
@@ -21,27 +21,103 @@ using ::istio::mixerclient::Statistics;
 namespace Envoy {
 namespace Tcp {
 namespace Mixer {
+namespace {
+
+// The interval to re-read the admission options from runtime.
+const int kRuntimeRefreshIntervalMs = 1000;
+
+// The runtime keys of the thresholds over which a worker is overloaded:
+// the number of pending checks, and the recent check latency in
+// milliseconds. 0 disables a threshold.
+const std::string kMaxPendingChecksRuntimeKey("mixer.tcp_max_pending_checks");
+const std::string kCheckLatencyBudgetRuntimeKey(
+    "mixer.tcp_check_latency_budget_ms");
+
+// The runtime key to proxy the new connections of an overloaded worker
+// while their checks are pending. Otherwise they are closed.
+const std::string kOverloadFailOpenRuntimeKey("mixer.tcp_overload_fail_open");
+
+}  // namespace
+
+void ReadAdmissionRuntimeOptions(const Runtime::Snapshot& snapshot,
+                                 RuntimeOptions* options) {
+  options->max_pending_checks =
+      snapshot.getInteger(kMaxPendingChecksRuntimeKey, 0);
+  options->check_latency_budget_ms =
+      snapshot.getInteger(kCheckLatencyBudgetRuntimeKey, 0);
+  options->overload_fail_open =
+      snapshot.getInteger(kOverloadFailOpenRuntimeKey, 0) != 0;
+}
 
 Control::Control(const Config& config, Upstream::ClusterManager& cm,
                  Event::Dispatcher& dispatcher,
-                 Runtime::RandomGenerator& random, Stats::Scope& scope,
-                 Utils::MixerFilterStats& stats, const std::string& uuid)
+                 Runtime::RandomGenerator& random, Runtime::Loader& runtime,
+                 Stats::Scope& scope, Utils::MixerFilterStats& stats,
+                 const std::string& uuid,
+                 const RuntimeOptions& runtime_options)
     : config_(config),
       dispatcher_(dispatcher),
+      report_scheduler_(dispatcher, config_.report_interval_ms()),
+      check_admission_(runtime_options.max_pending_checks,
+                       runtime_options.check_latency_budget_ms,
+                       runtime_options.overload_fail_open),
       check_client_factory_(Utils::GrpcClientFactoryForCluster(
           config_.check_cluster(), cm, scope)),
       report_client_factory_(Utils::GrpcClientFactoryForCluster(
           config_.report_cluster(), cm, scope)),
+      check_client_(check_client_factory_->create()),
+      report_client_(config_.report_cluster() == config_.check_cluster()
+                         ? nullptr
+                         : report_client_factory_->create()),
+      stats_(stats),
       stats_obj_(dispatcher, stats,
                  config_.config_pb().transport().stats_update_interval(),
                  [this](Statistics* stat) -> bool { return GetStats(stat); }),
-      uuid_(uuid) {
+      uuid_(uuid),
+      runtime_(runtime) {
+  stats_obj_.PublishTo(Utils::MixerStatsRegistry::Get(), "tcp");
   ::istio::control::tcp::Controller::Options options(config_.config_pb());
+  options.connection_decision_ttl_ms =
+      runtime_options.connection_decision_ttl_ms;
 
-  Utils::CreateEnvironment(dispatcher, random, *check_client_factory_,
-                           *report_client_factory_, &options.env);
+  Utils::CreateEnvironment(dispatcher, random, *check_client_,
+                           report_client_ ? *report_client_ : *check_client_,
+                           &options.env);
+  options.env.stats_sink = std::make_shared<Utils::MixerStatsSink>(stats);
+  options.env.traffic_capture = runtime_options.traffic_capture;
+  options.env.check_transport =
+      Utils::RecordCheckStats(options.env.check_transport, stats);
+  options.env.report_transport =
+      Utils::RecordReportStats(options.env.report_transport, stats);
+  if (runtime_options.shared_report_batch) {
+    options.shared_report_batch = Utils::GetSharedReportBatch(
+        config_.report_cluster(), false,
+        ::istio::control::tcp::Controller::SharedReportBatchKey(options), cm,
+        dispatcher, random, scope,
+        [&options](const ::istio::mixerclient::Environment& env) {
+          ::istio::control::tcp::Controller::Options batch_options(options);
+          batch_options.env = env;
+          return ::istio::control::tcp::Controller::CreateSharedReportBatch(
+              batch_options);
+        });
+  }
 
   controller_ = ::istio::control::tcp::Controller::Create(options);
+
+  runtime_timer_ =
+      dispatcher.createTimer([this]() { RefreshRuntimeOptions(); });
+  runtime_timer_->enableTimer(
+      std::chrono::milliseconds(kRuntimeRefreshIntervalMs));
+}
+
+void Control::RefreshRuntimeOptions() {
+  RuntimeOptions runtime_options;
+  ReadAdmissionRuntimeOptions(runtime_.snapshot(), &runtime_options);
+  check_admission_.SetLimits(runtime_options.max_pending_checks,
+                             runtime_options.check_latency_budget_ms,
+                             runtime_options.overload_fail_open);
+  runtime_timer_->enableTimer(
+      std::chrono::milliseconds(kRuntimeRefreshIntervalMs));
 }
 
 // Call controller to get statistics.
@@ -20,20 +20,51 @@
 #include "envoy/thread_local/thread_local.h"
 #include "envoy/upstream/cluster_manager.h"
 #include "include/istio/control/tcp/controller.h"
+#include "src/envoy/tcp/mixer/check_admission.h"
 #include "src/envoy/tcp/mixer/config.h"
+#include "src/envoy/tcp/mixer/report_scheduler.h"
+#include "src/envoy/utils/mixer_control.h"
 #include "src/envoy/utils/stats.h"
 
 namespace Envoy {
 namespace Tcp {
 namespace Mixer {
 
+// The options set by runtime keys, see the README.md of the HTTP filter.
+// The admission options, read by ReadAdmissionRuntimeOptions(), follow the
+// runtime while the listener runs. The other ones are read once when the
+// listener is created.
+struct RuntimeOptions {
+  // If positive, how long a connection decision is cached.
+  int connection_decision_ttl_ms = 0;
+  // If positive, the thresholds of pending checks and of the check latency
+  // over which a worker is overloaded.
+  int max_pending_checks = 0;
+  int check_latency_budget_ms = 0;
+  // If true, an overloaded worker proxies new connections while their
+  // checks are pending, otherwise it closes them.
+  bool overload_fail_open = false;
+  // If not nullptr, the capture of the sampled calls.
+  std::shared_ptr<::istio::mixerclient::TrafficCapture> traffic_capture;
+  // If true, the reports are batched with the ones of the HTTP filter with
+  // the same report cluster and options.
+  bool shared_report_batch = false;
+};
+
+// Reads the admission options: the overload thresholds of the pending
+// checks, and the policy of an overloaded worker.
+void ReadAdmissionRuntimeOptions(const Runtime::Snapshot& snapshot,
+                                 RuntimeOptions* options);
+
 class Control final : public ThreadLocal::ThreadLocalObject {
  public:
-  // The constructor.
+  // The constructor. The admission options are re-read from runtime every
+  // second.
   Control(const Config& config, Upstream::ClusterManager& cm,
           Event::Dispatcher& dispatcher, Runtime::RandomGenerator& random,
-          Stats::Scope& scope, Utils::MixerFilterStats& stats,
-          const std::string& uuid);
+          Runtime::Loader& runtime, Stats::Scope& scope,
+          Utils::MixerFilterStats& stats, const std::string& uuid,
+          const RuntimeOptions& runtime_options);
 
   ::istio::control::tcp::Controller* controller() { return controller_.get(); }
 
@@ -43,10 +74,19 @@ class Control final : public ThreadLocal::ThreadLocalObject {
 
   const Config& config() const { return config_; }
 
+  ReportScheduler& report_scheduler() { return report_scheduler_; }
+
+  CheckAdmission& check_admission() { return check_admission_; }
+
+  Utils::MixerFilterStats& stats() { return stats_; }
+
  private:
   // Call controller to get statistics.
   bool GetStats(::istio::mixerclient::Statistics* stat);
 
+  // Re-reads the admission options, and re-arms runtime_timer_.
+  void RefreshRuntimeOptions();
+
   // The mixer config.
   const Config& config_;
   // The mixer control
@@ -54,15 +94,28 @@ class Control final : public ThreadLocal::ThreadLocalObject {
 
   // dispatcher.
   Event::Dispatcher& dispatcher_;
+  // The periodical reports of all connections of this worker.
+  ReportScheduler report_scheduler_;
+  // The pending checks of this worker.
+  CheckAdmission check_admission_;
 
   // async client factories
   Grpc::AsyncClientFactoryPtr check_client_factory_;
   Grpc::AsyncClientFactoryPtr report_client_factory_;
+  // async clients shared by all calls of this worker. report_client_ is
+  // nullptr if report calls go to the check cluster and share its client.
+  Grpc::AsyncClientPtr check_client_;
+  Grpc::AsyncClientPtr report_client_;
 
   // statistics
+  Utils::MixerFilterStats& stats_;
   Utils::MixerStatsObject stats_obj_;
   // UUID of the Envoy TCP mixer filter.
   const std::string& uuid_;
+  // The runtime of the admission options.
+  Runtime::Loader& runtime_;
+  // The timer to re-read the admission options.
+  Event::TimerPtr runtime_timer_;
 };
 
 }  // namespace Mixer
@@ -25,6 +25,12 @@ namespace {
 // Envoy stats perfix for TCP filter stats.
 const std::string kTcpStatsPrefix("tcp_mixer_filter.");
 
+// The runtime key for how long in milliseconds a connection allowed by a
+// check cache hit lets the next connections from the same source principal
+// and IP to the same local address skip the Check call. 0 disables it.
+const std::string kConnectionDecisionTtlRuntimeKey(
+    "mixer.tcp_connection_decision_ttl_ms");
+
 }  // namespace
 
 class ControlFactory : public Logger::Loggable<Logger::Id::filter> {
@@ -37,11 +43,21 @@ class ControlFactory : public Logger::Loggable<Logger::Id::filter> {
         stats_(generateStats(kTcpStatsPrefix, context.scope())),
         uuid_(context.random().uuid()) {
     Runtime::RandomGenerator& random = context.random();
+    Runtime::Loader& runtime = context.runtime();
     Stats::Scope& scope = context.scope();
-    tls_->set([this, &random, &scope](Event::Dispatcher& dispatcher)
+    const auto& snapshot = context.runtime().snapshot();
+    runtime_options_.connection_decision_ttl_ms =
+        snapshot.getInteger(kConnectionDecisionTtlRuntimeKey, 0);
+    ReadAdmissionRuntimeOptions(snapshot, &runtime_options_);
+    runtime_options_.traffic_capture = Utils::GetTrafficCapture(snapshot);
+    runtime_options_.shared_report_batch =
+        Utils::SharedReportBatchEnabled(snapshot);
+    Utils::MixerStatsRegistry::Get().AddAdminHandler(context.admin());
+    tls_->set([this, &random, &runtime, &scope](Event::Dispatcher& dispatcher)
                   -> ThreadLocal::ThreadLocalObjectSharedPtr {
       return ThreadLocal::ThreadLocalObjectSharedPtr(
-          new Control(*config_, cm_, dispatcher, random, scope, stats_, uuid_));
+          new Control(*config_, cm_, dispatcher, random, runtime, scope,
+                      stats_, uuid_, runtime_options_));
     });
   }
 
@@ -52,7 +68,9 @@ class ControlFactory : public Logger::Loggable<Logger::Id::filter> {
   // Generates stats struct.
   static Utils::MixerFilterStats generateStats(const std::string& name,
                                                Stats::Scope& scope) {
-    return {ALL_MIXER_FILTER_STATS(POOL_COUNTER_PREFIX(scope, name))};
+    return {ALL_MIXER_FILTER_STATS(POOL_COUNTER_PREFIX(scope, name),
+                                   POOL_GAUGE_PREFIX(scope, name),
+                                   POOL_HISTOGRAM_PREFIX(scope, name))};
   }
 
   // The config object
@@ -65,6 +83,8 @@ class ControlFactory : public Logger::Loggable<Logger::Id::filter> {
   Utils::MixerFilterStats stats_;
   // UUID of the Envoy TCP mixer filter.
   const std::string uuid_;
+  // The options set by runtime keys, as the listener is created.
+  RuntimeOptions runtime_options_;
 };
 
 }  // namespace Mixer
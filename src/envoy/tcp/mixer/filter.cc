@@ -29,6 +29,7 @@ Filter::Filter(Control& control) : control_(control) {
 
 Filter::~Filter() {
   cancelCheck();
+  stopReports();
   ENVOY_LOG(debug, "Called tcp filter : {}", __func__);
 }
 
@@ -37,14 +38,23 @@ void Filter::initializeReadFilterCallbacks(
   ENVOY_LOG(debug, "Called tcp filter: {}", __func__);
   filter_callbacks_ = &callbacks;
   filter_callbacks_->connection().addConnectionCallbacks(*this);
-  start_time_ = std::chrono::system_clock::now();
+  start_time_ = std::chrono::steady_clock::now();
+
+  // The unique downstream connection ID is <uuid>-<connection id>.
+  char connection_id_str[32];
+  StringUtil::itoa(connection_id_str, 32, filter_callbacks_->connection().id());
+  connection_id_ = control_.uuid() + "-";
+  connection_id_.append(connection_id_str);
 }
 
 void Filter::cancelCheck() {
-  if (state_ != State::Calling) {
+  state_ = State::Closed;
+  if (!check_pending_) {
     cancel_check_ = nullptr;
+    return;
   }
-  state_ = State::Closed;
+  check_pending_ = false;
+  control_.check_admission().OnCheckCancelled();
   if (cancel_check_) {
     ENVOY_LOG(debug, "Cancelling check call");
     cancel_check_();
@@ -54,10 +64,29 @@ void Filter::cancelCheck() {
 
 // Makes a Check() call to Mixer.
 void Filter::callCheck() {
-  handler_ = control_.controller()->CreateRequestHandler();
+  CheckAdmission::Decision decision =
+      control_.check_admission().Admit(std::chrono::steady_clock::now());
+  if (decision == CheckAdmission::Decision::Reject) {
+    ENVOY_CONN_LOG(debug, "Mixer checks are overloaded, closing connection",
+                   filter_callbacks_->connection());
+    state_ = State::Closed;
+    filter_callbacks_->connection().close(
+        Network::ConnectionCloseType::NoFlush);
+    return;
+  }
 
-  state_ = State::Calling;
-  filter_callbacks_->connection().readDisable(true);
+  handler_ = control_.controller()->CreateRequestHandler();
+  check_pending_ = true;
+  check_start_time_ = std::chrono::steady_clock::now();
+  if (decision == CheckAdmission::Decision::CheckAsync) {
+    // The connection is proxied while the check is pending, and closed if
+    // the check fails.
+    state_ = State::Completed;
+    startReports();
+  } else {
+    state_ = State::Calling;
+    filter_callbacks_->connection().readDisable(true);
+  }
   calling_check_ = true;
   cancel_check_ = handler_->Check(
       this, [this](const Status& status) { completeCheck(status); });
@@ -66,6 +95,12 @@ void Filter::callCheck() {
 
 // Network::ReadFilter
 Network::FilterStatus Filter::onData(Buffer::Instance& data, bool) {
+  // Once the connection is proxied, the filter only counts the bytes.
+  if (state_ == State::Completed) {
+    received_bytes_ += data.length();
+    return Network::FilterStatus::Continue;
+  }
+
   if (state_ == State::NotStarted) {
     // By waiting to invoke the callCheck() at onData(), the call to Mixer
     // will have sufficient SSL information to fill the check Request.
@@ -76,14 +111,14 @@ Network::FilterStatus Filter::onData(Buffer::Instance& data, bool) {
                  filter_callbacks_->connection(), data.length());
   received_bytes_ += data.length();
 
-  return state_ == State::Calling ? Network::FilterStatus::StopIteration
-                                  : Network::FilterStatus::Continue;
+  return state_ == State::Completed ? Network::FilterStatus::Continue
+                                    : Network::FilterStatus::StopIteration;
 }
 
 // Network::WriteFilter
 Network::FilterStatus Filter::onWrite(Buffer::Instance& data, bool) {
-  ENVOY_CONN_LOG(debug, "Called tcp filter onWrite bytes: {}",
-                 filter_callbacks_->connection(), data.length());
+  // Called for every buffer written to the connection, it only counts the
+  // bytes.
   send_bytes_ += data.length();
   return Network::FilterStatus::Continue;
 }
@@ -102,22 +137,33 @@ Network::FilterStatus Filter::onNewConnection() {
 void Filter::completeCheck(const Status& status) {
   ENVOY_LOG(debug, "Called tcp filter completeCheck: {}", status.ToString());
   cancel_check_ = nullptr;
-  if (state_ == State::Closed) {
+  if (!check_pending_) {
     return;
   }
+  check_pending_ = false;
+  control_.check_admission().OnCheckDone(check_start_time_,
+                                        std::chrono::steady_clock::now());
+
+  // An asynchronous check completes after the connection is proxied.
+  bool async_check = state_ == State::Completed;
   state_ = State::Completed;
-  filter_callbacks_->connection().readDisable(false);
+  if (!async_check) {
+    filter_callbacks_->connection().readDisable(false);
+    if (!calling_check_) {
+      Utils::RecordCheckBlocked(control_.stats(),
+                                handler_->check_miss_reason(),
+                                check_start_time_);
+    }
+  }
 
   if (!status.ok()) {
     filter_callbacks_->connection().close(
         Network::ConnectionCloseType::NoFlush);
-  } else {
+  } else if (!async_check) {
     if (!calling_check_) {
       filter_callbacks_->continueReading();
     }
-    report_timer_ =
-        control_.dispatcher().createTimer([this]() { OnReportTimer(); });
-    report_timer_->enableTimer(control_.config().report_interval_ms());
+    startReports();
   }
 }
 
@@ -134,9 +180,7 @@ void Filter::onEvent(Network::ConnectionEvent event) {
   if (event == Network::ConnectionEvent::RemoteClose ||
       event == Network::ConnectionEvent::LocalClose) {
     if (state_ != State::Closed && handler_) {
-      if (report_timer_) {
-        report_timer_->disableTimer();
-      }
+      stopReports();
       handler_->Report(this, /* is_final_report */ true);
     }
     cancelCheck();
@@ -155,6 +199,11 @@ bool Filter::IsMutualTLS() const {
   return Utils::IsMutualTLS(&filter_callbacks_->connection());
 }
 
+bool Filter::GetLocalAddress(std::string* address) const {
+  *address = filter_callbacks_->connection().localAddress()->asString();
+  return true;
+}
+
 bool Filter::GetDestinationIpPort(std::string* str_ip, int* port) const {
   if (filter_callbacks_->upstreamHost() &&
       filter_callbacks_->upstreamHost()->address()) {
@@ -168,20 +217,26 @@ void Filter::GetReportInfo(
   data->received_bytes = received_bytes_;
   data->send_bytes = send_bytes_;
   data->duration = std::chrono::duration_cast<std::chrono::nanoseconds>(
-      std::chrono::system_clock::now() - start_time_);
+      std::chrono::steady_clock::now() - start_time_);
 }
 
-std::string Filter::GetConnectionId() const {
-  char connection_id_str[32];
-  StringUtil::itoa(connection_id_str, 32, filter_callbacks_->connection().id());
-  std::string uuid_connection_id = control_.uuid() + "-";
-  uuid_connection_id.append(connection_id_str);
-  return uuid_connection_id;
-}
+std::string Filter::GetConnectionId() const { return connection_id_; }
 
 void Filter::OnReportTimer() {
   handler_->Report(this, /* is_final_report */ false);
-  report_timer_->enableTimer(control_.config().report_interval_ms());
+}
+
+void Filter::startReports() {
+  report_handle_ =
+      control_.report_scheduler().Add([this]() { OnReportTimer(); });
+  report_scheduled_ = true;
+}
+
+void Filter::stopReports() {
+  if (report_scheduled_) {
+    control_.report_scheduler().Remove(report_handle_);
+    report_scheduled_ = false;
+  }
 }
 
 }  // namespace Mixer
@@ -53,6 +53,7 @@ class Filter : public Network::Filter,
   bool GetSourceIpPort(std::string* str_ip, int* port) const override;
   bool GetSourceUser(std::string* user) const override;
   bool IsMutualTLS() const override;
+  bool GetLocalAddress(std::string* address) const override;
 
   // ReportData virtual functions.
   bool GetDestinationIpPort(std::string* str_ip, int* port) const override;
@@ -61,11 +62,17 @@ class Filter : public Network::Filter,
   std::string GetConnectionId() const override;
 
  private:
+  // The connection is proxied in the Completed state, also while an
+  // asynchronous Check call is pending.
   enum class State { NotStarted, Calling, Completed, Closed };
-  // This function is invoked when timer event fires.
+  // This function is invoked by the report scheduler.
   // It sends periodical delta reports.
   void OnReportTimer();
 
+  // Starts and stops the periodical delta reports.
+  void startReports();
+  void stopReports();
+
   // Makes a Check() call to Mixer.
   void callCheck();
 
@@ -87,15 +94,22 @@ class Filter : public Network::Filter,
   State state_{State::NotStarted};
   // calling_check
   bool calling_check_{};
+  // True if the Check call is pending, and its start time.
+  bool check_pending_{};
+  std::chrono::steady_clock::time_point check_start_time_;
   // received bytes
   uint64_t received_bytes_{};
   // send bytes
   uint64_t send_bytes_{};
 
-  // Timer that periodically sends reports.
-  Event::TimerPtr report_timer_;
-  // start_time
-  std::chrono::time_point<std::chrono::system_clock> start_time_;
+  // The handle of this connection in the report scheduler, only valid if
+  // report_scheduled_ is true.
+  ReportScheduler::Handle report_handle_;
+  bool report_scheduled_{};
+  // start_time, on the monotonic clock for the connection duration.
+  std::chrono::steady_clock::time_point start_time_;
+  // The connection id, built once for the connection.
+  std::string connection_id_;
 };
 
 }  // namespace Mixer
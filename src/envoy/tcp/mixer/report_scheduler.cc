@@ -0,0 +1,80 @@
+/* Copyright 2018 Istio Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/envoy/tcp/mixer/report_scheduler.h"
+
+namespace Envoy {
+namespace Tcp {
+namespace Mixer {
+namespace {
+
+// The number of buckets of the timer wheel. A connection reports between
+// (kNumBuckets - 1) / kNumBuckets and one interval after it is added.
+const int kNumBuckets = 10;
+
+}  // namespace
+
+ReportScheduler::ReportScheduler(Event::Dispatcher& dispatcher,
+                                 std::chrono::milliseconds interval)
+    : dispatcher_(dispatcher),
+      tick_(interval / kNumBuckets),
+      buckets_(kNumBuckets),
+      next_bucket_(0),
+      size_(0),
+      sweeping_(false) {}
+
+ReportScheduler::Handle ReportScheduler::Add(ReportFunc report) {
+  if (!timer_) {
+    timer_ = dispatcher_.createTimer([this]() { OnTimer(); });
+  }
+  if (size_++ == 0) {
+    timer_->enableTimer(tick_);
+  }
+  // The last swept bucket is the last one to be swept again.
+  size_t bucket = (next_bucket_ + kNumBuckets - 1) % kNumBuckets;
+  buckets_[bucket].push_back(std::move(report));
+  return {bucket, std::prev(buckets_[bucket].end())};
+}
+
+void ReportScheduler::Remove(const Handle& handle) {
+  if (--size_ == 0 && !sweeping_) {
+    timer_->disableTimer();
+  }
+  if (sweeping_ && handle.bucket == next_bucket_) {
+    *handle.it = nullptr;
+    return;
+  }
+  buckets_[handle.bucket].erase(handle.it);
+}
+
+void ReportScheduler::OnTimer() {
+  auto& bucket = buckets_[next_bucket_];
+  sweeping_ = true;
+  for (auto& report : bucket) {
+    if (report) {
+      report();
+    }
+  }
+  sweeping_ = false;
+  bucket.remove_if([](const ReportFunc& report) { return !report; });
+  next_bucket_ = (next_bucket_ + 1) % kNumBuckets;
+  if (size_ > 0) {
+    timer_->enableTimer(tick_);
+  }
+}
+
+}  // namespace Mixer
+}  // namespace Tcp
+}  // namespace Envoy
@@ -0,0 +1,76 @@
+/* Copyright 2018 Istio Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <functional>
+#include <list>
+#include <vector>
+
+#include "envoy/event/dispatcher.h"
+#include "envoy/event/timer.h"
+
+namespace Envoy {
+namespace Tcp {
+namespace Mixer {
+
+// Sends the periodical reports of all TCP connections of a worker thread
+// with one timer. The connections are kept in the buckets of a timer wheel
+// swept in turn, so each connection reports once per interval, and the
+// reports of a bucket are added to the report batch together.
+class ReportScheduler {
+ public:
+  using ReportFunc = std::function<void()>;
+
+  // The handle of a connection added to the scheduler.
+  struct Handle {
+    size_t bucket;
+    std::list<ReportFunc>::iterator it;
+  };
+
+  ReportScheduler(Event::Dispatcher& dispatcher,
+                  std::chrono::milliseconds interval);
+
+  // Adds a connection whose report is called once per interval, the first
+  // time in about one interval.
+  Handle Add(ReportFunc report);
+
+  // Removes a connection, its report is not called any more.
+  void Remove(const Handle& handle);
+
+ private:
+  // Calls the reports of the next bucket.
+  void OnTimer();
+
+  Event::Dispatcher& dispatcher_;
+  // The timer interval, a slice of the report interval.
+  std::chrono::milliseconds tick_;
+  // The timer, only enabled if there are connections.
+  Event::TimerPtr timer_;
+  // The buckets of the timer wheel.
+  std::vector<std::list<ReportFunc>> buckets_;
+  // The bucket to sweep next.
+  size_t next_bucket_;
+  // The number of connections.
+  size_t size_;
+  // True while the reports of a bucket are called. The connections removed
+  // from the bucket meanwhile are erased after the sweep.
+  bool sweeping_;
+};
+
+}  // namespace Mixer
+}  // namespace Tcp
+}  // namespace Envoy
@@ -14,9 +14,11 @@
  */
 
 #include "src/envoy/utils/authn.h"
-#include "common/common/base64.h"
+#include "include/istio/utils/base64.h"
 #include "src/istio/authn/context.pb.h"
 
+#include <unordered_map>
+
 using istio::authn::Result;
 
 namespace Envoy {
@@ -26,6 +28,15 @@ namespace {
 // The HTTP header to save authentication result.
 const Http::LowerCaseString kAuthenticationOutputHeaderLocation(
     "sec-istio-authn-payload");
+
+// The authentication results of the streams on this thread, indexed by the
+// request headers of each stream. The filters of a stream all run on the
+// thread of its connection and see the same request headers.
+std::unordered_map<const Http::HeaderMap*, Result>& StreamResults() {
+  static thread_local std::unordered_map<const Http::HeaderMap*, Result>
+      results;
+  return results;
+}
 }  // namespace
 
 bool Authentication::SaveResultToHeader(const istio::authn::Result& result,
@@ -39,7 +50,7 @@ bool Authentication::SaveResultToHeader(const istio::authn::Result& result,
   std::string payload_data;
   result.SerializeToString(&payload_data);
   headers->addCopy(kAuthenticationOutputHeaderLocation,
-                   Base64::encode(payload_data.c_str(), payload_data.size()));
+                   ::istio::utils::Base64Encode(payload_data));
   return true;
 }
 
@@ -49,8 +60,11 @@ bool Authentication::FetchResultFromHeader(const Http::HeaderMap& headers,
   if (entry == nullptr) {
     return false;
   }
-  std::string value(entry->value().c_str(), entry->value().size());
-  return result->ParseFromString(Base64::decode(value));
+  std::string payload_data;
+  ::istio::utils::Base64Decode(
+      absl::string_view(entry->value().c_str(), entry->value().size()),
+      &payload_data);
+  return result->ParseFromString(payload_data);
 }
 
 void Authentication::ClearResultInHeader(Http::HeaderMap* headers) {
@@ -61,6 +75,42 @@ bool Authentication::HasResultInHeader(const Http::HeaderMap& headers) {
   return headers.get(kAuthenticationOutputHeaderLocation) != nullptr;
 }
 
+void Authentication::SaveResultToStream(const istio::authn::Result& result,
+                                        const Http::HeaderMap& headers) {
+  StreamResults()[&headers] = result;
+}
+
+bool Authentication::FetchResult(const Http::HeaderMap& headers,
+                                 istio::authn::Result* result) {
+  const auto& results = StreamResults();
+  auto it = results.find(&headers);
+  if (it != results.end()) {
+    *result = it->second;
+    return true;
+  }
+  return FetchResultFromHeader(headers, result);
+}
+
+const istio::authn::Result* Authentication::FindResultInStream(
+    const Http::HeaderMap& headers) {
+  const auto& results = StreamResults();
+  auto it = results.find(&headers);
+  return it != results.end() ? &it->second : nullptr;
+}
+
+void Authentication::ClearResultInStream(const Http::HeaderMap& headers) {
+  StreamResults().erase(&headers);
+}
+
+void Authentication::ClearResult(Http::HeaderMap* headers) {
+  ClearResultInStream(*headers);
+  ClearResultInHeader(headers);
+}
+
+bool Authentication::HasResultInStream(const Http::HeaderMap& headers) {
+  return StreamResults().count(&headers) > 0;
+}
+
 const Http::LowerCaseString& Authentication::GetHeaderLocation() {
   return kAuthenticationOutputHeaderLocation;
 }
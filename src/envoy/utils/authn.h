@@ -43,7 +43,35 @@ class Authentication : public Logger::Loggable<Logger::Id::filter> {
   // though).
   static bool HasResultInHeader(const Http::HeaderMap& headers);
 
+  // Saves (authentication) result in the stream state, for the filters after
+  // the authentication filter on the same stream. The state is per thread,
+  // indexed by the request headers of the stream, and holds the result as is
+  // with no encoding. It is kept until the stream state is cleared.
+  static void SaveResultToStream(const istio::authn::Result& result,
+                                 const Http::HeaderMap& headers);
+
+  // Looks up authentication result in the stream state of the headers. If it
+  // is not there, falls back to the header for compatibility. Returns false
+  // if data is not available, or in bad format.
+  static bool FetchResult(const Http::HeaderMap& headers,
+                          istio::authn::Result* result);
+
+  // Returns the authentication result in the stream state of the headers, or
+  // nullptr if there is none. It is valid until the stream state is cleared.
+  static const istio::authn::Result* FindResultInStream(
+      const Http::HeaderMap& headers);
+
+  // Clears authentication result in the stream state of the headers, if exist.
+  static void ClearResultInStream(const Http::HeaderMap& headers);
+
+  // Clears authentication result both in the stream state and in the header.
+  static void ClearResult(Http::HeaderMap* headers);
+
  private:
+  // Returns true if the stream state of the headers has a result. For testing
+  // purpose only.
+  static bool HasResultInStream(const Http::HeaderMap& headers);
+
   // Return the header location key. For testing purpose only.
   static const Http::LowerCaseString& GetHeaderLocation();
 
@@ -88,5 +88,33 @@ TEST_F(AuthenticationTest, FetchResult) {
   EXPECT_TRUE(TestUtility::protoEqual(test_result_, fetch_result));
 }
 
+TEST_F(AuthenticationTest, FetchResultFromStream) {
+  Authentication::SaveResultToStream(test_result_, request_headers_);
+  EXPECT_TRUE(Authentication::HasResultInStream(request_headers_));
+  EXPECT_FALSE(Authentication::HasResultInHeader(request_headers_));
+  Result fetch_result;
+  EXPECT_TRUE(Authentication::FetchResult(request_headers_, &fetch_result));
+  EXPECT_TRUE(TestUtility::protoEqual(test_result_, fetch_result));
+
+  // Other streams never see the result.
+  Http::TestHeaderMapImpl other_headers{};
+  EXPECT_FALSE(Authentication::FetchResult(other_headers, &fetch_result));
+
+  Authentication::ClearResult(&request_headers_);
+  EXPECT_FALSE(Authentication::HasResultInStream(request_headers_));
+  EXPECT_FALSE(Authentication::FetchResult(request_headers_, &fetch_result));
+}
+
+TEST_F(AuthenticationTest, FetchResultFallbackToHeader) {
+  EXPECT_TRUE(
+      Authentication::SaveResultToHeader(test_result_, &request_headers_));
+  Result fetch_result;
+  EXPECT_TRUE(Authentication::FetchResult(request_headers_, &fetch_result));
+  EXPECT_TRUE(TestUtility::protoEqual(test_result_, fetch_result));
+
+  Authentication::ClearResult(&request_headers_);
+  EXPECT_FALSE(Authentication::HasResultInHeader(request_headers_));
+}
+
 }  // namespace Utils
 }  // namespace Envoy
@@ -14,8 +14,17 @@
  */
 #include "src/envoy/utils/grpc_transport.h"
 #include "absl/types/optional.h"
+#include "src/envoy/utils/proto_log.h"
+#include "common/buffer/buffer_impl.h"
+#include "common/grpc/codec.h"
+#include "common/grpc/common.h"
+#include "common/http/utility.h"
+#include "zlib.h"
 
 using ::google::protobuf::util::Status;
+using ::istio::mixer::v1::CheckResponse;
+using ::istio::mixer::v1::ReportRequest;
+using ::istio::mixer::v1::ReportResponse;
 using StatusCode = ::google::protobuf::util::error::Code;
 
 namespace Envoy {
@@ -23,7 +32,7 @@ namespace Utils {
 namespace {
 
 // gRPC request timeout
-const std::chrono::milliseconds kGrpcRequestTimeoutMs(5000);
+const std::chrono::milliseconds kGrpcRequestTimeoutMs(kDefaultGrpcTimeoutMs);
 
 // HTTP trace headers that should pass to gRPC metadata from origin request.
 // x-request-id is added for easy debugging.
@@ -35,6 +44,47 @@ const Http::LowerCaseString kB3Sampled("x-b3-sampled");
 const Http::LowerCaseString kB3Flags("x-b3-flags");
 const Http::LowerCaseString kOtSpanContext("x-ot-span-context");
 
+// The span tags of a remote Check call. It is only made for a check cache
+// miss.
+const std::string kCheckCacheTag("istio.mixer.check_cache");
+const std::string kCheckCacheMiss("miss");
+const std::string kQuotaTag("istio.mixer.quota");
+const std::string kStatusTag("istio.mixer.status");
+
+// The metadata with the hash key of a call.
+const Http::LowerCaseString kMixerHashKey("x-istio-mixer-hash-key");
+
+// The gRPC message encoding header and its gzip value.
+const Http::LowerCaseString kGrpcEncoding("grpc-encoding");
+const std::string kGzipEncoding("gzip");
+
+// The zlib window bits to write the gzip format, 15 plus 16 for the gzip
+// header and trailer.
+const int kGzipWindowBits = 15 + 16;
+
+// The zlib default memory level.
+const int kGzipMemoryLevel = 8;
+
+// Compresses the data in the gzip format. Returns false on error.
+bool GzipCompress(const std::string &data, std::string *out) {
+  z_stream stream;
+  memset(&stream, 0, sizeof(stream));
+  if (deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+                   kGzipWindowBits, kGzipMemoryLevel,
+                   Z_DEFAULT_STRATEGY) != Z_OK) {
+    return false;
+  }
+  out->resize(deflateBound(&stream, data.size()));
+  stream.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data.data()));
+  stream.avail_in = data.size();
+  stream.next_out = reinterpret_cast<Bytef *>(&(*out)[0]);
+  stream.avail_out = out->size();
+  int ret = deflate(&stream, Z_FINISH);
+  out->resize(stream.total_out);
+  deflateEnd(&stream);
+  return ret == Z_STREAM_END;
+}
+
 inline void CopyHeaderEntry(const Http::HeaderEntry *entry,
                             const Http::LowerCaseString &key,
                             Http::HeaderMap &headers) {
@@ -44,30 +94,54 @@ inline void CopyHeaderEntry(const Http::HeaderEntry *entry,
   }
 }
 
+// Tags the span of a Check call with the quota involvement and the
+// precondition status code.
+void TagSpan(Tracing::Span &span, const CheckResponse &response) {
+  span.setTag(kCheckCacheTag, kCheckCacheMiss);
+  span.setTag(kQuotaTag, response.quotas_size() > 0 ? "true" : "false");
+  span.setTag(kStatusTag,
+              std::to_string(response.precondition().status().code()));
+}
+
+// Report calls are not tagged, the gRPC status is tagged by the client.
+void TagSpan(Tracing::Span &, const ReportResponse &) {}
+
 }  // namespace
 
 template <class RequestType, class ResponseType>
 GrpcTransport<RequestType, ResponseType>::GrpcTransport(
-    Grpc::AsyncClientPtr async_client, const RequestType &request,
-    const Http::HeaderMap *headers, ResponseType *response,
-    istio::mixerclient::DoneFunc on_done)
-    : async_client_(std::move(async_client)),
-      headers_(headers),
+    Grpc::AsyncClient &async_client, const RequestType &request,
+    const Http::HeaderMap *headers, const std::string &hash_key,
+    ResponseType *response, istio::mixerclient::DoneFunc on_done,
+    int timeout_ms, Tracing::Span *parent_span)
+    : headers_(headers),
+      hash_key_(hash_key),
+      traced_(parent_span != nullptr),
       response_(response),
       on_done_(on_done),
-      request_(async_client_->send(
-          descriptor(), request, *this, Tracing::NullSpan::instance(),
-          absl::optional<std::chrono::milliseconds>(kGrpcRequestTimeoutMs))) {
+      request_(async_client.send(
+          descriptor(), request, *this,
+          parent_span ? *parent_span : Tracing::NullSpan::instance(),
+          absl::optional<std::chrono::milliseconds>(
+              timeout_ms > 0 ? std::chrono::milliseconds(timeout_ms)
+                             : kGrpcRequestTimeoutMs))) {
   ENVOY_LOG(debug, "Sending {} request: {}", descriptor().name(),
-            request.DebugString());
+            ProtoSummary(request));
+  ENVOY_LOG(trace, "{} request: {}", descriptor().name(),
+            ProtoDebugString(request));
 }
 
 template <class RequestType, class ResponseType>
 void GrpcTransport<RequestType, ResponseType>::onCreateInitialMetadata(
     Http::HeaderMap &metadata) {
+  if (!hash_key_.empty()) {
+    metadata.addCopy(kMixerHashKey, hash_key_);
+  }
   if (!headers_) return;
 
   CopyHeaderEntry(headers_->RequestId(), kRequestId, metadata);
+  // The client has injected the context of the call span.
+  if (traced_) return;
   CopyHeaderEntry(headers_->XB3TraceId(), kB3TraceId, metadata);
   CopyHeaderEntry(headers_->XB3SpanId(), kB3SpanId, metadata);
   CopyHeaderEntry(headers_->XB3ParentSpanId(), kB3ParentSpanId, metadata);
@@ -80,9 +154,14 @@ void GrpcTransport<RequestType, ResponseType>::onCreateInitialMetadata(
 
 template <class RequestType, class ResponseType>
 void GrpcTransport<RequestType, ResponseType>::onSuccess(
-    std::unique_ptr<ResponseType> &&response, Tracing::Span &) {
+    std::unique_ptr<ResponseType> &&response, Tracing::Span &span) {
   ENVOY_LOG(debug, "{} response: {}", descriptor().name(),
-            response->DebugString());
+            ProtoSummary(*response));
+  if (traced_) {
+    TagSpan(span, *response);
+  }
+  ENVOY_LOG(trace, "{} response: {}", descriptor().name(),
+            ProtoDebugString(*response));
   response->Swap(response_);
   on_done_(Status::OK);
   delete this;
@@ -101,18 +180,25 @@ void GrpcTransport<RequestType, ResponseType>::onFailure(
 template <class RequestType, class ResponseType>
 void GrpcTransport<RequestType, ResponseType>::Cancel() {
   ENVOY_LOG(debug, "Cancel gRPC request {}", descriptor().name());
+  // The client outlives the call, so its stream has to be reset.
+  if (request_) {
+    request_->cancel();
+  }
   delete this;
 }
 
 template <class RequestType, class ResponseType>
 typename GrpcTransport<RequestType, ResponseType>::Func
 GrpcTransport<RequestType, ResponseType>::GetFunc(
-    Grpc::AsyncClientFactory &factory, const Http::HeaderMap *headers) {
-  return [&factory, headers](const RequestType &request, ResponseType *response,
-                             istio::mixerclient::DoneFunc on_done)
+    Grpc::AsyncClient &async_client, const Http::HeaderMap *headers,
+    int timeout_ms, const std::string &hash_key, Tracing::Span *parent_span) {
+  return [&async_client, headers, timeout_ms, hash_key, parent_span](
+             const RequestType &request, ResponseType *response,
+             istio::mixerclient::DoneFunc on_done)
              -> istio::mixerclient::CancelFunc {
     auto transport = new GrpcTransport<RequestType, ResponseType>(
-        factory.create(), request, headers, response, on_done);
+        async_client, request, headers, hash_key, response, on_done,
+        timeout_ms, parent_span);
     return [transport]() { transport->Cancel(); };
   };
 }
@@ -135,11 +221,133 @@ const google::protobuf::MethodDescriptor &ReportTransport::descriptor() {
   return *report_descriptor;
 }
 
+CompressedReportTransport::CompressedReportTransport(
+    ReportResponse *response, istio::mixerclient::DoneFunc on_done)
+    : response_(response), on_done_(on_done) {}
+
+bool CompressedReportTransport::Send(Upstream::ClusterManager &cm,
+                                     const std::string &cluster_name,
+                                     const ReportRequest &request) {
+  ENVOY_LOG(debug, "Sending compressed Report request: {}",
+            ProtoSummary(request));
+  ENVOY_LOG(trace, "Report request: {}", ProtoDebugString(request));
+  Http::MessagePtr message = Grpc::Common::prepareHeaders(
+      cluster_name, istio::mixer::v1::Mixer::descriptor()->full_name(),
+      "Report",
+      absl::optional<std::chrono::milliseconds>(kGrpcRequestTimeoutMs));
+
+  // Send the message uncompressed if it fails to compress.
+  std::string data = request.SerializeAsString();
+  std::string compressed;
+  uint8_t flags = Grpc::GRPC_FH_DEFAULT;
+  if (GzipCompress(data, &compressed)) {
+    message->headers().addReference(kGrpcEncoding, kGzipEncoding);
+    data.swap(compressed);
+    flags = Grpc::GRPC_FH_COMPRESSED;
+  }
+  std::array<uint8_t, Grpc::GRPC_FRAME_HEADER_SIZE> frame;
+  Grpc::Encoder().newFrame(flags, data.size(), frame);
+  message->body().reset(new Buffer::OwnedImpl(frame.data(), frame.size()));
+  message->body()->add(data);
+
+  // The callbacks may be called inline, and delete this.
+  bool done = false;
+  done_inline_ = &done;
+  auto request = cm.httpAsyncClientForCluster(cluster_name)
+                     .send(std::move(message), *this,
+                           absl::optional<std::chrono::milliseconds>(
+                               kGrpcRequestTimeoutMs));
+  if (done) {
+    return false;
+  }
+  done_inline_ = nullptr;
+  request_ = request;
+  return true;
+}
+
+void CompressedReportTransport::onSuccess(Http::MessagePtr &&response) {
+  request_ = nullptr;
+  if (done_inline_) {
+    *done_inline_ = true;
+  }
+  uint64_t status_code = Http::Utility::getResponseStatus(response->headers());
+  if (status_code != 200) {
+    ENVOY_LOG(debug, "Compressed Report failed with status code: {}",
+              status_code);
+    on_done_(Status(StatusCode::UNAVAILABLE, "Report failed with HTTP status " +
+                                                 std::to_string(status_code)));
+    delete this;
+    return;
+  }
+
+  // The gRPC status is in the trailers, or in the headers of a trailers only
+  // response.
+  const Http::HeaderMap &status_headers =
+      response->trailers() ? *response->trailers() : response->headers();
+  auto grpc_status = Grpc::Common::getGrpcStatus(status_headers);
+  Grpc::Status::GrpcStatus code =
+      grpc_status ? grpc_status.value() : Grpc::Status::Unknown;
+  if (code != Grpc::Status::Ok) {
+    const std::string message = Grpc::Common::getGrpcMessage(status_headers);
+    ENVOY_LOG(debug, "Compressed Report failed with code: {}, {}", code,
+              message);
+    on_done_(Status(static_cast<StatusCode>(code), message));
+    delete this;
+    return;
+  }
+
+  if (response->body()) {
+    std::vector<Grpc::Frame> frames;
+    if (Grpc::Decoder().decode(*response->body(), frames) && !frames.empty() &&
+        frames[0].data_) {
+      auto len = frames[0].data_->length();
+      response_->ParseFromArray(frames[0].data_->linearize(len), len);
+    }
+  }
+  ENVOY_LOG(debug, "Compressed Report response: {}", ProtoSummary(*response_));
+  on_done_(Status::OK);
+  delete this;
+}
+
+void CompressedReportTransport::onFailure(Http::AsyncClient::FailureReason) {
+  request_ = nullptr;
+  if (done_inline_) {
+    *done_inline_ = true;
+  }
+  ENVOY_LOG(debug, "Compressed Report failed with a reset");
+  on_done_(Status(StatusCode::UNAVAILABLE, "Report stream was reset"));
+  delete this;
+}
+
+void CompressedReportTransport::Cancel() {
+  ENVOY_LOG(debug, "Cancel compressed Report request");
+  if (request_) {
+    request_->cancel();
+  }
+  delete this;
+}
+
+ReportTransport::Func CompressedReportTransport::GetFunc(
+    Upstream::ClusterManager &cm, const std::string &cluster_name) {
+  return [&cm, cluster_name](const ReportRequest &request,
+                             ReportResponse *response,
+                             istio::mixerclient::DoneFunc on_done)
+             -> istio::mixerclient::CancelFunc {
+    auto transport = new CompressedReportTransport(response, on_done);
+    if (!transport->Send(cm, cluster_name, request)) {
+      return nullptr;
+    }
+    return [transport]() { transport->Cancel(); };
+  };
+}
+
 // explicitly instantiate CheckTransport and ReportTransport
 template CheckTransport::Func CheckTransport::GetFunc(
-    Grpc::AsyncClientFactory &factory, const Http::HeaderMap *headers);
+    Grpc::AsyncClient &async_client, const Http::HeaderMap *headers,
+    int timeout_ms, const std::string &hash_key);
 template ReportTransport::Func ReportTransport::GetFunc(
-    Grpc::AsyncClientFactory &factory, const Http::HeaderMap *headers);
+    Grpc::AsyncClient &async_client, const Http::HeaderMap *headers,
+    int timeout_ms, const std::string &hash_key);
 
 }  // namespace Utils
 }  // namespace Envoy
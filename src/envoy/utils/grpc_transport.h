@@ -21,6 +21,7 @@
 #include "common/common/logger.h"
 #include "envoy/event/dispatcher.h"
 #include "envoy/grpc/async_client.h"
+#include "envoy/http/async_client.h"
 #include "envoy/http/header_map.h"
 
 #include "envoy/upstream/cluster_manager.h"
@@ -29,7 +30,12 @@
 namespace Envoy {
 namespace Utils {
 
-// An object to use Envoy::Grpc::AsyncClient to make grpc call.
+// The default deadline of the gRPC calls to Mixer.
+constexpr int kDefaultGrpcTimeoutMs = 5000;
+
+// An object to use Envoy::Grpc::AsyncClient to make grpc call. The client is
+// long lived and shared by all calls of a worker, each call is a new stream
+// on it.
 template <class RequestType, class ResponseType>
 class GrpcTransport : public Grpc::TypedAsyncRequestCallbacks<ResponseType>,
                       public Logger::Loggable<Logger::Id::grpc> {
@@ -38,12 +44,21 @@ class GrpcTransport : public Grpc::TypedAsyncRequestCallbacks<ResponseType>,
       const RequestType& request, ResponseType* response,
       istio::mixerclient::DoneFunc on_done)>;
 
-  static Func GetFunc(Grpc::AsyncClientFactory& factory,
-                      const Http::HeaderMap* headers = nullptr);
-
-  GrpcTransport(Grpc::AsyncClientPtr async_client, const RequestType& request,
-                const Http::HeaderMap* headers, ResponseType* response,
-                istio::mixerclient::DoneFunc on_done);
+  // If timeout_ms is positive, it is the deadline of the calls instead of
+  // the default one. If hash_key is not empty, it is sent in the
+  // x-istio-mixer-hash-key metadata, for a hash based load balancer.
+  // If parent_span is not nullptr, each call is traced by a child span of
+  // it, which has to outlive the calls. Otherwise the trace headers are
+  // copied from headers.
+  static Func GetFunc(Grpc::AsyncClient& async_client,
+                      const Http::HeaderMap* headers = nullptr,
+                      int timeout_ms = 0, const std::string& hash_key = "",
+                      Tracing::Span* parent_span = nullptr);
+
+  GrpcTransport(Grpc::AsyncClient& async_client, const RequestType& request,
+                const Http::HeaderMap* headers, const std::string& hash_key,
+                ResponseType* response, istio::mixerclient::DoneFunc on_done,
+                int timeout_ms, Tracing::Span* parent_span);
 
   // Grpc::AsyncRequestCallbacks<ResponseType>
   void onCreateInitialMetadata(Http::HeaderMap& metadata) override;
@@ -59,8 +74,11 @@ class GrpcTransport : public Grpc::TypedAsyncRequestCallbacks<ResponseType>,
  private:
   static const google::protobuf::MethodDescriptor& descriptor();
 
-  Grpc::AsyncClientPtr async_client_;
   const Http::HeaderMap* headers_;
+  const std::string hash_key_;
+  // True if the call has its own span, whose context is sent instead of
+  // the trace headers.
+  const bool traced_;
   ResponseType* response_;
   ::istio::mixerclient::DoneFunc on_done_;
   Grpc::AsyncRequest* request_{};
@@ -74,5 +92,36 @@ typedef GrpcTransport<istio::mixer::v1::ReportRequest,
                       istio::mixer::v1::ReportResponse>
     ReportTransport;
 
+// An object to send a gzip compressed Report request with the Envoy HTTP
+// async client, since Grpc::AsyncClient can not compress messages. Report
+// requests are batched, so compression runs once per batch.
+class CompressedReportTransport : public Http::AsyncClient::Callbacks,
+                                  public Logger::Loggable<Logger::Id::grpc> {
+ public:
+  static ReportTransport::Func GetFunc(Upstream::ClusterManager& cm,
+                                       const std::string& cluster_name);
+
+  CompressedReportTransport(istio::mixer::v1::ReportResponse* response,
+                            istio::mixerclient::DoneFunc on_done);
+
+  // Sends the request. Returns false if it is done inline, this is deleted
+  // then.
+  bool Send(Upstream::ClusterManager& cm, const std::string& cluster_name,
+            const istio::mixer::v1::ReportRequest& request);
+
+  // Http::AsyncClient::Callbacks
+  void onSuccess(Http::MessagePtr&& response) override;
+  void onFailure(Http::AsyncClient::FailureReason reason) override;
+
+  void Cancel();
+
+ private:
+  istio::mixer::v1::ReportResponse* response_;
+  ::istio::mixerclient::DoneFunc on_done_;
+  Http::AsyncClient::Request* request_{};
+  // Set while sending, to tell the request is done inline.
+  bool* done_inline_{};
+};
+
 }  // namespace Utils
 }  // namespace Envoy
@@ -14,14 +14,82 @@
  */
 
 #include "src/envoy/utils/mixer_control.h"
+#include "common/common/logger.h"
 #include "src/envoy/utils/grpc_transport.h"
+#include "src/envoy/utils/stats.h"
 
+#include <mutex>
+#include <unordered_map>
+
+using ::istio::mixer::v1::ReportRequest;
+using ::istio::mixer::v1::ReportResponse;
+using ::istio::mixerclient::DoneFunc;
+using ::istio::mixerclient::Environment;
+using ::istio::mixerclient::ReportBatch;
 using ::istio::mixerclient::Statistics;
+using ::istio::mixerclient::StatsCounter;
+using ::istio::mixerclient::StatsSink;
+using ::istio::mixerclient::TrafficCapture;
+using ::istio::mixerclient::TrafficCaptureOptions;
+using ::istio::mixerclient::TransportReportFunc;
 
 namespace Envoy {
 namespace Utils {
 namespace {
 
+// The runtime keys of the traffic capture.
+const std::string kTrafficCaptureFileRuntimeKey("mixer.traffic_capture_file");
+const std::string kTrafficCaptureSampleRuntimeKey(
+    "mixer.traffic_capture_sample_every");
+
+// The runtime key to share the report batches of the worker threads.
+const std::string kSharedReportBatchRuntimeKey("mixer.shared_report_batch");
+
+// The prefix of the stats of the shared report batches.
+const std::string kSharedReportStatsPrefix("mixer_shared_report.");
+
+// The stats of a shared report batch, owned by the batch. They are only
+// reported here, not by each filter using the batch, and outlive the
+// filter config which created the batch.
+class SharedReportStats : public StatsSink {
+ public:
+  SharedReportStats(Event::Dispatcher &dispatcher, Stats::Scope &scope)
+      : scope_(scope.createScope("")),
+        stats_{ALL_MIXER_FILTER_STATS(
+            POOL_COUNTER_PREFIX(*scope_, kSharedReportStatsPrefix),
+            POOL_GAUGE_PREFIX(*scope_, kSharedReportStatsPrefix),
+            POOL_HISTOGRAM_PREFIX(*scope_, kSharedReportStatsPrefix))},
+        sink_(stats_),
+        stats_obj_(dispatcher, stats_, ::google::protobuf::Duration(),
+                   [this](Statistics *stat) -> bool {
+                     if (!batch_) {
+                       return false;
+                     }
+                     *stat = Statistics();
+                     ::istio::mixerclient::GetReportBatchStatistics(*batch_,
+                                                                    stat);
+                     return true;
+                   }) {
+    stats_obj_.PublishTo(MixerStatsRegistry::Get(), "shared report");
+  }
+
+  void AddCounter(StatsCounter counter, uint64_t value) override {
+    sink_.AddCounter(counter, value);
+  }
+
+  MixerFilterStats &stats() { return stats_; }
+
+  // Sets the batch polled for the gauges, which owns this object.
+  void set_batch(ReportBatch *batch) { batch_ = batch; }
+
+ private:
+  Stats::ScopePtr scope_;
+  MixerFilterStats stats_;
+  MixerStatsSink sink_;
+  ReportBatch *batch_ = nullptr;
+  MixerStatsObject stats_obj_;
+};
+
 // A class to wrap envoy timer for mixer client timer.
 class EnvoyTimer : public ::istio::mixerclient::Timer {
  public:
@@ -58,11 +126,11 @@ class EnvoyGrpcAsyncClientFactory : public Grpc::AsyncClientFactory {
 // Create all environment functions for mixerclient
 void CreateEnvironment(Event::Dispatcher &dispatcher,
                        Runtime::RandomGenerator &random,
-                       Grpc::AsyncClientFactory &check_client_factory,
-                       Grpc::AsyncClientFactory &report_client_factory,
+                       Grpc::AsyncClient &check_client,
+                       Grpc::AsyncClient &report_client,
                        ::istio::mixerclient::Environment *env) {
-  env->check_transport = CheckTransport::GetFunc(check_client_factory, nullptr);
-  env->report_transport = ReportTransport::GetFunc(report_client_factory);
+  env->check_transport = CheckTransport::GetFunc(check_client, nullptr);
+  env->report_transport = ReportTransport::GetFunc(report_client);
 
   env->timer_create_func = [&dispatcher](std::function<void()> timer_cb)
       -> std::unique_ptr<::istio::mixerclient::Timer> {
@@ -73,6 +141,10 @@ void CreateEnvironment(Event::Dispatcher &dispatcher,
   env->uuid_generate_func = [&random]() -> std::string {
     return random.uuid();
   };
+
+  // The clients belong to the thread local controls of the worker, and the
+  // gRPC callbacks and timers all run on its dispatcher.
+  env->threading_model = ::istio::mixerclient::ThreadingModel::THREAD_CONFINED;
 }
 
 Grpc::AsyncClientFactoryPtr GrpcClientFactoryForCluster(
@@ -86,5 +158,88 @@ Grpc::AsyncClientFactoryPtr GrpcClientFactoryForCluster(
   return std::make_unique<EnvoyGrpcAsyncClientFactory>(cm, service);
 }
 
+std::shared_ptr<TrafficCapture> GetTrafficCapture(
+    const Runtime::Snapshot &snapshot) {
+  const std::string &file = snapshot.get(kTrafficCaptureFileRuntimeKey);
+  if (file.empty()) {
+    return nullptr;
+  }
+  // The captures in use by the filters, by file.
+  static std::mutex mutex;
+  static std::unordered_map<std::string, std::weak_ptr<TrafficCapture>>
+      captures;
+  std::lock_guard<std::mutex> lock(mutex);
+  auto capture = captures[file].lock();
+  if (!capture) {
+    TrafficCaptureOptions options;
+    options.file = file;
+    options.sample_every = snapshot.getInteger(kTrafficCaptureSampleRuntimeKey,
+                                               options.sample_every);
+    capture = ::istio::mixerclient::CreateTrafficCapture(options);
+    if (!capture) {
+      auto &logger = Logger::Registry::getLog(Logger::Id::config);
+      ENVOY_LOG_TO_LOGGER(logger, error,
+                          "Failed to open the traffic capture file {}", file);
+      return nullptr;
+    }
+    captures[file] = capture;
+  }
+  return capture;
+}
+
+bool SharedReportBatchEnabled(const Runtime::Snapshot &snapshot) {
+  return snapshot.getInteger(kSharedReportBatchRuntimeKey, 0) != 0;
+}
+
+std::shared_ptr<ReportBatch> GetSharedReportBatch(
+    const std::string &report_cluster, bool compress_report,
+    const std::string &key, Upstream::ClusterManager &cm,
+    Event::Dispatcher &dispatcher, Runtime::RandomGenerator &random,
+    Stats::Scope &scope, CreateReportBatchFunc create_func) {
+  // The batches in use on this thread. They are only used by the thread,
+  // without lock.
+  static thread_local std::unordered_map<std::string,
+                                         std::weak_ptr<ReportBatch>>
+      batches;
+  for (auto it = batches.begin(); it != batches.end();) {
+    if (it->second.expired()) {
+      it = batches.erase(it);
+    } else {
+      ++it;
+    }
+  }
+  std::string batch_key = report_cluster;
+  batch_key.push_back('\0');
+  batch_key.push_back(compress_report ? '1' : '0');
+  batch_key.push_back('\0');
+  batch_key.append(key);
+  auto batch = batches[batch_key].lock();
+  if (batch) {
+    return batch;
+  }
+
+  // The transport owns the client, which is destroyed with the batch.
+  std::shared_ptr<Grpc::AsyncClient> client =
+      GrpcClientFactoryForCluster(report_cluster, cm, scope)->create();
+  Environment env;
+  CreateEnvironment(dispatcher, random, *client, *client, &env);
+  TransportReportFunc transport = env.report_transport;
+  if (compress_report) {
+    transport = CompressedReportTransport::GetFunc(cm, report_cluster);
+  }
+  auto stats = std::make_shared<SharedReportStats>(dispatcher, scope);
+  env.report_transport = RecordReportStats(
+      [client, stats, transport](const ReportRequest &request,
+                                 ReportResponse *response, DoneFunc on_done) {
+        return transport(request, response, on_done);
+      },
+      stats->stats());
+  env.stats_sink = stats;
+  batch = create_func(env);
+  stats->set_batch(batch.get());
+  batches[batch_key] = batch;
+  return batch;
+}
+
 }  // namespace Utils
 }  // namespace Envoy
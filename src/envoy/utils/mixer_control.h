@@ -19,21 +19,52 @@
 #include "envoy/runtime/runtime.h"
 #include "envoy/upstream/cluster_manager.h"
 #include "include/istio/mixerclient/client.h"
+#include "include/istio/mixerclient/traffic_capture.h"
 #include "src/envoy/utils/config.h"
 
 namespace Envoy {
 namespace Utils {
 
-// Create all environment functions for mixerclient
+// Create all environment functions for mixerclient, for the clients of
+// the worker of dispatcher.
 void CreateEnvironment(Event::Dispatcher &dispatcher,
                        Runtime::RandomGenerator &random,
-                       Grpc::AsyncClientFactory &check_client_factory,
-                       Grpc::AsyncClientFactory &report_client_factory,
+                       Grpc::AsyncClient &check_client,
+                       Grpc::AsyncClient &report_client,
                        ::istio::mixerclient::Environment *env);
 
 Grpc::AsyncClientFactoryPtr GrpcClientFactoryForCluster(
     const std::string &cluster_name, Upstream::ClusterManager &cm,
     Stats::Scope &scope);
 
+// Gets the capture of the sampled Check and Report calls to the file of
+// the runtime key mixer.traffic_capture_file, one of every
+// mixer.traffic_capture_sample_every calls. The filters capturing to the
+// same file share one capture. Returns nullptr if the key is not set or
+// the file cannot be opened.
+std::shared_ptr<::istio::mixerclient::TrafficCapture> GetTrafficCapture(
+    const Runtime::Snapshot &snapshot);
+
+// Returns true if the HTTP and TCP mixer filters of a worker thread share
+// one report batch per Mixer report cluster and report options, set by
+// the runtime key mixer.shared_report_batch.
+bool SharedReportBatchEnabled(const Runtime::Snapshot &snapshot);
+
+using CreateReportBatchFunc =
+    std::function<std::shared_ptr<::istio::mixerclient::ReportBatch>(
+        const ::istio::mixerclient::Environment &env)>;
+
+// Gets the report batch of this worker thread shared by the mixer filters
+// with the same report cluster, compression and key, or creates one with
+// create_func. Its environment has its own gRPC client, so the batch keeps
+// reporting after the filter config which created it is removed. For the
+// same reason it has its own stats, prefixed by mixer_shared_report., and
+// the filters using it only count their own report calls.
+std::shared_ptr<::istio::mixerclient::ReportBatch> GetSharedReportBatch(
+    const std::string &report_cluster, bool compress_report,
+    const std::string &key, Upstream::ClusterManager &cm,
+    Event::Dispatcher &dispatcher, Runtime::RandomGenerator &random,
+    Stats::Scope &scope, CreateReportBatchFunc create_func);
+
 }  // namespace Utils
 }  // namespace Envoy
@@ -0,0 +1,68 @@
+/* Copyright 2018 Istio Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <chrono>
+
+#include "envoy/stats/stats.h"
+
+namespace Envoy {
+namespace Utils {
+
+// The per-request cost of the filter phases. It is only built with
+//   bazel build --define phase_timing=enabled
+// where ISTIO_TIME_PHASE(histogram) at the start of a scope records the
+// nanoseconds spent until its end to the histogram, a reference or a
+// pointer. The phases timed never block, so this is the time the worker
+// thread spends on them. The histograms only exist in these builds, and
+// ISTIO_TIME_PHASE is empty in the default builds.
+
+#ifdef ISTIO_PHASE_TIMING
+
+class ScopedPhaseTimer {
+ public:
+  explicit ScopedPhaseTimer(Stats::Histogram& histogram)
+      : ScopedPhaseTimer(&histogram) {}
+
+  // Nothing is recorded if histogram is nullptr.
+  explicit ScopedPhaseTimer(Stats::Histogram* histogram)
+      : histogram_(histogram), start_(std::chrono::steady_clock::now()) {}
+
+  ~ScopedPhaseTimer() {
+    if (histogram_) {
+      histogram_->recordValue(
+          std::chrono::duration_cast<std::chrono::nanoseconds>(
+              std::chrono::steady_clock::now() - start_)
+              .count());
+    }
+  }
+
+ private:
+  Stats::Histogram* histogram_;
+  const std::chrono::steady_clock::time_point start_;
+};
+
+#define ISTIO_TIME_PHASE(histogram) \
+  ::Envoy::Utils::ScopedPhaseTimer istio_phase_timer(histogram)
+
+#else
+
+#define ISTIO_TIME_PHASE(histogram)
+
+#endif  // ISTIO_PHASE_TIMING
+
+}  // namespace Utils
+}  // namespace Envoy
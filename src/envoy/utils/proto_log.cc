@@ -0,0 +1,47 @@
+/* Copyright 2018 Istio Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/envoy/utils/proto_log.h"
+
+#include <vector>
+
+using ::google::protobuf::FieldDescriptor;
+using ::google::protobuf::Reflection;
+
+namespace Envoy {
+namespace Utils {
+
+std::ostream& operator<<(std::ostream& os, const ProtoDebugString& proto) {
+  return os << proto.message_.DebugString();
+}
+
+std::ostream& operator<<(std::ostream& os, const ProtoSummary& proto) {
+  const Reflection* reflection = proto.message_.GetReflection();
+  std::vector<const FieldDescriptor*> fields;
+  reflection->ListFields(proto.message_, &fields);
+
+  os << proto.message_.GetDescriptor()->full_name()
+     << "{bytes: " << proto.message_.ByteSize();
+  for (const FieldDescriptor* field : fields) {
+    if (field->is_repeated()) {
+      os << ", " << field->name() << ": "
+         << reflection->FieldSize(proto.message_, field);
+    }
+  }
+  return os << "}";
+}
+
+}  // namespace Utils
+}  // namespace Envoy
@@ -0,0 +1,59 @@
+/* Copyright 2018 Istio Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <ostream>
+
+#include "google/protobuf/message.h"
+#include "spdlog/fmt/ostr.h"
+
+namespace Envoy {
+namespace Utils {
+
+// Wrappers to log a protobuf message as a log argument, e.g.
+//   ENVOY_LOG(debug, "Report request: {}", ProtoSummary(request));
+// The message is only formatted when the log line is written, so it costs
+// nothing if the log level is off.
+
+// Formats the whole message with DebugString().
+class ProtoDebugString {
+ public:
+  explicit ProtoDebugString(const ::google::protobuf::Message& message)
+      : message_(message) {}
+
+  friend std::ostream& operator<<(std::ostream& os,
+                                  const ProtoDebugString& proto);
+
+ private:
+  const ::google::protobuf::Message& message_;
+};
+
+// Formats the message type, its byte size and the sizes of its repeated
+// and map fields, e.g.
+//   istio.mixer.v1.ReportRequest{bytes: 5120, attributes: 100}
+class ProtoSummary {
+ public:
+  explicit ProtoSummary(const ::google::protobuf::Message& message)
+      : message_(message) {}
+
+  friend std::ostream& operator<<(std::ostream& os, const ProtoSummary& proto);
+
+ private:
+  const ::google::protobuf::Message& message_;
+};
+
+}  // namespace Utils
+}  // namespace Envoy
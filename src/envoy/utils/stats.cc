@@ -13,10 +13,26 @@
  * limitations under the License.
  */
 
+#include <algorithm>
 #include <chrono>
+#include <memory>
+#include <sstream>
+#include <vector>
 
 #include "src/envoy/utils/stats.h"
 
+using ::google::protobuf::util::Status;
+using ::istio::mixer::v1::CheckRequest;
+using ::istio::mixer::v1::CheckResponse;
+using ::istio::mixer::v1::ReportRequest;
+using ::istio::mixer::v1::ReportResponse;
+using ::istio::mixerclient::CancelFunc;
+using ::istio::mixerclient::CheckMissReason;
+using ::istio::mixerclient::DoneFunc;
+using ::istio::mixerclient::StatsCounter;
+using ::istio::mixerclient::TransportCheckFunc;
+using ::istio::mixerclient::TransportReportFunc;
+
 namespace Envoy {
 namespace Utils {
 namespace {
@@ -24,8 +40,251 @@ namespace {
 // The time interval for envoy stats update.
 const int kStatsUpdateIntervalInMs = 10000;
 
+// Returns the milliseconds since start.
+uint64_t MillisecondsSince(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+             std::chrono::steady_clock::now() - start)
+      .count();
+}
+
+// Renders the statistics of one mixer client.
+void RenderStats(const ::istio::mixerclient::Statistics& stats,
+                 std::ostringstream* out) {
+  *out << "  check_cache_entries: " << stats.check_cache_entries << "\n"
+       << "  check_cache_bytes: " << stats.check_cache_bytes << "\n"
+       << "  check_cache_shapes:\n";
+  for (const auto& s : stats.check_cache_shapes) {
+    *out << "    hits: " << s.hits << " misses: " << s.misses
+         << " shape: " << s.shape << "\n";
+  }
+  *out << "  quota_cache_entries: " << stats.quota_cache_entries << "\n"
+       << "  quota_cache_bytes: " << stats.quota_cache_bytes << "\n"
+       << "  quota_stats:\n";
+  for (const auto& s : stats.quota_stats) {
+    *out << "    name: " << s.name << " hits: " << s.hits
+         << " misses: " << s.misses << " prefetch_calls: " << s.prefetch_calls
+         << " granted_amount: " << s.granted_amount
+         << " used_amount: " << s.used_amount
+         << " expired_amount: " << s.expired_amount
+         << " inflight_checks: " << s.inflight_checks
+         << " inflight_rejections: " << s.inflight_rejections
+         << " close_time_ms: " << s.close_time_ms
+         << " queue_depth: " << s.queue_depth
+         << " negative_hits: " << s.negative_hits << "\n";
+  }
+  *out << "  inflight_report_batches: " << stats.inflight_report_batches
+       << "\n"
+       << "  buffered_report_bytes: " << stats.buffered_report_bytes << "\n"
+       << "  open_report_batches: " << stats.open_report_batches << "\n"
+       << "  open_report_entries: " << stats.open_report_entries << "\n"
+       << "  global_dictionary_words: " << stats.global_dictionary_words
+       << "\n";
+}
+
 }  // namespace
 
+MixerStatsRegistry& MixerStatsRegistry::Get() {
+  // Never destroyed, the admin handler may outlive the filters.
+  static MixerStatsRegistry* registry = new MixerStatsRegistry();
+  return *registry;
+}
+
+void MixerStatsRegistry::AddAdminHandler(Server::Admin& admin) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (handler_added_) {
+      return;
+    }
+    handler_added_ = true;
+  }
+  admin.addHandler(
+      "/mixer_stats",
+      "print the mixer client caches and report batches of each worker",
+      [this](absl::string_view, Http::HeaderMap&, Buffer::Instance& response,
+             Server::AdminStream&) -> Http::Code {
+        response.add(Render());
+        return Http::Code::OK;
+      },
+      false, false);
+}
+
+void MixerStatsRegistry::Publish(
+    const void* key, const std::string& filter,
+    const ::istio::mixerclient::Statistics& stats) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = entries_.find(key);
+  if (it == entries_.end()) {
+    it = entries_.emplace(key, Entry{next_id_++, filter, {}}).first;
+  }
+  it->second.stats = stats;
+}
+
+void MixerStatsRegistry::Remove(const void* key) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  entries_.erase(key);
+}
+
+std::string MixerStatsRegistry::Render() const {
+  std::vector<const Entry*> entries;
+  std::ostringstream out;
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (const auto& it : entries_) {
+    entries.push_back(&it.second);
+  }
+  std::sort(entries.begin(), entries.end(),
+            [](const Entry* a, const Entry* b) { return a->id < b->id; });
+  for (const Entry* entry : entries) {
+    out << entry->filter << " mixer client " << entry->id << ":\n";
+    RenderStats(entry->stats, &out);
+  }
+  return out.str();
+}
+
+TransportCheckFunc RecordCheckStats(TransportCheckFunc transport,
+                                    MixerFilterStats& stats) {
+  return [transport, &stats](const CheckRequest& request,
+                             CheckResponse* response,
+                             DoneFunc on_done) -> CancelFunc {
+    stats.inflight_check_calls_.inc();
+    auto start = std::chrono::steady_clock::now();
+    // Set once the call is done or cancelled.
+    auto finished = std::make_shared<bool>(false);
+    CancelFunc cancel = transport(
+        request, response,
+        [&stats, start, finished, on_done](const Status& status) {
+          *finished = true;
+          stats.inflight_check_calls_.dec();
+          stats.check_latency_ms_.recordValue(MillisecondsSince(start));
+          on_done(status);
+        });
+    if (*finished) {
+      return cancel;
+    }
+    return [&stats, finished, cancel]() {
+      if (!*finished) {
+        *finished = true;
+        stats.inflight_check_calls_.dec();
+      }
+      if (cancel) {
+        cancel();
+      }
+    };
+  };
+}
+
+void RecordCheckBlocked(MixerFilterStats& stats, CheckMissReason reason,
+                        std::chrono::steady_clock::time_point start) {
+  uint64_t blocked_ms = MillisecondsSince(start);
+  switch (reason) {
+    case CheckMissReason::NO_SHAPE:
+      stats.check_blocked_ms_no_shape_.recordValue(blocked_ms);
+      break;
+    case CheckMissReason::NO_ITEM:
+      stats.check_blocked_ms_no_item_.recordValue(blocked_ms);
+      break;
+    case CheckMissReason::EXPIRED:
+      stats.check_blocked_ms_expired_.recordValue(blocked_ms);
+      break;
+    case CheckMissReason::USE_COUNT_EXHAUSTED:
+      stats.check_blocked_ms_use_count_exhausted_.recordValue(blocked_ms);
+      break;
+    case CheckMissReason::QUOTA:
+      stats.check_blocked_ms_quota_.recordValue(blocked_ms);
+      break;
+    case CheckMissReason::NONE:
+      stats.check_blocked_ms_other_.recordValue(blocked_ms);
+      break;
+  }
+}
+
+TransportReportFunc RecordReportStats(TransportReportFunc transport,
+                                      MixerFilterStats& stats) {
+  return [transport, &stats](const ReportRequest& request,
+                             ReportResponse* response,
+                             DoneFunc on_done) -> CancelFunc {
+    stats.report_batch_entries_.recordValue(request.attributes_size());
+    stats.report_batch_bytes_.recordValue(request.ByteSize());
+    auto start = std::chrono::steady_clock::now();
+    return transport(request, response,
+                     [&stats, start, on_done](const Status& status) {
+                       stats.report_latency_ms_.recordValue(
+                           MillisecondsSince(start));
+                       on_done(status);
+                     });
+  };
+}
+
+void MixerStatsSink::AddCounter(StatsCounter counter, uint64_t value) {
+  switch (counter) {
+    case StatsCounter::CHECK_CALLS:
+      stats_.total_check_calls_.add(value);
+      break;
+    case StatsCounter::REMOTE_CHECK_CALLS:
+      stats_.total_remote_check_calls_.add(value);
+      break;
+    case StatsCounter::BLOCKING_REMOTE_CHECK_CALLS:
+      stats_.total_blocking_remote_check_calls_.add(value);
+      break;
+    case StatsCounter::QUOTA_CALLS:
+      stats_.total_quota_calls_.add(value);
+      break;
+    case StatsCounter::REMOTE_QUOTA_CALLS:
+      stats_.total_remote_quota_calls_.add(value);
+      break;
+    case StatsCounter::BLOCKING_REMOTE_QUOTA_CALLS:
+      stats_.total_blocking_remote_quota_calls_.add(value);
+      break;
+    case StatsCounter::REPORT_CALLS:
+      stats_.total_report_calls_.add(value);
+      break;
+    case StatsCounter::REMOTE_REPORT_CALLS:
+      stats_.total_remote_report_calls_.add(value);
+      break;
+    case StatsCounter::DROPPED_REPORT_CALLS:
+      stats_.total_dropped_report_calls_.add(value);
+      break;
+    case StatsCounter::REPORT_BATCHES_FULL_ENTRIES:
+      stats_.total_report_batches_full_entries_.add(value);
+      break;
+    case StatsCounter::REPORT_BATCHES_FULL_BYTES:
+      stats_.total_report_batches_full_bytes_.add(value);
+      break;
+    case StatsCounter::REPORT_BATCHES_TIMED:
+      stats_.total_report_batches_timed_.add(value);
+      break;
+    case StatsCounter::REPORT_BATCHES_DELTA_BREAK:
+      stats_.total_report_batches_delta_break_.add(value);
+      break;
+    case StatsCounter::REPORT_BATCHES_EVICTED:
+      stats_.total_report_batches_evicted_.add(value);
+      break;
+    case StatsCounter::CHECK_CACHE_SWEPT_ITEMS:
+      stats_.total_check_cache_swept_items_.add(value);
+      break;
+    case StatsCounter::QUOTA_CACHE_SWEPT_ITEMS:
+      stats_.total_quota_cache_swept_items_.add(value);
+      break;
+    case StatsCounter::OVERLOAD_SHED_CHECK_CALLS:
+      stats_.total_overload_shed_check_calls_.add(value);
+      break;
+    case StatsCounter::OVERLOAD_DROPPED_REPORT_CALLS:
+      stats_.total_overload_dropped_report_calls_.add(value);
+      break;
+    case StatsCounter::OVERLOAD_EVICTED_CACHE_ITEMS:
+      stats_.total_overload_evicted_cache_items_.add(value);
+      break;
+    case StatsCounter::BREAKER_SHED_CHECK_CALLS:
+      stats_.total_breaker_shed_check_calls_.add(value);
+      break;
+    case StatsCounter::SPILLED_REPORT_BATCHES:
+      stats_.total_spilled_report_batches_.add(value);
+      break;
+    default:
+      // Not exported.
+      break;
+  }
+}
+
 MixerStatsObject::MixerStatsObject(Event::Dispatcher& dispatcher,
                                    MixerFilterStats& stats,
                                    ::google::protobuf::Duration update_interval,
@@ -36,7 +295,8 @@ MixerStatsObject::MixerStatsObject(Event::Dispatcher& dispatcher,
   if (stats_update_interval_ <= 0) {
     stats_update_interval_ = kStatsUpdateIntervalInMs;
   }
-  memset(&old_stats_, 0, sizeof(old_stats_));
+  // Value-initialize to zero all counters.
+  old_stats_ = ::istio::mixerclient::Statistics();
 
   if (get_stats_func_) {
     timer_ = dispatcher.createTimer([this]() { OnTimer(); });
@@ -44,60 +304,165 @@ MixerStatsObject::MixerStatsObject(Event::Dispatcher& dispatcher,
   }
 }
 
+MixerStatsObject::~MixerStatsObject() {
+  if (registry_) {
+    registry_->Remove(this);
+  }
+}
+
+void MixerStatsObject::PublishTo(MixerStatsRegistry& registry,
+                                 const std::string& filter) {
+  registry_ = &registry;
+  registry_filter_ = filter;
+}
+
+void MixerStatsObject::EnableServiceStats(Stats::Scope& scope,
+                                          const std::string& prefix) {
+  service_scope_ = &scope;
+  service_prefix_ = prefix;
+}
+
 void MixerStatsObject::OnTimer() {
   ::istio::mixerclient::Statistics new_stats;
   bool get_stats = get_stats_func_(&new_stats);
   if (get_stats) {
     CheckAndUpdateStats(new_stats);
+    if (registry_) {
+      registry_->Publish(this, registry_filter_, new_stats);
+    }
   }
   timer_->enableTimer(std::chrono::milliseconds(stats_update_interval_));
 }
 
+void MixerStatsObject::UpdateGauge(Stats::Gauge& gauge, uint64_t new_value,
+                                   uint64_t old_value) {
+  if (new_value > old_value) {
+    gauge.add(new_value - old_value);
+  } else if (new_value < old_value) {
+    gauge.sub(old_value - new_value);
+  }
+}
+
+void MixerStatsObject::UpdateCounter(Stats::Counter& counter,
+                                     uint64_t new_value, uint64_t old_value) {
+  if (new_value > old_value) {
+    counter.add(new_value - old_value);
+  }
+}
+
+void MixerStatsObject::UpdateServiceStats(
+    const std::vector<::istio::mixerclient::ServiceStats>& stats) {
+  for (const auto& s : stats) {
+    // Value-initialized to zero for a new service.
+    ::istio::mixerclient::ServiceStats& old = old_service_stats_[s.service];
+    const std::string prefix = service_prefix_ + s.service + ".";
+    UpdateCounter(service_scope_->counter(prefix + "check_calls"),
+                  s.check_calls, old.check_calls);
+    UpdateCounter(service_scope_->counter(prefix + "check_cache_hits"),
+                  s.check_cache_hits, old.check_cache_hits);
+    UpdateCounter(
+        service_scope_->counter(prefix + "blocking_remote_check_calls"),
+        s.blocking_remote_check_calls, old.blocking_remote_check_calls);
+    UpdateCounter(service_scope_->counter(prefix + "quota_cache_hits"),
+                  s.quota_cache_hits, old.quota_cache_hits);
+    UpdateCounter(service_scope_->counter(prefix + "report_calls"),
+                  s.report_calls, old.report_calls);
+    old = s;
+  }
+}
+
+::istio::mixerclient::QuotaNameStats MixerStatsObject::SumQuotaStats(
+    const std::vector<::istio::mixerclient::QuotaNameStats>& stats) {
+  ::istio::mixerclient::QuotaNameStats sum = {};
+  for (const auto& s : stats) {
+    sum.granted_amount += s.granted_amount;
+    sum.used_amount += s.used_amount;
+    sum.expired_amount += s.expired_amount;
+    sum.inflight_rejections += s.inflight_rejections;
+    sum.close_time_ms += s.close_time_ms;
+    sum.queue_depth += s.queue_depth;
+    sum.negative_hits += s.negative_hits;
+  }
+  return sum;
+}
+
 void MixerStatsObject::CheckAndUpdateStats(
     const ::istio::mixerclient::Statistics& new_stats) {
-  if (new_stats.total_check_calls > old_stats_.total_check_calls) {
-    stats_.total_check_calls_.add(new_stats.total_check_calls -
-                                  old_stats_.total_check_calls);
-  }
-  if (new_stats.total_remote_check_calls >
-      old_stats_.total_remote_check_calls) {
-    stats_.total_remote_check_calls_.add(new_stats.total_remote_check_calls -
-                                         old_stats_.total_remote_check_calls);
-  }
-  if (new_stats.total_blocking_remote_check_calls >
-      old_stats_.total_blocking_remote_check_calls) {
-    stats_.total_blocking_remote_check_calls_.add(
-        new_stats.total_blocking_remote_check_calls -
-        old_stats_.total_blocking_remote_check_calls);
-  }
-  if (new_stats.total_quota_calls > old_stats_.total_quota_calls) {
-    stats_.total_quota_calls_.add(new_stats.total_quota_calls -
-                                  old_stats_.total_quota_calls);
-  }
-  if (new_stats.total_remote_quota_calls >
-      old_stats_.total_remote_quota_calls) {
-    stats_.total_remote_quota_calls_.add(new_stats.total_remote_quota_calls -
-                                         old_stats_.total_remote_quota_calls);
-  }
-  if (new_stats.total_blocking_remote_quota_calls >
-      old_stats_.total_blocking_remote_quota_calls) {
-    stats_.total_blocking_remote_quota_calls_.add(
-        new_stats.total_blocking_remote_quota_calls -
-        old_stats_.total_blocking_remote_quota_calls);
-  }
-  if (new_stats.total_report_calls > old_stats_.total_report_calls) {
-    stats_.total_report_calls_.add(new_stats.total_report_calls -
-                                   old_stats_.total_report_calls);
-  }
-  if (new_stats.total_remote_report_calls >
-      old_stats_.total_remote_report_calls) {
-    stats_.total_remote_report_calls_.add(new_stats.total_remote_report_calls -
-                                          old_stats_.total_remote_report_calls);
+  // The call counters are pushed by MixerStatsSink. The per quota name
+  // statistics are polled and exported as their sums.
+  auto new_quota = SumQuotaStats(new_stats.quota_stats);
+  auto old_quota = SumQuotaStats(old_stats_.quota_stats);
+  UpdateCounter(stats_.total_quota_granted_amount_, new_quota.granted_amount,
+                old_quota.granted_amount);
+  UpdateCounter(stats_.total_quota_used_amount_, new_quota.used_amount,
+                old_quota.used_amount);
+  UpdateCounter(stats_.total_quota_expired_amount_, new_quota.expired_amount,
+                old_quota.expired_amount);
+  UpdateCounter(stats_.total_quota_inflight_rejections_,
+                new_quota.inflight_rejections, old_quota.inflight_rejections);
+  UpdateCounter(stats_.total_quota_close_time_ms_, new_quota.close_time_ms,
+                old_quota.close_time_ms);
+  UpdateCounter(stats_.total_quota_negative_hits_, new_quota.negative_hits,
+                old_quota.negative_hits);
+
+  // Gauges are shared by the stats objects of all worker threads, update
+  // them by the deltas so that they are the sum of all threads.
+  UpdateGauge(stats_.check_cache_entries_, new_stats.check_cache_entries,
+              old_stats_.check_cache_entries);
+  UpdateGauge(stats_.check_cache_bytes_, new_stats.check_cache_bytes,
+              old_stats_.check_cache_bytes);
+  UpdateGauge(stats_.quota_cache_entries_, new_stats.quota_cache_entries,
+              old_stats_.quota_cache_entries);
+  UpdateGauge(stats_.quota_cache_bytes_, new_stats.quota_cache_bytes,
+              old_stats_.quota_cache_bytes);
+  UpdateGauge(stats_.quota_prefetch_queue_depth_, new_quota.queue_depth,
+              old_quota.queue_depth);
+  UpdateGauge(stats_.inflight_report_batches_,
+              new_stats.inflight_report_batches,
+              old_stats_.inflight_report_batches);
+  UpdateGauge(stats_.buffered_report_bytes_, new_stats.buffered_report_bytes,
+              old_stats_.buffered_report_bytes);
+
+  if (service_scope_) {
+    UpdateServiceStats(new_stats.service_stats);
   }
 
   // Copy new_stats to old_stats_ for next stats update.
   old_stats_ = new_stats;
+
+#ifdef ISTIO_ALLOC_ACCOUNTING
+  UpdateAllocStats();
+#endif
+}
+
+#ifdef ISTIO_ALLOC_ACCOUNTING
+void MixerStatsObject::UpdateAllocStats() {
+  using ::istio::utils::AllocStats;
+  using ::istio::utils::AllocTag;
+  // The timer runs on the worker thread, so these are the allocations of
+  // the requests it has served.
+  auto update = [this](AllocTag tag, Stats::Counter& scopes,
+                       Stats::Counter& allocations, Stats::Counter& bytes) {
+    AllocStats& old_value = old_alloc_stats_[static_cast<int>(tag)];
+    AllocStats new_value;
+    ::istio::utils::GetThreadAllocStats(tag, &new_value);
+    UpdateCounter(scopes, new_value.scopes, old_value.scopes);
+    UpdateCounter(allocations, new_value.allocations, old_value.allocations);
+    UpdateCounter(bytes, new_value.bytes, old_value.bytes);
+    old_value = new_value;
+  };
+  update(AllocTag::MIXER_CHECK, stats_.alloc_mixer_check_scopes_,
+         stats_.alloc_mixer_check_allocations_,
+         stats_.alloc_mixer_check_bytes_);
+  update(AllocTag::MIXER_REPORT, stats_.alloc_mixer_report_scopes_,
+         stats_.alloc_mixer_report_allocations_,
+         stats_.alloc_mixer_report_bytes_);
+  update(AllocTag::JWT_VERIFY, stats_.alloc_jwt_verify_scopes_,
+         stats_.alloc_jwt_verify_allocations_, stats_.alloc_jwt_verify_bytes_);
+  update(AllocTag::AUTHN, stats_.alloc_authn_scopes_,
+         stats_.alloc_authn_allocations_, stats_.alloc_authn_bytes_);
 }
+#endif
 
 }  // namespace Utils
 }  // namespace Envoy
@@ -17,43 +17,209 @@
 
 #include "envoy/event/dispatcher.h"
 #include "envoy/event/timer.h"
+#include "envoy/server/admin.h"
 #include "envoy/stats/stats_macros.h"
 #include "include/istio/mixerclient/client.h"
+#include "include/istio/utils/alloc_accounting.h"
+#include "src/envoy/utils/phase_timer.h"
+
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <unordered_map>
 
 namespace Envoy {
 namespace Utils {
 
+/**
+ * The allocation stats of the mixer and authentication subsystems on the
+ * worker threads, only in the alloc_accounting builds.
+ * @see include/istio/utils/alloc_accounting.h
+ */
+// clang-format off
+#ifdef ISTIO_ALLOC_ACCOUNTING
+#define ALLOC_ACCOUNTING_STATS(COUNTER)                                       \
+  COUNTER(alloc_mixer_check_scopes)                                           \
+  COUNTER(alloc_mixer_check_allocations)                                      \
+  COUNTER(alloc_mixer_check_bytes)                                            \
+  COUNTER(alloc_mixer_report_scopes)                                          \
+  COUNTER(alloc_mixer_report_allocations)                                     \
+  COUNTER(alloc_mixer_report_bytes)                                           \
+  COUNTER(alloc_jwt_verify_scopes)                                            \
+  COUNTER(alloc_jwt_verify_allocations)                                       \
+  COUNTER(alloc_jwt_verify_bytes)                                             \
+  COUNTER(alloc_authn_scopes)                                                 \
+  COUNTER(alloc_authn_allocations)                                            \
+  COUNTER(alloc_authn_bytes)
+#else
+#define ALLOC_ACCOUNTING_STATS(COUNTER)
+#endif
+// clang-format on
+
+/**
+ * The per-request nanoseconds of the HTTP mixer filter phases, only in the
+ * phase_timing builds. @see src/envoy/utils/phase_timer.h
+ */
+// clang-format off
+#ifdef ISTIO_PHASE_TIMING
+#define MIXER_PHASE_TIMING_STATS(HISTOGRAM)                                   \
+  HISTOGRAM(decode_headers_ns)                                                \
+  HISTOGRAM(log_ns)
+#else
+#define MIXER_PHASE_TIMING_STATS(HISTOGRAM)
+#endif
+// clang-format on
+
 /**
  * All mixer filter stats. @see stats_macros.h
  */
 // clang-format off
-#define ALL_MIXER_FILTER_STATS(COUNTER)                                       \
+#define ALL_MIXER_FILTER_STATS(COUNTER, GAUGE, HISTOGRAM)                     \
   COUNTER(total_check_calls)                                                  \
   COUNTER(total_remote_check_calls)                                           \
   COUNTER(total_blocking_remote_check_calls)                                  \
   COUNTER(total_quota_calls)                                                  \
   COUNTER(total_remote_quota_calls)                                           \
   COUNTER(total_blocking_remote_quota_calls)                                  \
+  COUNTER(total_quota_granted_amount)                                         \
+  COUNTER(total_quota_used_amount)                                            \
+  COUNTER(total_quota_expired_amount)                                         \
+  COUNTER(total_quota_inflight_rejections)                                    \
+  COUNTER(total_quota_close_time_ms)                                          \
+  COUNTER(total_quota_negative_hits)                                          \
   COUNTER(total_report_calls)                                                 \
-  COUNTER(total_remote_report_calls)
+  COUNTER(total_remote_report_calls)                                          \
+  COUNTER(total_dropped_report_calls)                                         \
+  COUNTER(total_report_batches_full_entries)                                  \
+  COUNTER(total_report_batches_full_bytes)                                    \
+  COUNTER(total_report_batches_timed)                                         \
+  COUNTER(total_report_batches_delta_break)                                   \
+  COUNTER(total_report_batches_evicted)                                       \
+  COUNTER(total_check_cache_swept_items)                                      \
+  COUNTER(total_quota_cache_swept_items)                                      \
+  COUNTER(total_overload_shed_check_calls)                                    \
+  COUNTER(total_overload_dropped_report_calls)                                \
+  COUNTER(total_overload_evicted_cache_items)                                 \
+  COUNTER(total_breaker_shed_check_calls)                                     \
+  COUNTER(total_spilled_report_batches)                                       \
+  COUNTER(total_bypassed_requests)                                            \
+  ALLOC_ACCOUNTING_STATS(COUNTER)                                             \
+  GAUGE(check_cache_entries)                                                  \
+  GAUGE(check_cache_bytes)                                                    \
+  GAUGE(quota_cache_entries)                                                  \
+  GAUGE(quota_cache_bytes)                                                    \
+  GAUGE(quota_prefetch_queue_depth)                                           \
+  GAUGE(inflight_report_batches)                                              \
+  GAUGE(buffered_report_bytes)                                                \
+  GAUGE(inflight_check_calls)                                                 \
+  HISTOGRAM(check_latency_ms)                                                 \
+  HISTOGRAM(report_latency_ms)                                                \
+  HISTOGRAM(report_batch_entries)                                             \
+  HISTOGRAM(report_batch_bytes)                                               \
+  HISTOGRAM(check_blocked_ms_no_shape)                                        \
+  HISTOGRAM(check_blocked_ms_no_item)                                         \
+  HISTOGRAM(check_blocked_ms_expired)                                         \
+  HISTOGRAM(check_blocked_ms_use_count_exhausted)                             \
+  HISTOGRAM(check_blocked_ms_quota)                                           \
+  HISTOGRAM(check_blocked_ms_other)                                           \
+  MIXER_PHASE_TIMING_STATS(HISTOGRAM)
 // clang-format on
 
 /**
  * Struct definition for all mixer filter stats. @see stats_macros.h
  */
 struct MixerFilterStats {
-  ALL_MIXER_FILTER_STATS(GENERATE_COUNTER_STRUCT)
+  ALL_MIXER_FILTER_STATS(GENERATE_COUNTER_STRUCT, GENERATE_GAUGE_STRUCT,
+                         GENERATE_HISTOGRAM_STRUCT)
 };
 
 typedef std::function<bool(::istio::mixerclient::Statistics* s)> GetStatsFunc;
 
-// MixerStatsObject maintains statistics for number of check, quota and report
-// calls issued by a mixer filter.
+// Wraps a check transport to record the latency and the in-flight number
+// of its calls.
+::istio::mixerclient::TransportCheckFunc RecordCheckStats(
+    ::istio::mixerclient::TransportCheckFunc transport,
+    MixerFilterStats& stats);
+
+// Wraps a report transport to record the latency, the number of entries
+// and the serialized bytes of its batches.
+::istio::mixerclient::TransportReportFunc RecordReportStats(
+    ::istio::mixerclient::TransportReportFunc transport,
+    MixerFilterStats& stats);
+
+// Records the time a request or a connection was held by a check, from
+// start until now, in the histogram of the reason the check missed the
+// caches.
+void RecordCheckBlocked(MixerFilterStats& stats,
+                        ::istio::mixerclient::CheckMissReason reason,
+                        std::chrono::steady_clock::time_point start);
+
+// Pushes the counters of the mixer clients to the filter stats as they are
+// incremented. It is set to the Environment of the mixer clients.
+class MixerStatsSink : public ::istio::mixerclient::StatsSink {
+ public:
+  MixerStatsSink(MixerFilterStats& stats) : stats_(stats) {}
+
+  void AddCounter(::istio::mixerclient::StatsCounter counter,
+                  uint64_t value) override;
+
+ private:
+  MixerFilterStats& stats_;
+};
+
+// The latest statistics of the mixer clients of all worker threads, served
+// by the /mixer_stats admin handler. Each MixerStatsObject publishes the
+// statistics it polls on its own worker thread, so the admin thread only
+// reads the last published copies and never waits for a worker.
+class MixerStatsRegistry {
+ public:
+  // The process wide registry.
+  static MixerStatsRegistry& Get();
+
+  // Adds the /mixer_stats admin handler, only done once per process.
+  void AddAdminHandler(Server::Admin& admin);
+
+  // Publishes the statistics of a mixer client, replacing the previous
+  // ones of the same key.
+  void Publish(const void* key, const std::string& filter,
+               const ::istio::mixerclient::Statistics& stats);
+
+  // Removes the statistics of a mixer client.
+  void Remove(const void* key);
+
+  // Renders the published statistics as text, one section per worker.
+  std::string Render() const;
+
+ private:
+  struct Entry {
+    // The order the mixer client published first, for a stable output.
+    uint64_t id;
+    // "http" or "tcp".
+    std::string filter;
+    ::istio::mixerclient::Statistics stats;
+  };
+
+  mutable std::mutex mutex_;
+  bool handler_added_ = false;
+  uint64_t next_id_ = 0;
+  std::map<const void*, Entry> entries_;
+};
+
+// MixerStatsObject periodically polls the statistics of a mixer filter
+// that are not pushed by MixerStatsSink: the gauges and the quota stats.
 class MixerStatsObject {
  public:
   MixerStatsObject(Event::Dispatcher& dispatcher, MixerFilterStats& stats,
                    ::google::protobuf::Duration update_interval,
                    GetStatsFunc func);
+  ~MixerStatsObject();
+
+  // Exports the per destination service stats as counters named prefix,
+  // the service name and the stat name.
+  void EnableServiceStats(Stats::Scope& scope, const std::string& prefix);
+
+  // Publishes the polled statistics to the registry under the filter name.
+  void PublishTo(MixerStatsRegistry& registry, const std::string& filter);
 
  private:
   // This function is invoked when timer event fires.
@@ -62,6 +228,31 @@ class MixerStatsObject {
   // Compares old stats with new stats and updates envoy stats.
   void CheckAndUpdateStats(const ::istio::mixerclient::Statistics& new_stats);
 
+  // Updates a gauge by the delta of the new and old value.
+  static void UpdateGauge(Stats::Gauge& gauge, uint64_t new_value,
+                          uint64_t old_value);
+
+  // Adds the increase of the new value over the old value to a counter.
+  static void UpdateCounter(Stats::Counter& counter, uint64_t new_value,
+                            uint64_t old_value);
+
+  // Adds the increases of the per destination service stats.
+  void UpdateServiceStats(
+      const std::vector<::istio::mixerclient::ServiceStats>& stats);
+
+  // Sums the quota statistics of all quota names.
+  static ::istio::mixerclient::QuotaNameStats SumQuotaStats(
+      const std::vector<::istio::mixerclient::QuotaNameStats>& stats);
+
+#ifdef ISTIO_ALLOC_ACCOUNTING
+  // Adds the allocations of the calling worker thread since the last call.
+  void UpdateAllocStats();
+
+  // The allocation stats of the worker thread from the last call.
+  ::istio::utils::AllocStats old_alloc_stats_[::istio::utils::kNumAllocTags] =
+      {};
+#endif
+
   // A set of Envoy stats for the number of check, quota and report calls.
   MixerFilterStats& stats_;
   // Stores a function which gets statistics from mixer controller.
@@ -71,6 +262,18 @@ class MixerStatsObject {
   // variances of stats and update envoy stats.
   ::istio::mixerclient::Statistics old_stats_;
 
+  // The scope and the name prefix of the per destination service stats,
+  // nullptr if they are not exported.
+  Stats::Scope* service_scope_ = nullptr;
+  std::string service_prefix_;
+  // The per destination service stats from the last call, by service.
+  std::unordered_map<std::string, ::istio::mixerclient::ServiceStats>
+      old_service_stats_;
+
+  // The registry to publish the statistics to, nullptr if not published.
+  MixerStatsRegistry* registry_ = nullptr;
+  std::string registry_filter_;
+
   // These members are used for creating a timer which update Envoy stats
   // periodically.
   ::Envoy::Event::TimerPtr timer_;
@@ -16,6 +16,9 @@
 #include "src/envoy/utils/utils.h"
 #include "mixer/v1/attributes.pb.h"
 
+#include <atomic>
+#include <sstream>
+
 using ::google::protobuf::Message;
 using ::google::protobuf::util::Status;
 
@@ -26,6 +29,18 @@ namespace {
 
 const std::string kSPIFFEPrefix("spiffe://");
 
+// The source users of the recent TLS connections of a thread, so the peer
+// certificate SAN is parsed once per connection for all the filters and
+// requests. The slot of a connection is picked by its id, which is never
+// reused.
+struct PeerIdentity {
+  uint64_t connection_id;
+  const Ssl::Connection* ssl;
+  std::string user;
+};
+const size_t kPeerIdentityCacheSize = 64;
+thread_local PeerIdentity peer_identities[kPeerIdentityCacheSize];
+
 }  // namespace
 
 std::map<std::string, std::string> ExtractHeaders(
@@ -53,6 +68,49 @@ std::map<std::string, std::string> ExtractHeaders(
   return headers;
 }
 
+void ParseHeaderNames(const std::string& str,
+                      std::unordered_set<std::string>* names) {
+  std::istringstream stream(str);
+  std::string name;
+  while (std::getline(stream, name, ',')) {
+    size_t first = name.find_first_not_of(' ');
+    if (first == std::string::npos) {
+      continue;
+    }
+    size_t last = name.find_last_not_of(' ');
+    names->insert(name.substr(first, last - first + 1));
+  }
+}
+
+void ExtractHeaders(
+    const Http::HeaderMap& header_map, const HeaderFilter* filter,
+    ::google::protobuf::Map<std::string, std::string>* headers) {
+  struct Context {
+    const HeaderFilter* filter;
+    ::google::protobuf::Map<std::string, std::string>* headers;
+  };
+  Context ctx{filter, headers};
+  header_map.iterate(
+      [](const Http::HeaderEntry& header,
+         void* context) -> Http::HeaderMap::Iterate {
+        Context* ctx = static_cast<Context*>(context);
+        std::string key(header.key().c_str(), header.key().size());
+        if (ctx->filter && ((!ctx->filter->allowed.empty() &&
+                             ctx->filter->allowed.count(key) == 0) ||
+                            ctx->filter->denied.count(key) > 0)) {
+          return Http::HeaderMap::Iterate::Continue;
+        }
+        size_t size = header.value().size();
+        if (ctx->filter && ctx->filter->max_value_length > 0 &&
+            size > ctx->filter->max_value_length) {
+          size = ctx->filter->max_value_length;
+        }
+        (*ctx->headers)[key].assign(header.value().c_str(), size);
+        return Http::HeaderMap::Iterate::Continue;
+      },
+      &ctx);
+}
+
 bool GetIpPort(const Network::Address::Ip* ip, std::string* str_ip, int* port) {
   if (ip) {
     *port = ip->port();
@@ -74,17 +132,26 @@ bool GetSourceUser(const Network::Connection* connection, std::string* user) {
   if (connection) {
     Ssl::Connection* ssl = const_cast<Ssl::Connection*>(connection->ssl());
     if (ssl != nullptr) {
-      std::string result = ssl->uriSanPeerCertificate();
-      if (result.empty()) {  // empty source user is not allowed
-        return false;
-      }
-      if (result.length() >= kSPIFFEPrefix.length() &&
-          result.compare(0, kSPIFFEPrefix.length(), kSPIFFEPrefix) == 0) {
-        // Strip out the prefix "spiffe://" in the identity.
-        *user = result.substr(kSPIFFEPrefix.size());
-      } else {
-        *user = result;
+      PeerIdentity& identity =
+          peer_identities[connection->id() % kPeerIdentityCacheSize];
+      if (identity.ssl != ssl || identity.connection_id != connection->id()) {
+        std::string result = ssl->uriSanPeerCertificate();
+        // empty source user is not allowed. It is not cached, the handshake
+        // may not be done yet.
+        if (result.empty()) {
+          return false;
+        }
+        if (result.length() >= kSPIFFEPrefix.length() &&
+            result.compare(0, kSPIFFEPrefix.length(), kSPIFFEPrefix) == 0) {
+          // Strip out the prefix "spiffe://" in the identity.
+          identity.user = result.substr(kSPIFFEPrefix.size());
+        } else {
+          identity.user = std::move(result);
+        }
+        identity.connection_id = connection->id();
+        identity.ssl = ssl;
       }
+      *user = identity.user;
       return true;
     }
   }
@@ -96,6 +163,12 @@ bool IsMutualTLS(const Network::Connection* connection) {
          connection->ssl()->peerCertificatePresented();
 }
 
+int ThreadIndex() {
+  static std::atomic<int> next_index(0);
+  static thread_local int index = next_index++;
+  return index;
+}
+
 Status ParseJsonMessage(const std::string& json, Message* output) {
   ::google::protobuf::util::JsonParseOptions options;
   options.ignore_unknown_fields = true;
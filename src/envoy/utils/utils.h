@@ -16,7 +16,9 @@
 #pragma once
 
 #include <map>
+#include <set>
 #include <string>
+#include <unordered_set>
 
 #include "envoy/http/header_map.h"
 #include "envoy/network/connection.h"
@@ -29,6 +31,26 @@ namespace Utils {
 std::map<std::string, std::string> ExtractHeaders(
     const Http::HeaderMap& header_map, const std::set<std::string>& exclusives);
 
+// Selects the headers extracted into a header map attribute.
+struct HeaderFilter {
+  // If not empty, only these headers are extracted.
+  std::unordered_set<std::string> allowed;
+  // These headers are never extracted.
+  std::unordered_set<std::string> denied;
+  // If positive, the longer header values are truncated to it.
+  size_t max_value_length = 0;
+};
+
+// Parses comma separated lower case header names into names.
+void ParseHeaderNames(const std::string& str,
+                      std::unordered_set<std::string>* names);
+
+// Extract HTTP headers selected by the filter directly into a protobuf
+// string map, visiting the header map once. The filter may be nullptr.
+void ExtractHeaders(const Http::HeaderMap& header_map,
+                    const HeaderFilter* filter,
+                    ::google::protobuf::Map<std::string, std::string>* headers);
+
 // Get ip and port from Envoy ip.
 bool GetIpPort(const Network::Address::Ip* ip, std::string* str_ip, int* port);
 
@@ -38,6 +60,11 @@ bool GetSourceUser(const Network::Connection* connection, std::string* user);
 // Returns true if connection is mutual TLS enabled.
 bool IsMutualTLS(const Network::Connection* connection);
 
+// Returns the index of the calling thread. The threads are numbered from 0
+// in the order they first call it, so that the threads of the next process
+// of a hot restart have the same indexes, e.g. to name per-thread files.
+int ThreadIndex();
+
 // Parse JSON string into message.
 ::google::protobuf::util::Status ParseJsonMessage(
     const std::string& json, ::google::protobuf::Message* output);
@@ -15,9 +15,15 @@
 
 #include "src/envoy/utils/utils.h"
 #include "mixer/v1/config/client/client_config.pb.h"
+#include "mixer/v1/report.pb.h"
+#include "src/envoy/utils/proto_log.h"
 #include "test/test_common/utility.h"
 
+using Envoy::Utils::ExtractHeaders;
+using Envoy::Utils::HeaderFilter;
+using Envoy::Utils::ParseHeaderNames;
 using Envoy::Utils::ParseJsonMessage;
+using Envoy::Utils::ProtoSummary;
 
 namespace {
 
@@ -44,4 +50,53 @@ TEST(UtilsTest, ParseMessageWithUnknownField) {
   EXPECT_EQ(http_config.default_destination_service(),
             "service.svc.cluster.local");
 }
+
+TEST(UtilsTest, ProtoSummary) {
+  ::istio::mixer::v1::ReportRequest request;
+  request.add_attributes();
+  request.add_attributes();
+  request.add_default_words("word");
+
+  std::ostringstream os;
+  os << ProtoSummary(request);
+  EXPECT_EQ(os.str(), "istio.mixer.v1.ReportRequest{bytes: " +
+                          std::to_string(request.ByteSize()) +
+                          ", attributes: 2, default_words: 1}");
+}
+
+TEST(UtilsTest, ExtractFilteredHeaders) {
+  Envoy::Http::TestHeaderMapImpl header_map{
+      {":path", "/books"}, {"x-user", "user1"}, {"cookie", "secret"}};
+  ::google::protobuf::Map<std::string, std::string> headers;
+  ExtractHeaders(header_map, nullptr, &headers);
+  EXPECT_EQ(headers.size(), 3);
+  EXPECT_EQ(headers["x-user"], "user1");
+
+  HeaderFilter filter;
+  ParseHeaderNames("cookie", &filter.denied);
+  headers.clear();
+  ExtractHeaders(header_map, &filter, &headers);
+  EXPECT_EQ(headers.size(), 2);
+  EXPECT_EQ(headers.count("cookie"), 0);
+
+  ParseHeaderNames(" :path, x-user ,,cookie", &filter.allowed);
+  EXPECT_EQ(filter.allowed.size(), 3);
+  headers.clear();
+  ExtractHeaders(header_map, &filter, &headers);
+  EXPECT_EQ(headers.size(), 2);
+  EXPECT_EQ(headers[":path"], "/books");
+}
+
+TEST(UtilsTest, ExtractTruncatedHeaders) {
+  Envoy::Http::TestHeaderMapImpl header_map{{":path", "/books"},
+                                            {"set-cookie", "0123456789"}};
+  ::google::protobuf::Map<std::string, std::string> headers;
+  HeaderFilter filter;
+  filter.max_value_length = 6;
+  ExtractHeaders(header_map, &filter, &headers);
+  EXPECT_EQ(headers.size(), 2);
+  EXPECT_EQ(headers[":path"], "/books");
+  EXPECT_EQ(headers["set-cookie"], "012345");
+}
+
 }  // namespace
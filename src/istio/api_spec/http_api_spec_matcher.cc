@@ -0,0 +1,231 @@
+/* Copyright 2018 Istio Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/istio/api_spec/http_api_spec_matcher.h"
+#include "google/protobuf/stubs/logging.h"
+#include "include/istio/utils/protobuf.h"
+
+#include <algorithm>
+#include <cctype>
+#include <mutex>
+
+using ::istio::control::http::CheckData;
+using ::istio::mixer::v1::Attributes;
+using ::istio::mixer::v1::config::client::APIKey;
+using ::istio::mixer::v1::config::client::HTTPAPISpec;
+using ::istio::mixer::v1::config::client::HTTPAPISpecPattern;
+
+namespace istio {
+namespace api_spec {
+namespace {
+// If api-key is not defined in APISpec, use following defaults.
+const std::string kApiKeyDefaultQueryName1("key");
+const std::string kApiKeyDefaultQueryName2("api_key");
+const std::string kApiKeyDefaultHeader("x-api-key");
+
+// Returns the literal prefix of the strings matched by an ECMAScript regex,
+// empty if it is not known.
+std::string GetLiteralPrefix(const std::string& regex) {
+  // An alternation may be anywhere.
+  if (regex.find('|') != std::string::npos) {
+    return "";
+  }
+  static const char kSpecialChars[] = "\\^$.*+?()[]{}";
+  size_t end = regex.find_first_of(kSpecialChars);
+  if (end == std::string::npos) {
+    return regex;
+  }
+  // The last literal char is optional if it is quantified.
+  if (end > 0 &&
+      (regex[end] == '*' || regex[end] == '?' || regex[end] == '{')) {
+    --end;
+  }
+  return regex.substr(0, end);
+}
+
+// Returns true if a uri_template only matches the path equal to it, such as
+// the gRPC paths "/package.Service/Method".
+bool IsLiteralTemplate(const std::string& uri_template) {
+  return uri_template.size() > 1 && uri_template[0] == '/' &&
+         uri_template.back() != '/' &&
+         uri_template.find_first_of("{}*:?#%") == std::string::npos &&
+         uri_template.find("//") == std::string::npos;
+}
+
+}  // namespace
+
+HttpApiSpecMatcher::RegexData::RegexData(const std::string& regex,
+                                         const Attributes* attributes)
+    : regex(regex), prefix(GetLiteralPrefix(regex)), attributes(attributes) {}
+
+HttpApiSpecMatcher::HttpApiSpecMatcher(const HTTPAPISpec& api_spec)
+    : api_spec_(api_spec) {
+  BuildPathMatcher();
+  BuildApiKeyData();
+}
+
+std::shared_ptr<const HttpApiSpecMatcher> HttpApiSpecMatcher::Get(
+    const HTTPAPISpec& api_spec) {
+  // The live matchers by the deterministic serialization of their spec.
+  typedef std::unordered_map<std::string,
+                             std::weak_ptr<const HttpApiSpecMatcher>>
+      MatcherMap;
+  static std::mutex mutex;
+  static MatcherMap matchers;
+
+  std::string key = ::istio::utils::SerializeDeterministic(api_spec);
+
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = matchers.find(key);
+    if (it != matchers.end()) {
+      auto matcher = it->second.lock();
+      if (matcher) {
+        return matcher;
+      }
+    }
+  }
+
+  // Compiles out of the lock, not to block the other workers. If another
+  // worker compiled the same spec meanwhile, its matcher is used.
+  std::shared_ptr<const HttpApiSpecMatcher> matcher =
+      std::make_shared<HttpApiSpecMatcher>(api_spec);
+  std::lock_guard<std::mutex> lock(mutex);
+  std::weak_ptr<const HttpApiSpecMatcher>& entry = matchers[key];
+  auto existing = entry.lock();
+  if (existing) {
+    return existing;
+  }
+  entry = matcher;
+  // Drop the entries of the released matchers.
+  for (auto it = matchers.begin(); it != matchers.end();) {
+    if (it->second.expired()) {
+      it = matchers.erase(it);
+    } else {
+      ++it;
+    }
+  }
+  return matcher;
+}
+
+void HttpApiSpecMatcher::BuildPathMatcher() {
+  PathMatcherBuilder<const Attributes*> pmb;
+  for (const auto& pattern : api_spec_.patterns()) {
+    if (pattern.pattern_case() == HTTPAPISpecPattern::kUriTemplate) {
+      if (!pmb.Register(pattern.http_method(), pattern.uri_template(),
+                        std::string(), &pattern.attributes())) {
+        GOOGLE_LOG(WARNING)
+            << "Invalid uri_template: " << pattern.uri_template();
+      } else if (IsLiteralTemplate(pattern.uri_template())) {
+        // The first registered one is used, as by the path matcher.
+        exact_path_map_[pattern.http_method()].emplace(pattern.uri_template(),
+                                                       &pattern.attributes());
+      }
+    } else {
+      regex_map_[pattern.http_method()].emplace_back(pattern.regex(),
+                                                     &pattern.attributes());
+    }
+  }
+  path_matcher_ = pmb.Build();
+}
+
+void HttpApiSpecMatcher::BuildApiKeyData() {
+  if (api_spec_.api_keys_size() == 0) {
+    api_key_locations_ = {{APIKey::kQuery, kApiKeyDefaultQueryName1},
+                          {APIKey::kQuery, kApiKeyDefaultQueryName2},
+                          {APIKey::kHeader, kApiKeyDefaultHeader}};
+    return;
+  }
+  for (const auto& api_key : api_spec_.api_keys()) {
+    switch (api_key.key_case()) {
+      case APIKey::kQuery:
+        api_key_locations_.push_back({APIKey::kQuery, api_key.query()});
+        break;
+      case APIKey::kHeader: {
+        // Header names are case insensitive, lowercase them once here.
+        std::string name = api_key.header();
+        std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+        api_key_locations_.push_back({APIKey::kHeader, name});
+        break;
+      }
+      case APIKey::kCookie:
+        api_key_locations_.push_back({APIKey::kCookie, api_key.cookie()});
+        break;
+      case APIKey::KEY_NOT_SET:
+        break;
+    }
+  }
+}
+
+void HttpApiSpecMatcher::MatchAttributes(
+    const std::string& http_method, const std::string& path,
+    std::vector<const Attributes*>* matched) const {
+  const Attributes* matched_attributes = nullptr;
+  auto exact_it = exact_path_map_.find(http_method);
+  if (exact_it != exact_path_map_.end()) {
+    auto path_it = exact_it->second.find(path);
+    if (path_it != exact_it->second.end()) {
+      matched_attributes = path_it->second;
+    }
+  }
+  if (!matched_attributes) {
+    matched_attributes = path_matcher_->Lookup(http_method, path);
+  }
+  if (matched_attributes) {
+    matched->push_back(matched_attributes);
+  }
+
+  // Check the regex patterns of the method, only running the regex if its
+  // literal prefix matches.
+  auto it = regex_map_.find(http_method);
+  if (it == regex_map_.end()) {
+    return;
+  }
+  for (const auto& re : it->second) {
+    if (path.compare(0, re.prefix.size(), re.prefix) == 0 &&
+        std::regex_match(path, re.regex)) {
+      matched->push_back(re.attributes);
+    }
+  }
+}
+
+bool HttpApiSpecMatcher::ExtractApiKey(CheckData* check_data,
+                                       std::string* value) const {
+  for (const auto& location : api_key_locations_) {
+    switch (location.key_case) {
+      case APIKey::kQuery:
+        if (check_data->FindQueryParameter(location.name, value)) {
+          return true;
+        }
+        break;
+      case APIKey::kHeader:
+        if (check_data->FindHeaderByName(location.name, value)) {
+          return true;
+        }
+        break;
+      case APIKey::kCookie:
+        if (check_data->FindCookie(location.name, value)) {
+          return true;
+        }
+        break;
+      case APIKey::KEY_NOT_SET:
+        break;
+    }
+  }
+  return false;
+}
+
+}  // namespace api_spec
+}  // namespace istio
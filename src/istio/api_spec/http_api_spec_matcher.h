@@ -0,0 +1,106 @@
+/* Copyright 2018 Istio Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ISTIO_API_SPEC_HTTP_API_SPEC_MATCHER_H_
+#define ISTIO_API_SPEC_HTTP_API_SPEC_MATCHER_H_
+
+#include "include/istio/control/http/check_data.h"
+#include "mixer/v1/attributes.pb.h"
+#include "mixer/v1/config/client/api_spec.pb.h"
+#include "src/istio/api_spec/path_matcher.h"
+
+#include <memory>
+#include <regex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace istio {
+namespace api_spec {
+
+// The compiled, immutable form of a HTTPAPISpec: its path matcher, regex
+// patterns and api key locations. It is thread safe, so the specs with the
+// same content share one across workers and services.
+class HttpApiSpecMatcher {
+ public:
+  HttpApiSpecMatcher(
+      const ::istio::mixer::v1::config::client::HTTPAPISpec& api_spec);
+
+  // Returns the shared matcher of the spec, compiling it if no live one has
+  // the same content.
+  static std::shared_ptr<const HttpApiSpecMatcher> Get(
+      const ::istio::mixer::v1::config::client::HTTPAPISpec& api_spec);
+
+  // The global attributes of the spec.
+  const ::istio::mixer::v1::Attributes& attributes() const {
+    return api_spec_.attributes();
+  }
+
+  // Finds the pattern attributes matched by the http_method and path, the
+  // uri_template one first, then the regex ones in the order of the spec.
+  void MatchAttributes(
+      const std::string& http_method, const std::string& path,
+      std::vector<const ::istio::mixer::v1::Attributes*>* matched) const;
+
+  // Extracts the api key from the first location of the spec having one.
+  bool ExtractApiKey(::istio::control::http::CheckData* check_data,
+                     std::string* api_key) const;
+
+ private:
+  // Build PatchMatcher for extracting api attributes.
+  void BuildPathMatcher();
+  // Build Api key extraction used data.
+  void BuildApiKeyData();
+
+  // The http api spec.
+  ::istio::mixer::v1::config::client::HTTPAPISpec api_spec_;
+
+  // Where to find the api key, in the order of the spec.
+  struct ApiKeyLocation {
+    ::istio::mixer::v1::config::client::APIKey::KeyCase key_case;
+    // The query parameter or cookie name, or the lowercased header name.
+    std::string name;
+  };
+  std::vector<ApiKeyLocation> api_key_locations_;
+
+  // The path matcher for all url templates
+  PathMatcherPtr<const ::istio::mixer::v1::Attributes*> path_matcher_;
+
+  // The attributes of the literal uri_templates, such as the gRPC paths
+  // "/package.Service/Method", by http_method and path. A request path equal
+  // to one of them is matched without the path matcher.
+  std::unordered_map<
+      std::string,
+      std::unordered_map<std::string, const ::istio::mixer::v1::Attributes*>>
+      exact_path_map_;
+
+  struct RegexData {
+    RegexData(const std::string& regex,
+              const ::istio::mixer::v1::Attributes* attributes);
+
+    std::regex regex;
+    // The literal prefix of all the paths matched by the regex.
+    std::string prefix;
+    // The attributes to add if matched.
+    const ::istio::mixer::v1::Attributes* attributes;
+  };
+  // The regex patterns by http_method, in the order of the spec.
+  std::unordered_map<std::string, std::vector<RegexData>> regex_map_;
+};
+
+}  // namespace api_spec
+}  // namespace istio
+
+#endif  // ISTIO_API_SPEC_HTTP_API_SPEC_MATCHER_H_
@@ -0,0 +1,142 @@
+/* Copyright 2018 Istio Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// A micro-benchmark for HttpApiSpecParser with a large API spec: 1k
+// uri_templates with variables and wildcards, and 50 regexes. Measures
+// compiling the spec, and AddAttributes for hot paths served by the match
+// cache and for distinct paths missing it.
+
+#include "benchmark/benchmark.h"
+#include "include/istio/api_spec/http_api_spec_parser.h"
+#include "src/istio/api_spec/http_api_spec_matcher.h"
+
+#include <string>
+#include <utility>
+#include <vector>
+
+using ::istio::mixer::v1::Attributes;
+using ::istio::mixer::v1::config::client::HTTPAPISpec;
+
+namespace istio {
+namespace api_spec {
+namespace {
+
+// The number of resources, each with kTemplatesPerResource templates.
+const int kNumResources = 125;
+const int kTemplatesPerResource = 8;
+const int kNumRegexes = 50;
+
+void AddPattern(const std::string& http_method, const std::string& pattern,
+                bool regex, HTTPAPISpec* spec) {
+  auto* p = spec->add_patterns();
+  p->set_http_method(http_method);
+  if (regex) {
+    p->set_regex(pattern);
+  } else {
+    p->set_uri_template(pattern);
+  }
+  (*p->mutable_attributes()->mutable_attributes())["api.operation"]
+      .set_string_value(http_method + " " + pattern);
+}
+
+HTTPAPISpec BuildSpec() {
+  HTTPAPISpec spec;
+  (*spec.mutable_attributes()->mutable_attributes())["api.service"]
+      .set_string_value("library");
+  for (int i = 0; i < kNumResources; ++i) {
+    std::string r = "/v1/resource" + std::to_string(i);
+    AddPattern("GET", r, false, &spec);
+    AddPattern("POST", r, false, &spec);
+    AddPattern("GET", r + "/{id}", false, &spec);
+    AddPattern("PUT", r + "/{id}", false, &spec);
+    AddPattern("DELETE", r + "/{id}", false, &spec);
+    AddPattern("GET", r + "/{id}/items/{item}", false, &spec);
+    AddPattern("POST", r + "/{id}:archive", false, &spec);
+    AddPattern("GET", r + "/{id}/files/**", false, &spec);
+  }
+  for (int i = 0; i < kNumRegexes; ++i) {
+    AddPattern("GET", "/v1/resource" + std::to_string(i) + "/[0-9]+/.*", true,
+               &spec);
+  }
+  // A gRPC method.
+  AddPattern("POST", "/library.Library/GetBook", false, &spec);
+  return spec;
+}
+
+void BM_BuildMatcher(benchmark::State& state) {
+  HTTPAPISpec spec = BuildSpec();
+  while (state.KeepRunning()) {
+    HttpApiSpecMatcher matcher(spec);
+  }
+  state.counters["patterns"] = spec.patterns_size();
+}
+BENCHMARK(BM_BuildMatcher)->Unit(benchmark::kMillisecond);
+
+void RunAddAttributes(
+    benchmark::State& state,
+    const std::vector<std::pair<std::string, std::string>>& requests) {
+  auto parser = HttpApiSpecParser::Create(BuildSpec());
+  size_t num_attributes = 0;
+  size_t i = 0;
+  while (state.KeepRunning()) {
+    const auto& request = requests[i++ % requests.size()];
+    Attributes attributes;
+    parser->AddAttributes(request.first, request.second, &attributes);
+    num_attributes += attributes.attributes().size();
+  }
+  state.counters["attributes"] = num_attributes * 1.0 / state.iterations();
+}
+
+void BM_AddAttributesHot(benchmark::State& state) {
+  RunAddAttributes(state, {{"GET", "/v1/resource7/42"},
+                           {"GET", "/v1/resource99/1/items/2"},
+                           {"POST", "/library.Library/GetBook"},
+                           {"GET", "/healthz"}});
+}
+BENCHMARK(BM_AddAttributesHot);
+
+// More distinct paths than the match cache holds.
+void BM_AddAttributesCold(benchmark::State& state) {
+  std::vector<std::pair<std::string, std::string>> requests;
+  for (int i = 0; i < 5000; ++i) {
+    std::string r = "/v1/resource" + std::to_string(i % kNumResources);
+    switch (i % 5) {
+      case 0:
+        requests.emplace_back("GET", r + "/" + std::to_string(i));
+        break;
+      case 1:
+        requests.emplace_back("GET", r + "/" + std::to_string(i) + "/items/x");
+        break;
+      case 2:
+        requests.emplace_back("POST", r + "/" + std::to_string(i) + ":archive");
+        break;
+      case 3:
+        requests.emplace_back("GET",
+                              r + "/" + std::to_string(i) + "/files/a/b");
+        break;
+      default:
+        requests.emplace_back("GET", "/v2/unknown/" + std::to_string(i));
+        break;
+    }
+  }
+  RunAddAttributes(state, requests);
+}
+BENCHMARK(BM_AddAttributesCold);
+
+}  // namespace
+}  // namespace api_spec
+}  // namespace istio
+
+BENCHMARK_MAIN();
@@ -17,9 +17,13 @@
 #define ISTIO_API_SPEC_HTTP_ISTIO_API_SPEC_PARSER_IMPL_H_
 
 #include "include/istio/api_spec/http_api_spec_parser.h"
-#include "src/istio/api_spec/path_matcher.h"
+#include "include/istio/utils/simple_lru_cache.h"
+#include "include/istio/utils/simple_lru_cache_inl.h"
+#include "include/istio/utils/string_key.h"
+#include "src/istio/api_spec/http_api_spec_matcher.h"
 
-#include <regex>
+#include <memory>
+#include <string>
 #include <vector>
 
 namespace istio {
@@ -30,6 +34,7 @@ class HttpApiSpecParserImpl : public HttpApiSpecParser {
  public:
   HttpApiSpecParserImpl(
       const ::istio::mixer::v1::config::client::HTTPAPISpec& api_spec);
+  ~HttpApiSpecParserImpl();
 
   void AddAttributes(const std::string& http_method, const std::string& path,
                      ::istio::mixer::v1::Attributes* attributes) override;
@@ -38,28 +43,23 @@ class HttpApiSpecParserImpl : public HttpApiSpecParser {
                              std::string* api_key) override;
 
  private:
-  // Build PatchMatcher for extracting api attributes.
-  void BuildPathMatcher();
-  // Build Api key extraction used data.
-  void BuildApiKeyData();
+  // The compiled spec, shared with the parsers of the same spec.
+  std::shared_ptr<const HttpApiSpecMatcher> matcher_;
 
-  // The http api spec.
-  ::istio::mixer::v1::config::client::HTTPAPISpec api_spec_;
-
-  // The path matcher for all url templates
-  PathMatcherPtr<const ::istio::mixer::v1::Attributes*> path_matcher_;
-
-  struct RegexData {
-    RegexData(const std::string& regex, const std::string& http_method,
-              const ::istio::mixer::v1::Attributes* attributes)
-        : regex(regex), http_method(http_method), attributes(attributes) {}
-
-    std::regex regex;
-    std::string http_method;
-    // The attributes to add if matched.
-    const ::istio::mixer::v1::Attributes* attributes;
+  // The matched pattern attributes of the recent (http_method, path)s, to
+  // skip the path matcher and the regex patterns for the hot paths. It is
+  // owned by the parser, not shared with the matcher, so it needs no lock.
+  // A spec change builds a new parser with an empty cache.
+  struct MatchCacheElem {
+    std::vector<const ::istio::mixer::v1::Attributes*> attributes;
   };
-  std::vector<RegexData> regex_list_;
+  using MatchCache =
+      ::istio::utils::SimpleLRUCache<::istio::utils::StringKey, MatchCacheElem,
+                                     ::istio::utils::StringKey::Hash>;
+  std::unique_ptr<MatchCache> match_cache_;
+  // The buffer of the match cache key, reused to probe the cache without
+  // allocating.
+  std::string match_key_;
 };
 
 }  // namespace api_spec
@@ -18,6 +18,7 @@
 #include "google/protobuf/util/message_differencer.h"
 #include "gtest/gtest.h"
 #include "include/istio/utils/attributes_builder.h"
+#include "src/istio/api_spec/http_api_spec_matcher.h"
 #include "src/istio/control/http/mock_check_data.h"
 
 using ::google::protobuf::TextFormat;
@@ -111,6 +112,185 @@ TEST(HttpApiSpecParserTest, TestBoth) {
   EXPECT_TRUE(MessageDifferencer::Equals(attributes, expected));
 }
 
+const char kRegexSpec[] = R"(
+patterns {
+  attributes {
+    attributes {
+      key: "key1"
+      value {
+        string_value: "value1"
+      }
+    }
+  }
+  http_method: "GET"
+  regex: "/shelves?/[0-9]+"
+}
+patterns {
+  attributes {
+    attributes {
+      key: "key2"
+      value {
+        string_value: "value2"
+      }
+    }
+  }
+  http_method: "GET"
+  regex: "/books/.*|/magazines/.*"
+}
+patterns {
+  attributes {
+    attributes {
+      key: "key3"
+      value {
+        string_value: "value3"
+      }
+    }
+  }
+  http_method: "POST"
+  regex: "/books/.*"
+}
+)";
+
+TEST(HttpApiSpecParserTest, TestRegex) {
+  HTTPAPISpec spec;
+  ASSERT_TRUE(TextFormat::ParseFromString(kRegexSpec, &spec));
+  auto parser = HttpApiSpecParser::Create(spec);
+
+  auto keys = [&parser](const std::string& http_method,
+                        const std::string& path) {
+    Attributes attributes;
+    parser->AddAttributes(http_method, path, &attributes);
+    std::string keys;
+    for (const auto& key : {"key1", "key2", "key3"}) {
+      if (attributes.attributes().count(key) > 0) {
+        keys += key;
+      }
+    }
+    return keys;
+  };
+
+  // The last literal of a prefix is optional if quantified.
+  EXPECT_EQ(keys("GET", "/shelve/1"), "key1");
+  EXPECT_EQ(keys("GET", "/shelves/12"), "key1");
+  EXPECT_EQ(keys("GET", "/shelves/a"), "");
+  // An alternation has no literal prefix.
+  EXPECT_EQ(keys("GET", "/books/1"), "key2");
+  EXPECT_EQ(keys("GET", "/magazines/1"), "key2");
+  // Only the patterns of the method are matched.
+  EXPECT_EQ(keys("POST", "/books/1"), "key3");
+  EXPECT_EQ(keys("PUT", "/books/1"), "");
+}
+
+const char kGrpcSpec[] = R"(
+patterns {
+  attributes {
+    attributes {
+      key: "key1"
+      value {
+        string_value: "value1"
+      }
+    }
+  }
+  http_method: "POST"
+  uri_template: "/package.Service/Method"
+}
+patterns {
+  attributes {
+    attributes {
+      key: "key2"
+      value {
+        string_value: "value2"
+      }
+    }
+  }
+  http_method: "POST"
+  uri_template: "/package.Service/{method}"
+}
+patterns {
+  attributes {
+    attributes {
+      key: "key3"
+      value {
+        string_value: "value3"
+      }
+    }
+  }
+  http_method: "POST"
+  uri_template: "/package.Service/Method"
+}
+)";
+
+TEST(HttpApiSpecParserTest, TestLiteralPath) {
+  HTTPAPISpec spec;
+  ASSERT_TRUE(TextFormat::ParseFromString(kGrpcSpec, &spec));
+  auto parser = HttpApiSpecParser::Create(spec);
+
+  auto keys = [&parser](const std::string& http_method,
+                        const std::string& path) {
+    Attributes attributes;
+    parser->AddAttributes(http_method, path, &attributes);
+    std::string keys;
+    for (const auto& key : {"key1", "key2", "key3"}) {
+      if (attributes.attributes().count(key) > 0) {
+        keys += key;
+      }
+    }
+    return keys;
+  };
+
+  // The first registered literal path wins over the template.
+  EXPECT_EQ(keys("POST", "/package.Service/Method"), "key1");
+  EXPECT_EQ(keys("POST", "/package.Service/Other"), "key2");
+  // The paths not equal to the literal one go to the path matcher.
+  EXPECT_EQ(keys("POST", "/package.Service/Method/"), "key1");
+  EXPECT_EQ(keys("POST", "/package.Service/Method?a=b"), "key1");
+  EXPECT_EQ(keys("GET", "/package.Service/Method"), "");
+}
+
+TEST(HttpApiSpecParserTest, TestMatchCache) {
+  HTTPAPISpec spec;
+  ASSERT_TRUE(TextFormat::ParseFromString(kSpec, &spec));
+  auto parser = HttpApiSpecParser::Create(spec);
+
+  Attributes expected;
+  ASSERT_TRUE(TextFormat::ParseFromString(kResult, &expected));
+  // The same result when cached, and after being evicted by other paths.
+  for (int i = 0; i < 3; ++i) {
+    Attributes attributes;
+    parser->AddAttributes("GET", "/books/10", &attributes);
+    EXPECT_TRUE(MessageDifferencer::Equals(attributes, expected));
+
+    Attributes post_attributes;
+    parser->AddAttributes("POST", "/books/10", &post_attributes);
+    EXPECT_EQ(post_attributes.attributes().size(), 1);
+    EXPECT_EQ(post_attributes.attributes().count("key0"), 1);
+
+    for (int j = 0; j < 2000; ++j) {
+      Attributes other;
+      parser->AddAttributes("GET", "/shelves/" + std::to_string(j), &other);
+      EXPECT_EQ(other.attributes().size(), 1);
+    }
+  }
+}
+
+TEST(HttpApiSpecParserTest, TestSharedMatcher) {
+  HTTPAPISpec spec;
+  ASSERT_TRUE(TextFormat::ParseFromString(kSpec, &spec));
+  HTTPAPISpec same_spec;
+  ASSERT_TRUE(TextFormat::ParseFromString(kSpec, &same_spec));
+  HTTPAPISpec other_spec;
+  ASSERT_TRUE(TextFormat::ParseFromString(kRegexSpec, &other_spec));
+
+  // The specs with the same content share a matcher while it is alive.
+  auto matcher = HttpApiSpecMatcher::Get(spec);
+  EXPECT_EQ(HttpApiSpecMatcher::Get(same_spec), matcher);
+  EXPECT_NE(HttpApiSpecMatcher::Get(other_spec), matcher);
+
+  std::vector<const Attributes*> matched;
+  matcher->MatchAttributes("GET", "/books/10", &matched);
+  EXPECT_EQ(matched.size(), 2);
+}
+
 TEST(HttpApiSpecParserTest, TestDefaultApiKey) {
   HTTPAPISpec spec;
   auto parser = HttpApiSpecParser::Create(spec);
@@ -197,12 +377,12 @@ TEST(HttpApiSpecParserTest, TestCustomApiKey) {
   EXPECT_TRUE(parser->ExtractApiKey(&mock_data1, &api_key1));
   EXPECT_EQ(api_key1, "this-is-a-test-api-key");
 
-  // "api-key-header" header
+  // "api-key-header" header, header names are lowercased.
   ::testing::NiceMock<MockCheckData> mock_data2;
   EXPECT_CALL(mock_data2, FindHeaderByName(_, _))
       .WillRepeatedly(
           Invoke([](const std::string& name, std::string* value) -> bool {
-            if (name == "Api-Key-Header") {
+            if (name == "api-key-header") {
               *value = "this-is-a-test-api-key";
               return true;
             }
@@ -17,14 +17,17 @@
 #define ISTIO_API_SPEC_PATH_MATCHER_H_
 
 #include <cstddef>
+#include <deque>
 #include <memory>
 #include <set>
-#include <sstream>
 #include <string>
 #include <unordered_map>
 
+#include "absl/strings/string_view.h"
+
 #include "src/istio/api_spec/http_template.h"
 #include "src/istio/api_spec/path_matcher_node.h"
+#include "src/istio/api_spec/path_matcher_trie.h"
 
 namespace istio {
 namespace api_spec {
@@ -32,6 +35,17 @@ namespace api_spec {
 template <class Method>
 class PathMatcherBuilder;  // required for PathMatcher constructor
 
+// A variable binding referencing the matcher and the request, so it is only
+// valid as long as they are.
+struct VariableBindingView {
+  // The dot-delimited field path, e.g. "shelf.theme".
+  absl::string_view field_path;
+  // The value. If it has escaped characters, or joins path parts not
+  // separated by a single "/", it references a string of the storage passed
+  // to Lookup() instead.
+  absl::string_view value;
+};
+
 // The immutable, thread safe PathMatcher stores a mapping from a combination of
 // a service (host) name and a HTTP path to your method (MethodInfo*). It is
 // constructed with a PathMatcherBuilder and supports one operation: Lookup.
@@ -61,21 +75,38 @@ class PathMatcher {
                 std::vector<VariableBinding>* variable_bindings,
                 std::string* body_field_path) const;
 
+  // Same as above, with the bindings as views without copies. The unescaped
+  // values are added to storage. A lookup with no escaped values allocates
+  // nothing if variable_bindings has the capacity.
+  Method Lookup(const std::string& http_method, const std::string& path,
+                absl::string_view query_params,
+                std::vector<VariableBindingView>* variable_bindings,
+                std::deque<std::string>* storage,
+                std::string* body_field_path) const;
+
   Method Lookup(const std::string& http_method, const std::string& path) const;
 
  private:
   // Creates a Path Matcher with a Builder by moving the builder's root node.
   explicit PathMatcher(PathMatcherBuilder<Method>&& builder);
 
-  // A root node shared by all services, i.e. paths of all services will be
-  // registered to this node.
-  std::unique_ptr<PathMatcherNode> root_ptr_;
+  // The registered paths of all services, compiled from the builder's root
+  // node.
+  PathMatcherTrie trie_;
   // Holds the set of custom verbs found in configured templates.
   std::set<std::string> custom_verbs_;
   // Data we store per each registered method
   struct MethodData {
     Method method;
     std::vector<HttpTemplate::Variable> variables;
+    // The variables with their field path joined by ".", for the bindings
+    // as views.
+    struct PathVariable {
+      int start_segment;
+      int end_segment;
+      std::string field_path;
+    };
+    std::vector<PathVariable> path_variables;
     std::string body_field_path;
   };
   // The info associated with each method. The path matcher nodes
@@ -129,12 +160,27 @@ class PathMatcherBuilder {
 
 namespace {
 
+// Splits s by delim and appends the parts to elems. Unlike std::getline,
+// a trailing delim yields a trailing empty part.
+template <class Container>
+void SplitInto(absl::string_view s, char delim, Container* elems) {
+  size_t begin = 0;
+  for (size_t pos = s.find(delim); pos != absl::string_view::npos;
+       pos = s.find(delim, begin)) {
+    elems->emplace_back(s.data() + begin, pos - begin);
+    begin = pos + 1;
+  }
+  elems->emplace_back(s.data() + begin, s.size() - begin);
+}
+
 std::vector<std::string>& split(const std::string& s, char delim,
                                 std::vector<std::string>& elems) {
-  std::stringstream ss(s);
-  std::string item;
-  while (std::getline(ss, item, delim)) {
-    elems.push_back(item);
+  if (!s.empty()) {
+    SplitInto(s, delim, &elems);
+    // Like std::getline, a trailing delim does not yield an empty part.
+    if (elems.back().empty()) {
+      elems.pop_back();
+    }
   }
   return elems;
 }
@@ -192,7 +238,7 @@ inline int hex_digit_to_int(char c) {
 //
 // If the next three characters are an escaped character then this function will
 // also return what character is escaped.
-bool GetEscapedChar(const std::string& src, size_t i,
+bool GetEscapedChar(absl::string_view src, size_t i,
                     bool unescape_reserved_chars, char* out) {
   if (i + 2 < src.size() && src[i] == '%') {
     if (ascii_isxdigit(src[i + 1]) && ascii_isxdigit(src[i + 2])) {
@@ -208,48 +254,43 @@ bool GetEscapedChar(const std::string& src, size_t i,
   return false;
 }
 
-// Unescapes string 'part' and returns the unescaped string. Reserved characters
-// (as specified in RFC 6570) are not escaped if unescape_reserved_chars is
-// false.
-std::string UrlUnescapeString(const std::string& part,
-                              bool unescape_reserved_chars) {
-  std::string unescaped;
-  // Check whether we need to escape at all.
-  bool needs_unescaping = false;
+// Unescapes string 'part' and appends the unescaped string to 'out'. Reserved
+// characters (as specified in RFC 6570) are not escaped if
+// unescape_reserved_chars is false. The runs without escaped characters are
+// appended as they are.
+void AppendUrlUnescaped(absl::string_view part, bool unescape_reserved_chars,
+                        std::string* out) {
   char ch = '\0';
-  for (size_t i = 0; i < part.size(); ++i) {
+  size_t begin = 0;
+  // Jumps from '%' to '%' with find(), a vectorized memchr(), so a part
+  // without any is appended after a single scan.
+  for (size_t i = part.find('%'); i != absl::string_view::npos;
+       i = part.find('%', i)) {
     if (GetEscapedChar(part, i, unescape_reserved_chars, &ch)) {
-      needs_unescaping = true;
-      break;
-    }
-  }
-  if (!needs_unescaping) {
-    unescaped = part;
-    return unescaped;
-  }
-
-  unescaped.resize(part.size());
-
-  char* begin = &(unescaped)[0];
-  char* p = begin;
-
-  for (size_t i = 0; i < part.size();) {
-    if (GetEscapedChar(part, i, unescape_reserved_chars, &ch)) {
-      *p++ = ch;
+      out->append(part.data() + begin, i - begin);
+      out->push_back(ch);
       i += 3;
+      begin = i;
     } else {
-      *p++ = part[i];
       i += 1;
     }
   }
+  out->append(part.data() + begin, part.size() - begin);
+}
 
-  unescaped.resize(p - begin);
+// Unescapes string 'part' and returns the unescaped string. Reserved characters
+// (as specified in RFC 6570) are not escaped if unescape_reserved_chars is
+// false.
+std::string UrlUnescapeString(absl::string_view part,
+                              bool unescape_reserved_chars) {
+  std::string unescaped;
+  AppendUrlUnescaped(part, unescape_reserved_chars, &unescaped);
   return unescaped;
 }
 
 template <class VariableBinding>
 void ExtractBindingsFromPath(const std::vector<HttpTemplate::Variable>& vars,
-                             const std::vector<std::string>& parts,
+                             const PathMatcherNode::RequestPathParts& parts,
                              std::vector<VariableBinding>* bindings) {
   for (const auto& var : vars) {
     // Determine the subpath bound to the variable based on the
@@ -271,7 +312,7 @@ void ExtractBindingsFromPath(const std::vector<HttpTemplate::Variable>& vars,
     // Joins parts with "/"  to form a path string.
     for (size_t i = var.start_segment; i < end_segment; ++i) {
       // For multipart matches only unescape non-reserved characters.
-      binding.value += UrlUnescapeString(parts[i], !is_multipart);
+      AppendUrlUnescaped(parts[i], !is_multipart, &binding.value);
       if (i < end_segment - 1) {
         binding.value += "/";
       }
@@ -310,10 +351,80 @@ void ExtractBindingsFromQueryParameters(
   }
 }
 
+// Same as ExtractBindingsFromPath, with the values referencing the parts if
+// they have no escaped characters and are separated by a single "/".
+template <class PathVariable>
+void ExtractBindingViewsFromPath(const std::vector<PathVariable>& vars,
+                                 const PathMatcherNode::RequestPathParts& parts,
+                                 std::vector<VariableBindingView>* bindings,
+                                 std::deque<std::string>* storage) {
+  for (const auto& var : vars) {
+    size_t end_segment = (var.end_segment >= 0)
+                             ? var.end_segment
+                             : parts.size() + var.end_segment + 1;
+    bool is_multipart =
+        (end_segment - var.start_segment) > 1 || var.end_segment < 0;
+    absl::string_view value;
+    if (static_cast<size_t>(var.start_segment) < end_segment) {
+      const absl::string_view& first = parts[var.start_segment];
+      const absl::string_view& last = parts[end_segment - 1];
+      value = absl::string_view(first.data(),
+                                last.data() + last.size() - first.data());
+      bool contiguous = true;
+      for (size_t i = var.start_segment; i + 1 < end_segment; ++i) {
+        const char* separator = parts[i].data() + parts[i].size();
+        if (parts[i + 1].data() != separator + 1 || *separator != '/') {
+          contiguous = false;
+          break;
+        }
+      }
+      if (!contiguous || value.find('%') != absl::string_view::npos) {
+        storage->emplace_back();
+        std::string& joined = storage->back();
+        for (size_t i = var.start_segment; i < end_segment; ++i) {
+          AppendUrlUnescaped(parts[i], !is_multipart, &joined);
+          if (i < end_segment - 1) {
+            joined += "/";
+          }
+        }
+        value = joined;
+      }
+    }
+    bindings->push_back(VariableBindingView{var.field_path, value});
+  }
+}
+
+// Same as ExtractBindingsFromQueryParameters, with the field paths and the
+// values referencing query_params if they have no escaped characters.
+void ExtractBindingViewsFromQueryParameters(
+    absl::string_view query_params, const std::set<std::string>& system_params,
+    std::vector<VariableBindingView>* bindings,
+    std::deque<std::string>* storage) {
+  absl::InlinedVector<absl::string_view, 16> params;
+  if (!query_params.empty()) {
+    SplitInto(query_params, '&', &params);
+  }
+  for (const auto& param : params) {
+    size_t pos = param.find('=');
+    if (pos != 0 && pos != absl::string_view::npos) {
+      absl::string_view name = param.substr(0, pos);
+      if (system_params.find(std::string(name.data(), name.size())) ==
+          std::end(system_params)) {
+        absl::string_view value = param.substr(pos + 1);
+        if (value.find('%') != absl::string_view::npos) {
+          storage->push_back(UrlUnescapeString(value, true));
+          value = storage->back();
+        }
+        bindings->push_back(VariableBindingView{name, value});
+      }
+    }
+  }
+}
+
 // Converts a request path into a format that can be used to perform a request
 // lookup in the PathMatcher trie. This utility method sanitizes the request
-// path and then splits the path into slash separated parts. Returns an empty
-// vector if the sanitized path is "/".
+// path and then splits the path into slash separated parts, which reference
+// the path. Leaves the parts empty if the sanitized path is "/".
 //
 // custom_verbs is a set of configured custom verbs that are used to match
 // against any custom verbs in request path. If the request_path contains a
@@ -321,42 +432,40 @@ void ExtractBindingsFromQueryParameters(
 //
 // - Strips off query string: "/a?foo=bar" --> "/a"
 // - Collapses extra slashes: "///" --> "/"
-std::vector<std::string> ExtractRequestParts(
-    std::string path, const std::set<std::string>& custom_verbs) {
+void ExtractRequestParts(absl::string_view path,
+                         const std::set<std::string>& custom_verbs,
+                         PathMatcherNode::RequestPathParts* parts) {
   // Remove query parameters.
   path = path.substr(0, path.find_first_of('?'));
 
-  // Replace last ':' with '/' to handle custom verb.
+  // The custom verb after the last ':' is a separate part.
   // But not for /foo:bar/const.
+  absl::string_view verb;
+  bool has_verb = false;
   std::size_t last_colon_pos = path.find_last_of(':');
   std::size_t last_slash_pos = path.find_last_of('/');
-  if (last_colon_pos != std::string::npos && last_colon_pos > last_slash_pos) {
-    std::string verb = path.substr(last_colon_pos + 1);
+  if (last_colon_pos != absl::string_view::npos &&
+      last_colon_pos > last_slash_pos) {
+    verb = path.substr(last_colon_pos + 1);
     // only verb in the configured custom verbs, treat it as verb
-    // replace ":" with / as a separate segment.
-    if (custom_verbs.find(verb) != custom_verbs.end()) {
-      path[last_colon_pos] = '/';
+    // the ':' is a separator as if it were '/'.
+    if (custom_verbs.find(std::string(verb.data(), verb.size())) !=
+        custom_verbs.end()) {
+      has_verb = true;
+      path = path.substr(0, last_colon_pos);
     }
   }
 
-  std::vector<std::string> result;
   if (path.size() > 0) {
-    split(path.substr(1), '/', result);
+    SplitInto(path.substr(1), '/', parts);
+  }
+  if (has_verb) {
+    parts->push_back(verb);
   }
   // Removes all trailing empty parts caused by extra "/".
-  while (!result.empty() && (*(--result.end())).empty()) {
-    result.pop_back();
+  while (!parts->empty() && parts->back().empty()) {
+    parts->pop_back();
   }
-  return result;
-}
-
-// Looks up on a PathMatcherNode.
-PathMatcherLookupResult LookupInPathMatcherNode(
-    const PathMatcherNode& root, const std::vector<std::string>& parts,
-    const HttpMethod& http_method) {
-  PathMatcherLookupResult result;
-  root.LookupPath(parts.begin(), parts.end(), http_method, &result);
-  return result;
 }
 
 PathMatcherNode::PathInfo TransformHttpTemplate(const HttpTemplate& ht) {
@@ -376,7 +485,7 @@ PathMatcherNode::PathInfo TransformHttpTemplate(const HttpTemplate& ht) {
 
 template <class Method>
 PathMatcher<Method>::PathMatcher(PathMatcherBuilder<Method>&& builder)
-    : root_ptr_(std::move(builder.root_ptr_)),
+    : trie_(*builder.root_ptr_),
       custom_verbs_(std::move(builder.custom_verbs_)),
       methods_(std::move(builder.methods_)) {}
 
@@ -395,17 +504,10 @@ Method PathMatcher<Method>::Lookup(
     const std::string& query_params,
     std::vector<VariableBinding>* variable_bindings,
     std::string* body_field_path) const {
-  const std::vector<std::string> parts =
-      ExtractRequestParts(path, custom_verbs_);
-
-  // If service_name has not been registered to ESP and strict_service_matching_
-  // is set to false, tries to lookup the method in all registered services.
-  if (root_ptr_ == nullptr) {
-    return nullptr;
-  }
+  PathMatcherNode::RequestPathParts parts;
+  ExtractRequestParts(path, custom_verbs_, &parts);
 
-  PathMatcherLookupResult lookup_result =
-      LookupInPathMatcherNode(*root_ptr_, parts, http_method);
+  PathMatcherLookupResult lookup_result = trie_.Lookup(parts, http_method);
   // Return nullptr if nothing is found.
   // Not need to check duplication. Only first item is stored for duplicated
   if (lookup_result.data == nullptr) {
@@ -425,21 +527,42 @@ Method PathMatcher<Method>::Lookup(
   return method_data->method;
 }
 
-// TODO: refactor common code with method above
 template <class Method>
-Method PathMatcher<Method>::Lookup(const std::string& http_method,
-                                   const std::string& path) const {
-  const std::vector<std::string> parts =
-      ExtractRequestParts(path, custom_verbs_);
+Method PathMatcher<Method>::Lookup(
+    const std::string& http_method, const std::string& path,
+    absl::string_view query_params,
+    std::vector<VariableBindingView>* variable_bindings,
+    std::deque<std::string>* storage, std::string* body_field_path) const {
+  PathMatcherNode::RequestPathParts parts;
+  ExtractRequestParts(path, custom_verbs_, &parts);
 
-  // If service_name has not been registered to ESP and strict_service_matching_
-  // is set to false, tries to lookup the method in all registered services.
-  if (root_ptr_ == nullptr) {
+  PathMatcherLookupResult lookup_result = trie_.Lookup(parts, http_method);
+  if (lookup_result.data == nullptr) {
     return nullptr;
   }
+  MethodData* method_data = reinterpret_cast<MethodData*>(lookup_result.data);
+  if (variable_bindings != nullptr) {
+    variable_bindings->clear();
+    ExtractBindingViewsFromPath(method_data->path_variables, parts,
+                                variable_bindings, storage);
+    ExtractBindingViewsFromQueryParameters(
+        query_params, method_data->method->system_query_parameter_names(),
+        variable_bindings, storage);
+  }
+  if (body_field_path != nullptr) {
+    *body_field_path = method_data->body_field_path;
+  }
+  return method_data->method;
+}
+
+// TODO: refactor common code with method above
+template <class Method>
+Method PathMatcher<Method>::Lookup(const std::string& http_method,
+                                   const std::string& path) const {
+  PathMatcherNode::RequestPathParts parts;
+  ExtractRequestParts(path, custom_verbs_, &parts);
 
-  PathMatcherLookupResult lookup_result =
-      LookupInPathMatcherNode(*root_ptr_, parts, http_method);
+  PathMatcherLookupResult lookup_result = trie_.Lookup(parts, http_method);
   // Return nullptr if nothing is found.
   // Not need to check duplication. Only first item is stored for duplicated
   if (lookup_result.data == nullptr) {
@@ -479,6 +602,17 @@ bool PathMatcherBuilder<Method>::Register(std::string http_method,
   auto method_data = std::unique_ptr<MethodData>(new MethodData());
   method_data->method = method;
   method_data->variables = std::move(ht->Variables());
+  for (const auto& var : method_data->variables) {
+    std::string field_path;
+    for (const auto& field : var.field_path) {
+      if (!field_path.empty()) {
+        field_path += ".";
+      }
+      field_path += field;
+    }
+    method_data->path_variables.push_back(
+        {var.start_segment, var.end_segment, std::move(field_path)});
+  }
   method_data->body_field_path = std::move(body_field_path);
 
   if (!root_ptr_->InsertPath(path_info, http_method, method_data.get(), true)) {
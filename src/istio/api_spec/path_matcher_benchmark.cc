@@ -0,0 +1,176 @@
+/* Copyright 2018 Istio Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// A micro-benchmark for PathMatcher::Lookup with a REST style API spec.
+// Reports the heap allocations per lookup as a counter, which is only
+// counted in the alloc_accounting builds, see
+// include/istio/utils/alloc_accounting.h.
+
+#include "benchmark/benchmark.h"
+#include "include/istio/utils/alloc_accounting.h"
+#include "src/istio/api_spec/path_matcher.h"
+
+#include <deque>
+#include <memory>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace istio {
+namespace api_spec {
+namespace {
+
+using ::istio::utils::AllocStats;
+using ::istio::utils::GetThreadTotalAllocStats;
+
+// Reports the allocations per iteration since start.
+void SetAllocations(benchmark::State& state, const AllocStats& start) {
+  AllocStats end;
+  GetThreadTotalAllocStats(&end);
+  state.counters["allocs"] =
+      (end.allocations - start.allocations) * 1.0 / state.iterations();
+}
+
+struct Method {
+  std::string name;
+  std::set<std::string> system_params;
+
+  const std::set<std::string>& system_query_parameter_names() const {
+    return system_params;
+  }
+};
+
+struct Binding {
+  std::vector<std::string> field_path;
+  std::string value;
+};
+
+// The matcher shared by all cases, built on first use.
+const PathMatcher<const Method*>& GetMatcher() {
+  static std::vector<Method>* methods = new std::vector<Method>();
+  static PathMatcher<const Method*>* matcher = [] {
+    std::vector<std::pair<std::string, std::string>> templates;
+    for (const char* resource :
+         {"shelves", "authors", "publishers", "stores"}) {
+      std::string r(resource);
+      templates.emplace_back("GET", "/v1/" + r);
+      templates.emplace_back("POST", "/v1/" + r);
+      templates.emplace_back("GET", "/v1/" + r + "/{id}");
+      templates.emplace_back("DELETE", "/v1/" + r + "/{id}");
+      templates.emplace_back("GET", "/v1/" + r + "/{id}/books/{book}");
+      templates.emplace_back("POST", "/v1/" + r + "/{id}:archive");
+    }
+    templates.emplace_back("GET", "/v1/operations/**");
+    methods->resize(templates.size());
+
+    PathMatcherBuilder<const Method*> builder;
+    for (size_t i = 0; i < templates.size(); ++i) {
+      (*methods)[i].name = templates[i].first + " " + templates[i].second;
+      builder.Register(templates[i].first, templates[i].second, "",
+                       &(*methods)[i]);
+    }
+    return builder.Build().release();
+  }();
+  return *matcher;
+}
+
+void RunLookup(benchmark::State& state, const std::string& http_method,
+               const std::vector<std::string>& paths, bool expect_match) {
+  const auto& matcher = GetMatcher();
+  AllocStats start;
+  GetThreadTotalAllocStats(&start);
+  size_t i = 0;
+  while (state.KeepRunning()) {
+    bool matched =
+        matcher.Lookup(http_method, paths[i++ % paths.size()]) != nullptr;
+    if (matched != expect_match) {
+      state.SkipWithError("unexpected match result");
+      break;
+    }
+  }
+  SetAllocations(state, start);
+}
+
+void BM_LookupLiteral(benchmark::State& state) {
+  RunLookup(state, "GET", {"/v1/shelves", "/v1/stores"}, true);
+}
+BENCHMARK(BM_LookupLiteral);
+
+void BM_LookupVariables(benchmark::State& state) {
+  RunLookup(state, "GET",
+            {"/v1/shelves/1/books/2", "/v1/authors/shakespeare/books/hamlet"},
+            true);
+}
+BENCHMARK(BM_LookupVariables);
+
+void BM_LookupCustomVerb(benchmark::State& state) {
+  RunLookup(state, "POST",
+            {"/v1/shelves/1:archive", "/v1/stores/12345:archive"}, true);
+}
+BENCHMARK(BM_LookupCustomVerb);
+
+void BM_LookupWildcard(benchmark::State& state) {
+  RunLookup(state, "GET", {"/v1/operations/a/b/c/d", "/v1/operations/123"},
+            true);
+}
+BENCHMARK(BM_LookupWildcard);
+
+void BM_LookupQuery(benchmark::State& state) {
+  RunLookup(state, "GET", {"/v1/shelves/1?view=full&page=2"}, true);
+}
+BENCHMARK(BM_LookupQuery);
+
+void BM_LookupNoMatch(benchmark::State& state) {
+  RunLookup(state, "GET", {"/v2/unknown/path/segments"}, false);
+}
+BENCHMARK(BM_LookupNoMatch);
+
+// Looks up with the bindings, copied (argument 0) or as views (argument 1).
+// The bindings and the storage are reused by the lookups like a caller
+// would.
+void BM_LookupBindings(benchmark::State& state) {
+  const auto& matcher = GetMatcher();
+  const bool views = state.range(0) != 0;
+  const std::string path = "/v1/authors/shakespeare/books/hamlet";
+  const std::string query_params = "edition.year=1603&page=2";
+  std::vector<Binding> bindings;
+  std::vector<VariableBindingView> binding_views;
+  std::deque<std::string> storage;
+  std::string body_field_path;
+  AllocStats start;
+  GetThreadTotalAllocStats(&start);
+  size_t num_bindings = 0;
+  while (state.KeepRunning()) {
+    if (views) {
+      storage.clear();
+      matcher.Lookup("GET", path, query_params, &binding_views, &storage,
+                     nullptr);
+      num_bindings += binding_views.size();
+    } else {
+      matcher.Lookup("GET", path, query_params, &bindings, &body_field_path);
+      num_bindings += bindings.size();
+    }
+  }
+  SetAllocations(state, start);
+  state.counters["bindings"] = num_bindings * 1.0 / state.iterations();
+}
+BENCHMARK(BM_LookupBindings)->Arg(0)->Arg(1);
+
+}  // namespace
+}  // namespace api_spec
+}  // namespace istio
+
+BENCHMARK_MAIN();
@@ -23,6 +23,13 @@ const char HttpMethod_WILD_CARD[] = "*";
 
 namespace {
 
+// The child keys of the nodes matching any part, in the order of the
+// matching precedence.
+const std::string kSingleParameterKey(HttpTemplate::kSingleParameterKey);
+const std::string kWildCardPathPartKey(HttpTemplate::kWildCardPathPartKey);
+const std::string kWildCardPathKey(HttpTemplate::kWildCardPathKey);
+const std::string kHttpMethodWildCard(HttpMethod_WILD_CARD);
+
 // Tries to insert the given key-value pair into the collection. Returns nullptr
 // if the insert succeeds. Otherwise, returns a pointer to the existing value.
 //
@@ -136,7 +143,7 @@ std::unique_ptr<PathMatcherNode> PathMatcherNode::Clone() const {
 // result and returns true.
 void PathMatcherNode::LookupPath(const RequestPathParts::const_iterator current,
                                  const RequestPathParts::const_iterator end,
-                                 HttpMethod http_method,
+                                 const HttpMethod& http_method,
                                  PathMatcherLookupResult* result) const {
   // base case
   if (current == end) {
@@ -144,7 +151,7 @@ void PathMatcherNode::LookupPath(const RequestPathParts::const_iterator current,
       // If we didn't find a wrapper graph at this node, check if we have one
       // in a wildcard (**) child. If we do, use it. This will ensure we match
       // the root with wildcard templates.
-      auto pair = children_.find(HttpTemplate::kWildCardPathKey);
+      auto pair = children_.find(kWildCardPathKey);
       if (pair != children_.end()) {
         const auto& child = pair->second;
         child->GetResultForHttpMethod(http_method, result);
@@ -152,7 +159,10 @@ void PathMatcherNode::LookupPath(const RequestPathParts::const_iterator current,
     }
     return;
   }
-  if (LookupPathFromChild(*current, current, end, http_method, result)) {
+  // The part is short enough for the small string buffer in most paths, so
+  // the key does not allocate.
+  if (LookupPathFromChild(std::string(current->data(), current->size()),
+                          current, end, http_method, result)) {
     return;
   }
   // For wild card node, keeps searching for next path segment until either
@@ -165,10 +175,9 @@ void PathMatcherNode::LookupPath(const RequestPathParts::const_iterator current,
     return;
   }
 
-  for (const std::string& child_key :
-       {HttpTemplate::kSingleParameterKey, HttpTemplate::kWildCardPathPartKey,
-        HttpTemplate::kWildCardPathKey}) {
-    if (LookupPathFromChild(child_key, current, end, http_method, result)) {
+  for (const std::string* child_key :
+       {&kSingleParameterKey, &kWildCardPathPartKey, &kWildCardPathKey}) {
+    if (LookupPathFromChild(*child_key, current, end, http_method, result)) {
       return;
     }
   }
@@ -216,8 +225,9 @@ bool PathMatcherNode::InsertTemplate(
 }
 
 bool PathMatcherNode::LookupPathFromChild(
-    const std::string child_key, const RequestPathParts::const_iterator current,
-    const RequestPathParts::const_iterator end, HttpMethod http_method,
+    const std::string& child_key,
+    const RequestPathParts::const_iterator current,
+    const RequestPathParts::const_iterator end, const HttpMethod& http_method,
     PathMatcherLookupResult* result) const {
   auto pair = children_.find(child_key);
   if (pair != children_.end()) {
@@ -230,9 +240,9 @@ bool PathMatcherNode::LookupPathFromChild(
 }
 
 bool PathMatcherNode::GetResultForHttpMethod(
-    HttpMethod key, PathMatcherLookupResult* result) const {
+    const HttpMethod& key, PathMatcherLookupResult* result) const {
   const PathMatcherLookupResult* found_p =
-      Find2KeysOrNull(result_map_, key, HttpMethod_WILD_CARD);
+      Find2KeysOrNull(result_map_, key, kHttpMethodWildCard);
   if (found_p != nullptr) {
     *result = *found_p;
     return true;
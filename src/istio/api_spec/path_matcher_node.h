@@ -22,6 +22,9 @@
 #include <unordered_map>
 #include <vector>
 
+#include "absl/container/inlined_vector.h"
+#include "absl/strings/string_view.h"
+
 namespace istio {
 namespace api_spec {
 
@@ -109,7 +112,9 @@ class PathMatcherNode {
     std::vector<std::string> path_;
   };  // class PathInfo
 
-  typedef std::vector<std::string> RequestPathParts;
+  // The parts of a request path, referencing the path string. The inline
+  // storage covers the usual paths without a heap allocation.
+  typedef absl::InlinedVector<absl::string_view, 16> RequestPathParts;
 
   // Creates a Root node with an empty WrapperGraph map.
   PathMatcherNode() : result_map_(), children_(), wildcard_(false) {}
@@ -126,7 +131,7 @@ class PathMatcherNode {
   // VariableBindingInfoMap to the result pointers.
   void LookupPath(const RequestPathParts::const_iterator current,
                   const RequestPathParts::const_iterator end,
-                  HttpMethod http_method,
+                  const HttpMethod& http_method,
                   PathMatcherLookupResult* result) const;
 
   // This method inserts a path of nodes into this subtrie. The WrapperGraph,
@@ -141,6 +146,8 @@ class PathMatcherNode {
   void set_wildcard(bool wildcard) { wildcard_ = wildcard; }
 
  private:
+  friend class PathMatcherTrie;
+
   // This method inserts a path of nodes into this subtrie (described by the
   // vector<Info>, starting from the |current| position in the iterator of path
   // parts, and if necessary, creating intermediate nodes along the way. The
@@ -158,10 +165,10 @@ class PathMatcherNode {
   // Helper method for LookupPath. If the given child key exists, search
   // continues on the child node pointed by the child key with the next part
   // in the path. Returns true if found a match for the path eventually.
-  bool LookupPathFromChild(const std::string child_key,
+  bool LookupPathFromChild(const std::string& child_key,
                            const RequestPathParts::const_iterator current,
                            const RequestPathParts::const_iterator end,
-                           HttpMethod http_method,
+                           const HttpMethod& http_method,
                            PathMatcherLookupResult* result) const;
 
   // If a WrapperGraph is found for the provided key, then this method returns
@@ -170,7 +177,7 @@ class PathMatcherNode {
   //
   // NB: If result == nullptr, method will return bool value without modifying
   // result.
-  bool GetResultForHttpMethod(HttpMethod key,
+  bool GetResultForHttpMethod(const HttpMethod& key,
                               PathMatcherLookupResult* result) const;
 
   std::map<HttpMethod, PathMatcherLookupResult> result_map_;
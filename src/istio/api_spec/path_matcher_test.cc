@@ -123,6 +123,8 @@ class PathMatcherTest : public ::testing::Test {
 
   void Build() { matcher_ = builder_.Build(); }
 
+  const PathMatcher<MethodInfo*>* matcher() const { return matcher_.get(); }
+
   MethodInfo* LookupWithBodyFieldPath(std::string method, std::string path,
                                       Bindings* bindings,
                                       std::string* body_field_path) {
@@ -130,16 +132,34 @@ class PathMatcherTest : public ::testing::Test {
   }
 
   MethodInfo* Lookup(std::string method, std::string path, Bindings* bindings) {
-    std::string body_field_path;
-    return matcher_->Lookup(method, path, std::string(), bindings,
-                            &body_field_path);
+    return LookupWithParams(method, path, std::string(), bindings);
   }
 
   MethodInfo* LookupWithParams(std::string method, std::string path,
                                std::string query_params, Bindings* bindings) {
     std::string body_field_path;
-    return matcher_->Lookup(method, path, query_params, bindings,
-                            &body_field_path);
+    MethodInfo* result = matcher_->Lookup(method, path, query_params, bindings,
+                                          &body_field_path);
+    // The bindings as views are the same.
+    std::vector<VariableBindingView> views;
+    std::deque<std::string> storage;
+    std::string view_body_field_path;
+    EXPECT_EQ(result, matcher_->Lookup(method, path, query_params, &views,
+                                       &storage, &view_body_field_path));
+    EXPECT_EQ(body_field_path, view_body_field_path);
+    if (result && bindings) {
+      Bindings view_bindings;
+      for (const auto& view : views) {
+        Binding binding;
+        if (!view.field_path.empty()) {
+          SplitInto(view.field_path, '.', &binding.field_path);
+        }
+        binding.value = std::string(view.value.data(), view.value.size());
+        view_bindings.push_back(binding);
+      }
+      EXPECT_EQ(*bindings, view_bindings);
+    }
+    return result;
   }
 
   MethodInfo* LookupNoBindings(std::string method, std::string path) {
@@ -698,6 +718,42 @@ TEST_F(PathMatcherTest, BodyFieldPathTest) {
   EXPECT_EQ("e.f.g", body_field_path);
 }
 
+TEST_F(PathMatcherTest, VariableBindingViews) {
+  MethodInfo* a_b = AddGetPath("/a/{x=b/*}/{y=**}");
+  Build();
+
+  std::vector<VariableBindingView> views;
+  std::deque<std::string> storage;
+  std::string path = "/a/b/c/d/e";
+  std::string query_params = "z=f&t=g%20h";
+  EXPECT_EQ(matcher()->Lookup("GET", path, query_params, &views, &storage,
+                              nullptr),
+            a_b);
+  ASSERT_EQ(views.size(), 4);
+  // The values without escaped characters reference the request.
+  EXPECT_EQ(views[0].field_path, "x");
+  EXPECT_EQ(views[0].value, "b/c");
+  EXPECT_EQ(views[0].value.data(), path.data() + 3);
+  EXPECT_EQ(views[1].field_path, "y");
+  EXPECT_EQ(views[1].value, "d/e");
+  EXPECT_EQ(views[1].value.data(), path.data() + 7);
+  EXPECT_EQ(views[2].field_path, "z");
+  EXPECT_EQ(views[2].value.data(), query_params.data() + 2);
+  EXPECT_EQ(views[3].field_path, "t");
+  EXPECT_EQ(views[3].value, "g h");
+  EXPECT_EQ(storage.size(), 1);
+
+  // The values with escaped characters are stored, empty parts are kept.
+  storage.clear();
+  EXPECT_EQ(matcher()->Lookup("GET", "/a/b/c%20d//e", "", &views, &storage,
+                              nullptr),
+            a_b);
+  ASSERT_EQ(views.size(), 2);
+  EXPECT_EQ(views[0].value, "b/c d");
+  EXPECT_EQ(views[1].value, "/e");
+  EXPECT_EQ(storage.size(), 1);
+}
+
 TEST_F(PathMatcherTest, VariableBindingsWithQueryParams) {
   MethodInfo* a = AddGetPath("/a");
   MethodInfo* a_b = AddGetPath("/a/{x}/b");
@@ -754,6 +810,16 @@ TEST_F(PathMatcherTest, VariableBindingsWithQueryParamsEncoding) {
                 Binding{FieldPath{"x"}, "$%/ \n"},
             }),
             bindings);
+
+  // A '%' not followed by two hex digits is kept.
+  EXPECT_EQ(LookupWithParams("GET", "/a", "x=100%&y=%2&z=%zz%41", &bindings),
+            a);
+  EXPECT_EQ(Bindings({
+                Binding{FieldPath{"x"}, "100%"},
+                Binding{FieldPath{"y"}, "%2"},
+                Binding{FieldPath{"z"}, "%zzA"},
+            }),
+            bindings);
 }
 
 TEST_F(PathMatcherTest, VariableBindingsWithQueryParamsAndSystemParams) {
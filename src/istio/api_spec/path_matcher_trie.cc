@@ -0,0 +1,216 @@
+/* Copyright 2018 Istio Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/istio/api_spec/path_matcher_trie.h"
+#include "src/istio/api_spec/http_template.h"
+
+#include <algorithm>
+
+namespace istio {
+namespace api_spec {
+
+const int32_t PathMatcherTrie::kNoNode;
+
+PathMatcherTrie::PathMatcherTrie(const PathMatcherNode& root) {
+  typedef std::pair<const std::string, std::unique_ptr<PathMatcherNode>>
+      ChildEntry;
+
+  // The source nodes in breadth first order, the same order as nodes_.
+  std::vector<const PathMatcherNode*> queue{&root};
+  nodes_.emplace_back();
+  for (size_t i = 0; i < queue.size(); ++i) {
+    const PathMatcherNode& node = *queue[i];
+
+    std::vector<const ChildEntry*> sorted;
+    for (const auto& entry : node.children_) {
+      sorted.push_back(&entry);
+    }
+    std::sort(sorted.begin(), sorted.end(),
+              [](const ChildEntry* a, const ChildEntry* b) {
+                return a->first < b->first;
+              });
+
+    nodes_[i].children_begin = children_.size();
+    for (const ChildEntry* entry : sorted) {
+      const std::string& child_key = entry->first;
+      const int32_t index = queue.size();
+      queue.push_back(entry->second.get());
+      nodes_.emplace_back();
+      children_.push_back(Child{static_cast<uint32_t>(keys_.size()),
+                                static_cast<uint32_t>(child_key.size()),
+                                static_cast<uint32_t>(index)});
+      keys_.append(child_key);
+      if (child_key == HttpTemplate::kSingleParameterKey) {
+        nodes_[i].single_parameter_child = index;
+      } else if (child_key == HttpTemplate::kWildCardPathPartKey) {
+        nodes_[i].wild_card_path_part_child = index;
+      } else if (child_key == HttpTemplate::kWildCardPathKey) {
+        nodes_[i].wild_card_path_child = index;
+      }
+    }
+    nodes_[i].children_end = children_.size();
+    nodes_[i].wildcard = node.wildcard_;
+
+    if (!node.result_map_.empty()) {
+      nodes_[i].results = results_.size();
+      results_.emplace_back();
+      Results& results = results_.back();
+      for (const auto& entry : node.result_map_) {
+        MethodIndex method_index = GetMethodIndex(entry.first);
+        if (method_index == kOtherMethod) {
+          results.others.emplace_back(entry.first, entry.second);
+        } else {
+          results.methods[method_index] = entry.second;
+          results.registered |= 1u << method_index;
+        }
+      }
+    }
+  }
+}
+
+PathMatcherTrie::MethodIndex PathMatcherTrie::GetMethodIndex(
+    absl::string_view http_method) {
+  switch (http_method.size()) {
+    case 1:
+      if (http_method == "*") return kWildCardMethod;
+      break;
+    case 3:
+      if (http_method == "GET") return kGetMethod;
+      if (http_method == "PUT") return kPutMethod;
+      break;
+    case 4:
+      if (http_method == "POST") return kPostMethod;
+      if (http_method == "HEAD") return kHeadMethod;
+      break;
+    case 5:
+      if (http_method == "PATCH") return kPatchMethod;
+      break;
+    case 6:
+      if (http_method == "DELETE") return kDeleteMethod;
+      break;
+    case 7:
+      if (http_method == "OPTIONS") return kOptionsMethod;
+      break;
+  }
+  return kOtherMethod;
+}
+
+PathMatcherLookupResult PathMatcherTrie::Lookup(
+    const PathMatcherNode::RequestPathParts& parts,
+    absl::string_view http_method) const {
+  PathMatcherLookupResult result;
+  LookupPath(0, parts.begin(), parts.end(), GetMethodIndex(http_method),
+             http_method, &result);
+  return result;
+}
+
+int32_t PathMatcherTrie::FindChild(const Node& node,
+                                   absl::string_view key) const {
+  auto begin = children_.begin() + node.children_begin;
+  auto end = children_.begin() + node.children_end;
+  auto it = std::lower_bound(
+      begin, end, key, [this](const Child& child, absl::string_view key) {
+        return this->key(child) < key;
+      });
+  if (it != end && this->key(*it) == key) {
+    return it->node;
+  }
+  return kNoNode;
+}
+
+// The same search as PathMatcherNode::LookupPath, on the compiled nodes.
+void PathMatcherTrie::LookupPath(int32_t index, PartIterator current,
+                                 PartIterator end, MethodIndex method_index,
+                                 absl::string_view http_method,
+                                 PathMatcherLookupResult* result) const {
+  const Node& node = nodes_[index];
+  // base case
+  if (current == end) {
+    if (!GetResultForHttpMethod(node, method_index, http_method, result)) {
+      // If we didn't find a result at this node, check if we have one in a
+      // wildcard (**) child. This will ensure we match the root with
+      // wildcard templates.
+      if (node.wild_card_path_child != kNoNode) {
+        GetResultForHttpMethod(nodes_[node.wild_card_path_child],
+                               method_index, http_method, result);
+      }
+    }
+    return;
+  }
+  if (LookupPathFromChild(FindChild(node, *current), current, end,
+                          method_index, http_method, result)) {
+    return;
+  }
+  // For wild card node, keeps searching for next path segment until either
+  // 1) reaching the end (/foo/** case), or 2) all remaining segments match
+  // one of child branches (/foo/**/bar/xyz case).
+  if (node.wildcard) {
+    LookupPath(index, current + 1, end, method_index, http_method, result);
+    return;
+  }
+
+  for (int32_t child : {node.single_parameter_child,
+                        node.wild_card_path_part_child,
+                        node.wild_card_path_child}) {
+    if (LookupPathFromChild(child, current, end, method_index, http_method,
+                            result)) {
+      return;
+    }
+  }
+}
+
+bool PathMatcherTrie::LookupPathFromChild(
+    int32_t child, PartIterator current, PartIterator end,
+    MethodIndex method_index, absl::string_view http_method,
+    PathMatcherLookupResult* result) const {
+  if (child == kNoNode) {
+    return false;
+  }
+  LookupPath(child, current + 1, end, method_index, http_method, result);
+  return result->data != nullptr;
+}
+
+bool PathMatcherTrie::GetResultForHttpMethod(
+    const Node& node, MethodIndex method_index, absl::string_view http_method,
+    PathMatcherLookupResult* result) const {
+  if (node.results == kNoNode) {
+    return false;
+  }
+  const Results& results = results_[node.results];
+  const PathMatcherLookupResult* found = nullptr;
+  if (method_index != kOtherMethod) {
+    if (results.registered & (1u << method_index)) {
+      found = &results.methods[method_index];
+    }
+  } else {
+    for (const auto& other : results.others) {
+      if (other.first == http_method) {
+        found = &other.second;
+        break;
+      }
+    }
+  }
+  if (found == nullptr) {
+    if (!(results.registered & (1u << kWildCardMethod))) {
+      return false;
+    }
+    found = &results.methods[kWildCardMethod];
+  }
+  *result = *found;
+  return true;
+}
+
+}  // namespace api_spec
+}  // namespace istio
@@ -0,0 +1,135 @@
+/* Copyright 2018 Istio Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ISTIO_API_SPEC_PATH_MATCHER_TRIE_H_
+#define ISTIO_API_SPEC_PATH_MATCHER_TRIE_H_
+
+#include <stdint.h>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/strings/string_view.h"
+#include "src/istio/api_spec/path_matcher_node.h"
+
+namespace istio {
+namespace api_spec {
+
+// PathMatcherTrie is a compiled, read only copy of a PathMatcherNode trie for
+// fast lookups. The nodes are stored in one array in breadth first order. The
+// literal children of a node are a range of a table sorted by key, searched
+// with a binary search, and the children matching any part are indexed
+// directly. The results of a node are indexed by the common HTTP methods.
+//
+// Thread Safe.
+class PathMatcherTrie {
+ public:
+  // Compiles the trie rooted at root.
+  explicit PathMatcherTrie(const PathMatcherNode& root);
+
+  // Looks up the parts of a request path, with the same matching rules as
+  // PathMatcherNode::LookupPath from the root.
+  PathMatcherLookupResult Lookup(const PathMatcherNode::RequestPathParts& parts,
+                                 absl::string_view http_method) const;
+
+ private:
+  typedef PathMatcherNode::RequestPathParts::const_iterator PartIterator;
+
+  // The index of a missing node.
+  static const int32_t kNoNode = -1;
+
+  // The methods with a slot in Results, kOtherMethod for the other methods.
+  enum MethodIndex {
+    kGetMethod = 0,
+    kPostMethod,
+    kPutMethod,
+    kDeleteMethod,
+    kPatchMethod,
+    kHeadMethod,
+    kOptionsMethod,
+    kWildCardMethod,
+    kNumMethods,
+    kOtherMethod = kNumMethods,
+  };
+
+  // The results registered at a node.
+  struct Results {
+    // The results of the common methods indexed by MethodIndex.
+    PathMatcherLookupResult methods[kNumMethods];
+    // The bits of the registered methods, indexed by MethodIndex.
+    uint32_t registered = 0;
+    // The results of the other methods.
+    std::vector<std::pair<std::string, PathMatcherLookupResult>> others;
+  };
+
+  struct Node {
+    // The range of the literal children in children_.
+    uint32_t children_begin = 0;
+    uint32_t children_end = 0;
+    // The children matching any part.
+    int32_t single_parameter_child = kNoNode;
+    int32_t wild_card_path_part_child = kNoNode;
+    int32_t wild_card_path_child = kNoNode;
+    // The index of the results in results_, kNoNode if none.
+    int32_t results = kNoNode;
+    // True if this node represents a wildcard path '**'.
+    bool wildcard = false;
+  };
+
+  struct Child {
+    // The key, a range of keys_.
+    uint32_t key_begin;
+    uint32_t key_size;
+    // The index of the child node in nodes_.
+    uint32_t node;
+  };
+
+  static MethodIndex GetMethodIndex(absl::string_view http_method);
+
+  absl::string_view key(const Child& child) const {
+    return absl::string_view(keys_.data() + child.key_begin, child.key_size);
+  }
+
+  // Returns the index of the literal child with the key, kNoNode if none.
+  int32_t FindChild(const Node& node, absl::string_view key) const;
+
+  void LookupPath(int32_t node, PartIterator current, PartIterator end,
+                  MethodIndex method_index, absl::string_view http_method,
+                  PathMatcherLookupResult* result) const;
+
+  // Continues the search on the child, if any. Returns true if found a match
+  // for the path eventually.
+  bool LookupPathFromChild(int32_t child, PartIterator current,
+                           PartIterator end, MethodIndex method_index,
+                           absl::string_view http_method,
+                           PathMatcherLookupResult* result) const;
+
+  // Copies the result of the method, or of the wild card method, of the node
+  // to result. Returns false if there is none.
+  bool GetResultForHttpMethod(const Node& node, MethodIndex method_index,
+                              absl::string_view http_method,
+                              PathMatcherLookupResult* result) const;
+
+  std::vector<Node> nodes_;
+  std::vector<Child> children_;
+  // The keys of all the children.
+  std::string keys_;
+  std::vector<Results> results_;
+};
+
+}  // namespace api_spec
+}  // namespace istio
+
+#endif  // ISTIO_API_SPEC_PATH_MATCHER_TRIE_H_
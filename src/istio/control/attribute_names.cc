@@ -19,65 +19,70 @@ namespace istio {
 namespace control {
 
 // Define attribute names
-const char AttributeName::kSourceUser[] = "source.user";
-const char AttributeName::kSourcePrincipal[] = "source.principal";
+const std::string AttributeName::kSourceUser = "source.user";
+const std::string AttributeName::kSourcePrincipal = "source.principal";
 
-const char AttributeName::kRequestHeaders[] = "request.headers";
-const char AttributeName::kRequestHost[] = "request.host";
-const char AttributeName::kRequestMethod[] = "request.method";
-const char AttributeName::kRequestPath[] = "request.path";
-const char AttributeName::kRequestReferer[] = "request.referer";
-const char AttributeName::kRequestScheme[] = "request.scheme";
-const char AttributeName::kRequestBodySize[] = "request.size";
-const char AttributeName::kRequestTotalSize[] = "request.total_size";
-const char AttributeName::kRequestTime[] = "request.time";
-const char AttributeName::kRequestUserAgent[] = "request.useragent";
-const char AttributeName::kRequestApiKey[] = "request.api_key";
+const std::string AttributeName::kRequestHeaders = "request.headers";
+const std::string AttributeName::kRequestHost = "request.host";
+const std::string AttributeName::kRequestMethod = "request.method";
+const std::string AttributeName::kRequestPath = "request.path";
+const std::string AttributeName::kRequestReferer = "request.referer";
+const std::string AttributeName::kRequestScheme = "request.scheme";
+const std::string AttributeName::kRequestBodySize = "request.size";
+const std::string AttributeName::kRequestTotalSize = "request.total_size";
+const std::string AttributeName::kRequestTime = "request.time";
+const std::string AttributeName::kRequestUserAgent = "request.useragent";
+const std::string AttributeName::kRequestApiKey = "request.api_key";
 
-const char AttributeName::kResponseCode[] = "response.code";
-const char AttributeName::kResponseDuration[] = "response.duration";
-const char AttributeName::kResponseHeaders[] = "response.headers";
-const char AttributeName::kResponseBodySize[] = "response.size";
-const char AttributeName::kResponseTotalSize[] = "response.total_size";
-const char AttributeName::kResponseTime[] = "response.time";
+const std::string AttributeName::kResponseCode = "response.code";
+const std::string AttributeName::kResponseDuration = "response.duration";
+const std::string AttributeName::kResponseHeaders = "response.headers";
+const std::string AttributeName::kResponseBodySize = "response.size";
+const std::string AttributeName::kResponseTotalSize = "response.total_size";
+const std::string AttributeName::kResponseTime = "response.time";
 
 // TCP attributes
 // Downstream tcp connection: source ip/port.
-const char AttributeName::kSourceIp[] = "source.ip";
-const char AttributeName::kSourcePort[] = "source.port";
+const std::string AttributeName::kSourceIp = "source.ip";
+const std::string AttributeName::kSourcePort = "source.port";
 // Upstream tcp connection: destionation ip/port.
-const char AttributeName::kDestinationIp[] = "destination.ip";
-const char AttributeName::kDestinationPort[] = "destination.port";
-const char AttributeName::kConnectionReceviedBytes[] =
+const std::string AttributeName::kDestinationIp = "destination.ip";
+const std::string AttributeName::kDestinationPort = "destination.port";
+const std::string AttributeName::kConnectionReceviedBytes =
     "connection.received.bytes";
-const char AttributeName::kConnectionReceviedTotalBytes[] =
+const std::string AttributeName::kConnectionReceviedTotalBytes =
     "connection.received.bytes_total";
-const char AttributeName::kConnectionSendBytes[] = "connection.sent.bytes";
-const char AttributeName::kConnectionSendTotalBytes[] =
+const std::string AttributeName::kConnectionSendBytes = "connection.sent.bytes";
+const std::string AttributeName::kConnectionSendTotalBytes =
     "connection.sent.bytes_total";
-const char AttributeName::kConnectionDuration[] = "connection.duration";
-const char AttributeName::kConnectionMtls[] = "connection.mtls";
+const std::string AttributeName::kConnectionDuration = "connection.duration";
+const std::string AttributeName::kConnectionMtls = "connection.mtls";
 // Downstream TCP connection id.
-const char AttributeName::kConnectionId[] = "connection.id";
-const char AttributeName::kConnectionEvent[] = "connection.event";
+const std::string AttributeName::kConnectionId = "connection.id";
+const std::string AttributeName::kConnectionEvent = "connection.event";
 
 // Context attributes
-const char AttributeName::kContextProtocol[] = "context.protocol";
-const char AttributeName::kContextTime[] = "context.time";
+const std::string AttributeName::kContextProtocol = "context.protocol";
+const std::string AttributeName::kContextTime = "context.time";
+const std::string AttributeName::kContextRejectedCount =
+    "context.rejected_count";
 
 // Check error code and message.
-const char AttributeName::kCheckErrorCode[] = "check.error_code";
-const char AttributeName::kCheckErrorMessage[] = "check.error_message";
+const std::string AttributeName::kCheckErrorCode = "check.error_code";
+const std::string AttributeName::kCheckErrorMessage = "check.error_message";
 
 // Check and Quota cache hit
-const char AttributeName::kCheckCacheHit[] = "check.cache_hit";
-const char AttributeName::kQuotaCacheHit[] = "quota.cache_hit";
+const std::string AttributeName::kCheckCacheHit = "check.cache_hit";
+const std::string AttributeName::kQuotaCacheHit = "quota.cache_hit";
 
 // Authentication attributes
-const char AttributeName::kRequestAuthPrincipal[] = "request.auth.principal";
-const char AttributeName::kRequestAuthAudiences[] = "request.auth.audiences";
-const char AttributeName::kRequestAuthPresenter[] = "request.auth.presenter";
-const char AttributeName::kRequestAuthClaims[] = "request.auth.claims";
+const std::string AttributeName::kRequestAuthPrincipal =
+    "request.auth.principal";
+const std::string AttributeName::kRequestAuthAudiences =
+    "request.auth.audiences";
+const std::string AttributeName::kRequestAuthPresenter =
+    "request.auth.presenter";
+const std::string AttributeName::kRequestAuthClaims = "request.auth.claims";
 
 }  // namespace control
 }  // namespace istio
@@ -21,70 +21,73 @@
 namespace istio {
 namespace control {
 
-// Define attribute names
+// Define attribute names. They are strings, not char arrays, so that adding
+// an attribute doesn't construct a temporary string for its name.
 struct AttributeName {
   // source.user is replaced by source.principal
   // https://github.com/istio/istio/issues/4689
-  static const char kSourceUser[];
-  static const char kSourcePrincipal[];
+  static const std::string kSourceUser;
+  static const std::string kSourcePrincipal;
 
-  static const char kRequestHeaders[];
-  static const char kRequestHost[];
-  static const char kRequestMethod[];
-  static const char kRequestPath[];
-  static const char kRequestReferer[];
-  static const char kRequestScheme[];
-  static const char kRequestBodySize[];
+  static const std::string kRequestHeaders;
+  static const std::string kRequestHost;
+  static const std::string kRequestMethod;
+  static const std::string kRequestPath;
+  static const std::string kRequestReferer;
+  static const std::string kRequestScheme;
+  static const std::string kRequestBodySize;
   // Total size of request received, including request headers, body, and
   // trailers.
-  static const char kRequestTotalSize[];
-  static const char kRequestTime[];
-  static const char kRequestUserAgent[];
-  static const char kRequestApiKey[];
+  static const std::string kRequestTotalSize;
+  static const std::string kRequestTime;
+  static const std::string kRequestUserAgent;
+  static const std::string kRequestApiKey;
 
-  static const char kResponseCode[];
-  static const char kResponseDuration[];
-  static const char kResponseHeaders[];
-  static const char kResponseBodySize[];
+  static const std::string kResponseCode;
+  static const std::string kResponseDuration;
+  static const std::string kResponseHeaders;
+  static const std::string kResponseBodySize;
   // Total size of response sent, including response headers and body.
-  static const char kResponseTotalSize[];
-  static const char kResponseTime[];
+  static const std::string kResponseTotalSize;
+  static const std::string kResponseTime;
 
   // TCP attributes
   // Downstream tcp connection: source ip/port.
-  static const char kSourceIp[];
-  static const char kSourcePort[];
+  static const std::string kSourceIp;
+  static const std::string kSourcePort;
   // Upstream tcp connection: destionation ip/port.
 
-  static const char kDestinationIp[];
-  static const char kDestinationPort[];
-  static const char kConnectionReceviedBytes[];
-  static const char kConnectionReceviedTotalBytes[];
-  static const char kConnectionSendBytes[];
-  static const char kConnectionSendTotalBytes[];
-  static const char kConnectionDuration[];
-  static const char kConnectionMtls[];
-  static const char kConnectionId[];
+  static const std::string kDestinationIp;
+  static const std::string kDestinationPort;
+  static const std::string kConnectionReceviedBytes;
+  static const std::string kConnectionReceviedTotalBytes;
+  static const std::string kConnectionSendBytes;
+  static const std::string kConnectionSendTotalBytes;
+  static const std::string kConnectionDuration;
+  static const std::string kConnectionMtls;
+  static const std::string kConnectionId;
   // Record TCP connection status: open, continue, close
-  static const char kConnectionEvent[];
+  static const std::string kConnectionEvent;
 
   // Context attributes
-  static const char kContextProtocol[];
-  static const char kContextTime[];
+  static const std::string kContextProtocol;
+  static const std::string kContextTime;
+  // The number of rejections aggregated into one report.
+  static const std::string kContextRejectedCount;
 
   // Check error code and message.
-  static const char kCheckErrorCode[];
-  static const char kCheckErrorMessage[];
+  static const std::string kCheckErrorCode;
+  static const std::string kCheckErrorMessage;
 
   // Check and Quota cache hit
-  static const char kCheckCacheHit[];
-  static const char kQuotaCacheHit[];
+  static const std::string kCheckCacheHit;
+  static const std::string kQuotaCacheHit;
 
   // Authentication attributes
-  static const char kRequestAuthPrincipal[];
-  static const char kRequestAuthAudiences[];
-  static const char kRequestAuthPresenter[];
-  static const char kRequestAuthClaims[];
+  static const std::string kRequestAuthPrincipal;
+  static const std::string kRequestAuthAudiences;
+  static const std::string kRequestAuthPresenter;
+  static const std::string kRequestAuthClaims;
 };
 
 }  // namespace control
@@ -16,31 +16,53 @@
 #include "client_context_base.h"
 #include "include/istio/mixerclient/check_response.h"
 #include "include/istio/utils/attributes_builder.h"
+#include "include/istio/utils/fast_hash.h"
 #include "src/istio/control/attribute_names.h"
 
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
 using ::google::protobuf::util::Status;
 using ::istio::mixer::v1::config::client::NetworkFailPolicy;
 using ::istio::mixer::v1::config::client::TransportConfig;
+using ::istio::mixerclient::CacheBudget;
 using ::istio::mixerclient::CancelFunc;
+using ::istio::mixerclient::CheckCache;
 using ::istio::mixerclient::CheckOptions;
 using ::istio::mixerclient::CheckResponseInfo;
+using ::istio::mixerclient::ClientTuning;
 using ::istio::mixerclient::DoneFunc;
 using ::istio::mixerclient::Environment;
 using ::istio::mixerclient::MixerClientOptions;
+using ::istio::mixerclient::QuotaCache;
 using ::istio::mixerclient::QuotaOptions;
+using ::istio::mixerclient::ReportBatch;
 using ::istio::mixerclient::ReportOptions;
 using ::istio::mixerclient::Statistics;
+using ::istio::mixerclient::TrafficCaptureType;
 using ::istio::mixerclient::TransportCheckFunc;
 
 namespace istio {
 namespace control {
 namespace {
 
+// The number of shards for a check cache shared by multiple threads.
+const int kSharedCheckCacheShards = 16;
+
+// The number of shards for a quota cache shared by multiple threads.
+const int kSharedQuotaCacheShards = 16;
+
+// The interval to sweep expired cache items in the background.
+const int kCacheSweepIntervalMs = 1000;
+
 CheckOptions GetJustCheckOptions(const TransportConfig& config) {
   if (config.disable_check_cache()) {
     return CheckOptions(0);
   }
-  return CheckOptions();
+  CheckOptions options;
+  options.sweep_interval_ms = kCacheSweepIntervalMs;
+  return options;
 }
 
 CheckOptions GetCheckOptions(const TransportConfig& config) {
@@ -56,7 +78,148 @@ QuotaOptions GetQuotaOptions(const TransportConfig& config) {
   if (config.disable_quota_cache()) {
     return QuotaOptions(0, 1000);
   }
-  return QuotaOptions();
+  QuotaOptions options;
+  options.sweep_interval_ms = kCacheSweepIntervalMs;
+  return options;
+}
+
+// The shared caches still in use, by the key of the options they were
+// created with. A listener updated by LDS is built while the old one still
+// runs, so its new client contexts adopt the warm caches of the old ones.
+template <class Cache>
+class SharedCacheRegistry {
+ public:
+  // Returns the live cache created with key, or creates one.
+  template <class CreateFunc>
+  std::shared_ptr<Cache> Get(const std::string& key, CreateFunc create) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto it = caches_.begin(); it != caches_.end();) {
+      if (it->second.expired()) {
+        it = caches_.erase(it);
+      } else {
+        ++it;
+      }
+    }
+    std::shared_ptr<Cache> cache;
+    auto it = caches_.find(key);
+    if (it != caches_.end()) {
+      cache = it->second.lock();
+    }
+    if (cache) {
+      return cache;
+    }
+    cache = create();
+    if (cache) {
+      caches_[key] = cache;
+    }
+    return cache;
+  }
+
+ private:
+  std::mutex mutex_;
+  std::unordered_map<std::string, std::weak_ptr<Cache>> caches_;
+};
+
+// Appends a field of the options to a shared cache key.
+template <class T>
+void AppendKeyField(const T& value, std::string* key) {
+  key->push_back('\0');
+  key->append(std::to_string(value));
+}
+
+// The key of the shared check caches created with the options for the
+// cluster: a cache is only adopted by the clients of the same size,
+// expiration and fail policy.
+std::string SharedCheckCacheKey(const std::string& cluster,
+                                const CheckOptions& options) {
+  std::string key = cluster;
+  AppendKeyField(options.num_entries, &key);
+  AppendKeyField(options.max_bytes, &key);
+  AppendKeyField(options.num_shards, &key);
+  AppendKeyField(options.negative_cache_ttl_ms, &key);
+  AppendKeyField(options.stale_while_unavailable_ms, &key);
+  AppendKeyField(options.refresh_ahead_fraction, &key);
+  AppendKeyField(options.sweep_interval_ms, &key);
+  AppendKeyField(options.network_fail_open, &key);
+  AppendKeyField(options.node_cache_entries, &key);
+  key.push_back('\0');
+  key.append(options.node_cache_file);
+  key.push_back('\0');
+  key.append(options.node_cache_config_id);
+  key.push_back('\0');
+  key.append(options.partition_attribute);
+  return key;
+}
+
+// The key of the shared quota caches created with the options for the
+// cluster.
+std::string SharedQuotaCacheKey(const std::string& cluster,
+                                const QuotaOptions& options) {
+  std::string key = cluster;
+  AppendKeyField(options.num_entries, &key);
+  AppendKeyField(options.expiration_ms, &key);
+  AppendKeyField(options.max_bytes, &key);
+  AppendKeyField(options.num_shards, &key);
+  AppendKeyField(options.sweep_interval_ms, &key);
+  AppendKeyField(options.minimize_quota_requests, &key);
+  AppendKeyField(options.adaptive_prefetch, &key);
+  AppendKeyField(options.max_rejected_signatures, &key);
+  return key;
+}
+
+SharedCacheRegistry<CheckCache>& SharedCheckCaches() {
+  static SharedCacheRegistry<CheckCache>* caches =
+      new SharedCacheRegistry<CheckCache>;
+  return *caches;
+}
+
+SharedCacheRegistry<QuotaCache>& SharedQuotaCaches() {
+  static SharedCacheRegistry<QuotaCache>* caches =
+      new SharedCacheRegistry<QuotaCache>;
+  return *caches;
+}
+
+// Sets the check options set by the proxy.
+void ApplyCheckTuning(const ClientTuning& tuning, CheckOptions* options) {
+  options->hedge_percentile = tuning.hedge_percentile;
+  options->hedge_min_delay_ms = tuning.hedge_min_delay_ms;
+  options->breaker_consecutive_failures = tuning.breaker_consecutive_failures;
+  options->breaker_error_percent = tuning.breaker_error_percent;
+  options->breaker_window_calls = tuning.breaker_window_calls;
+  options->breaker_cooldown_ms = tuning.breaker_cooldown_ms;
+  options->partition_attribute = tuning.check_partition_attribute;
+  options->negative_cache_ttl_ms = tuning.negative_cache_ttl_ms;
+  options->stale_while_unavailable_ms = tuning.stale_while_unavailable_ms;
+  options->refresh_ahead_fraction = tuning.refresh_ahead_fraction;
+  options->max_bytes = tuning.check_cache_max_bytes;
+  options->overload_cache_fraction = tuning.overload_cache_fraction;
+}
+
+// Sets the quota options set by the proxy.
+void ApplyQuotaTuning(const ClientTuning& tuning, QuotaOptions* options) {
+  options->max_bytes = tuning.quota_cache_max_bytes;
+  options->batch_window_ms = tuning.quota_batch_window_ms;
+  options->max_batch_quotas = tuning.max_batch_quotas;
+  options->adaptive_prefetch = tuning.adaptive_prefetch;
+  options->minimize_quota_requests = tuning.minimize_quota_requests;
+  options->max_rejected_signatures = tuning.max_rejected_signatures;
+}
+
+// Sets the report options set by the proxy.
+void ApplyReportTuning(const ClientTuning& tuning, ReportOptions* options) {
+  options->spill_ring_file = tuning.spill_ring_file;
+  options->pipeline_queue_size = tuning.report_pipeline_queue_size;
+  options->overload_sample_rate = tuning.overload_report_sample_rate;
+  options->max_inflight_batches = tuning.report_max_inflight_batches;
+  options->max_buffered_bytes = tuning.report_max_buffered_bytes;
+  options->overflow_sample_rate = tuning.report_overflow_sample_rate;
+  options->max_batch_bytes = tuning.report_max_batch_bytes;
+  options->max_open_batches = tuning.report_max_open_batches;
+  options->aggregation_keys = tuning.report_aggregation_keys;
+  options->aggregation_sums = tuning.report_aggregation_sums;
+  options->aggregation_count_attribute =
+      tuning.report_aggregation_count_attribute;
+  options->full_report_sample_rate = tuning.report_full_sample_rate;
 }
 
 ReportOptions GetReportOptions(const TransportConfig& config) {
@@ -66,16 +229,152 @@ ReportOptions GetReportOptions(const TransportConfig& config) {
   return ReportOptions();
 }
 
-}  // namespace
-
-ClientContextBase::ClientContextBase(const TransportConfig& config,
-                                     const Environment& env) {
+MixerClientOptions GetMixerClientOptions(
+    const TransportConfig& config, const Environment& env,
+    const std::string& report_spill_file, int report_max_value_bytes,
+    std::shared_ptr<const std::vector<std::string>> global_words_extension,
+    int report_target_calls_per_second, int64_t report_target_batch_bytes,
+    const ClientTuning& tuning) {
   MixerClientOptions options(GetCheckOptions(config), GetReportOptions(config),
                              GetQuotaOptions(config));
+  ApplyCheckTuning(tuning, &options.check_options);
+  ApplyQuotaTuning(tuning, &options.quota_options);
+  ApplyReportTuning(tuning, &options.report_options);
+  options.report_options.spill_file = report_spill_file;
+  options.report_options.max_attribute_value_bytes = report_max_value_bytes;
+  options.report_options.target_report_calls_per_second =
+      report_target_calls_per_second;
+  options.report_options.target_batch_bytes = report_target_batch_bytes;
   options.env = env;
+  options.global_words_extension = global_words_extension;
+  return options;
+}
+
+}  // namespace
+
+ClientContextBase::ClientContextBase(
+    const TransportConfig& config, const Environment& env,
+    std::shared_ptr<CheckCache> shared_check_cache,
+    std::shared_ptr<QuotaCache> shared_quota_cache,
+    const std::string& report_spill_file, int report_max_value_bytes,
+    std::shared_ptr<const std::vector<std::string>> global_words_extension,
+    int report_target_calls_per_second, int64_t report_target_batch_bytes,
+    std::shared_ptr<ReportBatch> shared_report_batch,
+    std::shared_ptr<CacheBudget> cache_budget, const ClientTuning& tuning)
+    : traffic_capture_(env.traffic_capture) {
+  MixerClientOptions options = GetMixerClientOptions(
+      config, env, report_spill_file, report_max_value_bytes,
+      global_words_extension, report_target_calls_per_second,
+      report_target_batch_bytes, tuning);
+  options.check_options.shared_cache = shared_check_cache;
+  options.quota_options.shared_cache = shared_quota_cache;
+  options.report_options.shared_batch = shared_report_batch;
+  options.cache_budget = cache_budget;
   mixer_client_ = ::istio::mixerclient::CreateMixerClient(options);
 }
 
+std::shared_ptr<CheckCache> ClientContextBase::CreateSharedCheckCache(
+    const TransportConfig& config, const std::string& snapshot_file,
+    const std::string& node_cache_file, const std::string& mesh_config_id,
+    const ClientTuning& tuning) {
+  if (config.disable_check_cache()) {
+    return nullptr;
+  }
+  auto options = GetCheckOptions(config);
+  ApplyCheckTuning(tuning, &options);
+  options.num_shards = kSharedCheckCacheShards;
+  options.node_cache_file = node_cache_file;
+  // The cached responses are only valid for the same Mixer cluster.
+  options.node_cache_config_id = mesh_config_id;
+  options.node_cache_config_id.push_back('\0');
+  options.node_cache_config_id.append(config.check_cluster());
+  options.node_cache_config_id.push_back(options.network_fail_open ? '1'
+                                                                   : '0');
+  std::string key = SharedCheckCacheKey(config.check_cluster(), options);
+  // Each cache saves its own snapshot, named after its key so that the
+  // same cache of the next process loads it.
+  if (!snapshot_file.empty()) {
+    options.snapshot_file =
+        snapshot_file + "." +
+        utils::FastHash::DebugString(utils::FastHash()(key.data(), key.size()));
+  }
+  key.push_back('\0');
+  key.append(snapshot_file);
+  return SharedCheckCaches().Get(key, [&options]() {
+    return ::istio::mixerclient::CreateSharedCheckCache(options);
+  });
+}
+
+std::shared_ptr<QuotaCache> ClientContextBase::CreateSharedQuotaCache(
+    const TransportConfig& config, const ClientTuning& tuning) {
+  if (config.disable_quota_cache()) {
+    return nullptr;
+  }
+  auto options = GetQuotaOptions(config);
+  ApplyQuotaTuning(tuning, &options);
+  options.num_shards = kSharedQuotaCacheShards;
+  std::string key = SharedQuotaCacheKey(config.check_cluster(), options);
+  return SharedQuotaCaches().Get(key, [&options]() {
+    return ::istio::mixerclient::CreateSharedQuotaCache(options);
+  });
+}
+
+std::shared_ptr<ReportBatch> ClientContextBase::CreateSharedReportBatch(
+    const TransportConfig& config, const Environment& env,
+    const std::string& report_spill_file, int report_max_value_bytes,
+    std::shared_ptr<const std::vector<std::string>> global_words_extension,
+    int report_target_calls_per_second, int64_t report_target_batch_bytes,
+    const ClientTuning& tuning) {
+  return ::istio::mixerclient::CreateSharedReportBatch(GetMixerClientOptions(
+      config, env, report_spill_file, report_max_value_bytes,
+      global_words_extension, report_target_calls_per_second,
+      report_target_batch_bytes, tuning));
+}
+
+std::string ClientContextBase::SharedReportBatchKey(
+    const TransportConfig& config, const std::string& report_spill_file,
+    int report_max_value_bytes,
+    std::shared_ptr<const std::vector<std::string>> global_words_extension,
+    int report_target_calls_per_second, int64_t report_target_batch_bytes,
+    const ClientTuning& tuning) {
+  std::string key = config.report_cluster();
+  for (const auto& value :
+       {std::to_string(config.disable_report_batch()), report_spill_file,
+        std::to_string(report_max_value_bytes),
+        std::to_string(report_target_calls_per_second),
+        std::to_string(report_target_batch_bytes), tuning.spill_ring_file,
+        std::to_string(tuning.report_pipeline_queue_size),
+        std::to_string(tuning.overload_report_sample_rate),
+        std::to_string(tuning.report_max_inflight_batches),
+        std::to_string(tuning.report_max_buffered_bytes),
+        std::to_string(tuning.report_overflow_sample_rate),
+        std::to_string(tuning.report_max_batch_bytes),
+        std::to_string(tuning.report_max_open_batches),
+        tuning.report_aggregation_count_attribute,
+        std::to_string(tuning.report_full_sample_rate)}) {
+    key.push_back('\0');
+    key.append(value);
+  }
+  // The reports are folded by the same attributes.
+  for (const auto* names :
+       {&tuning.report_aggregation_keys, &tuning.report_aggregation_sums}) {
+    key.push_back('\0');
+    key.append(std::to_string(names->size()));
+    for (const auto& name : *names) {
+      key.push_back('\0');
+      key.append(name);
+    }
+  }
+  // The reports are compressed with the same global dictionary.
+  if (global_words_extension) {
+    for (const auto& word : *global_words_extension) {
+      key.push_back('\0');
+      key.append(word);
+    }
+  }
+  return key;
+}
+
 CancelFunc ClientContextBase::SendCheck(TransportCheckFunc transport,
                                         DoneFunc on_done,
                                         RequestContext* request) {
@@ -83,19 +382,41 @@ CancelFunc ClientContextBase::SendCheck(TransportCheckFunc transport,
   auto local_on_done = [request,
                         on_done](const CheckResponseInfo& check_response_info) {
     // save the check status code
-    request->check_status = check_response_info.response_status;
+    request->check_status = *check_response_info.response_status;
+    request->check_cache_hit = check_response_info.is_check_cache_hit;
+    request->quota_cache_hit = check_response_info.is_quota_cache_hit;
+    request->check_miss_reason = check_response_info.miss_reason;
 
     utils::AttributesBuilder builder(&request->attributes);
     builder.AddBool(AttributeName::kCheckCacheHit,
                     check_response_info.is_check_cache_hit);
     builder.AddBool(AttributeName::kQuotaCacheHit,
                     check_response_info.is_quota_cache_hit);
-    on_done(check_response_info.response_status);
+    on_done(*check_response_info.response_status);
   };
 
   // TODO: add debug message
   // GOOGLE_LOG(INFO) << "Check attributes: " <<
   // request->attributes.DebugString();
+  if (request->deferred_attribute_names) {
+    // The deferred attributes are only filled during the call.
+    CancelFunc cancel = mixer_client_->Check(
+        &request->attributes, *request->deferred_attribute_names,
+        request->fill_deferred_attributes, request->quotas, transport,
+        local_on_done);
+    request->deferred_attribute_names = nullptr;
+    request->fill_deferred_attributes = nullptr;
+    // Captured with the deferred attributes filled by the call.
+    if (traffic_capture_) {
+      traffic_capture_->Capture(TrafficCaptureType::CHECK, request->attributes,
+                                request->quotas);
+    }
+    return cancel;
+  }
+  if (traffic_capture_) {
+    traffic_capture_->Capture(TrafficCaptureType::CHECK, request->attributes,
+                              request->quotas);
+  }
   return mixer_client_->Check(request->attributes, request->quotas, transport,
                               local_on_done);
 }
@@ -104,9 +425,21 @@ void ClientContextBase::SendReport(const RequestContext& request) {
   // TODO: add debug message
   // GOOGLE_LOG(INFO) << "Report attributes: " <<
   // request.attributes.DebugString();
+  if (traffic_capture_) {
+    traffic_capture_->Capture(TrafficCaptureType::REPORT, request.attributes,
+                              {});
+  }
   mixer_client_->Report(request.attributes);
 }
 
+void ClientContextBase::SendReport(RequestContext&& request) {
+  if (traffic_capture_) {
+    traffic_capture_->Capture(TrafficCaptureType::REPORT, request.attributes,
+                              {});
+  }
+  mixer_client_->Report(std::move(request.attributes));
+}
+
 void ClientContextBase::GetStatistics(Statistics* stat) const {
   mixer_client_->GetStatistics(stat);
 }
@@ -17,6 +17,7 @@
 #define ISTIO_CONTROL_CLIENT_CONTEXT_BASE_H
 
 #include "include/istio/mixerclient/client.h"
+#include "include/istio/mixerclient/traffic_capture.h"
 #include "mixer/v1/config/client/client_config.pb.h"
 #include "request_context.h"
 
@@ -29,7 +30,23 @@ class ClientContextBase {
  public:
   ClientContextBase(
       const ::istio::mixer::v1::config::client::TransportConfig& config,
-      const ::istio::mixerclient::Environment& env);
+      const ::istio::mixerclient::Environment& env,
+      std::shared_ptr<::istio::mixerclient::CheckCache> shared_check_cache =
+          nullptr,
+      std::shared_ptr<::istio::mixerclient::QuotaCache> shared_quota_cache =
+          nullptr,
+      const std::string& report_spill_file = "",
+      int report_max_value_bytes = 0,
+      std::shared_ptr<const std::vector<std::string>> global_words_extension =
+          nullptr,
+      int report_target_calls_per_second = 0,
+      int64_t report_target_batch_bytes = 0,
+      std::shared_ptr<::istio::mixerclient::ReportBatch> shared_report_batch =
+          nullptr,
+      std::shared_ptr<::istio::mixerclient::CacheBudget> cache_budget =
+          nullptr,
+      const ::istio::mixerclient::ClientTuning& tuning =
+          ::istio::mixerclient::ClientTuning());
 
   // A constructor for unit-test to pass in a mock mixer_client
   ClientContextBase(
@@ -46,12 +63,78 @@ class ClientContextBase {
   // Use mixer client object to make a Report call.
   void SendReport(const RequestContext& request);
 
+  // Use mixer client object to make a Report call, taking the content of
+  // the request attributes.
+  void SendReport(RequestContext&& request);
+
   // Get statistics.
   void GetStatistics(::istio::mixerclient::Statistics* stat) const;
 
+  // Sets whether the mixer client sheds its work.
+  void SetOverloaded(bool overloaded) {
+    mixer_client_->SetOverloaded(overloaded);
+  }
+
+  // Starts draining the reports of the mixer client before a shutdown.
+  void DrainReports(int deadline_ms) {
+    mixer_client_->DrainReports(deadline_ms);
+  }
+
+  // Creates a sharded check cache to be shared by the client contexts
+  // created with the same transport config. Returns nullptr if check
+  // cache is disabled. If snapshot_file is not empty, the cache is warm
+  // started from it. If node_cache_file is not empty, it is backed by the
+  // node check cache of this file, keyed by the mesh config id and the
+  // check cluster. Its cache options set by the proxy, e.g. the partition
+  // attribute and the TTL tiers, are the ones of tuning. While a cache
+  // created with the same check cluster and cache options, e.g. sizes,
+  // fail policy, files and partition attribute, is in use, it is returned
+  // instead, so that a listener update keeps the cached responses.
+  static std::shared_ptr<::istio::mixerclient::CheckCache>
+  CreateSharedCheckCache(
+      const ::istio::mixer::v1::config::client::TransportConfig& config,
+      const std::string& snapshot_file, const std::string& node_cache_file,
+      const std::string& mesh_config_id,
+      const ::istio::mixerclient::ClientTuning& tuning);
+
+  // Creates a sharded quota cache to be shared by the client contexts
+  // created with the same transport config, with the quota options of
+  // tuning. Returns nullptr if quota cache is disabled. Like the check
+  // cache, a cache of the same check cluster and cache options in use is
+  // returned instead.
+  static std::shared_ptr<::istio::mixerclient::QuotaCache>
+  CreateSharedQuotaCache(
+      const ::istio::mixer::v1::config::client::TransportConfig& config,
+      const ::istio::mixerclient::ClientTuning& tuning);
+
+  // Creates a report batch to be shared by the client contexts of a thread
+  // created with the same SharedReportBatchKey(), so that the HTTP and TCP
+  // contexts reporting to the same Mixer fill the same batches. It reports
+  // with the transports, timer and stats sink of env, which outlive it.
+  // The other parameters are the ones of the constructor.
+  static std::shared_ptr<::istio::mixerclient::ReportBatch>
+  CreateSharedReportBatch(
+      const ::istio::mixer::v1::config::client::TransportConfig& config,
+      const ::istio::mixerclient::Environment& env,
+      const std::string& report_spill_file, int report_max_value_bytes,
+      std::shared_ptr<const std::vector<std::string>> global_words_extension,
+      int report_target_calls_per_second, int64_t report_target_batch_bytes,
+      const ::istio::mixerclient::ClientTuning& tuning);
+
+  // Returns the key of the report cluster and report options, the client
+  // contexts with the same key can share a report batch.
+  static std::string SharedReportBatchKey(
+      const ::istio::mixer::v1::config::client::TransportConfig& config,
+      const std::string& report_spill_file, int report_max_value_bytes,
+      std::shared_ptr<const std::vector<std::string>> global_words_extension,
+      int report_target_calls_per_second, int64_t report_target_batch_bytes,
+      const ::istio::mixerclient::ClientTuning& tuning);
+
  private:
   // The mixer client object with check cache and report batch features.
   std::unique_ptr<::istio::mixerclient::MixerClient> mixer_client_;
+  // The capture of the sampled calls, nullptr if not captured.
+  std::shared_ptr<::istio::mixerclient::TrafficCapture> traffic_capture_;
 };
 
 }  // namespace control
@@ -0,0 +1,501 @@
+/* Copyright 2018 Istio Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// A single-threaded load benchmark of the HTTP and TCP control layers, the
+// code the Envoy Mixer filters run for each request and connection, without
+// Envoy: //src/envoy/http/mixer:mixer_filter_benchmark runs the filters. The
+// requests go through a fake Mixer that answers Check calls after a
+// configurable number of later requests, with the given cache directives
+// (valid duration and use count), and acknowledges Report calls.
+//
+// Each workload prints its requests/s, the p50 and p99 time spent in the
+// control layer per request, the heap allocations per request, only
+// counted in the alloc_accounting builds, and the ratio of remote Check and
+// Report calls. The cache hit heavy workloads send 10 distinct requests,
+// the cache miss heavy ones only distinct requests.
+// The http.authn workloads add an authentication result, decoded from its
+// base64 header for each request in the header one, and kept in memory by
+// the environment in the memory one, as with the Envoy filters of a stream
+// sharing it.
+// Usage: control_benchmark [mixer_latency_requests] [valid_use_count]
+
+#include "include/istio/control/http/controller.h"
+#include "include/istio/control/tcp/controller.h"
+#include "include/istio/utils/alloc_accounting.h"
+#include "include/istio/utils/attributes_builder.h"
+#include "include/istio/utils/base64.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+using namespace std::chrono;
+using ::google::protobuf::util::Status;
+using ::istio::mixer::v1::CheckRequest;
+using ::istio::mixer::v1::CheckResponse;
+using ::istio::mixer::v1::ReferencedAttributes;
+using ::istio::mixer::v1::ReportRequest;
+using ::istio::mixer::v1::ReportResponse;
+using ::istio::mixer::v1::config::client::HttpClientConfig;
+using ::istio::mixer::v1::config::client::TcpClientConfig;
+using ::istio::mixerclient::CancelFunc;
+using ::istio::mixerclient::DoneFunc;
+using ::istio::mixerclient::Environment;
+using ::istio::mixerclient::Statistics;
+using ::istio::mixerclient::Timer;
+
+namespace istio {
+namespace control {
+namespace {
+
+// Returns the heap allocations of the thread so far.
+uint64_t ThreadAllocations() {
+  utils::AllocStats stats;
+  utils::GetThreadTotalAllocStats(&stats);
+  return stats.allocations;
+}
+
+// Number of requests of each workload.
+const int kNumRequests = 100000;
+
+// Number of distinct requests of the cache hit heavy workloads.
+const int kNumHitRequests = 10;
+
+// A timer never firing, the report batches are flushed by their size.
+class NoOpTimer : public Timer {
+ public:
+  void Stop() override {}
+  void Start(int interval_ms) override {}
+};
+
+// The fake Mixer server.
+class FakeMixer {
+ public:
+  FakeMixer(int latency_requests, int valid_use_count)
+      : latency_requests_(latency_requests), num_reports_(0) {
+    // The policies reference the destination service, the source IP and
+    // the request path.
+    auto precondition = response_.mutable_precondition();
+    precondition->mutable_valid_duration()->set_seconds(60);
+    precondition->set_valid_use_count(valid_use_count);
+    auto referenced = precondition->mutable_referenced_attributes();
+    for (const char* name :
+         {"destination.service", "source.ip", "request.path"}) {
+      referenced->add_words(name);
+      auto match = referenced->add_attribute_matches();
+      match->set_condition(ReferencedAttributes::EXACT);
+      match->set_name(-referenced->words_size());
+    }
+  }
+
+  void SetEnvironment(Environment* env) {
+    env->check_transport = [this](const CheckRequest& request,
+                                  CheckResponse* response,
+                                  DoneFunc on_done) -> CancelFunc {
+      pending_.push_back({response, on_done});
+      if (latency_requests_ == 0) {
+        Flush();
+      }
+      return nullptr;
+    };
+    env->report_transport = [this](const ReportRequest& request,
+                                   ReportResponse* response,
+                                   DoneFunc on_done) -> CancelFunc {
+      ++num_reports_;
+      on_done(Status::OK);
+      return nullptr;
+    };
+    env->timer_create_func = [](std::function<void()> timer_func) {
+      return std::unique_ptr<Timer>(new NoOpTimer());
+    };
+  }
+
+  // Called before each request, answers the checks made latency_requests
+  // requests ago.
+  void Tick() {
+    while (pending_.size() > static_cast<size_t>(latency_requests_)) {
+      Answer();
+    }
+  }
+
+  // Answers all pending checks.
+  void Flush() {
+    while (!pending_.empty()) {
+      Answer();
+    }
+  }
+
+  uint64_t num_reports() const { return num_reports_; }
+
+ private:
+  void Answer() {
+    Pending pending = pending_.front();
+    pending_.pop_front();
+    pending.response->CopyFrom(response_);
+    pending.on_done(Status::OK);
+  }
+
+  struct Pending {
+    CheckResponse* response;
+    DoneFunc on_done;
+  };
+  const int latency_requests_;
+  CheckResponse response_;
+  std::deque<Pending> pending_;
+  uint64_t num_reports_;
+};
+
+// Returns the IPv4 address 10.x.y.z of the index as 4 bytes.
+std::string SourceIp(int index) {
+  std::string ip(1, '\x0a');
+  ip += static_cast<char>(index >> 16);
+  ip += static_cast<char>(index >> 8);
+  ip += static_cast<char>(index);
+  return ip;
+}
+
+// How a request has its authentication result.
+enum class Authn { NONE, HEADER, MEMORY };
+
+// The authentication result of a request with a JWT.
+istio::authn::Result AuthnResult() {
+  istio::authn::Result result;
+  result.set_principal("https://accounts.example.com/user1");
+  result.set_peer_user("cluster.local/ns/default/sa/productpage");
+  auto origin = result.mutable_origin();
+  origin->set_user("https://accounts.example.com/user1");
+  origin->add_audiences("bookstore");
+  origin->set_presenter("productpage");
+  auto claims = origin->mutable_claims();
+  (*claims)["iss"] = "https://accounts.example.com";
+  (*claims)["sub"] = "user1";
+  (*claims)["aud"] = "bookstore";
+  (*claims)["azp"] = "productpage";
+  (*claims)["email"] = "user1@example.com";
+  return result;
+}
+
+// The data of a request, the index selects the source IP, port and path.
+class HttpData : public http::CheckData, public http::ReportData {
+ public:
+  HttpData(int index, Authn authn = Authn::NONE)
+      : source_ip_(SourceIp(index)),
+        path_("/books/" + std::to_string(index)),
+        authn_(authn) {
+    if (authn_ != Authn::NONE) {
+      authn_result_ = AuthnResult();
+      authn_header_ = utils::Base64Encode(authn_result_.SerializeAsString());
+    }
+  }
+
+  bool ExtractIstioAttributes(std::string* data) const override {
+    return false;
+  }
+  bool GetSourceIpPort(std::string* ip, int* port) const override {
+    *ip = source_ip_;
+    *port = 40000;
+    return true;
+  }
+  bool GetSourceUser(std::string* user) const override {
+    *user = "cluster.local/ns/default/sa/productpage";
+    return true;
+  }
+  std::map<std::string, std::string> GetRequestHeaders() const override {
+    return {{":path", path_},
+            {":method", "GET"},
+            {":authority", "books.default.svc.cluster.local"},
+            {"user-agent", "curl/7.54.0"},
+            {"x-request-id", "4f0b9e2c-5a8c-4a34-9d33-3c0c8a6d5e21"}};
+  }
+  bool IsMutualTLS() const override { return true; }
+  bool FindHeaderByType(HeaderType header_type,
+                        std::string* value) const override {
+    switch (header_type) {
+      case HEADER_PATH:
+        *value = path_;
+        return true;
+      case HEADER_HOST:
+        *value = "books.default.svc.cluster.local";
+        return true;
+      case HEADER_METHOD:
+        *value = "GET";
+        return true;
+      default:
+        return false;
+    }
+  }
+  bool FindHeaderByName(const std::string& name,
+                        std::string* value) const override {
+    return false;
+  }
+  bool FindQueryParameter(const std::string& name,
+                          std::string* value) const override {
+    return false;
+  }
+  bool FindCookie(const std::string& name, std::string* value) const override {
+    return false;
+  }
+  bool GetJWTPayload(
+      std::map<std::string, std::string>* payload) const override {
+    return false;
+  }
+  bool GetAuthenticationResult(istio::authn::Result* result) const override {
+    if (authn_ != Authn::HEADER) {
+      return false;
+    }
+    std::string data;
+    return utils::Base64Decode(authn_header_, &data) &&
+           result->ParseFromString(data);
+  }
+  const istio::authn::Result* FindAuthenticationResult() const override {
+    return authn_ == Authn::MEMORY ? &authn_result_ : nullptr;
+  }
+
+  std::map<std::string, std::string> GetResponseHeaders() const override {
+    return {{":status", "200"},
+            {"content-type", "application/json"},
+            {"content-length", "1024"}};
+  }
+  void GetReportInfo(http::ReportData::ReportInfo* info) const override {
+    info->request_total_size = 256;
+    info->response_total_size = 1280;
+    info->request_body_size = 0;
+    info->response_body_size = 1024;
+    info->duration = milliseconds(2);
+    info->response_code = 200;
+  }
+  bool GetDestinationIpPort(std::string* ip, int* port) const override {
+    *ip = std::string("\x0a\x00\x01\x01", 4);
+    *port = 9080;
+    return true;
+  }
+
+ private:
+  std::string source_ip_;
+  std::string path_;
+  Authn authn_;
+  istio::authn::Result authn_result_;
+  std::string authn_header_;
+};
+
+// Drops the forwarded attributes.
+class NoOpHeaderUpdate : public http::HeaderUpdate {
+ public:
+  void RemoveIstioAttributes() override {}
+  void AddIstioAttributes(const std::string& data) override {}
+};
+
+// The data of a connection, the index selects the source IP.
+class TcpData : public tcp::CheckData, public tcp::ReportData {
+ public:
+  TcpData(int index)
+      : source_ip_(SourceIp(index)),
+        connection_id_("ab5d1c2e-" + std::to_string(index)) {}
+
+  bool GetSourceIpPort(std::string* ip, int* port) const override {
+    *ip = source_ip_;
+    *port = 40000;
+    return true;
+  }
+  bool GetSourceUser(std::string* user) const override {
+    *user = "cluster.local/ns/default/sa/productpage";
+    return true;
+  }
+  bool IsMutualTLS() const override { return true; }
+  bool GetLocalAddress(std::string* address) const override {
+    *address = "10.0.1.1:3306";
+    return true;
+  }
+  std::string GetConnectionId() const override { return connection_id_; }
+
+  bool GetDestinationIpPort(std::string* ip, int* port) const override {
+    *ip = std::string("\x0a\x00\x01\x01", 4);
+    *port = 3306;
+    return true;
+  }
+  void GetReportInfo(tcp::ReportData::ReportInfo* info) const override {
+    info->received_bytes = 4096;
+    info->send_bytes = 65536;
+    info->duration = milliseconds(20);
+  }
+
+ private:
+  std::string source_ip_;
+  std::string connection_id_;
+};
+
+// Prints the results of a workload. times are the nanoseconds spent in the
+// control layer by each request.
+void Print(const char* name, std::vector<int64_t>* times, nanoseconds elapsed,
+           uint64_t allocations, const Statistics& stat,
+           const FakeMixer& mixer) {
+  std::sort(times->begin(), times->end());
+  size_t n = times->size();
+  printf(
+      "%-16s %8.0f req/s  p50 %6.2f us  p99 %6.2f us  %5.1f allocs/req  "
+      "remote checks %5.3f  remote reports %5.3f\n",
+      name, n * 1e9 / elapsed.count(), (*times)[n / 2] / 1000.0,
+      (*times)[n * 99 / 100] / 1000.0, static_cast<double>(allocations) / n,
+      static_cast<double>(stat.total_remote_check_calls) /
+          std::max<uint64_t>(stat.total_check_calls, 1),
+      static_cast<double>(mixer.num_reports()) /
+          std::max<uint64_t>(stat.total_report_calls, 1));
+}
+
+// A request between its Check and its Report. The handler has to outlive
+// the Check, its callback saves the check status in the handler.
+template <class Handler, class Data>
+struct InFlight {
+  std::unique_ptr<Handler> handler;
+  Data* data;
+  int64_t time;
+  bool done;
+};
+
+// Reports the requests whose Check is done, in their order, adding the
+// report time to their time.
+template <class Handler, class Data, class ReportFunc>
+void ReportDone(std::deque<InFlight<Handler, Data>>* in_flight,
+                std::vector<int64_t>* times, ReportFunc report) {
+  while (!in_flight->empty() && in_flight->front().done) {
+    auto& request = in_flight->front();
+    auto start = steady_clock::now();
+    report(request.handler.get(), request.data);
+    request.handler.reset();
+    times->push_back(request.time + duration_cast<nanoseconds>(
+                                        steady_clock::now() - start)
+                                        .count());
+    in_flight->pop_front();
+  }
+}
+
+void RunHttp(const char* name, int num_distinct, int latency_requests,
+             int valid_use_count, Authn authn = Authn::NONE) {
+  HttpClientConfig config;
+  (*config.mutable_service_configs())[":default"];
+  config.set_default_destination_service(":default");
+  FakeMixer mixer(latency_requests, valid_use_count);
+  http::Controller::Options options(config);
+  mixer.SetEnvironment(&options.env);
+  auto controller = http::Controller::Create(options);
+
+  std::vector<HttpData> data;
+  for (int i = 0; i < num_distinct; ++i) {
+    data.emplace_back(i, authn);
+  }
+  NoOpHeaderUpdate header_update;
+  auto report = [](http::RequestHandler* handler, HttpData* request) {
+    handler->Report(request);
+  };
+  std::deque<InFlight<http::RequestHandler, HttpData>> in_flight;
+  std::vector<int64_t> times;
+  times.reserve(kNumRequests);
+  uint64_t allocations = ThreadAllocations();
+  auto start = steady_clock::now();
+  for (int i = 0; i < kNumRequests; ++i) {
+    mixer.Tick();
+    ReportDone(&in_flight, &times, report);
+    in_flight.push_back({nullptr, &data[i % num_distinct], 0, false});
+    auto& request = in_flight.back();
+    auto request_start = steady_clock::now();
+    request.handler =
+        controller->CreateRequestHandler(http::Controller::PerRouteConfig());
+    bool* done = &request.done;
+    request.handler->Check(request.data, &header_update, nullptr,
+                           [done](const Status& status) { *done = true; });
+    request.time =
+        duration_cast<nanoseconds>(steady_clock::now() - request_start)
+            .count();
+  }
+  mixer.Flush();
+  ReportDone(&in_flight, &times, report);
+  auto elapsed = duration_cast<nanoseconds>(steady_clock::now() - start);
+  allocations = ThreadAllocations() - allocations;
+
+  Statistics stat;
+  controller->GetStatistics(&stat);
+  Print(name, &times, elapsed, allocations, stat, mixer);
+}
+
+void RunTcp(const char* name, int num_distinct, int latency_requests,
+            int valid_use_count) {
+  TcpClientConfig config;
+  FakeMixer mixer(latency_requests, valid_use_count);
+  tcp::Controller::Options options(config);
+  mixer.SetEnvironment(&options.env);
+  auto controller = tcp::Controller::Create(options);
+
+  std::vector<TcpData> data;
+  for (int i = 0; i < num_distinct; ++i) {
+    data.emplace_back(i);
+  }
+  // A periodical report and the final one for each connection.
+  auto report = [](tcp::RequestHandler* handler, TcpData* connection) {
+    handler->Report(connection, /* is_final_report */ false);
+    handler->Report(connection, /* is_final_report */ true);
+  };
+  std::deque<InFlight<tcp::RequestHandler, TcpData>> in_flight;
+  std::vector<int64_t> times;
+  times.reserve(kNumRequests);
+  uint64_t allocations = ThreadAllocations();
+  auto start = steady_clock::now();
+  for (int i = 0; i < kNumRequests; ++i) {
+    mixer.Tick();
+    ReportDone(&in_flight, &times, report);
+    in_flight.push_back({nullptr, &data[i % num_distinct], 0, false});
+    auto& connection = in_flight.back();
+    auto request_start = steady_clock::now();
+    connection.handler = controller->CreateRequestHandler();
+    bool* done = &connection.done;
+    connection.handler->Check(connection.data,
+                              [done](const Status& status) { *done = true; });
+    connection.time =
+        duration_cast<nanoseconds>(steady_clock::now() - request_start)
+            .count();
+  }
+  mixer.Flush();
+  ReportDone(&in_flight, &times, report);
+  auto elapsed = duration_cast<nanoseconds>(steady_clock::now() - start);
+  allocations = ThreadAllocations() - allocations;
+
+  Statistics stat;
+  controller->GetStatistics(&stat);
+  Print(name, &times, elapsed, allocations, stat, mixer);
+}
+
+}  // namespace
+}  // namespace control
+}  // namespace istio
+
+int main(int argc, char** argv) {
+  int latency_requests = argc > 1 ? atoi(argv[1]) : 10;
+  int valid_use_count = argc > 2 ? atoi(argv[2]) : 10000;
+  using namespace ::istio::control;
+  RunHttp("http.hit", kNumHitRequests, latency_requests, valid_use_count);
+  RunHttp("http.miss", kNumRequests, latency_requests, valid_use_count);
+  RunHttp("http.authn.hdr", kNumHitRequests, latency_requests, valid_use_count,
+          Authn::HEADER);
+  RunHttp("http.authn.mem", kNumHitRequests, latency_requests, valid_use_count,
+          Authn::MEMORY);
+  RunTcp("tcp.hit", kNumHitRequests, latency_requests, valid_use_count);
+  RunTcp("tcp.miss", kNumRequests, latency_requests, valid_use_count);
+  return 0;
+}
@@ -16,38 +16,64 @@
 #include "src/istio/control/http/attributes_builder.h"
 
 #include "include/istio/utils/attributes_builder.h"
+#include "include/istio/utils/base64.h"
 #include "include/istio/utils/status.h"
 #include "src/istio/control/attribute_names.h"
 
 using ::istio::mixer::v1::Attributes;
 using ::istio::mixer::v1::Attributes_StringMap;
+using ::istio::utils::StringKey;
 
 namespace istio {
 namespace control {
 namespace http {
+namespace {
 
-void AttributesBuilder::ExtractRequestHeaderAttributes(CheckData *check_data) {
-  utils::AttributesBuilder builder(&request_->attributes);
-  std::map<std::string, std::string> headers = check_data->GetRequestHeaders();
-  builder.AddStringMap(AttributeName::kRequestHeaders, headers);
-
-  struct TopLevelAttr {
-    CheckData::HeaderType header_type;
-    const std::string &name;
-    bool set_default;
-    const char *default_value;
-  };
-  static TopLevelAttr attrs[] = {
-      {CheckData::HEADER_HOST, AttributeName::kRequestHost, true, ""},
-      {CheckData::HEADER_METHOD, AttributeName::kRequestMethod, false, ""},
-      {CheckData::HEADER_PATH, AttributeName::kRequestPath, true, ""},
-      {CheckData::HEADER_REFERER, AttributeName::kRequestReferer, false, ""},
-      {CheckData::HEADER_SCHEME, AttributeName::kRequestScheme, true, "http"},
-      {CheckData::HEADER_USER_AGENT, AttributeName::kRequestUserAgent, false,
-       ""},
-  };
-
-  for (const auto &it : attrs) {
+// Adds a string map attribute filled by add_entries, if it is not empty.
+template <class AddEntries>
+void AddStringMapAttribute(const std::string &name, AddEntries add_entries,
+                           Attributes *attributes) {
+  auto *attributes_map = attributes->mutable_attributes();
+  auto *entries =
+      (*attributes_map)[name].mutable_string_map_value()->mutable_entries();
+  entries->clear();
+  add_entries(entries);
+  if (entries->empty()) {
+    attributes_map->erase(name);
+  }
+}
+
+// The top level header attributes. The deferred ones are left out of the
+// check cache lookup of a check without report, until a learned
+// referenced shape needs them.
+const struct {
+  CheckData::HeaderType header_type;
+  const std::string &name;
+  bool set_default;
+  const char *default_value;
+  bool deferred;
+} kHeaderAttributes[] = {
+    {CheckData::HEADER_HOST, AttributeName::kRequestHost, true, "", false},
+    {CheckData::HEADER_METHOD, AttributeName::kRequestMethod, false, "",
+     false},
+    {CheckData::HEADER_PATH, AttributeName::kRequestPath, true, "", false},
+    {CheckData::HEADER_REFERER, AttributeName::kRequestReferer, false, "",
+     true},
+    {CheckData::HEADER_SCHEME, AttributeName::kRequestScheme, true, "http",
+     true},
+    {CheckData::HEADER_USER_AGENT, AttributeName::kRequestUserAgent, false,
+     "", true},
+};
+
+// Adds the top level header attributes, only the deferred ones if
+// deferred_only, else all of them unless defer is also true.
+void AddHeaderAttributes(CheckData *check_data, bool defer,
+                         bool deferred_only, Attributes *attributes) {
+  utils::AttributesBuilder builder(attributes);
+  for (const auto &it : kHeaderAttributes) {
+    if ((deferred_only && !it.deferred) || (defer && it.deferred)) {
+      continue;
+    }
     std::string data;
     if (check_data->FindHeaderByType(it.header_type, &data)) {
       builder.AddString(it.name, data);
@@ -57,9 +83,71 @@ void AttributesBuilder::ExtractRequestHeaderAttributes(CheckData *check_data) {
   }
 }
 
-void AttributesBuilder::ExtractAuthAttributes(CheckData *check_data) {
-  istio::authn::Result authn_result;
-  if (check_data->GetAuthenticationResult(&authn_result)) {
+// Adds the deferred connection attributes.
+void AddDeferredConnectionAttributes(CheckData *check_data,
+                                     Attributes *attributes) {
+  utils::AttributesBuilder builder(attributes);
+  builder.AddBool(AttributeName::kConnectionMtls, check_data->IsMutualTLS());
+  builder.AddTimestamp(AttributeName::kRequestTime,
+                       std::chrono::system_clock::now());
+}
+
+// Adds the deferred auth attributes of an authentication origin.
+void AddDeferredOriginAttributes(const istio::authn::JwtPayload &origin,
+                                 Attributes *attributes) {
+  utils::AttributesBuilder builder(attributes);
+  if (!origin.audiences().empty()) {
+    // TODO(diemtvu): this should be send as repeated field once mixer
+    // support string_list (https://github.com/istio/istio/issues/2802) For
+    // now, just use the first value.
+    builder.AddString(AttributeName::kRequestAuthAudiences,
+                      origin.audiences(0));
+  }
+  if (!origin.presenter().empty()) {
+    builder.AddString(AttributeName::kRequestAuthPresenter, origin.presenter());
+  }
+  if (!origin.claims().empty()) {
+    builder.AddProtobufStringMap(AttributeName::kRequestAuthClaims,
+                                 origin.claims());
+  }
+}
+
+// Adds the deferred auth attributes of a JWT payload.
+void AddDeferredJwtAttributes(const std::map<std::string, std::string> &payload,
+                              Attributes *attributes) {
+  utils::AttributesBuilder builder(attributes);
+  auto it = payload.find("aud");
+  if (it != payload.end()) {
+    builder.AddString(AttributeName::kRequestAuthAudiences, it->second);
+  }
+  it = payload.find("azp");
+  if (it != payload.end()) {
+    builder.AddString(AttributeName::kRequestAuthPresenter, it->second);
+  }
+  builder.AddStringMap(AttributeName::kRequestAuthClaims, payload);
+}
+
+}  // namespace
+
+void AttributesBuilder::ExtractRequestHeaderAttributes(CheckData *check_data,
+                                                       bool defer) {
+  if (!defer) {
+    AddStringMapAttribute(
+        AttributeName::kRequestHeaders,
+        [check_data](::google::protobuf::Map<std::string, std::string> *map) {
+          check_data->AddRequestHeaders(map);
+        },
+        &request_->attributes);
+  }
+  AddHeaderAttributes(check_data, defer, false, &request_->attributes);
+}
+
+void AttributesBuilder::ExtractAuthAttributes(CheckData *check_data,
+                                              bool add_deferred) {
+  istio::authn::Result result;
+  const istio::authn::Result *found = check_data->FindAuthenticationResult();
+  if (found || check_data->GetAuthenticationResult(&result)) {
+    const istio::authn::Result &authn_result = found ? *found : result;
     utils::AttributesBuilder builder(&request_->attributes);
     if (!authn_result.principal().empty()) {
       builder.AddString(AttributeName::kRequestAuthPrincipal,
@@ -72,23 +160,9 @@ void AttributesBuilder::ExtractAuthAttributes(CheckData *check_data) {
       builder.AddString(AttributeName::kSourcePrincipal,
                         authn_result.peer_user());
     }
-    if (authn_result.has_origin()) {
-      const auto &origin = authn_result.origin();
-      if (!origin.audiences().empty()) {
-        // TODO(diemtvu): this should be send as repeated field once mixer
-        // support string_list (https://github.com/istio/istio/issues/2802) For
-        // now, just use the first value.
-        builder.AddString(AttributeName::kRequestAuthAudiences,
-                          origin.audiences(0));
-      }
-      if (!origin.presenter().empty()) {
-        builder.AddString(AttributeName::kRequestAuthPresenter,
-                          origin.presenter());
-      }
-      if (!origin.claims().empty()) {
-        builder.AddProtobufStringMap(AttributeName::kRequestAuthClaims,
-                                     origin.claims());
-      }
+    if (add_deferred && authn_result.has_origin()) {
+      AddDeferredOriginAttributes(authn_result.origin(),
+                                  &request_->attributes);
     }
     return;
   }
@@ -103,13 +177,9 @@ void AttributesBuilder::ExtractAuthAttributes(CheckData *check_data) {
       builder.AddString(AttributeName::kRequestAuthPrincipal,
                         payload["iss"] + "/" + payload["sub"]);
     }
-    if (payload.count("aud") > 0) {
-      builder.AddString(AttributeName::kRequestAuthAudiences, payload["aud"]);
-    }
-    if (payload.count("azp") > 0) {
-      builder.AddString(AttributeName::kRequestAuthPresenter, payload["azp"]);
+    if (add_deferred) {
+      AddDeferredJwtAttributes(payload, &request_->attributes);
     }
-    builder.AddStringMap(AttributeName::kRequestAuthClaims, payload);
   }
   std::string source_user;
   if (check_data->GetSourceUser(&source_user)) {
@@ -120,11 +190,33 @@ void AttributesBuilder::ExtractAuthAttributes(CheckData *check_data) {
   }
 }  // namespace http
 
-void AttributesBuilder::ExtractForwardedAttributes(CheckData *check_data) {
+bool ForwardedAttributesCache::Merge(const std::string &data,
+                                     Attributes *attributes) {
+  LRUCache::ScopedLookup lookup(&cache_, StringKey::Ref(data));
+  if (lookup.Found()) {
+    attributes->MergeFrom(*lookup.value());
+    return true;
+  }
+  Attributes *parsed = new Attributes;
+  if (!parsed->ParseFromString(data)) {
+    delete parsed;
+    return false;
+  }
+  attributes->MergeFrom(*parsed);
+  cache_.Insert(StringKey::Ref(data), parsed, 1);
+  return true;
+}
+
+void AttributesBuilder::ExtractForwardedAttributes(
+    CheckData *check_data, ForwardedAttributesCache *cache) {
   std::string forwarded_data;
   if (!check_data->ExtractIstioAttributes(&forwarded_data)) {
     return;
   }
+  if (cache) {
+    cache->Merge(forwarded_data, &request_->attributes);
+    return;
+  }
   Attributes v2_format;
   if (v2_format.ParseFromString(forwarded_data)) {
     request_->attributes.MergeFrom(v2_format);
@@ -132,9 +224,54 @@ void AttributesBuilder::ExtractForwardedAttributes(CheckData *check_data) {
   }
 }
 
-void AttributesBuilder::ExtractCheckAttributes(CheckData *check_data) {
-  ExtractRequestHeaderAttributes(check_data);
-  ExtractAuthAttributes(check_data);
+const std::vector<std::string> &
+AttributesBuilder::DeferredCheckAttributeNames() {
+  static const std::vector<std::string> names = [] {
+    std::vector<std::string> result = {
+        AttributeName::kRequestHeaders, AttributeName::kRequestAuthClaims,
+        AttributeName::kRequestAuthAudiences,
+        AttributeName::kRequestAuthPresenter, AttributeName::kConnectionMtls,
+        AttributeName::kRequestTime};
+    for (const auto &it : kHeaderAttributes) {
+      if (it.deferred) {
+        result.push_back(it.name);
+      }
+    }
+    return result;
+  }();
+  return names;
+}
+
+void AttributesBuilder::ExtractDeferredCheckAttributes(CheckData *check_data) {
+  AddStringMapAttribute(
+      AttributeName::kRequestHeaders,
+      [check_data](::google::protobuf::Map<std::string, std::string> *map) {
+        check_data->AddRequestHeaders(map);
+      },
+      &request_->attributes);
+  AddHeaderAttributes(check_data, false, true, &request_->attributes);
+  AddDeferredConnectionAttributes(check_data, &request_->attributes);
+
+  istio::authn::Result result;
+  const istio::authn::Result *found = check_data->FindAuthenticationResult();
+  if (found || check_data->GetAuthenticationResult(&result)) {
+    const istio::authn::Result &authn_result = found ? *found : result;
+    if (authn_result.has_origin()) {
+      AddDeferredOriginAttributes(authn_result.origin(),
+                                  &request_->attributes);
+    }
+    return;
+  }
+  std::map<std::string, std::string> payload;
+  if (check_data->GetJWTPayload(&payload) && !payload.empty()) {
+    AddDeferredJwtAttributes(payload, &request_->attributes);
+  }
+}
+
+void AttributesBuilder::ExtractCheckAttributes(CheckData *check_data,
+                                               bool defer) {
+  ExtractRequestHeaderAttributes(check_data, defer);
+  ExtractAuthAttributes(check_data, !defer);
 
   utils::AttributesBuilder builder(&request_->attributes);
 
@@ -144,18 +281,17 @@ void AttributesBuilder::ExtractCheckAttributes(CheckData *check_data) {
     builder.AddBytes(AttributeName::kSourceIp, source_ip);
     builder.AddInt64(AttributeName::kSourcePort, source_port);
   }
-  builder.AddBool(AttributeName::kConnectionMtls, check_data->IsMutualTLS());
-
-  builder.AddTimestamp(AttributeName::kRequestTime,
-                       std::chrono::system_clock::now());
+  if (!defer) {
+    AddDeferredConnectionAttributes(check_data, &request_->attributes);
+  }
   builder.AddString(AttributeName::kContextProtocol, "http");
 }
 
-void AttributesBuilder::ForwardAttributes(const Attributes &forward_attributes,
-                                          HeaderUpdate *header_update) {
+std::string AttributesBuilder::EncodeForwardAttributes(
+    const Attributes &forward_attributes) {
   std::string str;
   forward_attributes.SerializeToString(&str);
-  header_update->AddIstioAttributes(str);
+  return utils::Base64Encode(str);
 }
 
 void AttributesBuilder::ExtractReportAttributes(ReportData *report_data) {
@@ -171,9 +307,12 @@ void AttributesBuilder::ExtractReportAttributes(ReportData *report_data) {
     builder.AddInt64(AttributeName::kDestinationPort, dest_port);
   }
 
-  std::map<std::string, std::string> headers =
-      report_data->GetResponseHeaders();
-  builder.AddStringMap(AttributeName::kResponseHeaders, headers);
+  AddStringMapAttribute(
+      AttributeName::kResponseHeaders,
+      [report_data](::google::protobuf::Map<std::string, std::string> *map) {
+        report_data->AddResponseHeaders(map);
+      },
+      &request_->attributes);
 
   builder.AddTimestamp(AttributeName::kResponseTime,
                        std::chrono::system_clock::now());
@@ -18,39 +18,76 @@
 
 #include "include/istio/control/http/check_data.h"
 #include "include/istio/control/http/report_data.h"
+#include "include/istio/utils/simple_lru_cache.h"
+#include "include/istio/utils/simple_lru_cache_inl.h"
+#include "include/istio/utils/string_key.h"
 #include "src/istio/control/request_context.h"
 
 namespace istio {
 namespace control {
 namespace http {
 
+// A LRU cache of the parsed forwarded attributes keyed by their data,
+// since upstream proxies only send a few distinct values. It is not thread
+// safe.
+class ForwardedAttributesCache {
+ public:
+  ForwardedAttributesCache(int size) : cache_(size) {}
+  ~ForwardedAttributesCache() { cache_.RemoveAll(); }
+
+  // Merges the attributes parsed from data into attributes. Returns false
+  // if data is not valid.
+  bool Merge(const std::string& data,
+             ::istio::mixer::v1::Attributes* attributes);
+
+ private:
+  using LRUCache =
+      ::istio::utils::SimpleLRUCache<::istio::utils::StringKey,
+                                     ::istio::mixer::v1::Attributes,
+                                     ::istio::utils::StringKey::Hash>;
+  LRUCache cache_;
+};
+
 // The context for each HTTP request.
 class AttributesBuilder {
  public:
   AttributesBuilder(RequestContext* request) : request_(request) {}
 
-  // Extract forwarded attributes from HTTP header.
-  void ExtractForwardedAttributes(CheckData* check_data);
-  // Forward attributes to upstream proxy.
-  static void ForwardAttributes(
-      const ::istio::mixer::v1::Attributes& attributes,
-      HeaderUpdate* header_update);
+  // Extract forwarded attributes from HTTP header, parsed with the cache if
+  // not nullptr.
+  void ExtractForwardedAttributes(CheckData* check_data,
+                                  ForwardedAttributesCache* cache = nullptr);
+  // Encodes attributes as the header value to forward them to upstream
+  // proxy.
+  static std::string EncodeForwardAttributes(
+      const ::istio::mixer::v1::Attributes& attributes);
 
-  // Extract attributes for Check call.
-  void ExtractCheckAttributes(CheckData* check_data);
+  // Extract attributes for Check call. If defer is true, the attributes
+  // named in DeferredCheckAttributeNames() are left for
+  // ExtractDeferredCheckAttributes().
+  void ExtractCheckAttributes(CheckData* check_data, bool defer = false);
+  // Extract the check attributes deferred by ExtractCheckAttributes().
+  void ExtractDeferredCheckAttributes(CheckData* check_data);
+  // The attributes a check cache lookup rarely depends on: the request
+  // header and auth claim maps, the most expensive ones to extract, the
+  // other auth claims, the referer, user agent and scheme headers, the
+  // mTLS flag and the request time. The others, e.g. the host, method,
+  // path, source ip and principals, are the stable attributes the learned
+  // referenced shapes are usually made of.
+  static const std::vector<std::string>& DeferredCheckAttributeNames();
   // Extract attributes for Report call.
   void ExtractReportAttributes(ReportData* report_data);
 
  private:
-  // Extract HTTP header attributes
-  void ExtractRequestHeaderAttributes(CheckData* check_data);
+  // Extract HTTP header attributes, without the deferred ones if defer.
+  void ExtractRequestHeaderAttributes(CheckData* check_data, bool defer);
   // Extract authentication attributes for Check call. Going forward, this
   // function will use authentication result (from authn filter), which will set
   // all authenticated attributes (including source_user, request.auth.*).
   // During the transition (i.e authn filter is not added to sidecar), this
   // function will also look up the (jwt) payload when authentication result is
-  // not available.
-  void ExtractAuthAttributes(CheckData* check_data);
+  // not available. The deferred ones are only added if add_deferred.
+  void ExtractAuthAttributes(CheckData* check_data, bool add_deferred);
 
   // The request context object.
   RequestContext* request_;
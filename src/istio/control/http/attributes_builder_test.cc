@@ -19,6 +19,7 @@
 #include "google/protobuf/util/message_differencer.h"
 #include "gtest/gtest.h"
 #include "include/istio/utils/attributes_builder.h"
+#include "include/istio/utils/base64.h"
 #include "src/istio/control/attribute_names.h"
 #include "src/istio/control/http/mock_check_data.h"
 #include "src/istio/control/http/mock_report_data.h"
@@ -272,20 +273,51 @@ TEST(AttributesBuilderTest, TestExtractForwardedAttributes) {
   EXPECT_TRUE(MessageDifferencer::Equals(request.attributes, attr));
 }
 
-TEST(AttributesBuilderTest, TestForwardAttributes) {
-  Attributes forwarded_attr;
-  ::testing::NiceMock<MockHeaderUpdate> mock_header;
-  EXPECT_CALL(mock_header, AddIstioAttributes(_))
-      .WillOnce(Invoke([&forwarded_attr](const std::string &data) {
-        EXPECT_TRUE(forwarded_attr.ParseFromString(data));
+TEST(AttributesBuilderTest, TestExtractForwardedAttributesWithCache) {
+  Attributes attr;
+  (*attr.mutable_attributes())["test_key"].set_string_value("test_value");
+
+  ::testing::NiceMock<MockCheckData> mock_data;
+  EXPECT_CALL(mock_data, ExtractIstioAttributes(_))
+      .Times(3)
+      .WillRepeatedly(Invoke([&attr](std::string *data) -> bool {
+        attr.SerializeToString(data);
+        return true;
       }));
 
+  ForwardedAttributesCache cache(2);
+  for (int i = 0; i < 2; ++i) {
+    RequestContext request;
+    AttributesBuilder builder(&request);
+    builder.ExtractForwardedAttributes(&mock_data, &cache);
+    EXPECT_TRUE(MessageDifferencer::Equals(request.attributes, attr));
+  }
+
+  // The cached attributes are merged into the existing ones.
+  RequestContext request;
+  (*request.attributes.mutable_attributes())["key"].set_int64_value(1);
+  AttributesBuilder builder(&request);
+  builder.ExtractForwardedAttributes(&mock_data, &cache);
+  EXPECT_EQ(request.attributes.attributes().size(), 2);
+  EXPECT_EQ(request.attributes.attributes().at("test_key").string_value(),
+            "test_value");
+
+  // Invalid data is not cached.
+  Attributes merged;
+  EXPECT_FALSE(cache.Merge("\xff\xff", &merged));
+  EXPECT_FALSE(cache.Merge("\xff\xff", &merged));
+  EXPECT_EQ(merged.attributes().size(), 0);
+}
+
+TEST(AttributesBuilderTest, TestEncodeForwardAttributes) {
   Attributes origin_attr;
   (*origin_attr.mutable_attributes())["test_key"].set_string_value(
       "test_value");
 
-  AttributesBuilder::ForwardAttributes(origin_attr, &mock_header);
-  EXPECT_TRUE(MessageDifferencer::Equals(origin_attr, forwarded_attr));
+  std::string data;
+  origin_attr.SerializeToString(&data);
+  EXPECT_EQ(AttributesBuilder::EncodeForwardAttributes(origin_attr),
+            utils::Base64Encode(data));
 }
 
 TEST(AttributesBuilderTest, TestCheckAttributes) {
@@ -418,6 +450,144 @@ TEST(AttributesBuilderTest, TestCheckAttributesWithAuthNResult) {
       MessageDifferencer::Equals(request.attributes, expected_attributes));
 }
 
+TEST(AttributesBuilderTest, TestCheckAttributesWithAuthNResultInMemory) {
+  ::testing::NiceMock<MockCheckData> mock_data;
+  EXPECT_CALL(mock_data, GetSourceIpPort(_, _))
+      .WillOnce(Invoke([](std::string *ip, int *port) -> bool {
+        *ip = "1.2.3.4";
+        *port = 8080;
+        return true;
+      }));
+  EXPECT_CALL(mock_data, IsMutualTLS()).WillOnce(Invoke([]() -> bool {
+    return true;
+  }));
+  EXPECT_CALL(mock_data, GetRequestHeaders())
+      .WillOnce(Invoke([]() -> std::map<std::string, std::string> {
+        std::map<std::string, std::string> map;
+        map["path"] = "/books";
+        map["host"] = "localhost";
+        return map;
+      }));
+  EXPECT_CALL(mock_data, FindHeaderByType(_, _))
+      .WillRepeatedly(Invoke(
+          [](CheckData::HeaderType header_type, std::string *value) -> bool {
+            if (header_type == CheckData::HEADER_PATH) {
+              *value = "/books";
+              return true;
+            } else if (header_type == CheckData::HEADER_HOST) {
+              *value = "localhost";
+              return true;
+            }
+            return false;
+          }));
+  // The result kept in memory by the environment is used without a copy.
+  istio::authn::Result result;
+  result.set_principal("thisisiss/thisissub");
+  result.set_peer_user("test_user");
+  result.mutable_origin()->add_audiences("thisisaud");
+  result.mutable_origin()->set_presenter("thisisazp");
+  (*result.mutable_origin()->mutable_claims())["iss"] = "thisisiss";
+  (*result.mutable_origin()->mutable_claims())["sub"] = "thisissub";
+  (*result.mutable_origin()->mutable_claims())["aud"] = "thisisaud";
+  (*result.mutable_origin()->mutable_claims())["azp"] = "thisisazp";
+  (*result.mutable_origin()->mutable_claims())["email"] =
+      "thisisemail@email.com";
+  (*result.mutable_origin()->mutable_claims())["iat"] = "1512754205";
+  (*result.mutable_origin()->mutable_claims())["exp"] = "5112754205";
+  EXPECT_CALL(mock_data, FindAuthenticationResult())
+      .WillRepeatedly(testing::Return(&result));
+  EXPECT_CALL(mock_data, GetAuthenticationResult(_)).Times(0);
+
+  RequestContext request;
+  AttributesBuilder builder(&request);
+  builder.ExtractCheckAttributes(&mock_data);
+
+  ClearContextTime(AttributeName::kRequestTime, &request);
+
+  std::string out_str;
+  TextFormat::PrintToString(request.attributes, &out_str);
+  GOOGLE_LOG(INFO) << "===" << out_str << "===";
+
+  Attributes expected_attributes;
+  ASSERT_TRUE(
+      TextFormat::ParseFromString(kCheckAttributes, &expected_attributes));
+  EXPECT_TRUE(
+      MessageDifferencer::Equals(request.attributes, expected_attributes));
+}
+
+TEST(AttributesBuilderTest, TestDeferredCheckAttributes) {
+  ::testing::NiceMock<MockCheckData> mock_data;
+  EXPECT_CALL(mock_data, GetSourceIpPort(_, _))
+      .WillOnce(Invoke([](std::string *ip, int *port) -> bool {
+        *ip = "1.2.3.4";
+        *port = 8080;
+        return true;
+      }));
+  EXPECT_CALL(mock_data, IsMutualTLS()).WillOnce(Invoke([]() -> bool {
+    return true;
+  }));
+  // The header map is only extracted once deferred attributes are needed.
+  EXPECT_CALL(mock_data, GetRequestHeaders())
+      .WillOnce(Invoke([]() -> std::map<std::string, std::string> {
+        std::map<std::string, std::string> map;
+        map["path"] = "/books";
+        map["host"] = "localhost";
+        return map;
+      }));
+  EXPECT_CALL(mock_data, FindHeaderByType(_, _))
+      .WillRepeatedly(Invoke(
+          [](CheckData::HeaderType header_type, std::string *value) -> bool {
+            if (header_type == CheckData::HEADER_PATH) {
+              *value = "/books";
+              return true;
+            } else if (header_type == CheckData::HEADER_HOST) {
+              *value = "localhost";
+              return true;
+            }
+            return false;
+          }));
+  EXPECT_CALL(mock_data, GetAuthenticationResult(_))
+      .Times(2)
+      .WillRepeatedly(Invoke([](istio::authn::Result *result) -> bool {
+        result->set_principal("thisisiss/thisissub");
+        result->set_peer_user("test_user");
+        result->mutable_origin()->add_audiences("thisisaud");
+        result->mutable_origin()->set_presenter("thisisazp");
+        (*result->mutable_origin()->mutable_claims())["iss"] = "thisisiss";
+        (*result->mutable_origin()->mutable_claims())["sub"] = "thisissub";
+        (*result->mutable_origin()->mutable_claims())["aud"] = "thisisaud";
+        (*result->mutable_origin()->mutable_claims())["azp"] = "thisisazp";
+        (*result->mutable_origin()->mutable_claims())["email"] =
+            "thisisemail@email.com";
+        (*result->mutable_origin()->mutable_claims())["iat"] = "1512754205";
+        (*result->mutable_origin()->mutable_claims())["exp"] = "5112754205";
+        return true;
+      }));
+
+  RequestContext request;
+  AttributesBuilder builder(&request);
+  builder.ExtractCheckAttributes(&mock_data, true);
+  for (const auto &name : AttributesBuilder::DeferredCheckAttributeNames()) {
+    EXPECT_EQ(request.attributes.attributes().count(name), 0);
+  }
+  // The stable attributes are extracted for the first cache lookup.
+  for (const auto &name :
+       {AttributeName::kRequestHost, AttributeName::kRequestPath,
+        AttributeName::kRequestAuthPrincipal, AttributeName::kSourcePrincipal,
+        AttributeName::kSourceIp, AttributeName::kContextProtocol}) {
+    EXPECT_EQ(request.attributes.attributes().count(name), 1);
+  }
+
+  builder.ExtractDeferredCheckAttributes(&mock_data);
+  ClearContextTime(AttributeName::kRequestTime, &request);
+
+  Attributes expected_attributes;
+  ASSERT_TRUE(
+      TextFormat::ParseFromString(kCheckAttributes, &expected_attributes));
+  EXPECT_TRUE(
+      MessageDifferencer::Equals(request.attributes, expected_attributes));
+}
+
 TEST(AttributesBuilderTest, TestReportAttributes) {
   ::testing::NiceMock<MockReportData> mock_data;
   EXPECT_CALL(mock_data, GetDestinationIpPort(_, _))
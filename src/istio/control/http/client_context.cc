@@ -20,19 +20,64 @@ using ::istio::mixer::v1::config::client::ServiceConfig;
 namespace istio {
 namespace control {
 namespace http {
+namespace {
+
+// The number of distinct forwarded attributes kept parsed.
+const int kForwardedAttributesCacheSize = 16;
+
+// The number of free request contexts kept for reuse, about the requests
+// in flight on a busy worker.
+const size_t kMaxFreeRequestContexts = 128;
+
+}  // namespace
 
 ClientContext::ClientContext(const Controller::Options& data)
-    : ClientContextBase(data.config.transport(), data.env),
+    : ClientContextBase(data.config.transport(), data.env,
+                        data.shared_check_cache, data.shared_quota_cache,
+                        data.report_spill_file, data.report_max_value_bytes,
+                        data.global_words_extension,
+                        data.report_target_calls_per_second,
+                        data.report_target_batch_bytes,
+                        data.shared_report_batch, data.cache_budget,
+                        data.client_tuning),
       config_(data.config),
-      service_config_cache_size_(data.service_config_cache_size) {}
+      service_config_cache_size_(data.service_config_cache_size),
+      max_service_stats_(data.max_service_stats),
+      forwarded_attributes_cache_(kForwardedAttributesCacheSize) {
+  EncodeForwardAttributes();
+  CreateRejectionReporter(data.rejection_report_attributes,
+                          data.rejection_aggregate_window_ms,
+                          data.env.timer_create_func);
+}
 
 ClientContext::ClientContext(
     std::unique_ptr<::istio::mixerclient::MixerClient> mixer_client,
     const ::istio::mixer::v1::config::client::HttpClientConfig& config,
-    int service_config_cache_size)
+    int service_config_cache_size, int max_service_stats)
     : ClientContextBase(std::move(mixer_client)),
       config_(config),
-      service_config_cache_size_(service_config_cache_size) {}
+      service_config_cache_size_(service_config_cache_size),
+      max_service_stats_(max_service_stats),
+      forwarded_attributes_cache_(kForwardedAttributesCacheSize) {
+  EncodeForwardAttributes();
+  CreateRejectionReporter({}, 0, nullptr);
+}
+
+void ClientContext::CreateRejectionReporter(
+    const std::unordered_set<std::string>& attributes, int aggregate_window_ms,
+    ::istio::mixerclient::TimerCreateFunc timer_create_func) {
+  rejection_reporter_.reset(new RejectionReporter(
+      attributes, aggregate_window_ms, config_.mixer_attributes(),
+      timer_create_func,
+      [this](RequestContext&& request) { SendReport(std::move(request)); }));
+}
+
+void ClientContext::EncodeForwardAttributes() {
+  if (config_.has_forward_attributes()) {
+    forward_attributes_header_ = AttributesBuilder::EncodeForwardAttributes(
+        config_.forward_attributes());
+  }
+}
 
 const std::string& ClientContext::GetServiceName(
     const std::string& service_name) const {
@@ -58,6 +103,33 @@ const ServiceConfig* ClientContext::GetServiceConfig(
   return nullptr;
 }
 
+std::unique_ptr<RequestContext> ClientContext::NewRequestContext() {
+  if (free_request_contexts_.empty()) {
+    return std::unique_ptr<RequestContext>(new RequestContext);
+  }
+  std::unique_ptr<RequestContext> request =
+      std::move(free_request_contexts_.back());
+  free_request_contexts_.pop_back();
+  return request;
+}
+
+void ClientContext::FreeRequestContext(
+    std::unique_ptr<RequestContext> request) {
+  if (free_request_contexts_.size() >= kMaxFreeRequestContexts) {
+    return;
+  }
+  // Map::clear() frees the values but keeps the bucket array.
+  request->attributes.Clear();
+  request->quotas.clear();
+  request->check_status = ::google::protobuf::util::Status::OK;
+  request->check_cache_hit = false;
+  request->quota_cache_hit = false;
+  request->check_miss_reason = ::istio::mixerclient::CheckMissReason::NONE;
+  request->deferred_attribute_names = nullptr;
+  request->fill_deferred_attributes = nullptr;
+  free_request_contexts_.push_back(std::move(request));
+}
+
 }  // namespace http
 }  // namespace control
 }  // namespace istio
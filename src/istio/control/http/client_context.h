@@ -17,6 +17,8 @@
 #define ISTIO_CONTROL_HTTP_CLIENT_CONTEXT_H
 
 #include "include/istio/control/http/controller.h"
+#include "src/istio/control/http/attributes_builder.h"
+#include "src/istio/control/http/rejection_reporter.h"
 #include "src/istio/control/client_context_base.h"
 
 namespace istio {
@@ -33,7 +35,7 @@ class ClientContext : public ClientContextBase {
   ClientContext(
       std::unique_ptr<::istio::mixerclient::MixerClient> mixer_client,
       const ::istio::mixer::v1::config::client::HttpClientConfig& config,
-      int service_config_cache_size);
+      int service_config_cache_size, int max_service_stats = 0);
 
   // Retrieve mixer client config.
   const ::istio::mixer::v1::config::client::HttpClientConfig& config() const {
@@ -52,12 +54,64 @@ class ClientContext : public ClientContextBase {
   // Get the service config cache size
   int service_config_cache_size() const { return service_config_cache_size_; }
 
+  // Get the maximum number of services with their own stats.
+  int max_service_stats() const { return max_service_stats_; }
+
+  // The encoded header value of the forward attributes, empty if the config
+  // has none.
+  const std::string& forward_attributes_header() const {
+    return forward_attributes_header_;
+  }
+
+  // The cache of the attributes forwarded by upstream proxies.
+  ForwardedAttributesCache* forwarded_attributes_cache() {
+    return &forwarded_attributes_cache_;
+  }
+
+  // The reporter of the requests rejected before the Mixer filter runs.
+  RejectionReporter* rejection_reporter() { return rejection_reporter_.get(); }
+
+  // Returns a request context for a request handler, a recycled one if
+  // there is any.
+  std::unique_ptr<RequestContext> NewRequestContext();
+
+  // Recycles the request context of a finished request. Its attributes
+  // map keeps its buckets.
+  void FreeRequestContext(std::unique_ptr<RequestContext> request);
+
  private:
-  // The http client config.
+  // Encodes the forward attributes of the config.
+  void EncodeForwardAttributes();
+
+  // Creates the reporter of the rejected requests.
+  void CreateRejectionReporter(
+      const std::unordered_set<std::string>& attributes,
+      int aggregate_window_ms,
+      ::istio::mixerclient::TimerCreateFunc timer_create_func);
+
+  // The http client config. It is owned by the filter config and shared by
+  // the client contexts of all workers, which must not outlive it.
   const ::istio::mixer::v1::config::client::HttpClientConfig& config_;
 
   // The service config cache size
   int service_config_cache_size_;
+
+  // The maximum number of services with their own stats, 0 if disabled.
+  int max_service_stats_;
+
+  // The forward attributes encoded once since they are static.
+  std::string forward_attributes_header_;
+
+  // The client context is per worker thread, so is the cache.
+  ForwardedAttributesCache forwarded_attributes_cache_;
+
+  // Destroyed before the mixer client, so that its pending aggregated
+  // reports are sent.
+  std::unique_ptr<RejectionReporter> rejection_reporter_;
+
+  // The free request contexts, up to kMaxFreeRequestContexts. The client
+  // context is per worker thread, so they are not locked.
+  std::vector<std::unique_ptr<RequestContext>> free_request_contexts_;
 };
 
 }  // namespace http
@@ -16,8 +16,17 @@
 #include "src/istio/control/http/controller_impl.h"
 #include "src/istio/control/http/request_handler_impl.h"
 
+#include <algorithm>
+
+using ::istio::mixer::v1::config::client::HttpClientConfig;
 using ::istio::mixer::v1::config::client::ServiceConfig;
+using ::istio::mixerclient::CheckCache;
+using ::istio::mixerclient::ClientTuning;
+using ::istio::mixerclient::QuotaCache;
+using ::istio::mixerclient::ReportBatch;
+using ::istio::mixerclient::ServiceStats;
 using ::istio::mixerclient::Statistics;
+using ::istio::utils::StringKey;
 
 namespace istio {
 namespace control {
@@ -35,13 +44,17 @@ ControllerImpl::ControllerImpl(std::shared_ptr<ClientContext> client_context)
     cache_size = kServiceContextCacheSize;
   }
   service_context_cache_.reset(new LRUCache(cache_size));
+  route_service_context_cache_.reset(new RouteLRUCache(cache_size));
 }
 
-ControllerImpl::~ControllerImpl() { service_context_cache_->RemoveAll(); }
+ControllerImpl::~ControllerImpl() {
+  service_context_cache_->RemoveAll();
+  route_service_context_cache_->RemoveAll();
+}
 
 bool ControllerImpl::LookupServiceConfig(const std::string& service_config_id) {
   LRUCache::ScopedLookup lookup(service_context_cache_.get(),
-                                service_config_id);
+                                StringKey::Ref(service_config_id));
   return lookup.Found();
 }
 
@@ -51,24 +64,92 @@ void ControllerImpl::AddServiceConfig(
   CacheElem* cache_elem = new CacheElem;
   cache_elem->service_context =
       std::make_shared<ServiceContext>(client_context_, &config);
-  service_context_cache_->Insert(service_config_id, cache_elem, 1);
+  service_context_cache_->Insert(StringKey::Ref(service_config_id),
+                                 cache_elem, 1);
 }
 
 std::unique_ptr<RequestHandler> ControllerImpl::CreateRequestHandler(
     const PerRouteConfig& per_route_config) {
-  return std::unique_ptr<RequestHandler>(
-      new RequestHandlerImpl(GetServiceContext(per_route_config)));
+  return std::unique_ptr<RequestHandler>(new RequestHandlerImpl(
+      GetServiceContext(per_route_config),
+      GetServiceCounters(per_route_config.destination_service)));
+}
+
+void ControllerImpl::ReportRejection(const PerRouteConfig& per_route_config,
+                                     CheckData* check_data,
+                                     ReportData* report_data) {
+  if (!GetServiceContext(per_route_config)->enable_mixer_report()) {
+    return;
+  }
+  client_context_->rejection_reporter()->Report(check_data, report_data);
+}
+
+void ControllerImpl::SetOverloaded(bool overloaded) {
+  client_context_->SetOverloaded(overloaded);
+}
+
+void ControllerImpl::DrainReports(int deadline_ms) {
+  client_context_->DrainReports(deadline_ms);
 }
 
 void ControllerImpl::GetStatistics(Statistics* stat) const {
   client_context_->GetStatistics(stat);
+  stat->service_stats.clear();
+  for (const auto& it : service_counters_) {
+    const ServiceCounters& counters = *it.second;
+    stat->service_stats.push_back(
+        {it.first, counters.check_calls, counters.check_cache_hits,
+         counters.blocking_remote_check_calls, counters.quota_cache_hits,
+         counters.report_calls});
+  }
+  std::sort(stat->service_stats.begin(), stat->service_stats.end(),
+            [](const ServiceStats& a, const ServiceStats& b) {
+              return a.service < b.service;
+            });
+}
+
+std::shared_ptr<ServiceCounters> ControllerImpl::GetServiceCounters(
+    const std::string& service) {
+  int max_services = client_context_->max_service_stats();
+  if (max_services <= 0) {
+    return nullptr;
+  }
+  auto it = service_counters_.find(service);
+  if (it != service_counters_.end()) {
+    return it->second;
+  }
+  // Over the limit, the new services share one entry.
+  std::shared_ptr<ServiceCounters>& counters =
+      static_cast<int>(service_counters_.size()) < max_services
+          ? service_counters_[service]
+          : service_counters_[::istio::mixerclient::kOtherServiceStats];
+  if (!counters) {
+    counters = std::make_shared<ServiceCounters>();
+  }
+  return counters;
 }
 
 std::shared_ptr<ServiceContext> ControllerImpl::GetServiceContext(
     const PerRouteConfig& config) {
+  if (config.service_config) {
+    {
+      RouteLRUCache::ScopedLookup lookup(route_service_context_cache_.get(),
+                                         config.service_config_hash);
+      if (lookup.Found()) {
+        return lookup.value()->service_context;
+      }
+    }
+    CacheElem* cache_elem = new CacheElem;
+    cache_elem->service_context = std::make_shared<ServiceContext>(
+        client_context_, config.service_config);
+    route_service_context_cache_->Insert(config.service_config_hash,
+                                         cache_elem, 1);
+    return cache_elem->service_context;
+  }
+
   if (!config.service_config_id.empty()) {
     LRUCache::ScopedLookup lookup(service_context_cache_.get(),
-                                  config.service_config_id);
+                                  StringKey::Ref(config.service_config_id));
     if (lookup.Found()) {
       return lookup.value()->service_context;
     }
@@ -99,6 +180,37 @@ std::unique_ptr<Controller> Controller::Create(const Options& data) {
       new ControllerImpl(std::make_shared<ClientContext>(data)));
 }
 
+std::shared_ptr<CheckCache> Controller::CreateSharedCheckCache(
+    const HttpClientConfig& config, const std::string& snapshot_file,
+    const std::string& node_cache_file, const std::string& mesh_config_id,
+    const ClientTuning& tuning) {
+  return ClientContextBase::CreateSharedCheckCache(
+      config.transport(), snapshot_file, node_cache_file, mesh_config_id,
+      tuning);
+}
+
+std::shared_ptr<QuotaCache> Controller::CreateSharedQuotaCache(
+    const HttpClientConfig& config, const ClientTuning& tuning) {
+  return ClientContextBase::CreateSharedQuotaCache(config.transport(), tuning);
+}
+
+std::shared_ptr<ReportBatch> Controller::CreateSharedReportBatch(
+    const Options& options) {
+  return ClientContextBase::CreateSharedReportBatch(
+      options.config.transport(), options.env, options.report_spill_file,
+      options.report_max_value_bytes, options.global_words_extension,
+      options.report_target_calls_per_second,
+      options.report_target_batch_bytes, options.client_tuning);
+}
+
+std::string Controller::SharedReportBatchKey(const Options& options) {
+  return ClientContextBase::SharedReportBatchKey(
+      options.config.transport(), options.report_spill_file,
+      options.report_max_value_bytes, options.global_words_extension,
+      options.report_target_calls_per_second,
+      options.report_target_batch_bytes, options.client_tuning);
+}
+
 }  // namespace http
 }  // namespace control
 }  // namespace istio
@@ -22,6 +22,7 @@
 #include "include/istio/control/http/controller.h"
 #include "include/istio/utils/simple_lru_cache.h"
 #include "include/istio/utils/simple_lru_cache_inl.h"
+#include "include/istio/utils/string_key.h"
 #include "src/istio/control/http/client_context.h"
 #include "src/istio/control/http/service_context.h"
 
@@ -47,14 +48,26 @@ class ControllerImpl : public Controller {
   std::unique_ptr<RequestHandler> CreateRequestHandler(
       const PerRouteConfig& per_route_config) override;
 
+  // Reports a request rejected before the Mixer filter runs.
+  void ReportRejection(const PerRouteConfig& per_route_config,
+                       CheckData* check_data, ReportData* report_data) override;
+
   // Get statistics.
   void GetStatistics(::istio::mixerclient::Statistics* stat) const override;
 
+  void SetOverloaded(bool overloaded) override;
+  void DrainReports(int deadline_ms) override;
+
  private:
   // Create service config context for HTTP.
   std::shared_ptr<ServiceContext> GetServiceContext(
       const PerRouteConfig& per_route_config);
 
+  // Gets the counters of a destination service, nullptr if the service
+  // stats are disabled.
+  std::shared_ptr<ServiceCounters> GetServiceCounters(
+      const std::string& service);
+
   // The client context object to hold client config and client cache.
   std::shared_ptr<ClientContext> client_context_;
 
@@ -70,8 +83,20 @@ class ControllerImpl : public Controller {
   struct CacheElem {
     std::shared_ptr<ServiceContext> service_context;
   };
-  using LRUCache = ::istio::utils::SimpleLRUCache<std::string, CacheElem>;
+  using LRUCache =
+      ::istio::utils::SimpleLRUCache<::istio::utils::StringKey, CacheElem,
+                                     ::istio::utils::StringKey::Hash>;
   std::unique_ptr<LRUCache> service_context_cache_;
+
+  // The service contexts of the service configs interned by the routes,
+  // keyed by the config hash. It has the same size as the cache above.
+  using RouteLRUCache = ::istio::utils::SimpleLRUCache<uint64_t, CacheElem>;
+  std::unique_ptr<RouteLRUCache> route_service_context_cache_;
+
+  // The counters per destination service, up to max_service_stats of them
+  // and one kOtherServiceStats entry for the others.
+  std::unordered_map<std::string, std::shared_ptr<ServiceCounters>>
+      service_counters_;
 };
 
 }  // namespace http
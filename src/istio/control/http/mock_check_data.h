@@ -43,6 +43,7 @@ class MockCheckData : public CheckData {
                      bool(std::map<std::string, std::string> *payload));
   MOCK_CONST_METHOD1(GetAuthenticationResult,
                      bool(istio::authn::Result *result));
+  MOCK_CONST_METHOD0(FindAuthenticationResult, const istio::authn::Result *());
   MOCK_CONST_METHOD0(IsMutualTLS, bool());
 };
 
@@ -0,0 +1,183 @@
+/* Copyright 2018 Istio Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/istio/control/http/rejection_reporter.h"
+#include "include/istio/utils/attributes_builder.h"
+#include "src/istio/control/attribute_names.h"
+
+using ::istio::mixer::v1::Attributes;
+using ::istio::mixerclient::TimerCreateFunc;
+
+namespace istio {
+namespace control {
+namespace http {
+namespace {
+
+// The maximum number of aggregated reports in a window, they are all sent
+// when it is reached.
+const size_t kMaxAggregates = 1000;
+
+// The header attributes, found by type.
+const struct {
+  const std::string& name;
+  CheckData::HeaderType type;
+} kHeaderAttributes[] = {
+    {AttributeName::kRequestPath, CheckData::HEADER_PATH},
+    {AttributeName::kRequestHost, CheckData::HEADER_HOST},
+    {AttributeName::kRequestScheme, CheckData::HEADER_SCHEME},
+    {AttributeName::kRequestUserAgent, CheckData::HEADER_USER_AGENT},
+    {AttributeName::kRequestMethod, CheckData::HEADER_METHOD},
+    {AttributeName::kRequestReferer, CheckData::HEADER_REFERER},
+};
+
+}  // namespace
+
+RejectionReporter::RejectionReporter(
+    const std::unordered_set<std::string>& attributes, int aggregate_window_ms,
+    const Attributes& static_attributes, TimerCreateFunc timer_create_func,
+    SendFunc send)
+    : attributes_(attributes.empty() ? DefaultAttributes() : attributes),
+      static_attributes_(static_attributes),
+      send_(send),
+      aggregate_window_ms_(0) {
+  if (aggregate_window_ms > 0 && timer_create_func) {
+    aggregate_window_ms_ = aggregate_window_ms;
+    timer_ = timer_create_func([this]() { Flush(); });
+  }
+}
+
+RejectionReporter::~RejectionReporter() { Flush(); }
+
+const std::unordered_set<std::string>& RejectionReporter::DefaultAttributes() {
+  static const std::unordered_set<std::string> names = {
+      AttributeName::kSourceIp,       AttributeName::kRequestHost,
+      AttributeName::kRequestPath,    AttributeName::kRequestMethod,
+      AttributeName::kResponseCode,   AttributeName::kResponseTime,
+      AttributeName::kContextProtocol};
+  return names;
+}
+
+void RejectionReporter::ExtractAttributes(CheckData* check_data,
+                                          ReportData* report_data,
+                                          Attributes* attributes) const {
+  utils::AttributesBuilder builder(attributes);
+  if (Reported(AttributeName::kSourceIp) ||
+      Reported(AttributeName::kSourcePort)) {
+    std::string source_ip;
+    int source_port;
+    if (check_data->GetSourceIpPort(&source_ip, &source_port)) {
+      if (Reported(AttributeName::kSourceIp)) {
+        builder.AddBytes(AttributeName::kSourceIp, source_ip);
+      }
+      if (Reported(AttributeName::kSourcePort)) {
+        builder.AddInt64(AttributeName::kSourcePort, source_port);
+      }
+    }
+  }
+  if (Reported(AttributeName::kSourcePrincipal)) {
+    std::string source_user;
+    if (check_data->GetSourceUser(&source_user)) {
+      builder.AddString(AttributeName::kSourcePrincipal, source_user);
+    }
+  }
+  for (const auto& it : kHeaderAttributes) {
+    std::string value;
+    if (Reported(it.name) && check_data->FindHeaderByType(it.type, &value)) {
+      builder.AddString(it.name, value);
+    }
+  }
+  if (Reported(AttributeName::kRequestTime)) {
+    builder.AddTimestamp(AttributeName::kRequestTime,
+                         std::chrono::system_clock::now());
+  }
+  if (Reported(AttributeName::kContextProtocol)) {
+    builder.AddString(AttributeName::kContextProtocol, "http");
+  }
+
+  ReportData::ReportInfo info;
+  report_data->GetReportInfo(&info);
+  if (Reported(AttributeName::kResponseCode)) {
+    builder.AddInt64(AttributeName::kResponseCode, info.response_code);
+  }
+  if (Reported(AttributeName::kResponseTime)) {
+    builder.AddTimestamp(AttributeName::kResponseTime,
+                         std::chrono::system_clock::now());
+  }
+  if (Reported(AttributeName::kResponseDuration)) {
+    builder.AddDuration(AttributeName::kResponseDuration, info.duration);
+  }
+  if (Reported(AttributeName::kRequestTotalSize)) {
+    builder.AddInt64(AttributeName::kRequestTotalSize,
+                     info.request_total_size);
+  }
+  if (Reported(AttributeName::kResponseTotalSize)) {
+    builder.AddInt64(AttributeName::kResponseTotalSize,
+                     info.response_total_size);
+  }
+}
+
+void RejectionReporter::Report(CheckData* check_data,
+                               ReportData* report_data) {
+  if (aggregate_window_ms_ == 0) {
+    RequestContext request;
+    request.attributes.CopyFrom(static_attributes_);
+    ExtractAttributes(check_data, report_data, &request.attributes);
+    send_(std::move(request));
+    return;
+  }
+
+  std::string key;
+  int source_port;
+  check_data->GetSourceIpPort(&key, &source_port);
+  ReportData::ReportInfo info;
+  report_data->GetReportInfo(&info);
+  key.push_back('\0');
+  key.append(std::to_string(info.response_code));
+
+  auto it = aggregates_.find(key);
+  if (it != aggregates_.end()) {
+    ++it->second.count;
+    return;
+  }
+  if (aggregates_.size() >= kMaxAggregates) {
+    Flush();
+  }
+  if (aggregates_.empty()) {
+    timer_->Start(aggregate_window_ms_);
+  }
+  Aggregate& aggregate = aggregates_[key];
+  aggregate.request.attributes.CopyFrom(static_attributes_);
+  ExtractAttributes(check_data, report_data, &aggregate.request.attributes);
+  aggregate.count = 1;
+}
+
+void RejectionReporter::Flush() {
+  if (aggregates_.empty()) {
+    return;
+  }
+  timer_->Stop();
+  // Swapped out first, send_ may report more rejections.
+  std::unordered_map<std::string, Aggregate> aggregates;
+  aggregates.swap(aggregates_);
+  for (auto& it : aggregates) {
+    utils::AttributesBuilder(&it.second.request.attributes)
+        .AddInt64(AttributeName::kContextRejectedCount, it.second.count);
+    send_(std::move(it.second.request));
+  }
+}
+
+}  // namespace http
+}  // namespace control
+}  // namespace istio
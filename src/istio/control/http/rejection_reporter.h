@@ -0,0 +1,99 @@
+/* Copyright 2018 Istio Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ISTIO_CONTROL_HTTP_REJECTION_REPORTER_H
+#define ISTIO_CONTROL_HTTP_REJECTION_REPORTER_H
+
+#include "include/istio/control/http/check_data.h"
+#include "include/istio/control/http/report_data.h"
+#include "include/istio/mixerclient/timer.h"
+#include "src/istio/control/request_context.h"
+
+#include <memory>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace istio {
+namespace control {
+namespace http {
+
+// Reports the requests rejected before the Mixer filter runs, e.g. by an
+// authentication or a rate limit filter, with a small set of attributes.
+// No service config is looked up and no header map is extracted, so that
+// a flood of rejections costs much less than the same regular requests.
+// If aggregate_window_ms is positive, the rejections with the same source
+// ip and response code within the window are sent as one report, with the
+// attributes of the first one and their number in context.rejected_count.
+// It is not thread safe, there is one per worker thread.
+class RejectionReporter {
+ public:
+  using SendFunc = std::function<void(RequestContext&& request)>;
+
+  // If attributes is empty, DefaultAttributes() are reported. The static
+  // attributes are added to every report. The rejections are not
+  // aggregated without a timer_create_func.
+  RejectionReporter(
+      const std::unordered_set<std::string>& attributes,
+      int aggregate_window_ms,
+      const ::istio::mixer::v1::Attributes& static_attributes,
+      ::istio::mixerclient::TimerCreateFunc timer_create_func, SendFunc send);
+
+  // Sends the pending aggregated reports.
+  ~RejectionReporter();
+
+  // Reports a rejected request, or adds it to its aggregated report.
+  void Report(CheckData* check_data, ReportData* report_data);
+
+  // Sends the pending aggregated reports.
+  void Flush();
+
+  // The attributes reported by default: source.ip, request.host,
+  // request.path, request.method, response.code, response.time and
+  // context.protocol.
+  static const std::unordered_set<std::string>& DefaultAttributes();
+
+ private:
+  // Returns true if the attribute is reported.
+  bool Reported(const std::string& name) const {
+    return attributes_.count(name) > 0;
+  }
+
+  // Extracts the reported attributes of a rejection.
+  void ExtractAttributes(CheckData* check_data, ReportData* report_data,
+                         ::istio::mixer::v1::Attributes* attributes) const;
+
+  const std::unordered_set<std::string> attributes_;
+  const ::istio::mixer::v1::Attributes static_attributes_;
+  SendFunc send_;
+
+  // The window of the aggregated reports, 0 if they are not aggregated.
+  int aggregate_window_ms_;
+  // Started by the first aggregated rejection of a window.
+  std::unique_ptr<::istio::mixerclient::Timer> timer_;
+
+  // The aggregated reports of the current window, keyed by source ip and
+  // response code.
+  struct Aggregate {
+    RequestContext request;
+    int64_t count;
+  };
+  std::unordered_map<std::string, Aggregate> aggregates_;
+};
+
+}  // namespace http
+}  // namespace control
+}  // namespace istio
+
+#endif  // ISTIO_CONTROL_HTTP_REJECTION_REPORTER_H
@@ -0,0 +1,202 @@
+/* Copyright 2018 Istio Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/istio/control/http/rejection_reporter.h"
+
+#include "gtest/gtest.h"
+#include "include/istio/utils/attributes_builder.h"
+#include "src/istio/control/attribute_names.h"
+#include "src/istio/control/http/mock_check_data.h"
+#include "src/istio/control/http/mock_report_data.h"
+
+using ::istio::mixer::v1::Attributes;
+using ::istio::mixerclient::Timer;
+
+using ::testing::Invoke;
+using ::testing::Return;
+using ::testing::_;
+
+namespace istio {
+namespace control {
+namespace http {
+namespace {
+
+class MockTimer : public Timer {
+ public:
+  MOCK_METHOD0(Stop, void());
+  MOCK_METHOD1(Start, void(int interval_ms));
+};
+
+class RejectionReporterTest : public ::testing::Test {
+ public:
+  void SetUp() {
+    utils::AttributesBuilder(&static_attributes_)
+        .AddString("destination.uid", "pod1");
+    send_ = [this](RequestContext&& request) {
+      sent_.push_back(std::move(request.attributes));
+    };
+  }
+
+  // Sets up a rejection from ip with the response code.
+  void SetUpRejection(const std::string& ip, int code) {
+    EXPECT_CALL(check_data_, GetSourceIpPort(_, _))
+        .WillRepeatedly(Invoke([ip](std::string* source_ip, int* port) {
+          *source_ip = ip;
+          *port = 8080;
+          return true;
+        }));
+    EXPECT_CALL(check_data_, FindHeaderByType(_, _))
+        .WillRepeatedly(Invoke(
+            [](CheckData::HeaderType type, std::string* value) -> bool {
+              switch (type) {
+                case CheckData::HEADER_PATH:
+                  *value = "/books";
+                  return true;
+                case CheckData::HEADER_HOST:
+                  *value = "bookinfo";
+                  return true;
+                case CheckData::HEADER_METHOD:
+                  *value = "GET";
+                  return true;
+                default:
+                  return false;
+              }
+            }));
+    EXPECT_CALL(report_data_, GetReportInfo(_))
+        .WillRepeatedly(Invoke([code](ReportData::ReportInfo* info) {
+          info->request_total_size = 100;
+          info->response_total_size = 50;
+          info->duration = std::chrono::milliseconds(1);
+          info->response_code = code;
+        }));
+    // The maps are never extracted.
+    EXPECT_CALL(check_data_, GetRequestHeaders()).Times(0);
+    EXPECT_CALL(report_data_, GetResponseHeaders()).Times(0);
+  }
+
+  const ::google::protobuf::Map<std::string, Attributes::AttributeValue>& Sent(
+      int i) {
+    return sent_[i].attributes();
+  }
+
+  Attributes static_attributes_;
+  RejectionReporter::SendFunc send_;
+  std::vector<Attributes> sent_;
+  ::testing::NiceMock<MockCheckData> check_data_;
+  ::testing::NiceMock<MockReportData> report_data_;
+};
+
+TEST_F(RejectionReporterTest, TestDefaultAttributes) {
+  RejectionReporter reporter({}, 0, static_attributes_, nullptr, send_);
+  SetUpRejection("1.2.3.4", 401);
+  reporter.Report(&check_data_, &report_data_);
+
+  ASSERT_EQ(sent_.size(), 1);
+  const auto& attributes = Sent(0);
+  EXPECT_EQ(attributes.size(),
+            RejectionReporter::DefaultAttributes().size() + 1);
+  EXPECT_EQ(attributes.at("destination.uid").string_value(), "pod1");
+  EXPECT_EQ(attributes.at(AttributeName::kSourceIp).bytes_value(), "1.2.3.4");
+  EXPECT_EQ(attributes.at(AttributeName::kRequestPath).string_value(),
+            "/books");
+  EXPECT_EQ(attributes.at(AttributeName::kRequestHost).string_value(),
+            "bookinfo");
+  EXPECT_EQ(attributes.at(AttributeName::kRequestMethod).string_value(),
+            "GET");
+  EXPECT_EQ(attributes.at(AttributeName::kResponseCode).int64_value(), 401);
+  EXPECT_EQ(attributes.at(AttributeName::kContextProtocol).string_value(),
+            "http");
+  EXPECT_EQ(attributes.count(AttributeName::kResponseTime), 1);
+}
+
+TEST_F(RejectionReporterTest, TestConfiguredAttributes) {
+  RejectionReporter reporter(
+      {AttributeName::kSourcePort, AttributeName::kResponseCode,
+       AttributeName::kResponseTotalSize, "request.headers"},
+      0, Attributes(), nullptr, send_);
+  SetUpRejection("1.2.3.4", 429);
+  reporter.Report(&check_data_, &report_data_);
+
+  ASSERT_EQ(sent_.size(), 1);
+  const auto& attributes = Sent(0);
+  // Only the supported attributes are reported.
+  EXPECT_EQ(attributes.size(), 3);
+  EXPECT_EQ(attributes.at(AttributeName::kSourcePort).int64_value(), 8080);
+  EXPECT_EQ(attributes.at(AttributeName::kResponseCode).int64_value(), 429);
+  EXPECT_EQ(attributes.at(AttributeName::kResponseTotalSize).int64_value(),
+            50);
+}
+
+TEST_F(RejectionReporterTest, TestAggregation) {
+  MockTimer* timer = new MockTimer;
+  std::function<void()> timer_func;
+  auto timer_create = [timer, &timer_func](std::function<void()> func) {
+    timer_func = func;
+    return std::unique_ptr<Timer>(timer);
+  };
+  RejectionReporter reporter({}, 1000, static_attributes_, timer_create,
+                             send_);
+  ASSERT_TRUE(timer_func);
+
+  // The timer is started by the first rejection of the window only.
+  EXPECT_CALL(*timer, Start(1000)).Times(1);
+  SetUpRejection("1.2.3.4", 401);
+  for (int i = 0; i < 3; ++i) {
+    reporter.Report(&check_data_, &report_data_);
+  }
+  SetUpRejection("1.2.3.4", 429);
+  reporter.Report(&check_data_, &report_data_);
+  EXPECT_TRUE(sent_.empty());
+
+  // Stopped again when the reporter is destroyed.
+  EXPECT_CALL(*timer, Stop()).Times(2);
+  timer_func();
+  ASSERT_EQ(sent_.size(), 2);
+  std::map<int64_t, int64_t> counts;
+  for (int i = 0; i < 2; ++i) {
+    EXPECT_EQ(Sent(i).at("destination.uid").string_value(), "pod1");
+    counts[Sent(i).at(AttributeName::kResponseCode).int64_value()] =
+        Sent(i).at(AttributeName::kContextRejectedCount).int64_value();
+  }
+  EXPECT_EQ(counts[401], 3);
+  EXPECT_EQ(counts[429], 1);
+
+  // A new window is started by the next rejection, and the reports still
+  // pending are sent when the reporter is destroyed.
+  EXPECT_CALL(*timer, Start(1000)).Times(1);
+  reporter.Report(&check_data_, &report_data_);
+  EXPECT_EQ(sent_.size(), 2);
+}
+
+TEST_F(RejectionReporterTest, TestFlushOnDestroy) {
+  MockTimer* timer = new ::testing::NiceMock<MockTimer>;
+  auto timer_create = [timer](std::function<void()>) {
+    return std::unique_ptr<Timer>(timer);
+  };
+  {
+    RejectionReporter reporter({}, 1000, Attributes(), timer_create, send_);
+    SetUpRejection("1.2.3.4", 401);
+    reporter.Report(&check_data_, &report_data_);
+    reporter.Report(&check_data_, &report_data_);
+    EXPECT_TRUE(sent_.empty());
+  }
+  ASSERT_EQ(sent_.size(), 1);
+  EXPECT_EQ(Sent(0).at(AttributeName::kContextRejectedCount).int64_value(), 2);
+}
+
+}  // namespace
+}  // namespace http
+}  // namespace control
+}  // namespace istio
@@ -14,6 +14,7 @@
  */
 
 #include "src/istio/control/http/request_handler_impl.h"
+#include "src/istio/control/attribute_names.h"
 #include "src/istio/control/http/attributes_builder.h"
 
 using ::google::protobuf::util::Status;
@@ -25,21 +26,54 @@ using ::istio::quota_config::Requirement;
 namespace istio {
 namespace control {
 namespace http {
+namespace {
+
+// The deferred check attributes, with the api key. Scanning the query
+// parameters, headers and cookies for the api key is skipped if the check
+// cache answers without it.
+const std::vector<std::string>& DeferredAttributeNames() {
+  static const std::vector<std::string> names = [] {
+    std::vector<std::string> result =
+        AttributesBuilder::DeferredCheckAttributeNames();
+    result.push_back(AttributeName::kRequestApiKey);
+    return result;
+  }();
+  return names;
+}
+
+}  // namespace
 
 RequestHandlerImpl::RequestHandlerImpl(
-    std::shared_ptr<ServiceContext> service_context)
-    : service_context_(service_context) {}
+    std::shared_ptr<ServiceContext> service_context,
+    std::shared_ptr<ServiceCounters> service_counters)
+    : request_context_(
+          service_context->client_context()->NewRequestContext()),
+      service_context_(service_context),
+      service_counters_(service_counters) {}
+
+RequestHandlerImpl::~RequestHandlerImpl() {
+  service_context_->client_context()->FreeRequestContext(
+      std::move(request_context_));
+}
 
 void RequestHandlerImpl::ExtractRequestAttributes(CheckData* check_data) {
+  ExtractRequestAttributes(check_data, false);
+}
+
+void RequestHandlerImpl::ExtractRequestAttributes(CheckData* check_data,
+                                                  bool defer) {
   if (service_context_->enable_mixer_check() ||
       service_context_->enable_mixer_report()) {
-    service_context_->AddStaticAttributes(&request_context_);
+    service_context_->AddStaticAttributes(request_context_.get());
 
-    AttributesBuilder builder(&request_context_);
-    builder.ExtractForwardedAttributes(check_data);
-    builder.ExtractCheckAttributes(check_data);
+    AttributesBuilder builder(request_context_.get());
+    builder.ExtractForwardedAttributes(
+        check_data, service_context_->client_context()
+                        ->forwarded_attributes_cache());
+    builder.ExtractCheckAttributes(check_data, defer);
 
-    service_context_->AddApiAttributes(check_data, &request_context_);
+    service_context_->AddApiAttributes(check_data, request_context_.get(),
+                                       defer);
   }
 }
 
@@ -47,12 +81,17 @@ CancelFunc RequestHandlerImpl::Check(CheckData* check_data,
                                      HeaderUpdate* header_update,
                                      TransportCheckFunc transport,
                                      DoneFunc on_done) {
-  ExtractRequestAttributes(check_data);
+  // Without a report, the check cache is first looked up with the stable
+  // attributes only, the others are extracted if it misses or if a learned
+  // referenced shape needs them.
+  bool defer = service_context_->enable_mixer_check() &&
+                    !service_context_->enable_mixer_report();
+  ExtractRequestAttributes(check_data, defer);
 
-  if (service_context_->client_context()->config().has_forward_attributes()) {
-    AttributesBuilder::ForwardAttributes(
-        service_context_->client_context()->config().forward_attributes(),
-        header_update);
+  const std::string& forward_attributes_header =
+      service_context_->client_context()->forward_attributes_header();
+  if (!forward_attributes_header.empty()) {
+    header_update->AddIstioAttributes(forward_attributes_header);
   } else {
     header_update->RemoveIstioAttributes();
   }
@@ -62,10 +101,36 @@ CancelFunc RequestHandlerImpl::Check(CheckData* check_data,
     return nullptr;
   }
 
-  service_context_->AddQuotas(&request_context_);
+  service_context_->AddQuotas(request_context_.get());
+  if (defer) {
+    request_context_->deferred_attribute_names = &DeferredAttributeNames();
+    request_context_->fill_deferred_attributes =
+        [this, check_data](::istio::mixer::v1::Attributes*) {
+          AttributesBuilder builder(request_context_.get());
+          builder.ExtractDeferredCheckAttributes(check_data);
+          service_context_->AddApiKey(check_data, request_context_.get());
+        };
+  }
 
+  if (service_counters_) {
+    ++service_counters_->check_calls;
+    on_done = [this, on_done](const Status& status) {
+      if (request_context_->check_cache_hit) {
+        ++service_counters_->check_cache_hits;
+      } else {
+        ++service_counters_->blocking_remote_check_calls;
+      }
+      if (!request_context_->quotas.empty() &&
+          request_context_->quota_cache_hit) {
+        ++service_counters_->quota_cache_hits;
+      }
+      if (on_done) {
+        on_done(status);
+      }
+    };
+  }
   return service_context_->client_context()->SendCheck(transport, on_done,
-                                                       &request_context_);
+                                                       request_context_.get());
 }
 
 // Make remote report call.
@@ -73,10 +138,15 @@ void RequestHandlerImpl::Report(ReportData* report_data) {
   if (!service_context_->enable_mixer_report()) {
     return;
   }
-  AttributesBuilder builder(&request_context_);
+  if (service_counters_) {
+    ++service_counters_->report_calls;
+  }
+  AttributesBuilder builder(request_context_.get());
   builder.ExtractReportAttributes(report_data);
 
-  service_context_->client_context()->SendReport(request_context_);
+  // The request context is not used after the report.
+  service_context_->client_context()->SendReport(
+      std::move(*request_context_));
 }
 
 }  // namespace http
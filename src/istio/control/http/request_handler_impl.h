@@ -28,7 +28,13 @@ namespace http {
 // The class to implement HTTPRequestHandler interface.
 class RequestHandlerImpl : public RequestHandler {
  public:
-  RequestHandlerImpl(std::shared_ptr<ServiceContext> service_context);
+  // The requests are counted in service_counters, if not nullptr.
+  RequestHandlerImpl(std::shared_ptr<ServiceContext> service_context,
+                     std::shared_ptr<ServiceCounters> service_counters =
+                         nullptr);
+
+  // Recycles the request context.
+  ~RequestHandlerImpl();
 
   // Makes a Check call.
   ::istio::mixerclient::CancelFunc Check(
@@ -41,12 +47,24 @@ class RequestHandlerImpl : public RequestHandler {
 
   void ExtractRequestAttributes(CheckData* check_data) override;
 
+  ::istio::mixerclient::CheckMissReason check_miss_reason() const override {
+    return request_context_->check_miss_reason;
+  }
+
  private:
-  // The request context object.
-  RequestContext request_context_;
+  // Extracts the request attributes, leaving the deferred check attributes
+  // if defer is true.
+  void ExtractRequestAttributes(CheckData* check_data, bool defer);
+
+  // The request context object, from the free contexts of the client
+  // context.
+  std::unique_ptr<RequestContext> request_context_;
 
   // The service context.
   std::shared_ptr<ServiceContext> service_context_;
+
+  // The counters of the destination service, nullptr if not counted.
+  std::shared_ptr<ServiceCounters> service_counters_;
 };
 
 }  // namespace http
@@ -20,6 +20,7 @@
 #include "src/istio/control/http/controller_impl.h"
 #include "src/istio/control/http/mock_check_data.h"
 #include "src/istio/control/http/mock_report_data.h"
+#include "src/istio/control/http/service_context.h"
 #include "src/istio/control/mock_mixer_client.h"
 
 using ::google::protobuf::TextFormat;
@@ -128,6 +129,32 @@ TEST_F(RequestHandlerImplTest, TestServiceConfigManage) {
   EXPECT_TRUE(controller_->LookupServiceConfig("4444"));
 }
 
+TEST_F(RequestHandlerImplTest, TestRouteServiceConfig) {
+  ::testing::NiceMock<MockCheckData> mock_data;
+  ::testing::NiceMock<MockHeaderUpdate> mock_header;
+  // Not to extract attributes since both Check and Report are disabled.
+  EXPECT_CALL(mock_data, GetSourceIpPort(_, _)).Times(0);
+
+  // Check should NOT be called.
+  EXPECT_CALL(*mock_client_, Check(_, _, _, _)).Times(0);
+
+  ServiceConfig config;
+  config.set_disable_check_calls(true);
+  config.set_disable_report_calls(true);
+  Controller::PerRouteConfig per_route;
+  per_route.service_config = &config;
+  per_route.service_config_hash = 1111;
+  // The string keys are not used.
+  per_route.service_config_id = "2222";
+
+  for (int i = 0; i < 2; ++i) {
+    auto handler = controller_->CreateRequestHandler(per_route);
+    handler->Check(&mock_data, &mock_header, nullptr,
+                   [](const Status& status) { EXPECT_TRUE(status.ok()); });
+  }
+  EXPECT_FALSE(controller_->LookupServiceConfig("2222"));
+}
+
 TEST_F(RequestHandlerImplTest, TestHandlerDisabledCheckReport) {
   ::testing::NiceMock<MockCheckData> mock_data;
   ::testing::NiceMock<MockHeaderUpdate> mock_header;
@@ -375,6 +402,98 @@ TEST_F(RequestHandlerImplTest, TestDefaultApiKey) {
   handler->Check(&mock_data, &mock_header, nullptr, nullptr);
 }
 
+TEST_F(RequestHandlerImplTest, TestDeferredApiKey) {
+  ::testing::NiceMock<MockCheckData> mock_data;
+  ::testing::NiceMock<MockHeaderUpdate> mock_header;
+  EXPECT_CALL(mock_data, FindQueryParameter(_, _))
+      .WillRepeatedly(
+          Invoke([](const std::string& name, std::string* value) -> bool {
+            if (name == "key") {
+              *value = "test-api-key";
+              return true;
+            }
+            return false;
+          }));
+
+  // Without a report, the api key is deferred. The default deferred Check
+  // fills it before the check.
+  EXPECT_CALL(*mock_client_, Check(_, _, _, _))
+      .WillOnce(Invoke([](const Attributes& attributes,
+                          const std::vector<Requirement>& quotas,
+                          TransportCheckFunc transport,
+                          CheckDoneFunc on_done) -> CancelFunc {
+        auto map = attributes.attributes();
+        EXPECT_EQ(map[AttributeName::kRequestApiKey].string_value(),
+                  "test-api-key");
+        return nullptr;
+      }));
+
+  ServiceConfig config;
+  config.set_disable_report_calls(true);
+  Controller::PerRouteConfig per_route;
+  ApplyPerRouteConfig(config, &per_route);
+
+  auto handler = controller_->CreateRequestHandler(per_route);
+  handler->Check(&mock_data, &mock_header, nullptr, nullptr);
+}
+
+TEST_F(RequestHandlerImplTest, TestSharedServiceConfigSnapshot) {
+  ServiceConfig config;
+  config.set_disable_report_calls(true);
+  ServiceConfig same_config(config);
+  ServiceConfig other_config;
+
+  // The service contexts of the same config, as in different workers,
+  // share the compiled one.
+  ServiceContext context(client_context_, &config);
+  ServiceContext same_context(client_context_, &same_config);
+  ServiceContext other_context(client_context_, &other_config);
+  EXPECT_EQ(context.snapshot(), same_context.snapshot());
+  EXPECT_NE(context.snapshot(), other_context.snapshot());
+  EXPECT_TRUE(context.enable_mixer_check());
+  EXPECT_FALSE(context.enable_mixer_report());
+  EXPECT_TRUE(other_context.enable_mixer_report());
+}
+
+TEST_F(RequestHandlerImplTest, TestSharedCachesKeptByConfigUpdate) {
+  HttpClientConfig config;
+  config.mutable_transport()->set_check_cluster("mixer_server");
+  HttpClientConfig updated_config(config);
+  updated_config.set_default_destination_service("service1");
+  HttpClientConfig other_config(config);
+  other_config.mutable_transport()->set_check_cluster("other_server");
+
+  // The caches of an updated config with the same transport are the ones
+  // still in use.
+  auto check_cache = Controller::CreateSharedCheckCache(config);
+  auto quota_cache = Controller::CreateSharedQuotaCache(config);
+  ASSERT_TRUE(check_cache && quota_cache);
+  EXPECT_EQ(Controller::CreateSharedCheckCache(updated_config), check_cache);
+  EXPECT_EQ(Controller::CreateSharedQuotaCache(updated_config), quota_cache);
+  EXPECT_NE(Controller::CreateSharedCheckCache(other_config), check_cache);
+  EXPECT_NE(Controller::CreateSharedQuotaCache(other_config), quota_cache);
+  // A cache partitioned by an attribute is not the same cache.
+  ::istio::mixerclient::ClientTuning tuning;
+  tuning.check_partition_attribute = "destination.service";
+  EXPECT_NE(Controller::CreateSharedCheckCache(config, "", "", "", tuning),
+            check_cache);
+  // Nor is a cache with a negative cache tier.
+  ::istio::mixerclient::ClientTuning negative_tuning;
+  negative_tuning.negative_cache_ttl_ms = 1000;
+  EXPECT_NE(
+      Controller::CreateSharedCheckCache(config, "", "", "", negative_tuning),
+      check_cache);
+  // Nor are caches limited by bytes.
+  ::istio::mixerclient::ClientTuning bytes_tuning;
+  bytes_tuning.check_cache_max_bytes = 1 << 20;
+  bytes_tuning.quota_cache_max_bytes = 1 << 20;
+  EXPECT_NE(
+      Controller::CreateSharedCheckCache(config, "", "", "", bytes_tuning),
+      check_cache);
+  EXPECT_NE(Controller::CreateSharedQuotaCache(config, bytes_tuning),
+            quota_cache);
+}
+
 TEST_F(RequestHandlerImplTest, TestHandlerReport) {
   ::testing::NiceMock<MockReportData> mock_data;
   EXPECT_CALL(mock_data, GetResponseHeaders()).Times(1);
@@ -391,6 +510,88 @@ TEST_F(RequestHandlerImplTest, TestHandlerReport) {
   handler->Report(&mock_data);
 }
 
+TEST_F(RequestHandlerImplTest, TestRecycledRequestContext) {
+  auto request = client_context_->NewRequestContext();
+  (*request->attributes.mutable_attributes())["key"].set_string_value("value");
+  request->quotas.push_back({"RequestCount", 1});
+  request->check_cache_hit = true;
+  const RequestContext* recycled = request.get();
+  client_context_->FreeRequestContext(std::move(request));
+
+  // A handler takes the free context, and it is cleared.
+  ServiceConfig config;
+  Controller::PerRouteConfig per_route;
+  ApplyPerRouteConfig(config, &per_route);
+  auto handler = controller_->CreateRequestHandler(per_route);
+  request = client_context_->NewRequestContext();
+  EXPECT_NE(request.get(), recycled);
+  client_context_->FreeRequestContext(std::move(request));
+
+  // Freed again with the handler.
+  handler.reset();
+  request = client_context_->NewRequestContext();
+  EXPECT_EQ(request.get(), recycled);
+  EXPECT_EQ(request->attributes.attributes_size(), 0);
+  EXPECT_TRUE(request->quotas.empty());
+  EXPECT_FALSE(request->check_cache_hit);
+}
+
+TEST_F(RequestHandlerImplTest, TestServiceStats) {
+  ::testing::NiceMock<MockCheckData> mock_check_data;
+  ::testing::NiceMock<MockReportData> mock_report_data;
+  ::testing::NiceMock<MockHeaderUpdate> mock_header;
+  mock_client_ = new ::testing::NiceMock<MockMixerClient>;
+  // Keep the stats of one service.
+  client_context_ = std::make_shared<ClientContext>(
+      std::unique_ptr<MixerClient>(mock_client_), client_config_, 3, 1);
+  controller_ =
+      std::unique_ptr<Controller>(new ControllerImpl(client_context_));
+
+  bool cache_hit = false;
+  EXPECT_CALL(*mock_client_, Check(_, _, _, _))
+      .WillRepeatedly(Invoke([&cache_hit](const Attributes& attributes,
+                                          const std::vector<Requirement>&,
+                                          TransportCheckFunc,
+                                          CheckDoneFunc on_done)
+                                    -> CancelFunc {
+        ::istio::mixerclient::CheckResponseInfo info;
+        info.is_check_cache_hit = cache_hit;
+        info.response_status = &Status::OK;
+        on_done(info);
+        return nullptr;
+      }));
+
+  Controller::PerRouteConfig per_route;
+  per_route.destination_service = "svc1";
+  for (int i = 0; i < 3; i++) {
+    cache_hit = i > 0;
+    auto handler = controller_->CreateRequestHandler(per_route);
+    handler->Check(&mock_check_data, &mock_header, nullptr,
+                   [](const Status&) {});
+    handler->Report(&mock_report_data);
+  }
+  // The services over the limit are counted together.
+  for (const std::string& service : {"svc2", "svc3"}) {
+    per_route.destination_service = service;
+    auto handler = controller_->CreateRequestHandler(per_route);
+    handler->Check(&mock_check_data, &mock_header, nullptr,
+                   [](const Status&) {});
+  }
+
+  ::istio::mixerclient::Statistics stat;
+  controller_->GetStatistics(&stat);
+  ASSERT_EQ(stat.service_stats.size(), 2);
+  EXPECT_EQ(stat.service_stats[0].service,
+            ::istio::mixerclient::kOtherServiceStats);
+  EXPECT_EQ(stat.service_stats[0].check_calls, 2);
+  EXPECT_EQ(stat.service_stats[0].report_calls, 0);
+  EXPECT_EQ(stat.service_stats[1].service, "svc1");
+  EXPECT_EQ(stat.service_stats[1].check_calls, 3);
+  EXPECT_EQ(stat.service_stats[1].check_cache_hits, 2);
+  EXPECT_EQ(stat.service_stats[1].blocking_remote_check_calls, 1);
+  EXPECT_EQ(stat.service_stats[1].report_calls, 3);
+}
+
 TEST_F(RequestHandlerImplTest, TestHandlerDisabledReport) {
   ::testing::NiceMock<MockReportData> mock_data;
   EXPECT_CALL(mock_data, GetResponseHeaders()).Times(0);
@@ -408,6 +609,21 @@ TEST_F(RequestHandlerImplTest, TestHandlerDisabledReport) {
   handler->Report(&mock_data);
 }
 
+TEST_F(RequestHandlerImplTest, TestRejectionReportDisabled) {
+  ::testing::NiceMock<MockCheckData> mock_check;
+  ::testing::NiceMock<MockReportData> mock_data;
+  // Reported for the default service config only.
+  EXPECT_CALL(*mock_client_, Report(_)).Times(1);
+  controller_->ReportRejection(Controller::PerRouteConfig(), &mock_check,
+                               &mock_data);
+
+  ServiceConfig config;
+  config.set_disable_report_calls(true);
+  Controller::PerRouteConfig per_route;
+  ApplyPerRouteConfig(config, &per_route);
+  controller_->ReportRejection(per_route, &mock_check, &mock_data);
+}
+
 TEST_F(RequestHandlerImplTest, TestEmptyConfig) {
   SetUpMockController(kEmptyClientConfig);
 
@@ -418,13 +634,12 @@ TEST_F(RequestHandlerImplTest, TestEmptyConfig) {
   EXPECT_CALL(mock_check, GetSourceUser(_)).Times(0);
 
   // Attributes is forwarded.
-  EXPECT_CALL(mock_header, AddIstioAttributes(_))
-      .WillOnce(Invoke([](const std::string& data) {
-        Attributes forwarded_attr;
-        EXPECT_TRUE(forwarded_attr.ParseFromString(data));
-        auto map = forwarded_attr.attributes();
-        EXPECT_EQ(map["source-key"].string_value(), "source-value");
-      }));
+  Attributes forwarded_attr;
+  (*forwarded_attr.mutable_attributes())["source-key"].set_string_value(
+      "source-value");
+  EXPECT_CALL(mock_header, AddIstioAttributes(
+                               AttributesBuilder::EncodeForwardAttributes(
+                                   forwarded_attr)));
 
   // Check should NOT be called.
   EXPECT_CALL(*mock_client_, Check(_, _, _, _)).Times(0);
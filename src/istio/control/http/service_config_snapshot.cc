@@ -0,0 +1,95 @@
+/* Copyright 2018 Istio Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/istio/control/http/service_config_snapshot.h"
+#include "include/istio/utils/protobuf.h"
+
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+using ::istio::mixer::v1::config::client::ServiceConfig;
+
+namespace istio {
+namespace control {
+namespace http {
+
+ServiceConfigSnapshot::ServiceConfigSnapshot(const ServiceConfig* config) {
+  if (!config) {
+    return;
+  }
+  service_config_.reset(new ServiceConfig(*config));
+  for (const auto& api_spec : service_config_->http_api_spec()) {
+    api_spec_.MergeFrom(api_spec);
+  }
+  // The quota configs without match are evaluated once here.
+  for (const auto& quota : service_config_->quota_spec()) {
+    auto parser = ::istio::quota_config::ConfigParser::Create(quota);
+    if (!parser->GetUnconditionalRequirements(&unconditional_quotas_)) {
+      quota_parsers_.push_back(std::move(parser));
+    }
+  }
+}
+
+std::shared_ptr<const ServiceConfigSnapshot> ServiceConfigSnapshot::Get(
+    const ServiceConfig* config) {
+  // The live snapshots by the deterministic serialization of their config,
+  // with an empty key for no config.
+  typedef std::unordered_map<std::string,
+                             std::weak_ptr<const ServiceConfigSnapshot>>
+      SnapshotMap;
+  static std::mutex mutex;
+  static SnapshotMap snapshots;
+
+  // The prefix keeps an empty config apart from no config.
+  std::string key =
+      config ? "c" + ::istio::utils::SerializeDeterministic(*config) : "";
+
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = snapshots.find(key);
+    if (it != snapshots.end()) {
+      auto snapshot = it->second.lock();
+      if (snapshot) {
+        return snapshot;
+      }
+    }
+  }
+
+  // Builds out of the lock, not to block the other workers. If another
+  // worker built the same config meanwhile, its snapshot is used.
+  std::shared_ptr<const ServiceConfigSnapshot> snapshot =
+      std::make_shared<ServiceConfigSnapshot>(config);
+  std::lock_guard<std::mutex> lock(mutex);
+  std::weak_ptr<const ServiceConfigSnapshot>& entry = snapshots[key];
+  auto existing = entry.lock();
+  if (existing) {
+    return existing;
+  }
+  entry = snapshot;
+  // Drop the entries of the released snapshots.
+  for (auto it = snapshots.begin(); it != snapshots.end();) {
+    if (it->second.expired()) {
+      it = snapshots.erase(it);
+    } else {
+      ++it;
+    }
+  }
+  return snapshot;
+}
+
+}  // namespace http
+}  // namespace control
+}  // namespace istio
@@ -0,0 +1,86 @@
+/* Copyright 2018 Istio Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ISTIO_CONTROL_HTTP_SERVICE_CONFIG_SNAPSHOT_H
+#define ISTIO_CONTROL_HTTP_SERVICE_CONFIG_SNAPSHOT_H
+
+#include "include/istio/quota_config/config_parser.h"
+#include "mixer/v1/config/client/api_spec.pb.h"
+#include "mixer/v1/config/client/client_config.pb.h"
+
+#include <memory>
+#include <vector>
+
+namespace istio {
+namespace control {
+namespace http {
+
+// The compiled state of a service config, not depending on a worker: the
+// config, its merged api spec and its quota parsers. It is immutable, so
+// the workers and the services share the snapshot of the same config.
+class ServiceConfigSnapshot {
+ public:
+  ServiceConfigSnapshot(
+      const ::istio::mixer::v1::config::client::ServiceConfig* config);
+
+  // Returns the shared snapshot of the config, building it if no live one
+  // has the same content. config may be nullptr.
+  static std::shared_ptr<const ServiceConfigSnapshot> Get(
+      const ::istio::mixer::v1::config::client::ServiceConfig* config);
+
+  // The service config, nullptr if none.
+  const ::istio::mixer::v1::config::client::ServiceConfig* service_config()
+      const {
+    return service_config_.get();
+  }
+
+  // The concatenated api specs of the service config.
+  const ::istio::mixer::v1::config::client::HTTPAPISpec& api_spec() const {
+    return api_spec_;
+  }
+
+  // The quota parsers of the quota configs with conditional requirements.
+  const std::vector<std::unique_ptr<::istio::quota_config::ConfigParser>>&
+  quota_parsers() const {
+    return quota_parsers_;
+  }
+
+  // The requirements of the other quota configs, added to all requests.
+  const std::vector<::istio::quota_config::Requirement>&
+  unconditional_quotas() const {
+    return unconditional_quotas_;
+  }
+
+ private:
+  // The service config.
+  std::unique_ptr<::istio::mixer::v1::config::client::ServiceConfig>
+      service_config_;
+
+  // Concatenated api_spec_
+  ::istio::mixer::v1::config::client::HTTPAPISpec api_spec_;
+
+  // The quota parsers of the conditional quota configs.
+  std::vector<std::unique_ptr<::istio::quota_config::ConfigParser>>
+      quota_parsers_;
+
+  // The requirements of the unconditional quota configs.
+  std::vector<::istio::quota_config::Requirement> unconditional_quotas_;
+};
+
+}  // namespace http
+}  // namespace control
+}  // namespace istio
+
+#endif  // ISTIO_CONTROL_HTTP_SERVICE_CONFIG_SNAPSHOT_H
@@ -24,42 +24,46 @@ namespace http {
 
 ServiceContext::ServiceContext(std::shared_ptr<ClientContext> client_context,
                                const ServiceConfig* config)
-    : client_context_(client_context) {
-  if (config) {
-    service_config_.reset(new ServiceConfig(*config));
-  }
+    : client_context_(client_context),
+      snapshot_(ServiceConfigSnapshot::Get(config)),
+      service_config_(snapshot_->service_config()) {
   BuildParsers();
+  BuildStaticAttributes();
 }
 
-void ServiceContext::BuildParsers() {
-  if (!service_config_) {
-    return;
+void ServiceContext::BuildStaticAttributes() {
+  if (client_context_->config().has_mixer_attributes()) {
+    static_attributes_.MergeFrom(client_context_->config().mixer_attributes());
   }
-  // Build api_spec parsers
-  for (const auto& api_spec : service_config_->http_api_spec()) {
-    api_spec_.MergeFrom(api_spec);
+  if (service_config_ && service_config_->has_mixer_attributes()) {
+    static_attributes_.MergeFrom(service_config_->mixer_attributes());
   }
-  api_spec_parser_ = ::istio::api_spec::HttpApiSpecParser::Create(api_spec_);
+}
 
-  // Build quota parser
-  for (const auto& quota : service_config_->quota_spec()) {
-    quota_parsers_.push_back(
-        ::istio::quota_config::ConfigParser::Create(quota));
+void ServiceContext::BuildParsers() {
+  if (!service_config_) {
+    return;
   }
+  api_spec_parser_ =
+      ::istio::api_spec::HttpApiSpecParser::Create(snapshot_->api_spec());
 }
 
 // Add static mixer attributes.
 void ServiceContext::AddStaticAttributes(RequestContext* request) const {
-  if (client_context_->config().has_mixer_attributes()) {
-    request->attributes.MergeFrom(client_context_->config().mixer_attributes());
+  if (static_attributes_.attributes().empty()) {
+    return;
   }
-  if (service_config_->has_mixer_attributes()) {
-    request->attributes.MergeFrom(service_config_->mixer_attributes());
+  if (request->attributes.attributes().empty()) {
+    // A new request starts from a copy of them.
+    request->attributes.CopyFrom(static_attributes_);
+  } else {
+    request->attributes.MergeFrom(static_attributes_);
   }
 }
 
 void ServiceContext::AddApiAttributes(CheckData* check_data,
-                                      RequestContext* request) const {
+                                      RequestContext* request,
+                                      bool defer_api_key) const {
   if (!api_spec_parser_) {
     return;
   }
@@ -70,6 +74,16 @@ void ServiceContext::AddApiAttributes(CheckData* check_data,
     api_spec_parser_->AddAttributes(http_method, path, &request->attributes);
   }
 
+  if (!defer_api_key) {
+    AddApiKey(check_data, request);
+  }
+}
+
+void ServiceContext::AddApiKey(CheckData* check_data,
+                               RequestContext* request) const {
+  if (!api_spec_parser_) {
+    return;
+  }
   std::string api_key;
   if (api_spec_parser_->ExtractApiKey(check_data, &api_key)) {
     (*request->attributes.mutable_attributes())[AttributeName::kRequestApiKey]
@@ -79,7 +93,10 @@ void ServiceContext::AddApiAttributes(CheckData* check_data,
 
 // Add quota requirements from quota configs.
 void ServiceContext::AddQuotas(RequestContext* request) const {
-  for (const auto& parser : quota_parsers_) {
+  const auto& unconditional_quotas = snapshot_->unconditional_quotas();
+  request->quotas.insert(request->quotas.end(), unconditional_quotas.begin(),
+                         unconditional_quotas.end());
+  for (const auto& parser : snapshot_->quota_parsers()) {
     parser->GetRequirements(request->attributes, &request->quotas);
   }
 }
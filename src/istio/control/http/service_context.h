@@ -18,14 +18,26 @@
 
 #include "google/protobuf/stubs/status.h"
 #include "include/istio/api_spec/http_api_spec_parser.h"
-#include "include/istio/quota_config/config_parser.h"
 #include "mixer/v1/attributes.pb.h"
 #include "src/istio/control/http/client_context.h"
+#include "src/istio/control/http/service_config_snapshot.h"
+
+#include <atomic>
 
 namespace istio {
 namespace control {
 namespace http {
 
+// The counters of the requests to a destination service, see
+// ::istio::mixerclient::ServiceStats.
+struct ServiceCounters {
+  std::atomic<uint64_t> check_calls{0};
+  std::atomic<uint64_t> check_cache_hits{0};
+  std::atomic<uint64_t> blocking_remote_check_calls{0};
+  std::atomic<uint64_t> quota_cache_hits{0};
+  std::atomic<uint64_t> report_calls{0};
+};
+
 // The context to hold service config for both HTTP and TCP.
 class ServiceContext {
  public:
@@ -40,8 +52,13 @@ class ServiceContext {
   // Add static mixer attributes.
   void AddStaticAttributes(RequestContext* request) const;
 
-  // Add api attributes from api_spec.
-  void AddApiAttributes(CheckData* check_data, RequestContext* request) const;
+  // Add api attributes from api_spec. If defer_api_key is true, the api key
+  // is left for AddApiKey().
+  void AddApiAttributes(CheckData* check_data, RequestContext* request,
+                        bool defer_api_key = false) const;
+
+  // Add the api key from the api_spec locations, if found.
+  void AddApiKey(CheckData* check_data, RequestContext* request) const;
 
   // Add quota requirements from quota configs.
   void AddQuotas(RequestContext* request) const;
@@ -53,25 +70,32 @@ class ServiceContext {
     return service_config_ && !service_config_->disable_report_calls();
   }
 
+  // The compiled service config, shared with the other workers.
+  std::shared_ptr<const ServiceConfigSnapshot> snapshot() const {
+    return snapshot_;
+  }
+
  private:
-  // Pre-process the config data to build parser objects.
+  // Build the per worker parser objects.
   void BuildParsers();
 
+  // Merges the static mixer attributes of the client and service configs.
+  void BuildStaticAttributes();
+
   // The client context object.
   std::shared_ptr<ClientContext> client_context_;
 
-  // Concatenated api_spec_
-  ::istio::mixer::v1::config::client::HTTPAPISpec api_spec_;
-  // Api spec parser to generate api attributes and api_key
-  std::unique_ptr<::istio::api_spec::HttpApiSpecParser> api_spec_parser_;
+  // The compiled service config.
+  std::shared_ptr<const ServiceConfigSnapshot> snapshot_;
+  // The service config of the snapshot, nullptr if none.
+  const ::istio::mixer::v1::config::client::ServiceConfig* service_config_;
 
-  // The quota parsers for each quota config.
-  std::vector<std::unique_ptr<::istio::quota_config::ConfigParser>>
-      quota_parsers_;
+  // Api spec parser to generate api attributes and api_key. It shares the
+  // compiled api spec, but keeps a per worker match cache.
+  std::unique_ptr<::istio::api_spec::HttpApiSpecParser> api_spec_parser_;
 
-  // The service config.
-  std::unique_ptr<::istio::mixer::v1::config::client::ServiceConfig>
-      service_config_;
+  // The static mixer attributes, the service ones override the client ones.
+  ::istio::mixer::v1::Attributes static_attributes_;
 };
 
 }  // namespace http
@@ -32,6 +32,8 @@ class MockMixerClient : public ::istio::mixerclient::MixerClient {
                  ::istio::mixerclient::TransportCheckFunc transport,
                  ::istio::mixerclient::CheckDoneFunc on_done));
   MOCK_METHOD1(Report, void(const ::istio::mixer::v1::Attributes& attributes));
+  // Report(Attributes&&) forwards to the mocked Report().
+  using ::istio::mixerclient::MixerClient::Report;
   MOCK_CONST_METHOD1(GetStatistics,
                      void(::istio::mixerclient::Statistics* stat));
 };
@@ -17,9 +17,12 @@
 #define ISTIO_CONTROL_REQUEST_CONTEXT_H
 
 #include "google/protobuf/stubs/status.h"
+#include "include/istio/mixerclient/check_response.h"
 #include "include/istio/quota_config/requirement.h"
 #include "mixer/v1/attributes.pb.h"
 
+#include <functional>
+#include <string>
 #include <vector>
 
 namespace istio {
@@ -33,6 +36,18 @@ struct RequestContext {
   std::vector<::istio::quota_config::Requirement> quotas;
   // The check status.
   ::google::protobuf::util::Status check_status;
+  // True if the check status is from the check cache.
+  bool check_cache_hit = false;
+  // True if the quota result is from the quota cache.
+  bool quota_cache_hit = false;
+  // Why the check or the quotas missed the caches.
+  ::istio::mixerclient::CheckMissReason check_miss_reason =
+      ::istio::mixerclient::CheckMissReason::NONE;
+  // If set, the attributes named in it are not extracted yet for the Check
+  // call, and fill_deferred_attributes adds them. Cleared by SendCheck().
+  const std::vector<std::string>* deferred_attribute_names = nullptr;
+  std::function<void(::istio::mixer::v1::Attributes*)>
+      fill_deferred_attributes;
 };
 
 }  // namespace control
@@ -89,11 +89,17 @@ void AttributesBuilder::ExtractReportAttributes(
     builder.AddString(AttributeName::kConnectionEvent, kConnectionContinue);
   }
 
-  std::string dest_ip;
-  int dest_port;
-  if (report_data->GetDestinationIpPort(&dest_ip, &dest_port)) {
-    builder.AddBytes(AttributeName::kDestinationIp, dest_ip);
-    builder.AddInt64(AttributeName::kDestinationPort, dest_port);
+  // The upstream host doesn't change once it is connected, so the
+  // destination is only extracted until a report finds it.
+  const auto& attributes_map = request_->attributes.attributes();
+  if (attributes_map.find(AttributeName::kDestinationIp) ==
+      attributes_map.end()) {
+    std::string dest_ip;
+    int dest_port;
+    if (report_data->GetDestinationIpPort(&dest_ip, &dest_port)) {
+      builder.AddBytes(AttributeName::kDestinationIp, dest_ip);
+      builder.AddInt64(AttributeName::kDestinationPort, dest_port);
+    }
   }
 
   builder.AddTimestamp(AttributeName::kContextTime,
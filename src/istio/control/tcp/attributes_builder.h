@@ -31,7 +31,8 @@ class AttributesBuilder {
 
   // Extract attributes for Check.
   void ExtractCheckAttributes(CheckData* check_data);
-  // Extract attributes for Report.
+  // Extract attributes for Report. The attributes of the previous report
+  // are updated, the destination is only extracted until it is known.
   void ExtractReportAttributes(ReportData* report_data, bool is_final_report,
                                ReportData::ReportInfo* last_report_info);
 
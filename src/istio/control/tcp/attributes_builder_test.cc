@@ -313,9 +313,9 @@ TEST(AttributesBuilderTest, TestCheckAttributes) {
 
 TEST(AttributesBuilderTest, TestReportAttributes) {
   ::testing::NiceMock<MockReportData> mock_data;
+  // The destination is only extracted by the first report.
   EXPECT_CALL(mock_data, GetDestinationIpPort(_, _))
-      .Times(3)
-      .WillRepeatedly(Invoke([](std::string* ip, int* port) -> bool {
+      .WillOnce(Invoke([](std::string* ip, int* port) -> bool {
         *ip = "1.2.3.4";
         *port = 8080;
         return true;
@@ -20,6 +20,7 @@
 #include "include/istio/quota_config/config_parser.h"
 #include "src/istio/control/client_context_base.h"
 #include "src/istio/control/request_context.h"
+#include "src/istio/control/tcp/connection_decision_cache.h"
 
 namespace istio {
 namespace control {
@@ -31,17 +32,21 @@ namespace tcp {
 class ClientContext : public ClientContextBase {
  public:
   ClientContext(const Controller::Options& data)
-      : ClientContextBase(data.config.transport(), data.env),
+      : ClientContextBase(data.config.transport(), data.env, nullptr, nullptr,
+                          "", 0, nullptr, 0, 0, data.shared_report_batch),
         config_(data.config) {
     BuildQuotaParser();
+    BuildConnectionDecisionCache(data.connection_decision_ttl_ms);
   }
 
   // A constructor for unit-test to pass in a mock mixer_client
   ClientContext(
       std::unique_ptr<::istio::mixerclient::MixerClient> mixer_client,
-      const ::istio::mixer::v1::config::client::TcpClientConfig& config)
+      const ::istio::mixer::v1::config::client::TcpClientConfig& config,
+      int connection_decision_ttl_ms = 0)
       : ClientContextBase(std::move(mixer_client)), config_(config) {
     BuildQuotaParser();
+    BuildConnectionDecisionCache(connection_decision_ttl_ms);
   }
 
   // Add static mixer attributes.
@@ -61,6 +66,11 @@ class ClientContext : public ClientContextBase {
   bool enable_mixer_check() const { return !config_.disable_check_calls(); }
   bool enable_mixer_report() const { return !config_.disable_report_calls(); }
 
+  // The cache of allowed connections, nullptr if it is not enabled.
+  ConnectionDecisionCache* connection_decision_cache() const {
+    return connection_decision_cache_.get();
+  }
+
  private:
   // If there is quota config, build quota parser.
   void BuildQuotaParser() {
@@ -69,11 +79,26 @@ class ClientContext : public ClientContextBase {
           config_.connection_quota_spec());
     }
   }
+  // The decisions can't be cached if each connection takes a quota.
+  void BuildConnectionDecisionCache(int ttl_ms) {
+    if (ttl_ms > 0 && enable_mixer_check() &&
+        !config_.has_connection_quota_spec()) {
+      connection_decision_cache_.reset(new ConnectionDecisionCache(
+          ttl_ms, kConnectionDecisionCacheSize));
+    }
+  }
+
+  // The maximum number of connection decisions to cache.
+  static const int kConnectionDecisionCacheSize = 1000;
+
   // The mixer client config.
   const ::istio::mixer::v1::config::client::TcpClientConfig& config_;
 
   // The quota parser.
   std::unique_ptr<::istio::quota_config::ConfigParser> quota_parser_;
+
+  // The cache of allowed connections.
+  std::unique_ptr<ConnectionDecisionCache> connection_decision_cache_;
 };
 
 }  // namespace tcp
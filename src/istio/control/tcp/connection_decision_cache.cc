@@ -0,0 +1,62 @@
+/* Copyright 2018 Istio Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/istio/control/tcp/connection_decision_cache.h"
+
+namespace istio {
+namespace control {
+namespace tcp {
+
+ConnectionDecisionCache::ConnectionDecisionCache(int ttl_ms, int max_entries)
+    : cache_(max_entries) {
+  cache_.SetAgeBasedEviction(ttl_ms / 1000.0);
+}
+
+ConnectionDecisionCache::~ConnectionDecisionCache() { cache_.RemoveAll(); }
+
+bool ConnectionDecisionCache::GetKey(const CheckData& check_data,
+                                     std::string* key) {
+  std::string source_ip;
+  int source_port;
+  std::string local_address;
+  if (!check_data.GetSourceIpPort(&source_ip, &source_port) ||
+      !check_data.GetLocalAddress(&local_address)) {
+    return false;
+  }
+  std::string source_user;
+  check_data.GetSourceUser(&source_user);
+
+  // The parts are separated by '\0' which the source principal can't have,
+  // the source IP is in binary and has a fixed size.
+  key->assign(source_user);
+  key->push_back('\0');
+  key->append(source_ip);
+  key->push_back('\0');
+  key->append(local_address);
+  return true;
+}
+
+bool ConnectionDecisionCache::Lookup(const std::string& key) {
+  LRUCache::ScopedLookup lookup(&cache_, key);
+  return lookup.Found();
+}
+
+void ConnectionDecisionCache::Insert(const std::string& key) {
+  cache_.Insert(key, new CacheElem, 1);
+}
+
+}  // namespace tcp
+}  // namespace control
+}  // namespace istio
@@ -0,0 +1,60 @@
+/* Copyright 2018 Istio Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ISTIO_CONTROL_TCP_CONNECTION_DECISION_CACHE_H
+#define ISTIO_CONTROL_TCP_CONNECTION_DECISION_CACHE_H
+
+#include <string>
+
+#include "include/istio/control/tcp/check_data.h"
+#include "include/istio/utils/simple_lru_cache.h"
+#include "include/istio/utils/simple_lru_cache_inl.h"
+
+namespace istio {
+namespace control {
+namespace tcp {
+
+// Remembers the connections allowed by a check cache hit, keyed by their
+// source principal, source IP and local address, so the next connections
+// of the same tuple skip the Check call for a while. Not thread safe, it
+// is owned by the per worker ClientContext.
+class ConnectionDecisionCache {
+ public:
+  ConnectionDecisionCache(int ttl_ms, int max_entries);
+  ~ConnectionDecisionCache();
+
+  // Gets the cache key of a connection. Returns false if the connection
+  // has no source IP or local address.
+  static bool GetKey(const CheckData& check_data, std::string* key);
+
+  // Returns true if a connection with the key has been allowed within the
+  // ttl.
+  bool Lookup(const std::string& key);
+
+  // Records an allowed connection.
+  void Insert(const std::string& key);
+
+ private:
+  // The cache holds no data, the presence of a key is the decision.
+  struct CacheElem {};
+  using LRUCache = ::istio::utils::SimpleLRUCache<std::string, CacheElem>;
+  LRUCache cache_;
+};
+
+}  // namespace tcp
+}  // namespace control
+}  // namespace istio
+
+#endif  // ISTIO_CONTROL_TCP_CONNECTION_DECISION_CACHE_H
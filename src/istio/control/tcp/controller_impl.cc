@@ -17,6 +17,7 @@
 #include "src/istio/control/tcp/request_handler_impl.h"
 
 using ::istio::mixer::v1::config::client::TcpClientConfig;
+using ::istio::mixerclient::ReportBatch;
 using ::istio::mixerclient::Statistics;
 
 namespace istio {
@@ -36,6 +37,19 @@ std::unique_ptr<Controller> Controller::Create(const Options& data) {
   return std::unique_ptr<Controller>(new ControllerImpl(data));
 }
 
+std::shared_ptr<ReportBatch> Controller::CreateSharedReportBatch(
+    const Options& options) {
+  return ClientContextBase::CreateSharedReportBatch(
+      options.config.transport(), options.env, "", 0, nullptr, 0, 0,
+      ::istio::mixerclient::ClientTuning());
+}
+
+std::string Controller::SharedReportBatchKey(const Options& options) {
+  return ClientContextBase::SharedReportBatchKey(
+      options.config.transport(), "", 0, nullptr, 0, 0,
+      ::istio::mixerclient::ClientTuning());
+}
+
 void ControllerImpl::GetStatistics(Statistics* stat) const {
   client_context_->GetStatistics(stat);
 }
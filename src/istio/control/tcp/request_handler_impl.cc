@@ -14,6 +14,8 @@
  */
 
 #include "src/istio/control/tcp/request_handler_impl.h"
+#include "include/istio/utils/attributes_builder.h"
+#include "src/istio/control/attribute_names.h"
 #include "src/istio/control/tcp/attributes_builder.h"
 
 using ::google::protobuf::util::Status;
@@ -27,10 +29,24 @@ namespace tcp {
 
 RequestHandlerImpl::RequestHandlerImpl(
     std::shared_ptr<ClientContext> client_context)
-    : client_context_(client_context),
+    : skipped_check_data_(nullptr),
+      client_context_(client_context),
       last_report_info_{0ULL, 0ULL, std::chrono::nanoseconds::zero()} {}
 
 CancelFunc RequestHandlerImpl::Check(CheckData* check_data, DoneFunc on_done) {
+  // The decision cache is only enabled with mixer check.
+  ConnectionDecisionCache* decisions =
+      client_context_->connection_decision_cache();
+  std::string decision_key;
+  if (decisions &&
+      ConnectionDecisionCache::GetKey(*check_data, &decision_key) &&
+      decisions->Lookup(decision_key)) {
+    // Skip building attributes, they are only needed by the reports now.
+    skipped_check_data_ = check_data;
+    on_done(Status::OK);
+    return nullptr;
+  }
+
   if (client_context_->enable_mixer_check() ||
       client_context_->enable_mixer_report()) {
     client_context_->AddStaticAttributes(&request_context_);
@@ -46,7 +62,31 @@ CancelFunc RequestHandlerImpl::Check(CheckData* check_data, DoneFunc on_done) {
 
   client_context_->AddQuotas(&request_context_);
 
-  return client_context_->SendCheck(nullptr, on_done, &request_context_);
+  if (decision_key.empty()) {
+    return client_context_->SendCheck(nullptr, on_done, &request_context_);
+  }
+  // Only the decisions the check cache can reuse are cached, so they follow
+  // its expiration, roughly.
+  return client_context_->SendCheck(
+      nullptr,
+      [this, decisions, decision_key, on_done](const Status& status) {
+        if (status.ok() && request_context_.check_cache_hit) {
+          decisions->Insert(decision_key);
+        }
+        on_done(status);
+      },
+      &request_context_);
+}
+
+void RequestHandlerImpl::ExtractSkippedCheckAttributes() {
+  client_context_->AddStaticAttributes(&request_context_);
+
+  AttributesBuilder builder(&request_context_);
+  builder.ExtractCheckAttributes(skipped_check_data_);
+  skipped_check_data_ = nullptr;
+
+  utils::AttributesBuilder cache_builder(&request_context_.attributes);
+  cache_builder.AddBool(AttributeName::kCheckCacheHit, true);
 }
 
 // Make remote report call.
@@ -58,12 +98,21 @@ void RequestHandlerImpl::Report(ReportData* report_data, bool is_final_report) {
   if (!client_context_->enable_mixer_report()) {
     return;
   }
+  if (skipped_check_data_) {
+    ExtractSkippedCheckAttributes();
+  }
 
   AttributesBuilder builder(&request_context_);
   builder.ExtractReportAttributes(report_data, is_final_report,
                                   &last_report_info_);
 
-  client_context_->SendReport(request_context_);
+  // The attributes are kept for the periodical reports, until the final
+  // one.
+  if (is_final_report) {
+    client_context_->SendReport(std::move(request_context_));
+  } else {
+    client_context_->SendReport(request_context_);
+  }
 }
 
 }  // namespace tcp
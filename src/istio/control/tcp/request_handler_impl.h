@@ -43,7 +43,19 @@ class RequestHandlerImpl : public RequestHandler {
   // otherwise, report delta attributes.
   void Report(ReportData* report_data, bool is_final_report) override;
 
+  ::istio::mixerclient::CheckMissReason check_miss_reason() const override {
+    return request_context_.check_miss_reason;
+  }
+
  private:
+  // Extracts the check attributes of a connection allowed by the connection
+  // decision cache, for its first report.
+  void ExtractSkippedCheckAttributes();
+
+  // The check data of a connection allowed by the connection decision
+  // cache, until its check attributes are extracted.
+  CheckData* skipped_check_data_;
+
   // The request context object.
   RequestContext request_context_;
 
@@ -25,12 +25,16 @@ using ::istio::mixer::v1::Attributes;
 using ::istio::mixer::v1::config::client::TcpClientConfig;
 using ::istio::mixerclient::CancelFunc;
 using ::istio::mixerclient::CheckDoneFunc;
+using ::istio::mixerclient::CheckResponseInfo;
 using ::istio::mixerclient::DoneFunc;
 using ::istio::mixerclient::MixerClient;
 using ::istio::mixerclient::TransportCheckFunc;
 using ::istio::quota_config::Requirement;
 
+using ::testing::DoAll;
 using ::testing::Invoke;
+using ::testing::Return;
+using ::testing::SetArgPointee;
 using ::testing::_;
 
 namespace istio {
@@ -111,6 +115,63 @@ TEST_F(RequestHandlerImplTest, TestHandlerReport) {
   handler->Report(&mock_data);
 }
 
+TEST_F(RequestHandlerImplTest, TestHandlerConnectionDecisionCache) {
+  // Connections with a quota are always checked.
+  client_config_.clear_connection_quota_spec();
+  auto mock_client = new ::testing::NiceMock<MockMixerClient>;
+  controller_ = std::unique_ptr<Controller>(
+      new ControllerImpl(std::make_shared<ClientContext>(
+          std::unique_ptr<MixerClient>(mock_client), client_config_, 60000)));
+
+  ::testing::NiceMock<MockCheckData> mock_data;
+  ON_CALL(mock_data, GetSourceIpPort(_, _))
+      .WillByDefault(
+          DoAll(SetArgPointee<0>(std::string("1.2.3.4")), Return(true)));
+  ON_CALL(mock_data, GetLocalAddress(_))
+      .WillByDefault(
+          DoAll(SetArgPointee<0>(std::string("5.6.7.8:80")), Return(true)));
+
+  // The first connection is allowed by a remote check, the second one by a
+  // check cache hit, the third one is not checked.
+  bool cache_hit = false;
+  EXPECT_CALL(*mock_client, Check(_, _, _, _))
+      .Times(2)
+      .WillRepeatedly(Invoke([&cache_hit](const Attributes&,
+                                          const std::vector<Requirement>&,
+                                          TransportCheckFunc,
+                                          CheckDoneFunc on_done)
+                                 -> CancelFunc {
+        CheckResponseInfo info;
+        info.is_check_cache_hit = cache_hit;
+        info.response_status = &Status::OK;
+        on_done(info);
+        return nullptr;
+      }));
+
+  std::vector<std::unique_ptr<RequestHandler>> handlers;
+  for (int i = 0; i < 3; ++i) {
+    cache_hit = i > 0;
+    handlers.push_back(controller_->CreateRequestHandler());
+    bool done = false;
+    handlers.back()->Check(&mock_data, [&done](const Status& status) {
+      EXPECT_TRUE(status.ok());
+      done = true;
+    });
+    EXPECT_TRUE(done);
+  }
+
+  // The report of the connection not checked has its check attributes.
+  ::testing::NiceMock<MockReportData> mock_report_data;
+  EXPECT_CALL(*mock_client, Report(_))
+      .WillOnce(Invoke([](const Attributes& attributes) {
+        auto map = attributes.attributes();
+        EXPECT_EQ(map["key1"].string_value(), "value1");
+        EXPECT_EQ(map["source.ip"].bytes_value(), "1.2.3.4");
+        EXPECT_TRUE(map["check.cache_hit"].bool_value());
+      }));
+  handlers.back()->Report(&mock_report_data, /* is_final_report */ true);
+}
+
 }  // namespace tcp
 }  // namespace control
 }  // namespace istio
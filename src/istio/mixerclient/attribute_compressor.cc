@@ -18,6 +18,10 @@
 #include "src/istio/mixerclient/delta_update.h"
 #include "src/istio/mixerclient/global_dictionary.h"
 
+#include <algorithm>
+#include <chrono>
+#include <unordered_map>
+
 using ::istio::mixer::v1::Attributes;
 using ::istio::mixer::v1::Attributes_AttributeValue;
 using ::istio::mixer::v1::Attributes_StringMap;
@@ -31,14 +35,32 @@ namespace {
 // If any dictionary error, global dictionary will fall back to this version.
 const int kGlobalDictionaryBaseSize = 111;
 
+// The delay to probe the full global dictionary again after it is shrunk,
+// so that the proxies use it again once the servers are upgraded. It is
+// doubled up to the maximum each time the probe is rejected, and reset
+// when the full dictionary was used for the maximum delay.
+const int64_t kGlobalDictionaryRestoreDelayMs = 60 * 1000;
+const int64_t kMaxGlobalDictionaryRestoreDelayMs = 30 * 60 * 1000;
+
+// Returns the steady clock time in nanoseconds.
+int64_t SteadyNowNs() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
 // Return per message dictionary index.
 int MessageDictIndex(int idx) { return -(idx + 1); }
 
+// Per message words are searched linearly up to this many words, before
+// a hash map is built for them.
+const size_t kMaxLinearWords = 16;
+
 // Per message dictionary.
 class MessageDictionary {
  public:
   MessageDictionary(const GlobalDictionary& global_dict)
-      : global_dict_(global_dict) {}
+      : global_dict_(global_dict), words_bytes_(0) {}
 
   int GetIndex(const std::string& name) {
     int index;
@@ -46,41 +68,94 @@ class MessageDictionary {
       return index;
     }
 
-    const auto& message_it = message_dict_.find(name);
-    if (message_it != message_dict_.end()) {
-      return MessageDictIndex(message_it->second);
+    // Most messages only have a few per message words, they are cheaper
+    // to search than to hash and to copy into a map.
+    if (message_dict_.empty()) {
+      for (size_t i = 0; i < message_words_.size(); ++i) {
+        if (message_words_[i] == name) {
+          return MessageDictIndex(i);
+        }
+      }
+      if (message_words_.size() >= kMaxLinearWords) {
+        for (size_t i = 0; i < message_words_.size(); ++i) {
+          message_dict_[message_words_[i]] = i;
+        }
+      }
+    } else {
+      const auto& message_it = message_dict_.find(name);
+      if (message_it != message_dict_.end()) {
+        return MessageDictIndex(message_it->second);
+      }
     }
 
     index = message_words_.size();
     message_words_.push_back(name);
-    message_dict_[name] = index;
+    words_bytes_ += name.size();
+    if (!message_dict_.empty()) {
+      message_dict_[name] = index;
+    }
     return MessageDictIndex(index);
   }
 
-  const std::vector<std::string>& GetWords() const { return message_words_; }
+  // The words are moved out, the dictionary is not used after.
+  std::vector<std::string>& GetWords() { return message_words_; }
+
+  // The total bytes of the per message words.
+  int64_t words_bytes() const { return words_bytes_; }
 
  private:
   const GlobalDictionary& global_dict_;
+  int64_t words_bytes_;
 
   // Per message dictionary
   std::vector<std::string> message_words_;
   std::unordered_map<std::string, int> message_dict_;
 };
 
+// Appended to the values cut to the maximum size.
+const char kTruncationMarker[] = "...";
+
+// Returns value, or its first max_bytes bytes followed by kTruncationMarker
+// in truncated if it is longer and max_bytes is positive. A UTF-8 value is
+// cut at a character boundary.
+const std::string& BoundValue(const std::string& value, int max_bytes,
+                              bool utf8, std::string* truncated) {
+  if (max_bytes <= 0 || value.size() <= static_cast<size_t>(max_bytes)) {
+    return value;
+  }
+  size_t size = max_bytes;
+  while (utf8 && size > 0 && (value[size] & 0xC0) == 0x80) {
+    --size;
+  }
+  truncated->assign(value, 0, size);
+  truncated->append(kTruncationMarker);
+  return *truncated;
+}
+
 ::istio::mixer::v1::StringMap CreateStringMap(
-    const Attributes_StringMap& raw_map, MessageDictionary& dict) {
+    const Attributes_StringMap& raw_map, MessageDictionary& dict,
+    int max_value_bytes) {
   ::istio::mixer::v1::StringMap compressed_map;
   auto* map_pb = compressed_map.mutable_entries();
+  std::string truncated;
   for (const auto& it : raw_map.entries()) {
-    (*map_pb)[dict.GetIndex(it.first)] = dict.GetIndex(it.second);
+    (*map_pb)[dict.GetIndex(it.first)] = dict.GetIndex(
+        BoundValue(it.second, max_value_bytes, true, &truncated));
   }
   return compressed_map;
 }
 
+// Compresses the attributes, skipping the ones unchanged since the last
+// call if delta_update is not nullptr. If max_value_bytes is positive, the
+// string and bytes values are cut to it.
 bool CompressByDict(const Attributes& attributes, MessageDictionary& dict,
-                    DeltaUpdate& delta_update, CompressedAttributes* pb) {
-  delta_update.Start();
+                    DeltaUpdate* delta_update, int max_value_bytes,
+                    CompressedAttributes* pb) {
+  if (delta_update) {
+    delta_update->Start();
+  }
 
+  std::string truncated;
   // Fill attributes.
   for (const auto& it : attributes.attributes()) {
     const std::string& name = it.first;
@@ -89,17 +164,19 @@ bool CompressByDict(const Attributes& attributes, MessageDictionary& dict,
     int index = dict.GetIndex(name);
 
     // Check delta update. If same, skip it.
-    if (delta_update.Check(index, value)) {
+    if (delta_update && delta_update->Check(index, value)) {
       continue;
     }
 
     // Fill the attribute to proper map.
     switch (value.value_case()) {
       case Attributes_AttributeValue::kStringValue:
-        (*pb->mutable_strings())[index] = dict.GetIndex(value.string_value());
+        (*pb->mutable_strings())[index] = dict.GetIndex(BoundValue(
+            value.string_value(), max_value_bytes, true, &truncated));
         break;
       case Attributes_AttributeValue::kBytesValue:
-        (*pb->mutable_bytes())[index] = value.bytes_value();
+        (*pb->mutable_bytes())[index] = BoundValue(
+            value.bytes_value(), max_value_bytes, false, &truncated);
         break;
       case Attributes_AttributeValue::kInt64Value:
         (*pb->mutable_int64s())[index] = value.int64_value();
@@ -118,75 +195,127 @@ bool CompressByDict(const Attributes& attributes, MessageDictionary& dict,
         break;
       case Attributes_AttributeValue::kStringMapValue:
         (*pb->mutable_string_maps())[index] =
-            CreateStringMap(value.string_map_value(), dict);
+            CreateStringMap(value.string_map_value(), dict, max_value_bytes);
         break;
       case Attributes_AttributeValue::VALUE_NOT_SET:
         break;
     }
   }
 
-  return delta_update.Finish();
+  return delta_update ? delta_update->Finish() : true;
 }
 
 class BatchCompressorImpl : public BatchCompressor {
  public:
-  BatchCompressorImpl(const GlobalDictionary& global_dict)
+  BatchCompressorImpl(const GlobalDictionary& global_dict,
+                      int max_value_bytes)
       : dict_(global_dict),
+        max_value_bytes_(max_value_bytes),
         delta_update_(DeltaUpdate::Create()),
-        report_(new ::istio::mixer::v1::ReportRequest) {
+        report_(new ::istio::mixer::v1::ReportRequest),
+        attributes_bytes_(0) {
     report_->set_global_word_count(global_dict.size());
   }
 
   bool Add(const Attributes& attributes) override {
     CompressedAttributes pb;
-    if (!CompressByDict(attributes, dict_, *delta_update_, &pb)) {
+    if (!CompressByDict(attributes, dict_, delta_update_.get(),
+                        max_value_bytes_, &pb)) {
       return false;
     }
+    attributes_bytes_ += pb.ByteSize();
     pb.GetReflection()->Swap(report_->add_attributes(), &pb);
     return true;
   }
 
   int size() const override { return report_->attributes_size(); }
 
+  int64_t byte_size() const override {
+    return attributes_bytes_ + dict_.words_bytes();
+  }
+
   std::unique_ptr<::istio::mixer::v1::ReportRequest> Finish() override {
-    for (const std::string& word : dict_.GetWords()) {
-      report_->add_default_words(word);
+    for (std::string& word : dict_.GetWords()) {
+      report_->add_default_words(std::move(word));
     }
     return std::move(report_);
   }
 
  private:
   MessageDictionary dict_;
+  const int max_value_bytes_;
   std::unique_ptr<DeltaUpdate> delta_update_;
   std::unique_ptr<::istio::mixer::v1::ReportRequest> report_;
+  // The encoded bytes of the batched attributes.
+  int64_t attributes_bytes_;
 };
 
 }  // namespace
 
-GlobalDictionary::GlobalDictionary() {
-  const std::vector<std::string>& global_words = GetGlobalWords();
-  for (unsigned int i = 0; i < global_words.size(); i++) {
-    global_dict_[global_words[i]] = i;
-  }
-  top_index_ = global_words.size();
-}
+GlobalDictionary::GlobalDictionary()
+    : full_size_(GetGlobalWords().size()),
+      top_index_(full_size_),
+      restore_time_ns_(0),
+      restore_delay_ms_(kGlobalDictionaryRestoreDelayMs) {}
 
 // Lookup the index, return true if found.
-bool GlobalDictionary::GetIndex(const std::string name, int* index) const {
-  const auto& it = global_dict_.find(name);
-  if (it != global_dict_.end() && it->second < top_index_) {
+bool GlobalDictionary::GetIndex(const std::string& name, int* index) const {
+  int global_index = LookupGlobalWord(name.data(), name.size());
+  if (global_index >= 0 && global_index < top_index_) {
     // Return global dictionary index.
-    *index = it->second;
+    *index = global_index;
     return true;
   }
+  if (!extension_.empty()) {
+    const auto it = extension_.find(name);
+    if (it != extension_.end() && it->second < top_index_) {
+      *index = it->second;
+      return true;
+    }
+  }
   return false;
 }
 
+void GlobalDictionary::Extend(const std::vector<std::string>& words) {
+  // Mixer indexes the extension words by their position, the duplicated
+  // words keep their first index.
+  int base_size = GetGlobalWords().size();
+  for (size_t i = 0; i < words.size(); ++i) {
+    extension_.emplace(words[i], base_size + i);
+  }
+  full_size_ = base_size + words.size();
+  top_index_ = full_size_;
+}
+
 void GlobalDictionary::ShrinkToBase() {
-  if (top_index_ > kGlobalDictionaryBaseSize) {
-    top_index_ = kGlobalDictionaryBaseSize;
-    GOOGLE_LOG(INFO) << "Shrink global dictionary " << top_index_
-                     << " to base.";
+  int top_index = full_size_;
+  // Only the first of the concurrent failures shrinks it.
+  if (full_size_ <= kGlobalDictionaryBaseSize ||
+      !top_index_.compare_exchange_strong(top_index,
+                                          kGlobalDictionaryBaseSize)) {
+    return;
+  }
+  int64_t now = SteadyNowNs();
+  int64_t delay_ms = restore_delay_ms_;
+  // The last probe succeeded if it was used for the maximum delay.
+  if (restore_time_ns_ > 0 &&
+      now - restore_time_ns_ > kMaxGlobalDictionaryRestoreDelayMs * 1000000) {
+    delay_ms = kGlobalDictionaryRestoreDelayMs;
+  }
+  restore_time_ns_ = now + delay_ms * 1000000;
+  restore_delay_ms_ =
+      std::min(delay_ms * 2, kMaxGlobalDictionaryRestoreDelayMs);
+  GOOGLE_LOG(INFO) << "Shrink global dictionary " << top_index
+                   << " to base for " << delay_ms << " ms.";
+}
+
+void GlobalDictionary::MaybeRestore() {
+  if (top_index_ == full_size_ || SteadyNowNs() < restore_time_ns_) {
+    return;
+  }
+  int top_index = kGlobalDictionaryBaseSize;
+  if (top_index_.compare_exchange_strong(top_index, full_size_)) {
+    GOOGLE_LOG(INFO) << "Restore global dictionary to " << full_size_;
   }
 }
 
@@ -194,19 +323,17 @@ void AttributeCompressor::Compress(
     const Attributes& attributes,
     ::istio::mixer::v1::CompressedAttributes* pb) const {
   MessageDictionary dict(global_dict_);
-  std::unique_ptr<DeltaUpdate> delta_update = DeltaUpdate::CreateNoOp();
-
-  CompressByDict(attributes, dict, *delta_update, pb);
+  CompressByDict(attributes, dict, nullptr, 0, pb);
 
-  for (const std::string& word : dict.GetWords()) {
-    pb->add_words(word);
+  for (std::string& word : dict.GetWords()) {
+    pb->add_words(std::move(word));
   }
 }
 
 std::unique_ptr<BatchCompressor> AttributeCompressor::CreateBatchCompressor()
     const {
   return std::unique_ptr<BatchCompressor>(
-      new BatchCompressorImpl(global_dict_));
+      new BatchCompressorImpl(global_dict_, max_report_value_bytes_));
 }
 
 }  // namespace mixerclient
@@ -16,11 +16,14 @@
 #ifndef ISTIO_MIXERCLIENT_ATTRIBUTE_COMPRESSOR_H
 #define ISTIO_MIXERCLIENT_ATTRIBUTE_COMPRESSOR_H
 
-#include <unordered_map>
-
 #include "mixer/v1/attributes.pb.h"
 #include "mixer/v1/report.pb.h"
 
+#include <atomic>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
 namespace istio {
 namespace mixerclient {
 
@@ -30,18 +33,39 @@ class GlobalDictionary {
   GlobalDictionary();
 
   // Lookup the index, return true if found.
-  bool GetIndex(const std::string word, int* index) const;
+  bool GetIndex(const std::string& word, int* index) const;
 
-  // Shrink the global dictioanry
+  // Shrink the global dictioanry. The full one is probed again after the
+  // restore delay, which is doubled up to a maximum each time the probe
+  // is rejected by the server.
   void ShrinkToBase();
 
+  // Restores the full global dictionary if it is shrunk and the restore
+  // delay has passed.
+  void MaybeRestore();
+
   int size() const { return top_index_; }
 
+  // Appends the words of a dictionary extension to the global words, see
+  // ReadDictionaryExtension(). Called before the dictionary is used.
+  void Extend(const std::vector<std::string>& words);
+
+  // Sets the delay to restore the full dictionary after the next shrink.
+  void set_restore_delay_ms(int64_t delay_ms) { restore_delay_ms_ = delay_ms; }
+
  private:
-  std::unordered_map<std::string, int> global_dict_;
+  // The size of the full global dictionary, with the extension words.
+  int full_size_;
   // the last index of the global dictionary.
   // If mis-matched with server, it will set to base
-  int top_index_;
+  std::atomic<int> top_index_;
+  // The steady clock time to restore the full dictionary, or the time it
+  // was restored, in nanoseconds.
+  std::atomic<int64_t> restore_time_ns_;
+  // The delay to restore the full dictionary after the next shrink.
+  std::atomic<int64_t> restore_delay_ms_;
+  // The index of the extension words, after the global words.
+  std::unordered_map<std::string, int> extension_;
 };
 
 // A attribute batch compressor for report.
@@ -56,6 +80,9 @@ class BatchCompressor {
   // Get the batched size.
   virtual int size() const = 0;
 
+  // Get the approximate encoded bytes of the batch.
+  virtual int64_t byte_size() const = 0;
+
   // Finish the batch and create the batched report request.
   virtual std::unique_ptr<::istio::mixer::v1::ReportRequest> Finish() = 0;
 };
@@ -74,8 +101,25 @@ class AttributeCompressor {
   // Shrink global dictionary to the first version.
   void ShrinkGlobalDictionary() { global_dict_.ShrinkToBase(); }
 
+  // Extends the global dictionary, see GlobalDictionary::Extend().
+  void ExtendGlobalDictionary(const std::vector<std::string>& words) {
+    global_dict_.Extend(words);
+  }
+
+  // Probe the full global dictionary again if it is time to. Called before
+  // compressing a request.
+  void MaybeRestoreGlobalDictionary() { global_dict_.MaybeRestore(); }
+
+  // If positive, the string and bytes values added to the batch
+  // compressors are cut to this many bytes, followed by "...". The values
+  // of Compress() are not, policies are checked against the full values.
+  void set_max_report_value_bytes(int max_bytes) {
+    max_report_value_bytes_ = max_bytes;
+  }
+
  private:
   GlobalDictionary global_dict_;
+  int max_report_value_bytes_ = 0;
 };
 
 }  // namespace mixerclient
@@ -14,9 +14,11 @@
  */
 
 #include "src/istio/mixerclient/attribute_compressor.h"
+#include "src/istio/mixerclient/global_dictionary.h"
 #include "include/istio/utils/attributes_builder.h"
 
 #include <time.h>
+#include <set>
 #include "google/protobuf/text_format.h"
 #include "google/protobuf/util/message_differencer.h"
 #include "gtest/gtest.h"
@@ -266,6 +268,157 @@ TEST_F(AttributeCompressorTest, BatchCompressTest) {
   EXPECT_TRUE(MessageDifferencer::Equals(*report_pb, expected_report_pb));
 }
 
+TEST_F(AttributeCompressorTest, BatchByteSizeTest) {
+  AttributeCompressor compressor;
+  auto batch_compressor = compressor.CreateBatchCompressor();
+  EXPECT_EQ(batch_compressor->byte_size(), 0);
+
+  EXPECT_TRUE(batch_compressor->Add(attributes_));
+  int64_t one_size = batch_compressor->byte_size();
+  EXPECT_GT(one_size, 0);
+
+  // A delta update only adds the changed attributes.
+  utils::AttributesBuilder(&attributes_).AddInt64("source.port", 135);
+  EXPECT_TRUE(batch_compressor->Add(attributes_));
+  EXPECT_GT(batch_compressor->byte_size(), one_size);
+  EXPECT_LT(batch_compressor->byte_size(), 2 * one_size);
+
+  // The encoded size only misses the field overheads.
+  int64_t byte_size = batch_compressor->byte_size();
+  auto report_pb = batch_compressor->Finish();
+  EXPECT_LE(byte_size, report_pb->ByteSize());
+  EXPECT_GT(byte_size, report_pb->ByteSize() - 32);
+}
+
+TEST_F(AttributeCompressorTest, ManyMessageWordsTest) {
+  // More per message words than are searched linearly, each used twice.
+  Attributes attributes;
+  std::map<std::string, std::string> string_map;
+  for (int i = 0; i < 40; ++i) {
+    string_map["key-" + std::to_string(i)] = "value-" + std::to_string(i % 20);
+  }
+  utils::AttributesBuilder(&attributes)
+      .AddStringMap("request.headers", std::move(string_map));
+
+  AttributeCompressor compressor;
+  ::istio::mixer::v1::CompressedAttributes attributes_pb;
+  compressor.Compress(attributes, &attributes_pb);
+  EXPECT_EQ(attributes_pb.words_size(), 60);
+
+  // Decode the keys and values with the per message words.
+  auto word = [&attributes_pb](int index) {
+    return attributes_pb.words(-index - 1);
+  };
+  ASSERT_EQ(attributes_pb.string_maps_size(), 1);
+  const auto& entries = attributes_pb.string_maps().begin()->second.entries();
+  EXPECT_EQ(entries.size(), 40);
+  for (const auto& it : entries) {
+    const std::string key = word(it.first);
+    int i = std::stoi(key.substr(4));
+    EXPECT_EQ(word(it.second), "value-" + std::to_string(i % 20));
+  }
+}
+
+TEST_F(AttributeCompressorTest, MaxReportValueBytesTest) {
+  Attributes attributes;
+  // The multi-byte character at bytes 7 and 8 is not split.
+  utils::AttributesBuilder builder(&attributes);
+  builder.AddString("request.useragent", "abcdef\xc3\xa9gh");
+  builder.AddBytes("source.ip", "1234567890");
+  builder.AddString("request.path", "/short");
+  std::map<std::string, std::string> string_map = {{"x-long", "0123456789"}};
+  builder.AddStringMap("request.headers", std::move(string_map));
+
+  AttributeCompressor compressor;
+  compressor.set_max_report_value_bytes(7);
+  auto batch_compressor = compressor.CreateBatchCompressor();
+  EXPECT_TRUE(batch_compressor->Add(attributes));
+  auto report_pb = batch_compressor->Finish();
+  ASSERT_EQ(report_pb->attributes_size(), 1);
+  const auto& pb = report_pb->attributes(0);
+  auto word = [&report_pb](int index) {
+    return report_pb->default_words(-index - 1);
+  };
+  ASSERT_EQ(pb.strings_size(), 2);
+  std::set<std::string> strings;
+  for (const auto& it : pb.strings()) {
+    strings.insert(word(it.second));
+  }
+  EXPECT_EQ(strings, std::set<std::string>({"abcdef...", "/short"}));
+  ASSERT_EQ(pb.bytes_size(), 1);
+  EXPECT_EQ(pb.bytes().begin()->second, "1234567...");
+  const auto& entries = pb.string_maps().begin()->second.entries();
+  EXPECT_EQ(word(entries.begin()->second), "0123456...");
+
+  // The checked attributes are kept in full.
+  CompressedAttributes check_pb;
+  compressor.Compress(attributes, &check_pb);
+  EXPECT_EQ(check_pb.bytes().begin()->second, "1234567890");
+}
+
+TEST(GlobalDictionaryTest, LookupTest) {
+  // Every global word is found at its index, the last one if duplicated.
+  const std::vector<std::string>& words = GetGlobalWords();
+  for (size_t i = 0; i < words.size(); ++i) {
+    int index = LookupGlobalWord(words[i].data(), words[i].size());
+    ASSERT_GE(index, 0) << words[i];
+    EXPECT_EQ(words[index], words[i]);
+  }
+
+  EXPECT_EQ(LookupGlobalWord("", 0), -1);
+  std::string word = "not-a-global-word";
+  EXPECT_EQ(LookupGlobalWord(word.data(), word.size()), -1);
+  // A prefix of a global word.
+  EXPECT_EQ(LookupGlobalWord(words[0].data(), words[0].size() - 1), -1);
+}
+
+TEST(GlobalDictionaryTest, ShrinkAndRestoreTest) {
+  GlobalDictionary dict;
+  const int full_size = GetGlobalWords().size();
+  ASSERT_EQ(dict.size(), full_size);
+
+  // Not restored before the delay.
+  dict.ShrinkToBase();
+  EXPECT_EQ(dict.size(), 111);
+  dict.MaybeRestore();
+  EXPECT_EQ(dict.size(), 111);
+
+  GlobalDictionary probed;
+  probed.set_restore_delay_ms(0);
+  probed.ShrinkToBase();
+  EXPECT_EQ(probed.size(), 111);
+  int index;
+  EXPECT_FALSE(probed.GetIndex(GetGlobalWords().back(), &index));
+  probed.MaybeRestore();
+  EXPECT_EQ(probed.size(), full_size);
+  EXPECT_TRUE(probed.GetIndex(GetGlobalWords().back(), &index));
+}
+
+TEST(GlobalDictionaryTest, ExtendTest) {
+  GlobalDictionary dict;
+  const int full_size = GetGlobalWords().size();
+  dict.set_restore_delay_ms(0);
+  dict.Extend({"reviews.default.svc", GetGlobalWords()[0], "x-user"});
+  ASSERT_EQ(dict.size(), full_size + 3);
+
+  int index;
+  ASSERT_TRUE(dict.GetIndex("reviews.default.svc", &index));
+  EXPECT_EQ(index, full_size);
+  ASSERT_TRUE(dict.GetIndex("x-user", &index));
+  EXPECT_EQ(index, full_size + 2);
+  // A global word keeps its global index.
+  ASSERT_TRUE(dict.GetIndex(GetGlobalWords()[0], &index));
+  EXPECT_EQ(index, 0);
+
+  // Rejected by a Mixer without the extension.
+  dict.ShrinkToBase();
+  EXPECT_EQ(dict.size(), 111);
+  EXPECT_FALSE(dict.GetIndex("x-user", &index));
+  dict.MaybeRestore();
+  EXPECT_EQ(dict.size(), full_size + 3);
+  EXPECT_TRUE(dict.GetIndex("x-user", &index));
+}
+
 }  // namespace
 }  // namespace mixerclient
 }  // namespace istio
@@ -0,0 +1,152 @@
+/* Copyright 2018 Istio Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "include/istio/mixerclient/cache_budget.h"
+
+#include <algorithm>
+#include <map>
+#include <tuple>
+
+namespace istio {
+namespace mixerclient {
+namespace {
+
+// The weight of the last demand in the smoothed demand of a client.
+const double kDemandSmoothing = 0.5;
+
+}  // namespace
+
+CacheBudget::CacheBudget(int64_t check_capacity, int64_t quota_capacity,
+                         int sync_interval_ms)
+    : check_capacity_(check_capacity),
+      quota_capacity_(quota_capacity),
+      sync_interval_ms_(std::max(1, sync_interval_ms)) {}
+
+std::shared_ptr<CacheBudget> CacheBudget::GetShared(int64_t check_capacity,
+                                                   int64_t quota_capacity,
+                                                   int sync_interval_ms) {
+  // Never destroyed, the budgets may be released at exit.
+  static std::mutex* mutex = new std::mutex;
+  static auto* budgets = new std::map<std::tuple<int64_t, int64_t, int>,
+                                      std::weak_ptr<CacheBudget>>;
+  std::lock_guard<std::mutex> lock(*mutex);
+  for (auto it = budgets->begin(); it != budgets->end();) {
+    if (it->second.expired()) {
+      it = budgets->erase(it);
+    } else {
+      ++it;
+    }
+  }
+  auto key = std::make_tuple(check_capacity, quota_capacity, sync_interval_ms);
+  std::shared_ptr<CacheBudget> budget = (*budgets)[key].lock();
+  if (!budget) {
+    budget = std::make_shared<CacheBudget>(check_capacity, quota_capacity,
+                                           sync_interval_ms);
+    (*budgets)[key] = budget;
+  }
+  return budget;
+}
+
+std::shared_ptr<CacheBudget::Share> CacheBudget::Join() {
+  std::shared_ptr<Share> share = std::make_shared<Share>();
+  std::lock_guard<std::mutex> lock(mutex_);
+  members_.push_back(Member{share, 0, 0, 0, 0});
+  // The members already in keep their weights, so the total never goes
+  // over the budget.
+  SplitAllWithLock();
+  return share;
+}
+
+void CacheBudget::Rebalance() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (auto& member : members_) {
+    std::shared_ptr<Share> share = member.share.lock();
+    if (!share) {
+      continue;
+    }
+    uint64_t check_demand = share->check_demand;
+    uint64_t quota_demand = share->quota_demand;
+    member.check_weight =
+        (1 - kDemandSmoothing) * member.check_weight +
+        kDemandSmoothing * (check_demand - member.last_check_demand);
+    member.quota_weight =
+        (1 - kDemandSmoothing) * member.quota_weight +
+        kDemandSmoothing * (quota_demand - member.last_quota_demand);
+    member.last_check_demand = check_demand;
+    member.last_quota_demand = quota_demand;
+  }
+  SplitAllWithLock();
+}
+
+bool CacheBudget::RebalanceIfDue(int64_t now_ms) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (rebalanced_ && now_ms - last_rebalance_ms_ < sync_interval_ms_ / 2) {
+      return false;
+    }
+    rebalanced_ = true;
+    last_rebalance_ms_ = now_ms;
+  }
+  Rebalance();
+  return true;
+}
+
+void CacheBudget::SplitAllWithLock() {
+  std::vector<std::shared_ptr<Share>> shares;
+  std::vector<Member> members;
+  for (const auto& member : members_) {
+    std::shared_ptr<Share> share = member.share.lock();
+    if (share) {
+      shares.push_back(share);
+      members.push_back(member);
+    }
+  }
+  members_.swap(members);
+  if (members_.empty()) {
+    return;
+  }
+  if (check_capacity_ > 0) {
+    SplitWithLock(check_capacity_, &Member::check_weight,
+                  &Share::check_capacity, shares);
+  }
+  if (quota_capacity_ > 0) {
+    SplitWithLock(quota_capacity_, &Member::quota_weight,
+                  &Share::quota_capacity, shares);
+  }
+}
+
+void CacheBudget::SplitWithLock(
+    int64_t budget, double Member::*weight,
+    std::atomic<int64_t> Share::*capacity,
+    const std::vector<std::shared_ptr<Share>>& shares) {
+  const int64_t num_members = members_.size();
+  // Half of the budget is split evenly, so an idle client keeps a warm
+  // cache and can take a burst.
+  int64_t floor = budget / (2 * num_members);
+  int64_t rest = budget - floor * num_members;
+  double total_weight = 0;
+  for (const auto& member : members_) {
+    total_weight += member.*weight;
+  }
+  for (int64_t i = 0; i < num_members; ++i) {
+    double part = total_weight > 0 ? members_[i].*weight / total_weight
+                                   : 1.0 / num_members;
+    int64_t value = floor + static_cast<int64_t>(rest * part);
+    (*shares[i]).*capacity = std::max<int64_t>(1, value);
+  }
+}
+
+}  // namespace mixerclient
+}  // namespace istio
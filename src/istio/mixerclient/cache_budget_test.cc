@@ -0,0 +1,127 @@
+/* Copyright 2018 Istio Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "include/istio/mixerclient/cache_budget.h"
+#include "gtest/gtest.h"
+
+namespace istio {
+namespace mixerclient {
+namespace {
+
+TEST(CacheBudgetTest, TestEvenSplit) {
+  CacheBudget budget(1000, 100);
+  auto first = budget.Join();
+  EXPECT_EQ(first->check_capacity, 1000);
+  EXPECT_EQ(first->quota_capacity, 100);
+  auto second = budget.Join();
+  EXPECT_EQ(first->check_capacity, 500);
+  EXPECT_EQ(first->quota_capacity, 50);
+  EXPECT_EQ(second->check_capacity, 500);
+  EXPECT_EQ(second->quota_capacity, 50);
+
+  // Without any demand, the budget is split evenly.
+  budget.Rebalance();
+  EXPECT_EQ(first->check_capacity, 500);
+  EXPECT_EQ(second->check_capacity, 500);
+  EXPECT_EQ(first->quota_capacity, 50);
+  EXPECT_EQ(second->quota_capacity, 50);
+}
+
+TEST(CacheBudgetTest, TestSplitByDemand) {
+  CacheBudget budget(1000, 0);
+  auto busy = budget.Join();
+  auto idle = budget.Join();
+
+  busy->check_demand = 300;
+  idle->check_demand = 100;
+  budget.Rebalance();
+  // Half of the budget is split evenly, the other half by demand.
+  EXPECT_EQ(busy->check_capacity, 250 + 375);
+  EXPECT_EQ(idle->check_capacity, 250 + 125);
+
+  // The demand is smoothed over the calls, the weights decay to 75 and
+  // 25 without new demand.
+  budget.Rebalance();
+  EXPECT_EQ(busy->check_capacity, 250 + 375);
+  EXPECT_EQ(idle->check_capacity, 250 + 125);
+
+  // The weights become 0.5 * 75 + 0.5 * 100 = 87.5 and 0.5 * 25 = 12.5.
+  busy->check_demand = 400;
+  budget.Rebalance();
+  EXPECT_EQ(busy->check_capacity, 250 + 437);
+  EXPECT_EQ(idle->check_capacity, 250 + 62);
+}
+
+TEST(CacheBudgetTest, TestLeave) {
+  CacheBudget budget(1000, 0);
+  auto first = budget.Join();
+  auto second = budget.Join();
+  second.reset();
+
+  budget.Rebalance();
+  EXPECT_EQ(first->check_capacity, 1000);
+  auto third = budget.Join();
+  EXPECT_EQ(first->check_capacity, 500);
+  EXPECT_EQ(third->check_capacity, 500);
+}
+
+TEST(CacheBudgetTest, TestJoinWithinBudget) {
+  CacheBudget budget(1000, 0);
+  auto busy = budget.Join();
+  auto idle = budget.Join();
+  busy->check_demand = 300;
+  budget.Rebalance();
+  EXPECT_EQ(busy->check_capacity, 250 + 500);
+  EXPECT_EQ(idle->check_capacity, 250);
+
+  // A new client takes its floor from the others, without any demand.
+  auto third = budget.Join();
+  EXPECT_EQ(busy->check_capacity, 166 + 502);
+  EXPECT_EQ(idle->check_capacity, 166);
+  EXPECT_EQ(third->check_capacity, 166);
+  EXPECT_LE(busy->check_capacity + idle->check_capacity +
+                third->check_capacity,
+            1000);
+}
+
+TEST(CacheBudgetTest, TestRebalanceIfDue) {
+  CacheBudget budget(1000, 0, 100);
+  auto busy = budget.Join();
+  auto idle = budget.Join();
+  EXPECT_TRUE(budget.RebalanceIfDue(1000));
+
+  // Another owner calling it at about the same time doesn't rebalance.
+  busy->check_demand = 300;
+  EXPECT_FALSE(budget.RebalanceIfDue(1020));
+  EXPECT_EQ(busy->check_capacity, 500);
+  EXPECT_TRUE(budget.RebalanceIfDue(1100));
+  EXPECT_EQ(busy->check_capacity, 250 + 500);
+}
+
+TEST(CacheBudgetTest, TestGetShared) {
+  auto budget = CacheBudget::GetShared(1000, 100, 10);
+  EXPECT_EQ(CacheBudget::GetShared(1000, 100, 10), budget);
+  EXPECT_NE(CacheBudget::GetShared(2000, 100, 10), budget);
+
+  // A new budget, without the old members, once it is released.
+  auto share = budget->Join();
+  budget.reset();
+  budget = CacheBudget::GetShared(1000, 100, 10);
+  EXPECT_EQ(budget->Join()->check_capacity, 1000);
+}
+
+}  // namespace
+}  // namespace mixerclient
+}  // namespace istio
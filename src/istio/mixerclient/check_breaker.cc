@@ -0,0 +1,135 @@
+/* Copyright 2018 Istio Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/istio/mixerclient/check_breaker.h"
+#include "include/istio/utils/protobuf.h"
+
+#include <algorithm>
+
+using ::google::protobuf::util::Status;
+using ::google::protobuf::util::error::Code;
+
+namespace istio {
+namespace mixerclient {
+namespace {
+
+// Returns true if a transport status means Mixer could not be reached. An
+// invalid dictionary is answered by Mixer.
+bool IsFailure(const Status& status) {
+  return !status.ok() && !utils::InvalidDictionaryStatus(status);
+}
+
+}  // namespace
+
+CheckBreaker::CheckBreaker(const CheckOptions& options,
+                           ThreadingModel threading_model)
+    : consecutive_failures_limit_(options.breaker_consecutive_failures),
+      error_percent_(options.breaker_error_percent),
+      window_calls_(std::max(1, options.breaker_window_calls)),
+      cooldown_(std::max(1, options.breaker_cooldown_ms)),
+      state_(CLOSED),
+      consecutive_failures_(0),
+      window_total_(0),
+      window_failures_(0),
+      probe_inflight_(false) {
+  mutex_.set_enabled(threading_model == ThreadingModel::SHARED);
+}
+
+bool CheckBreaker::Enabled(const CheckOptions& options) {
+  return options.breaker_consecutive_failures > 0 ||
+         (options.breaker_error_percent > 0 &&
+          options.breaker_error_percent <= 100);
+}
+
+bool CheckBreaker::Allow(Tick t, bool* probe) {
+  *probe = false;
+  std::lock_guard<utils::OptionalMutex<std::mutex>> lock(mutex_);
+  if (state_ == CLOSED) {
+    return true;
+  }
+  if (state_ == OPEN) {
+    if (t < open_until_) {
+      return false;
+    }
+    state_ = HALF_OPEN;
+  }
+  if (probe_inflight_ && t < probe_deadline_) {
+    return false;
+  }
+  probe_inflight_ = true;
+  probe_deadline_ = t + cooldown_;
+  *probe = true;
+  return true;
+}
+
+void CheckBreaker::Record(const Status& status, bool probe, Tick t) {
+  // A cancelled call says nothing of Mixer.
+  bool cancelled = status.error_code() == Code::CANCELLED;
+  bool failure = IsFailure(status);
+  std::lock_guard<utils::OptionalMutex<std::mutex>> lock(mutex_);
+  if (probe) {
+    probe_inflight_ = false;
+    if (state_ != HALF_OPEN || cancelled) {
+      return;
+    }
+    if (failure) {
+      OpenWithLock(t);
+    } else {
+      state_ = CLOSED;
+    }
+    return;
+  }
+  // The calls made before the breaker opened don't change it.
+  if (state_ != CLOSED || cancelled) {
+    return;
+  }
+  consecutive_failures_ = failure ? consecutive_failures_ + 1 : 0;
+  if (consecutive_failures_limit_ > 0 &&
+      consecutive_failures_ >= consecutive_failures_limit_) {
+    OpenWithLock(t);
+    return;
+  }
+  if (error_percent_ <= 0) {
+    return;
+  }
+  ++window_total_;
+  if (failure) {
+    ++window_failures_;
+  }
+  if (window_total_ >= window_calls_) {
+    bool open = window_failures_ * 100 >= error_percent_ * window_total_;
+    window_total_ = 0;
+    window_failures_ = 0;
+    if (open) {
+      OpenWithLock(t);
+    }
+  }
+}
+
+bool CheckBreaker::tripped() const {
+  std::lock_guard<utils::OptionalMutex<std::mutex>> lock(mutex_);
+  return state_ != CLOSED;
+}
+
+void CheckBreaker::OpenWithLock(Tick t) {
+  state_ = OPEN;
+  open_until_ = t + cooldown_;
+  consecutive_failures_ = 0;
+  window_total_ = 0;
+  window_failures_ = 0;
+}
+
+}  // namespace mixerclient
+}  // namespace istio
@@ -0,0 +1,88 @@
+/* Copyright 2018 Istio Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ISTIO_MIXERCLIENT_CHECK_BREAKER_H
+#define ISTIO_MIXERCLIENT_CHECK_BREAKER_H
+
+#include "include/istio/mixerclient/client.h"
+#include "include/istio/utils/optional_mutex.h"
+
+#include <chrono>
+#include <mutex>
+
+namespace istio {
+namespace mixerclient {
+
+// A circuit breaker of the remote check calls. It opens after
+// breaker_consecutive_failures transport failures in a row, or once
+// breaker_error_percent of a window of breaker_window_calls calls failed.
+// While open, no remote check call is made for breaker_cooldown_ms, the
+// checks are answered as for a network failure. It is then half open: one
+// probe call at a time is made, and the breaker closes once one succeeds.
+class CheckBreaker {
+ public:
+  using Tick = std::chrono::steady_clock::time_point;
+
+  CheckBreaker(const CheckOptions& options,
+               ThreadingModel threading_model = ThreadingModel::SHARED);
+
+  // Returns true if the breaker is enabled by the options.
+  static bool Enabled(const CheckOptions& options);
+
+  // Returns false if no remote check call should be made at t. If the
+  // call is the probe of a half open breaker, *probe is set.
+  bool Allow(Tick t, bool* probe);
+
+  // Records the transport status of an allowed call.
+  void Record(const ::google::protobuf::util::Status& status, bool probe,
+              Tick t);
+
+  // Returns true if remote check calls are stopped, open or half open.
+  bool tripped() const;
+
+ private:
+  enum State { CLOSED, OPEN, HALF_OPEN };
+
+  // Opens the breaker at t. Called with mutex_.
+  void OpenWithLock(Tick t);
+
+  // The options.
+  const int consecutive_failures_limit_;
+  const int error_percent_;
+  const int window_calls_;
+  const std::chrono::milliseconds cooldown_;
+
+  // Mutex guarding the members below, disabled if THREAD_CONFINED.
+  mutable utils::OptionalMutex<std::mutex> mutex_;
+  State state_;
+  // The failures in a row while closed.
+  int consecutive_failures_;
+  // The calls and the failures of the current error rate window.
+  int window_total_;
+  int window_failures_;
+  // When an open breaker becomes half open.
+  Tick open_until_;
+  // True while a probe is in flight, a probe not done by its deadline is
+  // given up, e.g. if it was cancelled.
+  bool probe_inflight_;
+  Tick probe_deadline_;
+
+  GOOGLE_DISALLOW_EVIL_CONSTRUCTORS(CheckBreaker);
+};
+
+}  // namespace mixerclient
+}  // namespace istio
+
+#endif  // ISTIO_MIXERCLIENT_CHECK_BREAKER_H
@@ -0,0 +1,166 @@
+/* Copyright 2018 Istio Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/istio/mixerclient/check_breaker.h"
+#include "gtest/gtest.h"
+
+using ::google::protobuf::util::Status;
+using ::google::protobuf::util::error::Code;
+using std::chrono::milliseconds;
+
+namespace istio {
+namespace mixerclient {
+namespace {
+
+const Status kFailure(Code::UNAVAILABLE, "unavailable");
+
+class CheckBreakerTest : public ::testing::Test {
+ public:
+  CheckBreakerTest() : now_(CheckBreaker::Tick()) {}
+
+  // Makes a call at now_ and records its status, returns false if shed.
+  bool Call(const Status& status) {
+    bool probe;
+    if (!breaker_->Allow(now_, &probe)) {
+      return false;
+    }
+    breaker_->Record(status, probe, now_);
+    return true;
+  }
+
+  std::unique_ptr<CheckBreaker> breaker_;
+  CheckBreaker::Tick now_;
+};
+
+TEST_F(CheckBreakerTest, TestEnabled) {
+  CheckOptions options;
+  EXPECT_FALSE(CheckBreaker::Enabled(options));
+  options.breaker_error_percent = 50;
+  EXPECT_TRUE(CheckBreaker::Enabled(options));
+  options.breaker_error_percent = 0;
+  options.breaker_consecutive_failures = 3;
+  EXPECT_TRUE(CheckBreaker::Enabled(options));
+}
+
+TEST_F(CheckBreakerTest, TestConsecutiveFailures) {
+  CheckOptions options;
+  options.breaker_consecutive_failures = 3;
+  options.breaker_cooldown_ms = 100;
+  breaker_.reset(new CheckBreaker(options));
+
+  EXPECT_TRUE(Call(kFailure));
+  EXPECT_TRUE(Call(kFailure));
+  // A success resets the count.
+  EXPECT_TRUE(Call(Status::OK));
+  EXPECT_TRUE(Call(kFailure));
+  EXPECT_TRUE(Call(kFailure));
+  // Cancelled calls are neither failures nor successes.
+  EXPECT_TRUE(Call(Status::CANCELLED));
+  EXPECT_FALSE(breaker_->tripped());
+  EXPECT_TRUE(Call(kFailure));
+  EXPECT_TRUE(breaker_->tripped());
+  EXPECT_FALSE(Call(Status::OK));
+
+  now_ += milliseconds(99);
+  EXPECT_FALSE(Call(Status::OK));
+}
+
+TEST_F(CheckBreakerTest, TestErrorPercent) {
+  CheckOptions options;
+  options.breaker_error_percent = 50;
+  options.breaker_window_calls = 4;
+  breaker_.reset(new CheckBreaker(options));
+
+  // 1 of 4 failed.
+  EXPECT_TRUE(Call(kFailure));
+  EXPECT_TRUE(Call(Status::OK));
+  EXPECT_TRUE(Call(Status::OK));
+  EXPECT_TRUE(Call(Status::OK));
+  EXPECT_FALSE(breaker_->tripped());
+
+  // 2 of 4 failed.
+  EXPECT_TRUE(Call(kFailure));
+  EXPECT_TRUE(Call(Status::OK));
+  EXPECT_TRUE(Call(kFailure));
+  EXPECT_FALSE(breaker_->tripped());
+  EXPECT_TRUE(Call(Status::OK));
+  EXPECT_TRUE(breaker_->tripped());
+}
+
+TEST_F(CheckBreakerTest, TestHalfOpenProbe) {
+  CheckOptions options;
+  options.breaker_consecutive_failures = 1;
+  options.breaker_cooldown_ms = 100;
+  breaker_.reset(new CheckBreaker(options));
+
+  EXPECT_TRUE(Call(kFailure));
+  now_ += milliseconds(100);
+
+  // One probe at a time.
+  bool probe;
+  EXPECT_TRUE(breaker_->Allow(now_, &probe));
+  EXPECT_TRUE(probe);
+  bool other_probe;
+  EXPECT_FALSE(breaker_->Allow(now_, &other_probe));
+
+  // A call made before the breaker opened doesn't close it.
+  breaker_->Record(Status::OK, false, now_);
+  EXPECT_TRUE(breaker_->tripped());
+
+  breaker_->Record(Status::OK, probe, now_);
+  EXPECT_FALSE(breaker_->tripped());
+  EXPECT_TRUE(Call(Status::OK));
+}
+
+TEST_F(CheckBreakerTest, TestProbeFailureReopens) {
+  CheckOptions options;
+  options.breaker_consecutive_failures = 1;
+  options.breaker_cooldown_ms = 100;
+  breaker_.reset(new CheckBreaker(options));
+
+  EXPECT_TRUE(Call(kFailure));
+  now_ += milliseconds(100);
+  EXPECT_TRUE(Call(kFailure));
+  EXPECT_TRUE(breaker_->tripped());
+  EXPECT_FALSE(Call(Status::OK));
+
+  now_ += milliseconds(100);
+  EXPECT_TRUE(Call(Status::OK));
+  EXPECT_FALSE(breaker_->tripped());
+}
+
+TEST_F(CheckBreakerTest, TestProbeGivenUp) {
+  CheckOptions options;
+  options.breaker_consecutive_failures = 1;
+  options.breaker_cooldown_ms = 100;
+  breaker_.reset(new CheckBreaker(options));
+
+  EXPECT_TRUE(Call(kFailure));
+  now_ += milliseconds(100);
+  bool probe;
+  EXPECT_TRUE(breaker_->Allow(now_, &probe));
+  EXPECT_TRUE(probe);
+
+  // The probe never completes, another one is allowed after the cooldown.
+  now_ += milliseconds(99);
+  EXPECT_FALSE(breaker_->Allow(now_, &probe));
+  now_ += milliseconds(1);
+  EXPECT_TRUE(breaker_->Allow(now_, &probe));
+  EXPECT_TRUE(probe);
+}
+
+}  // namespace
+}  // namespace mixerclient
+}  // namespace istio
@@ -15,6 +15,14 @@
 
 #include "src/istio/mixerclient/check_cache.h"
 #include "include/istio/utils/protobuf.h"
+#include "include/istio/utils/tracepoint.h"
+
+#include <stdio.h>
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <limits>
+#include <sstream>
 
 using namespace std::chrono;
 using ::google::protobuf::util::Status;
@@ -24,65 +32,326 @@ using ::istio::mixer::v1::CheckResponse;
 
 namespace istio {
 namespace mixerclient {
+namespace {
+
+// The minimum interval between two refreshes of the same cache item,
+// in case a refresh call fails.
+const int kRefreshRetryIntervalMs = 1000;
+
+// The magic number and the version of the check cache snapshot format.
+// The version should be bumped whenever the format is changed.
+const uint32_t kSnapshotMagic = 0x43434d49;  // "IMCC"
+const uint32_t kSnapshotVersion = 3;
+
+// The item times with special meanings, the other times are clamped
+// between them.
+const int32_t kNeverTime = std::numeric_limits<int32_t>::max();
+const int32_t kExpiredTime = std::numeric_limits<int32_t>::min();
+
+// The epoch of a shard is moved when the times are getting this far from
+// it, so the times of the items in use stay in range.
+const int64_t kRebaseMs = int64_t(1) << 30;
+
+// The maximum number of distinct statuses interned by a cache.
+const size_t kMaxInternedStatuses = 1024;
+
+// The statuses returned for a miss, and for a lookup needing the deferred
+// attributes.
+const Status &NotFoundStatus() {
+  static const Status *status = new Status(Code::NOT_FOUND, "");
+  return *status;
+}
+const Status &DeferredStatus() {
+  static const Status *status = new Status(Code::FAILED_PRECONDITION, "");
+  return *status;
+}
+
+// Converts a time to milliseconds since the clock epoch, rounded down or
+// up.
+int64_t ToEpochMs(system_clock::time_point time, bool round_up = false) {
+  milliseconds ms = duration_cast<milliseconds>(time.time_since_epoch());
+  if (ms > time.time_since_epoch()) {
+    ms -= milliseconds(1);
+  }
+  if (round_up && ms < time.time_since_epoch()) {
+    ms += milliseconds(1);
+  }
+  return ms.count();
+}
+
+// Adds milliseconds to an item time, clamped to the finite times.
+int32_t AddMs(int64_t time, int64_t ms) {
+  return static_cast<int32_t>(
+      std::max<int64_t>(kExpiredTime + 1,
+                        std::min<int64_t>(kNeverTime - 1, time + ms)));
+}
+
+}  // namespace
 
-void CheckCache::CacheElem::CacheElem::SetResponse(
-    const CheckResponse &response, Tick time_now) {
+CheckCache::ShardTime CheckCache::ToShardTime(const Shard &shard, Tick time,
+                                              bool round_up) {
+  return AddMs(ToEpochMs(time, round_up), -shard.epoch_ms);
+}
+
+CheckCache::CacheElem::CacheElem(const CacheElem &other)
+    : status_(other.status_),
+      has_precondition_(other.has_precondition_),
+      use_count_(other.use_count_.load()),
+      refresh_use_count_(other.refresh_use_count_),
+      expire_time_(other.expire_time_),
+      refresh_time_(other.refresh_time_),
+      next_refresh_(other.next_refresh_.load()),
+      last_access_(other.last_access_.load()),
+      partition_(other.partition_) {
+  if (other.owned_status_) {
+    owned_status_.reset(new Status(*other.owned_status_));
+    status_ = owned_status_.get();
+  }
+}
+
+void CheckCache::CacheElem::SetStatus(CheckCache &parent,
+                                      const Status &status) {
+  status_ = parent.InternStatus(status);
+  if (status_) {
+    owned_status_.reset();
+  } else {
+    owned_status_.reset(new Status(status));
+    status_ = owned_status_.get();
+  }
+}
+
+void CheckCache::CacheElem::SetResponse(CheckCache &parent,
+                                        const CheckResponse &response,
+                                        ShardTime shard_now, Tick time_now) {
+  has_precondition_ = response.has_precondition();
   if (response.has_precondition()) {
-    status_ = parent_.ConvertRpcStatus(response.precondition().status());
+    SetStatus(parent,
+              parent.ConvertRpcStatus(response.precondition().status()));
 
     if (response.precondition().has_valid_duration()) {
-      expire_time_ = time_now + utils::ToMilliseonds(
-                                    response.precondition().valid_duration());
+      expire_time_ =
+          AddMs(shard_now,
+                utils::ToMilliseonds(response.precondition().valid_duration())
+                    .count());
     } else {
       // never expired.
-      expire_time_ = time_point<system_clock>::max();
+      expire_time_ = kNeverTime;
+    }
+    // Denied responses are only cached for a short time.
+    int negative_ttl_ms = parent.options_.negative_cache_ttl_ms;
+    if (negative_ttl_ms > 0 && !status_->ok()) {
+      expire_time_ = std::min(expire_time_, AddMs(shard_now, negative_ttl_ms));
     }
     use_count_ = response.precondition().valid_use_count();
+
+    refresh_time_ = kNeverTime;
+    refresh_use_count_ = -1;
+    double fraction = parent.options_.refresh_ahead_fraction;
+    if (fraction > 0 && fraction < 1) {
+      if (response.precondition().has_valid_duration()) {
+        refresh_time_ = AddMs(
+            shard_now, static_cast<int64_t>(
+                           (int64_t(expire_time_) - shard_now) * fraction));
+      }
+      if (use_count_ > 0) {
+        refresh_use_count_ = static_cast<int>(use_count_ * (1 - fraction));
+      }
+    }
   } else {
-    status_ = Status(Code::INVALID_ARGUMENT,
-                     "CheckResponse doesn't have PreconditionResult");
+    SetStatus(parent, Status(Code::INVALID_ARGUMENT,
+                             "CheckResponse doesn't have PreconditionResult"));
     use_count_ = 0;           // 0 for not used this cache.
-    expire_time_ = time_now;  // expired now.
+    expire_time_ = shard_now;  // expired now.
+    refresh_time_ = kNeverTime;
+    refresh_use_count_ = -1;
   }
+  last_access_ = time_now.time_since_epoch().count();
+  next_refresh_ = kExpiredTime;
+}
+
+bool CheckCache::CacheElem::NeedsRefresh(ShardTime time_now) {
+  if (time_now < refresh_time_ &&
+      (refresh_use_count_ < 0 || use_count_ > refresh_use_count_)) {
+    return false;
+  }
+  ShardTime next = next_refresh_.load();
+  if (time_now < next) {
+    return false;
+  }
+  // Only one of concurrent callers wins.
+  return next_refresh_.compare_exchange_strong(
+      next, AddMs(time_now, kRefreshRetryIntervalMs));
+}
+
+bool CheckCache::CacheElem::IsStaleUsable(const CheckCache &parent,
+                                          ShardTime time_now) const {
+  int stale_ms = parent.options_.stale_while_unavailable_ms;
+  if (stale_ms <= 0 || !parent.transport_unavailable_) {
+    return false;
+  }
+  // An item without precondition is never used.
+  if (!has_precondition_) {
+    return false;
+  }
+  if (time_now <= expire_time_) {
+    // Expired by use count.
+    return true;
+  }
+  return int64_t(time_now) - expire_time_ <= stale_ms;
+}
+
+bool CheckCache::CacheElem::IsDead(const CheckCache &parent,
+                                   ShardTime time_now) const {
+  if (!has_precondition_) {
+    return true;
+  }
+  int stale_ms = parent.options_.stale_while_unavailable_ms;
+  if (time_now <= expire_time_) {
+    // Expired by use count, usable as stale until expire_time_.
+    return use_count_ == 0 && stale_ms <= 0;
+  }
+  return int64_t(time_now) - expire_time_ > std::max(stale_ms, 0);
 }
 
 // check if the item is expired.
-bool CheckCache::CacheElem::CacheElem::IsExpired(Tick time_now) {
-  if (time_now > expire_time_ || use_count_ == 0) {
+bool CheckCache::CacheElem::IsExpired(ShardTime time_now,
+                                      Tick::rep access_time) {
+  if (time_now > expire_time_) {
     return true;
   }
-  if (use_count_ > 0) {
-    --use_count_;
+  last_access_.store(access_time, std::memory_order_relaxed);
+  int use_count = use_count_.load();
+  while (use_count != 0) {
+    if (use_count < 0) {
+      // never expired by use count.
+      return false;
+    }
+    if (use_count_.compare_exchange_weak(use_count, use_count - 1)) {
+      return false;
+    }
   }
-  return false;
+  return true;
 }
 
-CheckCache::CheckResult::CheckResult() : status_(Code::UNAVAILABLE, "") {}
+bool CheckCache::CacheElem::IsSnapshotUsable(ShardTime time_now) const {
+  return has_precondition_ && time_now <= expire_time_ && use_count_ != 0;
+}
+
+CheckCache::Tick::rep CheckCache::CacheElem::last_access(
+    ShardTime time_now) const {
+  if (time_now > expire_time_ || use_count_ == 0) {
+    return Tick::min().time_since_epoch().count();
+  }
+  return last_access_;
+}
+
+void CheckCache::CacheElem::Rebase(int64_t delta_ms) {
+  auto rebase = [delta_ms](ShardTime time) -> ShardTime {
+    if (time == kNeverTime || time == kExpiredTime) {
+      return time;
+    }
+    return AddMs(time, -delta_ms);
+  };
+  expire_time_ = rebase(expire_time_);
+  refresh_time_ = rebase(refresh_time_);
+  next_refresh_ = rebase(next_refresh_);
+}
+
+CheckCache::CheckResult::CheckResult()
+    : status_(nullptr),
+      owned_status_(Code::UNAVAILABLE, ""),
+      needs_refresh_(false),
+      has_miss_signature_(false),
+      miss_reason_(CheckMissReason::NONE) {}
 
 bool CheckCache::CheckResult::IsCacheHit() const {
-  return status_.error_code() != Code::UNAVAILABLE;
+  return status().error_code() != Code::UNAVAILABLE;
 }
 
-CheckCache::CheckCache(const CheckOptions &options) : options_(options) {
+CheckCache::CheckCache(const CheckOptions &options,
+                       ThreadingModel threading_model)
+    : options_(options),
+      transport_unavailable_(false),
+      referenced_bytes_(0),
+      max_shard_bytes_(0),
+      num_misses_(0),
+      num_evictions_(0),
+      index_epoch_(0),
+      has_retired_indexes_(false),
+      sweep_shard_(0),
+      next_snapshot_ms_(0) {
+  const bool thread_safe = threading_model == ThreadingModel::SHARED;
+  referenced_mutex_.set_enabled(thread_safe);
+  sweep_mutex_.set_enabled(thread_safe);
+  for (auto &stripe : index_reader_stripes_) {
+    stripe.readers[0] = 0;
+    stripe.readers[1] = 0;
+  }
+  statuses_mutex_.set_enabled(thread_safe);
+  PublishIndex(std::unique_ptr<ReferencedIndex>(new ReferencedIndex));
+
+  // A check cache should not hold a reference to another shared cache.
+  options_.shared_cache.reset();
   if (options.num_entries > 0) {
-    cache_.reset(new CheckLRUCache(options.num_entries));
+    int num_shards = std::max(1, std::min(options.num_shards,
+                                          options.num_entries));
+    for (int i = 0; i < num_shards; ++i) {
+      Shard *shard = new Shard;
+      shard->mutex.set_enabled(thread_safe);
+      shard->capacity = options.num_entries / num_shards;
+      shard->bytes = 0;
+      shard->sweep_bucket = 0;
+      shard->epoch_ms = 0;
+      shards_.emplace_back(shard);
+    }
+    if (options.max_bytes > 0) {
+      max_shard_bytes_ = std::max<int64_t>(1, options.max_bytes / num_shards);
+    }
+  }
+  if (!options_.node_cache_file.empty() && !shards_.empty()) {
+    node_cache_ =
+        NodeCheckCache::Open(options_.node_cache_file,
+                             options_.node_cache_entries,
+                             options_.node_cache_config_id);
+  }
+  if (!options_.snapshot_file.empty()) {
+    LoadSnapshotFile();
+    next_snapshot_ms_ = ToEpochMs(system_clock::now()) + snapshot_interval_ms();
   }
 }
 
 CheckCache::~CheckCache() {
+  if (!options_.snapshot_file.empty()) {
+    SaveSnapshotFile();
+  }
   // FlushAll() will remove all cache items.
   FlushAll();
 }
 
-void CheckCache::Check(const Attributes &attributes, CheckResult *result) {
-  Status status = Check(attributes, system_clock::now());
-  if (status.error_code() != Code::NOT_FOUND) {
-    result->status_ = status;
+void CheckCache::Check(const Attributes &attributes, CheckResult *result,
+                       AttributeFingerprints *fingerprints) {
+  Check(attributes, system_clock::now(), result, nullptr, fingerprints);
+  SetResponseFunc(result);
+}
+
+bool CheckCache::Check(const Attributes &attributes,
+                       const std::vector<std::string> &deferred_names,
+                       CheckResult *result,
+                       AttributeFingerprints *fingerprints) {
+  const Status &status = Check(attributes, system_clock::now(), result,
+                               &deferred_names, fingerprints);
+  if (status.error_code() == Code::FAILED_PRECONDITION) {
+    return false;
   }
+  SetResponseFunc(result);
+  return true;
+}
 
+void CheckCache::SetResponseFunc(CheckResult *result) {
   result->on_response_ = [this](const Status &status,
                                 const Attributes &attributes,
                                 const CheckResponse &response) -> Status {
+    transport_unavailable_ = !status.ok();
     if (!status.ok()) {
       if (options_.network_fail_open) {
         return Status::OK;
@@ -95,37 +364,219 @@ void CheckCache::Check(const Attributes &attributes, CheckResult *result) {
   };
 }
 
-Status CheckCache::Check(const Attributes &attributes, Tick time_now) {
-  if (!cache_) {
+CheckCache::Shard *CheckCache::GetShard(
+    const utils::FastHash::Key &signature) const {
+  if (shards_.size() == 1) {
+    return shards_[0].get();
+  }
+  // Use the high word of the signature to pick a shard.
+  return shards_[signature.high % shards_.size()].get();
+}
+
+void CheckCache::PublishIndex(std::unique_ptr<ReferencedIndex> index) {
+  index->names.clear();
+  for (const auto &shape : index->ordered) {
+    shape->referenced.GetNames(&index->names);
+  }
+  referenced_index_.store(index.get());
+  if (current_index_) {
+    replaced_indexes_.emplace_back(std::move(current_index_));
+  }
+  current_index_ = std::move(index);
+  ReclaimIndexesWithLock();
+}
+
+void CheckCache::ReclaimIndexes() const {
+  std::unique_lock<Mutex> lock(referenced_mutex_, std::try_to_lock);
+  if (lock.owns_lock()) {
+    ReclaimIndexesWithLock();
+  }
+}
+
+void CheckCache::ReclaimIndexesWithLock() const {
+  while (!retired_indexes_.empty() || !replaced_indexes_.empty()) {
+    if (retired_indexes_.empty()) {
+      // The readers entering the next epoch load a newer version than the
+      // retired ones.
+      retired_indexes_.swap(replaced_indexes_);
+      has_retired_indexes_.store(true);
+      index_epoch_.fetch_add(1);
+    }
+    // The retired versions are only used by the readers of the epoch
+    // before, which no reader enters any more.
+    const uint64_t parity = (index_epoch_.load() - 1) & 1;
+    for (const auto &stripe : index_reader_stripes_) {
+      if (stripe.readers[parity].load() != 0) {
+        return;
+      }
+    }
+    retired_indexes_.clear();
+    has_retired_indexes_.store(false);
+  }
+}
+
+CheckCache::IndexReader::IndexReader(const CheckCache &cache)
+    : cache_(cache) {
+  // Each thread counts its readers in its own stripe, so that the threads
+  // of a shared cache don't write the same cache line.
+  static std::atomic<size_t> next_stripe(0);
+  static thread_local size_t thread_stripe = next_stripe.fetch_add(1);
+  stripe_ = &cache_.index_reader_stripes_[thread_stripe % kIndexReaderStripes];
+  // Counted before the index is loaded, so that the version it loads is
+  // not freed while it is used. The epoch is checked again since the
+  // readers of an epoch may have been found gone already once it ended.
+  for (;;) {
+    epoch_ = cache_.index_epoch_.load();
+    stripe_->readers[epoch_ & 1].fetch_add(1);
+    if (cache_.index_epoch_.load() == epoch_) {
+      break;
+    }
+    stripe_->readers[epoch_ & 1].fetch_sub(1);
+  }
+  index_ = cache_.referenced_index_.load();
+}
+
+CheckCache::IndexReader::~IndexReader() {
+  stripe_->readers[epoch_ & 1].fetch_sub(1);
+  // The readers left from an ended epoch free the versions retired by it.
+  if (cache_.has_retired_indexes_.load() &&
+      cache_.index_epoch_.load() != epoch_) {
+    cache_.ReclaimIndexes();
+  }
+}
+
+void CheckCache::ReorderShapes() {
+  std::unique_lock<Mutex> lock(referenced_mutex_, std::try_to_lock);
+  if (!lock.owns_lock()) {
+    return;
+  }
+  std::unique_ptr<ReferencedIndex> index(
+      new ReferencedIndex(*GetReferencedIndex()));
+  std::stable_sort(
+      index->ordered.begin(), index->ordered.end(),
+      [](const ReferencedShapePtr &a, const ReferencedShapePtr &b) {
+        return a->hits > b->hits;
+      });
+  PublishIndex(std::move(index));
+}
+
+void CheckCache::GetShapeStats(std::vector<ReferencedShapeStats> *stats) const {
+  stats->clear();
+  IndexReader index(*this);
+  for (const auto &shape : index->ordered) {
+    ReferencedShapeStats stat;
+    stat.shape = shape->debug_string;
+    stat.hits = shape->hits;
+    stat.misses = shape->misses;
+    stats->push_back(stat);
+  }
+}
+
+const Status &CheckCache::Check(const Attributes &attributes, Tick time_now,
+                                CheckResult *result,
+                                const std::vector<std::string> *deferred_names,
+                                AttributeFingerprints *fingerprints) {
+  if (shards_.empty()) {
     // By returning NOT_FOUND, caller will send request to server.
-    return Status(Code::NOT_FOUND, "");
+    return NotFoundStatus();
+  }
+
+  // Shapes are probed from the most hit one. Signature() rules out a shape
+  // with missing "exact" or present "absence" attributes before hashing.
+  IndexReader index(*this);
+  // A missing deferred attribute could match an "absence" key by mistake.
+  if (deferred_names) {
+    for (const auto &name : *deferred_names) {
+      if (index->names.count(name) > 0) {
+        return DeferredStatus();
+      }
+    }
+  }
+  AttributeFingerprints local_fingerprints(attributes);
+  if (!fingerprints) {
+    fingerprints = &local_fingerprints;
   }
+  for (size_t i = 0; i < index->ordered.size(); ++i) {
+    ReferencedShape *shape = index->ordered[i].get();
+    utils::FastHash::Key signature;
+    if (!shape->referenced.Signature(fingerprints, "", &signature)) {
+      continue;
+    }
+
+    // The first matched signature identifies the request for a miss.
+    if (!result->has_miss_signature_) {
+      result->has_miss_signature_ = true;
+      result->miss_signature_ = signature;
+    }
 
-  for (const auto &it : referenced_map_) {
-    const Referenced &reference = it.second;
-    std::string signature;
-    if (!reference.Signature(attributes, "", &signature)) {
+    Shard *shard = GetShard(signature);
+    std::shared_lock<SharedMutex> lock(shard->mutex);
+    const auto it = shard->cache.find(signature);
+    if (it == shard->cache.end()) {
+      ++shape->misses;
+      lock.unlock();
+      if (CheckNodeCache(attributes, signature, time_now,
+                         &result->owned_status_)) {
+        result->status_ = nullptr;
+        return result->owned_status_;
+      }
       continue;
     }
 
-    std::lock_guard<std::mutex> lock(cache_mutex_);
-    CheckLRUCache::ScopedLookup lookup(cache_.get(), signature);
-    if (lookup.Found()) {
-      CacheElem *elem = lookup.value();
-      if (elem->IsExpired(time_now)) {
-        cache_->Remove(signature);
-        return Status(Code::NOT_FOUND, "");
+    CacheElem *elem = &it->second;
+    ShardTime shard_now = ToShardTime(*shard, time_now);
+    if (elem->IsExpired(shard_now, time_now.time_since_epoch().count()) &&
+        !elem->IsStaleUsable(*this, shard_now)) {
+      // The expired item will be replaced by the new response,
+      // or evicted first when the shard is full.
+      ++shape->misses;
+      bool expired_by_time = elem->IsExpiredByTime(shard_now);
+      lock.unlock();
+      if (CheckNodeCache(attributes, signature, time_now,
+                         &result->owned_status_)) {
+        result->status_ = nullptr;
+        return result->owned_status_;
       }
-      return elem->status();
+      num_misses_.fetch_add(1, std::memory_order_relaxed);
+      result->miss_signature_ = signature;
+      result->miss_reason_ = expired_by_time
+                                 ? CheckMissReason::EXPIRED
+                                 : CheckMissReason::USE_COUNT_EXHAUSTED;
+      ISTIO_TRACEPOINT1(check_cache_miss, i + 1);
+      return NotFoundStatus();
+    }
+    // An interned status outlives the item, it is shared without a copy.
+    // Only a status not interned, if the intern table is full, is copied
+    // while the item is locked.
+    result->status_ = elem->interned_status();
+    if (!result->status_) {
+      result->owned_status_ = elem->status();
     }
+    if (elem->status().ok()) {
+      result->needs_refresh_ = elem->NeedsRefresh(shard_now);
+    }
+    lock.unlock();
+
+    uint64_t hits = ++shape->hits;
+    ISTIO_TRACEPOINT1(check_cache_hit, i);
+    // Only re-order when the hit count is doubled to bound re-orders.
+    if (i > 0 && hits > 2 * index->ordered[i - 1]->hits) {
+      ReorderShapes();
+    }
+    return result->status();
   }
 
-  return Status(Code::NOT_FOUND, "");
+  num_misses_.fetch_add(1, std::memory_order_relaxed);
+  result->miss_reason_ = result->has_miss_signature_
+                             ? CheckMissReason::NO_ITEM
+                             : CheckMissReason::NO_SHAPE;
+  ISTIO_TRACEPOINT1(check_cache_miss, index->ordered.size());
+  return NotFoundStatus();
 }
 
 Status CheckCache::CacheResponse(const Attributes &attributes,
                                  const CheckResponse &response, Tick time_now) {
-  if (!cache_ || !response.has_precondition()) {
+  if (shards_.empty() || !response.has_precondition()) {
     if (response.has_precondition()) {
       return ConvertRpcStatus(response.precondition().status());
     } else {
@@ -140,7 +591,7 @@ Status CheckCache::CacheResponse(const Attributes &attributes,
     // Failed to decode referenced_attributes, not to cache this result.
     return ConvertRpcStatus(response.precondition().status());
   }
-  std::string signature;
+  utils::FastHash::Key signature;
   if (!referenced.Signature(attributes, "", &signature)) {
     GOOGLE_LOG(ERROR) << "Response referenced mismatchs with request";
     GOOGLE_LOG(ERROR) << "Request attributes: " << attributes.DebugString();
@@ -148,31 +599,593 @@ Status CheckCache::CacheResponse(const Attributes &attributes,
     return ConvertRpcStatus(response.precondition().status());
   }
 
-  std::lock_guard<std::mutex> lock(cache_mutex_);
-  std::string hash = referenced.Hash();
-  if (referenced_map_.find(hash) == referenced_map_.end()) {
-    referenced_map_[hash] = referenced;
-    GOOGLE_LOG(INFO) << "Add a new Referenced for check cache: "
-                     << referenced.DebugString();
+  utils::FastHash::Key hash = referenced.Hash();
+  bool known_shape;
+  {
+    IndexReader index(*this);
+    known_shape = index->map.count(hash) > 0;
+  }
+  if (!known_shape) {
+    std::lock_guard<Mutex> lock(referenced_mutex_);
+    // Check again with the lock, and copy-on-write.
+    if (GetReferencedIndex()->map.count(hash) == 0) {
+      std::unique_ptr<ReferencedIndex> index(
+          new ReferencedIndex(*GetReferencedIndex()));
+      auto shape = std::make_shared<ReferencedShape>(referenced);
+      index->map[hash] = shape;
+      index->ordered.push_back(shape);
+      PublishIndex(std::move(index));
+      referenced_bytes_ += referenced.ByteSize();
+      GOOGLE_LOG(INFO) << "Add a new Referenced for check cache: "
+                       << referenced.DebugString();
+    }
+  }
+
+  if (node_cache_) {
+    CacheNodeResponse(signature, response, time_now);
   }
+  return StoreResponse(signature, GetPartition(attributes), response,
+                       time_now);
+}
 
-  CheckLRUCache::ScopedLookup lookup(cache_.get(), signature);
-  if (lookup.Found()) {
-    lookup.value()->SetResponse(response, time_now);
-    return lookup.value()->status();
+Status CheckCache::StoreResponse(const utils::FastHash::Key &signature,
+                                 uint64_t partition,
+                                 const CheckResponse &response,
+                                 Tick time_now) {
+  Shard *shard = GetShard(signature);
+  std::lock_guard<SharedMutex> lock(shard->mutex);
+  UpdateEpoch(shard, time_now);
+  ShardTime shard_now = ToShardTime(*shard, time_now, false);
+  const auto it = shard->cache.find(signature);
+  if (it != shard->cache.end()) {
+    shard->bytes -= it->second.ByteSize();
+    it->second.SetResponse(*this, response, shard_now, time_now);
+    shard->bytes += it->second.ByteSize();
+    return it->second.status();
   }
 
-  CacheElem *cache_elem = new CacheElem(*this, response, time_now);
-  cache_->Insert(signature, cache_elem, 1);
-  return cache_elem->status();
+  CacheElem cache_elem;
+  cache_elem.SetResponse(*this, response, shard_now, time_now);
+  cache_elem.set_partition(partition);
+  size_t bytes = cache_elem.ByteSize();
+  Evict(shard, time_now, bytes);
+  const auto &elem = shard->cache.emplace(signature, cache_elem).first->second;
+  shard->bytes += bytes;
+  return elem.status();
+}
+
+bool CheckCache::CheckNodeCache(const Attributes &attributes,
+                                const utils::FastHash::Key &signature,
+                                Tick time_now, Status *status) {
+  int64_t now_ms = ToEpochMs(time_now);
+  int64_t expire_ms;
+  int use_count;
+  if (!node_cache_ ||
+      !node_cache_->Lookup(signature, now_ms, status, &expire_ms,
+                           &use_count)) {
+    return false;
+  }
+  if (use_count == 1) {
+    // The only use left is this one.
+    return true;
+  }
+  // The uses taken from the node cache, but this one, are served locally.
+  CheckResponse response;
+  auto *precondition = response.mutable_precondition();
+  precondition->mutable_status()->set_code(status->error_code());
+  precondition->mutable_status()->set_message(
+      status->error_message().ToString());
+  if (expire_ms != NodeCheckCache::kNeverExpire) {
+    *precondition->mutable_valid_duration() = utils::CreateDuration(
+        std::chrono::milliseconds(expire_ms - now_ms));
+  }
+  precondition->set_valid_use_count(use_count < 0 ? -1 : use_count - 1);
+  StoreResponse(signature, GetPartition(attributes), response, time_now);
+  return true;
+}
+
+void CheckCache::CacheNodeResponse(const utils::FastHash::Key &signature,
+                                   const CheckResponse &response,
+                                   Tick time_now) {
+  const auto &precondition = response.precondition();
+  Status status = ConvertRpcStatus(precondition.status());
+  if (status.ok()) {
+    return;
+  }
+  int64_t now_ms = ToEpochMs(time_now);
+  int64_t expire_ms = NodeCheckCache::kNeverExpire;
+  if (precondition.has_valid_duration()) {
+    expire_ms =
+        now_ms + utils::ToMilliseonds(precondition.valid_duration()).count();
+  }
+  // Denied responses are only cached for a short time.
+  if (options_.negative_cache_ttl_ms > 0) {
+    expire_ms = std::min(expire_ms, now_ms + options_.negative_cache_ttl_ms);
+  }
+  node_cache_->Insert(signature, status, expire_ms,
+                      precondition.valid_use_count(), now_ms);
+}
+
+void CheckCache::UpdateEpoch(Shard *shard, Tick time_now) {
+  int64_t now_ms = ToEpochMs(time_now);
+  if (shard->cache.empty()) {
+    shard->epoch_ms = now_ms;
+    return;
+  }
+  int64_t delta_ms = now_ms - shard->epoch_ms;
+  if (delta_ms < kRebaseMs && delta_ms > -kRebaseMs) {
+    return;
+  }
+  for (auto &it : shard->cache) {
+    it.second.Rebase(delta_ms);
+  }
+  shard->epoch_ms = now_ms;
+}
+
+const Status *CheckCache::InternStatus(const Status &status) {
+  if (status.ok()) {
+    return &Status::OK;
+  }
+  std::string key = std::to_string(status.error_code());
+  key.push_back(':');
+  key.append(status.error_message().data(), status.error_message().size());
+  std::lock_guard<Mutex> lock(statuses_mutex_);
+  const auto it = statuses_.find(key);
+  if (it != statuses_.end()) {
+    return it->second.get();
+  }
+  if (statuses_.size() >= kMaxInternedStatuses) {
+    return nullptr;
+  }
+  Status *interned = new Status(status);
+  statuses_[key].reset(interned);
+  return interned;
+}
+
+uint64_t CheckCache::GetPartition(const Attributes &attributes) const {
+  if (options_.partition_attribute.empty()) {
+    return 0;
+  }
+  const auto &map = attributes.attributes();
+  const auto it = map.find(options_.partition_attribute);
+  if (it == map.end()) {
+    return 0;
+  }
+  // Keeps the partition of a value apart from no value.
+  return std::hash<std::string>()(it->second.string_value()) | 1;
+}
+
+void CheckCache::Evict(Shard *shard, Tick time_now, size_t new_bytes) {
+  bool over_entries = shard->cache.size() >= shard->capacity;
+  auto over_bytes = [this, shard, new_bytes]() -> bool {
+    return max_shard_bytes_ > 0 && shard->bytes + new_bytes > max_shard_bytes_;
+  };
+  if (!over_entries && !over_bytes()) {
+    return;
+  }
+
+  ShardTime shard_now = ToShardTime(*shard, time_now);
+  std::vector<std::pair<Tick::rep, utils::FastHash::Key>> items;
+  items.reserve(shard->cache.size());
+  // The number of items of each partition.
+  std::unordered_map<uint64_t, size_t> partitions;
+  for (const auto &it : shard->cache) {
+    items.emplace_back(it.second.last_access(shard_now), it.first);
+    if (!options_.partition_attribute.empty()) {
+      ++partitions[it.second.partition()];
+    }
+  }
+  std::sort(items.begin(), items.end(),
+            [](const std::pair<Tick::rep, utils::FastHash::Key> &a,
+               const std::pair<Tick::rep, utils::FastHash::Key> &b) {
+              return a.first < b.first;
+            });
+
+  // Evict 1/8 of the capacity if it is full, and more until the new item
+  // fits into max bytes.
+  size_t num_evicted = over_entries ? std::max<size_t>(1, shard->capacity / 8)
+                                    : 0;
+  size_t evicted = 0;
+  auto evict = [shard, &evicted](const utils::FastHash::Key &key) {
+    const auto it = shard->cache.find(key);
+    shard->bytes -= it->second.ByteSize();
+    shard->cache.erase(it);
+    ++evicted;
+  };
+  // With more than one partition, the expired items and the items of the
+  // partitions over their share go first.
+  if (partitions.size() > 1) {
+    size_t share = shard->capacity / partitions.size();
+    const Tick::rep expired = Tick::min().time_since_epoch().count();
+    for (const auto &item : items) {
+      if (evicted >= num_evicted && !over_bytes()) {
+        break;
+      }
+      size_t &count =
+          partitions[shard->cache.find(item.second)->second.partition()];
+      if (item.first == expired || count > share) {
+        --count;
+        evict(item.second);
+      }
+    }
+  }
+  // Then the least recently used items left.
+  for (const auto &item : items) {
+    if (evicted >= num_evicted && !over_bytes()) {
+      break;
+    }
+    if (shard->cache.count(item.second) > 0) {
+      evict(item.second);
+    }
+  }
+  num_evictions_.fetch_add(evicted, std::memory_order_relaxed);
+}
+
+size_t CheckCache::Shrink(double fraction) {
+  Tick time_now = system_clock::now();
+  size_t evicted = 0;
+  for (const auto &shard : shards_) {
+    std::lock_guard<SharedMutex> lock(shard->mutex);
+    size_t target = static_cast<size_t>(shard->capacity * fraction);
+    if (shard->cache.size() <= target) {
+      continue;
+    }
+    ShardTime shard_now = ToShardTime(*shard, time_now);
+    std::vector<std::pair<Tick::rep, utils::FastHash::Key>> items;
+    items.reserve(shard->cache.size());
+    for (const auto &it : shard->cache) {
+      items.emplace_back(it.second.last_access(shard_now), it.first);
+    }
+    size_t num_evicted = shard->cache.size() - target;
+    std::partial_sort(items.begin(), items.begin() + num_evicted, items.end(),
+                      [](const std::pair<Tick::rep, utils::FastHash::Key> &a,
+                         const std::pair<Tick::rep, utils::FastHash::Key> &b) {
+                        return a.first < b.first;
+                      });
+    for (size_t i = 0; i < num_evicted; ++i) {
+      const auto it = shard->cache.find(items[i].second);
+      shard->bytes -= it->second.ByteSize();
+      shard->cache.erase(it);
+    }
+    evicted += num_evicted;
+  }
+  return evicted;
+}
+
+void CheckCache::SetCapacity(int64_t num_entries) {
+  if (shards_.empty()) {
+    return;
+  }
+  size_t shard_capacity =
+      std::max<int64_t>(1, num_entries / static_cast<int64_t>(shards_.size()));
+  for (const auto &shard : shards_) {
+    std::lock_guard<SharedMutex> lock(shard->mutex);
+    shard->capacity = shard_capacity;
+  }
+  Shrink(1.0);
+}
+
+void CheckCache::GetDemand(uint64_t *misses, uint64_t *evictions) const {
+  *misses = num_misses_.load(std::memory_order_relaxed);
+  *evictions = num_evictions_.load(std::memory_order_relaxed);
+}
+
+size_t CheckCache::CacheElem::ByteSize() const {
+  // The hash map node holds the key and the item, with the pointer to the
+  // next node and the cached hash. An interned status is not counted.
+  size_t size = sizeof(utils::FastHash::Key) + sizeof(CacheElem) +
+                2 * sizeof(void *);
+  if (owned_status_) {
+    size += sizeof(Status) + owned_status_->error_message().size();
+  }
+  return size;
+}
+
+void CheckCache::GetCacheSize(uint64_t *num_entries,
+                              uint64_t *num_bytes) const {
+  *num_entries = 0;
+  *num_bytes = referenced_bytes_;
+  for (const auto &shard : shards_) {
+    std::shared_lock<SharedMutex> lock(shard->mutex);
+    *num_entries += shard->cache.size();
+    *num_bytes += shard->bytes;
+  }
+}
+
+namespace {
+
+// Converts an item time to the absolute time in a snapshot, which keeps
+// the clock ticks of the format before the compact items.
+system_clock::rep ToSnapshotTime(int64_t epoch_ms, int32_t time) {
+  if (time == kNeverTime) {
+    return system_clock::time_point::max().time_since_epoch().count();
+  }
+  return duration_cast<system_clock::duration>(milliseconds(epoch_ms + time))
+      .count();
+}
+
+int32_t FromSnapshotTime(int64_t epoch_ms, system_clock::rep time) {
+  if (time == system_clock::time_point::max().time_since_epoch().count()) {
+    return kNeverTime;
+  }
+  system_clock::time_point tick{system_clock::duration(time)};
+  return AddMs(ToEpochMs(tick), -epoch_ms);
+}
+
+}  // namespace
+
+void CheckCache::CacheElem::Encode(int64_t epoch_ms,
+                                   SnapshotWriter *writer) const {
+  writer->Write<int32_t>(status_->error_code());
+  writer->WriteString(status_->error_message().ToString());
+  writer->Write<Tick::rep>(ToSnapshotTime(epoch_ms, expire_time_));
+  writer->Write<int32_t>(use_count_);
+  writer->Write<Tick::rep>(ToSnapshotTime(epoch_ms, refresh_time_));
+  writer->Write<int32_t>(refresh_use_count_);
+}
+
+bool CheckCache::CacheElem::Decode(CheckCache &parent, int64_t epoch_ms,
+                                   SnapshotReader *reader, Tick time_now) {
+  int32_t code, use_count, refresh_use_count;
+  std::string message;
+  Tick::rep expire_time, refresh_time;
+  if (!reader->Read(&code) || !reader->ReadString(&message) ||
+      !reader->Read(&expire_time) || !reader->Read(&use_count) ||
+      !reader->Read(&refresh_time) || !reader->Read(&refresh_use_count)) {
+    return false;
+  }
+  SetStatus(parent, Status(static_cast<Code>(code), message));
+  has_precondition_ = true;
+  expire_time_ = FromSnapshotTime(epoch_ms, expire_time);
+  use_count_ = use_count;
+  refresh_time_ = FromSnapshotTime(epoch_ms, refresh_time);
+  refresh_use_count_ = refresh_use_count;
+  last_access_ = time_now.time_since_epoch().count();
+  next_refresh_ = kExpiredTime;
+  return true;
+}
+
+void CheckCache::SaveSnapshot(std::string *data) const {
+  SaveSnapshot(data, system_clock::now());
+}
+
+Status CheckCache::LoadSnapshot(const std::string &data) {
+  return LoadSnapshot(data, system_clock::now());
+}
+
+// The snapshot format is:
+//   magic, version,
+//   number of shapes, {Referenced, hits} for each shape,
+//   number of items, {signature, CacheElem} for each item.
+void CheckCache::SaveSnapshot(std::string *data, Tick time_now) const {
+  data->clear();
+  SnapshotWriter writer(data);
+  writer.Write(kSnapshotMagic);
+  writer.Write(kSnapshotVersion);
+
+  IndexReader index(*this);
+  writer.Write<uint32_t>(index->ordered.size());
+  for (const auto &shape : index->ordered) {
+    shape->referenced.EncodeSnapshot(&writer);
+    writer.Write<uint64_t>(shape->hits);
+  }
+
+  std::string items;
+  SnapshotWriter items_writer(&items);
+  uint32_t num_items = 0;
+  for (const auto &shard : shards_) {
+    std::shared_lock<SharedMutex> lock(shard->mutex);
+    ShardTime shard_now = ToShardTime(*shard, time_now);
+    for (const auto &it : shard->cache) {
+      if (!it.second.IsSnapshotUsable(shard_now)) {
+        continue;
+      }
+      items_writer.Write(it.first.high);
+      items_writer.Write(it.first.low);
+      it.second.Encode(shard->epoch_ms, &items_writer);
+      ++num_items;
+    }
+  }
+  writer.Write(num_items);
+  data->append(items);
+}
+
+Status CheckCache::LoadSnapshot(const std::string &data, Tick time_now) {
+  SnapshotReader reader(data);
+  uint32_t magic, version, num_shapes;
+  if (!reader.Read(&magic) || magic != kSnapshotMagic ||
+      !reader.Read(&version) || version != kSnapshotVersion) {
+    return Status(Code::INVALID_ARGUMENT,
+                  "Check cache snapshot has an unknown format");
+  }
+
+  // Parses the whole snapshot before changing the cache.
+  if (!reader.Read(&num_shapes)) {
+    return Status(Code::INVALID_ARGUMENT, "Corrupted check cache snapshot");
+  }
+  std::vector<ReferencedShapePtr> shapes;
+  for (uint32_t i = 0; i < num_shapes; ++i) {
+    Referenced referenced;
+    uint64_t hits;
+    if (!referenced.DecodeSnapshot(&reader) || !reader.Read(&hits)) {
+      return Status(Code::INVALID_ARGUMENT, "Corrupted check cache snapshot");
+    }
+    shapes.push_back(std::make_shared<ReferencedShape>(referenced));
+    shapes.back()->hits = hits;
+  }
+
+  uint32_t num_items;
+  if (!reader.Read(&num_items)) {
+    return Status(Code::INVALID_ARGUMENT, "Corrupted check cache snapshot");
+  }
+  // The items are decoded with the epoch at time_now, and moved to the
+  // epoch of their shard when they are added.
+  int64_t epoch_ms = ToEpochMs(time_now);
+  std::vector<std::pair<utils::FastHash::Key, std::unique_ptr<CacheElem>>>
+      items;
+  for (uint32_t i = 0; i < num_items; ++i) {
+    utils::FastHash::Key signature;
+    std::unique_ptr<CacheElem> elem(new CacheElem);
+    if (!reader.Read(&signature.high) || !reader.Read(&signature.low) ||
+        !elem->Decode(*this, epoch_ms, &reader, time_now)) {
+      return Status(Code::INVALID_ARGUMENT, "Corrupted check cache snapshot");
+    }
+    if (elem->IsSnapshotUsable(AddMs(ToEpochMs(time_now, true), -epoch_ms))) {
+      items.emplace_back(signature, std::move(elem));
+    }
+  }
+  if (!reader.AtEnd()) {
+    return Status(Code::INVALID_ARGUMENT, "Corrupted check cache snapshot");
+  }
+  if (shards_.empty()) {
+    return Status::OK;
+  }
+
+  {
+    std::lock_guard<Mutex> lock(referenced_mutex_);
+    std::unique_ptr<ReferencedIndex> index(
+        new ReferencedIndex(*GetReferencedIndex()));
+    for (const auto &shape : shapes) {
+      utils::FastHash::Key hash = shape->referenced.Hash();
+      if (index->map.count(hash) == 0) {
+        index->map[hash] = shape;
+        index->ordered.push_back(shape);
+        referenced_bytes_ += shape->referenced.ByteSize();
+      }
+    }
+    std::stable_sort(
+        index->ordered.begin(), index->ordered.end(),
+        [](const ReferencedShapePtr &a, const ReferencedShapePtr &b) {
+          return a->hits > b->hits;
+        });
+    PublishIndex(std::move(index));
+  }
+
+  for (auto &item : items) {
+    Shard *shard = GetShard(item.first);
+    std::lock_guard<SharedMutex> lock(shard->mutex);
+    if (shard->cache.count(item.first) > 0) {
+      // Keep the item from a fresh response.
+      continue;
+    }
+    UpdateEpoch(shard, time_now);
+    item.second->Rebase(shard->epoch_ms - epoch_ms);
+    size_t bytes = item.second->ByteSize();
+    Evict(shard, time_now, bytes);
+    shard->cache.emplace(item.first, *item.second);
+    shard->bytes += bytes;
+  }
+  GOOGLE_LOG(INFO) << "Loaded check cache snapshot with " << shapes.size()
+                   << " Referenced and " << items.size() << " cache items";
+  return Status::OK;
+}
+
+void CheckCache::LoadSnapshotFile() {
+  std::ifstream file(options_.snapshot_file, std::ios::binary);
+  if (!file) {
+    // No snapshot is saved yet.
+    return;
+  }
+  std::stringstream data;
+  data << file.rdbuf();
+  Status status = LoadSnapshot(data.str());
+  if (!status.ok()) {
+    GOOGLE_LOG(ERROR) << "Failed to load check cache snapshot from "
+                      << options_.snapshot_file << ": " << status.ToString();
+  }
+}
+
+void CheckCache::SaveSnapshotFile() const {
+  std::string data;
+  SaveSnapshot(&data);
+  // Writes to a temporary file and renames it, a process loading the
+  // snapshot never sees a partial file.
+  std::string tmp_file = options_.snapshot_file + ".tmp";
+  {
+    std::ofstream file(tmp_file, std::ios::binary | std::ios::trunc);
+    file.write(data.data(), data.size());
+    file.close();
+    if (!file) {
+      GOOGLE_LOG(ERROR) << "Failed to write check cache snapshot to "
+                        << tmp_file;
+      return;
+    }
+  }
+  if (rename(tmp_file.c_str(), options_.snapshot_file.c_str()) != 0) {
+    GOOGLE_LOG(ERROR) << "Failed to rename check cache snapshot to "
+                      << options_.snapshot_file;
+  }
+}
+
+bool CheckCache::SaveSnapshotIfDue() {
+  return SaveSnapshotIfDue(system_clock::now());
+}
+
+bool CheckCache::SaveSnapshotIfDue(Tick time_now) {
+  int interval_ms = snapshot_interval_ms();
+  int64_t now_ms = ToEpochMs(time_now);
+  int64_t next_ms = next_snapshot_ms_.load();
+  if (interval_ms <= 0 || now_ms < next_ms ||
+      !next_snapshot_ms_.compare_exchange_strong(next_ms,
+                                                 now_ms + interval_ms)) {
+    return false;
+  }
+  SaveSnapshotFile();
+  return true;
+}
+
+size_t CheckCache::SweepExpired(size_t max_items) {
+  return SweepExpired(max_items, system_clock::now());
+}
+
+size_t CheckCache::SweepExpired(size_t max_items, Tick time_now) {
+  // The last readers of an epoch may not have freed its retired versions.
+  ReclaimIndexes();
+  if (shards_.empty()) {
+    return 0;
+  }
+  std::lock_guard<Mutex> sweep_lock(sweep_mutex_);
+  size_t removed = 0;
+  size_t visited = 0;
+  // Each shard is swept by walking its hash buckets, the cursor stays in
+  // a shard until all its buckets are visited.
+  for (size_t n = 0; n <= shards_.size() && visited < max_items; ++n) {
+    Shard *shard = shards_[sweep_shard_].get();
+    std::lock_guard<SharedMutex> lock(shard->mutex);
+    ShardTime shard_now = ToShardTime(*shard, time_now);
+    std::vector<utils::FastHash::Key> dead;
+    size_t num_buckets = shard->cache.bucket_count();
+    size_t &bucket = shard->sweep_bucket;
+    for (; bucket < num_buckets && visited < max_items; ++bucket) {
+      for (auto it = shard->cache.begin(bucket);
+           it != shard->cache.end(bucket); ++it) {
+        ++visited;
+        if (it->second.IsDead(*this, shard_now)) {
+          dead.push_back(it->first);
+        }
+      }
+    }
+    for (const auto &signature : dead) {
+      const auto it = shard->cache.find(signature);
+      shard->bytes -= it->second.ByteSize();
+      shard->cache.erase(it);
+    }
+    removed += dead.size();
+    if (bucket >= num_buckets) {
+      bucket = 0;
+      sweep_shard_ = (sweep_shard_ + 1) % shards_.size();
+    }
+  }
+  return removed;
 }
 
 // Flush out aggregated check requests, clear all cache items.
 // Usually called at destructor.
 Status CheckCache::FlushAll() {
-  if (cache_) {
-    std::lock_guard<std::mutex> lock(cache_mutex_);
-    cache_->RemoveAll();
+  for (const auto &shard : shards_) {
+    std::lock_guard<SharedMutex> lock(shard->mutex);
+    shard->cache.clear();
+    shard->bytes = 0;
   }
 
   return Status::OK;
@@ -18,33 +18,46 @@
 #ifndef ISTIO_MIXERCLIENT_CHECK_CACHE_H
 #define ISTIO_MIXERCLIENT_CHECK_CACHE_H
 
+#include <atomic>
 #include <chrono>
+#include <memory>
 #include <mutex>
+#include <set>
+#include <shared_mutex>
 #include <string>
 #include <unordered_map>
 #include <utility>
+#include <vector>
 
 #include "google/protobuf/stubs/status.h"
+#include "include/istio/mixerclient/check_response.h"
 #include "include/istio/mixerclient/client.h"
 #include "include/istio/mixerclient/options.h"
-#include "include/istio/utils/simple_lru_cache.h"
-#include "include/istio/utils/simple_lru_cache_inl.h"
+#include "include/istio/utils/fast_hash.h"
+#include "include/istio/utils/optional_mutex.h"
+#include "src/istio/mixerclient/node_check_cache.h"
 #include "src/istio/mixerclient/referenced.h"
+#include "src/istio/mixerclient/snapshot_coder.h"
 
 namespace istio {
 namespace mixerclient {
 
 // Cache Mixer Check call result.
-// This interface is thread safe.
+// This interface is thread safe unless the cache is THREAD_CONFINED. The
+// cache can be sharded with CheckOptions::num_shards so that it can be
+// shared by multiple threads.
 class CheckCache {
  public:
-  CheckCache(const CheckOptions& options);
+  CheckCache(const CheckOptions& options,
+             ThreadingModel threading_model = ThreadingModel::SHARED);
 
   virtual ~CheckCache();
 
   // A check cache result for a request. Its usage
   //   cache->Check(attributes, result);
   //   if (result->IsCacheHit()) return result->Status();
+  // For a cache hit, if result->NeedsRefresh(), a remote call should still
+  // be made in the background to renew the cache item.
   // Make remote call and on receiving response.
   //   result->SetReponse(status, response);
   //   return result->Status();
@@ -54,20 +67,48 @@ class CheckCache {
 
     bool IsCacheHit() const;
 
-    ::google::protobuf::util::Status status() const { return status_; }
+    // True if the cache item should be renewed by a remote call.
+    bool NeedsRefresh() const { return needs_refresh_; }
+
+    // For a cache miss, gets the request signature from a learned
+    // Referenced shape. Returns false if no shape matches the request.
+    bool GetMissSignature(utils::FastHash::Key* signature) const {
+      if (has_miss_signature_) {
+        *signature = miss_signature_;
+      }
+      return has_miss_signature_;
+    }
+
+    // The status of a hit is interned by the cache, and returned without a
+    // copy. It is valid as long as the result and the cache.
+    const ::google::protobuf::util::Status& status() const {
+      return status_ ? *status_ : owned_status_;
+    }
+
+    // Why the lookup missed, NONE for a hit.
+    CheckMissReason miss_reason() const { return miss_reason_; }
 
     void SetResponse(const ::google::protobuf::util::Status& status,
                      const ::istio::mixer::v1::Attributes& attributes,
                      const ::istio::mixer::v1::CheckResponse& response) {
       if (on_response_) {
-        status_ = on_response_(status, attributes, response);
+        owned_status_ = on_response_(status, attributes, response);
+        status_ = nullptr;
       }
     }
 
    private:
     friend class CheckCache;
-    // Check status.
-    ::google::protobuf::util::Status status_;
+    // Check status: a status interned by the cache, or owned_status_ if
+    // nullptr.
+    const ::google::protobuf::util::Status* status_;
+    ::google::protobuf::util::Status owned_status_;
+    // If true, the cache hit needs a background refresh.
+    bool needs_refresh_;
+    // The request signature for a cache miss.
+    bool has_miss_signature_;
+    utils::FastHash::Key miss_signature_;
+    CheckMissReason miss_reason_;
 
     // The function to set check response.
     using OnResponseFunc = std::function<::google::protobuf::util::Status(
@@ -77,17 +118,92 @@ class CheckCache {
     OnResponseFunc on_response_;
   };
 
+  // If fingerprints is not nullptr, they are the value hashes of
+  // attributes shared with the quota cache lookup of the same request.
   void Check(const ::istio::mixer::v1::Attributes& attributes,
-             CheckResult* result);
+             CheckResult* result,
+             AttributeFingerprints* fingerprints = nullptr);
+
+  // Same as above for attributes without the ones named in deferred_names.
+  // Returns false without a lookup if any learned Referenced shape uses
+  // one of them, the caller has to add them and call Check() again.
+  bool Check(const ::istio::mixer::v1::Attributes& attributes,
+             const std::vector<std::string>& deferred_names,
+             CheckResult* result,
+             AttributeFingerprints* fingerprints = nullptr);
+
+  // Returns true if remote check responses are cached, so a response needs
+  // the attributes of its request.
+  bool CachesResponses() const { return !shards_.empty(); }
+
+  // Gets the hit/miss counts of each Referenced shape.
+  void GetShapeStats(std::vector<ReferencedShapeStats>* stats) const;
+
+  // Gets the number of cache items, and their bytes plus the bytes of
+  // learned Referenced shapes.
+  void GetCacheSize(uint64_t* num_entries, uint64_t* num_bytes) const;
+
+  // Writes learned Referenced shapes and unexpired cache items into a
+  // versioned binary snapshot.
+  void SaveSnapshot(std::string* data) const;
+
+  // Preloads the cache from a snapshot written by SaveSnapshot().
+  // Items expired since the snapshot are skipped. Returns INVALID_ARGUMENT
+  // if the snapshot is corrupted or has a different version, the cache is
+  // not changed in that case.
+  ::google::protobuf::util::Status LoadSnapshot(const std::string& data);
+
+  // The interval of the periodic snapshots, 0 if there are none.
+  int snapshot_interval_ms() const {
+    return options_.snapshot_file.empty() ? 0 : options_.snapshot_interval_ms;
+  }
+
+  // Saves the snapshot file if an interval passed since the last save.
+  // Called by the timers of all the clients sharing the cache, only the
+  // first one due saves it. Returns true if saved.
+  bool SaveSnapshotIfDue();
+
+  // Removes the items which can't be used anymore, not even as stale
+  // ones. Visits at most max_items items, starting from where the last
+  // sweep stopped. Called periodically so that items never looked up again
+  // don't stay until their shard is full. Returns the number of removed
+  // items.
+  size_t SweepExpired(size_t max_items);
+
+  // Evicts the least recently used items until each shard holds at most
+  // fraction of its capacity, e.g. to release memory under overload.
+  // Returns the number of evicted items.
+  size_t Shrink(double fraction);
+
+  // Sets the maximum number of items, split over the shards. The least
+  // recently used items over the new capacity are evicted.
+  void SetCapacity(int64_t num_entries);
+
+  // Returns the total number of misses and of items evicted to make room,
+  // the demand for more capacity.
+  void GetDemand(uint64_t* misses, uint64_t* evictions) const;
 
  private:
   friend class CheckCacheTest;
   using Tick = std::chrono::time_point<std::chrono::system_clock>;
+  // The mutexes are disabled if the cache is THREAD_CONFINED.
+  using Mutex = utils::OptionalMutex<std::mutex>;
+  using SharedMutex = utils::OptionalMutex<std::shared_timed_mutex>;
 
   // If the check could not be handled by the cache, returns NOT_FOUND,
   // caller has to send the request to mixer.
-  ::google::protobuf::util::Status Check(
-      const ::istio::mixer::v1::Attributes& request, Tick time_now);
+  // For a hit, sets the status and the refresh flag of result, and returns
+  // the status of result. For a miss, sets the request signature of
+  // result. If deferred_names is not nullptr and any of them is used by a
+  // shape, returns FAILED_PRECONDITION instead.
+  const ::google::protobuf::util::Status& Check(
+      const ::istio::mixer::v1::Attributes& request, Tick time_now,
+      CheckResult* result,
+      const std::vector<std::string>* deferred_names = nullptr,
+      AttributeFingerprints* fingerprints = nullptr);
+
+  // Sets the function of the result to cache the remote check response.
+  void SetResponseFunc(CheckResult* result);
 
   // Caches a response from a remote mixer call.
   // Return the converted status from response.
@@ -99,60 +215,335 @@ class CheckCache {
   // Usually called at destructor.
   ::google::protobuf::util::Status FlushAll();
 
+  size_t SweepExpired(size_t max_items, Tick time_now);
+
+  void SaveSnapshot(std::string* data, Tick time_now) const;
+  ::google::protobuf::util::Status LoadSnapshot(const std::string& data,
+                                                Tick time_now);
+
+  // Loads the cache from, or saves it to options_.snapshot_file.
+  void LoadSnapshotFile();
+  void SaveSnapshotFile() const;
+  bool SaveSnapshotIfDue(Tick time_now);
+
+  // Looks up a local miss in the node check cache, if any. The uses left
+  // of a hit are moved to the local cache.
+  bool CheckNodeCache(const ::istio::mixer::v1::Attributes& attributes,
+                      const utils::FastHash::Key& signature, Tick time_now,
+                      ::google::protobuf::util::Status* status);
+
+  // Stores a check response of a signature in its shard.
+  ::google::protobuf::util::Status StoreResponse(
+      const utils::FastHash::Key& signature, uint64_t partition,
+      const ::istio::mixer::v1::CheckResponse& response, Tick time_now);
+
+  // Stores a denied remote check response in the node check cache, if
+  // any.
+  void CacheNodeResponse(const utils::FastHash::Key& signature,
+                         const ::istio::mixer::v1::CheckResponse& response,
+                         Tick time_now);
+
   // Convert from grpc status to protobuf status.
   ::google::protobuf::util::Status ConvertRpcStatus(
       const ::google::rpc::Status& status) const;
 
+  // The times of the items are in milliseconds relative to the epoch of
+  // their shard, so that they fit into 32 bits.
+  using ShardTime = int32_t;
+
   class CacheElem {
    public:
-    CacheElem(const CheckCache& parent,
-              const ::istio::mixer::v1::CheckResponse& response, Tick time)
-        : parent_(parent) {
-      SetResponse(response, time);
-    }
+    // Creates an empty item, to be set by a response or a snapshot.
+    CacheElem()
+        : status_(nullptr),
+          has_precondition_(false),
+          use_count_(0),
+          refresh_use_count_(-1),
+          expire_time_(0),
+          refresh_time_(0),
+          next_refresh_(0),
+          last_access_(0) {}
+
+    // Copies an item decoded from a snapshot.
+    CacheElem(const CacheElem& other);
 
     // Set the response
-    void SetResponse(const ::istio::mixer::v1::CheckResponse& response,
-                     Tick time_now);
+    void SetResponse(CheckCache& parent,
+                     const ::istio::mixer::v1::CheckResponse& response,
+                     ShardTime shard_now, Tick time_now);
+
+    // Check if the item is expired. It is called with a shared lock,
+    // use_count is decreased atomically.
+    bool IsExpired(ShardTime time_now, Tick::rep access_time);
+
+    // Returns true if the item is expired by its valid duration, rather
+    // than by its use count.
+    bool IsExpiredByTime(ShardTime time_now) const {
+      return time_now > expire_time_;
+    }
 
-    // Check if the item is expired.
-    bool IsExpired(Tick time_now);
+    // Check if the item should be renewed. Only returns true once for
+    // each retry interval so concurrent refreshes are coalesced.
+    bool NeedsRefresh(ShardTime time_now);
+
+    // Check if the expired item can still be used when remote check calls
+    // are failing.
+    bool IsStaleUsable(const CheckCache& parent, ShardTime time_now) const;
 
     // getter for converted status from response.
-    ::google::protobuf::util::Status status() const { return status_; }
+    const ::google::protobuf::util::Status& status() const { return *status_; }
+
+    // The status if it is interned by the parent cache, nullptr if it is
+    // owned by the item.
+    const ::google::protobuf::util::Status* interned_status() const {
+      return owned_status_ ? nullptr : status_;
+    }
+
+    // Returns the approximate memory size of the item in bytes.
+    size_t ByteSize() const;
+
+    // Writes the item into a snapshot, or reads it from a snapshot. The
+    // snapshot has absolute times, converted with the epoch of the item.
+    void Encode(int64_t epoch_ms, SnapshotWriter* writer) const;
+    bool Decode(CheckCache& parent, int64_t epoch_ms, SnapshotReader* reader,
+                Tick time_now);
+
+    // Returns true if the item can still be used after a restart.
+    bool IsSnapshotUsable(ShardTime time_now) const;
+
+    // Returns true if the item is expired and can't be used as a stale item
+    // either, so it can be removed.
+    bool IsDead(const CheckCache& parent, ShardTime time_now) const;
+
+    // Moves the times of the item to an epoch delta_ms later.
+    void Rebase(int64_t delta_ms);
+
+    // The hash of the partition attribute value of the item, 0 if the
+    // cache is not partitioned.
+    uint64_t partition() const { return partition_; }
+    void set_partition(uint64_t partition) { partition_ = partition; }
+
+    // Returns expired items as the oldest ones for eviction.
+    Tick::rep last_access(ShardTime time_now) const;
 
    private:
-    // To the parent cache object.
-    const CheckCache& parent_;
-    // The check status for the last check request.
-    ::google::protobuf::util::Status status_;
-    // Cache item should not be used after it is expired.
-    std::chrono::time_point<std::chrono::system_clock> expire_time_;
+    // Sets the status to an interned one.
+    void SetStatus(CheckCache& parent,
+                   const ::google::protobuf::util::Status& status);
+
+    // The check status for the last check request, interned by the parent
+    // cache, or owned_status_ if the intern table is full.
+    const ::google::protobuf::util::Status* status_;
+    std::unique_ptr<::google::protobuf::util::Status> owned_status_;
+    // If false, the response doesn't have precondition.
+    bool has_precondition_;
     // if -1, not to check use_count.
     // if 0, cache item should not be used.
     // use_cound is decreased by 1 for each request,
-    int use_count_;
+    std::atomic<int32_t> use_count_;
+    // The item should be renewed if use_count_ drops to this value.
+    int32_t refresh_use_count_;
+    // Cache item should not be used after it is expired.
+    ShardTime expire_time_;
+    // The item should be renewed after this time.
+    ShardTime refresh_time_;
+    // The earliest time to start the next refresh.
+    std::atomic<ShardTime> next_refresh_;
+    // The last time the item is used, for eviction. It keeps the clock
+    // ticks to order the items used within the same millisecond.
+    std::atomic<Tick::rep> last_access_;
+    // The partition of the item.
+    uint64_t partition_ = 0;
   };
 
-  // Key is the signature of the Attributes. Value is the CacheElem.
-  // It is a LRU cache with maximum size.
-  // When the maximum size is reached, oldest idle items will be removed.
-  using CheckLRUCache = utils::SimpleLRUCache<std::string, CacheElem>;
+  // A cache shard with its own lock. Cache hits only take a shared lock,
+  // so concurrent lookups don't block each other. Inserts and removals
+  // take the exclusive lock.
+  struct Shard {
+    // Mutex guarding the access of cache.
+    SharedMutex mutex;
+    // Key is the signature of the Attributes. Value is the CacheElem,
+    // held in the hash map node to save an allocation per item.
+    std::unordered_map<utils::FastHash::Key, CacheElem,
+                       utils::FastHash::KeyHash>
+        cache;
+    // The maximum number of items.
+    size_t capacity;
+    // The total bytes of items.
+    size_t bytes;
+    // The hash bucket where the next sweep of the shard starts.
+    size_t sweep_bucket;
+    // The epoch of the item times, in milliseconds since the clock epoch.
+    // Only changed with the exclusive lock.
+    int64_t epoch_ms;
+  };
+
+  // Converts a time to the time of a shard. The times of a new item are
+  // rounded down and the lookup times are rounded up, so an item is never
+  // used past its expiration.
+  static ShardTime ToShardTime(const Shard& shard, Tick time,
+                               bool round_up = true);
+
+  // Moves the epoch of a shard to time_now if the shard is empty, or if
+  // time_now is getting out of the range of the item times. Called with
+  // the exclusive lock before an item is added.
+  void UpdateEpoch(Shard* shard, Tick time_now);
+
+  // Interns a status shared by the items. Returns nullptr if there are
+  // too many distinct statuses already.
+  const ::google::protobuf::util::Status* InternStatus(
+      const ::google::protobuf::util::Status& status);
+
+  // When a shard is full, evicts expired items and the least recently used
+  // ones, 1/8 of the capacity in one pass. With partitions, the items of the
+  // partitions over an equal share of the shard are evicted first. Also
+  // evicts items until a new item of new_bytes fits into max bytes. Called
+  // with the exclusive lock.
+  void Evict(Shard* shard, Tick time_now, size_t new_bytes);
+
+  // Returns the partition of a request, 0 if the cache is not partitioned.
+  uint64_t GetPartition(const ::istio::mixer::v1::Attributes& attributes) const;
+
+  // Get the shard for a signature.
+  Shard* GetShard(const utils::FastHash::Key& signature) const;
+
+  // A Referenced shape with its cache hit/miss counts.
+  struct ReferencedShape {
+    ReferencedShape(const Referenced& referenced)
+        : referenced(referenced),
+          debug_string(referenced.DebugString()),
+          hits(0),
+          misses(0) {}
+
+    Referenced referenced;
+    // The display string of the shape for its stats, built once.
+    const std::string debug_string;
+    std::atomic<uint64_t> hits;
+    std::atomic<uint64_t> misses;
+  };
+  using ReferencedShapePtr = std::shared_ptr<ReferencedShape>;
+
+  // The index of Referenced shapes.
+  struct ReferencedIndex {
+    // Referenced shapes keyed with their hashes.
+    std::unordered_map<utils::FastHash::Key, ReferencedShapePtr,
+                       utils::FastHash::KeyHash>
+        map;
+    // Referenced shapes to probe, ordered from the most hit one.
+    std::vector<ReferencedShapePtr> ordered;
+    // The attribute names used by any shape.
+    std::set<std::string> names;
+  };
+
+  // Get a snapshot of the referenced index. Only called with
+  // referenced_mutex_, other readers use an IndexReader.
+  const ReferencedIndex* GetReferencedIndex() const {
+    return referenced_index_.load();
+  }
+
+  // The stripes counting the readers of the referenced index, by the
+  // parity of the epoch they entered. Padded to a cache line each.
+  static const int kIndexReaderStripes = 32;
+  struct IndexReaderStripe {
+    std::atomic<int> readers[2];
+    char padding[64 - 2 * sizeof(std::atomic<int>)];
+  };
+
+  // Reads the referenced index without a lock. The replaced versions are
+  // retired by advancing the epoch, and freed once the readers of the
+  // epoch before are gone.
+  class IndexReader {
+   public:
+    explicit IndexReader(const CheckCache& cache);
+    ~IndexReader();
+
+    const ReferencedIndex* operator->() const { return index_; }
+
+   private:
+    const CheckCache& cache_;
+    IndexReaderStripe* stripe_;
+    uint64_t epoch_;
+    const ReferencedIndex* index_;
+  };
+
+  // Publishes a new version of the referenced index, and updates its
+  // attribute names. Called with referenced_mutex_.
+  void PublishIndex(std::unique_ptr<ReferencedIndex> index);
+
+  // Retires the replaced versions of the referenced index, and frees the
+  // retired ones once no reader of their epoch is left. The first one is
+  // skipped if another thread holds referenced_mutex_, the second one is
+  // called with it.
+  void ReclaimIndexes() const;
+  void ReclaimIndexesWithLock() const;
+
+  // Re-orders the shapes by their hit counts. It is skipped if another
+  // thread is updating the index.
+  void ReorderShapes();
 
   // The check options.
   CheckOptions options_;
 
-  // Referenced map keyed with their hashes
-  std::unordered_map<std::string, Referenced> referenced_map_;
+  // True if the last remote check call failed with a network error.
+  std::atomic<bool> transport_unavailable_;
+
+  // The total bytes of learned Referenced shapes.
+  std::atomic<uint64_t> referenced_bytes_;
+
+  // The maximum bytes of each shard, 0 if not limited.
+  size_t max_shard_bytes_;
+
+  // The total lookups not found and items evicted to make room.
+  std::atomic<uint64_t> num_misses_;
+  std::atomic<uint64_t> num_evictions_;
+
+  // The referenced index is read without lock by loading the pointer
+  // atomically. It is updated by copy-on-write since new Referenced and
+  // re-orders are rare.
+  std::atomic<const ReferencedIndex*> referenced_index_;
+
+  // The published version of the referenced index, the replaced ones not
+  // retired yet, and the ones retired by the last epoch.
+  std::unique_ptr<const ReferencedIndex> current_index_;
+  mutable std::vector<std::unique_ptr<const ReferencedIndex>>
+      replaced_indexes_;
+  mutable std::vector<std::unique_ptr<const ReferencedIndex>> retired_indexes_;
+
+  // The epoch of the referenced index readers, the stripes counting them,
+  // and true if retired_indexes_ is not empty.
+  mutable std::atomic<uint64_t> index_epoch_;
+  mutable IndexReaderStripe index_reader_stripes_[kIndexReaderStripes];
+  mutable std::atomic<bool> has_retired_indexes_;
+
+  // Mutex guarding writes of referenced_index_, current_index_,
+  // replaced_indexes_, retired_indexes_ and index_epoch_.
+  mutable Mutex referenced_mutex_;
+
+  // The cache shards. Empty if the cache is disabled.
+  std::vector<std::unique_ptr<Shard>> shards_;
+
+  // The check cache shared by the proxies of the node, nullptr if not
+  // enabled by options_.node_cache_file.
+  std::unique_ptr<NodeCheckCache> node_cache_;
+
+  // The shard where the next sweep starts.
+  size_t sweep_shard_;
+
+  // The time of the next periodic snapshot, in epoch milliseconds.
+  std::atomic<int64_t> next_snapshot_ms_;
+
+  // Mutex serializing sweeps, guarding sweep_shard_ and the sweep_bucket
+  // of the shards.
+  Mutex sweep_mutex_;
 
-  // Mutex guarding the access of cache_;
-  std::mutex cache_mutex_;
+  // The interned statuses of the items, keyed by code and message. There
+  // are only a few distinct ones, such as the denials of a policy.
+  std::unordered_map<std::string,
+                     std::unique_ptr<::google::protobuf::util::Status>>
+      statuses_;
 
-  // The cache that maps from operation signature to an operation.
-  // We don't calculate fine grained cost for cache entries, assign each
-  // entry 1 cost unit.
-  // Guarded by mutex_, except when compare against NULL.
-  std::unique_ptr<CheckLRUCache> cache_;
+  // Mutex guarding statuses_.
+  Mutex statuses_mutex_;
 
   GOOGLE_DISALLOW_EVIL_CONSTRUCTORS(CheckCache);
 };
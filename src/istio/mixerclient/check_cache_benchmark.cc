@@ -0,0 +1,99 @@
+/* Copyright 2017 Istio Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// A multi-threaded micro-benchmark for CheckCache hits, by the number of
+// threads, keys and shards.
+
+#include "benchmark/benchmark.h"
+#include "include/istio/utils/attributes_builder.h"
+#include "src/istio/mixerclient/check_cache.h"
+
+#include <memory>
+#include <vector>
+
+using ::google::protobuf::util::Status;
+using ::istio::mixer::v1::Attributes;
+using ::istio::mixer::v1::CheckResponse;
+using ::istio::mixer::v1::ReferencedAttributes;
+
+namespace istio {
+namespace mixerclient {
+namespace {
+
+// The cache and the keys of a run, shared by its threads.
+std::unique_ptr<CheckCache> cache;
+std::vector<Attributes> attributes;
+
+// The arguments are the number of keys and of shards.
+void BM_CheckCacheHit(benchmark::State& state) {
+  const int num_keys = state.range(0);
+  if (state.thread_index == 0) {
+    CheckOptions options;
+    options.num_shards = state.range(1);
+    cache.reset(new CheckCache(options));
+
+    CheckResponse ok_response;
+    // Never expired by use count.
+    ok_response.mutable_precondition()->set_valid_use_count(-1);
+    auto match = ok_response.mutable_precondition()
+                     ->mutable_referenced_attributes()
+                     ->add_attribute_matches();
+    match->set_condition(ReferencedAttributes::EXACT);
+    match->set_name(-1);
+    ok_response.mutable_precondition()
+        ->mutable_referenced_attributes()
+        ->add_words("target.service");
+
+    attributes.assign(num_keys, Attributes());
+    for (int i = 0; i < num_keys; ++i) {
+      utils::AttributesBuilder(&attributes[i])
+          .AddString("target.service", "service-" + std::to_string(i));
+      CheckCache::CheckResult result;
+      cache->Check(attributes[i], &result);
+      result.SetResponse(Status::OK, attributes[i], ok_response);
+    }
+  }
+
+  // The threads start the loop once the cache is filled.
+  int i = state.thread_index;
+  int64_t misses = 0;
+  while (state.KeepRunning()) {
+    CheckCache::CheckResult result;
+    cache->Check(attributes[i++ % num_keys], &result);
+    if (!result.IsCacheHit()) {
+      ++misses;
+    }
+  }
+  if (misses > 0) {
+    state.SkipWithError("cache misses");
+  }
+  state.SetItemsProcessed(state.iterations());
+
+  if (state.thread_index == 0) {
+    cache.reset();
+    attributes.clear();
+  }
+}
+BENCHMARK(BM_CheckCacheHit)
+    ->Args({1000, 1})
+    ->Args({1000, 16})
+    ->ThreadRange(1, 16)
+    ->UseRealTime();
+
+}  // namespace
+}  // namespace mixerclient
+}  // namespace istio
+
+BENCHMARK_MAIN();
@@ -20,6 +20,9 @@
 #include "include/istio/utils/protobuf.h"
 #include "src/istio/mixerclient/status_test_util.h"
 
+#include <thread>
+#include <vector>
+
 using namespace std::chrono;
 using ::google::protobuf::util::Status;
 using ::google::protobuf::util::error::Code;
@@ -49,22 +52,47 @@ class CheckCacheTest : public ::testing::Test {
     CheckResponse ok_response;
     ok_response.mutable_precondition()->set_valid_use_count(1000);
     // Just to calculate signature
-    EXPECT_ERROR_CODE(Code::NOT_FOUND, cache_->Check(attributes_, FakeTime(0)));
+    EXPECT_ERROR_CODE(Code::NOT_FOUND, Check(attributes_, FakeTime(0)));
     // set to the cache
     EXPECT_OK(cache_->CacheResponse(attributes_, ok_response, FakeTime(0)));
 
     // Still not_found, so cache is disabled.
-    EXPECT_ERROR_CODE(Code::NOT_FOUND, cache_->Check(attributes_, FakeTime(0)));
+    EXPECT_ERROR_CODE(Code::NOT_FOUND, Check(attributes_, FakeTime(0)));
   }
 
-  Status Check(const Attributes& request, time_point<system_clock> time_now) {
-    return cache_->Check(request, time_now);
+  Status Check(const Attributes& request, time_point<system_clock> time_now,
+               CheckCache::CheckResult* result = nullptr) {
+    CheckCache::CheckResult local_result;
+    return cache_->Check(request, time_now,
+                         result ? result : &local_result);
   }
   Status CacheResponse(const Attributes& attributes,
                        const ::istio::mixer::v1::CheckResponse& response,
                        time_point<system_clock> time_now) {
     return cache_->CacheResponse(attributes, response, time_now);
   }
+  void SaveSnapshot(std::string* data, time_point<system_clock> time_now) {
+    cache_->SaveSnapshot(data, time_now);
+  }
+  Status LoadSnapshot(const std::string& data,
+                      time_point<system_clock> time_now) {
+    return cache_->LoadSnapshot(data, time_now);
+  }
+  size_t SweepExpired(size_t max_items, time_point<system_clock> time_now) {
+    return cache_->SweepExpired(max_items, time_now);
+  }
+  size_t NumInternedStatuses() { return cache_->statuses_.size(); }
+  size_t NumUnfreedIndexes() {
+    return cache_->replaced_indexes_.size() + cache_->retired_indexes_.size();
+  }
+  // Holds a reader of the referenced index until it is destroyed.
+  std::unique_ptr<CheckCache::IndexReader> NewIndexReader() {
+    return std::unique_ptr<CheckCache::IndexReader>(
+        new CheckCache::IndexReader(*cache_));
+  }
+  bool SaveSnapshotIfDue(time_point<system_clock> time_now) {
+    return cache_->SaveSnapshotIfDue(time_now);
+  }
 
   Attributes attributes_;
   std::unique_ptr<CheckCache> cache_;
@@ -124,6 +152,182 @@ TEST_F(CheckCacheTest, TestExpiredByDuration) {
   EXPECT_ERROR_CODE(Code::NOT_FOUND, Check(attributes_, FakeTime(11)));
 }
 
+TEST_F(CheckCacheTest, TestMissReason) {
+  CheckCache::CheckResult result;
+  EXPECT_ERROR_CODE(Code::NOT_FOUND, Check(attributes_, FakeTime(0), &result));
+  EXPECT_EQ(result.miss_reason(), CheckMissReason::NO_SHAPE);
+
+  CheckResponse ok_response;
+  ok_response.mutable_precondition()->set_valid_use_count(1);
+  *ok_response.mutable_precondition()->mutable_valid_duration() =
+      utils::CreateDuration(duration_cast<nanoseconds>(milliseconds(10)));
+  auto match = ok_response.mutable_precondition()
+                   ->mutable_referenced_attributes()
+                   ->add_attribute_matches();
+  match->set_condition(ReferencedAttributes::EXACT);
+  match->set_name(9);  // target.service is used.
+  EXPECT_OK(CacheResponse(attributes_, ok_response, FakeTime(0)));
+
+  CheckCache::CheckResult result1;
+  EXPECT_OK(Check(attributes_, FakeTime(1), &result1));
+  EXPECT_EQ(result1.miss_reason(), CheckMissReason::NONE);
+
+  CheckCache::CheckResult result2;
+  EXPECT_ERROR_CODE(Code::NOT_FOUND, Check(attributes_, FakeTime(2), &result2));
+  EXPECT_EQ(result2.miss_reason(), CheckMissReason::USE_COUNT_EXHAUSTED);
+
+  ok_response.mutable_precondition()->set_valid_use_count(1000);
+  EXPECT_OK(CacheResponse(attributes_, ok_response, FakeTime(2)));
+  CheckCache::CheckResult result3;
+  EXPECT_ERROR_CODE(Code::NOT_FOUND,
+                    Check(attributes_, FakeTime(13), &result3));
+  EXPECT_EQ(result3.miss_reason(), CheckMissReason::EXPIRED);
+
+  Attributes attributes1;
+  utils::AttributesBuilder(&attributes1)
+      .AddString("target.service", "different target service");
+  CheckCache::CheckResult result4;
+  EXPECT_ERROR_CODE(Code::NOT_FOUND, Check(attributes1, FakeTime(2), &result4));
+  EXPECT_EQ(result4.miss_reason(), CheckMissReason::NO_ITEM);
+}
+
+TEST_F(CheckCacheTest, TestNodeCache) {
+  const char* dir = getenv("TEST_TMPDIR");
+  CheckOptions options;
+  options.node_cache_file = std::string(dir ? dir : "/tmp") + "/node_cache";
+  remove(options.node_cache_file.c_str());
+  options.node_cache_config_id = "mesh-1";
+  cache_.reset(new CheckCache(options));
+
+  CheckResponse response;
+  response.mutable_precondition()->set_valid_use_count(1000);
+  auto match = response.mutable_precondition()
+                   ->mutable_referenced_attributes()
+                   ->add_attribute_matches();
+  match->set_condition(ReferencedAttributes::EXACT);
+  match->set_name(9);  // target.service is used.
+  CheckResponse denied_response(response);
+  denied_response.mutable_precondition()->mutable_status()->set_code(
+      Code::PERMISSION_DENIED);
+  EXPECT_ERROR_CODE(Code::PERMISSION_DENIED,
+                    CacheResponse(attributes_, denied_response, FakeTime(0)));
+
+  // Another proxy of the node needs the Referenced shape to look up the
+  // request.
+  std::unique_ptr<CheckCache> first_cache = std::move(cache_);
+  cache_.reset(new CheckCache(options));
+  Attributes attributes1;
+  utils::AttributesBuilder(&attributes1)
+      .AddString("target.service", "different target service");
+  EXPECT_OK(CacheResponse(attributes1, response, FakeTime(0)));
+  EXPECT_ERROR_CODE(Code::PERMISSION_DENIED, Check(attributes_, FakeTime(1)));
+  // The uses left are moved to the local cache.
+  EXPECT_ERROR_CODE(Code::PERMISSION_DENIED, Check(attributes_, FakeTime(2)));
+  std::unique_ptr<CheckCache> second_cache = std::move(cache_);
+  cache_.reset(new CheckCache(options));
+  EXPECT_OK(CacheResponse(attributes1, response, FakeTime(0)));
+  EXPECT_ERROR_CODE(Code::NOT_FOUND, Check(attributes_, FakeTime(1)));
+
+  // The OK responses are not shared.
+  cache_.reset(new CheckCache(options));
+  EXPECT_ERROR_CODE(Code::PERMISSION_DENIED,
+                    CacheResponse(attributes_, denied_response, FakeTime(0)));
+  EXPECT_ERROR_CODE(Code::NOT_FOUND, Check(attributes1, FakeTime(1)));
+
+  // Not shared with another mesh config.
+  options.node_cache_config_id = "mesh-2";
+  cache_.reset(new CheckCache(options));
+  EXPECT_OK(CacheResponse(attributes1, response, FakeTime(0)));
+  EXPECT_ERROR_CODE(Code::NOT_FOUND, Check(attributes_, FakeTime(1)));
+}
+
+TEST_F(CheckCacheTest, TestNegativeCacheTtl) {
+  CheckOptions options;
+  options.negative_cache_ttl_ms = 10;
+  cache_ = std::unique_ptr<CheckCache>(new CheckCache(options));
+
+  CheckResponse denied_response;
+  denied_response.mutable_precondition()->set_valid_use_count(1000);
+  denied_response.mutable_precondition()->mutable_status()->set_code(
+      Code::PERMISSION_DENIED);
+  // Mixer says it is valid for 1 second.
+  *denied_response.mutable_precondition()->mutable_valid_duration() =
+      utils::CreateDuration(duration_cast<nanoseconds>(seconds(1)));
+  EXPECT_ERROR_CODE(Code::PERMISSION_DENIED,
+                    CacheResponse(attributes_, denied_response, FakeTime(0)));
+
+  EXPECT_ERROR_CODE(Code::PERMISSION_DENIED, Check(attributes_, FakeTime(1)));
+  // The denial is only cached for 10 milliseconds.
+  EXPECT_ERROR_CODE(Code::NOT_FOUND, Check(attributes_, FakeTime(11)));
+}
+
+TEST_F(CheckCacheTest, TestStaleWhileUnavailable) {
+  CheckOptions options;
+  options.stale_while_unavailable_ms = 1000;
+  cache_ = std::unique_ptr<CheckCache>(new CheckCache(options));
+
+  CheckResponse ok_response;
+  ok_response.mutable_precondition()->set_valid_use_count(1000);
+  // expired in 10 milliseconds.
+  *ok_response.mutable_precondition()->mutable_valid_duration() =
+      utils::CreateDuration(duration_cast<nanoseconds>(milliseconds(10)));
+  EXPECT_OK(CacheResponse(attributes_, ok_response, FakeTime(0)));
+
+  // Expired, and remote check calls are working.
+  EXPECT_ERROR_CODE(Code::NOT_FOUND, Check(attributes_, FakeTime(11)));
+
+  // A remote check call fails with network error.
+  CheckCache::CheckResult result;
+  cache_->Check(attributes_, &result);
+  result.SetResponse(Status(Code::UNAVAILABLE, ""), attributes_,
+                     CheckResponse());
+
+  // The expired item is used within 1 second after expiration.
+  EXPECT_OK(Check(attributes_, FakeTime(11)));
+  EXPECT_OK(Check(attributes_, FakeTime(1010)));
+  EXPECT_ERROR_CODE(Code::NOT_FOUND, Check(attributes_, FakeTime(1011)));
+
+  // A remote check call succeeds, the stale item is not used anymore.
+  CheckCache::CheckResult result1;
+  cache_->Check(attributes_, &result1);
+  result1.SetResponse(Status::OK, attributes_, CheckResponse());
+  EXPECT_ERROR_CODE(Code::NOT_FOUND, Check(attributes_, FakeTime(20)));
+}
+
+TEST_F(CheckCacheTest, TestRefreshAhead) {
+  CheckOptions options;
+  options.refresh_ahead_fraction = 0.5;
+  cache_ = std::unique_ptr<CheckCache>(new CheckCache(options));
+
+  CheckResponse ok_response;
+  ok_response.mutable_precondition()->set_valid_use_count(1000);
+  // expired in 10 milliseconds.
+  *ok_response.mutable_precondition()->mutable_valid_duration() =
+      utils::CreateDuration(duration_cast<nanoseconds>(milliseconds(10)));
+  EXPECT_OK(CacheResponse(attributes_, ok_response, FakeTime(0)));
+
+  CheckCache::CheckResult result;
+  EXPECT_OK(Check(attributes_, FakeTime(4), &result));
+  EXPECT_FALSE(result.NeedsRefresh());
+
+  // Half of valid_duration is used, only one caller refreshes it.
+  CheckCache::CheckResult result1;
+  EXPECT_OK(Check(attributes_, FakeTime(5), &result1));
+  EXPECT_TRUE(result1.NeedsRefresh());
+  CheckCache::CheckResult result2;
+  EXPECT_OK(Check(attributes_, FakeTime(6), &result2));
+  EXPECT_FALSE(result2.NeedsRefresh());
+
+  // The item is renewed, it is refreshed again half way.
+  EXPECT_OK(CacheResponse(attributes_, ok_response, FakeTime(7)));
+  CheckCache::CheckResult result3;
+  EXPECT_OK(Check(attributes_, FakeTime(11), &result3));
+  EXPECT_FALSE(result3.NeedsRefresh());
+  CheckCache::CheckResult result4;
+  EXPECT_OK(Check(attributes_, FakeTime(12), &result4));
+  EXPECT_TRUE(result4.NeedsRefresh());
+}
+
 TEST_F(CheckCacheTest, TestCheckResult) {
   CheckCache::CheckResult result;
   cache_->Check(attributes_, &result);
@@ -317,5 +521,480 @@ TEST_F(CheckCacheTest, TestTwoReferenced) {
   EXPECT_TRUE(result3.IsCacheHit());
 }
 
+
+TEST_F(CheckCacheTest, TestShardedCacheFromMultipleThreads) {
+  CheckOptions options;
+  options.num_shards = 4;
+  cache_ = std::unique_ptr<CheckCache>(new CheckCache(options));
+
+  CheckResponse ok_response;
+  ok_response.mutable_precondition()->set_valid_use_count(1000);
+  auto match = ok_response.mutable_precondition()
+                   ->mutable_referenced_attributes()
+                   ->add_attribute_matches();
+  match->set_condition(ReferencedAttributes::EXACT);
+  match->set_name(9);  // target.service is used.
+
+  const int kNumThreads = 4;
+  const int kNumKeys = 20;
+  std::vector<std::thread> threads;
+  for (int t = 0; t < kNumThreads; ++t) {
+    threads.emplace_back([this, t, &ok_response]() {
+      for (int i = 0; i < kNumKeys; ++i) {
+        Attributes attributes;
+        utils::AttributesBuilder(&attributes)
+            .AddString("target.service",
+                       "service-" + std::to_string(t * kNumKeys + i));
+        CheckCache::CheckResult result;
+        cache_->Check(attributes, &result);
+        result.SetResponse(Status::OK, attributes, ok_response);
+        EXPECT_OK(result.status());
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  // All keys from all threads should be in the cache.
+  for (int i = 0; i < kNumThreads * kNumKeys; ++i) {
+    Attributes attributes;
+    utils::AttributesBuilder(&attributes)
+        .AddString("target.service", "service-" + std::to_string(i));
+    CheckCache::CheckResult result;
+    cache_->Check(attributes, &result);
+    EXPECT_TRUE(result.IsCacheHit());
+  }
+}
+
+
+TEST_F(CheckCacheTest, TestShapeStats) {
+  CheckResponse ok_response;
+  ok_response.mutable_precondition()->set_valid_use_count(1000);
+  auto match = ok_response.mutable_precondition()
+                   ->mutable_referenced_attributes()
+                   ->add_attribute_matches();
+  match->set_condition(ReferencedAttributes::EXACT);
+  match->set_name(9);  // target.service is used.
+  EXPECT_OK(CacheResponse(attributes_, ok_response, FakeTime(0)));
+
+  Attributes attributes1;
+  utils::AttributesBuilder(&attributes1)
+      .AddString("target.name", "target name");
+  CheckResponse ok_response1;
+  ok_response1.mutable_precondition()->set_valid_use_count(1000);
+  auto match1 = ok_response1.mutable_precondition()
+                    ->mutable_referenced_attributes()
+                    ->add_attribute_matches();
+  match1->set_condition(ReferencedAttributes::EXACT);
+  match1->set_name(10);  // target.name is used.
+  EXPECT_OK(CacheResponse(attributes1, ok_response1, FakeTime(0)));
+
+  std::vector<ReferencedShapeStats> stats;
+  cache_->GetShapeStats(&stats);
+  ASSERT_EQ(stats.size(), 2);
+  EXPECT_EQ(stats[0].shape, "Absence-keys: Exact-keys: target.service, ");
+  EXPECT_EQ(stats[1].shape, "Absence-keys: Exact-keys: target.name, ");
+
+  // The second shape is hit more than twice, it is moved to the front.
+  EXPECT_OK(Check(attributes_, FakeTime(0)));
+  EXPECT_OK(Check(attributes1, FakeTime(0)));
+  EXPECT_OK(Check(attributes1, FakeTime(0)));
+  EXPECT_OK(Check(attributes1, FakeTime(0)));
+
+  // target.service matches the first shape, but is not in the cache.
+  Attributes attributes2;
+  utils::AttributesBuilder(&attributes2)
+      .AddString("target.service", "different target service");
+  EXPECT_ERROR_CODE(Code::NOT_FOUND, Check(attributes2, FakeTime(0)));
+
+  cache_->GetShapeStats(&stats);
+  ASSERT_EQ(stats.size(), 2);
+  EXPECT_EQ(stats[0].shape, "Absence-keys: Exact-keys: target.name, ");
+  EXPECT_EQ(stats[0].hits, 3);
+  EXPECT_EQ(stats[0].misses, 0);
+  EXPECT_EQ(stats[1].shape, "Absence-keys: Exact-keys: target.service, ");
+  EXPECT_EQ(stats[1].hits, 1);
+  EXPECT_EQ(stats[1].misses, 1);
+}
+
+
+TEST_F(CheckCacheTest, TestReplacedIndexesFreed) {
+  CheckResponse ok_response;
+  ok_response.mutable_precondition()->set_valid_use_count(1000);
+  auto match = ok_response.mutable_precondition()
+                   ->mutable_referenced_attributes()
+                   ->add_attribute_matches();
+  match->set_condition(ReferencedAttributes::EXACT);
+  match->set_name(9);  // target.service is used.
+
+  // Without a reader, a replaced version is freed at once.
+  EXPECT_OK(CacheResponse(attributes_, ok_response, FakeTime(0)));
+  EXPECT_EQ(NumUnfreedIndexes(), 0);
+
+  // A reader keeps the version it may use until it is gone.
+  auto reader = NewIndexReader();
+  utils::AttributesBuilder(&attributes_).AddString("target.name", "name");
+  match->set_name(10);  // target.name is used.
+  EXPECT_OK(CacheResponse(attributes_, ok_response, FakeTime(0)));
+  EXPECT_EQ(NumUnfreedIndexes(), 1);
+
+  // The readers of the new epoch don't hold the retired version.
+  auto new_reader = NewIndexReader();
+  reader.reset();
+  EXPECT_EQ(NumUnfreedIndexes(), 0);
+  new_reader.reset();
+}
+
+TEST_F(CheckCacheTest, TestEvictLeastRecentlyUsed) {
+  CheckOptions options(2);
+  cache_ = std::unique_ptr<CheckCache>(new CheckCache(options));
+
+  CheckResponse ok_response;
+  ok_response.mutable_precondition()->set_valid_use_count(1000);
+  auto match = ok_response.mutable_precondition()
+                   ->mutable_referenced_attributes()
+                   ->add_attribute_matches();
+  match->set_condition(ReferencedAttributes::EXACT);
+  match->set_name(9);  // target.service is used.
+
+  std::vector<Attributes> attributes(3);
+  for (int i = 0; i < 3; ++i) {
+    utils::AttributesBuilder(&attributes[i])
+        .AddString("target.service", "service-" + std::to_string(i));
+  }
+
+  EXPECT_OK(CacheResponse(attributes[0], ok_response, FakeTime(0)));
+  EXPECT_OK(CacheResponse(attributes[1], ok_response, FakeTime(1)));
+  // Use the first one, the second one becomes the least recently used.
+  EXPECT_OK(Check(attributes[0], FakeTime(2)));
+  EXPECT_OK(CacheResponse(attributes[2], ok_response, FakeTime(3)));
+
+  EXPECT_OK(Check(attributes[0], FakeTime(4)));
+  EXPECT_ERROR_CODE(Code::NOT_FOUND, Check(attributes[1], FakeTime(4)));
+  EXPECT_OK(Check(attributes[2], FakeTime(4)));
+}
+
+TEST_F(CheckCacheTest, TestSetCapacity) {
+  CheckOptions options(4);
+  cache_ = std::unique_ptr<CheckCache>(new CheckCache(options));
+
+  CheckResponse ok_response;
+  ok_response.mutable_precondition()->set_valid_use_count(1000);
+  auto match = ok_response.mutable_precondition()
+                   ->mutable_referenced_attributes()
+                   ->add_attribute_matches();
+  match->set_condition(ReferencedAttributes::EXACT);
+  match->set_name(9);  // target.service is used.
+
+  std::vector<Attributes> attributes(3);
+  for (int i = 0; i < 3; ++i) {
+    utils::AttributesBuilder(&attributes[i])
+        .AddString("target.service", "service-" + std::to_string(i));
+    EXPECT_OK(CacheResponse(attributes[i], ok_response, FakeTime(i)));
+  }
+  EXPECT_OK(Check(attributes[1], FakeTime(3)));
+
+  // Only the most recently used item is kept.
+  cache_->SetCapacity(1);
+  EXPECT_OK(Check(attributes[1], FakeTime(4)));
+  EXPECT_ERROR_CODE(Code::NOT_FOUND, Check(attributes[0], FakeTime(4)));
+  uint64_t misses, evictions;
+  cache_->GetDemand(&misses, &evictions);
+  EXPECT_EQ(misses, 1);
+  EXPECT_EQ(evictions, 0);
+
+  // The new item evicts the old one.
+  EXPECT_OK(CacheResponse(attributes[0], ok_response, FakeTime(5)));
+  EXPECT_ERROR_CODE(Code::NOT_FOUND, Check(attributes[1], FakeTime(6)));
+  cache_->GetDemand(&misses, &evictions);
+  EXPECT_EQ(misses, 2);
+  EXPECT_EQ(evictions, 1);
+}
+
+TEST_F(CheckCacheTest, TestEvictByPartition) {
+  CheckOptions options(8);
+  options.partition_attribute = "destination.service";
+  cache_ = std::unique_ptr<CheckCache>(new CheckCache(options));
+
+  CheckResponse ok_response;
+  ok_response.mutable_precondition()->set_valid_use_count(1000);
+  auto match = ok_response.mutable_precondition()
+                   ->mutable_referenced_attributes()
+                   ->add_attribute_matches();
+  match->set_condition(ReferencedAttributes::EXACT);
+  match->set_name(9);  // target.service is used.
+
+  auto make_attributes = [](const std::string& service, int i) {
+    Attributes attributes;
+    utils::AttributesBuilder builder(&attributes);
+    builder.AddString("destination.service", service);
+    builder.AddString("target.service", service + std::to_string(i));
+    return attributes;
+  };
+
+  // The quiet service has the least recently used item, the noisy one
+  // fills the rest of the cache.
+  EXPECT_OK(CacheResponse(make_attributes("quiet", 0), ok_response,
+                          FakeTime(0)));
+  for (int i = 1; i < 9; ++i) {
+    EXPECT_OK(CacheResponse(make_attributes("noisy", i), ok_response,
+                            FakeTime(i)));
+  }
+
+  // The oldest item of the noisy service, over its share, is evicted.
+  EXPECT_OK(Check(make_attributes("quiet", 0), FakeTime(10)));
+  EXPECT_ERROR_CODE(Code::NOT_FOUND,
+                    Check(make_attributes("noisy", 1), FakeTime(10)));
+  EXPECT_OK(Check(make_attributes("noisy", 8), FakeTime(10)));
+}
+
+TEST_F(CheckCacheTest, TestMaxBytes) {
+  CheckOptions options;
+  CheckResponse ok_response;
+  ok_response.mutable_precondition()->set_valid_use_count(1000);
+  auto match = ok_response.mutable_precondition()
+                   ->mutable_referenced_attributes()
+                   ->add_attribute_matches();
+  match->set_condition(ReferencedAttributes::EXACT);
+  match->set_name(9);  // target.service is used.
+
+  std::vector<Attributes> attributes(3);
+  for (int i = 0; i < 3; ++i) {
+    utils::AttributesBuilder(&attributes[i])
+        .AddString("target.service", "service-" + std::to_string(i));
+  }
+
+  // Without max_bytes, only limited by num_entries.
+  uint64_t num_entries, num_bytes;
+  for (int i = 0; i < 3; ++i) {
+    EXPECT_OK(CacheResponse(attributes[i], ok_response, FakeTime(i)));
+  }
+  cache_->GetCacheSize(&num_entries, &num_bytes);
+  EXPECT_EQ(num_entries, 3);
+  EXPECT_GT(num_bytes, 0);
+
+  // Only one item fits into max bytes.
+  options.max_bytes = 1;
+  cache_ = std::unique_ptr<CheckCache>(new CheckCache(options));
+  for (int i = 0; i < 3; ++i) {
+    EXPECT_OK(CacheResponse(attributes[i], ok_response, FakeTime(i)));
+  }
+  cache_->GetCacheSize(&num_entries, &num_bytes);
+  EXPECT_EQ(num_entries, 1);
+  EXPECT_ERROR_CODE(Code::NOT_FOUND, Check(attributes[1], FakeTime(4)));
+  EXPECT_OK(Check(attributes[2], FakeTime(4)));
+}
+
+
+TEST_F(CheckCacheTest, TestSweepExpired) {
+  CheckResponse ok_response;
+  ok_response.mutable_precondition()->set_valid_use_count(1000);
+  auto match = ok_response.mutable_precondition()
+                   ->mutable_referenced_attributes()
+                   ->add_attribute_matches();
+  match->set_condition(ReferencedAttributes::EXACT);
+  match->set_name(9);  // target.service is used.
+  CheckResponse short_response = ok_response;
+  // expired in 10 milliseconds.
+  *short_response.mutable_precondition()->mutable_valid_duration() =
+      utils::CreateDuration(duration_cast<nanoseconds>(milliseconds(10)));
+  CheckResponse once_response = ok_response;
+  once_response.mutable_precondition()->set_valid_use_count(1);
+
+  std::vector<Attributes> attributes(3);
+  for (int i = 0; i < 3; ++i) {
+    utils::AttributesBuilder(&attributes[i])
+        .AddString("target.service", "service-" + std::to_string(i));
+  }
+
+  EXPECT_OK(CacheResponse(attributes[0], short_response, FakeTime(0)));
+  EXPECT_OK(CacheResponse(attributes[1], once_response, FakeTime(0)));
+  EXPECT_OK(CacheResponse(attributes[2], ok_response, FakeTime(0)));
+  EXPECT_OK(Check(attributes[1], FakeTime(1)));
+  EXPECT_EQ(SweepExpired(10, FakeTime(1)), 1);
+
+  // A sweep visits a bounded number of items, the next one continues.
+  size_t removed = SweepExpired(1, FakeTime(20));
+  EXPECT_LE(removed, 1);
+  removed += SweepExpired(10, FakeTime(20));
+  EXPECT_EQ(removed, 1);
+
+  uint64_t num_entries, num_bytes;
+  cache_->GetCacheSize(&num_entries, &num_bytes);
+  EXPECT_EQ(num_entries, 1);
+  EXPECT_OK(Check(attributes[2], FakeTime(20)));
+
+  // Items usable while remote check calls are failing are kept.
+  CheckOptions options;
+  options.stale_while_unavailable_ms = 100;
+  cache_ = std::unique_ptr<CheckCache>(new CheckCache(options));
+  EXPECT_OK(CacheResponse(attributes[0], short_response, FakeTime(0)));
+  EXPECT_EQ(SweepExpired(10, FakeTime(20)), 0);
+  EXPECT_EQ(SweepExpired(10, FakeTime(120)), 1);
+}
+
+TEST_F(CheckCacheTest, TestSnapshot) {
+  CheckResponse ok_response;
+  ok_response.mutable_precondition()->set_valid_use_count(1000);
+  auto match = ok_response.mutable_precondition()
+                   ->mutable_referenced_attributes()
+                   ->add_attribute_matches();
+  match->set_condition(ReferencedAttributes::EXACT);
+  match->set_name(9);  // target.service is used.
+  CheckResponse expiring_response = ok_response;
+  expiring_response.mutable_precondition()->mutable_valid_duration()->set_nanos(
+      10 * 1000000);
+
+  Attributes attributes1;
+  utils::AttributesBuilder(&attributes1)
+      .AddString("target.service", "service1");
+  EXPECT_OK(CacheResponse(attributes_, ok_response, FakeTime(0)));
+  EXPECT_OK(CacheResponse(attributes1, expiring_response, FakeTime(0)));
+
+  std::string data;
+  SaveSnapshot(&data, FakeTime(5));
+
+  // Corrupted snapshots are rejected.
+  cache_ = std::unique_ptr<CheckCache>(new CheckCache(CheckOptions()));
+  EXPECT_ERROR_CODE(Code::INVALID_ARGUMENT, LoadSnapshot("", FakeTime(20)));
+  EXPECT_ERROR_CODE(Code::INVALID_ARGUMENT,
+                    LoadSnapshot(data.substr(0, data.size() - 1),
+                                 FakeTime(20)));
+  EXPECT_ERROR_CODE(Code::INVALID_ARGUMENT,
+                    LoadSnapshot(data + "x", FakeTime(20)));
+  EXPECT_ERROR_CODE(Code::NOT_FOUND, Check(attributes_, FakeTime(20)));
+
+  // The item expired since the snapshot is not loaded.
+  EXPECT_OK(LoadSnapshot(data, FakeTime(20)));
+  EXPECT_OK(Check(attributes_, FakeTime(20)));
+  EXPECT_ERROR_CODE(Code::NOT_FOUND, Check(attributes1, FakeTime(20)));
+
+  std::vector<ReferencedShapeStats> stats;
+  cache_->GetShapeStats(&stats);
+  ASSERT_EQ(stats.size(), 1);
+
+  // A snapshot with only the shape learned, but no items.
+  SaveSnapshot(&data, FakeTime(20));
+  cache_ = std::unique_ptr<CheckCache>(new CheckCache(CheckOptions()));
+  EXPECT_OK(LoadSnapshot(data, FakeTime(20)));
+  cache_->GetShapeStats(&stats);
+  ASSERT_EQ(stats.size(), 1);
+  uint64_t num_entries, num_bytes;
+  cache_->GetCacheSize(&num_entries, &num_bytes);
+  EXPECT_EQ(num_entries, 1);
+}
+
+TEST_F(CheckCacheTest, TestPeriodicSnapshot) {
+  const char* dir = getenv("TEST_TMPDIR");
+  CheckOptions options;
+  options.snapshot_file = std::string(dir ? dir : "/tmp") + "/cache_snapshot";
+  options.snapshot_interval_ms = 1000;
+  remove(options.snapshot_file.c_str());
+  time_point<system_clock> start = system_clock::now();
+  cache_.reset(new CheckCache(options));
+  EXPECT_EQ(cache_->snapshot_interval_ms(), 1000);
+
+  CheckResponse response;
+  response.mutable_precondition()->set_valid_use_count(1000);
+  auto match = response.mutable_precondition()
+                   ->mutable_referenced_attributes()
+                   ->add_attribute_matches();
+  match->set_condition(ReferencedAttributes::EXACT);
+  match->set_name(9);  // target.service is used.
+  EXPECT_OK(CacheResponse(attributes_, response, start));
+
+  EXPECT_FALSE(SaveSnapshotIfDue(start));
+  EXPECT_FALSE(fopen(options.snapshot_file.c_str(), "rb"));
+  // Only the first client due saves it.
+  time_point<system_clock> due = start + milliseconds(2000);
+  EXPECT_TRUE(SaveSnapshotIfDue(due));
+  EXPECT_FALSE(SaveSnapshotIfDue(due));
+
+  // Loaded by the next cache without this one being destroyed.
+  std::unique_ptr<CheckCache> saved = std::move(cache_);
+  cache_.reset(new CheckCache(options));
+  EXPECT_OK(Check(attributes_, due));
+
+  // No periodic snapshots without a file.
+  cache_.reset(new CheckCache(CheckOptions()));
+  EXPECT_EQ(cache_->snapshot_interval_ms(), 0);
+  EXPECT_FALSE(SaveSnapshotIfDue(due));
+}
+
+TEST_F(CheckCacheTest, TestInternedStatusNotCopied) {
+  CheckResponse denied_response;
+  denied_response.mutable_precondition()->set_valid_use_count(1000);
+  auto match = denied_response.mutable_precondition()
+                   ->mutable_referenced_attributes()
+                   ->add_attribute_matches();
+  match->set_condition(ReferencedAttributes::EXACT);
+  match->set_name(9);  // target.service is used.
+  denied_response.mutable_precondition()->mutable_status()->set_code(
+      Code::PERMISSION_DENIED);
+  denied_response.mutable_precondition()->mutable_status()->set_message(
+      "denied");
+
+  std::vector<Attributes> attributes(2);
+  std::vector<CheckCache::CheckResult> results(2);
+  for (int i = 0; i < 2; ++i) {
+    utils::AttributesBuilder(&attributes[i])
+        .AddString("target.service", "service" + std::to_string(i));
+    EXPECT_ERROR_CODE(Code::PERMISSION_DENIED,
+                      CacheResponse(attributes[i], denied_response,
+                                    FakeTime(0)));
+    EXPECT_ERROR_CODE(Code::PERMISSION_DENIED,
+                      Check(attributes[i], FakeTime(1), &results[i]));
+    EXPECT_TRUE(results[i].IsCacheHit());
+  }
+  // Both hits return the interned status of the cache, not a copy.
+  EXPECT_EQ(&results[0].status(), &results[1].status());
+}
+
+TEST_F(CheckCacheTest, TestCompactItems) {
+  CheckResponse response;
+  response.mutable_precondition()->set_valid_use_count(-1);
+  *response.mutable_precondition()->mutable_valid_duration() =
+      utils::CreateDuration(duration_cast<nanoseconds>(hours(20 * 24)));
+  auto match = response.mutable_precondition()
+                   ->mutable_referenced_attributes()
+                   ->add_attribute_matches();
+  match->set_condition(ReferencedAttributes::EXACT);
+  match->set_name(9);  // target.service is used.
+  CheckResponse denied_response = response;
+  denied_response.mutable_precondition()->mutable_status()->set_code(
+      Code::PERMISSION_DENIED);
+  denied_response.mutable_precondition()->mutable_status()->set_message(
+      "denied");
+
+  std::vector<Attributes> attributes(3);
+  for (int i = 0; i < 3; ++i) {
+    utils::AttributesBuilder(&attributes[i])
+        .AddString("target.service", "service" + std::to_string(i));
+  }
+  time_point<system_clock> start =
+      time_point_cast<milliseconds>(system_clock::now());
+  EXPECT_OK(CacheResponse(attributes[0], response, start));
+  EXPECT_ERROR_CODE(Code::PERMISSION_DENIED,
+                    CacheResponse(attributes[1], denied_response, start));
+  // The same denial is interned once.
+  EXPECT_ERROR_CODE(Code::PERMISSION_DENIED,
+                    CacheResponse(attributes[2], denied_response, start));
+  EXPECT_EQ(NumInternedStatuses(), 1);
+
+  // The item times are 32 bits, so the epoch is moved by an item added
+  // more than 12 days later. The items keep their expiration.
+  time_point<system_clock> later = start + hours(13 * 24);
+  EXPECT_OK(CacheResponse(attributes[2], response, later));
+  EXPECT_OK(Check(attributes[0], start + hours(20 * 24)));
+  EXPECT_ERROR_CODE(Code::PERMISSION_DENIED,
+                    Check(attributes[1], start + hours(20 * 24)));
+  EXPECT_ERROR_CODE(Code::NOT_FOUND,
+                    Check(attributes[0], start + hours(20 * 24) + seconds(1)));
+  EXPECT_OK(Check(attributes[2], later + hours(20 * 24)));
+  EXPECT_ERROR_CODE(Code::NOT_FOUND,
+                    Check(attributes[2], later + hours(20 * 24) + seconds(1)));
+}
+
 }  // namespace mixerclient
 }  // namespace istio
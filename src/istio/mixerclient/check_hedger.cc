@@ -0,0 +1,193 @@
+/* Copyright 2018 Istio Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/istio/mixerclient/check_hedger.h"
+
+#include <algorithm>
+#include <chrono>
+
+using ::google::protobuf::util::Status;
+using ::istio::mixer::v1::CheckRequest;
+using ::istio::mixer::v1::CheckResponse;
+
+namespace istio {
+namespace mixerclient {
+namespace {
+
+// The number of recent round trip times kept.
+const size_t kNumRtts = 128;
+
+// The delay is updated once per this many round trip times, and is known
+// once there are this many of them.
+const size_t kRttsPerUpdate = 16;
+
+}  // namespace
+
+// The state of a hedged call, shared by its callbacks.
+struct CheckHedger::Call {
+  TransportCheckFunc transport;
+  const CheckRequest* request;
+  CheckResponse* response;
+  // The response of the hedged call, swapped into response if it wins.
+  CheckResponse hedged_response;
+  DoneFunc on_done;
+  // The cancel functions of the remote calls, reset once they are done.
+  CancelFunc cancel;
+  CancelFunc hedged_cancel;
+  std::unique_ptr<Timer> timer;
+  std::chrono::steady_clock::time_point start;
+  // The number of remote calls in flight.
+  int inflight;
+  bool hedged_inflight;
+  bool hedged_sent;
+  bool done;
+};
+
+CheckHedger::CheckHedger(const CheckOptions& options,
+                         TimerCreateFunc timer_create)
+    : options_(options),
+      timer_create_(timer_create),
+      next_rtt_(0),
+      delay_ms_(-1),
+      total_hedged_calls_(0) {
+  rtts_.reserve(kNumRtts);
+}
+
+CancelFunc CheckHedger::Send(TransportCheckFunc transport,
+                             const CheckRequest& request,
+                             CheckResponse* response, DoneFunc on_done) {
+  auto call = std::make_shared<Call>();
+  call->transport = transport;
+  call->request = &request;
+  call->response = response;
+  call->on_done = on_done;
+  call->start = std::chrono::steady_clock::now();
+  call->inflight = 1;
+  call->hedged_inflight = false;
+  call->hedged_sent = false;
+  call->done = false;
+
+  CancelFunc cancel = transport(request, response, [this, call](
+                                                       const Status& status) {
+    OnDone(call, false, status);
+  });
+  if (call->done) {
+    return nullptr;
+  }
+  call->cancel = cancel;
+
+  int delay_ms = delay_ms_;
+  if (delay_ms >= 0 && timer_create_) {
+    std::weak_ptr<Call> weak_call = call;
+    call->timer = timer_create_([this, weak_call]() {
+      auto call = weak_call.lock();
+      if (call) {
+        OnTimer(call);
+      }
+    });
+    call->timer->Start(std::max(delay_ms, options_.hedge_min_delay_ms));
+  }
+
+  return [call]() {
+    if (call->done) {
+      return;
+    }
+    call->done = true;
+    if (call->timer) {
+      call->timer->Stop();
+    }
+    if (call->cancel) {
+      call->cancel();
+    }
+    if (call->hedged_cancel) {
+      call->hedged_cancel();
+    }
+  };
+}
+
+void CheckHedger::OnTimer(const std::shared_ptr<Call>& call) {
+  if (call->done || call->hedged_sent) {
+    return;
+  }
+  call->hedged_sent = true;
+  ++total_hedged_calls_;
+  ++call->inflight;
+  call->hedged_inflight = true;
+  CancelFunc cancel = call->transport(
+      *call->request, &call->hedged_response,
+      [this, call](const Status& status) { OnDone(call, true, status); });
+  // A call done inline, even a failed one not finishing the call, can't
+  // be cancelled any more.
+  if (call->hedged_inflight) {
+    call->hedged_cancel = cancel;
+  }
+}
+
+void CheckHedger::OnDone(const std::shared_ptr<Call>& call, bool hedged,
+                         const Status& status) {
+  --call->inflight;
+  if (hedged) {
+    call->hedged_inflight = false;
+    call->hedged_cancel = nullptr;
+  } else {
+    call->cancel = nullptr;
+  }
+  if (call->done) {
+    return;
+  }
+  // Wait for the other call if this one failed.
+  if (!status.ok() && call->inflight > 0) {
+    return;
+  }
+  call->done = true;
+  if (call->timer) {
+    call->timer->Stop();
+  }
+  if (status.ok()) {
+    AddRtt(std::chrono::duration_cast<std::chrono::microseconds>(
+               std::chrono::steady_clock::now() - call->start)
+               .count());
+  }
+  if (hedged) {
+    call->response->Swap(&call->hedged_response);
+    if (call->cancel) {
+      call->cancel();
+    }
+  } else if (call->hedged_cancel) {
+    call->hedged_cancel();
+  }
+  call->on_done(status);
+}
+
+void CheckHedger::AddRtt(int64_t rtt_us) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (rtts_.size() < kNumRtts) {
+    rtts_.push_back(rtt_us);
+  } else {
+    rtts_[next_rtt_] = rtt_us;
+  }
+  next_rtt_ = (next_rtt_ + 1) % kNumRtts;
+  if (rtts_.size() < kRttsPerUpdate || next_rtt_ % kRttsPerUpdate != 0) {
+    return;
+  }
+
+  std::vector<int64_t> sorted(rtts_);
+  size_t index = sorted.size() * options_.hedge_percentile / 100;
+  std::nth_element(sorted.begin(), sorted.begin() + index, sorted.end());
+  delay_ms_ = static_cast<int>(sorted[index] / 1000);
+}
+
+}  // namespace mixerclient
+}  // namespace istio
@@ -0,0 +1,85 @@
+/* Copyright 2018 Istio Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ISTIO_MIXERCLIENT_CHECK_HEDGER_H
+#define ISTIO_MIXERCLIENT_CHECK_HEDGER_H
+
+#include "include/istio/mixerclient/client.h"
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+namespace istio {
+namespace mixerclient {
+
+// Hedges remote check calls. If a call has not returned after a percentile
+// of the recent round trip times, the same request is sent again, with the
+// same deduplication_id, and the first response is used. A failed call
+// waits for the other one if it is still in flight.
+// Calls and their callbacks should be on one thread, as Envoy workers are.
+class CheckHedger {
+ public:
+  CheckHedger(const CheckOptions& options, TimerCreateFunc timer_create);
+
+  // Sends a request with the transport. The request has to be valid until
+  // on_done is called or the call is cancelled.
+  CancelFunc Send(TransportCheckFunc transport,
+                  const ::istio::mixer::v1::CheckRequest& request,
+                  ::istio::mixer::v1::CheckResponse* response,
+                  DoneFunc on_done);
+
+  // Returns the delay before a call is hedged, or -1 if there are not
+  // enough round trip times yet.
+  int delay_ms() const { return delay_ms_; }
+
+  // The number of hedged calls sent.
+  uint64_t total_hedged_calls() const { return total_hedged_calls_; }
+
+ private:
+  struct Call;
+
+  // Finishes a call with the status of one of its remote calls.
+  void OnDone(const std::shared_ptr<Call>& call, bool hedged,
+              const ::google::protobuf::util::Status& status);
+
+  // Sends the hedged call if the first one is still in flight.
+  void OnTimer(const std::shared_ptr<Call>& call);
+
+  // Records a round trip time, and updates the delay.
+  void AddRtt(int64_t rtt_us);
+
+  // The check options.
+  const CheckOptions options_;
+  // timer create func
+  TimerCreateFunc timer_create_;
+
+  // Mutex guarding rtts_ and next_rtt_.
+  std::mutex mutex_;
+  // The recent round trip times in microseconds, used as a ring.
+  std::vector<int64_t> rtts_;
+  size_t next_rtt_;
+
+  // The current delay before hedging.
+  std::atomic_int delay_ms_;
+  std::atomic<uint64_t> total_hedged_calls_;
+
+  GOOGLE_DISALLOW_EVIL_CONSTRUCTORS(CheckHedger);
+};
+
+}  // namespace mixerclient
+}  // namespace istio
+
+#endif  // ISTIO_MIXERCLIENT_CHECK_HEDGER_H
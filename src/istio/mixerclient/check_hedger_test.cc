@@ -0,0 +1,183 @@
+/* Copyright 2018 Istio Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/istio/mixerclient/check_hedger.h"
+#include "gtest/gtest.h"
+
+using ::google::protobuf::util::Status;
+using ::google::protobuf::util::error::Code;
+using ::istio::mixer::v1::CheckRequest;
+using ::istio::mixer::v1::CheckResponse;
+
+namespace istio {
+namespace mixerclient {
+namespace {
+
+class MockTimer : public Timer {
+ public:
+  void Stop() override { started_ = false; }
+  void Start(int interval_ms) override {
+    started_ = true;
+    interval_ms_ = interval_ms;
+  }
+  std::function<void()> cb_;
+  bool started_ = false;
+  int interval_ms_ = 0;
+};
+
+class CheckHedgerTest : public ::testing::Test {
+ public:
+  CheckHedgerTest() : mock_timer_(nullptr), cancel_count_(0) {
+    CheckOptions options;
+    options.hedge_percentile = 90;
+    options.hedge_min_delay_ms = 5;
+    hedger_.reset(new CheckHedger(options, [this](std::function<void()> cb)
+                                               -> std::unique_ptr<Timer> {
+      mock_timer_ = new MockTimer;
+      mock_timer_->cb_ = cb;
+      return std::unique_ptr<Timer>(mock_timer_);
+    }));
+    transport_ = [this](const CheckRequest& request, CheckResponse* response,
+                        DoneFunc on_done) -> CancelFunc {
+      responses_.push_back(response);
+      pending_.push_back(on_done);
+      return [this]() { ++cancel_count_; };
+    };
+  }
+
+  // Sends calls answered right away, so the delay is known.
+  void LearnDelay() {
+    auto transport = [](const CheckRequest& request, CheckResponse* response,
+                        DoneFunc on_done) -> CancelFunc {
+      on_done(Status::OK);
+      return nullptr;
+    };
+    CheckResponse response;
+    for (int i = 0; i < 16; ++i) {
+      hedger_->Send(transport, request_, &response, [](const Status&) {});
+    }
+  }
+
+  MockTimer* mock_timer_;
+  int cancel_count_;
+  std::unique_ptr<CheckHedger> hedger_;
+  TransportCheckFunc transport_;
+  std::vector<CheckResponse*> responses_;
+  std::vector<DoneFunc> pending_;
+  CheckRequest request_;
+};
+
+TEST_F(CheckHedgerTest, TestNoDelayYet) {
+  CheckResponse response;
+  hedger_->Send(transport_, request_, &response, [](const Status&) {});
+  // No timer to hedge without round trip times.
+  EXPECT_EQ(mock_timer_, nullptr);
+  EXPECT_EQ(hedger_->delay_ms(), -1);
+}
+
+TEST_F(CheckHedgerTest, TestHedgedResponseWins) {
+  LearnDelay();
+  EXPECT_EQ(hedger_->delay_ms(), 0);
+
+  CheckResponse response;
+  Status done_status(Code::UNKNOWN, "");
+  int done_count = 0;
+  hedger_->Send(transport_, request_, &response, [&](const Status& status) {
+    done_status = status;
+    ++done_count;
+  });
+  ASSERT_NE(mock_timer_, nullptr);
+  EXPECT_TRUE(mock_timer_->started_);
+  EXPECT_EQ(mock_timer_->interval_ms_, 5);
+  mock_timer_->cb_();
+  ASSERT_EQ(pending_.size(), 2);
+  EXPECT_EQ(hedger_->total_hedged_calls(), 1);
+
+  // The hedged call returns first, the first call is cancelled.
+  responses_[1]->mutable_precondition()->set_valid_use_count(10);
+  pending_[1](Status::OK);
+  EXPECT_EQ(done_count, 1);
+  EXPECT_TRUE(done_status.ok());
+  EXPECT_EQ(response.precondition().valid_use_count(), 10);
+  EXPECT_EQ(cancel_count_, 1);
+}
+
+TEST_F(CheckHedgerTest, TestFailureWaitsForOther) {
+  LearnDelay();
+
+  CheckResponse response;
+  Status done_status(Code::UNKNOWN, "");
+  int done_count = 0;
+  hedger_->Send(transport_, request_, &response, [&](const Status& status) {
+    done_status = status;
+    ++done_count;
+  });
+  mock_timer_->cb_();
+  ASSERT_EQ(pending_.size(), 2);
+
+  // The first call fails, the hedged call is still in flight.
+  pending_[0](Status(Code::UNAVAILABLE, ""));
+  EXPECT_EQ(done_count, 0);
+  pending_[1](Status::OK);
+  EXPECT_EQ(done_count, 1);
+  EXPECT_TRUE(done_status.ok());
+  EXPECT_EQ(cancel_count_, 0);
+}
+
+TEST_F(CheckHedgerTest, TestInlineHedgedFailure) {
+  LearnDelay();
+
+  // The first call is in flight, the hedged call fails right away.
+  int num_calls = 0;
+  int hedged_cancel_count = 0;
+  auto transport = [&](const CheckRequest& request, CheckResponse* response,
+                       DoneFunc on_done) -> CancelFunc {
+    if (num_calls++ == 0) {
+      return transport_(request, response, on_done);
+    }
+    on_done(Status(Code::UNAVAILABLE, ""));
+    return [&]() { ++hedged_cancel_count; };
+  };
+  CheckResponse response;
+  int done_count = 0;
+  CancelFunc cancel =
+      hedger_->Send(transport, request_, &response,
+                    [&](const Status& status) { ++done_count; });
+  mock_timer_->cb_();
+  EXPECT_EQ(num_calls, 2);
+  EXPECT_EQ(done_count, 0);
+
+  // The done hedged call is not cancelled with the first one.
+  cancel();
+  EXPECT_EQ(cancel_count_, 1);
+  EXPECT_EQ(hedged_cancel_count, 0);
+  EXPECT_EQ(done_count, 0);
+}
+
+TEST_F(CheckHedgerTest, TestFirstResponseStopsTimer) {
+  LearnDelay();
+
+  CheckResponse response;
+  int done_count = 0;
+  hedger_->Send(transport_, request_, &response,
+                [&](const Status& status) { ++done_count; });
+  pending_[0](Status::OK);
+  EXPECT_EQ(done_count, 1);
+  EXPECT_FALSE(mock_timer_->started_);
+}
+
+}  // namespace
+}  // namespace mixerclient
+}  // namespace istio
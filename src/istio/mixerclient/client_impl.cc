@@ -14,7 +14,13 @@
  */
 #include "src/istio/mixerclient/client_impl.h"
 #include "include/istio/mixerclient/check_response.h"
+#include "include/istio/utils/alloc_accounting.h"
 #include "include/istio/utils/protobuf.h"
+#include "include/istio/utils/tracepoint.h"
+
+#include <algorithm>
+#include <chrono>
+#include <type_traits>
 
 using ::google::protobuf::util::Status;
 using ::google::protobuf::util::error::Code;
@@ -26,117 +32,698 @@ using ::istio::mixer::v1::ReportResponse;
 
 namespace istio {
 namespace mixerclient {
+namespace {
+
+// The maximum number of free check contexts kept for reuse.
+const size_t kMaxFreeCheckContexts = 64;
+
+// The first arena block size of a check context. It holds the request,
+// the response and the attributes copy of a check call with about 40
+// attributes.
+const size_t kCheckArenaBlockSize = 16 * 1024;
+
+// The limit of the first arena block size, larger calls allocate more
+// blocks.
+const size_t kMaxCheckArenaBlockSize = 256 * 1024;
+
+// Creates a message on the arena. The nested messages and strings of a
+// message type built without arena support are still on the heap.
+template <class T>
+T *CreateMessage(::google::protobuf::Arena *arena, std::true_type) {
+  return ::google::protobuf::Arena::CreateMessage<T>(arena);
+}
+
+template <class T>
+T *CreateMessage(::google::protobuf::Arena *arena, std::false_type) {
+  return ::google::protobuf::Arena::Create<T>(arena);
+}
+
+template <class T>
+T *CreateMessage(::google::protobuf::Arena *arena) {
+  return CreateMessage<T>(
+      arena, std::integral_constant<
+                 bool, ::google::protobuf::Arena::is_arena_constructable<
+                           T>::value>());
+}
+
+::google::protobuf::ArenaOptions CheckArenaOptions(char *block,
+                                                   size_t block_size) {
+  ::google::protobuf::ArenaOptions options;
+  options.initial_block = block;
+  options.initial_block_size = block_size;
+  options.start_block_size = block_size;
+  return options;
+}
+
+// Sets up a compressor for the reports of a client.
+void InitCompressor(const MixerClientOptions &options,
+                    AttributeCompressor *compressor) {
+  compressor->set_max_report_value_bytes(
+      options.report_options.max_attribute_value_bytes);
+  if (options.global_words_extension) {
+    compressor->ExtendGlobalDictionary(*options.global_words_extension);
+  }
+}
+
+// Clears the report statistics of a client using a shared batch.
+void ClearReportBatchStatistics(Statistics *stat) {
+  stat->total_report_calls = 0;
+  stat->total_remote_report_calls = 0;
+  stat->total_dropped_report_calls = 0;
+  stat->total_report_batches_full_entries = 0;
+  stat->total_report_batches_full_bytes = 0;
+  stat->total_report_batches_timed = 0;
+  stat->total_report_batches_delta_break = 0;
+  stat->total_report_batches_evicted = 0;
+  stat->total_overload_dropped_report_calls = 0;
+  stat->total_spilled_report_batches = 0;
+  stat->inflight_report_batches = 0;
+  stat->buffered_report_bytes = 0;
+  stat->open_report_batches = 0;
+  stat->open_report_entries = 0;
+}
+
+// The members of a shared report batch, constructed before the batch.
+struct SharedReportBatchMembers {
+  SharedReportBatchMembers(const MixerClientOptions &options)
+      : stats_sink(options.env.stats_sink) {
+    InitCompressor(options, &compressor);
+  }
+
+  AttributeCompressor compressor;
+  // Kept alive for the batch, which only has the pointer.
+  std::shared_ptr<StatsSink> stats_sink;
+};
+
+// A report batch with its own compressor, shared by multiple clients.
+class SharedReportBatch : private SharedReportBatchMembers,
+                          public ReportBatch {
+ public:
+  SharedReportBatch(const MixerClientOptions &options)
+      : SharedReportBatchMembers(options),
+        ReportBatch(options.report_options, options.env.report_transport,
+                    options.env.timer_create_func, compressor,
+                    stats_sink.get(), options.env.threading_model) {}
+};
+
+}  // namespace
 
 MixerClientImpl::MixerClientImpl(const MixerClientOptions &options)
-    : options_(options) {
-  check_cache_ =
-      std::unique_ptr<CheckCache>(new CheckCache(options.check_options));
-  report_batch_ = std::unique_ptr<ReportBatch>(
-      new ReportBatch(options.report_options, options_.env.report_transport,
-                      options.env.timer_create_func, compressor_));
-  quota_cache_ =
-      std::unique_ptr<QuotaCache>(new QuotaCache(options.quota_options));
+    : options_(options),
+      alive_(std::make_shared<bool>(true)),
+      next_call_id_(0),
+      check_arena_block_size_(kCheckArenaBlockSize) {
+  const bool thread_safe =
+      options.env.threading_model == ThreadingModel::SHARED;
+  inflight_mutex_.set_enabled(thread_safe);
+  free_check_contexts_mutex_.set_enabled(thread_safe);
+  InitCompressor(options, &compressor_);
+  if (options.check_options.shared_cache) {
+    check_cache_ = options.check_options.shared_cache;
+  } else {
+    check_cache_ = std::shared_ptr<CheckCache>(
+        new CheckCache(options.check_options, options.env.threading_model));
+  }
+  if (options.report_options.shared_batch) {
+    report_batch_ = options.report_options.shared_batch;
+  } else {
+    report_batch_ = std::shared_ptr<ReportBatch>(new ReportBatch(
+        options.report_options, options_.env.report_transport,
+        options.env.timer_create_func, compressor_,
+        options_.env.stats_sink.get(), options.env.threading_model));
+    if (!options_.env.extra_report_transports.empty()) {
+      report_batch_->AddChannels(options_.env.extra_report_transports);
+    }
+  }
+  if (options.quota_options.shared_cache) {
+    quota_cache_ = options.quota_options.shared_cache;
+  } else {
+    quota_cache_ = std::shared_ptr<QuotaCache>(
+        new QuotaCache(options.quota_options, options.env.threading_model));
+  }
+  // Batched calls are flushed by a timer with the default transport.
+  if (options.quota_options.batch_window_ms > 0 &&
+      options.env.timer_create_func && options.env.check_transport) {
+    quota_batch_ = std::unique_ptr<QuotaBatch>(new QuotaBatch(
+        options.quota_options, options.env.timer_create_func,
+        [this](std::unique_ptr<QuotaBatch::Batch> batch) {
+          SendQuotaBatch(std::move(batch));
+        },
+        options.env.threading_model));
+  }
+
+  if (options.check_options.hedge_percentile > 0 &&
+      options.check_options.hedge_percentile < 100 &&
+      options.env.timer_create_func) {
+    check_hedger_ = std::unique_ptr<CheckHedger>(new CheckHedger(
+        options.check_options, options.env.timer_create_func));
+  }
+  if (CheckBreaker::Enabled(options.check_options)) {
+    check_breaker_ = std::unique_ptr<CheckBreaker>(new CheckBreaker(
+        options.check_options, options.env.threading_model));
+  }
 
   if (options_.env.uuid_generate_func) {
     deduplication_id_base_ = options_.env.uuid_generate_func();
   }
+  deduplication_id_ = 0;
+  overloaded_ = false;
 
   total_check_calls_ = 0;
   total_remote_check_calls_ = 0;
   total_blocking_remote_check_calls_ = 0;
+  total_coalesced_check_calls_ = 0;
   total_quota_calls_ = 0;
   total_remote_quota_calls_ = 0;
   total_blocking_remote_quota_calls_ = 0;
+  total_check_cache_swept_items_ = 0;
+  total_quota_cache_swept_items_ = 0;
+  total_overload_shed_check_calls_ = 0;
+  total_overload_evicted_cache_items_ = 0;
+  total_breaker_shed_check_calls_ = 0;
+  total_report_calls_ = 0;
+
+  StartCacheSweeps();
+
+  // Shared caches are sized for the process already.
+  budget_check_capacity_ = 0;
+  budget_quota_capacity_ = 0;
+  if (options.cache_budget && options.env.timer_create_func &&
+      (!options.check_options.shared_cache ||
+       !options.quota_options.shared_cache)) {
+    budget_share_ = options.cache_budget->Join();
+    SyncCacheBudget();
+    int interval_ms = options.cache_budget->sync_interval_ms();
+    budget_timer_ = options.env.timer_create_func([this, interval_ms]() {
+      SyncCacheBudget();
+      budget_timer_->Start(interval_ms);
+    });
+    budget_timer_->Start(interval_ms);
+  }
 }
 
-MixerClientImpl::~MixerClientImpl() {}
+void MixerClientImpl::SyncCacheBudget() {
+  uint64_t misses, evictions;
+  check_cache_->GetDemand(&misses, &evictions);
+  budget_share_->check_demand = misses + evictions;
+  budget_share_->quota_demand = quota_cache_->GetDemand();
+
+  int64_t check_capacity = budget_share_->check_capacity;
+  if (options_.cache_budget->check_capacity() > 0 &&
+      !options_.check_options.shared_cache &&
+      check_capacity != budget_check_capacity_) {
+    check_cache_->SetCapacity(check_capacity);
+    budget_check_capacity_ = check_capacity;
+  }
+  int64_t quota_capacity = budget_share_->quota_capacity;
+  if (options_.cache_budget->quota_capacity() > 0 &&
+      !options_.quota_options.shared_cache &&
+      quota_capacity != budget_quota_capacity_) {
+    quota_cache_->SetCapacity(quota_capacity);
+    budget_quota_capacity_ = quota_capacity;
+  }
+}
+
+void MixerClientImpl::StartCacheSweeps() {
+  if (!options_.env.timer_create_func) {
+    return;
+  }
+  // Each timer sweeps a batch of items and is re-armed for the next one.
+  int check_interval_ms = options_.check_options.sweep_interval_ms;
+  if (check_interval_ms > 0 && check_cache_->CachesResponses()) {
+    check_sweep_timer_ =
+        options_.env.timer_create_func([this, check_interval_ms]() {
+          AddCounter(StatsCounter::CHECK_CACHE_SWEPT_ITEMS,
+                     &total_check_cache_swept_items_,
+                     check_cache_->SweepExpired(
+                         options_.check_options.sweep_max_items));
+          check_sweep_timer_->Start(check_interval_ms);
+        });
+    check_sweep_timer_->Start(check_interval_ms);
+  }
+  int snapshot_interval_ms = check_cache_->snapshot_interval_ms();
+  if (snapshot_interval_ms > 0) {
+    snapshot_timer_ =
+        options_.env.timer_create_func([this, snapshot_interval_ms]() {
+          check_cache_->SaveSnapshotIfDue();
+          snapshot_timer_->Start(snapshot_interval_ms);
+        });
+    snapshot_timer_->Start(snapshot_interval_ms);
+  }
+  int quota_interval_ms = options_.quota_options.sweep_interval_ms;
+  if (quota_interval_ms > 0) {
+    quota_sweep_timer_ =
+        options_.env.timer_create_func([this, quota_interval_ms]() {
+          AddCounter(StatsCounter::QUOTA_CACHE_SWEPT_ITEMS,
+                     &total_quota_cache_swept_items_,
+                     quota_cache_->SweepExpired(
+                         options_.quota_options.sweep_max_items));
+          quota_sweep_timer_->Start(quota_interval_ms);
+        });
+    quota_sweep_timer_->Start(quota_interval_ms);
+  }
+}
+
+MixerClientImpl::~MixerClientImpl() {
+  // The batched calls are sent while all the members are alive, their
+  // batches would only send them once some members are destroyed.
+  if (quota_batch_) {
+    quota_batch_->Flush();
+  }
+  alive_.reset();
+}
+
+void MixerClientImpl::AddCounter(StatsCounter counter,
+                                 std::atomic_int_fast64_t *total,
+                                 uint64_t value) {
+  if (value == 0) {
+    return;
+  }
+  *total += value;
+  if (options_.env.stats_sink) {
+    options_.env.stats_sink->AddCounter(counter, value);
+  }
+}
 
 CancelFunc MixerClientImpl::Check(
     const Attributes &attributes,
     const std::vector<::istio::quota_config::Requirement> &quotas,
     TransportCheckFunc transport, CheckDoneFunc on_done) {
-  ++total_check_calls_;
+  return Check(attributes, nullptr, nullptr, quotas, transport, on_done);
+}
 
-  std::unique_ptr<CheckCache::CheckResult> check_result(
-      new CheckCache::CheckResult);
-  check_cache_->Check(attributes, check_result.get());
+CancelFunc MixerClientImpl::Check(
+    Attributes *attributes, const std::vector<std::string> &deferred_names,
+    FillAttributesFunc fill_deferred,
+    const std::vector<::istio::quota_config::Requirement> &quotas,
+    TransportCheckFunc transport, CheckDoneFunc on_done) {
+  return Check(*attributes, &deferred_names,
+               [attributes, &fill_deferred]() { fill_deferred(attributes); },
+               quotas, transport, on_done);
+}
+
+CancelFunc MixerClientImpl::Check(
+    const Attributes &attributes,
+    const std::vector<std::string> *deferred_names,
+    const std::function<void()> &fill_deferred,
+    const std::vector<::istio::quota_config::Requirement> &quotas,
+    TransportCheckFunc transport, CheckDoneFunc on_done) {
+  utils::ScopedAllocTag alloc_tag(utils::AllocTag::MIXER_CHECK);
+  AddCounter(StatsCounter::CHECK_CALLS, &total_check_calls_);
+
+  std::unique_ptr<CheckContext> context = NewCheckContext();
+  CheckCache::CheckResult *check_result = &context->check_result;
+  // The value hashes of the attributes, shared by all the signatures of
+  // the check and the quota caches.
+  AttributeFingerprints fingerprints(attributes);
+  // The quota cache always needs all attributes. The attributes are the
+  // same object filled by fill_deferred.
+  bool deferred = fill_deferred && quotas.empty() &&
+                  check_cache_->Check(attributes, *deferred_names,
+                                      check_result, &fingerprints);
+  if (!deferred) {
+    if (fill_deferred) {
+      fill_deferred();
+      fingerprints.Clear();
+    }
+    check_cache_->Check(attributes, check_result, &fingerprints);
+  }
 
   CheckResponseInfo check_response_info;
   check_response_info.is_check_cache_hit = check_result->IsCacheHit();
-  check_response_info.response_status = check_result->status();
+  check_response_info.response_status = &check_result->status();
 
   if (check_result->IsCacheHit() && !check_result->status().ok()) {
+    FreeCheckContext(std::move(context));
     on_done(check_response_info);
     return nullptr;
   }
 
+  // Coalesce identical check cache misses without quotas.
+  context->coalesced = options_.check_options.coalesce_misses &&
+                       !check_result->IsCacheHit() && quotas.empty() &&
+                       check_result->GetMissSignature(&context->signature);
+  uint64_t coalesced_id;
+  if (context->coalesced &&
+      !StartCoalescedCheck(context->signature, on_done, &coalesced_id)) {
+    AddCounter(StatsCounter::COALESCED_CHECK_CALLS,
+               &total_coalesced_check_calls_);
+    utils::FastHash::Key signature = context->signature;
+    FreeCheckContext(std::move(context));
+    return [this, signature, coalesced_id]() {
+      CancelCoalescedCheck(signature, coalesced_id);
+    };
+  }
+
   if (!quotas.empty()) {
-    ++total_quota_calls_;
+    AddCounter(StatsCounter::QUOTA_CALLS, &total_quota_calls_);
   }
-  std::unique_ptr<QuotaCache::CheckResult> quota_result(
-      new QuotaCache::CheckResult);
+  QuotaCache::CheckResult *quota_result = context->quota_result.get();
   // Only use quota cache if Check is using cache with OK status.
   // Otherwise, a remote Check call may be rejected, but quota amounts were
   // substracted from quota cache already.
   quota_cache_->Check(attributes, quotas, check_result->IsCacheHit(),
-                      quota_result.get());
+                      quota_result, &fingerprints);
 
-  CheckRequest request;
+  CheckRequest &request = *context->request;
   bool quota_call = quota_result->BuildRequest(&request);
   check_response_info.is_quota_cache_hit = quota_result->IsCacheHit();
-  check_response_info.response_status = quota_result->status();
+  check_response_info.response_status = &quota_result->status();
+  if (!check_result->IsCacheHit()) {
+    check_response_info.miss_reason = check_result->miss_reason();
+  } else if (!quota_result->IsCacheHit()) {
+    check_response_info.miss_reason = CheckMissReason::QUOTA;
+  }
+  context->miss_reason = check_response_info.miss_reason;
   if (check_result->IsCacheHit() && quota_result->IsCacheHit()) {
     on_done(check_response_info);
     on_done = nullptr;
-    if (!quota_call) {
+    // Still make a non-blocking remote call for quota prefetch, or to
+    // renew a check cache item before it expires.
+    if (!quota_call && !check_result->NeedsRefresh()) {
+      FreeCheckContext(std::move(context));
+      return nullptr;
+    }
+    // A quota prefetch only call can be batched with other requests.
+    if (quota_call && !check_result->NeedsRefresh() && quota_batch_) {
+      quota_batch_->Add(attributes, std::move(context->quota_result));
+      FreeCheckContext(std::move(context));
       return nullptr;
     }
+    // Or sent with only its referenced attributes.
+    if (quota_call && !check_result->NeedsRefresh() &&
+        options_.quota_options.minimize_quota_requests &&
+        options_.env.check_transport) {
+      std::unique_ptr<QuotaBatch::Batch> batch(new QuotaBatch::Batch);
+      if (quota_result->GetReferencedAttributes(attributes,
+                                                &batch->attributes)) {
+        batch->referenced_only = true;
+        batch->results.push_back(std::move(context->quota_result));
+        FreeCheckContext(std::move(context));
+        SendQuotaBatch(std::move(batch));
+        return nullptr;
+      }
+    }
+  }
+
+  // While overloaded, or while the check breaker is open, the remote call
+  // is not made, the check and the quotas fail open or closed as for a
+  // network failure.
+  Status shed_status;
+  context->breaker_probe = false;
+  if (overloaded_) {
+    AddCounter(StatsCounter::OVERLOAD_SHED_CHECK_CALLS,
+               &total_overload_shed_check_calls_);
+    shed_status = Status(Code::UNAVAILABLE, "Mixer client is overloaded");
+  } else if (check_breaker_ &&
+             !check_breaker_->Allow(std::chrono::steady_clock::now(),
+                                    &context->breaker_probe)) {
+    AddCounter(StatsCounter::BREAKER_SHED_CHECK_CALLS,
+               &total_breaker_shed_check_calls_);
+    shed_status =
+        Status(Code::UNAVAILABLE, "Mixer check circuit breaker is open");
+  }
+  if (!shed_status.ok()) {
+    check_result->SetResponse(shed_status, attributes, *context->response);
+    quota_result->SetResponse(shed_status, attributes, *context->response);
+    if (!check_result->status().ok()) {
+      check_response_info.response_status = &check_result->status();
+    } else {
+      check_response_info.response_status = &quota_result->status();
+    }
+    if (on_done) {
+      on_done(check_response_info);
+    }
+    if (context->coalesced) {
+      FinishCoalescedCheck(context->signature, check_response_info);
+    }
+    FreeCheckContext(std::move(context));
+    return nullptr;
   }
 
+  // Not served by the cache, the remote call needs all attributes.
+  if (deferred) {
+    fill_deferred();
+  }
+  compressor_.MaybeRestoreGlobalDictionary();
   compressor_.Compress(attributes, request.mutable_attributes());
   request.set_global_word_count(compressor_.global_word_count());
-  request.set_deduplication_id(deduplication_id_base_ +
-                               std::to_string(deduplication_id_.fetch_add(1)));
+  SetDeduplicationId(&request);
 
-  // Need to make a copy for processing the response for check cache.
-  Attributes *request_copy = new Attributes(attributes);
-  auto response = new CheckResponse;
-  // Lambda capture could not pass unique_ptr, use raw pointer.
-  CheckCache::CheckResult *raw_check_result = check_result.release();
-  QuotaCache::CheckResult *raw_quota_result = quota_result.release();
+  // Only copy the attributes if the response is cached by them, or used
+  // for the quotas.
+  if (check_cache_->CachesResponses() || !quotas.empty()) {
+    context->attributes->CopyFrom(attributes);
+  }
+  context->on_done = std::move(on_done);
   if (!transport) {
     transport = options_.env.check_transport;
   }
   // We are going to make a remote call now.
-  ++total_remote_check_calls_;
+  AddCounter(StatsCounter::REMOTE_CHECK_CALLS, &total_remote_check_calls_);
   if (!quotas.empty()) {
-    ++total_remote_quota_calls_;
+    AddCounter(StatsCounter::REMOTE_QUOTA_CALLS, &total_remote_quota_calls_);
   }
-  if (on_done) {
-    ++total_blocking_remote_check_calls_;
+  if (context->on_done) {
+    AddCounter(StatsCounter::BLOCKING_REMOTE_CHECK_CALLS,
+               &total_blocking_remote_check_calls_);
     if (!quotas.empty()) {
-      ++total_blocking_remote_quota_calls_;
+      AddCounter(StatsCounter::BLOCKING_REMOTE_QUOTA_CALLS,
+                 &total_blocking_remote_quota_calls_);
     }
   }
 
-  return transport(
+  // Lambda capture could not pass unique_ptr, use raw pointer.
+  CheckContext *raw_context = context.release();
+  uint64_t call_id;
+  {
+    std::lock_guard<Mutex> lock(inflight_mutex_);
+    call_id = ++next_call_id_;
+    inflight_contexts_[call_id] = raw_context;
+  }
+  ISTIO_TRACEPOINT2(remote_check_start, raw_context,
+                    raw_context->on_done != nullptr);
+  std::weak_ptr<bool> alive = alive_;
+  DoneFunc done = [this, alive, raw_context, call_id](const Status &status) {
+    // Cancel can't be called once the client is destroyed, and its caches
+    // may be destroyed too.
+    if (alive.expired()) {
+      delete raw_context;
+      return;
+    }
+    {
+      std::lock_guard<Mutex> lock(inflight_mutex_);
+      // Cancelled, the context is freed already.
+      if (inflight_contexts_.erase(call_id) == 0) {
+        return;
+      }
+    }
+    ISTIO_TRACEPOINT2(remote_check_done, raw_context, status.error_code());
+    std::unique_ptr<CheckContext> context(raw_context);
+    if (check_breaker_) {
+      check_breaker_->Record(status, context->breaker_probe,
+                             std::chrono::steady_clock::now());
+    }
+    context->check_result.SetResponse(status, *context->attributes,
+                                      *context->response);
+    context->quota_result->SetResponse(status, *context->attributes,
+                                       *context->response);
+    CheckResponseInfo check_response_info;
+    check_response_info.miss_reason = context->miss_reason;
+    if (!context->check_result.status().ok()) {
+      check_response_info.response_status = &context->check_result.status();
+    } else {
+      check_response_info.response_status = &context->quota_result->status();
+    }
+    if (context->on_done) {
+      context->on_done(check_response_info);
+    }
+    if (context->coalesced) {
+      FinishCoalescedCheck(context->signature, check_response_info);
+    }
+    FreeCheckContext(std::move(context));
+
+    if (utils::InvalidDictionaryStatus(status)) {
+      compressor_.ShrinkGlobalDictionary();
+    }
+  };
+  // Only hedge the calls blocking a request.
+  CancelFunc cancel;
+  if (check_hedger_ && raw_context->on_done) {
+    cancel = check_hedger_->Send(transport, *raw_context->request,
+                                 raw_context->response, done);
+  } else {
+    cancel = transport(*raw_context->request, raw_context->response, done);
+  }
+  // The done function is not called for a cancelled transport call, a
+  // call without transport cancel only drops on_done.
+  return [this, call_id, cancel]() { CancelCheck(call_id, cancel); };
+}
+
+void MixerClientImpl::CancelCheck(uint64_t call_id, const CancelFunc &cancel) {
+  std::unique_ptr<CheckContext> context;
+  {
+    std::lock_guard<Mutex> lock(inflight_mutex_);
+    auto it = inflight_contexts_.find(call_id);
+    if (it == inflight_contexts_.end()) {
+      return;
+    }
+    it->second->on_done = nullptr;
+    if (!cancel) {
+      return;
+    }
+    if (it->second->coalesced) {
+      auto waiting = inflight_checks_.find(it->second->signature);
+      if (waiting != inflight_checks_.end()) {
+        if (!waiting->second.empty()) {
+          return;
+        }
+        // The next miss of the signature makes a new remote call.
+        inflight_checks_.erase(waiting);
+      }
+    }
+    context.reset(it->second);
+    inflight_contexts_.erase(it);
+  }
+  cancel();
+  // A cancelled probe is never recorded by its done function, the next
+  // check can probe right away.
+  if (check_breaker_ && context->breaker_probe) {
+    check_breaker_->Record(Status(Code::CANCELLED, "check cancelled"), true,
+                           std::chrono::steady_clock::now());
+  }
+  FreeCheckContext(std::move(context));
+}
+
+MixerClientImpl::CheckContext::CheckContext(size_t block_size)
+    : block(new char[block_size]),
+      block_size(block_size),
+      arena(CheckArenaOptions(block.get(), block_size)) {
+  ResetMessages();
+}
+
+void MixerClientImpl::CheckContext::ResetMessages() {
+  // The arena keeps its first block across resets.
+  arena.Reset();
+  attributes = CreateMessage<Attributes>(&arena);
+  request = CreateMessage<CheckRequest>(&arena);
+  response = CreateMessage<CheckResponse>(&arena);
+}
+
+std::unique_ptr<MixerClientImpl::CheckContext>
+MixerClientImpl::NewCheckContext() {
+  {
+    std::lock_guard<Mutex> lock(free_check_contexts_mutex_);
+    if (!free_check_contexts_.empty()) {
+      std::unique_ptr<CheckContext> context =
+          std::move(free_check_contexts_.back());
+      free_check_contexts_.pop_back();
+      return context;
+    }
+  }
+  std::unique_ptr<CheckContext> context(
+      new CheckContext(check_arena_block_size_));
+  context->quota_result.reset(new QuotaCache::CheckResult);
+  return context;
+}
+
+void MixerClientImpl::FreeCheckContext(std::unique_ptr<CheckContext> context) {
+  context->check_result = CheckCache::CheckResult();
+  if (context->quota_result) {
+    *context->quota_result = QuotaCache::CheckResult();
+  } else {
+    context->quota_result.reset(new QuotaCache::CheckResult);
+  }
+  context->on_done = nullptr;
+
+  // Grow the first block of new contexts to fit the largest call.
+  size_t used = context->arena.SpaceAllocated();
+  if (used > context->block_size) {
+    size_t block_size = std::min(used, kMaxCheckArenaBlockSize);
+    size_t current = check_arena_block_size_;
+    while (current < block_size &&
+           !check_arena_block_size_.compare_exchange_weak(current,
+                                                          block_size)) {
+    }
+  }
+  // A context with a smaller block is not reused.
+  if (context->block_size < check_arena_block_size_) {
+    return;
+  }
+  context->ResetMessages();
+
+  std::lock_guard<Mutex> lock(free_check_contexts_mutex_);
+  if (free_check_contexts_.size() < kMaxFreeCheckContexts) {
+    free_check_contexts_.push_back(std::move(context));
+  }
+}
+
+void MixerClientImpl::SetDeduplicationId(CheckRequest *request) {
+  // The counter is encoded in place as 16 hex digits after the base, so
+  // the string of a recycled request is reused without allocation.
+  static const char kHexDigits[] = "0123456789abcdef";
+  uint64_t counter = deduplication_id_.fetch_add(1, std::memory_order_relaxed);
+  std::string *id = request->mutable_deduplication_id();
+  id->assign(deduplication_id_base_);
+  id->resize(deduplication_id_base_.size() + 16);
+  char *digits = &(*id)[deduplication_id_base_.size()];
+  for (int i = 15; i >= 0; --i) {
+    digits[i] = kHexDigits[counter & 0xf];
+    counter >>= 4;
+  }
+}
+
+void MixerClientImpl::SendQuotaBatch(
+    std::unique_ptr<QuotaBatch::Batch> batch) {
+  CheckRequest request;
+  for (const auto &result : batch->results) {
+    result->BuildRequest(&request);
+  }
+  // Only send the referenced attributes of a batch if they are all known.
+  if (options_.quota_options.minimize_quota_requests &&
+      !batch->referenced_only) {
+    Attributes referenced;
+    bool known = true;
+    for (const auto &result : batch->results) {
+      known = known && result->GetReferencedAttributes(batch->attributes,
+                                                       &referenced);
+    }
+    if (known) {
+      batch->attributes.Swap(&referenced);
+      batch->referenced_only = true;
+    }
+  }
+  compressor_.MaybeRestoreGlobalDictionary();
+  compressor_.Compress(batch->attributes, request.mutable_attributes());
+  request.set_global_word_count(compressor_.global_word_count());
+  SetDeduplicationId(&request);
+
+  AddCounter(StatsCounter::REMOTE_CHECK_CALLS, &total_remote_check_calls_);
+  AddCounter(StatsCounter::REMOTE_QUOTA_CALLS, &total_remote_quota_calls_);
+
+  auto response = new CheckResponse;
+  // Lambda capture could not pass unique_ptr, use raw pointer.
+  QuotaBatch::Batch *raw_batch = batch.release();
+  std::weak_ptr<bool> alive = alive_;
+  options_.env.check_transport(
       request, response,
-      [this, request_copy, response, raw_check_result, raw_quota_result,
-       on_done](const Status &status) {
-        raw_check_result->SetResponse(status, *request_copy, *response);
-        raw_quota_result->SetResponse(status, *request_copy, *response);
-        CheckResponseInfo check_response_info;
-        if (on_done) {
-          if (!raw_check_result->status().ok()) {
-            check_response_info.response_status = raw_check_result->status();
+      [this, alive, raw_batch, response](const Status &status) {
+        // The quota cache of the results may be destroyed with the client.
+        if (alive.expired()) {
+          delete raw_batch;
+          delete response;
+          return;
+        }
+        // Mixer only saw the referenced attributes of a minimized call,
+        // its response is not learned from them.
+        for (const auto &result : raw_batch->results) {
+          if (raw_batch->referenced_only) {
+            result->SetReferencedResponse(status, *response);
           } else {
-            check_response_info.response_status = raw_quota_result->status();
+            result->SetResponse(status, raw_batch->attributes, *response);
           }
-          on_done(check_response_info);
         }
-        delete raw_check_result;
-        delete raw_quota_result;
-        delete request_copy;
+        delete raw_batch;
         delete response;
 
         if (utils::InvalidDictionaryStatus(status)) {
@@ -145,19 +732,116 @@ CancelFunc MixerClientImpl::Check(
       });
 }
 
+bool MixerClientImpl::StartCoalescedCheck(
+    const utils::FastHash::Key &signature, CheckDoneFunc on_done,
+    uint64_t *call_id) {
+  std::lock_guard<Mutex> lock(inflight_mutex_);
+  auto it = inflight_checks_.find(signature);
+  if (it == inflight_checks_.end()) {
+    inflight_checks_[signature];
+    return true;
+  }
+  *call_id = ++next_call_id_;
+  it->second.push_back({*call_id, std::move(on_done)});
+  return false;
+}
+
+void MixerClientImpl::CancelCoalescedCheck(
+    const utils::FastHash::Key &signature, uint64_t call_id) {
+  std::lock_guard<Mutex> lock(inflight_mutex_);
+  auto it = inflight_checks_.find(signature);
+  if (it == inflight_checks_.end()) {
+    return;
+  }
+  auto &waiting = it->second;
+  waiting.erase(std::remove_if(waiting.begin(), waiting.end(),
+                               [call_id](const CoalescedCheck &check) {
+                                 return check.call_id == call_id;
+                               }),
+                waiting.end());
+}
+
+void MixerClientImpl::FinishCoalescedCheck(
+    const utils::FastHash::Key &signature,
+    const CheckResponseInfo &check_response_info) {
+  std::vector<CoalescedCheck> waiting;
+  {
+    std::lock_guard<Mutex> lock(inflight_mutex_);
+    auto it = inflight_checks_.find(signature);
+    if (it == inflight_checks_.end()) {
+      return;
+    }
+    waiting.swap(it->second);
+    inflight_checks_.erase(it);
+  }
+  for (const auto &check : waiting) {
+    check.on_done(check_response_info);
+  }
+}
+
 void MixerClientImpl::Report(const Attributes &attributes) {
+  if (options_.report_options.shared_batch) {
+    AddCounter(StatsCounter::REPORT_CALLS, &total_report_calls_);
+  }
   report_batch_->Report(attributes);
 }
 
+void MixerClientImpl::Report(Attributes &&attributes) {
+  if (options_.report_options.shared_batch) {
+    AddCounter(StatsCounter::REPORT_CALLS, &total_report_calls_);
+  }
+  report_batch_->Report(std::move(attributes));
+}
+
+void MixerClientImpl::SetOverloaded(bool overloaded) {
+  if (overloaded_.exchange(overloaded) == overloaded) {
+    return;
+  }
+  report_batch_->SetOverloaded(overloaded);
+  if (overloaded) {
+    AddCounter(StatsCounter::OVERLOAD_EVICTED_CACHE_ITEMS,
+               &total_overload_evicted_cache_items_,
+               check_cache_->Shrink(
+                   options_.check_options.overload_cache_fraction));
+  }
+}
+
+void MixerClientImpl::DrainReports(int deadline_ms) {
+  report_batch_->BeginShutdown(deadline_ms);
+}
+
 void MixerClientImpl::GetStatistics(Statistics *stat) const {
   stat->total_check_calls = total_check_calls_;
   stat->total_remote_check_calls = total_remote_check_calls_;
   stat->total_blocking_remote_check_calls = total_blocking_remote_check_calls_;
+  stat->total_coalesced_check_calls = total_coalesced_check_calls_;
+  stat->total_hedged_check_calls =
+      check_hedger_ ? check_hedger_->total_hedged_calls() : 0;
   stat->total_quota_calls = total_quota_calls_;
   stat->total_remote_quota_calls = total_remote_quota_calls_;
   stat->total_blocking_remote_quota_calls = total_blocking_remote_quota_calls_;
-  stat->total_report_calls = report_batch_->total_report_calls();
-  stat->total_remote_report_calls = report_batch_->total_remote_report_calls();
+  stat->total_batched_quota_calls =
+      quota_batch_ ? quota_batch_->total_batched_calls() : 0;
+  stat->total_overload_shed_check_calls = total_overload_shed_check_calls_;
+  stat->total_overload_evicted_cache_items =
+      total_overload_evicted_cache_items_;
+  stat->total_breaker_shed_check_calls = total_breaker_shed_check_calls_;
+  // The owner of a shared batch reports its statistics, once.
+  if (options_.report_options.shared_batch) {
+    ClearReportBatchStatistics(stat);
+    stat->total_report_calls = total_report_calls_;
+  } else {
+    GetReportBatchStatistics(*report_batch_, stat);
+  }
+  stat->global_dictionary_words = compressor_.global_word_count();
+  stat->check_cache_swept_items = total_check_cache_swept_items_;
+  stat->quota_cache_swept_items = total_quota_cache_swept_items_;
+  check_cache_->GetCacheSize(&stat->check_cache_entries,
+                             &stat->check_cache_bytes);
+  quota_cache_->GetCacheSize(&stat->quota_cache_entries,
+                             &stat->quota_cache_bytes);
+  check_cache_->GetShapeStats(&stat->check_cache_shapes);
+  quota_cache_->GetQuotaStats(&stat->quota_stats);
 }
 
 // Creates a MixerClient object.
@@ -166,5 +850,54 @@ std::unique_ptr<MixerClient> CreateMixerClient(
   return std::unique_ptr<MixerClient>(new MixerClientImpl(options));
 }
 
+// Creates a check cache object to be shared by multiple MixerClient objects.
+std::shared_ptr<CheckCache> CreateSharedCheckCache(
+    const CheckOptions &options) {
+  return std::shared_ptr<CheckCache>(new CheckCache(options));
+}
+
+// Creates a quota cache object to be shared by multiple MixerClient objects.
+std::shared_ptr<QuotaCache> CreateSharedQuotaCache(
+    const QuotaOptions &options) {
+  return std::shared_ptr<QuotaCache>(new QuotaCache(options));
+}
+
+// Creates a report batch object to be shared by multiple MixerClient
+// objects.
+std::shared_ptr<ReportBatch> CreateSharedReportBatch(
+    const MixerClientOptions &options) {
+  // A shared batch should not hold a reference to another one.
+  MixerClientOptions batch_options(options);
+  batch_options.report_options.shared_batch.reset();
+  std::shared_ptr<ReportBatch> batch(new SharedReportBatch(batch_options));
+  if (!options.env.extra_report_transports.empty()) {
+    batch->AddChannels(options.env.extra_report_transports);
+  }
+  return batch;
+}
+
+void GetReportBatchStatistics(ReportBatch &batch, Statistics *stat) {
+  stat->total_report_calls = batch.total_report_calls();
+  stat->total_remote_report_calls = batch.total_remote_report_calls();
+  stat->total_dropped_report_calls = batch.total_dropped_report_calls();
+  stat->total_report_batches_full_entries =
+      batch.total_finished_batches(ReportBatch::FULL_ENTRIES);
+  stat->total_report_batches_full_bytes =
+      batch.total_finished_batches(ReportBatch::FULL_BYTES);
+  stat->total_report_batches_timed =
+      batch.total_finished_batches(ReportBatch::TIMED);
+  stat->total_report_batches_delta_break =
+      batch.total_finished_batches(ReportBatch::DELTA_BREAK);
+  stat->total_report_batches_evicted =
+      batch.total_finished_batches(ReportBatch::EVICTED);
+  stat->total_overload_dropped_report_calls =
+      batch.total_overload_dropped_report_calls();
+  stat->total_spilled_report_batches = batch.total_spilled_report_batches();
+  stat->inflight_report_batches = batch.inflight_report_batches();
+  stat->buffered_report_bytes = batch.buffered_report_bytes();
+  batch.GetOpenBatches(&stat->open_report_batches,
+                       &stat->open_report_entries);
+}
+
 }  // namespace mixerclient
 }  // namespace istio
@@ -18,11 +18,19 @@
 
 #include "include/istio/mixerclient/client.h"
 #include "src/istio/mixerclient/attribute_compressor.h"
+#include "src/istio/mixerclient/check_breaker.h"
 #include "src/istio/mixerclient/check_cache.h"
+#include "src/istio/mixerclient/check_hedger.h"
+#include "src/istio/mixerclient/quota_batch.h"
 #include "src/istio/mixerclient/quota_cache.h"
 #include "src/istio/mixerclient/report_batch.h"
 
+#include "google/protobuf/arena.h"
+
 #include <atomic>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
 
 namespace istio {
 namespace mixerclient {
@@ -39,23 +47,156 @@ class MixerClientImpl : public MixerClient {
       const ::istio::mixer::v1::Attributes& attributes,
       const std::vector<::istio::quota_config::Requirement>& quotas,
       TransportCheckFunc transport, CheckDoneFunc on_done) override;
+  CancelFunc Check(
+      ::istio::mixer::v1::Attributes* attributes,
+      const std::vector<std::string>& deferred_names,
+      FillAttributesFunc fill_deferred,
+      const std::vector<::istio::quota_config::Requirement>& quotas,
+      TransportCheckFunc transport, CheckDoneFunc on_done) override;
   void Report(const ::istio::mixer::v1::Attributes& attributes) override;
+  void Report(::istio::mixer::v1::Attributes&& attributes) override;
 
   void GetStatistics(Statistics* stat) const override;
 
+  void SetOverloaded(bool overloaded) override;
+  void DrainReports(int deadline_ms) override;
+
  private:
+  // The mutexes are disabled if the client is THREAD_CONFINED.
+  using Mutex = utils::OptionalMutex<std::mutex>;
+
+  // Makes a check call. If fill_deferred is set, the attributes named in
+  // deferred_names are added by it once they are needed.
+  CancelFunc Check(
+      const ::istio::mixer::v1::Attributes& attributes,
+      const std::vector<std::string>* deferred_names,
+      const std::function<void()>& fill_deferred,
+      const std::vector<::istio::quota_config::Requirement>& quotas,
+      TransportCheckFunc transport, CheckDoneFunc on_done);
+
   // Store the options
   MixerClientOptions options_;
 
+  // Reset first at destruction. The done functions of the remote calls
+  // hold a weak reference to it, so that the ones done later don't touch
+  // the destroyed client.
+  std::shared_ptr<bool> alive_;
+
   // To compress attributes.
   AttributeCompressor compressor_;
 
-  // Cache for Check call.
-  std::unique_ptr<CheckCache> check_cache_;
-  // Report batch.
-  std::unique_ptr<ReportBatch> report_batch_;
-  // Cache for Quota call.
-  std::unique_ptr<QuotaCache> quota_cache_;
+  // Cache for Check call. It may be shared with other MixerClient objects.
+  std::shared_ptr<CheckCache> check_cache_;
+  // Report batch. It may be shared with other MixerClient objects.
+  std::shared_ptr<ReportBatch> report_batch_;
+  // Cache for Quota call. It may be shared with other MixerClient objects.
+  std::shared_ptr<QuotaCache> quota_cache_;
+  // To hedge remote check calls, nullptr if not enabled.
+  std::unique_ptr<CheckHedger> check_hedger_;
+  // The circuit breaker of the remote check calls, nullptr if not enabled.
+  std::unique_ptr<CheckBreaker> check_breaker_;
+  // Batch for non-blocking quota prefetch calls. It is destroyed before
+  // quota_cache_ since its calls refer to the quota cache items.
+  std::unique_ptr<QuotaBatch> quota_batch_;
+
+  // The objects of a remote check call. They are recycled through a free
+  // list to save their allocations on each call. The protobuf messages live
+  // on an arena whose first block is owned by the context, so a call
+  // fitting in the block allocates nothing, and a reset drops all of them.
+  struct CheckContext {
+    CheckContext(size_t block_size);
+
+    // Resets the arena and creates new empty messages on it.
+    void ResetMessages();
+
+    CheckCache::CheckResult check_result;
+    std::unique_ptr<QuotaCache::CheckResult> quota_result;
+    std::unique_ptr<char[]> block;
+    size_t block_size;
+    ::google::protobuf::Arena arena;
+    // A copy of the request attributes, only if the response needs them.
+    ::istio::mixer::v1::Attributes* attributes;
+    ::istio::mixer::v1::CheckRequest* request;
+    ::istio::mixer::v1::CheckResponse* response;
+    CheckDoneFunc on_done;
+    bool coalesced;
+    utils::FastHash::Key signature;
+    // True if the remote call is the probe of the half open breaker.
+    bool breaker_probe;
+    // Why the call missed the caches.
+    CheckMissReason miss_reason;
+  };
+
+  // Cancels a remote check call, and its transport call with cancel. The
+  // call is kept if others wait for its response, only on_done is dropped.
+  void CancelCheck(uint64_t call_id, const CancelFunc& cancel);
+
+  // Gets a check context from the free list, or a new one.
+  std::unique_ptr<CheckContext> NewCheckContext();
+
+  // Clears a check context and returns it to the free list.
+  void FreeCheckContext(std::unique_ptr<CheckContext> context);
+
+  // Sets the next deduplication id of a check request.
+  void SetDeduplicationId(::istio::mixer::v1::CheckRequest* request);
+
+  // Starts the timers sweeping expired cache items, if enabled.
+  void StartCacheSweeps();
+
+  // Publishes the demand of the caches to the cache budget, and applies
+  // their capacities from it.
+  void SyncCacheBudget();
+
+  // Adds value to a total counter and pushes it to the stats sink, if any.
+  void AddCounter(StatsCounter counter, std::atomic_int_fast64_t* total,
+                  uint64_t value = 1);
+
+  // Sends a batch of quota prefetch calls in one remote check call.
+  void SendQuotaBatch(std::unique_ptr<QuotaBatch::Batch> batch);
+
+  // Starts a remote check call for a check cache miss signature.
+  // Returns false if one is in flight already, on_done will be called
+  // with its response unless the call of *call_id is cancelled.
+  bool StartCoalescedCheck(const utils::FastHash::Key& signature,
+                           CheckDoneFunc on_done, uint64_t* call_id);
+
+  // Cancels a check call waiting for a remote check call.
+  void CancelCoalescedCheck(const utils::FastHash::Key& signature,
+                            uint64_t call_id);
+
+  // Calls on_done of all check calls waiting for the remote check call.
+  void FinishCoalescedCheck(const utils::FastHash::Key& signature,
+                            const CheckResponseInfo& check_response_info);
+
+  // A check call waiting for the remote check call of another one.
+  struct CoalescedCheck {
+    uint64_t call_id;
+    CheckDoneFunc on_done;
+  };
+
+  // The in-flight remote check calls keyed by check cache miss signature.
+  // Value is the check calls waiting for the response.
+  std::unordered_map<utils::FastHash::Key, std::vector<CoalescedCheck>,
+                     utils::FastHash::KeyHash>
+      inflight_checks_;
+  // The contexts of the remote check calls in flight by call id. The done
+  // function, or the cancel function, of a call takes its context out
+  // first and frees it, so the other one never sees a recycled context.
+  std::unordered_map<uint64_t, CheckContext*> inflight_contexts_;
+  uint64_t next_call_id_;
+  // Mutex guarding inflight_checks_ and inflight_contexts_.
+  Mutex inflight_mutex_;
+
+  // The free check contexts, up to kMaxFreeCheckContexts.
+  std::vector<std::unique_ptr<CheckContext>> free_check_contexts_;
+  // Mutex guarding free_check_contexts_.
+  Mutex free_check_contexts_mutex_;
+  // The first arena block size of new check contexts. It grows to the
+  // largest footprint of the recycled contexts, up to a limit.
+  std::atomic<size_t> check_arena_block_size_;
+
+  // True while overloaded, see SetOverloaded().
+  std::atomic<bool> overloaded_;
 
   // for deduplication_id
   std::string deduplication_id_base_;
@@ -69,9 +210,31 @@ class MixerClientImpl : public MixerClient {
   std::atomic_int_fast64_t total_check_calls_;
   std::atomic_int_fast64_t total_remote_check_calls_;
   std::atomic_int_fast64_t total_blocking_remote_check_calls_;
+  std::atomic_int_fast64_t total_coalesced_check_calls_;
   std::atomic_int_fast64_t total_quota_calls_;
   std::atomic_int_fast64_t total_remote_quota_calls_;
   std::atomic_int_fast64_t total_blocking_remote_quota_calls_;
+  std::atomic_int_fast64_t total_check_cache_swept_items_;
+  std::atomic_int_fast64_t total_quota_cache_swept_items_;
+  std::atomic_int_fast64_t total_overload_shed_check_calls_;
+  std::atomic_int_fast64_t total_overload_evicted_cache_items_;
+  std::atomic_int_fast64_t total_breaker_shed_check_calls_;
+  // The report calls of this client, only counted with a shared batch.
+  std::atomic_int_fast64_t total_report_calls_;
+
+  // The share of the cache budget, nullptr if not budgeted, and the
+  // capacities applied from it.
+  std::shared_ptr<CacheBudget::Share> budget_share_;
+  int64_t budget_check_capacity_;
+  int64_t budget_quota_capacity_;
+
+  // The timers sweeping expired cache items, saving the check cache
+  // snapshot and syncing the cache budget. They are declared last so that
+  // they are stopped first at destruction.
+  std::unique_ptr<Timer> check_sweep_timer_;
+  std::unique_ptr<Timer> snapshot_timer_;
+  std::unique_ptr<Timer> quota_sweep_timer_;
+  std::unique_ptr<Timer> budget_timer_;
 
   GOOGLE_DISALLOW_EVIL_CONSTRUCTORS(MixerClientImpl);
 };
@@ -18,13 +18,20 @@
 #include "include/istio/mixerclient/check_response.h"
 #include "include/istio/mixerclient/client.h"
 #include "include/istio/utils/attributes_builder.h"
+#include "include/istio/utils/protobuf.h"
 #include "src/istio/mixerclient/status_test_util.h"
 
+#include <thread>
+#include <utility>
+
 using ::google::protobuf::util::Status;
 using ::google::protobuf::util::error::Code;
 using ::istio::mixer::v1::Attributes;
 using ::istio::mixer::v1::CheckRequest;
 using ::istio::mixer::v1::CheckResponse;
+using ::istio::mixer::v1::ReferencedAttributes;
+using ::istio::mixer::v1::ReportRequest;
+using ::istio::mixer::v1::ReportResponse;
 using ::istio::mixerclient::CheckResponseInfo;
 using ::istio::quota_config::Requirement;
 using ::testing::Invoke;
@@ -49,6 +56,13 @@ class MockCheckTransport {
   }
 };
 
+class MockTimer : public Timer {
+ public:
+  void Stop() override {}
+  void Start(int interval_ms) override {}
+  std::function<void()> cb_;
+};
+
 class MixerClientImplTest : public ::testing::Test {
  public:
   MixerClientImplTest() {
@@ -56,13 +70,15 @@ class MixerClientImplTest : public ::testing::Test {
     CreateClient(true /* check_cache */, true /* quota_cache */);
   }
 
-  void CreateClient(bool check_cache, bool quota_cache) {
+  void CreateClient(bool check_cache, bool quota_cache,
+                    ThreadingModel threading_model = ThreadingModel::SHARED) {
     MixerClientOptions options(CheckOptions(check_cache ? 1 : 0 /*entries */),
                                ReportOptions(1, 1000),
                                QuotaOptions(quota_cache ? 1 : 0 /* entries */,
                                             600000 /* expiration_ms */));
     options.check_options.network_fail_open = false;
     options.env.check_transport = mock_check_transport_.GetFunc();
+    options.env.threading_model = threading_model;
     client_ = CreateMixerClient(options);
   }
 
@@ -83,22 +99,21 @@ TEST_F(MixerClientImplTest, TestSuccessCheck) {
 
   // Not to test quota
   std::vector<Requirement> empty_quotas;
-  CheckResponseInfo check_response_info;
+  Status check_status;
   client_->Check(request_, empty_quotas, empty_transport_,
-                 [&check_response_info](const CheckResponseInfo& info) {
-                   check_response_info.response_status = info.response_status;
+                 [&check_status](const CheckResponseInfo& info) {
+                   check_status = *info.response_status;
                  });
-  EXPECT_TRUE(check_response_info.response_status.ok());
+  EXPECT_TRUE(check_status.ok());
 
   for (int i = 0; i < 10; i++) {
     // Other calls should be cached.
-    CheckResponseInfo check_response_info1;
+    Status check_status1;
     client_->Check(request_, empty_quotas, empty_transport_,
-                   [&check_response_info1](const CheckResponseInfo& info) {
-                     check_response_info1.response_status =
-                         info.response_status;
+                   [&check_status1](const CheckResponseInfo& info) {
+                     check_status1 = *info.response_status;
                    });
-    EXPECT_TRUE(check_response_info1.response_status.ok());
+    EXPECT_TRUE(check_status1.ok());
   }
 
   Statistics stat;
@@ -113,6 +128,201 @@ TEST_F(MixerClientImplTest, TestSuccessCheck) {
   EXPECT_EQ(stat.total_blocking_remote_quota_calls, 0);
 }
 
+TEST_F(MixerClientImplTest, TestCachedDenialNotCopied) {
+  EXPECT_CALL(mock_check_transport_, Check(_, _, _))
+      .WillOnce(Invoke([](const CheckRequest& request, CheckResponse* response,
+                          DoneFunc on_done) {
+        auto precondition = response->mutable_precondition();
+        precondition->set_valid_use_count(1000);
+        precondition->mutable_status()->set_code(Code::PERMISSION_DENIED);
+        precondition->mutable_status()->set_message("denied");
+        on_done(Status::OK);
+      }));
+
+  std::vector<Requirement> empty_quotas;
+  std::vector<const Status*> statuses;
+  for (int i = 0; i < 3; i++) {
+    client_->Check(request_, empty_quotas, empty_transport_,
+                   [&statuses](const CheckResponseInfo& info) {
+                     EXPECT_ERROR_CODE(Code::PERMISSION_DENIED,
+                                       *info.response_status);
+                     EXPECT_EQ(info.response_status->error_message(),
+                               "denied");
+                     statuses.push_back(info.response_status);
+                   });
+  }
+  // The hits pass the status interned by the cache, not a copy.
+  ASSERT_EQ(statuses.size(), 3);
+  EXPECT_EQ(statuses[1], statuses[2]);
+}
+
+TEST_F(MixerClientImplTest, TestRefreshAheadCheck) {
+  MixerClientOptions options(CheckOptions(1 /*entries */),
+                             ReportOptions(1, 1000), QuotaOptions(0, 600000));
+  options.check_options.refresh_ahead_fraction = 0.5;
+  options.env.check_transport = mock_check_transport_.GetFunc();
+  client_ = CreateMixerClient(options);
+
+  EXPECT_CALL(mock_check_transport_, Check(_, _, _))
+      .Times(2)
+      .WillRepeatedly(Invoke([](const CheckRequest& request,
+                                CheckResponse* response, DoneFunc on_done) {
+        response->mutable_precondition()->set_valid_use_count(10);
+        on_done(Status::OK);
+      }));
+
+  // Not to test quota
+  std::vector<Requirement> empty_quotas;
+  for (int i = 0; i < 10; i++) {
+    Status check_status;
+    client_->Check(request_, empty_quotas, empty_transport_,
+                   [&check_status](const CheckResponseInfo& info) {
+                     check_status = *info.response_status;
+                   });
+    EXPECT_TRUE(check_status.ok());
+  }
+
+  Statistics stat;
+  client_->GetStatistics(&stat);
+  EXPECT_EQ(stat.total_check_calls, 10);
+  // The 6th call has used half of valid_use_count, it triggers a
+  // non-blocking remote check call to renew the cache item.
+  EXPECT_EQ(stat.total_remote_check_calls, 2);
+  EXPECT_EQ(stat.total_blocking_remote_check_calls, 1);
+}
+
+TEST_F(MixerClientImplTest, TestCoalescedCheckMisses) {
+  std::vector<DoneFunc> pending;
+  EXPECT_CALL(mock_check_transport_, Check(_, _, _))
+      .Times(2)
+      .WillRepeatedly(Invoke([&pending](const CheckRequest& request,
+                                        CheckResponse* response,
+                                        DoneFunc on_done) {
+        // Cached response is expired right away.
+        response->mutable_precondition()->set_valid_use_count(1000);
+        *response->mutable_precondition()->mutable_valid_duration() =
+            utils::CreateDuration(std::chrono::nanoseconds(0));
+        pending.push_back(on_done);
+      }));
+
+  // Not to test quota
+  std::vector<Requirement> empty_quotas;
+  int num_ok = 0;
+  auto on_done = [&num_ok](const CheckResponseInfo& info) {
+    if (info.response_status->ok()) {
+      ++num_ok;
+    }
+  };
+
+  // The first call learns the Referenced from its response.
+  client_->Check(request_, empty_quotas, empty_transport_, on_done);
+  ASSERT_EQ(pending.size(), 1);
+  pending[0](Status::OK);
+  EXPECT_EQ(num_ok, 1);
+
+  // Following misses have the same signature, only one remote call is made.
+  for (int i = 0; i < 5; i++) {
+    client_->Check(request_, empty_quotas, empty_transport_, on_done);
+  }
+  ASSERT_EQ(pending.size(), 2);
+  EXPECT_EQ(num_ok, 1);
+  pending[1](Status::OK);
+  EXPECT_EQ(num_ok, 6);
+
+  Statistics stat;
+  client_->GetStatistics(&stat);
+  EXPECT_EQ(stat.total_check_calls, 6);
+  EXPECT_EQ(stat.total_remote_check_calls, 2);
+  EXPECT_EQ(stat.total_coalesced_check_calls, 4);
+}
+
+TEST_F(MixerClientImplTest, TestCancelledCheck) {
+  CreateClient(false /* check_cache */, false /* quota_cache */);
+  std::vector<DoneFunc> pending;
+  int cancelled = 0;
+  TransportCheckFunc transport = [&](const CheckRequest& request,
+                                     CheckResponse* response,
+                                     DoneFunc on_done) -> CancelFunc {
+    pending.push_back(on_done);
+    return [&cancelled]() { ++cancelled; };
+  };
+
+  // Not to test quota
+  std::vector<Requirement> empty_quotas;
+  int num_done = 0;
+  CancelFunc cancel =
+      client_->Check(request_, empty_quotas, transport,
+                     [&num_done](const CheckResponseInfo&) { ++num_done; });
+  ASSERT_TRUE(cancel != nullptr);
+  cancel();
+  EXPECT_EQ(cancelled, 1);
+  // The context is freed on cancel, a late done is ignored, as a second
+  // cancel.
+  pending[0](Status::OK);
+  cancel();
+  EXPECT_EQ(cancelled, 1);
+  EXPECT_EQ(num_done, 0);
+
+  // A cancel after done does nothing.
+  cancel =
+      client_->Check(request_, empty_quotas, transport,
+                     [&num_done](const CheckResponseInfo&) { ++num_done; });
+  pending[1](Status::OK);
+  EXPECT_EQ(num_done, 1);
+  cancel();
+  EXPECT_EQ(cancelled, 1);
+}
+
+TEST_F(MixerClientImplTest, TestCancelledCoalescedCheck) {
+  std::vector<DoneFunc> pending;
+  int cancelled = 0;
+  TransportCheckFunc transport = [&](const CheckRequest& request,
+                                     CheckResponse* response,
+                                     DoneFunc on_done) -> CancelFunc {
+    // Cached response is expired right away.
+    response->mutable_precondition()->set_valid_use_count(1000);
+    *response->mutable_precondition()->mutable_valid_duration() =
+        utils::CreateDuration(std::chrono::nanoseconds(0));
+    pending.push_back(on_done);
+    return [&cancelled]() { ++cancelled; };
+  };
+
+  // Not to test quota
+  std::vector<Requirement> empty_quotas;
+  int num_done = 0;
+  auto on_done = [&num_done](const CheckResponseInfo&) { ++num_done; };
+
+  // The first call learns the Referenced from its response.
+  client_->Check(request_, empty_quotas, transport, on_done);
+  ASSERT_EQ(pending.size(), 1);
+  pending[0](Status::OK);
+  EXPECT_EQ(num_done, 1);
+
+  // A cancelled follower is not called, the cancelled leader keeps its
+  // remote call for the other follower.
+  CancelFunc leader =
+      client_->Check(request_, empty_quotas, transport, on_done);
+  CancelFunc follower =
+      client_->Check(request_, empty_quotas, transport, on_done);
+  client_->Check(request_, empty_quotas, transport, on_done);
+  ASSERT_EQ(pending.size(), 2);
+  follower();
+  leader();
+  EXPECT_EQ(cancelled, 0);
+  pending[1](Status::OK);
+  EXPECT_EQ(num_done, 2);
+
+  // A cancelled leader without follower cancels its remote call, the next
+  // miss makes a new one.
+  leader = client_->Check(request_, empty_quotas, transport, on_done);
+  leader();
+  EXPECT_EQ(cancelled, 1);
+  client_->Check(request_, empty_quotas, transport, on_done);
+  ASSERT_EQ(pending.size(), 4);
+  pending[3](Status::OK);
+  EXPECT_EQ(num_done, 3);
+}
+
 TEST_F(MixerClientImplTest, TestPerRequestTransport) {
   // Global transport should not be called.
   EXPECT_CALL(mock_check_transport_, Check(_, _, _)).Times(0);
@@ -128,22 +338,21 @@ TEST_F(MixerClientImplTest, TestPerRequestTransport) {
 
   // Not to test quota
   std::vector<Requirement> empty_quotas;
-  CheckResponseInfo check_response_info;
+  Status check_status;
   client_->Check(request_, empty_quotas, local_check_transport.GetFunc(),
-                 [&check_response_info](const CheckResponseInfo& info) {
-                   check_response_info.response_status = info.response_status;
+                 [&check_status](const CheckResponseInfo& info) {
+                   check_status = *info.response_status;
                  });
-  EXPECT_TRUE(check_response_info.response_status.ok());
+  EXPECT_TRUE(check_status.ok());
 
   for (int i = 0; i < 10; i++) {
     // Other calls should be cached.
-    CheckResponseInfo check_response_info1;
+    Status check_status1;
     client_->Check(request_, empty_quotas, local_check_transport.GetFunc(),
-                   [&check_response_info1](const CheckResponseInfo& info) {
-                     check_response_info1.response_status =
-                         info.response_status;
+                   [&check_status1](const CheckResponseInfo& info) {
+                     check_status1 = *info.response_status;
                    });
-    EXPECT_TRUE(check_response_info1.response_status.ok());
+    EXPECT_TRUE(check_status1.ok());
   }
 
   Statistics stat;
@@ -174,22 +383,21 @@ TEST_F(MixerClientImplTest, TestNoCheckCache) {
         on_done(Status::OK);
       }));
 
-  CheckResponseInfo check_response_info;
+  Status check_status;
   client_->Check(request_, quotas_, empty_transport_,
-                 [&check_response_info](const CheckResponseInfo& info) {
-                   check_response_info.response_status = info.response_status;
+                 [&check_status](const CheckResponseInfo& info) {
+                   check_status = *info.response_status;
                  });
-  EXPECT_TRUE(check_response_info.response_status.ok());
+  EXPECT_TRUE(check_status.ok());
 
   for (int i = 0; i < 10; i++) {
     // Other calls are not cached.
-    CheckResponseInfo check_response_info1;
+    Status check_status1;
     client_->Check(request_, quotas_, empty_transport_,
-                   [&check_response_info1](const CheckResponseInfo& info) {
-                     check_response_info1.response_status =
-                         info.response_status;
+                   [&check_status1](const CheckResponseInfo& info) {
+                     check_status1 = *info.response_status;
                    });
-    EXPECT_TRUE(check_response_info1.response_status.ok());
+    EXPECT_TRUE(check_status1.ok());
   }
   // Call count 11 since check is not cached.
   EXPECT_EQ(call_counts, 11);
@@ -204,6 +412,47 @@ TEST_F(MixerClientImplTest, TestNoCheckCache) {
   EXPECT_EQ(stat.total_blocking_remote_quota_calls, 11);
 }
 
+TEST_F(MixerClientImplTest, TestRecycledCheckContexts) {
+  CreateClient(false /* check_cache */, false /* quota_cache */);
+
+  std::vector<std::string> deduplication_ids;
+  std::vector<DoneFunc> pending;
+  EXPECT_CALL(mock_check_transport_, Check(_, _, _))
+      .WillRepeatedly(Invoke([&](const CheckRequest& request,
+                                 CheckResponse* response, DoneFunc on_done) {
+        response->mutable_precondition()->set_valid_use_count(1000);
+        deduplication_ids.push_back(request.deduplication_id());
+        pending.push_back(on_done);
+      }));
+
+  std::vector<Status> statuses(3);
+  for (int i = 0; i < 2; i++) {
+    client_->Check(request_, quotas_, empty_transport_,
+                   [&statuses, i](const CheckResponseInfo& info) {
+                     statuses[i] = *info.response_status;
+                   });
+  }
+  // Finish the calls out of order, the second one fails.
+  pending[1](Status(Code::PERMISSION_DENIED, ""));
+  pending[0](Status::OK);
+
+  // The third call reuses a context of the finished calls.
+  client_->Check(request_, quotas_, empty_transport_,
+                 [&statuses](const CheckResponseInfo& info) {
+                   statuses[2] = *info.response_status;
+                 });
+  pending[2](Status::OK);
+
+  EXPECT_OK(statuses[0]);
+  EXPECT_ERROR_CODE(Code::PERMISSION_DENIED, statuses[1]);
+  EXPECT_OK(statuses[2]);
+  ASSERT_EQ(deduplication_ids.size(), 3);
+  EXPECT_NE(deduplication_ids[0], deduplication_ids[1]);
+  EXPECT_NE(deduplication_ids[1], deduplication_ids[2]);
+  // The ids are a fixed size counter, without uuid generator.
+  EXPECT_EQ(deduplication_ids[2].size(), 16);
+}
+
 TEST_F(MixerClientImplTest, TestNoQuotaCache) {
   CreateClient(true /* check_cache */, false /* quota_cache */);
 
@@ -220,22 +469,21 @@ TEST_F(MixerClientImplTest, TestNoQuotaCache) {
         on_done(Status::OK);
       }));
 
-  CheckResponseInfo check_response_info;
+  Status check_status;
   client_->Check(request_, quotas_, empty_transport_,
-                 [&check_response_info](const CheckResponseInfo& info) {
-                   check_response_info.response_status = info.response_status;
+                 [&check_status](const CheckResponseInfo& info) {
+                   check_status = *info.response_status;
                  });
-  EXPECT_TRUE(check_response_info.response_status.ok());
+  EXPECT_TRUE(check_status.ok());
 
   for (int i = 0; i < 10; i++) {
     // Other calls should be cached.
-    CheckResponseInfo check_response_info1;
+    Status check_status1;
     client_->Check(request_, quotas_, empty_transport_,
-                   [&check_response_info1](const CheckResponseInfo& info) {
-                     check_response_info1.response_status =
-                         info.response_status;
+                   [&check_status1](const CheckResponseInfo& info) {
+                     check_status1 = *info.response_status;
                    });
-    EXPECT_TRUE(check_response_info1.response_status.ok());
+    EXPECT_TRUE(check_status1.ok());
   }
   // Call count 11 since quota is not cached.
   EXPECT_EQ(call_counts, 11);
@@ -264,22 +512,21 @@ TEST_F(MixerClientImplTest, TestSuccessCheckAndQuota) {
         on_done(Status::OK);
       }));
 
-  CheckResponseInfo check_response_info;
+  Status check_status;
   client_->Check(request_, quotas_, empty_transport_,
-                 [&check_response_info](const CheckResponseInfo& info) {
-                   check_response_info.response_status = info.response_status;
+                 [&check_status](const CheckResponseInfo& info) {
+                   check_status = *info.response_status;
                  });
-  EXPECT_TRUE(check_response_info.response_status.ok());
+  EXPECT_TRUE(check_status.ok());
 
   for (int i = 0; i < 10; i++) {
     // Other calls should be cached.
-    CheckResponseInfo check_response_info1;
+    Status check_status1;
     client_->Check(request_, quotas_, empty_transport_,
-                   [&check_response_info1](const CheckResponseInfo& info) {
-                     check_response_info1.response_status =
-                         info.response_status;
+                   [&check_status1](const CheckResponseInfo& info) {
+                     check_status1 = *info.response_status;
                    });
-    EXPECT_TRUE(check_response_info1.response_status.ok());
+    EXPECT_TRUE(check_status1.ok());
   }
   // Call count should be less than 4
   EXPECT_LE(call_counts, 3);
@@ -295,6 +542,38 @@ TEST_F(MixerClientImplTest, TestSuccessCheckAndQuota) {
   EXPECT_EQ(stat.total_blocking_remote_quota_calls, 1);
 }
 
+TEST_F(MixerClientImplTest, TestThreadConfined) {
+  // The same calls as TestSuccessCheckAndQuota, without the mutexes.
+  CreateClient(true /* check_cache */, true /* quota_cache */,
+               ThreadingModel::THREAD_CONFINED);
+  EXPECT_CALL(mock_check_transport_, Check(_, _, _))
+      .WillRepeatedly(Invoke([](const CheckRequest& request,
+                                CheckResponse* response, DoneFunc on_done) {
+        response->mutable_precondition()->set_valid_use_count(1000);
+        CheckResponse::QuotaResult quota_result;
+        quota_result.set_granted_amount(10);
+        quota_result.mutable_valid_duration()->set_seconds(10);
+        (*response->mutable_quotas())[kRequestCount] = quota_result;
+        on_done(Status::OK);
+      }));
+
+  for (int i = 0; i < 11; i++) {
+    Status check_status;
+    client_->Check(request_, quotas_, empty_transport_,
+                   [&check_status](const CheckResponseInfo& info) {
+                     check_status = *info.response_status;
+                   });
+    EXPECT_TRUE(check_status.ok());
+  }
+  Statistics stat;
+  client_->GetStatistics(&stat);
+  EXPECT_EQ(stat.total_check_calls, 11);
+  EXPECT_LE(stat.total_remote_check_calls, 3);
+  EXPECT_EQ(stat.total_blocking_remote_check_calls, 1);
+  EXPECT_EQ(stat.total_quota_calls, 11);
+  EXPECT_LE(stat.total_remote_quota_calls, 3);
+}
+
 TEST_F(MixerClientImplTest, TestFailedCheckAndQuota) {
   EXPECT_CALL(mock_check_transport_, Check(_, _, _))
       .WillOnce(Invoke([](const CheckRequest& request, CheckResponse* response,
@@ -309,24 +588,23 @@ TEST_F(MixerClientImplTest, TestFailedCheckAndQuota) {
         on_done(Status::OK);
       }));
 
-  CheckResponseInfo check_response_info;
+  Status check_status;
   client_->Check(request_, quotas_, empty_transport_,
-                 [&check_response_info](const CheckResponseInfo& info) {
-                   check_response_info.response_status = info.response_status;
+                 [&check_status](const CheckResponseInfo& info) {
+                   check_status = *info.response_status;
                  });
   EXPECT_ERROR_CODE(Code::FAILED_PRECONDITION,
-                    check_response_info.response_status);
+                    check_status);
 
   for (int i = 0; i < 10; i++) {
     // Other calls should be cached.
-    CheckResponseInfo check_response_info1;
+    Status check_status1;
     client_->Check(request_, quotas_, empty_transport_,
-                   [&check_response_info1](const CheckResponseInfo& info) {
-                     check_response_info1.response_status =
-                         info.response_status;
+                   [&check_status1](const CheckResponseInfo& info) {
+                     check_status1 = *info.response_status;
                    });
     EXPECT_ERROR_CODE(Code::FAILED_PRECONDITION,
-                      check_response_info1.response_status);
+                      check_status1);
   }
   Statistics stat;
   client_->GetStatistics(&stat);
@@ -340,6 +618,604 @@ TEST_F(MixerClientImplTest, TestFailedCheckAndQuota) {
   EXPECT_EQ(stat.total_blocking_remote_quota_calls, 1);
 }
 
+TEST_F(MixerClientImplTest, TestBatchedQuotaPrefetch) {
+  MockTimer* mock_timer = nullptr;
+  MixerClientOptions options(CheckOptions(1 /* entries */),
+                             ReportOptions(1, 1000),
+                             QuotaOptions(2 /* entries */, 600000));
+  options.quota_options.batch_window_ms = 10;
+  options.env.check_transport = mock_check_transport_.GetFunc();
+  options.env.timer_create_func =
+      [&mock_timer](std::function<void()> cb) -> std::unique_ptr<Timer> {
+    mock_timer = new MockTimer;
+    mock_timer->cb_ = cb;
+    return std::unique_ptr<Timer>(mock_timer);
+  };
+  client_ = CreateMixerClient(options);
+
+  std::vector<CheckRequest> requests;
+  EXPECT_CALL(mock_check_transport_, Check(_, _, _))
+      .WillRepeatedly(Invoke([&](const CheckRequest& request,
+                                 CheckResponse* response, DoneFunc on_done) {
+        requests.push_back(request);
+        response->mutable_precondition()->set_valid_use_count(1000);
+        for (const auto& it : request.quotas()) {
+          CheckResponse::QuotaResult quota_result;
+          quota_result.set_granted_amount(it.second.amount());
+          quota_result.mutable_valid_duration()->set_seconds(10);
+          (*response->mutable_quotas())[it.first] = quota_result;
+        }
+        on_done(Status::OK);
+      }));
+
+  std::vector<Requirement> other_quotas;
+  other_quotas.push_back({"OtherCount", 1});
+  for (int i = 0; i < 100; i++) {
+    client_->Check(request_, quotas_, empty_transport_,
+                   [](const CheckResponseInfo& info) {});
+    client_->Check(request_, other_quotas, empty_transport_,
+                   [](const CheckResponseInfo& info) {});
+    // The batch window ends every few checks.
+    if (mock_timer && i % 5 == 4) {
+      mock_timer->cb_();
+    }
+  }
+  ASSERT_TRUE(mock_timer != nullptr);
+  mock_timer->cb_();
+
+  // Once both quotas are in the quota cache, their prefetch calls are sent
+  // in one remote call.
+  int batched_requests = 0;
+  for (const auto& request : requests) {
+    if (request.quotas().size() == 2) {
+      ++batched_requests;
+    }
+  }
+  EXPECT_GT(batched_requests, 0);
+
+  Statistics stat;
+  client_->GetStatistics(&stat);
+  EXPECT_EQ(stat.total_batched_quota_calls, batched_requests);
+}
+
+TEST_F(MixerClientImplTest, TestDestroyedWithBatchedQuotaPrefetch) {
+  MixerClientOptions options(CheckOptions(1 /* entries */),
+                             ReportOptions(1, 1000),
+                             QuotaOptions(2 /* entries */, 600000));
+  options.quota_options.batch_window_ms = 10;
+  options.env.check_transport = mock_check_transport_.GetFunc();
+  options.env.timer_create_func =
+      [](std::function<void()> cb) -> std::unique_ptr<Timer> {
+    return std::unique_ptr<Timer>(new MockTimer);
+  };
+  client_ = CreateMixerClient(options);
+
+  // Only the first calls are done, to fill the caches.
+  int calls = 0;
+  std::vector<DoneFunc> pending;
+  EXPECT_CALL(mock_check_transport_, Check(_, _, _))
+      .WillRepeatedly(Invoke([&](const CheckRequest& request,
+                                 CheckResponse* response, DoneFunc on_done) {
+        response->mutable_precondition()->set_valid_use_count(1000);
+        for (const auto& it : request.quotas()) {
+          CheckResponse::QuotaResult quota_result;
+          quota_result.set_granted_amount(it.second.amount());
+          quota_result.mutable_valid_duration()->set_seconds(10);
+          (*response->mutable_quotas())[it.first] = quota_result;
+        }
+        if (++calls <= 2) {
+          on_done(Status::OK);
+        } else {
+          pending.push_back(on_done);
+        }
+      }));
+
+  std::vector<Requirement> other_quotas;
+  other_quotas.push_back({"OtherCount", 1});
+  for (int i = 0; i < 10; i++) {
+    client_->Check(request_, quotas_, empty_transport_,
+                   [](const CheckResponseInfo& info) {});
+    client_->Check(request_, other_quotas, empty_transport_,
+                   [](const CheckResponseInfo& info) {});
+  }
+
+  // The batched prefetch calls are sent by the destroyed client, and their
+  // responses are dropped.
+  int sent = calls;
+  client_.reset();
+  EXPECT_GT(calls, sent);
+  for (const auto& on_done : pending) {
+    on_done(Status::OK);
+  }
+}
+
+TEST_F(MixerClientImplTest, TestCacheSweep) {
+  std::vector<MockTimer*> timers;
+  MixerClientOptions options(CheckOptions(10 /* entries */),
+                             ReportOptions(1, 1000),
+                             QuotaOptions(10 /* entries */, 600000));
+  options.check_options.sweep_interval_ms = 1000;
+  options.env.check_transport = mock_check_transport_.GetFunc();
+  options.env.timer_create_func =
+      [&timers](std::function<void()> cb) -> std::unique_ptr<Timer> {
+    MockTimer* timer = new MockTimer;
+    timer->cb_ = cb;
+    timers.push_back(timer);
+    return std::unique_ptr<Timer>(timer);
+  };
+  client_ = CreateMixerClient(options);
+  // Only the check cache is swept.
+  ASSERT_EQ(timers.size(), 1);
+
+  EXPECT_CALL(mock_check_transport_, Check(_, _, _))
+      .WillOnce(Invoke([](const CheckRequest& request, CheckResponse* response,
+                          DoneFunc on_done) {
+        response->mutable_precondition()->set_valid_use_count(1);
+        on_done(Status::OK);
+      }));
+  std::vector<Requirement> empty_quotas;
+  for (int i = 0; i < 2; i++) {
+    client_->Check(request_, empty_quotas, empty_transport_,
+                   [](const CheckResponseInfo& info) {});
+  }
+
+  // The cached item is used up by the second call.
+  timers[0]->cb_();
+  Statistics stat;
+  client_->GetStatistics(&stat);
+  EXPECT_EQ(stat.check_cache_entries, 0);
+  EXPECT_EQ(stat.check_cache_swept_items, 1);
+  EXPECT_EQ(stat.quota_cache_swept_items, 0);
+}
+
+// A stats sink recording the pushed counters.
+class TestStatsSink : public StatsSink {
+ public:
+  void AddCounter(StatsCounter counter, uint64_t value) override {
+    counters_[static_cast<int>(counter)] += value;
+  }
+
+  uint64_t Get(StatsCounter counter) {
+    return counters_[static_cast<int>(counter)];
+  }
+
+ private:
+  std::map<int, uint64_t> counters_;
+};
+
+TEST_F(MixerClientImplTest, TestStatsSink) {
+  EXPECT_CALL(mock_check_transport_, Check(_, _, _))
+      .WillRepeatedly(Invoke([](const CheckRequest& request,
+                                CheckResponse* response, DoneFunc on_done) {
+        response->mutable_precondition()->set_valid_use_count(1000);
+        for (const auto& it : request.quotas()) {
+          CheckResponse::QuotaResult quota_result;
+          quota_result.set_granted_amount(10);
+          quota_result.mutable_valid_duration()->set_seconds(10);
+          (*response->mutable_quotas())[it.first] = quota_result;
+        }
+        on_done(Status::OK);
+      }));
+
+  auto sink = std::make_shared<TestStatsSink>();
+  MixerClientOptions options(CheckOptions(1 /* entries */),
+                             ReportOptions(1, 1000),
+                             QuotaOptions(1 /* entries */, 600000));
+  options.env.check_transport = mock_check_transport_.GetFunc();
+  options.env.report_transport = [](const ReportRequest& request,
+                                    ReportResponse* response,
+                                    DoneFunc on_done) -> CancelFunc {
+    on_done(Status::OK);
+    return nullptr;
+  };
+  options.env.stats_sink = sink;
+  client_ = CreateMixerClient(options);
+
+  for (int i = 0; i < 3; i++) {
+    client_->Check(request_, quotas_, empty_transport_,
+                   [](const CheckResponseInfo& info) {});
+  }
+  client_->Report(request_);
+  client_->Report(request_);
+
+  // The pushed counters are the same as the polled ones.
+  Statistics stat;
+  client_->GetStatistics(&stat);
+  EXPECT_EQ(sink->Get(StatsCounter::CHECK_CALLS), stat.total_check_calls);
+  EXPECT_EQ(sink->Get(StatsCounter::CHECK_CALLS), 3);
+  EXPECT_EQ(sink->Get(StatsCounter::REMOTE_CHECK_CALLS),
+            stat.total_remote_check_calls);
+  EXPECT_EQ(sink->Get(StatsCounter::BLOCKING_REMOTE_CHECK_CALLS),
+            stat.total_blocking_remote_check_calls);
+  EXPECT_EQ(sink->Get(StatsCounter::QUOTA_CALLS), stat.total_quota_calls);
+  EXPECT_EQ(sink->Get(StatsCounter::QUOTA_CALLS), 3);
+  EXPECT_EQ(sink->Get(StatsCounter::REMOTE_QUOTA_CALLS),
+            stat.total_remote_quota_calls);
+  EXPECT_EQ(sink->Get(StatsCounter::BLOCKING_REMOTE_QUOTA_CALLS),
+            stat.total_blocking_remote_quota_calls);
+  EXPECT_EQ(sink->Get(StatsCounter::REPORT_CALLS), 2);
+  EXPECT_EQ(sink->Get(StatsCounter::REMOTE_REPORT_CALLS),
+            stat.total_remote_report_calls);
+  EXPECT_EQ(sink->Get(StatsCounter::REMOTE_REPORT_CALLS), 2);
+}
+
+TEST_F(MixerClientImplTest, TestSharedQuotaCache) {
+  EXPECT_CALL(mock_check_transport_, Check(_, _, _))
+      .WillRepeatedly(Invoke([](const CheckRequest& request,
+                                CheckResponse* response, DoneFunc on_done) {
+        response->mutable_precondition()->set_valid_use_count(1000);
+        for (const auto& it : request.quotas()) {
+          CheckResponse::QuotaResult quota_result;
+          quota_result.set_granted_amount(it.second.amount());
+          quota_result.mutable_valid_duration()->set_seconds(10);
+          (*response->mutable_quotas())[it.first] = quota_result;
+        }
+        on_done(Status::OK);
+      }));
+
+  MixerClientOptions options(CheckOptions(1 /* entries */),
+                             ReportOptions(1, 1000),
+                             QuotaOptions(1 /* entries */, 600000));
+  options.env.check_transport = mock_check_transport_.GetFunc();
+  options.check_options.shared_cache =
+      CreateSharedCheckCache(options.check_options);
+  options.quota_options.shared_cache =
+      CreateSharedQuotaCache(options.quota_options);
+  auto client1 = CreateMixerClient(options);
+  auto client2 = CreateMixerClient(options);
+
+  // The first call fills the check cache, the second one fills the quota
+  // cache.
+  for (int i = 0; i < 2; i++) {
+    client1->Check(request_, quotas_, empty_transport_,
+                   [](const CheckResponseInfo& info) {});
+  }
+
+  // The other client draws from the same prefetched quota.
+  bool quota_cache_hit = false;
+  Status check_status;
+  client2->Check(
+      request_, quotas_, empty_transport_,
+      [&quota_cache_hit, &check_status](const CheckResponseInfo& info) {
+        quota_cache_hit = info.is_quota_cache_hit;
+        check_status = *info.response_status;
+      });
+  EXPECT_TRUE(quota_cache_hit);
+  EXPECT_OK(check_status);
+
+  Statistics stat;
+  client2->GetStatistics(&stat);
+  EXPECT_EQ(stat.total_blocking_remote_quota_calls, 0);
+  EXPECT_EQ(stat.quota_cache_entries, 1);
+}
+
+TEST_F(MixerClientImplTest, TestDeferredAttributes) {
+  MixerClientOptions options(CheckOptions(10 /*entries */),
+                             ReportOptions(1, 1000), QuotaOptions(0, 600000));
+  options.env.check_transport = mock_check_transport_.GetFunc();
+  client_ = CreateMixerClient(options);
+
+  // The first response references "user", the second one also references
+  // the deferred request.headers["k"].
+  int num_responses = 0;
+  EXPECT_CALL(mock_check_transport_, Check(_, _, _))
+      .Times(2)
+      .WillRepeatedly(Invoke([&num_responses](const CheckRequest& request,
+                                              CheckResponse* response,
+                                              DoneFunc on_done) {
+        auto referenced = response->mutable_precondition()
+                              ->mutable_referenced_attributes();
+        referenced->add_words("user");
+        auto match = referenced->add_attribute_matches();
+        match->set_condition(ReferencedAttributes::EXACT);
+        match->set_name(-1);
+        if (num_responses++ > 0) {
+          referenced->add_words("request.headers");
+          referenced->add_words("k");
+          match = referenced->add_attribute_matches();
+          match->set_condition(ReferencedAttributes::EXACT);
+          match->set_name(-2);
+          match->set_map_key(-3);
+        }
+        response->mutable_precondition()->set_valid_use_count(1000);
+        on_done(Status::OK);
+      }));
+
+  const std::vector<std::string> deferred_names = {"request.headers"};
+  int num_fills = 0;
+  auto check = [this, &deferred_names, &num_fills](const std::string& user) {
+    Attributes attributes;
+    utils::AttributesBuilder(&attributes).AddString("user", user);
+    std::vector<Requirement> empty_quotas;
+    bool cache_hit = false;
+    Status check_status;
+    client_->Check(&attributes, deferred_names,
+                   [&num_fills](Attributes* attributes) {
+                     ++num_fills;
+                     utils::AttributesBuilder(attributes)
+                         .AddStringMap("request.headers", {{"k", "v"}});
+                   },
+                   empty_quotas, empty_transport_,
+                   [&cache_hit, &check_status](const CheckResponseInfo& info) {
+                     cache_hit = info.is_check_cache_hit;
+                     check_status = *info.response_status;
+                   });
+    EXPECT_OK(check_status);
+    return cache_hit;
+  };
+
+  // A miss fills the deferred attributes for the remote call.
+  EXPECT_FALSE(check("user1"));
+  EXPECT_EQ(num_fills, 1);
+  // A hit not using them skips them.
+  EXPECT_TRUE(check("user1"));
+  EXPECT_EQ(num_fills, 1);
+
+  // Once a shape uses them, they are filled before the lookup.
+  EXPECT_FALSE(check("user2"));
+  EXPECT_EQ(num_fills, 2);
+  EXPECT_TRUE(check("user2"));
+  EXPECT_EQ(num_fills, 3);
+
+  Statistics stat;
+  client_->GetStatistics(&stat);
+  EXPECT_EQ(stat.total_check_calls, 4);
+  EXPECT_EQ(stat.total_remote_check_calls, 2);
+}
+
+TEST_F(MixerClientImplTest, TestSharedReportBatch) {
+  // No timer, the batches are flushed when full.
+  MixerClientOptions options(CheckOptions(0), ReportOptions(4, 1000),
+                             QuotaOptions(0, 1000));
+  std::vector<int> batch_sizes;
+  options.env.report_transport = [&batch_sizes](const ReportRequest& request,
+                                                ReportResponse* response,
+                                                DoneFunc on_done) {
+    batch_sizes.push_back(request.attributes_size());
+    on_done(Status::OK);
+    return CancelFunc();
+  };
+  options.report_options.shared_batch = CreateSharedReportBatch(options);
+  auto client1 = CreateMixerClient(options);
+  auto client2 = CreateMixerClient(options);
+
+  // The reports of both clients fill the same batches.
+  for (int i = 0; i < 4; ++i) {
+    client1->Report(request_);
+    client2->Report(request_);
+  }
+  EXPECT_EQ(batch_sizes, std::vector<int>({4, 4}));
+
+  // Each client only counts its own report calls, the batch has the rest.
+  Statistics stat;
+  client1->GetStatistics(&stat);
+  EXPECT_EQ(stat.total_report_calls, 4);
+  EXPECT_EQ(stat.total_remote_report_calls, 0);
+  GetReportBatchStatistics(*options.report_options.shared_batch, &stat);
+  EXPECT_EQ(stat.total_report_calls, 8);
+  EXPECT_EQ(stat.total_remote_report_calls, 2);
+
+  // The pending reports are sent when the last client is destroyed.
+  client1->Report(request_);
+  client1.reset();
+  EXPECT_EQ(batch_sizes.size(), 2);
+  client2->Report(request_);
+  options.report_options.shared_batch.reset();
+  client2.reset();
+  EXPECT_EQ(batch_sizes, std::vector<int>({4, 4, 2}));
+}
+
+TEST_F(MixerClientImplTest, TestOverloaded) {
+  MixerClientOptions options(CheckOptions(4 /*entries */),
+                             ReportOptions(1, 1000), QuotaOptions(0, 600000));
+  options.check_options.network_fail_open = false;
+  options.report_options.overload_sample_rate = 4;
+  options.env.check_transport = mock_check_transport_.GetFunc();
+  int num_remote_reports = 0;
+  options.env.report_transport = [&num_remote_reports](
+                                     const ReportRequest& request,
+                                     ReportResponse* response,
+                                     DoneFunc on_done) -> CancelFunc {
+    ++num_remote_reports;
+    on_done(Status::OK);
+    return nullptr;
+  };
+  client_ = CreateMixerClient(options);
+
+  // Each user is cached by its own item.
+  EXPECT_CALL(mock_check_transport_, Check(_, _, _))
+      .Times(4)
+      .WillRepeatedly(Invoke([](const CheckRequest& request,
+                                CheckResponse* response, DoneFunc on_done) {
+        auto referenced = response->mutable_precondition()
+                              ->mutable_referenced_attributes();
+        referenced->add_words("user");
+        auto match = referenced->add_attribute_matches();
+        match->set_condition(ReferencedAttributes::EXACT);
+        match->set_name(-1);
+        response->mutable_precondition()->set_valid_use_count(1000);
+        on_done(Status::OK);
+      }));
+  std::vector<Requirement> empty_quotas;
+  auto check = [this, &empty_quotas](const std::string& user) {
+    Attributes attributes;
+    utils::AttributesBuilder(&attributes).AddString("user", user);
+    std::pair<Status, bool> result;
+    client_->Check(attributes, empty_quotas, empty_transport_,
+                   [&result](const CheckResponseInfo& info) {
+                     result = {*info.response_status, info.is_check_cache_hit};
+                   });
+    return result;
+  };
+  for (int i = 0; i < 4; ++i) {
+    EXPECT_OK(check("user" + std::to_string(i)).first);
+  }
+
+  // Half of the cache is evicted, the most recently used items are kept.
+  client_->SetOverloaded(true);
+  EXPECT_TRUE(check("user3").second);
+  // A miss fails closed without a remote call.
+  std::pair<Status, bool> result = check("user0");
+  EXPECT_FALSE(result.second);
+  EXPECT_EQ(result.first.error_code(), Code::UNAVAILABLE);
+
+  // One in 4 reports is sent.
+  for (int i = 0; i < 8; ++i) {
+    client_->Report(request_);
+  }
+  EXPECT_EQ(num_remote_reports, 2);
+
+  Statistics stat;
+  client_->GetStatistics(&stat);
+  EXPECT_EQ(stat.total_remote_check_calls, 4);
+  EXPECT_EQ(stat.total_overload_shed_check_calls, 1);
+  EXPECT_EQ(stat.total_overload_evicted_cache_items, 2);
+  EXPECT_EQ(stat.total_overload_dropped_report_calls, 6);
+  EXPECT_EQ(stat.total_report_calls, 8);
+  EXPECT_EQ(stat.check_cache_entries, 2);
+
+  // All reports are sent again once the overload is over.
+  client_->SetOverloaded(false);
+  client_->Report(request_);
+  EXPECT_EQ(num_remote_reports, 3);
+}
+
+TEST_F(MixerClientImplTest, TestCheckBreaker) {
+  MixerClientOptions options(CheckOptions(0 /*entries */),
+                             ReportOptions(1, 1000), QuotaOptions(0, 600000));
+  options.check_options.network_fail_open = true;
+  options.check_options.breaker_consecutive_failures = 2;
+  options.check_options.breaker_cooldown_ms = 60000;
+  options.env.check_transport = mock_check_transport_.GetFunc();
+  client_ = CreateMixerClient(options);
+
+  // The breaker opens after two failures, no more remote calls are made.
+  EXPECT_CALL(mock_check_transport_, Check(_, _, _))
+      .Times(2)
+      .WillRepeatedly(Invoke([](const CheckRequest& request,
+                                CheckResponse* response, DoneFunc on_done) {
+        on_done(Status(Code::UNAVAILABLE, "unavailable"));
+      }));
+  std::vector<Requirement> empty_quotas;
+  for (int i = 0; i < 5; ++i) {
+    Status check_status;
+    client_->Check(request_, empty_quotas, empty_transport_,
+                   [&check_status](const CheckResponseInfo& info) {
+                     check_status = *info.response_status;
+                   });
+    // The shed checks fail open as for a network failure.
+    EXPECT_OK(check_status);
+  }
+
+  Statistics stat;
+  client_->GetStatistics(&stat);
+  EXPECT_EQ(stat.total_check_calls, 5);
+  EXPECT_EQ(stat.total_remote_check_calls, 2);
+  EXPECT_EQ(stat.total_breaker_shed_check_calls, 3);
+}
+
+TEST_F(MixerClientImplTest, TestCancelledBreakerProbe) {
+  MixerClientOptions options(CheckOptions(0 /*entries */),
+                             ReportOptions(1, 1000), QuotaOptions(0, 600000));
+  options.check_options.network_fail_open = true;
+  options.check_options.breaker_consecutive_failures = 1;
+  options.check_options.breaker_cooldown_ms = 20;
+  std::vector<DoneFunc> pending;
+  int cancelled = 0;
+  options.env.check_transport = [&](const CheckRequest& request,
+                                    CheckResponse* response,
+                                    DoneFunc on_done) -> CancelFunc {
+    pending.push_back(on_done);
+    return [&cancelled]() { ++cancelled; };
+  };
+  client_ = CreateMixerClient(options);
+
+  std::vector<Requirement> empty_quotas;
+  auto on_done = [](const CheckResponseInfo&) {};
+  client_->Check(request_, empty_quotas, empty_transport_, on_done);
+  ASSERT_EQ(pending.size(), 1);
+  pending[0](Status(Code::UNAVAILABLE, "unavailable"));
+
+  // Half open after the cooldown, the probe is cancelled.
+  std::this_thread::sleep_for(std::chrono::milliseconds(25));
+  CancelFunc probe =
+      client_->Check(request_, empty_quotas, empty_transport_, on_done);
+  ASSERT_EQ(pending.size(), 2);
+  probe();
+  EXPECT_EQ(cancelled, 1);
+
+  // The next check probes without waiting for the cancelled one to be
+  // given up, and closes the breaker.
+  client_->Check(request_, empty_quotas, empty_transport_, on_done);
+  ASSERT_EQ(pending.size(), 3);
+  pending[2](Status::OK);
+  client_->Check(request_, empty_quotas, empty_transport_, on_done);
+  EXPECT_EQ(pending.size(), 4);
+
+  Statistics stat;
+  client_->GetStatistics(&stat);
+  EXPECT_EQ(stat.total_breaker_shed_check_calls, 0);
+}
+
+TEST_F(MixerClientImplTest, TestCheckBreakerWithCoalescedChecks) {
+  MixerClientOptions options(CheckOptions(1 /*entries */),
+                             ReportOptions(1, 1000), QuotaOptions(0, 600000));
+  options.check_options.network_fail_open = true;
+  options.check_options.breaker_consecutive_failures = 2;
+  options.check_options.breaker_cooldown_ms = 60000;
+  std::vector<DoneFunc> pending;
+  options.env.check_transport = [&](const CheckRequest& request,
+                                    CheckResponse* response,
+                                    DoneFunc on_done) -> CancelFunc {
+    // Cached response is expired right away.
+    response->mutable_precondition()->set_valid_use_count(1000);
+    *response->mutable_precondition()->mutable_valid_duration() =
+        utils::CreateDuration(std::chrono::nanoseconds(0));
+    pending.push_back(on_done);
+    return nullptr;
+  };
+  client_ = CreateMixerClient(options);
+
+  std::vector<Requirement> empty_quotas;
+  int num_ok = 0;
+  auto on_done = [&num_ok](const CheckResponseInfo& info) {
+    if (info.response_status->ok()) {
+      ++num_ok;
+    }
+  };
+  // The first call learns the Referenced from its response.
+  client_->Check(request_, empty_quotas, empty_transport_, on_done);
+  ASSERT_EQ(pending.size(), 1);
+  pending[0](Status::OK);
+
+  // A failed remote call is one failure, not one per coalesced check.
+  for (int i = 0; i < 4; i++) {
+    client_->Check(request_, empty_quotas, empty_transport_, on_done);
+  }
+  ASSERT_EQ(pending.size(), 2);
+  pending[1](Status(Code::UNAVAILABLE, "unavailable"));
+  // The followers fail open with the leader.
+  EXPECT_EQ(num_ok, 5);
+  client_->Check(request_, empty_quotas, empty_transport_, on_done);
+  ASSERT_EQ(pending.size(), 3);
+
+  // The second failure opens the breaker. The follower of the failed call
+  // is answered, the next miss is shed without a follower waiting for it.
+  client_->Check(request_, empty_quotas, empty_transport_, on_done);
+  pending[2](Status(Code::UNAVAILABLE, "unavailable"));
+  EXPECT_EQ(num_ok, 7);
+  client_->Check(request_, empty_quotas, empty_transport_, on_done);
+  client_->Check(request_, empty_quotas, empty_transport_, on_done);
+  EXPECT_EQ(pending.size(), 3);
+  EXPECT_EQ(num_ok, 9);
+
+  Statistics stat;
+  client_->GetStatistics(&stat);
+  EXPECT_EQ(stat.total_remote_check_calls, 3);
+  EXPECT_EQ(stat.total_coalesced_check_calls, 4);
+  EXPECT_EQ(stat.total_breaker_shed_check_calls, 2);
+}
+
 }  // namespace
 }  // namespace mixerclient
 }  // namespace istio
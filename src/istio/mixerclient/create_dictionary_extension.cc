@@ -0,0 +1,75 @@
+/* Copyright 2018 Istio Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Builds a global dictionary extension from a traffic capture: the words
+// of the captured attributes missing from the global dictionary that would
+// save the most bytes. The extension is written to output_file, to be
+// loaded by the proxies, and the words are printed as a YAML list to be
+// appended to the global dictionary of Mixer.
+// Usage: create_dictionary_extension capture_file output_file [max_words]
+//            [min_count]
+// max_words defaults to 256 and min_count, the number of captured calls a
+// word must be used in, to 100.
+
+#include "include/istio/mixerclient/dictionary_extension.h"
+#include "include/istio/mixerclient/traffic_capture.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+
+int main(int argc, char** argv) {
+  if (argc < 3) {
+    fprintf(stderr,
+            "Usage: %s capture_file output_file [max_words] [min_count]\n",
+            argv[0]);
+    return 1;
+  }
+  std::vector<::istio::mixerclient::TrafficCaptureRecord> records;
+  if (!::istio::mixerclient::ReadTrafficCapture(argv[1], &records)) {
+    fprintf(stderr, "Failed to read capture %s, %zu records read\n", argv[1],
+            records.size());
+    if (records.empty()) {
+      return 1;
+    }
+  }
+  size_t max_words = argc > 3 ? atoi(argv[3]) : 256;
+  int64_t min_count = argc > 4 ? atoi(argv[4]) : 100;
+
+  ::istio::mixerclient::DictionaryExtensionBuilder builder;
+  for (const auto& record : records) {
+    builder.Add(record.attributes);
+  }
+  std::vector<std::string> words = builder.Build(max_words, min_count);
+  if (!::istio::mixerclient::WriteDictionaryExtension(argv[2], words)) {
+    fprintf(stderr, "Failed to write %s\n", argv[2]);
+    return 1;
+  }
+  for (const std::string& word : words) {
+    // Quoted as a YAML string.
+    printf("- \"");
+    for (char c : word) {
+      if (c == '"' || c == '\\') {
+        putchar('\\');
+      }
+      putchar(c);
+    }
+    printf("\"\n");
+  }
+  fprintf(stderr, "%zu words from %zu records\n", words.size(),
+          records.size());
+  return 0;
+}
@@ -33,6 +33,9 @@ TOP = r"""/* Copyright 2017 Istio Authors. All Rights Reserved.
 
 #include "src/istio/mixerclient/global_dictionary.h"
 
+#include <stdint.h>
+#include <string.h>
+
 namespace istio {
 namespace mixerclient {
 namespace {
@@ -49,21 +52,171 @@ namespace {
 const std::vector<std::string> kGlobalWords{
 """
 
+MIDDLE = r"""};
+
+// A minimal perfect hash of the global words. A word is hashed once, the
+// hash picks a seed from kSeeds, and the mixed hash and seed is the slot
+// of the only global word the word can be.
+const uint64_t kSeeds[] = {
+"""
+
 BOTTOM = r"""};
 
+// The global word of each slot.
+struct Slot {
+  const char* data;
+  size_t size;
+  int index;
+};
+const Slot kSlots[] = {
+%s};
+
+const uint64_t kNumSlots = %d;
+
+// Loads less than 8 bytes in little endian order.
+uint64_t Load(const char* data, size_t size) {
+  uint64_t v = 0;
+  for (size_t i = 0; i < size; ++i) {
+    v |= static_cast<uint64_t>(static_cast<unsigned char>(data[i])) << (8 * i);
+  }
+  return v;
+}
+
+// Loads 8 bytes in little endian order, compiled into one load.
+uint64_t Load8(const char* data) {
+  const unsigned char* p = reinterpret_cast<const unsigned char*>(data);
+  return static_cast<uint64_t>(p[0]) | static_cast<uint64_t>(p[1]) << 8 |
+         static_cast<uint64_t>(p[2]) << 16 | static_cast<uint64_t>(p[3]) << 24 |
+         static_cast<uint64_t>(p[4]) << 32 | static_cast<uint64_t>(p[5]) << 40 |
+         static_cast<uint64_t>(p[6]) << 48 | static_cast<uint64_t>(p[7]) << 56;
+}
+
+// Hashes a word 8 bytes at a time. The last bytes of a word longer than 8
+// bytes are loaded as an overlapping 8 bytes block.
+uint64_t WordHash(const char* data, size_t size) {
+  uint64_t h = size * 0x9e3779b97f4a7c15ULL;
+  if (size < 8) {
+    h = (h ^ Load(data, size)) * 0x9e3779b97f4a7c15ULL;
+    return h ^ (h >> 32);
+  }
+  for (size_t i = 0; i + 8 <= size; i += 8) {
+    h = (h ^ Load8(data + i)) * 0x9e3779b97f4a7c15ULL;
+    h ^= h >> 32;
+  }
+  if (size %% 8 != 0) {
+    h = (h ^ Load8(data + size - 8)) * 0x9e3779b97f4a7c15ULL;
+    h ^= h >> 32;
+  }
+  return h;
+}
+
+// The splitmix64 finalizer.
+uint64_t Mix(uint64_t x) {
+  x ^= x >> 30;
+  x *= 0xbf58476d1ce4e5b9ULL;
+  x ^= x >> 27;
+  x *= 0x94d049bb133111ebULL;
+  x ^= x >> 31;
+  return x;
+}
+
 }  // namespace
 
 const std::vector<std::string>& GetGlobalWords() { return kGlobalWords; }
 
+int LookupGlobalWord(const char* data, size_t size) {
+  uint64_t h = WordHash(data, size);
+  const Slot& slot = kSlots[Mix(h ^ kSeeds[h %% kNumSlots]) %% kNumSlots];
+  if (slot.size == size && memcmp(slot.data, data, size) == 0) {
+    return slot.index;
+  }
+  return -1;
+}
+
 }  // namespace mixerclient
 }  // namespace istio"""
 
-all_words = ''
+MASK = (1 << 64) - 1
+
+
+def load(data):
+    v = 0
+    for i, c in enumerate(data):
+        v |= c << (8 * i)
+    return v
+
+
+def word_hash(word):
+    data = bytearray(word.encode('utf-8'))
+    size = len(data)
+    h = (size * 0x9e3779b97f4a7c15) & MASK
+    if size < 8:
+        blocks = [data]
+    else:
+        blocks = [data[i:i + 8] for i in range(0, size - 7, 8)]
+        if size % 8 != 0:
+            blocks.append(data[size - 8:])
+    for block in blocks:
+        h = ((h ^ load(block)) * 0x9e3779b97f4a7c15) & MASK
+        h ^= h >> 32
+    return h
+
+
+def mix(x):
+    x ^= x >> 30
+    x = (x * 0xbf58476d1ce4e5b9) & MASK
+    x ^= x >> 27
+    x = (x * 0x94d049bb133111eb) & MASK
+    x ^= x >> 31
+    return x
+
+
+def perfect_hash(words):
+    """Returns the seed of each bucket and the word index of each slot.
+
+    Words are bucketed by their hash, then a seed is searched for each
+    bucket, the biggest first, to place all its words in free slots.
+    A duplicated word takes the index of its last occurrence.
+    """
+    last_index = {}
+    for i, word in enumerate(words):
+        last_index[word] = i
+    n = len(last_index)
+    buckets = [[] for _ in range(n)]
+    for word in last_index:
+        h = word_hash(word)
+        buckets[h % n].append(h)
+    seeds = [0] * n
+    slots = [-1] * n
+    index_by_hash = dict((word_hash(w), i) for w, i in last_index.items())
+    assert len(index_by_hash) == n, "global words have the same hash"
+    for b in sorted(range(n), key=lambda b: -len(buckets[b])):
+        if not buckets[b]:
+            break
+        seed = 0
+        while True:
+            taken = [mix(h ^ seed) % n for h in buckets[b]]
+            if (len(set(taken)) == len(taken) and
+                    all(slots[s] < 0 for s in taken)):
+                break
+            seed += 1
+        seeds[b] = seed
+        for h, s in zip(buckets[b], taken):
+            slots[s] = index_by_hash[h]
+    return seeds, slots
+
+
+words = []
 with open(sys.argv[1]) as src_file:
     for line in src_file:
         if line.startswith("-"):
-            all_words += "    \"" + line[1:].strip() + "\",\n"
-
-print TOP + all_words + BOTTOM
+            words.append(line[1:].strip())
 
+seeds, slots = perfect_hash(words)
+all_words = ''.join('    "%s",\n' % word for word in words)
+all_seeds = ''.join('    %dULL,\n' % seed for seed in seeds)
+all_slots = ''.join('    {"%s", %d, %d},\n' %
+                    (words[slot], len(words[slot].encode('utf-8')), slot)
+                    for slot in slots)
 
+print(TOP + all_words + MIDDLE + all_seeds + BOTTOM % (all_slots, len(slots)))
@@ -13,63 +13,172 @@
  * limitations under the License.
  */
 #include "src/istio/mixerclient/delta_update.h"
+#include "include/istio/utils/fast_hash.h"
 
-#include "google/protobuf/util/message_differencer.h"
+#include <vector>
 
-#include <set>
-
-using ::google::protobuf::util::MessageDifferencer;
 using ::istio::mixer::v1::Attributes_AttributeValue;
 
 namespace istio {
 namespace mixerclient {
 namespace {
 
+// Returns a 64 bit hash of a value. String map entries are combined in an
+// order independent way since protobuf map order is not deterministic.
+uint64_t ValueHash(const Attributes_AttributeValue& value) {
+  utils::FastHash hasher;
+  hasher.Update(static_cast<int>(value.value_case()));
+  switch (value.value_case()) {
+    case Attributes_AttributeValue::kStringValue:
+      hasher.Update(value.string_value());
+      break;
+    case Attributes_AttributeValue::kBytesValue:
+      hasher.Update(value.bytes_value());
+      break;
+    case Attributes_AttributeValue::kInt64Value: {
+      int64_t v = value.int64_value();
+      hasher.Update(&v, sizeof(v));
+    } break;
+    case Attributes_AttributeValue::kDoubleValue: {
+      double v = value.double_value();
+      hasher.Update(&v, sizeof(v));
+    } break;
+    case Attributes_AttributeValue::kBoolValue:
+      hasher.Update(value.bool_value() ? 1 : 0);
+      break;
+    case Attributes_AttributeValue::kTimestampValue: {
+      int64_t seconds = value.timestamp_value().seconds();
+      hasher.Update(&seconds, sizeof(seconds));
+      hasher.Update(value.timestamp_value().nanos());
+    } break;
+    case Attributes_AttributeValue::kDurationValue: {
+      int64_t seconds = value.duration_value().seconds();
+      hasher.Update(&seconds, sizeof(seconds));
+      hasher.Update(value.duration_value().nanos());
+    } break;
+    case Attributes_AttributeValue::kStringMapValue: {
+      uint64_t sum = 0;
+      for (const auto& it : value.string_map_value().entries()) {
+        utils::FastHash entry_hasher;
+        entry_hasher.Update(it.first).Update(static_cast<int>(it.first.size()));
+        entry_hasher.Update(it.second);
+        sum += entry_hasher.Digest().low;
+      }
+      hasher.Update(&sum, sizeof(sum));
+    } break;
+    case Attributes_AttributeValue::VALUE_NOT_SET:
+      break;
+  }
+  return hasher.Digest().low;
+}
+
+// Compares two values by their type.
+bool ValueEquals(const Attributes_AttributeValue& a,
+                 const Attributes_AttributeValue& b) {
+  if (a.value_case() != b.value_case()) {
+    return false;
+  }
+  switch (a.value_case()) {
+    case Attributes_AttributeValue::kStringValue:
+      return a.string_value() == b.string_value();
+    case Attributes_AttributeValue::kBytesValue:
+      return a.bytes_value() == b.bytes_value();
+    case Attributes_AttributeValue::kInt64Value:
+      return a.int64_value() == b.int64_value();
+    case Attributes_AttributeValue::kDoubleValue:
+      return a.double_value() == b.double_value();
+    case Attributes_AttributeValue::kBoolValue:
+      return a.bool_value() == b.bool_value();
+    case Attributes_AttributeValue::kTimestampValue:
+      return a.timestamp_value().seconds() == b.timestamp_value().seconds() &&
+             a.timestamp_value().nanos() == b.timestamp_value().nanos();
+    case Attributes_AttributeValue::kDurationValue:
+      return a.duration_value().seconds() == b.duration_value().seconds() &&
+             a.duration_value().nanos() == b.duration_value().nanos();
+    case Attributes_AttributeValue::kStringMapValue: {
+      const auto& a_map = a.string_map_value().entries();
+      const auto& b_map = b.string_map_value().entries();
+      if (a_map.size() != b_map.size()) {
+        return false;
+      }
+      for (const auto& it : a_map) {
+        const auto& b_it = b_map.find(it.first);
+        if (b_it == b_map.end() || b_it->second != it.second) {
+          return false;
+        }
+      }
+      return true;
+    }
+    case Attributes_AttributeValue::VALUE_NOT_SET:
+      return true;
+  }
+  return false;
+}
+
+// Returns the slot of a dictionary index. Global indexes are positive and
+// per message indexes are negative, they are interleaved.
+size_t Slot(int index) { return index >= 0 ? 2 * index : -2 * index - 1; }
+
 class DeltaUpdateImpl : public DeltaUpdate {
  public:
+  DeltaUpdateImpl() : round_(1), prev_count_(0), count_(0), seen_(0) {}
+
   // Start a update for a request.
   void Start() override {
-    prev_set_.clear();
-    for (const auto& it : prev_map_) {
-      prev_set_.insert(it.first);
-    }
+    ++round_;
+    prev_count_ = count_;
+    count_ = 0;
+    seen_ = 0;
   }
 
   bool Check(int index, const Attributes_AttributeValue& value) override {
-    bool same = false;
-    const auto& it = prev_map_.find(index);
-    if (it != prev_map_.end()) {
-      if (MessageDifferencer::Equals(it->second, value)) {
-        same = true;
-      }
+    size_t slot = Slot(index);
+    if (slot >= values_.size()) {
+      values_.resize(slot + 1);
     }
-    if (!same) {
-      prev_map_[index] = value;
+    PrevValue& prev = values_[slot];
+    bool in_prev = prev.round == round_ - 1;
+    if (in_prev) {
+      ++seen_;
     }
-    prev_set_.erase(index);
-    return same;
+    ++count_;
+    prev.round = round_;
+
+    uint64_t hash = ValueHash(value);
+    if (in_prev && prev.hash == hash && ValueEquals(prev.value, value)) {
+      return true;
+    }
+    prev.hash = hash;
+    prev.value.CopyFrom(value);
+    return false;
   }
 
   // "deleted" is not supported for now. If some attributes are missing,
   // return false to indicate delta update is not supported.
-  bool Finish() override { return prev_set_.empty(); }
+  bool Finish() override { return seen_ == prev_count_; }
 
  private:
-  // The remaining attributes from previous.
-  std::set<int> prev_set_;
+  // The previous value of an attribute.
+  struct PrevValue {
+    PrevValue() : round(0), hash(0) {}
+    // The last round the attribute is checked, 0 for never. Rounds start
+    // from 2 so a never checked attribute is not in the previous round.
+    uint64_t round;
+    uint64_t hash;
+    Attributes_AttributeValue value;
+  };
 
-  // The attribute map from previous.
-  std::map<int, Attributes_AttributeValue> prev_map_;
-};
+  // The previous values indexed by Slot().
+  std::vector<PrevValue> values_;
 
-// An optimization for non-delta update case.
-class DeltaUpdateNoOpImpl : public DeltaUpdate {
- public:
-  void Start() override {}
-  bool Check(int index, const Attributes_AttributeValue& value) override {
-    return false;
-  }
-  bool Finish() override { return true; }
+  // The current round, increased by Start().
+  uint64_t round_;
+  // The number of attributes in the previous round.
+  int prev_count_;
+  // The number of attributes checked in the current round.
+  int count_;
+  // The number of them also in the previous round.
+  int seen_;
 };
 
 }  // namespace
@@ -78,9 +187,5 @@ std::unique_ptr<DeltaUpdate> DeltaUpdate::Create() {
   return std::unique_ptr<DeltaUpdate>(new DeltaUpdateImpl);
 }
 
-std::unique_ptr<DeltaUpdate> DeltaUpdate::CreateNoOp() {
-  return std::unique_ptr<DeltaUpdate>(new DeltaUpdateNoOpImpl);
-}
-
 }  // namespace mixerclient
 }  // namespace istio
@@ -48,9 +48,6 @@ class DeltaUpdate {
 
   // Create an instance.
   static std::unique_ptr<DeltaUpdate> Create();
-
-  // Create an no-op instance; an optimization for no delta update cases.
-  static std::unique_ptr<DeltaUpdate> CreateNoOp();
 };
 
 }  // namespace mixerclient
@@ -98,5 +98,50 @@ TEST_F(DeltaUpdateTest, TestDifferentType) {
   EXPECT_FALSE(update_->Check(1, StringValue("")));
 }
 
+TEST_F(DeltaUpdateTest, TestStringMapOrder) {
+  // String maps with the same entries are the same in any order.
+  Attributes_AttributeValue map_value;
+  auto entries = map_value.mutable_string_map_value()->mutable_entries();
+  for (int i = 0; i < 20; ++i) {
+    (*entries)["key" + std::to_string(i)] = "value";
+  }
+  Attributes_AttributeValue reversed_value;
+  entries = reversed_value.mutable_string_map_value()->mutable_entries();
+  for (int i = 19; i >= 0; --i) {
+    (*entries)["key" + std::to_string(i)] = "value";
+  }
+
+  update_->Start();
+  EXPECT_TRUE(update_->Check(1, Int64Value(1)));
+  EXPECT_TRUE(update_->Check(2, Int64Value(2)));
+  EXPECT_FALSE(update_->Check(3, map_value));
+  EXPECT_TRUE(update_->Finish());
+
+  update_->Start();
+  EXPECT_TRUE(update_->Check(1, Int64Value(1)));
+  EXPECT_TRUE(update_->Check(2, Int64Value(2)));
+  EXPECT_TRUE(update_->Check(3, reversed_value));
+  EXPECT_TRUE(update_->Finish());
+}
+
+TEST_F(DeltaUpdateTest, TestMessageDictIndex) {
+  // Negative per message indexes do not collide with global ones.
+  update_->Start();
+  EXPECT_TRUE(update_->Check(1, Int64Value(1)));
+  EXPECT_TRUE(update_->Check(2, Int64Value(2)));
+  EXPECT_TRUE(update_->Check(3, string_map_value_));
+  EXPECT_FALSE(update_->Check(-1, Int64Value(1)));
+  EXPECT_FALSE(update_->Check(-2, Int64Value(2)));
+  EXPECT_TRUE(update_->Finish());
+
+  update_->Start();
+  EXPECT_TRUE(update_->Check(1, Int64Value(1)));
+  EXPECT_TRUE(update_->Check(2, Int64Value(2)));
+  EXPECT_TRUE(update_->Check(3, string_map_value_));
+  EXPECT_TRUE(update_->Check(-1, Int64Value(1)));
+  EXPECT_FALSE(update_->Check(-2, Int64Value(3)));
+  EXPECT_TRUE(update_->Finish());
+}
+
 }  // namespace mixerclient
 }  // namespace istio
@@ -0,0 +1,145 @@
+/* Copyright 2018 Istio Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "include/istio/mixerclient/dictionary_extension.h"
+#include "google/protobuf/stubs/logging.h"
+#include "include/istio/utils/fast_hash.h"
+#include "src/istio/mixerclient/global_dictionary.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <fstream>
+
+using ::istio::mixer::v1::Attributes;
+using ::istio::mixer::v1::Attributes_AttributeValue;
+
+namespace istio {
+namespace mixerclient {
+namespace {
+
+// The header of an extension file, it changes with the file format.
+const char kExtensionHeader[] = "istio-mixer-dictionary-1";
+
+// Returns the fingerprint of the global words, an extension is only valid
+// for the words it was built for.
+uint64_t GlobalWordsFingerprint() {
+  ::istio::utils::FastHash hasher;
+  for (const std::string& word : GetGlobalWords()) {
+    hasher.Update(word.data(), word.size() + 1);
+  }
+  return hasher.Digest().low;
+}
+
+// Returns true if the word can be written on a line.
+bool IsLineWord(const std::string& word) {
+  return !word.empty() && word.find_first_of("\r\n") == std::string::npos;
+}
+
+}  // namespace
+
+void DictionaryExtensionBuilder::AddWord(const std::string& word) {
+  if (IsLineWord(word) && LookupGlobalWord(word.data(), word.size()) < 0) {
+    ++counts_[word];
+  }
+}
+
+void DictionaryExtensionBuilder::Add(const Attributes& attributes) {
+  for (const auto& it : attributes.attributes()) {
+    AddWord(it.first);
+    const Attributes_AttributeValue& value = it.second;
+    if (value.value_case() == Attributes_AttributeValue::kStringValue) {
+      AddWord(value.string_value());
+    } else if (value.value_case() ==
+               Attributes_AttributeValue::kStringMapValue) {
+      for (const auto& entry : value.string_map_value().entries()) {
+        AddWord(entry.first);
+        AddWord(entry.second);
+      }
+    }
+  }
+}
+
+std::vector<std::string> DictionaryExtensionBuilder::Build(
+    size_t max_words, int64_t min_count) const {
+  // A global word saves its bytes in each message it is used in.
+  std::vector<std::pair<int64_t, const std::string*>> candidates;
+  for (const auto& it : counts_) {
+    if (it.second >= min_count) {
+      candidates.emplace_back(it.second * it.first.size(), &it.first);
+    }
+  }
+  std::sort(candidates.begin(), candidates.end(),
+            [](const std::pair<int64_t, const std::string*>& a,
+               const std::pair<int64_t, const std::string*>& b) {
+              if (a.first != b.first) {
+                return a.first > b.first;
+              }
+              return *a.second < *b.second;
+            });
+  std::vector<std::string> words;
+  for (size_t i = 0; i < candidates.size() && i < max_words; ++i) {
+    words.push_back(*candidates[i].second);
+  }
+  return words;
+}
+
+bool WriteDictionaryExtension(const std::string& file,
+                              const std::vector<std::string>& words) {
+  std::ofstream out(file, std::ios::trunc);
+  char fingerprint[17];
+  snprintf(fingerprint, sizeof(fingerprint), "%016" PRIx64,
+           GlobalWordsFingerprint());
+  out << kExtensionHeader << " " << GetGlobalWords().size() << " "
+      << fingerprint << "\n";
+  for (const std::string& word : words) {
+    if (IsLineWord(word)) {
+      out << word << "\n";
+    }
+  }
+  out.close();
+  return !out.fail();
+}
+
+bool ReadDictionaryExtension(const std::string& file,
+                             std::vector<std::string>* words) {
+  std::ifstream in(file);
+  std::string header;
+  size_t num_global_words;
+  std::string fingerprint;
+  if (!(in >> header >> num_global_words >> fingerprint) ||
+      header != kExtensionHeader) {
+    GOOGLE_LOG(ERROR) << "Invalid dictionary extension " << file;
+    return false;
+  }
+  if (num_global_words != GetGlobalWords().size() ||
+      strtoull(fingerprint.c_str(), nullptr, 16) != GlobalWordsFingerprint()) {
+    GOOGLE_LOG(ERROR) << "Dictionary extension " << file
+                      << " was built for other global words";
+    return false;
+  }
+  std::string word;
+  std::getline(in, word);
+  while (std::getline(in, word)) {
+    if (!word.empty()) {
+      words->push_back(word);
+    }
+  }
+  return true;
+}
+
+}  // namespace mixerclient
+}  // namespace istio
@@ -0,0 +1,93 @@
+/* Copyright 2018 Istio Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "include/istio/mixerclient/dictionary_extension.h"
+#include "gtest/gtest.h"
+#include "include/istio/utils/attributes_builder.h"
+#include "src/istio/mixerclient/global_dictionary.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <fstream>
+
+using ::istio::mixer::v1::Attributes;
+
+namespace istio {
+namespace mixerclient {
+namespace {
+
+std::string ExtensionFile(const std::string& name) {
+  const char* dir = getenv("TEST_TMPDIR");
+  return std::string(dir ? dir : "/tmp") + "/" + name;
+}
+
+Attributes MakeAttributes(const std::string& service) {
+  Attributes attributes;
+  utils::AttributesBuilder builder(&attributes);
+  builder.AddString("destination.service", service);
+  builder.AddStringMap("request.headers",
+                       {{"x-tenant", "acme"}, {":path", "/books"}});
+  return attributes;
+}
+
+TEST(DictionaryExtensionTest, TestBuild) {
+  DictionaryExtensionBuilder builder;
+  for (int i = 0; i < 10; ++i) {
+    builder.Add(MakeAttributes("reviews.default.svc"));
+  }
+  builder.Add(MakeAttributes("ratings.default.svc"));
+
+  // The global words are not picked, the longest words save more.
+  std::vector<std::string> expected = {"reviews.default.svc", "x-tenant",
+                                       "/books", "acme"};
+  EXPECT_EQ(builder.Build(10, 2), expected);
+  expected.resize(2);
+  EXPECT_EQ(builder.Build(2, 2), expected);
+  EXPECT_EQ(builder.Build(10, 12).size(), 0);
+}
+
+TEST(DictionaryExtensionTest, TestWriteAndRead) {
+  const std::string file = ExtensionFile("dictionary_extension");
+  std::vector<std::string> words = {"reviews.default.svc", "x-tenant"};
+  ASSERT_TRUE(WriteDictionaryExtension(file, words));
+
+  std::vector<std::string> read_words;
+  ASSERT_TRUE(ReadDictionaryExtension(file, &read_words));
+  EXPECT_EQ(read_words, words);
+  remove(file.c_str());
+}
+
+TEST(DictionaryExtensionTest, TestOtherGlobalWords) {
+  const std::string file = ExtensionFile("other_dictionary_extension");
+  std::vector<std::string> words;
+  EXPECT_FALSE(ReadDictionaryExtension(file, &words));
+  {
+    std::ofstream out(file);
+    out << "istio-mixer-dictionary-1 " << GetGlobalWords().size()
+        << " 0123456789abcdef\nx-tenant\n";
+  }
+  EXPECT_FALSE(ReadDictionaryExtension(file, &words));
+  {
+    std::ofstream out(file);
+    out << "istio-mixer-dictionary-2 1 0\nx-tenant\n";
+  }
+  EXPECT_FALSE(ReadDictionaryExtension(file, &words));
+  EXPECT_TRUE(words.empty());
+  remove(file.c_str());
+}
+
+}  // namespace
+}  // namespace mixerclient
+}  // namespace istio
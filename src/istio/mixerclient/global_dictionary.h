@@ -16,6 +16,7 @@
 #ifndef ISTIO_MIXERCLIENT_GLOBAL_DICTIONARY_H
 #define ISTIO_MIXERCLIENT_GLOBAL_DICTIONARY_H
 
+#include <stddef.h>
 #include <string>
 #include <vector>
 
@@ -25,6 +26,10 @@ namespace mixerclient {
 // Get automatically generated global words.
 const std::vector<std::string>& GetGlobalWords();
 
+// Returns the index of a global word by the generated perfect hash,
+// or -1 if it is not a global word.
+int LookupGlobalWord(const char* data, size_t size);
+
 }  // namespace mixerclient
 }  // namespace istio
 
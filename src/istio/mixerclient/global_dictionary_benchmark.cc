@@ -0,0 +1,80 @@
+/* Copyright 2018 Istio Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// A micro-benchmark for global dictionary lookups, comparing the generated
+// perfect hash with an std::unordered_map of the global words. The
+// argument is the percent of the looked up words which are global words.
+
+#include "benchmark/benchmark.h"
+#include "src/istio/mixerclient/global_dictionary.h"
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace istio {
+namespace mixerclient {
+namespace {
+
+// Returns attribute names and values, percent of them global words.
+std::vector<std::string> GetWords(int percent) {
+  const auto& global_words = GetGlobalWords();
+  std::vector<std::string> words;
+  for (size_t i = 0; i < global_words.size(); ++i) {
+    if (static_cast<int>(i % 100) < percent) {
+      words.push_back(global_words[i]);
+    } else {
+      words.push_back("not-global-" + global_words[i]);
+    }
+  }
+  return words;
+}
+
+void BM_UnorderedMapLookup(benchmark::State& state) {
+  const auto& global_words = GetGlobalWords();
+  std::unordered_map<std::string, int> global_map;
+  for (size_t i = 0; i < global_words.size(); ++i) {
+    global_map[global_words[i]] = i;
+  }
+  std::vector<std::string> words = GetWords(state.range(0));
+  size_t next = 0;
+  while (state.KeepRunning()) {
+    const auto& it = global_map.find(words[next]);
+    benchmark::DoNotOptimize(it == global_map.end() ? -1 : it->second);
+    if (++next == words.size()) {
+      next = 0;
+    }
+  }
+}
+BENCHMARK(BM_UnorderedMapLookup)->Arg(50)->Arg(80)->Arg(100);
+
+void BM_PerfectHashLookup(benchmark::State& state) {
+  std::vector<std::string> words = GetWords(state.range(0));
+  size_t next = 0;
+  while (state.KeepRunning()) {
+    const std::string& word = words[next];
+    benchmark::DoNotOptimize(LookupGlobalWord(word.data(), word.size()));
+    if (++next == words.size()) {
+      next = 0;
+    }
+  }
+}
+BENCHMARK(BM_PerfectHashLookup)->Arg(50)->Arg(80)->Arg(100);
+
+}  // namespace
+}  // namespace mixerclient
+}  // namespace istio
+
+BENCHMARK_MAIN();
@@ -0,0 +1,434 @@
+/* Copyright 2018 Istio Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// A single-threaded micro-benchmark suite for the mixerclient hot paths,
+// run with realistic attribute sets of about 40 attributes including
+// request and response header maps.
+//
+// If a baseline file of "<name> <ns/op>" lines is passed after the
+// benchmark flags, each case is compared with it, and the benchmark fails
+// if any case is more than max_slowdown_percent slower.
+// Usage: mixerclient_benchmark [--benchmark_filter=...] [baseline_file]
+//            [max_slowdown_percent]
+//
+// The baseline is machine dependent, regenerate it on the machine that
+// runs the comparison from the output of an opt build, into
+// src/istio/mixerclient/mixerclient_benchmark_baseline.txt.
+
+#include "include/istio/mixerclient/client.h"
+#include "include/istio/prefetch/quota_prefetch.h"
+#include "include/istio/utils/attributes_builder.h"
+#include "src/istio/mixerclient/attribute_compressor.h"
+#include "src/istio/mixerclient/check_cache.h"
+#include "src/istio/mixerclient/delta_update.h"
+#include "src/istio/mixerclient/referenced.h"
+
+#include "benchmark/benchmark.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+#include <fstream>
+#include <map>
+#include <string>
+#include <vector>
+
+using namespace std::chrono;
+using ::google::protobuf::util::Status;
+using ::istio::mixer::v1::Attributes;
+using ::istio::mixer::v1::CheckRequest;
+using ::istio::mixer::v1::CheckResponse;
+using ::istio::mixer::v1::CompressedAttributes;
+using ::istio::mixer::v1::ReferencedAttributes;
+using ::istio::prefetch::QuotaPrefetch;
+using ::istio::quota_config::Requirement;
+
+namespace istio {
+namespace mixerclient {
+namespace {
+
+// Number of distinct attribute sets, each one is a different request.
+const int kNumRequests = 1000;
+
+// Number of reports in a batch.
+const int kBatchSize = 100;
+
+// Fills the attributes of a typical HTTP request, about 40 attributes.
+void MakeAttributes(int i, Attributes* attributes) {
+  utils::AttributesBuilder builder(attributes);
+  std::string id = std::to_string(i);
+  builder.AddString("source.uid", "kubernetes://productpage-v1-" + id);
+  builder.AddString("source.namespace", "default");
+  builder.AddString("source.principal", "cluster.local/ns/default/sa/pp");
+  builder.AddString("source.user", "user-" + std::to_string(i % 10));
+  builder.AddBytes("source.ip", std::string("\x0a\x00\x00\x01", 4));
+  builder.AddInt64("source.port", 40000 + i % 1000);
+  builder.AddString("destination.uid", "kubernetes://reviews-v1-84f7d");
+  builder.AddString("destination.service", "reviews.default.svc.local");
+  builder.AddString("destination.namespace", "default");
+  builder.AddString("destination.principal", "cluster.local/ns/default/rv");
+  builder.AddBytes("destination.ip", std::string("\x0a\x00\x00\x02", 4));
+  builder.AddInt64("destination.port", 9080);
+  builder.AddString("context.protocol", "http");
+  builder.AddString("context.reporter.uid", "kubernetes://reviews-v1-84f7d");
+  builder.AddString("context.reporter.kind", "inbound");
+  builder.AddString("connection.id", "conn-" + id);
+  builder.AddBool("connection.mtls", true);
+  builder.AddString("request.id", "8a7e3c4f-2b1d-4e5f-9a6b-" + id);
+  builder.AddString("request.path", "/reviews/" + std::to_string(i % 100));
+  builder.AddString("request.host", "reviews:9080");
+  builder.AddString("request.method", "GET");
+  builder.AddString("request.scheme", "http");
+  builder.AddString("request.useragent", "Mozilla/5.0 (X11; Linux x86_64)");
+  builder.AddString("request.referer", "http://productpage:9080/");
+  builder.AddTimestamp("request.time", system_clock::now());
+  builder.AddInt64("request.size", 0);
+  builder.AddInt64("request.total_size", 520);
+  builder.AddString("request.auth.principal", "issuer/user-" + id);
+  builder.AddString("request.auth.audiences", "bookinfo");
+  builder.AddStringMap(
+      "request.headers",
+      {{":authority", "reviews:9080"},
+       {":method", "GET"},
+       {":path", "/reviews/" + std::to_string(i % 100)},
+       {"accept", "application/json"},
+       {"accept-encoding", "gzip, deflate"},
+       {"user-agent", "Mozilla/5.0 (X11; Linux x86_64)"},
+       {"x-request-id", "8a7e3c4f-2b1d-4e5f-9a6b-" + id},
+       {"x-b3-traceid", "80f198ee56343ba8" + id},
+       {"x-b3-spanid", "e457b5a2e4d86bd1"},
+       {"x-b3-sampled", "1"},
+       {"x-forwarded-proto", "http"},
+       {"x-user", "user-" + std::to_string(i % 10)}});
+  builder.AddTimestamp("response.time", system_clock::now());
+  builder.AddDuration("response.duration", milliseconds(12));
+  builder.AddInt64("response.code", 200);
+  builder.AddInt64("response.size", 295);
+  builder.AddInt64("response.total_size", 612);
+  builder.AddStringMap("response.headers",
+                       {{":status", "200"},
+                        {"content-type", "application/json"},
+                        {"content-length", "295"},
+                        {"date", "Mon, 05 Mar 2018 18:28:36 GMT"},
+                        {"server", "envoy"},
+                        {"x-envoy-upstream-service-time", "12"}});
+  builder.AddString("api.service", "reviews");
+  builder.AddString("api.version", "v1");
+}
+
+// Fills the referenced attributes of a typical policy: a few exact matches
+// including header map keys, and a few absences.
+void MakeReferenced(ReferencedAttributes* referenced) {
+  const std::vector<std::string> exact_names = {
+      "destination.service", "source.user", "request.method", "request.path"};
+  const std::vector<std::string> absence_names = {"request.api_key",
+                                                  "source.labels"};
+  for (const auto& name : exact_names) {
+    referenced->add_words(name);
+    auto match = referenced->add_attribute_matches();
+    match->set_condition(ReferencedAttributes::EXACT);
+    match->set_name(-referenced->words_size());
+  }
+  for (const auto& name : absence_names) {
+    referenced->add_words(name);
+    auto match = referenced->add_attribute_matches();
+    match->set_condition(ReferencedAttributes::ABSENCE);
+    match->set_name(-referenced->words_size());
+  }
+  referenced->add_words("request.headers");
+  int headers_index = -referenced->words_size();
+  for (const auto& key : {":authority", "x-user"}) {
+    referenced->add_words(key);
+    auto match = referenced->add_attribute_matches();
+    match->set_condition(ReferencedAttributes::EXACT);
+    match->set_name(headers_index);
+    match->set_map_key(-referenced->words_size());
+  }
+}
+
+// The inputs of all the cases, built once.
+struct Inputs {
+  Inputs() : requests(kNumRequests), misses(kNumRequests) {
+    for (int i = 0; i < kNumRequests; ++i) {
+      MakeAttributes(i, &requests[i]);
+      // Misses differ in the referenced destination.service.
+      MakeAttributes(i, &misses[i]);
+      utils::AttributesBuilder(&misses[i])
+          .AddString("destination.service", "miss-" + std::to_string(i));
+    }
+    MakeReferenced(
+        ok_response.mutable_precondition()->mutable_referenced_attributes());
+    // Never expired by time or use count.
+    ok_response.mutable_precondition()->set_valid_use_count(-1);
+  }
+
+  std::vector<Attributes> requests;
+  std::vector<Attributes> misses;
+  CheckResponse ok_response;
+};
+
+const Inputs& GetInputs() {
+  static const Inputs* inputs = new Inputs;
+  return *inputs;
+}
+
+// A check cache holding the responses of all the requests.
+std::unique_ptr<CheckCache> CreateFilledCheckCache(const Inputs& inputs) {
+  std::unique_ptr<CheckCache> cache(
+      new CheckCache(CheckOptions(2 * kNumRequests)));
+  for (const auto& attributes : inputs.requests) {
+    CheckCache::CheckResult result;
+    cache->Check(attributes, &result);
+    result.SetResponse(Status::OK, attributes, inputs.ok_response);
+  }
+  return cache;
+}
+
+void BM_CheckCacheHit(benchmark::State& state) {
+  const Inputs& inputs = GetInputs();
+  auto cache = CreateFilledCheckCache(inputs);
+  size_t i = 0;
+  while (state.KeepRunning()) {
+    CheckCache::CheckResult result;
+    cache->Check(inputs.requests[i++ % kNumRequests], &result);
+  }
+}
+BENCHMARK(BM_CheckCacheHit);
+
+void BM_CheckCacheMiss(benchmark::State& state) {
+  const Inputs& inputs = GetInputs();
+  auto cache = CreateFilledCheckCache(inputs);
+  size_t i = 0;
+  while (state.KeepRunning()) {
+    CheckCache::CheckResult result;
+    cache->Check(inputs.misses[i++ % kNumRequests], &result);
+  }
+}
+BENCHMARK(BM_CheckCacheMiss);
+
+void BM_ReferencedSignature(benchmark::State& state) {
+  const Inputs& inputs = GetInputs();
+  Referenced referenced;
+  referenced.Fill(inputs.requests[0],
+                  inputs.ok_response.precondition().referenced_attributes());
+  size_t i = 0;
+  while (state.KeepRunning()) {
+    utils::FastHash::Key signature;
+    referenced.Signature(inputs.requests[i++ % kNumRequests], "", &signature);
+  }
+}
+BENCHMARK(BM_ReferencedSignature);
+
+void BM_AttributeCompressorCompress(benchmark::State& state) {
+  const Inputs& inputs = GetInputs();
+  AttributeCompressor compressor;
+  size_t i = 0;
+  while (state.KeepRunning()) {
+    CompressedAttributes pb;
+    compressor.Compress(inputs.requests[i++ % kNumRequests], &pb);
+  }
+}
+BENCHMARK(BM_AttributeCompressorCompress);
+
+// One iteration adds one report, a new batch is started every kBatchSize.
+void BM_BatchCompressorAdd(benchmark::State& state) {
+  const Inputs& inputs = GetInputs();
+  AttributeCompressor compressor;
+  std::unique_ptr<BatchCompressor> batch;
+  size_t i = 0;
+  while (state.KeepRunning()) {
+    if (i % kBatchSize == 0) {
+      batch = compressor.CreateBatchCompressor();
+    }
+    batch->Add(inputs.requests[i++ % kNumRequests]);
+  }
+}
+BENCHMARK(BM_BatchCompressorAdd);
+
+// One iteration adds kBatchSize reports and finishes the batch.
+void BM_BatchCompressorAddFinish(benchmark::State& state) {
+  const Inputs& inputs = GetInputs();
+  AttributeCompressor compressor;
+  size_t n = 0;
+  while (state.KeepRunning()) {
+    auto batch = compressor.CreateBatchCompressor();
+    for (int i = 0; i < kBatchSize; ++i) {
+      batch->Add(inputs.requests[(n * kBatchSize + i) % kNumRequests]);
+    }
+    batch->Finish();
+    ++n;
+  }
+  state.SetItemsProcessed(state.iterations() * kBatchSize);
+}
+BENCHMARK(BM_BatchCompressorAddFinish);
+
+// One iteration is the delta update of all the values of a request.
+void BM_DeltaUpdateCheck(benchmark::State& state) {
+  const Inputs& inputs = GetInputs();
+  auto delta = DeltaUpdate::Create();
+  size_t i = 0;
+  while (state.KeepRunning()) {
+    delta->Start();
+    int index = 0;
+    for (const auto& it : inputs.requests[i++ % kNumRequests].attributes()) {
+      delta->Check(index++, it.second);
+    }
+    delta->Finish();
+  }
+}
+BENCHMARK(BM_DeltaUpdateCheck);
+
+void BM_QuotaPrefetchCheck(benchmark::State& state) {
+  QuotaPrefetch::Tick t = system_clock::now();
+  std::vector<QuotaPrefetch::DoneFunc> pending;
+  auto prefetch = QuotaPrefetch::Create(
+      [&pending](int, QuotaPrefetch::DoneFunc fn, QuotaPrefetch::Tick) {
+        pending.push_back(fn);
+      },
+      QuotaPrefetch::Options(), t);
+  // Granted once with more than any run uses.
+  prefetch->Check(1, t);
+  for (const auto& fn : pending) {
+    fn(1 << 30, milliseconds(600000), t);
+  }
+  pending.clear();
+  int64_t i = 0;
+  while (state.KeepRunning()) {
+    prefetch->Check(1, t + microseconds(i++));
+  }
+}
+BENCHMARK(BM_QuotaPrefetchCheck);
+
+// A client whose fake transport responds synchronously.
+std::unique_ptr<MixerClient> CreateClient(const Inputs& inputs) {
+  MixerClientOptions options(CheckOptions(2 * kNumRequests), ReportOptions(),
+                             QuotaOptions(0, 600000));
+  const CheckResponse& ok_response = inputs.ok_response;
+  options.env.check_transport = [&ok_response](const CheckRequest&,
+                                               CheckResponse* response,
+                                               DoneFunc on_done) {
+    *response = ok_response;
+    on_done(Status::OK);
+    return CancelFunc();
+  };
+  return CreateMixerClient(options);
+}
+
+// A full client check of requests already checked.
+void BM_MixerClientCheckHit(benchmark::State& state) {
+  const Inputs& inputs = GetInputs();
+  auto client = CreateClient(inputs);
+  std::vector<Requirement> quotas;
+  TransportCheckFunc transport;
+  auto on_done = [](const CheckResponseInfo&) {};
+  for (const auto& attributes : inputs.requests) {
+    client->Check(attributes, quotas, transport, on_done);
+  }
+  size_t i = 0;
+  while (state.KeepRunning()) {
+    client->Check(inputs.requests[i++ % kNumRequests], quotas, transport,
+                  on_done);
+  }
+}
+BENCHMARK(BM_MixerClientCheckHit);
+
+// A full client check making a remote check call. Each request is given a
+// new destination.service, since a miss is cached.
+void BM_MixerClientCheckMiss(benchmark::State& state) {
+  const Inputs& inputs = GetInputs();
+  auto client = CreateClient(inputs);
+  std::vector<Requirement> quotas;
+  TransportCheckFunc transport;
+  auto on_done = [](const CheckResponseInfo&) {};
+  Attributes attributes;
+  size_t i = 0;
+  while (state.KeepRunning()) {
+    state.PauseTiming();
+    attributes = inputs.misses[i % kNumRequests];
+    utils::AttributesBuilder(&attributes)
+        .AddString("destination.service", "miss-" + std::to_string(i++));
+    state.ResumeTiming();
+    client->Check(attributes, quotas, transport, on_done);
+  }
+}
+BENCHMARK(BM_MixerClientCheckMiss);
+
+// Prints the results to the console, and keeps the ns per iteration of
+// each case.
+class BaselineReporter : public benchmark::ConsoleReporter {
+ public:
+  void ReportRuns(const std::vector<Run>& reports) override {
+    for (const auto& run : reports) {
+      if (!run.error_occurred) {
+        results_[run.benchmark_name] = run.GetAdjustedRealTime();
+      }
+    }
+    benchmark::ConsoleReporter::ReportRuns(reports);
+  }
+
+  const std::map<std::string, double>& results() const { return results_; }
+
+ private:
+  std::map<std::string, double> results_;
+};
+
+// Compares the results with the baseline file. Returns false if any case
+// is more than max_slowdown_percent slower.
+bool Compare(const std::map<std::string, double>& results,
+             const char* baseline_file, double max_slowdown_percent) {
+  std::ifstream in(baseline_file);
+  if (!in) {
+    fprintf(stderr, "Failed to read baseline file %s\n", baseline_file);
+    return false;
+  }
+  bool ok = true;
+  std::string name;
+  double baseline_ns;
+  while (in >> name) {
+    if (name[0] == '#') {
+      std::getline(in, name);
+      continue;
+    }
+    if (!(in >> baseline_ns)) break;
+    const auto it = results.find(name);
+    if (it == results.end() || baseline_ns <= 0) continue;
+    double change = (it->second / baseline_ns - 1) * 100;
+    bool regressed = change > max_slowdown_percent;
+    fprintf(stderr, "%s: %.1f ns, baseline %.1f ns, %+.0f%%%s\n",
+            name.c_str(), it->second, baseline_ns, change,
+            regressed ? " REGRESSION" : "");
+    ok = ok && !regressed;
+  }
+  return ok;
+}
+
+}  // namespace
+}  // namespace mixerclient
+}  // namespace istio
+
+int main(int argc, char** argv) {
+  // Removes the benchmark flags, the baseline arguments are left.
+  benchmark::Initialize(&argc, argv);
+  ::istio::mixerclient::BaselineReporter reporter;
+  benchmark::RunSpecifiedBenchmarks(&reporter);
+  if (argc > 1) {
+    double max_slowdown_percent = argc > 2 ? atof(argv[2]) : 25;
+    if (!::istio::mixerclient::Compare(reporter.results(), argv[1],
+                                       max_slowdown_percent)) {
+      return 1;
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,264 @@
+/* Copyright 2018 Istio Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/istio/mixerclient/node_check_cache.h"
+#include "google/protobuf/stubs/logging.h"
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <limits>
+
+using ::google::protobuf::util::Status;
+using ::google::protobuf::util::error::Code;
+
+namespace istio {
+namespace mixerclient {
+namespace {
+
+// The magic number of the mapped tables, and the version of their layout.
+const uint64_t kMagic = 0x49535449434e4343ull;
+// Version 2 only holds denials.
+const uint32_t kLayoutVersion = 2;
+
+// The number of entries probed for a key.
+const int kMaxProbes = 8;
+
+// The number of 8 byte words of the status message of an entry, longer
+// messages are truncated.
+const int kMessageWords = 11;
+
+}  // namespace
+
+const int64_t NodeCheckCache::kNeverExpire =
+    std::numeric_limits<int64_t>::max();
+
+// The table starts with a header of one cache line.
+struct NodeCheckCache::Header {
+  std::atomic<uint64_t> magic;
+  std::atomic<uint32_t> layout_version;
+  std::atomic<uint32_t> num_entries;
+  char padding[48];
+};
+
+// An entry of two cache lines. All the fields are atomics, since other
+// processes write them, and are read between two loads of seq.
+struct NodeCheckCache::Entry {
+  std::atomic<uint32_t> seq;
+  std::atomic<int32_t> use_count;
+  std::atomic<uint64_t> key_high;
+  std::atomic<uint64_t> key_low;
+  std::atomic<int64_t> expire_ms;
+  std::atomic<int32_t> code;
+  std::atomic<uint32_t> message_size;
+  std::atomic<uint64_t> message[kMessageWords];
+};
+
+std::unique_ptr<NodeCheckCache> NodeCheckCache::Open(
+    const std::string& file, int num_entries, const std::string& config_id) {
+  if (num_entries <= 0) {
+    return nullptr;
+  }
+  int fd = open(file.c_str(), O_RDWR | O_CREAT | O_CLOEXEC | O_NOFOLLOW,
+                0660);
+  if (fd < 0) {
+    GOOGLE_LOG(ERROR) << "Failed to open the node check cache " << file;
+    return nullptr;
+  }
+  // The first proxy sizes the table, the others wait for it.
+  flock(fd, LOCK_EX);
+  struct stat st;
+  bool created = false;
+  if (fstat(fd, &st) == 0 && st.st_size == 0) {
+    off_t size = sizeof(Header) + off_t(num_entries) * sizeof(Entry);
+    created = ftruncate(fd, size) == 0;
+    st.st_size = created ? size : 0;
+  }
+  void* mapped = MAP_FAILED;
+  if (st.st_size > off_t(sizeof(Header))) {
+    mapped = mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                  fd, 0);
+  }
+  if (mapped != MAP_FAILED && created) {
+    // The new file is zero filled, which is a table of empty entries.
+    Header* header = static_cast<Header*>(mapped);
+    header->num_entries.store(num_entries, std::memory_order_relaxed);
+    header->layout_version.store(kLayoutVersion, std::memory_order_relaxed);
+    header->magic.store(kMagic, std::memory_order_release);
+  }
+  flock(fd, LOCK_UN);
+  close(fd);
+  if (mapped == MAP_FAILED) {
+    GOOGLE_LOG(ERROR) << "Failed to map the node check cache " << file;
+    return nullptr;
+  }
+
+  std::unique_ptr<NodeCheckCache> cache(
+      new NodeCheckCache(mapped, st.st_size, config_id));
+  if (cache->num_entries_ == 0) {
+    GOOGLE_LOG(ERROR) << "The node check cache " << file
+                      << " has another layout";
+    return nullptr;
+  }
+  return cache;
+}
+
+NodeCheckCache::NodeCheckCache(void* mapped, size_t mapped_size,
+                               const std::string& config_id)
+    : mapped_(mapped),
+      mapped_size_(mapped_size),
+      entries_(nullptr),
+      num_entries_(0),
+      config_key_(utils::FastHash()(config_id.data(), config_id.size())) {
+  static_assert(sizeof(Header) == 64, "header size");
+  static_assert(sizeof(Entry) == 128, "entry size");
+  static_assert(ATOMIC_LLONG_LOCK_FREE == 2 && ATOMIC_INT_LOCK_FREE == 2,
+                "the shared table needs lock free atomics");
+  const Header* header = static_cast<const Header*>(mapped);
+  uint32_t num_entries = header->num_entries.load(std::memory_order_relaxed);
+  if (header->magic.load(std::memory_order_acquire) == kMagic &&
+      header->layout_version.load(std::memory_order_relaxed) ==
+          kLayoutVersion &&
+      num_entries > 0 &&
+      sizeof(Header) + size_t(num_entries) * sizeof(Entry) <= mapped_size) {
+    entries_ = reinterpret_cast<Entry*>(static_cast<char*>(mapped_) +
+                                        sizeof(Header));
+    num_entries_ = num_entries;
+  }
+}
+
+NodeCheckCache::~NodeCheckCache() { munmap(mapped_, mapped_size_); }
+
+utils::FastHash::Key NodeCheckCache::EntryKey(
+    const utils::FastHash::Key& signature) const {
+  utils::FastHash hasher;
+  hasher.Update(&config_key_, sizeof(config_key_));
+  hasher.Update(&signature, sizeof(signature));
+  utils::FastHash::Key key = hasher.Digest();
+  // The all zero key is the one of the empty entries.
+  if (key.high == 0 && key.low == 0) {
+    key.low = 1;
+  }
+  return key;
+}
+
+bool NodeCheckCache::Lookup(const utils::FastHash::Key& signature,
+                            int64_t now_ms, Status* status,
+                            int64_t* expire_ms, int* use_count) {
+  utils::FastHash::Key key = EntryKey(signature);
+  for (int i = 0; i < kMaxProbes; ++i) {
+    Entry& entry = entries_[(key.low + i) % num_entries_];
+    uint32_t seq = entry.seq.load(std::memory_order_acquire);
+    if (seq & 1) {
+      continue;
+    }
+    if (entry.key_high.load(std::memory_order_relaxed) != key.high ||
+        entry.key_low.load(std::memory_order_relaxed) != key.low) {
+      continue;
+    }
+    int64_t entry_expire_ms = entry.expire_ms.load(std::memory_order_relaxed);
+    int code = entry.code.load(std::memory_order_relaxed);
+    uint32_t message_size = std::min<uint32_t>(
+        entry.message_size.load(std::memory_order_relaxed),
+        sizeof(entry.message));
+    uint64_t message[kMessageWords];
+    for (int w = 0; w < kMessageWords; ++w) {
+      message[w] = entry.message[w].load(std::memory_order_relaxed);
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (entry.seq.load(std::memory_order_relaxed) != seq) {
+      // Replaced while read.
+      return false;
+    }
+    // Never trust an OK status written into the file.
+    if (now_ms >= entry_expire_ms || code == Code::OK) {
+      return false;
+    }
+    int entry_use_count = entry.use_count.load();
+    while (entry_use_count >= 0) {
+      if (entry_use_count == 0) {
+        return false;
+      }
+      if (entry.use_count.compare_exchange_weak(entry_use_count, 0)) {
+        break;
+      }
+    }
+    *expire_ms = entry_expire_ms;
+    *use_count = entry_use_count;
+    *status = Status(static_cast<Code>(code),
+                     std::string(reinterpret_cast<const char*>(message),
+                                 message_size));
+    return true;
+  }
+  return false;
+}
+
+void NodeCheckCache::Insert(const utils::FastHash::Key& signature,
+                            const Status& status, int64_t expire_ms,
+                            int use_count, int64_t now_ms) {
+  if (status.ok() || use_count == 0 || expire_ms <= now_ms) {
+    return;
+  }
+  utils::FastHash::Key key = EntryKey(signature);
+  Entry* victim = nullptr;
+  int64_t victim_expire_ms = kNeverExpire;
+  for (int i = 0; i < kMaxProbes; ++i) {
+    Entry& entry = entries_[(key.low + i) % num_entries_];
+    if (entry.key_high.load(std::memory_order_relaxed) == key.high &&
+        entry.key_low.load(std::memory_order_relaxed) == key.low) {
+      victim = &entry;
+      break;
+    }
+    int64_t entry_expire_ms = entry.expire_ms.load(std::memory_order_relaxed);
+    if (entry_expire_ms <= now_ms) {
+      victim = &entry;
+      break;
+    }
+    if (!victim || entry_expire_ms < victim_expire_ms) {
+      victim = &entry;
+      victim_expire_ms = entry_expire_ms;
+    }
+  }
+
+  uint32_t seq = victim->seq.load(std::memory_order_relaxed);
+  if ((seq & 1) || !victim->seq.compare_exchange_strong(
+                       seq, seq + 1, std::memory_order_acquire)) {
+    // Written by another proxy.
+    return;
+  }
+  std::atomic_thread_fence(std::memory_order_release);
+  uint64_t message[kMessageWords] = {};
+  const auto error_message = status.error_message();
+  size_t message_size = std::min<size_t>(error_message.size(), sizeof(message));
+  memcpy(message, error_message.data(), message_size);
+  victim->key_high.store(key.high, std::memory_order_relaxed);
+  victim->key_low.store(key.low, std::memory_order_relaxed);
+  victim->expire_ms.store(expire_ms, std::memory_order_relaxed);
+  victim->code.store(status.error_code(), std::memory_order_relaxed);
+  victim->message_size.store(message_size, std::memory_order_relaxed);
+  for (int w = 0; w < kMessageWords; ++w) {
+    victim->message[w].store(message[w], std::memory_order_relaxed);
+  }
+  victim->use_count.store(use_count < 0 ? -1 : use_count,
+                          std::memory_order_relaxed);
+  victim->seq.store(seq + 2, std::memory_order_release);
+}
+
+}  // namespace mixerclient
+}  // namespace istio
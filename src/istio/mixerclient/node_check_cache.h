@@ -0,0 +1,102 @@
+/* Copyright 2018 Istio Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ISTIO_MIXERCLIENT_NODE_CHECK_CACHE_H
+#define ISTIO_MIXERCLIENT_NODE_CHECK_CACHE_H
+
+#include "google/protobuf/stubs/common.h"
+#include "google/protobuf/stubs/status.h"
+#include "include/istio/utils/fast_hash.h"
+
+#include <atomic>
+#include <memory>
+#include <string>
+
+namespace istio {
+namespace mixerclient {
+
+// A check cache shared by all the proxies of a node, in a file mapped by
+// each of them. It is a fixed-size open addressing table without locks:
+// each entry has a sequence number which is odd while the entry is
+// written, a reader treats an entry changed while read as a miss, and a
+// writer gives up if another one holds the entry. An entry left odd by a
+// proxy killed while writing it is not used again. The keys mix the
+// request signature of a Referenced shape with a config id, so that the
+// proxies of another mesh config, or of another Mixer cluster, never see
+// the responses of each other.
+//
+// The file is writable by any proxy of the node, so it is not trusted: it
+// only holds denials, never OK statuses. A proxy which plants an entry can
+// deny the requests of another one, which its Mixer could deny as well,
+// but can't let any request through.
+class NodeCheckCache {
+ public:
+  // The expire time of the statuses never expired by time.
+  static const int64_t kNeverExpire;
+
+  // Maps the file, creating it with num_entries entries if it is empty.
+  // An existing file keeps its size. Returns nullptr if the file can't be
+  // mapped, or if it is not a table of this layout.
+  static std::unique_ptr<NodeCheckCache> Open(const std::string& file,
+                                              int num_entries,
+                                              const std::string& config_id);
+
+  ~NodeCheckCache();
+
+  // Looks up the denied status of a request signature at now_ms, in epoch
+  // milliseconds. Returns false for a miss. A hit takes all the uses left
+  // of the entry, returned in use_count, or -1 for any number of uses, and
+  // the expire time of the entry in expire_ms.
+  bool Lookup(const utils::FastHash::Key& signature, int64_t now_ms,
+              ::google::protobuf::util::Status* status, int64_t* expire_ms,
+              int* use_count);
+
+  // Stores the denied status of a request signature, valid until expire_ms
+  // and for use_count uses, or any number of uses if use_count is negative.
+  // OK statuses are not stored. The entry of the same signature, an
+  // expired one, or else the one expiring first among its probes is
+  // replaced.
+  void Insert(const utils::FastHash::Key& signature,
+              const ::google::protobuf::util::Status& status,
+              int64_t expire_ms, int use_count, int64_t now_ms);
+
+  // The number of entries of the table.
+  int num_entries() const { return num_entries_; }
+
+ private:
+  struct Header;
+  struct Entry;
+
+  NodeCheckCache(void* mapped, size_t mapped_size,
+                 const std::string& config_id);
+
+  // Mixes the config id into a signature.
+  utils::FastHash::Key EntryKey(const utils::FastHash::Key& signature) const;
+
+  // The mapping of the file.
+  void* const mapped_;
+  const size_t mapped_size_;
+  Entry* entries_;
+  int num_entries_;
+  // The digest of the config id.
+  const utils::FastHash::Key config_key_;
+
+  GOOGLE_DISALLOW_EVIL_CONSTRUCTORS(NodeCheckCache);
+};
+
+}  // namespace mixerclient
+}  // namespace istio
+
+#endif  // ISTIO_MIXERCLIENT_NODE_CHECK_CACHE_H
@@ -0,0 +1,159 @@
+/* Copyright 2018 Istio Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/istio/mixerclient/node_check_cache.h"
+#include "gtest/gtest.h"
+
+#include <stdio.h>
+#include <fstream>
+
+using ::google::protobuf::util::Status;
+using ::google::protobuf::util::error::Code;
+
+namespace istio {
+namespace mixerclient {
+namespace {
+
+std::string TempFile(const std::string& name) {
+  const char* dir = getenv("TEST_TMPDIR");
+  std::string file = std::string(dir ? dir : "/tmp") + "/" + name;
+  remove(file.c_str());
+  return file;
+}
+
+utils::FastHash::Key Signature(const std::string& value) {
+  return utils::FastHash()(value.data(), value.size());
+}
+
+TEST(NodeCheckCacheTest, TestLookupInsert) {
+  auto cache = NodeCheckCache::Open(TempFile("node_cache"), 16, "mesh-1");
+  ASSERT_TRUE(cache != nullptr);
+  EXPECT_EQ(cache->num_entries(), 16);
+
+  Status status;
+  int64_t expire_ms;
+  int use_count;
+  EXPECT_FALSE(
+      cache->Lookup(Signature("a"), 0, &status, &expire_ms, &use_count));
+
+  cache->Insert(Signature("a"), Status(Code::PERMISSION_DENIED, "denied"),
+                100, -1, 0);
+  EXPECT_TRUE(
+      cache->Lookup(Signature("a"), 99, &status, &expire_ms, &use_count));
+  EXPECT_EQ(status, Status(Code::PERMISSION_DENIED, "denied"));
+  EXPECT_EQ(expire_ms, 100);
+  EXPECT_EQ(use_count, -1);
+  EXPECT_FALSE(
+      cache->Lookup(Signature("b"), 99, &status, &expire_ms, &use_count));
+
+  // Expired.
+  EXPECT_FALSE(
+      cache->Lookup(Signature("a"), 100, &status, &expire_ms, &use_count));
+}
+
+TEST(NodeCheckCacheTest, TestOkNotShared) {
+  auto cache = NodeCheckCache::Open(TempFile("node_cache"), 16, "mesh-1");
+  ASSERT_TRUE(cache != nullptr);
+
+  cache->Insert(Signature("a"), Status::OK, NodeCheckCache::kNeverExpire, -1,
+                0);
+  Status status;
+  int64_t expire_ms;
+  int use_count;
+  EXPECT_FALSE(
+      cache->Lookup(Signature("a"), 1, &status, &expire_ms, &use_count));
+}
+
+TEST(NodeCheckCacheTest, TestUseCount) {
+  auto cache = NodeCheckCache::Open(TempFile("node_cache"), 16, "mesh-1");
+  ASSERT_TRUE(cache != nullptr);
+
+  const Status denied(Code::PERMISSION_DENIED, "denied");
+  cache->Insert(Signature("a"), denied, NodeCheckCache::kNeverExpire, 3, 0);
+  Status status;
+  int64_t expire_ms;
+  int use_count;
+  // A hit takes all the uses.
+  EXPECT_TRUE(
+      cache->Lookup(Signature("a"), 1, &status, &expire_ms, &use_count));
+  EXPECT_EQ(use_count, 3);
+  EXPECT_EQ(expire_ms, NodeCheckCache::kNeverExpire);
+  EXPECT_FALSE(
+      cache->Lookup(Signature("a"), 1, &status, &expire_ms, &use_count));
+
+  // Replaced by a new response.
+  cache->Insert(Signature("a"), denied, NodeCheckCache::kNeverExpire, 1, 1);
+  EXPECT_TRUE(
+      cache->Lookup(Signature("a"), 1, &status, &expire_ms, &use_count));
+  EXPECT_EQ(use_count, 1);
+}
+
+TEST(NodeCheckCacheTest, TestSharedByMappings) {
+  std::string file = TempFile("node_cache");
+  auto cache = NodeCheckCache::Open(file, 16, "mesh-1");
+  ASSERT_TRUE(cache != nullptr);
+  // The existing table keeps its size.
+  auto other = NodeCheckCache::Open(file, 1024, "mesh-1");
+  ASSERT_TRUE(other != nullptr);
+  EXPECT_EQ(other->num_entries(), 16);
+  // Another mesh config.
+  auto other_mesh = NodeCheckCache::Open(file, 16, "mesh-2");
+  ASSERT_TRUE(other_mesh != nullptr);
+
+  cache->Insert(Signature("a"), Status(Code::PERMISSION_DENIED, ""), 100, -1,
+                0);
+  Status status;
+  int64_t expire_ms;
+  int use_count;
+  EXPECT_TRUE(
+      other->Lookup(Signature("a"), 1, &status, &expire_ms, &use_count));
+  EXPECT_EQ(status.error_code(), Code::PERMISSION_DENIED);
+  EXPECT_FALSE(
+      other_mesh->Lookup(Signature("a"), 1, &status, &expire_ms, &use_count));
+}
+
+TEST(NodeCheckCacheTest, TestFullTable) {
+  auto cache = NodeCheckCache::Open(TempFile("node_cache"), 4, "mesh-1");
+  ASSERT_TRUE(cache != nullptr);
+
+  // All the entries are probed, the one expiring first is replaced.
+  const Status denied(Code::PERMISSION_DENIED, "");
+  for (int i = 0; i < 4; ++i) {
+    cache->Insert(Signature(std::to_string(i)), denied, 100 + i, -1, 0);
+  }
+  cache->Insert(Signature("new"), denied, 200, -1, 0);
+  Status status;
+  int64_t expire_ms;
+  int use_count;
+  EXPECT_TRUE(
+      cache->Lookup(Signature("new"), 1, &status, &expire_ms, &use_count));
+  EXPECT_FALSE(
+      cache->Lookup(Signature("0"), 1, &status, &expire_ms, &use_count));
+  EXPECT_TRUE(
+      cache->Lookup(Signature("3"), 1, &status, &expire_ms, &use_count));
+}
+
+TEST(NodeCheckCacheTest, TestOtherLayout) {
+  std::string file = TempFile("node_cache");
+  {
+    std::ofstream out(file, std::ios::binary);
+    out << std::string(1024, 'x');
+  }
+  EXPECT_TRUE(NodeCheckCache::Open(file, 16, "mesh-1") == nullptr);
+}
+
+}  // namespace
+}  // namespace mixerclient
+}  // namespace istio
@@ -0,0 +1,101 @@
+/* Copyright 2018 Istio Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/istio/mixerclient/quota_batch.h"
+
+using ::istio::mixer::v1::Attributes;
+
+namespace istio {
+namespace mixerclient {
+
+QuotaBatch::QuotaBatch(const QuotaOptions& options,
+                       TimerCreateFunc timer_create, FlushFunc flush_func,
+                       ThreadingModel threading_model)
+    : options_(options),
+      timer_create_(timer_create),
+      flush_func_(flush_func),
+      total_batched_calls_(0) {
+  mutex_.set_enabled(threading_model == ThreadingModel::SHARED);
+}
+
+QuotaBatch::~QuotaBatch() { Flush(); }
+
+bool QuotaBatch::CanJoin(const QuotaCache::CheckResult& result,
+                         const std::vector<std::string>& names) const {
+  if (!batch_) {
+    return false;
+  }
+  for (const auto& name : names) {
+    if (batch_->quota_names.count(name) > 0) {
+      return false;
+    }
+  }
+  return result.MatchesAttributes(batch_->attributes);
+}
+
+void QuotaBatch::Add(const Attributes& attributes,
+                     std::unique_ptr<QuotaCache::CheckResult> result) {
+  std::vector<std::string> names;
+  result->GetRequestQuotaNames(&names);
+
+  std::vector<std::unique_ptr<Batch>> flushed;
+  {
+    std::lock_guard<Mutex> lock(mutex_);
+    if (CanJoin(*result, names)) {
+      ++total_batched_calls_;
+    } else {
+      if (batch_) {
+        flushed.push_back(std::move(batch_));
+      }
+      batch_.reset(new Batch);
+      batch_->attributes = attributes;
+    }
+    batch_->results.push_back(std::move(result));
+    batch_->quota_names.insert(names.begin(), names.end());
+
+    if (batch_->quota_names.size() >=
+        static_cast<size_t>(options_.max_batch_quotas)) {
+      flushed.push_back(std::move(batch_));
+      if (timer_) {
+        timer_->Stop();
+      }
+    } else if (batch_->results.size() == 1 && timer_create_) {
+      if (!timer_) {
+        timer_ = timer_create_([this]() { Flush(); });
+      }
+      timer_->Start(options_.batch_window_ms);
+    }
+  }
+  for (auto& batch : flushed) {
+    flush_func_(std::move(batch));
+  }
+}
+
+void QuotaBatch::Flush() {
+  std::unique_ptr<Batch> batch;
+  {
+    std::lock_guard<Mutex> lock(mutex_);
+    batch = std::move(batch_);
+    if (timer_) {
+      timer_->Stop();
+    }
+  }
+  if (batch) {
+    flush_func_(std::move(batch));
+  }
+}
+
+}  // namespace mixerclient
+}  // namespace istio
@@ -0,0 +1,107 @@
+/* Copyright 2018 Istio Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ISTIO_MIXERCLIENT_QUOTA_BATCH_H
+#define ISTIO_MIXERCLIENT_QUOTA_BATCH_H
+
+#include "include/istio/mixerclient/client.h"
+#include "include/istio/utils/optional_mutex.h"
+#include "src/istio/mixerclient/quota_cache.h"
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace istio {
+namespace mixerclient {
+
+// Batches non-blocking quota prefetch calls from different requests into
+// one remote check call. The first call of a batch sends its attributes.
+// A later call only joins the batch if its quotas are not in the batch yet
+// and their Referenced signatures match the batch attributes, so Mixer
+// allocates them for the same quota keys. Otherwise the batch is flushed.
+// This interface is thread safe unless it is built THREAD_CONFINED.
+class QuotaBatch {
+ public:
+  // A batch of quota prefetch calls.
+  struct Batch {
+    // The attributes to send.
+    ::istio::mixer::v1::Attributes attributes;
+    // True if the attributes are only the ones referenced by the quotas.
+    bool referenced_only = false;
+    // The quota results to fan out the response to.
+    std::vector<std::unique_ptr<QuotaCache::CheckResult>> results;
+    // The quota names in the batch.
+    std::set<std::string> quota_names;
+  };
+
+  // The function to send a batch, called without any lock.
+  using FlushFunc = std::function<void(std::unique_ptr<Batch> batch)>;
+
+  QuotaBatch(const QuotaOptions& options, TimerCreateFunc timer_create,
+             FlushFunc flush_func,
+             ThreadingModel threading_model = ThreadingModel::SHARED);
+
+  virtual ~QuotaBatch();
+
+  // Adds a quota prefetch call.
+  void Add(const ::istio::mixer::v1::Attributes& attributes,
+           std::unique_ptr<QuotaCache::CheckResult> result);
+
+  // Flush out the batched calls.
+  void Flush();
+
+  // The number of calls merged into another remote call.
+  uint64_t total_batched_calls() const { return total_batched_calls_; }
+
+ private:
+  // The mutex is disabled if the batch is THREAD_CONFINED.
+  using Mutex = utils::OptionalMutex<std::mutex>;
+
+  // Returns true if the result can join the current batch.
+  bool CanJoin(const QuotaCache::CheckResult& result,
+               const std::vector<std::string>& names) const;
+
+  // The quota options.
+  QuotaOptions options_;
+
+  // timer create func
+  TimerCreateFunc timer_create_;
+
+  // The function to send a batch.
+  FlushFunc flush_func_;
+
+  // Mutex guarding the access of batch data;
+  Mutex mutex_;
+
+  // timer to flush out batched calls.
+  std::unique_ptr<Timer> timer_;
+
+  // The current batch.
+  std::unique_ptr<Batch> batch_;
+
+  std::atomic_int_fast64_t total_batched_calls_;
+
+  GOOGLE_DISALLOW_EVIL_CONSTRUCTORS(QuotaBatch);
+};
+
+}  // namespace mixerclient
+}  // namespace istio
+
+#endif  // ISTIO_MIXERCLIENT_QUOTA_BATCH_H
@@ -16,6 +16,10 @@
 #include "src/istio/mixerclient/quota_cache.h"
 #include "include/istio/utils/protobuf.h"
 
+#include <algorithm>
+#include <functional>
+#include <map>
+
 using namespace std::chrono;
 using ::google::protobuf::util::Status;
 using ::google::protobuf::util::error::Code;
@@ -28,20 +32,32 @@ using ::istio::quota_config::Requirement;
 
 namespace istio {
 namespace mixerclient {
+namespace {
+
+// The number of quotas of a request whose shards are kept on the stack.
+const size_t kMaxInlineQuotas = 8;
+
+}  // namespace
 
-QuotaCache::CacheElem::CacheElem(const std::string& name) : name_(name) {
+QuotaCache::CacheElem::CacheElem(const std::string& name,
+                                 const QuotaPrefetch::Options& options)
+    : name_(name) {
   prefetch_ = QuotaPrefetch::Create(
       [this](int amount, QuotaPrefetch::DoneFunc fn, QuotaPrefetch::Tick t) {
         Alloc(amount, fn);
       },
-      QuotaPrefetch::Options(), system_clock::now());
+      options, system_clock::now());
+}
+
+size_t QuotaCache::CacheElem::ByteSize() {
+  return sizeof(*this) + name_.capacity() + prefetch_->ByteSize();
 }
 
 void QuotaCache::CacheElem::Alloc(int amount, QuotaPrefetch::DoneFunc fn) {
   quota_->amount = amount;
   quota_->best_effort = true;
   quota_->response_func =
-      [fn](const Attributes&,
+      [fn](const Attributes*,
            const CheckResponse::QuotaResult* result) -> bool {
     int amount = -1;
     milliseconds expire = duration_cast<milliseconds>(minutes(1));
@@ -108,6 +124,17 @@ bool QuotaCache::CheckResult::BuildRequest(CheckRequest* request) {
 void QuotaCache::CheckResult::SetResponse(const Status& status,
                                           const Attributes& attributes,
                                           const CheckResponse& response) {
+  SetResponseWith(status, &attributes, response);
+}
+
+void QuotaCache::CheckResult::SetReferencedResponse(
+    const Status& status, const CheckResponse& response) {
+  SetResponseWith(status, nullptr, response);
+}
+
+void QuotaCache::CheckResult::SetResponseWith(const Status& status,
+                                              const Attributes* attributes,
+                                              const CheckResponse& response) {
   std::string rejected_quota_names;
   for (const auto& quota : quotas_) {
     if (quota.response_func) {
@@ -139,64 +166,246 @@ void QuotaCache::CheckResult::SetResponse(const Status& status,
   }
 }
 
-QuotaCache::QuotaCache(const QuotaOptions& options) : options_(options) {
+void QuotaCache::CheckResult::GetRequestQuotaNames(
+    std::vector<std::string>* names) const {
+  for (const auto& quota : quotas_) {
+    if (quota.response_func) {
+      names->push_back(quota.name);
+    }
+  }
+}
+
+bool QuotaCache::CheckResult::MatchesAttributes(
+    const Attributes& attributes) const {
+  for (const auto& quota : quotas_) {
+    if (!quota.response_func) {
+      continue;
+    }
+    utils::FastHash::Key signature;
+    if (!quota.referenced ||
+        !quota.referenced->Signature(attributes, quota.name, &signature) ||
+        signature != quota.signature) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool QuotaCache::CheckResult::GetReferencedAttributes(
+    const Attributes& attributes, Attributes* referenced) const {
+  for (const auto& quota : quotas_) {
+    if (!quota.response_func) {
+      continue;
+    }
+    if (!quota.referenced) {
+      return false;
+    }
+    quota.referenced->CopyExactAttributes(attributes, referenced);
+  }
+  return true;
+}
+
+QuotaCache::QuotaCache(const QuotaOptions& options,
+                       ThreadingModel threading_model)
+    : options_(options),
+      thread_safe_(threading_model == ThreadingModel::SHARED),
+      num_rejected_signatures_(0) {
+  rejections_mutex_.set_enabled(thread_safe_);
+  // A quota cache should not hold a reference to another shared cache.
+  options_.shared_cache.reset();
   if (options.num_entries > 0) {
-    cache_.reset(new QuotaLRUCache(options.num_entries));
-    cache_->SetMaxIdleSeconds(options.expiration_ms / 1000.0);
+    int num_shards =
+        std::max(1, std::min(options.num_shards, options.num_entries));
+    // The cache is limited by bytes if max_bytes is set.
+    int64_t capacity =
+        options.max_bytes > 0 ? options.max_bytes : options.num_entries;
+    for (int i = 0; i < num_shards; ++i) {
+      Shard* shard = new Shard;
+      shard->mutex.set_enabled(thread_safe_);
+      shard->cache.reset(new QuotaLRUCache(capacity / num_shards));
+      // Hot quota signatures are hit on every request, CLOCK saves
+      // relinking them each time.
+      shard->cache->SetEvictionPolicy(utils::SimpleLRUEvictionPolicy::CLOCK);
+      shard->cache->SetMaxIdleSeconds(options.expiration_ms / 1000.0);
+      shards_.emplace_back(shard);
+    }
   }
 }
 
+QuotaCache::Shard* QuotaCache::GetShard(const std::string& quota_name) {
+  return shards_[std::hash<std::string>()(quota_name) % shards_.size()].get();
+}
+
 QuotaCache::~QuotaCache() {
   // FlushAll() will remove all cache items.
   FlushAll();
 }
 
-void QuotaCache::CheckCache(const Attributes& request, bool check_use_cache,
-                            CheckResult::Quota* quota) {
-  // If check is not using cache, that check may be rejected.
-  // If quota cache is used, quota amount is already substracted from the cache.
-  // If the check is rejected, there is not easy way to add them back to cache.
-  // The workaround is not to use quota cache if check is not in the cache.
-  if (!cache_ || !check_use_cache) {
-    quota->best_effort = false;
-    quota->result = CheckResult::Quota::Pending;
-    quota->response_func =
-        [](const Attributes&,
-           const CheckResponse::QuotaResult* result) -> bool {
-      // nullptr means connection error, for quota, it is fail open for
-      // connection error.
-      return result == nullptr || result->granted_amount() > 0;
+void QuotaCache::NotUseCache(CheckResult::Quota* quota) {
+  quota->best_effort = false;
+  quota->result = CheckResult::Quota::Pending;
+  quota->response_func =
+      [](const Attributes*, const CheckResponse::QuotaResult* result) -> bool {
+    // nullptr means connection error, for quota, it is fail open for
+    // connection error.
+    return result == nullptr || result->granted_amount() > 0;
+  };
+}
+
+bool QuotaCache::RejectedRecently(const Attributes& request,
+                                  const std::string& quota_name) {
+  std::lock_guard<Mutex> lock(rejections_mutex_);
+  auto it = rejections_.find(quota_name);
+  if (it == rejections_.end()) {
+    return false;
+  }
+  Rejections& rejections = it->second;
+  auto now = steady_clock::now();
+  for (const auto& referenced_it : rejections.referenced_map) {
+    utils::FastHash::Key signature;
+    if (!referenced_it.second.Signature(request, quota_name, &signature)) {
+      continue;
+    }
+    auto expire_it = rejections.expire_time.find(signature);
+    if (expire_it == rejections.expire_time.end()) {
+      continue;
+    }
+    if (expire_it->second > now) {
+      ++rejections.hits;
+      return true;
+    }
+    rejections.expire_time.erase(expire_it);
+    --num_rejected_signatures_;
+  }
+  return false;
+}
+
+void QuotaCache::WatchResults(CheckResult::Quota* quotas, size_t count) {
+  for (size_t i = 0; i < count; ++i) {
+    CheckResult::Quota* quota = quotas + i;
+    if (!quota->response_func) {
+      continue;
+    }
+    auto saved_func = quota->response_func;
+    std::string quota_name = quota->name;
+    quota->response_func = [saved_func, quota_name, this](
+                               const Attributes* attributes,
+                               const CheckResponse::QuotaResult* result) {
+      if (result != nullptr && attributes != nullptr) {
+        RecordResult(*attributes, quota_name, *result);
+      }
+      return saved_func(attributes, result);
     };
+  }
+}
+
+void QuotaCache::RecordResult(const Attributes& attributes,
+                              const std::string& quota_name,
+                              const CheckResponse::QuotaResult& result) {
+  bool rejected = result.granted_amount() <= 0 && result.has_valid_duration();
+  milliseconds duration(0);
+  if (rejected) {
+    duration = utils::ToMilliseonds(result.valid_duration());
+    if (duration.count() <= 0) {
+      return;
+    }
+  } else if (num_rejected_signatures_ == 0) {
+    return;
+  }
+
+  Referenced referenced;
+  utils::FastHash::Key signature;
+  if (!referenced.Fill(attributes, result.referenced_attributes()) ||
+      !referenced.Signature(attributes, quota_name, &signature)) {
+    return;
+  }
+
+  std::lock_guard<Mutex> lock(rejections_mutex_);
+  if (!rejected) {
+    // Granted again, e.g. by a new quota window.
+    auto it = rejections_.find(quota_name);
+    if (it != rejections_.end() && it->second.expire_time.erase(signature)) {
+      --num_rejected_signatures_;
+    }
     return;
   }
+  if (num_rejected_signatures_ >= options_.max_rejected_signatures) {
+    RemoveExpiredRejectionsWithLock();
+    if (num_rejected_signatures_ >= options_.max_rejected_signatures) {
+      return;
+    }
+  }
+  Rejections& rejections = rejections_[quota_name];
+  rejections.referenced_map.emplace(referenced.Hash(), referenced);
+  auto expire = steady_clock::now() + duration;
+  auto inserted = rejections.expire_time.emplace(signature, expire);
+  if (inserted.second) {
+    ++num_rejected_signatures_;
+  } else {
+    inserted.first->second = expire;
+  }
+}
 
-  std::lock_guard<std::mutex> lock(cache_mutex_);
-  PerQuotaReferenced& quota_ref = quota_referenced_map_[quota->name];
+void QuotaCache::RemoveExpiredRejectionsWithLock() {
+  auto now = steady_clock::now();
+  for (auto& it : rejections_) {
+    auto& expire_time = it.second.expire_time;
+    for (auto expire_it = expire_time.begin();
+         expire_it != expire_time.end();) {
+      if (expire_it->second <= now) {
+        expire_it = expire_time.erase(expire_it);
+        --num_rejected_signatures_;
+      } else {
+        ++expire_it;
+      }
+    }
+  }
+}
+
+void QuotaCache::CheckCache(AttributeFingerprints* fingerprints,
+                            Shard* shard, CheckResult::Quota* quota) {
+  PerQuotaReferenced& quota_ref = shard->quota_referenced_map[quota->name];
   for (const auto& it : quota_ref.referenced_map) {
     const Referenced& referenced = it.second;
-    std::string signature;
-    if (!referenced.Signature(request, quota->name, &signature)) {
+    utils::FastHash::Key signature;
+    if (!referenced.Signature(fingerprints, quota->name, &signature)) {
       continue;
     }
-    QuotaLRUCache::ScopedLookup lookup(cache_.get(), signature);
+    QuotaLRUCache::ScopedLookup lookup(shard->cache.get(), signature);
     if (lookup.Found()) {
+      ++quota_ref.hits;
       CacheElem* cache_elem = lookup.value();
       cache_elem->Quota(quota->amount, quota);
+      if (quota->response_func) {
+        // A prefetch is sent, it may be batched with other requests.
+        quota->referenced = std::make_shared<Referenced>(referenced);
+        quota->signature = signature;
+      }
+      if (options_.max_bytes > 0) {
+        // The prefetch queue may grow.
+        shard->cache->UpdateSize(signature, cache_elem, Cost(cache_elem));
+      }
       return;
     }
   }
 
+  ++quota_ref.misses;
   if (!quota_ref.pending_item) {
-    quota_ref.pending_item.reset(new CacheElem(quota->name));
+    QuotaPrefetch::Options prefetch_options;
+    prefetch_options.adaptive = options_.adaptive_prefetch;
+    prefetch_options.thread_safe = thread_safe_;
+    quota_ref.pending_item.reset(new CacheElem(quota->name, prefetch_options));
   }
   quota_ref.pending_item->Quota(quota->amount, quota);
 
   auto saved_func = quota->response_func;
   std::string quota_name = quota->name;
   quota->response_func = [saved_func, quota_name, this](
-                             const Attributes& attributes,
+                             const Attributes* attributes,
                              const CheckResponse::QuotaResult* result) -> bool {
-    SetResponse(attributes, quota_name, result);
+    if (attributes != nullptr) {
+      SetResponse(*attributes, quota_name, result);
+    }
     if (saved_func) {
       return saved_func(attributes, result);
     }
@@ -216,7 +425,7 @@ void QuotaCache::SetResponse(const Attributes& attributes,
     return;
   }
 
-  std::string signature;
+  utils::FastHash::Key signature;
   if (!referenced.Signature(attributes, quota_name, &signature)) {
     GOOGLE_LOG(ERROR) << "Quota response referenced mismatchs with request";
     GOOGLE_LOG(ERROR) << "Request attributes: " << attributes.DebugString();
@@ -224,52 +433,204 @@ void QuotaCache::SetResponse(const Attributes& attributes,
     return;
   }
 
-  std::lock_guard<std::mutex> lock(cache_mutex_);
-  QuotaLRUCache::ScopedLookup lookup(cache_.get(), signature);
+  Shard* shard = GetShard(quota_name);
+  std::lock_guard<Mutex> lock(shard->mutex);
+  QuotaLRUCache::ScopedLookup lookup(shard->cache.get(), signature);
   if (lookup.Found()) {
     // Not to override the existing cache entry.
     return;
   }
 
-  PerQuotaReferenced& quota_ref = quota_referenced_map_[quota_name];
-  std::string hash = referenced.Hash();
+  PerQuotaReferenced& quota_ref = shard->quota_referenced_map[quota_name];
+  utils::FastHash::Key hash = referenced.Hash();
   if (quota_ref.referenced_map.find(hash) == quota_ref.referenced_map.end()) {
     quota_ref.referenced_map[hash] = referenced;
     GOOGLE_LOG(INFO) << "Add a new Referenced for quota cache: " << quota_name
                      << ", reference: " << referenced.DebugString();
   }
 
-  cache_->Insert(signature, quota_ref.pending_item.release(), 1);
+  CacheElem* cache_elem = quota_ref.pending_item.release();
+  shard->cache->Insert(signature, cache_elem, Cost(cache_elem));
+}
+
+size_t QuotaCache::Cost(CacheElem* elem) {
+  if (options_.max_bytes > 0) {
+    return elem->ByteSize();
+  }
+  // Each item costs 1 unit if only limited by num_entries.
+  return 1;
+}
+
+void QuotaCache::GetCacheSize(uint64_t* num_entries, uint64_t* num_bytes) {
+  *num_entries = 0;
+  *num_bytes = 0;
+  for (const auto& shard : shards_) {
+    std::lock_guard<Mutex> lock(shard->mutex);
+    *num_entries += shard->cache->Entries();
+    if (options_.max_bytes > 0) {
+      *num_bytes += shard->cache->Size();
+      continue;
+    }
+    for (auto it = shard->cache->begin(); it != shard->cache->end(); ++it) {
+      *num_bytes += it->second->ByteSize();
+    }
+  }
+}
+
+void QuotaCache::SetCapacity(int64_t capacity) {
+  if (shards_.empty()) {
+    return;
+  }
+  int64_t shard_capacity =
+      std::max<int64_t>(1, capacity / static_cast<int64_t>(shards_.size()));
+  for (const auto& shard : shards_) {
+    std::lock_guard<Mutex> lock(shard->mutex);
+    shard->cache->SetMaxSize(shard_capacity);
+  }
+}
+
+uint64_t QuotaCache::GetDemand() {
+  uint64_t misses = 0;
+  for (const auto& shard : shards_) {
+    std::lock_guard<Mutex> lock(shard->mutex);
+    for (const auto& it : shard->quota_referenced_map) {
+      misses += it.second.misses;
+    }
+  }
+  return misses;
+}
+
+void QuotaCache::GetQuotaStats(std::vector<QuotaNameStats>* stats) {
+  std::map<std::string, QuotaNameStats> stats_map;
+  auto add = [&stats_map](const std::string& name, CacheElem* elem) {
+    QuotaPrefetch::Stats prefetch_stats;
+    elem->GetStats(&prefetch_stats);
+    QuotaNameStats& s = stats_map[name];
+    s.prefetch_calls += prefetch_stats.prefetch_calls;
+    s.granted_amount += prefetch_stats.granted_amount;
+    s.used_amount += prefetch_stats.used_amount;
+    s.expired_amount += prefetch_stats.expired_amount;
+    s.inflight_checks += prefetch_stats.inflight_checks;
+    s.inflight_rejections += prefetch_stats.inflight_rejections;
+    s.close_time_ms += prefetch_stats.close_time.count();
+    s.queue_depth += prefetch_stats.queue_depth;
+  };
+  for (const auto& shard : shards_) {
+    std::lock_guard<Mutex> lock(shard->mutex);
+    for (const auto& it : shard->quota_referenced_map) {
+      QuotaNameStats& s = stats_map[it.first];
+      s.hits += it.second.hits;
+      s.misses += it.second.misses;
+      if (it.second.pending_item) {
+        add(it.first, it.second.pending_item.get());
+      }
+    }
+    for (auto it = shard->cache->begin(); it != shard->cache->end(); ++it) {
+      add(it->second->quota_name(), it->second);
+    }
+  }
+  {
+    std::lock_guard<Mutex> lock(rejections_mutex_);
+    for (const auto& it : rejections_) {
+      stats_map[it.first].negative_hits += it.second.hits;
+    }
+  }
+  stats->clear();
+  for (auto& it : stats_map) {
+    it.second.name = it.first;
+    stats->push_back(it.second);
+  }
 }
 
 void QuotaCache::Check(const Attributes& request,
                        const std::vector<Requirement>& quotas, bool use_cache,
-                       CheckResult* result) {
+                       CheckResult* result,
+                       AttributeFingerprints* fingerprints) {
+  size_t begin = result->quotas_.size();
+  result->quotas_.reserve(begin + quotas.size());
   for (const auto& requirement : quotas) {
-    CheckResult::Quota quota = {requirement.quota, requirement.charge};
-    CheckCache(request, use_cache, &quota);
-    result->quotas_.push_back(quota);
+    result->quotas_.push_back({requirement.quota, requirement.charge});
+  }
+  CheckResult::Quota* first = result->quotas_.data() + begin;
+
+  // The quotas recently rejected by a zero grant are not sent.
+  if (num_rejected_signatures_ > 0) {
+    for (size_t i = 0; i < quotas.size(); ++i) {
+      if (RejectedRecently(request, first[i].name)) {
+        first[i].result = CheckResult::Quota::Rejected;
+      }
+    }
+  }
+
+  // If check is not using cache, that check may be rejected.
+  // If quota cache is used, quota amount is already substracted from the cache.
+  // If the check is rejected, there is not easy way to add them back to cache.
+  // The workaround is not to use quota cache if check is not in the cache.
+  if (shards_.empty() || !use_cache) {
+    for (size_t i = 0; i < quotas.size(); ++i) {
+      if (first[i].result != CheckResult::Quota::Rejected) {
+        NotUseCache(first + i);
+      }
+    }
+    if (options_.max_rejected_signatures > 0) {
+      WatchResults(first, quotas.size());
+    }
+    return;
+  }
+
+  AttributeFingerprints local_fingerprints(request);
+  if (!fingerprints) {
+    fingerprints = &local_fingerprints;
+  }
+  // Lock each shard once for all quotas of the request in it.
+  Shard* inline_shards[kMaxInlineQuotas];
+  std::vector<Shard*> shard_vector;
+  Shard** shard_of = inline_shards;
+  if (quotas.size() > kMaxInlineQuotas) {
+    shard_vector.resize(quotas.size());
+    shard_of = shard_vector.data();
+  }
+  for (size_t i = 0; i < quotas.size(); ++i) {
+    shard_of[i] = first[i].result == CheckResult::Quota::Rejected
+                      ? nullptr
+                      : GetShard(first[i].name);
+  }
+  for (size_t i = 0; i < quotas.size(); ++i) {
+    Shard* shard = shard_of[i];
+    if (shard == nullptr) {
+      continue;
+    }
+    std::lock_guard<Mutex> lock(shard->mutex);
+    for (size_t j = i; j < quotas.size(); ++j) {
+      if (shard_of[j] == shard) {
+        CheckCache(fingerprints, shard, first + j);
+        // Mark it as done.
+        shard_of[j] = nullptr;
+      }
+    }
+  }
+  if (options_.max_rejected_signatures > 0) {
+    WatchResults(first, quotas.size());
   }
 }
 
-// TODO: hookup with a timer object to call Flush() periodically.
 // Be careful; some transport callback functions may be still using
-// expired items, need to add ref_count into these callback functions.
-Status QuotaCache::Flush() {
-  if (cache_) {
-    std::lock_guard<std::mutex> lock(cache_mutex_);
-    cache_->RemoveExpiredEntries();
+// expired items, the same as for the items expired on lookup.
+size_t QuotaCache::SweepExpired(size_t max_items) {
+  size_t removed = 0;
+  for (const auto& shard : shards_) {
+    std::lock_guard<Mutex> lock(shard->mutex);
+    removed += shard->cache->SweepExpiredEntries(max_items);
   }
-
-  return Status::OK;
+  return removed;
 }
 
 // Flush out aggregated check requests, clear all cache items.
 // Usually called at destructor.
 Status QuotaCache::FlushAll() {
-  if (cache_) {
-    std::lock_guard<std::mutex> lock(cache_mutex_);
-    cache_->RemoveAll();
+  for (const auto& shard : shards_) {
+    std::lock_guard<Mutex> lock(shard->mutex);
+    shard->cache->RemoveAll();
   }
 
   return Status::OK;
@@ -18,12 +18,17 @@
 #ifndef ISTIO_MIXERCLIENT_QUOTA_CACHE_H
 #define ISTIO_MIXERCLIENT_QUOTA_CACHE_H
 
+#include <atomic>
+#include <chrono>
+#include <memory>
 #include <mutex>
 #include <string>
 #include <unordered_map>
+#include <vector>
 
 #include "include/istio/mixerclient/client.h"
 #include "include/istio/prefetch/quota_prefetch.h"
+#include "include/istio/utils/optional_mutex.h"
 #include "include/istio/utils/simple_lru_cache.h"
 #include "include/istio/utils/simple_lru_cache_inl.h"
 #include "src/istio/mixerclient/referenced.h"
@@ -32,10 +37,11 @@ namespace istio {
 namespace mixerclient {
 
 // Cache Mixer Quota Attributes.
-// This interface is thread safe.
+// This interface is thread safe unless the cache is THREAD_CONFINED.
 class QuotaCache {
  public:
-  QuotaCache(const QuotaOptions& options);
+  QuotaCache(const QuotaOptions& options,
+             ThreadingModel threading_model = ThreadingModel::SHARED);
 
   virtual ~QuotaCache();
 
@@ -57,12 +63,36 @@ class QuotaCache {
 
     bool IsCacheHit() const;
 
-    ::google::protobuf::util::Status status() const { return status_; }
+    const ::google::protobuf::util::Status& status() const { return status_; }
 
     void SetResponse(const ::google::protobuf::util::Status& status,
                      const ::istio::mixer::v1::Attributes& attributes,
                      const ::istio::mixer::v1::CheckResponse& response);
 
+    // Sets the response of a call sent with only the attributes referenced
+    // by the quotas, see GetReferencedAttributes(). Mixer evaluated it
+    // without the other attributes, so its referenced attributes are not
+    // learned, only the granted amounts are used.
+    void SetReferencedResponse(
+        const ::google::protobuf::util::Status& status,
+        const ::istio::mixer::v1::CheckResponse& response);
+
+    // Gets the names of quotas to be sent in the remote call.
+    void GetRequestQuotaNames(std::vector<std::string>* names) const;
+
+    // Returns true if the quotas to be sent can be sent with the attributes
+    // of another request. It is only true if they are all prefetched for
+    // cached items, and their signatures match the attributes.
+    bool MatchesAttributes(
+        const ::istio::mixer::v1::Attributes& attributes) const;
+
+    // Copies the attributes referenced by the quotas to be sent. Returns
+    // false if any of them is not prefetched for a cached item, so its
+    // referenced attributes are unknown.
+    bool GetReferencedAttributes(
+        const ::istio::mixer::v1::Attributes& attributes,
+        ::istio::mixer::v1::Attributes* referenced) const;
+
    private:
     friend class QuotaCache;
     // Hold pending quota data needed to talk to server.
@@ -79,12 +109,24 @@ class QuotaCache {
       Result result;
 
       // The function to set the quota response from server.
+      // The attributes are nullptr if the call only sent the referenced
+      // ones.
       using OnResponseFunc = std::function<bool(
-          const ::istio::mixer::v1::Attributes& attributes,
+          const ::istio::mixer::v1::Attributes* attributes,
           const ::istio::mixer::v1::CheckResponse::QuotaResult* result)>;
       OnResponseFunc response_func;
+
+      // For a prefetch of a cached item, its Referenced and signature.
+      std::shared_ptr<const Referenced> referenced;
+      utils::FastHash::Key signature;
     };
 
+    // Sets the response of a call made with the attributes, nullptr if it
+    // only sent the referenced ones.
+    void SetResponseWith(const ::google::protobuf::util::Status& status,
+                         const ::istio::mixer::v1::Attributes* attributes,
+                         const ::istio::mixer::v1::CheckResponse& response);
+
     ::google::protobuf::util::Status status_;
 
     // The list of pending quota needed to talk to server.
@@ -92,18 +134,37 @@ class QuotaCache {
   };
 
   // Check quota cache for a request, result will be stored in CacaheResult.
+  // If fingerprints is not nullptr, they are the value hashes of request
+  // shared with the check cache lookup of the same request.
   void Check(const ::istio::mixer::v1::Attributes& request,
              const std::vector<::istio::quota_config::Requirement>& quotas,
-             bool use_cache, CheckResult* result);
+             bool use_cache, CheckResult* result,
+             AttributeFingerprints* fingerprints = nullptr);
 
- private:
-  // Check quota cache.
-  void CheckCache(const ::istio::mixer::v1::Attributes& request, bool use_cache,
-                  CheckResult::Quota* quota);
+  // Gets the number of cache items and their bytes.
+  void GetCacheSize(uint64_t* num_entries, uint64_t* num_bytes);
+
+  // Gets the statistics per quota name, ordered by name.
+  void GetQuotaStats(std::vector<QuotaNameStats>* stats);
 
-  // Invalidates expired check responses.
-  // Called at time specified by GetNextFlushInterval().
-  ::google::protobuf::util::Status Flush();
+  // Removes the items idle longer than the expiration time, visiting at
+  // most max_items items of each shard. Called periodically so that items
+  // never looked up again don't stay until their shard is full.
+  // Returns the number of removed items.
+  size_t SweepExpired(size_t max_items);
+
+  // Sets the capacity, in bytes if max_bytes is set or else in items,
+  // split over the shards. The least recently used items over it are
+  // evicted.
+  void SetCapacity(int64_t capacity);
+
+  // Returns the total number of quota checks not found in the cache, the
+  // demand for more capacity.
+  uint64_t GetDemand();
+
+ private:
+  // The mutexes are disabled if the cache is THREAD_CONFINED.
+  using Mutex = utils::OptionalMutex<std::mutex>;
 
   // Flushes out all cached check responses; clears all cache items.
   // Usually called at destructor.
@@ -112,7 +173,8 @@ class QuotaCache {
   // The cache element for each quota metric.
   class CacheElem {
    public:
-    CacheElem(const std::string& name);
+    CacheElem(const std::string& name,
+              const prefetch::QuotaPrefetch::Options& options);
 
     // Use the prefetch object to check the quota.
     void Quota(int amount, CheckResult::Quota* quota);
@@ -120,6 +182,14 @@ class QuotaCache {
     // The quota name.
     const std::string& quota_name() const { return name_; }
 
+    // Returns the approximate memory size of the item in bytes.
+    size_t ByteSize();
+
+    // Gets the statistics of the prefetch object.
+    void GetStats(prefetch::QuotaPrefetch::Stats* stats) {
+      prefetch_->GetStats(stats);
+    }
+
    private:
     // The quota allocation call.
     void Alloc(int amount, prefetch::QuotaPrefetch::DoneFunc fn);
@@ -140,30 +210,104 @@ class QuotaCache {
     std::unique_ptr<CacheElem> pending_item;
 
     // Referenced map keyed with their hashes
-    std::unordered_map<std::string, Referenced> referenced_map;
+    std::unordered_map<utils::FastHash::Key, Referenced,
+                       utils::FastHash::KeyHash>
+        referenced_map;
+
+    // Number of quota checks found and not found in the cache.
+    uint64_t hits = 0;
+    uint64_t misses = 0;
   };
 
+  // The cost of a cache item, in bytes if max_bytes is set.
+  size_t Cost(CacheElem* elem);
+
   // Set a quota response.
   void SetResponse(
       const ::istio::mixer::v1::Attributes& attributes,
       const std::string& quota_name,
       const ::istio::mixer::v1::CheckResponse::QuotaResult* result);
 
-  // A map from quota name to PerQuotaReferenced.
-  std::unordered_map<std::string, PerQuotaReferenced> quota_referenced_map_;
-
   // Key is the signature of the Attributes. Value is the CacheElem.
   // It is a LRU cache with MaxIdelTime as response_expiration_time.
-  using QuotaLRUCache = utils::SimpleLRUCache<std::string, CacheElem>;
+  using QuotaLRUCache =
+      utils::SimpleLRUCache<utils::FastHash::Key, CacheElem,
+                            utils::FastHash::KeyHash>;
+
+  // A shard of the cache. Signatures include the quota name, so all items
+  // of a quota are in the shard of its name.
+  struct Shard {
+    // Mutex guarding the access of cache and quota_referenced_map
+    Mutex mutex;
+
+    // A map from quota name to PerQuotaReferenced.
+    std::unordered_map<std::string, PerQuotaReferenced> quota_referenced_map;
+
+    // The cache that maps from key to prefetch object
+    std::unique_ptr<QuotaLRUCache> cache;
+  };
+
+  // Returns the shard of a quota.
+  Shard* GetShard(const std::string& quota_name);
+
+  // Sets a quota to be sent to the server without the cache.
+  static void NotUseCache(CheckResult::Quota* quota);
+
+  // Returns true if a quota of the request is rejected by a recent zero
+  // grant for the same referenced attributes.
+  bool RejectedRecently(const ::istio::mixer::v1::Attributes& request,
+                        const std::string& quota_name);
+
+  // Wraps the response functions of the quotas to be sent to record
+  // their results.
+  void WatchResults(CheckResult::Quota* quotas, size_t count);
+
+  // Remembers a zero grant with a valid duration, or forgets the rejection
+  // of a signature granted again.
+  void RecordResult(const ::istio::mixer::v1::Attributes& attributes,
+                    const std::string& quota_name,
+                    const ::istio::mixer::v1::CheckResponse::QuotaResult&
+                        result);
+
+  // Removes the expired rejected signatures. rejections_mutex_ should be
+  // locked.
+  void RemoveExpiredRejectionsWithLock();
+
+  // The quotas recently rejected with a zero grant, by quota name.
+  struct Rejections {
+    // The Referenced of the rejected signatures, by their hashes.
+    std::unordered_map<utils::FastHash::Key, Referenced,
+                       utils::FastHash::KeyHash>
+        referenced_map;
+    // The rejected signatures, and until when they are rejected.
+    std::unordered_map<utils::FastHash::Key,
+                       std::chrono::steady_clock::time_point,
+                       utils::FastHash::KeyHash>
+        expire_time;
+    // Number of quota checks rejected locally.
+    uint64_t hits = 0;
+  };
+
+  // Check quota cache with the value hashes of the request. The shard of
+  // the quota should be locked.
+  void CheckCache(AttributeFingerprints* fingerprints, Shard* shard,
+                  CheckResult::Quota* quota);
 
   // The quota options.
   QuotaOptions options_;
 
-  // Mutex guarding the access of cache_ and quota_referenced_map_
-  std::mutex cache_mutex_;
+  // False if the cache and its prefetches take no mutex.
+  const bool thread_safe_;
+
+  // The cache shards, empty if the cache is disabled.
+  std::vector<std::unique_ptr<Shard>> shards_;
 
-  // The cache that maps from key to prefetch object
-  std::unique_ptr<QuotaLRUCache> cache_;
+  // Mutex guarding rejections_.
+  Mutex rejections_mutex_;
+  std::unordered_map<std::string, Rejections> rejections_;
+  // The number of rejected signatures, read without the lock to skip the
+  // lookup when there is none.
+  std::atomic<int> num_rejected_signatures_;
 
   GOOGLE_DISALLOW_EVIL_CONSTRUCTORS(QuotaCache);
 };
@@ -20,6 +20,8 @@
 #include "include/istio/utils/attributes_builder.h"
 #include "src/istio/mixerclient/status_test_util.h"
 
+#include <unistd.h>
+
 using ::google::protobuf::util::Status;
 using ::google::protobuf::util::error::Code;
 using ::istio::mixer::v1::Attributes;
@@ -308,6 +310,242 @@ TEST_F(QuotaCacheTest, TestTwoReferencedWith) {
   TestRequest(attr2, true, response2);
 }
 
+TEST_F(QuotaCacheTest, TestShards) {
+  QuotaOptions options(100 /* entries */, 600000);
+  options.num_shards = 4;
+  cache_ = std::unique_ptr<QuotaCache>(new QuotaCache(options));
+
+  for (int i = 0; i < 8; ++i) {
+    std::string name = kQuotaName + std::to_string(i);
+    std::vector<Requirement> quotas;
+    quotas.push_back({name, 1});
+    QuotaCache::CheckResult result;
+    cache_->Check(request_, quotas, true, &result);
+    CheckRequest request;
+    EXPECT_TRUE(result.BuildRequest(&request));
+
+    CheckResponse response;
+    CheckResponse::QuotaResult quota_result;
+    quota_result.set_granted_amount(10);
+    (*response.mutable_quotas())[name] = quota_result;
+    result.SetResponse(Status::OK, request_, response);
+  }
+
+  // Each quota is cached in the shard of its name.
+  uint64_t num_entries, num_bytes;
+  cache_->GetCacheSize(&num_entries, &num_bytes);
+  EXPECT_EQ(num_entries, 8);
+  EXPECT_GT(num_bytes, 0);
+}
+
+TEST_F(QuotaCacheTest, TestSweepExpired) {
+  // Idle items expire in 50 milliseconds.
+  QuotaOptions options(100 /* entries */, 50);
+  cache_ = std::unique_ptr<QuotaCache>(new QuotaCache(options));
+
+  for (int i = 0; i < 4; ++i) {
+    std::string name = kQuotaName + std::to_string(i);
+    std::vector<Requirement> quotas;
+    quotas.push_back({name, 1});
+    QuotaCache::CheckResult result;
+    cache_->Check(request_, quotas, true, &result);
+    CheckRequest request;
+    EXPECT_TRUE(result.BuildRequest(&request));
+
+    CheckResponse response;
+    CheckResponse::QuotaResult quota_result;
+    quota_result.set_granted_amount(10);
+    (*response.mutable_quotas())[name] = quota_result;
+    result.SetResponse(Status::OK, request_, response);
+  }
+  EXPECT_EQ(cache_->SweepExpired(10), 0);
+
+  usleep(60 * 1000);
+  // Each sweep removes at most max_items items of a shard.
+  EXPECT_EQ(cache_->SweepExpired(1), 1);
+  EXPECT_EQ(cache_->SweepExpired(10), 3);
+  uint64_t num_entries, num_bytes;
+  cache_->GetCacheSize(&num_entries, &num_bytes);
+  EXPECT_EQ(num_entries, 0);
+}
+
+TEST_F(QuotaCacheTest, TestMultipleQuotasInShards) {
+  QuotaOptions options(100 /* entries */, 600000);
+  options.num_shards = 4;
+  cache_ = std::unique_ptr<QuotaCache>(new QuotaCache(options));
+
+  // More quotas than the shards kept on the stack.
+  std::vector<Requirement> quotas;
+  CheckResponse response;
+  for (int i = 0; i < 10; ++i) {
+    std::string name = kQuotaName + std::to_string(i);
+    quotas.push_back({name, 1});
+    CheckResponse::QuotaResult quota_result;
+    quota_result.set_granted_amount(10);
+    (*response.mutable_quotas())[name] = quota_result;
+  }
+
+  QuotaCache::CheckResult result;
+  cache_->Check(request_, quotas, true, &result);
+  CheckRequest request;
+  EXPECT_TRUE(result.BuildRequest(&request));
+  EXPECT_EQ(request.quotas().size(), 10);
+  result.SetResponse(Status::OK, request_, response);
+  EXPECT_OK(result.status());
+
+  // All quotas are served from the cache.
+  QuotaCache::CheckResult result1;
+  cache_->Check(request_, quotas, true, &result1);
+  CheckRequest request1;
+  EXPECT_FALSE(result1.BuildRequest(&request1));
+  EXPECT_TRUE(result1.IsCacheHit());
+  EXPECT_OK(result1.status());
+}
+
+TEST_F(QuotaCacheTest, TestQuotaStats) {
+  CheckResponse response;
+  CheckResponse::QuotaResult quota_result;
+  quota_result.set_granted_amount(10);
+  (*response.mutable_quotas())[kQuotaName] = quota_result;
+
+  // A miss, then a hit.
+  for (int i = 0; i < 2; ++i) {
+    QuotaCache::CheckResult result;
+    cache_->Check(request_, quotas_, true, &result);
+    CheckRequest request;
+    result.BuildRequest(&request);
+    result.SetResponse(Status::OK, request_, response);
+  }
+
+  std::vector<QuotaNameStats> stats;
+  cache_->GetQuotaStats(&stats);
+  ASSERT_EQ(stats.size(), 1);
+  EXPECT_EQ(stats[0].name, kQuotaName);
+  EXPECT_EQ(stats[0].hits, 1);
+  EXPECT_EQ(stats[0].misses, 1);
+  EXPECT_EQ(stats[0].prefetch_calls, 1);
+  EXPECT_EQ(stats[0].granted_amount, 10);
+  EXPECT_EQ(stats[0].used_amount, 2);
+  EXPECT_EQ(stats[0].queue_depth, 1);
+}
+
+TEST_F(QuotaCacheTest, TestNegativeCache) {
+  // A zero grant for source.name user1, valid for a minute.
+  CheckResponse response;
+  CheckResponse::QuotaResult quota_result;
+  quota_result.set_granted_amount(0);
+  quota_result.mutable_valid_duration()->set_seconds(60);
+  auto match =
+      quota_result.mutable_referenced_attributes()->add_attribute_matches();
+  match->set_condition(ReferencedAttributes::EXACT);
+  match->set_name(2);  // "source.name"
+  (*response.mutable_quotas())[kQuotaName] = quota_result;
+
+  Attributes attr1(request_);
+  utils::AttributesBuilder(&attr1).AddString("source.name", "user1");
+  Attributes attr2(request_);
+  utils::AttributesBuilder(&attr2).AddString("source.name", "user2");
+
+  // Not using the cache, the first request is sent and rejected.
+  QuotaCache::CheckResult result;
+  cache_->Check(attr1, quotas_, false, &result);
+  CheckRequest request;
+  EXPECT_TRUE(result.BuildRequest(&request));
+  result.SetResponse(Status::OK, attr1, response);
+  EXPECT_ERROR_CODE(Code::RESOURCE_EXHAUSTED, result.status());
+
+  // The next ones are rejected locally.
+  for (bool use_cache : {false, true}) {
+    QuotaCache::CheckResult rejected;
+    cache_->Check(attr1, quotas_, use_cache, &rejected);
+    CheckRequest rejected_request;
+    EXPECT_FALSE(rejected.BuildRequest(&rejected_request));
+    EXPECT_TRUE(rejected.IsCacheHit());
+    EXPECT_ERROR_CODE(Code::RESOURCE_EXHAUSTED, rejected.status());
+  }
+
+  // Another source is still sent.
+  QuotaCache::CheckResult other;
+  cache_->Check(attr2, quotas_, false, &other);
+  CheckRequest other_request;
+  EXPECT_TRUE(other.BuildRequest(&other_request));
+  EXPECT_FALSE(other.IsCacheHit());
+
+  std::vector<QuotaNameStats> stats;
+  cache_->GetQuotaStats(&stats);
+  ASSERT_EQ(stats.size(), 1);
+  EXPECT_EQ(stats[0].negative_hits, 2);
+}
+
+TEST_F(QuotaCacheTest, TestNegativeCacheDisabled) {
+  QuotaOptions options;
+  options.max_rejected_signatures = 0;
+  cache_ = std::unique_ptr<QuotaCache>(new QuotaCache(options));
+
+  CheckResponse response;
+  CheckResponse::QuotaResult quota_result;
+  quota_result.set_granted_amount(0);
+  quota_result.mutable_valid_duration()->set_seconds(60);
+  (*response.mutable_quotas())[kQuotaName] = quota_result;
+
+  for (int i = 0; i < 2; ++i) {
+    QuotaCache::CheckResult result;
+    cache_->Check(request_, quotas_, false, &result);
+    CheckRequest request;
+    EXPECT_TRUE(result.BuildRequest(&request));
+    result.SetResponse(Status::OK, request_, response);
+    EXPECT_ERROR_CODE(Code::RESOURCE_EXHAUSTED, result.status());
+  }
+}
+
+TEST_F(QuotaCacheTest, TestReferencedResponseNotLearned) {
+  CheckResponse::QuotaResult quota_result;
+  quota_result.set_granted_amount(10);
+  quota_result.mutable_valid_duration()->set_seconds(60);
+  auto match =
+      quota_result.mutable_referenced_attributes()->add_attribute_matches();
+  match->set_condition(ReferencedAttributes::EXACT);
+  match->set_name(2);  // "source.name"
+  CheckResponse granted;
+  (*granted.mutable_quotas())[kQuotaName] = quota_result;
+  quota_result.set_granted_amount(0);
+  CheckResponse rejected;
+  (*rejected.mutable_quotas())[kQuotaName] = quota_result;
+
+  Attributes attr1(request_);
+  utils::AttributesBuilder(&attr1).AddString("source.name", "user1");
+
+  // The first response is learned, the item is cached.
+  QuotaCache::CheckResult result;
+  cache_->Check(attr1, quotas_, true, &result);
+  CheckRequest request;
+  EXPECT_TRUE(result.BuildRequest(&request));
+  result.SetResponse(Status::OK, attr1, granted);
+  EXPECT_OK(result.status());
+
+  // The rejection of a prefetch sent with only the referenced attributes
+  // is not learned from them.
+  bool prefetched = false;
+  for (int i = 0; i < 20 && !prefetched; ++i) {
+    QuotaCache::CheckResult prefetch;
+    cache_->Check(attr1, quotas_, true, &prefetch);
+    CheckRequest prefetch_request;
+    prefetched = prefetch.BuildRequest(&prefetch_request);
+    EXPECT_TRUE(prefetch.IsCacheHit());
+    if (prefetched) {
+      prefetch.SetReferencedResponse(Status::OK, rejected);
+      EXPECT_OK(prefetch.status());
+    }
+  }
+  ASSERT_TRUE(prefetched);
+
+  QuotaCache::CheckResult not_cached;
+  cache_->Check(attr1, quotas_, false, &not_cached);
+  CheckRequest not_cached_request;
+  EXPECT_TRUE(not_cached.BuildRequest(&not_cached_request));
+  EXPECT_FALSE(not_cached.IsCacheHit());
+}
+
 }  // namespace
 }  // namespace mixerclient
 }  // namespace istio
@@ -19,8 +19,10 @@
 
 #include <algorithm>
 #include <map>
+#include <mutex>
 #include <set>
 #include <sstream>
+#include <unordered_map>
 
 using ::istio::mixer::v1::Attributes;
 using ::istio::mixer::v1::Attributes_AttributeValue;
@@ -33,6 +35,49 @@ const char kDelimiter[] = "\0";
 const int kDelimiterLength = 1;
 const std::string kWordDelimiter = ":";
 
+// The number of exact attributes matched without allocation.
+const std::size_t kMaxInlineGroups = 16;
+
+// The outcomes of a "regex" match hashed into a signature.
+const char kRegexAbsent = 0;
+const char kRegexMatched = 1;
+const char kRegexNotMatched = 2;
+
+// Returns the compiled regex of a pattern, nullptr if it is invalid. The
+// regexes are shared by all the objects using the same pattern, since
+// Mixer sends the same patterns for many shapes and compiling is costly.
+// The ones not used anymore are dropped when a new one is compiled. RE2
+// is used, like the Go regexp package of Mixer, so the patterns have the
+// same syntax and a match takes linear time.
+std::shared_ptr<const re2::RE2> GetRegex(const std::string &pattern) {
+  static std::mutex *mutex = new std::mutex;
+  static auto *regexes =
+      new std::unordered_map<std::string, std::weak_ptr<const re2::RE2>>;
+  std::lock_guard<std::mutex> lock(*mutex);
+  auto it = regexes->find(pattern);
+  if (it != regexes->end()) {
+    auto regex = it->second.lock();
+    if (regex) {
+      return regex;
+    }
+  }
+  auto regex = std::make_shared<const re2::RE2>(pattern, re2::RE2::Quiet);
+  if (!regex->ok()) {
+    GOOGLE_LOG(ERROR) << "Invalid REGEX in ReferencedAttributes: " << pattern
+                      << ", " << regex->error();
+    return nullptr;
+  }
+  for (auto dead = regexes->begin(); dead != regexes->end();) {
+    if (dead->second.expired()) {
+      dead = regexes->erase(dead);
+    } else {
+      ++dead;
+    }
+  }
+  (*regexes)[pattern] = regex;
+  return regex;
+}
+
 // Decode dereferences index into str using global and local word lists.
 // Decode returns false if it is unable to Decode.
 bool Decode(int idx, const std::vector<std::string> &global_words,
@@ -61,9 +106,81 @@ bool Decode(int idx, const std::vector<std::string> &global_words,
 
 }  // namespace
 
+const utils::FastHash::Key *AttributeFingerprints::Find(
+    const void *value) const {
+  for (const auto &it : hashes_) {
+    if (it.first == value) {
+      return &it.second;
+    }
+  }
+  return nullptr;
+}
+
+utils::FastHash::Key AttributeFingerprints::Get(
+    const Attributes_AttributeValue &value) {
+  const utils::FastHash::Key *found = Find(&value);
+  if (found) {
+    return *found;
+  }
+  utils::FastHash hasher;
+  switch (value.value_case()) {
+    case Attributes_AttributeValue::kStringValue:
+      hasher.Update(value.string_value());
+      break;
+    case Attributes_AttributeValue::kBytesValue:
+      hasher.Update(value.bytes_value());
+      break;
+    case Attributes_AttributeValue::kInt64Value: {
+      auto data = value.int64_value();
+      hasher.Update(&data, sizeof(data));
+    } break;
+    case Attributes_AttributeValue::kDoubleValue: {
+      auto data = value.double_value();
+      hasher.Update(&data, sizeof(data));
+    } break;
+    case Attributes_AttributeValue::kBoolValue: {
+      auto data = value.bool_value();
+      hasher.Update(&data, sizeof(data));
+    } break;
+    case Attributes_AttributeValue::kTimestampValue: {
+      auto seconds = value.timestamp_value().seconds();
+      auto nanos = value.timestamp_value().nanos();
+      hasher.Update(&seconds, sizeof(seconds));
+      hasher.Update(kDelimiter, kDelimiterLength);
+      hasher.Update(&nanos, sizeof(nanos));
+    } break;
+    case Attributes_AttributeValue::kDurationValue: {
+      auto seconds = value.duration_value().seconds();
+      auto nanos = value.duration_value().nanos();
+      hasher.Update(&seconds, sizeof(seconds));
+      hasher.Update(kDelimiter, kDelimiterLength);
+      hasher.Update(&nanos, sizeof(nanos));
+    } break;
+    case Attributes_AttributeValue::kStringMapValue:
+    case Attributes_AttributeValue::VALUE_NOT_SET:
+      break;
+  }
+  hashes_.emplace_back(&value, hasher.Digest());
+  return hashes_.back().second;
+}
+
+utils::FastHash::Key AttributeFingerprints::Get(const std::string &map_key,
+                                                const std::string &entry) {
+  const utils::FastHash::Key *found = Find(&entry);
+  if (found) {
+    return *found;
+  }
+  utils::FastHash hasher;
+  hasher.Update(map_key);
+  hasher.Update(kDelimiter, kDelimiterLength);
+  hasher.Update(entry);
+  hashes_.emplace_back(&entry, hasher.Digest());
+  return hashes_.back().second;
+}
+
 // Updates hasher with keys
 void Referenced::UpdateHash(const std::vector<AttributeRef> &keys,
-                            utils::MD5 *hasher) {
+                            utils::FastHash *hasher) {
   // keys are already sorted during Fill
   for (const AttributeRef &key : keys) {
     hasher->Update(key.name);
@@ -72,6 +189,10 @@ void Referenced::UpdateHash(const std::vector<AttributeRef> &keys,
       hasher->Update(key.map_key);
       hasher->Update(kDelimiter, kDelimiterLength);
     }
+    if (!key.regex.empty()) {
+      hasher->Update(key.regex);
+      hasher->Update(kDelimiter, kDelimiterLength);
+    }
   }
 }
 
@@ -101,27 +222,136 @@ bool Referenced::Fill(const Attributes &attributes,
     } else if (match.condition() == ReferencedAttributes::EXACT) {
       exact_keys_.push_back(ar);
     } else if (match.condition() == ReferencedAttributes::REGEX) {
-      // Don't support REGEX yet, return false to no caching the response.
-      GOOGLE_LOG(ERROR) << "Received REGEX in ReferencedAttributes for "
-                        << ar.name;
-      return false;
+      ar.regex = match.regex();
+      regex_keys_.push_back(ar);
     }
   }
 
   std::sort(absence_keys_.begin(), absence_keys_.end());
   std::sort(exact_keys_.begin(), exact_keys_.end());
+  std::sort(regex_keys_.begin(), regex_keys_.end());
+  // Not to cache the response if a regex can't be compiled.
+  return Compile();
+}
 
+void Referenced::CompileKeys(const std::vector<AttributeRef> &keys,
+                             std::vector<KeyGroup> *groups) {
+  groups->clear();
+  for (const AttributeRef &key : keys) {
+    if (groups->empty() || groups->back().name != key.name) {
+      groups->push_back(KeyGroup());
+      groups->back().name = key.name;
+    }
+    groups->back().map_keys.push_back(key.map_key);
+  }
+}
+
+bool Referenced::Compile() {
+  CompileKeys(absence_keys_, &absence_groups_);
+  CompileKeys(exact_keys_, &exact_groups_);
+  regexes_.clear();
+  for (const AttributeRef &key : regex_keys_) {
+    regexes_.push_back(GetRegex(key.regex));
+    if (!regexes_.back()) {
+      return false;
+    }
+  }
   return true;
 }
 
+void Referenced::GetNames(std::set<std::string> *names) const {
+  for (const KeyGroup &group : absence_groups_) {
+    names->insert(group.name);
+  }
+  for (const KeyGroup &group : exact_groups_) {
+    names->insert(group.name);
+  }
+  for (const AttributeRef &key : regex_keys_) {
+    names->insert(key.name);
+  }
+}
+
+void Referenced::CopyExactAttributes(const Attributes &from,
+                                     Attributes *to) const {
+  const auto &from_map = from.attributes();
+  auto *to_map = to->mutable_attributes();
+  for (const KeyGroup &group : exact_groups_) {
+    const auto it = from_map.find(group.name);
+    if (it == from_map.end()) {
+      continue;
+    }
+    const Attributes_AttributeValue &value = it->second;
+    bool whole = value.value_case() !=
+                 Attributes_AttributeValue::kStringMapValue;
+    for (const std::string &map_key : group.map_keys) {
+      whole = whole || map_key.empty();
+    }
+    if (whole) {
+      (*to_map)[group.name] = value;
+      continue;
+    }
+    const auto &smap = value.string_map_value().entries();
+    auto *to_smap =
+        (*to_map)[group.name].mutable_string_map_value()->mutable_entries();
+    for (const std::string &map_key : group.map_keys) {
+      const auto sub_it = smap.find(map_key);
+      if (sub_it != smap.end()) {
+        (*to_smap)[map_key] = sub_it->second;
+      }
+    }
+  }
+  for (const AttributeRef &key : regex_keys_) {
+    const auto it = from_map.find(key.name);
+    if (it == from_map.end()) {
+      continue;
+    }
+    const Attributes_AttributeValue &value = it->second;
+    if (value.value_case() != Attributes_AttributeValue::kStringMapValue ||
+        key.map_key.empty()) {
+      (*to_map)[key.name] = value;
+      continue;
+    }
+    const auto &smap = value.string_map_value().entries();
+    const auto sub_it = smap.find(key.map_key);
+    if (sub_it != smap.end()) {
+      (*(*to_map)[key.name].mutable_string_map_value()
+            ->mutable_entries())[key.map_key] = sub_it->second;
+    }
+  }
+}
+
 bool Referenced::Signature(const Attributes &attributes,
                            const std::string &extra_key,
-                           std::string *signature) const {
-  const auto &attributes_map = attributes.attributes();
+                           utils::FastHash::Key *signature) const {
+  AttributeFingerprints fingerprints(attributes);
+  return Signature(&fingerprints, extra_key, signature);
+}
 
-  for (std::size_t i = 0; i < absence_keys_.size(); ++i) {
-    const auto &key = absence_keys_[i];
-    const auto it = attributes_map.find(key.name);
+bool Referenced::Signature(AttributeFingerprints *fingerprints,
+                           const std::string &extra_key,
+                           utils::FastHash::Key *signature) const {
+  const auto &attributes_map = fingerprints->attributes().attributes();
+
+  // Rule out a mismatch from attribute names first, before any hashing.
+  // The found values are kept so each attribute is only looked up once.
+  // if an "exact" attribute not present, return false for mismatch.
+  const Attributes_AttributeValue *inline_values[kMaxInlineGroups];
+  std::vector<const Attributes_AttributeValue *> values;
+  const Attributes_AttributeValue **exact_values = inline_values;
+  if (exact_groups_.size() > kMaxInlineGroups) {
+    values.resize(exact_groups_.size());
+    exact_values = values.data();
+  }
+  for (std::size_t i = 0; i < exact_groups_.size(); ++i) {
+    const auto it = attributes_map.find(exact_groups_[i].name);
+    if (it == attributes_map.end()) {
+      return false;
+    }
+    exact_values[i] = &it->second;
+  }
+
+  for (const KeyGroup &group : absence_groups_) {
+    const auto it = attributes_map.find(group.name);
     if (it == attributes_map.end()) {
       continue;
     }
@@ -133,103 +363,76 @@ bool Referenced::Signature(const Attributes &attributes,
       return false;
     }
 
-    std::string map_key = key.map_key;
     const auto &smap = value.string_map_value().entries();
-    // Since absence_keys_ are sorted by key.name,
-    // continue processing stringMaps until a new name is found.
-    do {
+    for (const std::string &map_key : group.map_keys) {
       // if subkey is found, it is a violation of "absence" constrain.
       if (smap.find(map_key) != smap.end()) {
         return false;
       }
-      // break loop if at the end or keyname changes.
-      if (i + 1 == absence_keys_.size() ||
-          absence_keys_[i + 1].name != key.name) {
-        break;
-      }
+    }
+  }
 
-      map_key = absence_keys_[++i].map_key;
+  utils::FastHash hasher;
 
-    } while (true);
-  }
+  for (std::size_t i = 0; i < exact_groups_.size(); ++i) {
+    const KeyGroup &group = exact_groups_[i];
+    const Attributes_AttributeValue &value = *exact_values[i];
 
-  utils::MD5 hasher;
+    hasher.Update(group.name);
+    hasher.Update(kDelimiter, kDelimiterLength);
 
-  for (std::size_t i = 0; i < exact_keys_.size(); ++i) {
-    const auto &key = exact_keys_[i];
-    const auto it = attributes_map.find(key.name);
-    // if an "exact" attribute not present, return false for mismatch.
-    if (it == attributes_map.end()) {
-      return false;
+    if (value.value_case() != Attributes_AttributeValue::kStringMapValue) {
+      utils::FastHash::Key hash = fingerprints->Get(value);
+      hasher.Update(&hash, sizeof(hash));
+    } else {
+      const auto &smap = value.string_map_value().entries();
+      for (const std::string &map_key : group.map_keys) {
+        const auto sub_it = smap.find(map_key);
+        // exact match of map_key is missing
+        if (sub_it == smap.end()) {
+          return false;
+        }
+        utils::FastHash::Key hash =
+            fingerprints->Get(sub_it->first, sub_it->second);
+        hasher.Update(&hash, sizeof(hash));
+      }
     }
-
-    hasher.Update(it->first);
     hasher.Update(kDelimiter, kDelimiterLength);
+  }
 
-    const Attributes_AttributeValue &value = it->second;
-    switch (value.value_case()) {
-      case Attributes_AttributeValue::kStringValue:
-        hasher.Update(value.string_value());
-        break;
-      case Attributes_AttributeValue::kBytesValue:
-        hasher.Update(value.bytes_value());
-        break;
-      case Attributes_AttributeValue::kInt64Value: {
-        auto data = value.int64_value();
-        hasher.Update(&data, sizeof(data));
-      } break;
-      case Attributes_AttributeValue::kDoubleValue: {
-        auto data = value.double_value();
-        hasher.Update(&data, sizeof(data));
-      } break;
-      case Attributes_AttributeValue::kBoolValue: {
-        auto data = value.bool_value();
-        hasher.Update(&data, sizeof(data));
-      } break;
-      case Attributes_AttributeValue::kTimestampValue: {
-        auto seconds = value.timestamp_value().seconds();
-        auto nanos = value.timestamp_value().nanos();
-        hasher.Update(&seconds, sizeof(seconds));
-        hasher.Update(kDelimiter, kDelimiterLength);
-        hasher.Update(&nanos, sizeof(nanos));
-      } break;
-      case Attributes_AttributeValue::kDurationValue: {
-        auto seconds = value.duration_value().seconds();
-        auto nanos = value.duration_value().nanos();
-        hasher.Update(&seconds, sizeof(seconds));
-        hasher.Update(kDelimiter, kDelimiterLength);
-        hasher.Update(&nanos, sizeof(nanos));
-      } break;
-      case Attributes_AttributeValue::kStringMapValue: {
-        std::string map_key = key.map_key;
+  for (std::size_t i = 0; i < regex_keys_.size(); ++i) {
+    const AttributeRef &key = regex_keys_[i];
+    // Like Mixer, a regex matches any part of a string value.
+    char outcome = kRegexAbsent;
+    const auto it = attributes_map.find(key.name);
+    if (it != attributes_map.end()) {
+      const Attributes_AttributeValue &value = it->second;
+      const std::string *str = nullptr;
+      if (value.value_case() == Attributes_AttributeValue::kStringValue) {
+        str = &value.string_value();
+      } else if (value.value_case() ==
+                     Attributes_AttributeValue::kStringMapValue &&
+                 !key.map_key.empty()) {
         const auto &smap = value.string_map_value().entries();
-        // Since exact_keys_ are sorted by key.name,
-        // continue processing stringMaps until a new name is found.
-        do {
-          const auto sub_it = smap.find(map_key);
-          // exact match of map_key is missing
-          if (sub_it == smap.end()) {
-            return false;
-          }
-
-          hasher.Update(sub_it->first);
-          hasher.Update(kDelimiter, kDelimiterLength);
-          hasher.Update(sub_it->second);
-          hasher.Update(kDelimiter, kDelimiterLength);
-
-          // break loop if at the end or keyname changes.
-          if (i + 1 == exact_keys_.size() ||
-              exact_keys_[i + 1].name != key.name) {
-            break;
-          }
-
-          map_key = exact_keys_[++i].map_key;
-        } while (true);
-      } break;
-      case Attributes_AttributeValue::VALUE_NOT_SET:
-        break;
+        const auto sub_it = smap.find(key.map_key);
+        if (sub_it != smap.end()) {
+          str = &sub_it->second;
+        }
+      } else {
+        // Other types are not matched by a regex.
+        return false;
+      }
+      if (str) {
+        outcome = re2::RE2::PartialMatch(*str, *regexes_[i])
+                      ? kRegexMatched
+                      : kRegexNotMatched;
+      }
     }
+    hasher.Update(key.name);
     hasher.Update(kDelimiter, kDelimiterLength);
+    hasher.Update(key.map_key);
+    hasher.Update(kDelimiter, kDelimiterLength);
+    hasher.Update(&outcome, sizeof(outcome));
   }
   hasher.Update(extra_key);
 
@@ -237,17 +440,91 @@ bool Referenced::Signature(const Attributes &attributes,
   return true;
 }
 
-std::string Referenced::Hash() const {
-  utils::MD5 hasher;
+utils::FastHash::Key Referenced::Hash() const {
+  utils::FastHash hasher;
 
   // keys are sorted during Fill
   UpdateHash(absence_keys_, &hasher);
   hasher.Update(kWordDelimiter);
   UpdateHash(exact_keys_, &hasher);
+  // Not hashed without regex keys, so the hashes of the other shapes are
+  // the same as before they were supported.
+  if (!regex_keys_.empty()) {
+    hasher.Update(kWordDelimiter);
+    UpdateHash(regex_keys_, &hasher);
+  }
 
   return hasher.Digest();
 }
 
+size_t Referenced::ByteSize() const {
+  size_t size = sizeof(*this);
+  for (const auto *keys : {&absence_keys_, &exact_keys_, &regex_keys_}) {
+    size += keys->capacity() * sizeof(AttributeRef);
+    for (const AttributeRef &key : *keys) {
+      size += key.name.capacity() + key.map_key.capacity() +
+              key.regex.capacity();
+    }
+  }
+  // The compiled regexes are shared, only their references are counted.
+  size += regexes_.capacity() * sizeof(regexes_[0]);
+  for (const auto *groups : {&absence_groups_, &exact_groups_}) {
+    size += groups->capacity() * sizeof(KeyGroup);
+    for (const KeyGroup &group : *groups) {
+      size += group.name.capacity() +
+              group.map_keys.capacity() * sizeof(std::string);
+      for (const std::string &map_key : group.map_keys) {
+        size += map_key.capacity();
+      }
+    }
+  }
+  return size;
+}
+
+void Referenced::EncodeSnapshotKeys(const std::vector<AttributeRef> &keys,
+                                    SnapshotWriter *writer) {
+  writer->Write<uint32_t>(keys.size());
+  for (const AttributeRef &key : keys) {
+    writer->WriteString(key.name);
+    writer->WriteString(key.map_key);
+    writer->WriteString(key.regex);
+  }
+}
+
+bool Referenced::DecodeSnapshotKeys(SnapshotReader *reader,
+                                    std::vector<AttributeRef> *keys) {
+  uint32_t size;
+  if (!reader->Read(&size)) {
+    return false;
+  }
+  keys->clear();
+  for (uint32_t i = 0; i < size; ++i) {
+    AttributeRef ar;
+    if (!reader->ReadString(&ar.name) || !reader->ReadString(&ar.map_key) ||
+        !reader->ReadString(&ar.regex)) {
+      return false;
+    }
+    keys->push_back(ar);
+  }
+  // Keys should be sorted as in Fill.
+  return std::is_sorted(keys->begin(), keys->end());
+}
+
+void Referenced::EncodeSnapshot(SnapshotWriter *writer) const {
+  EncodeSnapshotKeys(absence_keys_, writer);
+  EncodeSnapshotKeys(exact_keys_, writer);
+  EncodeSnapshotKeys(regex_keys_, writer);
+}
+
+bool Referenced::DecodeSnapshot(SnapshotReader *reader) {
+  if (!DecodeSnapshotKeys(reader, &absence_keys_) ||
+      !DecodeSnapshotKeys(reader, &exact_keys_) ||
+      !DecodeSnapshotKeys(reader, &regex_keys_)) {
+    return false;
+  }
+  return Compile();
+}
+
 std::string Referenced::DebugString() const {
   std::stringstream ss;
   ss << "Absence-keys: ";
@@ -266,6 +543,16 @@ std::string Referenced::DebugString() const {
     }
     ss << ", ";
   }
+  if (!regex_keys_.empty()) {
+    ss << "Regex-keys: ";
+    for (const auto &key : regex_keys_) {
+      ss << key.name;
+      if (!key.map_key.empty()) {
+        ss << "[" + key.map_key + "]";
+      }
+      ss << "~" << key.regex << ", ";
+    }
+  }
   return ss.str();
 }
 
@@ -16,14 +16,52 @@
 #ifndef ISTIO_MIXERCLIENT_REFERENCED_H_
 #define ISTIO_MIXERCLIENT_REFERENCED_H_
 
+#include <memory>
+#include <set>
 #include <vector>
 
-#include "include/istio/utils/md5.h"
+#include "include/istio/utils/fast_hash.h"
 #include "mixer/v1/check.pb.h"
+#include "re2/re2.h"
+#include "src/istio/mixerclient/snapshot_coder.h"
 
 namespace istio {
 namespace mixerclient {
 
+// The value hashes of the attributes of one request, each computed when a
+// signature first uses it, so the signatures of all the check and quota
+// shapes only combine them. It is not thread safe, it lives in one Check
+// call and the attributes must outlive it.
+class AttributeFingerprints {
+ public:
+  AttributeFingerprints(const ::istio::mixer::v1::Attributes &attributes)
+      : attributes_(attributes) {}
+
+  const ::istio::mixer::v1::Attributes &attributes() const {
+    return attributes_;
+  }
+
+  // Returns the hash of an attribute value, which is not a stringMap.
+  utils::FastHash::Key Get(
+      const ::istio::mixer::v1::Attributes_AttributeValue &value);
+
+  // Returns the hash of a stringMap entry.
+  utils::FastHash::Key Get(const std::string &map_key,
+                           const std::string &entry);
+
+  // Drops the hashes, called once values of the attributes are changed.
+  void Clear() { hashes_.clear(); }
+
+ private:
+  // Returns the memoized hash of a value object, nullptr if not found.
+  const utils::FastHash::Key *Find(const void *value) const;
+
+  const ::istio::mixer::v1::Attributes &attributes_;
+  // The hashes keyed by the address of their value object. A request only
+  // uses a few attributes, a linear search is cheaper than a hash map.
+  std::vector<std::pair<const void *, utils::FastHash::Key>> hashes_;
+};
+
 // The object to store referenced attributes used by Mixer server.
 // Mixer client cache should only use referenced attributes
 // in its cache (for both Check cache and quota cache).
@@ -35,15 +73,40 @@ class Referenced {
   bool Fill(const ::istio::mixer::v1::Attributes &attributes,
             const ::istio::mixer::v1::ReferencedAttributes &reference);
 
-  // Calculate a cache signature for the attributes.
+  // Calculate a cache signature for the attributes. The "regex" match
+  // attributes only add whether they match their regex, or are absent.
   // Return false if attributes are mismatched, such as "absence" attributes
   // present
   // or "exact" match attributes don't present.
   bool Signature(const ::istio::mixer::v1::Attributes &attributes,
-                 const std::string &extra_key, std::string *signature) const;
+                 const std::string &extra_key,
+                 utils::FastHash::Key *signature) const;
+
+  // Same as above, with the value hashes memoized in fingerprints.
+  bool Signature(AttributeFingerprints *fingerprints,
+                 const std::string &extra_key,
+                 utils::FastHash::Key *signature) const;
+
+  // Copies the "exact" and "regex" match attributes into to. For a
+  // stringMap attribute only its referenced map keys are copied.
+  void CopyExactAttributes(const ::istio::mixer::v1::Attributes &from,
+                           ::istio::mixer::v1::Attributes *to) const;
+
+  // Adds the names of the referenced attributes to names.
+  void GetNames(std::set<std::string> *names) const;
 
   // A hash value to identify an instance.
-  std::string Hash() const;
+  utils::FastHash::Key Hash() const;
+
+  // Returns the approximate memory size of the object in bytes.
+  size_t ByteSize() const;
+
+  // Writes the object into a check cache snapshot.
+  void EncodeSnapshot(SnapshotWriter *writer) const;
+
+  // Reads the object from a check cache snapshot.
+  // Return false if the snapshot data is corrupted.
+  bool DecodeSnapshot(SnapshotReader *reader);
 
   // For debug logging only.
   std::string DebugString() const;
@@ -55,12 +118,17 @@ class Referenced {
     std::string name;
     // only used if attribute is a stringMap
     std::string map_key;
+    // only used for a "regex" match
+    std::string regex;
 
     // make vector<AttributeRef> sortable
     bool operator<(const AttributeRef &b) const {
       int cmp = name.compare(b.name);
       if (cmp == 0) {
-        return map_key.compare(b.map_key) < 0;
+        cmp = map_key.compare(b.map_key);
+        if (cmp == 0) {
+          return regex.compare(b.regex) < 0;
+        }
       }
 
       return cmp < 0;
@@ -73,9 +141,40 @@ class Referenced {
   // The keys should match exactly.
   std::vector<AttributeRef> exact_keys_;
 
+  // The keys whose regex matches, or not, are part of the signature.
+  std::vector<AttributeRef> regex_keys_;
+
+  // Sorted keys of the same attribute name are compiled into one group,
+  // so Signature() only looks up each attribute once, and walks the map
+  // keys of a stringMap attribute from a contiguous array.
+  struct KeyGroup {
+    // name of the attribute
+    std::string name;
+    // map keys of a stringMap attribute, one per AttributeRef.
+    std::vector<std::string> map_keys;
+  };
+  std::vector<KeyGroup> absence_groups_;
+  std::vector<KeyGroup> exact_groups_;
+
+  // The compiled regexes of regex_keys_, in the same order. They are
+  // shared with the other objects using the same patterns.
+  std::vector<std::shared_ptr<const re2::RE2>> regexes_;
+
+  // Builds the key groups from the sorted keys, and compiles the regexes.
+  // Returns false if a regex is invalid.
+  bool Compile();
+  static void CompileKeys(const std::vector<AttributeRef> &keys,
+                          std::vector<KeyGroup> *groups);
+
   // Updates hasher with keys
   static void UpdateHash(const std::vector<AttributeRef> &keys,
-                         utils::MD5 *hasher);
+                         utils::FastHash *hasher);
+
+  // Writes or reads keys for a snapshot.
+  static void EncodeSnapshotKeys(const std::vector<AttributeRef> &keys,
+                                 SnapshotWriter *writer);
+  static bool DecodeSnapshotKeys(SnapshotReader *reader,
+                                 std::vector<AttributeRef> *keys);
 };
 
 }  // namespace mixerclient
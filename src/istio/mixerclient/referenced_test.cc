@@ -16,7 +16,6 @@
 #include "src/istio/mixerclient/referenced.h"
 
 #include "include/istio/utils/attributes_builder.h"
-#include "include/istio/utils/md5.h"
 
 #include "google/protobuf/text_format.h"
 #include "gtest/gtest.h"
@@ -123,6 +122,33 @@ attribute_matches {
 }
 )";
 
+const char kReferencedRegexText[] = R"(
+words: "request.path"
+words: "request.headers"
+words: "user-agent"
+attribute_matches {
+  name: -1,
+  condition: REGEX,
+  regex: "^/books/[0-9]+$",
+}
+attribute_matches {
+  name: -2,
+  map_key: -3,
+  condition: REGEX,
+  regex: "chrome",
+}
+)";
+
+// An invalid regex
+const char kReferencedRegexFailText[] = R"(
+words: "request.path"
+attribute_matches {
+  name: -1,
+  condition: REGEX,
+  regex: "[0-9",
+}
+)";
+
 TEST(ReferencedTest, FillSuccessTest) {
   ::istio::mixer::v1::ReferencedAttributes pb;
   ASSERT_TRUE(TextFormat::ParseFromString(kReferencedText, &pb));
@@ -139,8 +165,8 @@ TEST(ReferencedTest, FillSuccessTest) {
             "duration-key, int-key, string-key, string-map-key[If-Match], "
             "time-key, ");
 
-  EXPECT_EQ(utils::MD5::DebugString(referenced.Hash()),
-            "602d5bbd45b623c3560d2bdb6104f3ab");
+  EXPECT_EQ(utils::FastHash::DebugString(referenced.Hash()),
+            "179f0bca3e69ae7edfd6a856363314ba");
 }
 
 TEST(ReferencedTest, FillFail1Test) {
@@ -169,7 +195,7 @@ TEST(ReferencedTest, NegativeSignature1Test) {
   Referenced referenced;
   EXPECT_TRUE(referenced.Fill(attrs, pb));
 
-  std::string signature;
+  utils::FastHash::Key signature;
 
   Attributes attributes1;
   // "target.service" should be absence.
@@ -208,11 +234,167 @@ TEST(ReferencedTest, OKSignature1Test) {
   Referenced referenced;
   EXPECT_TRUE(referenced.Fill(attributes, pb));
 
-  std::string signature;
+  utils::FastHash::Key signature;
+  EXPECT_TRUE(referenced.Signature(attributes, "extra", &signature));
+
+  EXPECT_EQ(utils::FastHash::DebugString(signature),
+            "f01b5ac5509cacd8a13771c7b7091fa6");
+}
+
+TEST(ReferencedTest, SharedFingerprintsTest) {
+  ::istio::mixer::v1::ReferencedAttributes pb;
+  ASSERT_TRUE(TextFormat::ParseFromString(kReferencedText, &pb));
+  ::istio::mixer::v1::ReferencedAttributes partial;
+  ASSERT_TRUE(TextFormat::ParseFromString(kReferencedText, &partial));
+  partial.mutable_attribute_matches()->DeleteSubrange(2, 3);
+
+  Attributes attributes;
+  utils::AttributesBuilder builder(&attributes);
+  builder.AddString("string-key", "this is a string value");
+  builder.AddBytes("bytes-key", "this is a bytes value");
+  builder.AddDouble("double-key", 99.9);
+  builder.AddInt64("int-key", 35);
+  builder.AddBool("bool-key", true);
+  std::chrono::time_point<std::chrono::system_clock> time0;
+  builder.AddTimestamp("time-key", time0);
+  builder.AddDuration("duration-key", std::chrono::nanoseconds(5));
+  builder.AddStringMap("string-map-key", {{"If-Match", "value1"}});
+
+  Referenced referenced;
+  ASSERT_TRUE(referenced.Fill(attributes, pb));
+  Referenced other;
+  ASSERT_TRUE(other.Fill(attributes, partial));
+
+  // The signatures combining the shared value hashes are the same as the
+  // ones computed alone.
+  AttributeFingerprints fingerprints(attributes);
+  for (const Referenced* shape : {&referenced, &other, &referenced}) {
+    utils::FastHash::Key signature;
+    utils::FastHash::Key shared_signature;
+    ASSERT_TRUE(shape->Signature(attributes, "extra", &signature));
+    ASSERT_TRUE(shape->Signature(&fingerprints, "extra", &shared_signature));
+    EXPECT_EQ(signature, shared_signature);
+  }
+}
+
+TEST(ReferencedTest, CopyExactAttributesTest) {
+  ::istio::mixer::v1::ReferencedAttributes pb;
+  ASSERT_TRUE(TextFormat::ParseFromString(kReferencedText, &pb));
+
+  Attributes attributes;
+  utils::AttributesBuilder builder(&attributes);
+  builder.AddString("string-key", "this is a string value");
+  builder.AddBytes("bytes-key", "this is a bytes value");
+  builder.AddDouble("double-key", 99.9);
+  builder.AddInt64("int-key", 35);
+  builder.AddBool("bool-key", true);
+  std::chrono::time_point<std::chrono::system_clock> time0;
+  builder.AddTimestamp("time-key", time0);
+  builder.AddDuration("duration-key", std::chrono::nanoseconds(5));
+  builder.AddString("other-key", "not referenced");
+  std::map<std::string, std::string> string_map = {{"If-Match", "value1"},
+                                                   {"key2", "value2"}};
+  builder.AddStringMap("string-map-key", std::move(string_map));
+
+  Referenced referenced;
+  EXPECT_TRUE(referenced.Fill(attributes, pb));
+
+  Attributes copied;
+  referenced.CopyExactAttributes(attributes, &copied);
+  const auto& copied_map = copied.attributes();
+  EXPECT_EQ(copied_map.size(), 8);
+  EXPECT_EQ(copied_map.at("string-key").string_value(),
+            "this is a string value");
+  EXPECT_EQ(copied_map.at("int-key").int64_value(), 35);
+  EXPECT_EQ(copied_map.count("other-key"), 0);
+
+  // Only the referenced map key is copied.
+  const auto& entries = copied_map.at("string-map-key").string_map_value();
+  EXPECT_EQ(entries.entries().size(), 1);
+  EXPECT_EQ(entries.entries().at("If-Match"), "value1");
+
+  // The copied attributes have the same signature.
+  utils::FastHash::Key signature;
+  utils::FastHash::Key copied_signature;
   EXPECT_TRUE(referenced.Signature(attributes, "extra", &signature));
+  EXPECT_TRUE(referenced.Signature(copied, "extra", &copied_signature));
+  EXPECT_EQ(signature, copied_signature);
+}
 
-  EXPECT_EQ(utils::MD5::DebugString(signature),
-            "751b028b2e2c230ef9c4e59ac556ca04");
+TEST(ReferencedTest, RegexSignatureTest) {
+  ::istio::mixer::v1::ReferencedAttributes pb;
+  ASSERT_TRUE(TextFormat::ParseFromString(kReferencedRegexText, &pb));
+
+  auto make_attributes = [](const std::string& path,
+                            const std::string& user_agent) {
+    Attributes attributes;
+    utils::AttributesBuilder builder(&attributes);
+    builder.AddString("request.path", path);
+    builder.AddStringMap("request.headers", {{"user-agent", user_agent},
+                                             {"x-request-id", path}});
+    return attributes;
+  };
+  Attributes attributes = make_attributes("/books/1", "chrome60");
+  Referenced referenced;
+  ASSERT_TRUE(referenced.Fill(attributes, pb));
+  EXPECT_EQ(referenced.DebugString(),
+            "Absence-keys: Exact-keys: Regex-keys: "
+            "request.headers[user-agent]~chrome, "
+            "request.path~^/books/[0-9]+$, ");
+  std::set<std::string> names;
+  referenced.GetNames(&names);
+  EXPECT_EQ(names, std::set<std::string>({"request.headers", "request.path"}));
+
+  // Only the match outcomes are in the signature.
+  utils::FastHash::Key signature;
+  utils::FastHash::Key other;
+  ASSERT_TRUE(referenced.Signature(attributes, "", &signature));
+  ASSERT_TRUE(referenced.Signature(make_attributes("/books/2", "chrome61"), "",
+                                   &other));
+  EXPECT_EQ(signature, other);
+  ASSERT_TRUE(referenced.Signature(make_attributes("/books", "chrome61"), "",
+                                   &other));
+  EXPECT_NE(signature, other);
+  ASSERT_TRUE(referenced.Signature(make_attributes("/books/2", "firefox"), "",
+                                   &other));
+  EXPECT_NE(signature, other);
+  // An absent attribute is not the same as a non matching one.
+  utils::FastHash::Key absent;
+  Attributes no_path;
+  utils::AttributesBuilder(&no_path).AddStringMap("request.headers",
+                                                  {{"user-agent", "firefox"}});
+  ASSERT_TRUE(referenced.Signature(no_path, "", &absent));
+  EXPECT_NE(absent, other);
+
+  // The regex attributes are copied with their referenced map keys.
+  Attributes copied;
+  referenced.CopyExactAttributes(attributes, &copied);
+  EXPECT_EQ(copied.attributes().size(), 2);
+  EXPECT_EQ(copied.attributes()
+                .at("request.headers")
+                .string_map_value()
+                .entries()
+                .size(),
+            1);
+  ASSERT_TRUE(referenced.Signature(copied, "", &other));
+  EXPECT_EQ(signature, other);
+
+  // The shape is identified by its patterns.
+  Referenced same;
+  ASSERT_TRUE(same.Fill(attributes, pb));
+  EXPECT_EQ(referenced.Hash(), same.Hash());
+  pb.mutable_attribute_matches(0)->set_regex("^/books");
+  Referenced different;
+  ASSERT_TRUE(different.Fill(attributes, pb));
+  EXPECT_NE(referenced.Hash(), different.Hash());
+}
+
+TEST(ReferencedTest, RegexFillFailTest) {
+  ::istio::mixer::v1::ReferencedAttributes pb;
+  ASSERT_TRUE(TextFormat::ParseFromString(kReferencedRegexFailText, &pb));
+  Attributes attributes;
+  Referenced referenced;
+  EXPECT_FALSE(referenced.Fill(attributes, pb));
 }
 
 }  // namespace
@@ -14,83 +14,817 @@
  */
 
 #include "src/istio/mixerclient/report_batch.h"
+#include "include/istio/utils/alloc_accounting.h"
+#include "include/istio/utils/fast_hash.h"
 #include "include/istio/utils/protobuf.h"
+#include "include/istio/utils/tracepoint.h"
+#include "src/istio/mixerclient/snapshot_coder.h"
+
+#include <stdio.h>
+#include <unistd.h>
+#include <fstream>
+#include <iterator>
+
+#include <algorithm>
 
 using ::google::protobuf::util::Status;
 using ::google::protobuf::util::error::Code;
 using ::istio::mixer::v1::Attributes;
+using ::istio::mixer::v1::Attributes_AttributeValue;
 using ::istio::mixer::v1::ReportRequest;
 using ::istio::mixer::v1::ReportResponse;
 
 namespace istio {
 namespace mixerclient {
+namespace {
+
+// The weight of a new sample in the moving averages of the adaptive
+// batching.
+const double kAdaptiveSampleWeight = 0.2;
+
+// Returns the moving average updated with a sample, the sample itself for
+// the first one.
+double MovingAverage(double average, double sample) {
+  return average == 0 ? sample
+                      : average + kAdaptiveSampleWeight * (sample - average);
+}
+
+// Returns a hash of the attribute names, independent of their order.
+uint64_t Shape(const Attributes& attributes) {
+  uint64_t shape = 0;
+  for (const auto& it : attributes.attributes()) {
+    shape += utils::FastHash()(it.first.data(), it.first.size()).low;
+  }
+  return shape;
+}
+
+// Writes data to a file opened with mode, returns false on failure.
+bool WriteFile(const std::string& name, const std::string& data,
+               const char* mode) {
+  FILE* file = fopen(name.c_str(), mode);
+  if (file == nullptr) {
+    return false;
+  }
+  bool written = fwrite(data.data(), 1, data.size(), file) == data.size();
+  return fclose(file) == 0 && written;
+}
+
+}  // namespace
 
 ReportBatch::ReportBatch(const ReportOptions& options,
                          TransportReportFunc transport,
                          TimerCreateFunc timer_create,
-                         AttributeCompressor& compressor)
+                         AttributeCompressor& compressor,
+                         StatsSink* stats_sink,
+                         ThreadingModel threading_model)
     : options_(options),
+      alive_(std::make_shared<bool>(true)),
       transport_(transport),
+      next_channel_(0),
       timer_create_(timer_create),
       compressor_(compressor),
+      stats_sink_(stats_sink),
+      batch_entries_(options.max_batch_entries),
+      batch_time_ms_(options.max_batch_time_ms),
+      report_rate_(0),
+      report_bytes_(0),
+      latency_us_(0),
+      adapt_time_(std::chrono::steady_clock::now()),
       total_report_calls_(0),
-      total_remote_report_calls_(0) {}
+      total_remote_report_calls_(0),
+      folded_count_(0),
+      overflow_reports_(0),
+      buffered_bytes_(0),
+      inflight_batches_(0),
+      total_dropped_report_calls_(0),
+      shutting_down_(false),
+      shutdown_finished_(false),
+      next_sequence_(0),
+      spill_loaded_(false),
+      spill_drain_scheduled_(false),
+      spill_backoff_ms_(0),
+      total_spilled_report_batches_(0),
+      overloaded_(false),
+      overload_reports_(0),
+      total_overload_dropped_report_calls_(0) {
+  mutex_.set_enabled(threading_model == ThreadingModel::SHARED);
+  queue_mutex_.set_enabled(threading_model == ThreadingModel::SHARED);
+  for (auto& total : total_finished_batches_) {
+    total = 0;
+  }
+  if (options_.target_report_calls_per_second > 0) {
+    UpdateBatchLimitsWithLock();
+  }
+  if (!options_.spill_ring_file.empty() && timer_create_) {
+    spill_ring_ = ReportSpillRing::Open(options_.spill_ring_file,
+                                        options_.spill_ring_bytes);
+  }
+  if (!options_.spill_file.empty()) {
+    // Sent by the first flush.
+    spill_loaded_ = LoadSpillWithLock();
+  }
+}
+
+ReportBatch::~ReportBatch() {
+  bool spill;
+  {
+    std::lock_guard<Mutex> lock(mutex_);
+    spill = shutting_down_;
+  }
+  // Not to send through a transport which may be torn down already.
+  if (spill) {
+    FinishShutdown();
+  }
+  Flush();
+  SendHeld(true);
+  alive_.reset();
+}
+
+void ReportBatch::AddChannels(
+    const std::vector<TransportReportFunc>& transports) {
+  std::lock_guard<Mutex> lock(mutex_);
+  if (channels_.empty()) {
+    channels_.push_back({transport_, 0, {}});
+  }
+  for (const auto& transport : transports) {
+    channels_.push_back({transport, 0, {}});
+  }
+}
+
+int ReportBatch::PickChannelWithLock() {
+  if (channels_.empty()) {
+    return -1;
+  }
+  auto now = std::chrono::steady_clock::now();
+  // The first one not backing off, or the one whose back-off ends first.
+  size_t picked = next_channel_;
+  for (size_t i = 0; i < channels_.size(); ++i) {
+    size_t channel = (next_channel_ + i) % channels_.size();
+    if (channels_[channel].retry_time <= now) {
+      picked = channel;
+      break;
+    }
+    if (channels_[channel].retry_time < channels_[picked].retry_time) {
+      picked = channel;
+    }
+  }
+  next_channel_ = (picked + 1) % channels_.size();
+  return picked;
+}
 
-ReportBatch::~ReportBatch() { Flush(); }
+void ReportBatch::UpdateChannelWithLock(int channel, bool ok) {
+  Channel& it = channels_[channel];
+  if (ok) {
+    it.backoff_ms = 0;
+    it.retry_time = {};
+    return;
+  }
+  it.backoff_ms = it.backoff_ms == 0
+                      ? options_.channel_initial_backoff_ms
+                      : std::min(it.backoff_ms * 2,
+                                 options_.channel_max_backoff_ms);
+  it.retry_time = std::chrono::steady_clock::now() +
+                  std::chrono::milliseconds(it.backoff_ms);
+}
+
+void ReportBatch::SpillWithLock(const ReportRequest& request) {
+  if (spill_ring_->Push(request.SerializeAsString()) < 0) {
+    GOOGLE_LOG(ERROR) << "A report batch of " << request.ByteSize()
+                      << " bytes doesn't fit in the spill ring "
+                      << spill_ring_->file();
+    return;
+  }
+  IncrementCounter(StatsCounter::SPILLED_REPORT_BATCHES,
+                   &total_spilled_report_batches_);
+  ScheduleSpillDrainWithLock();
+}
+
+void ReportBatch::UpdateSpillWithLock(bool ok) {
+  if (ok) {
+    spill_backoff_ms_ = 0;
+    spill_until_ = {};
+    ScheduleSpillDrainWithLock();
+    return;
+  }
+  spill_backoff_ms_ = spill_backoff_ms_ == 0
+                          ? options_.channel_initial_backoff_ms
+                          : std::min(spill_backoff_ms_ * 2,
+                                     options_.channel_max_backoff_ms);
+  spill_until_ = std::chrono::steady_clock::now() +
+                 std::chrono::milliseconds(spill_backoff_ms_);
+}
+
+void ReportBatch::ScheduleSpillDrainWithLock() {
+  if (spill_drain_scheduled_ || spill_ring_->empty() || shutting_down_) {
+    return;
+  }
+  if (!spill_timer_) {
+    spill_timer_ = timer_create_([this]() { DrainSpill(); });
+  }
+  int delay_ms = 1000 / std::max(1, options_.spill_drain_batches_per_second);
+  auto backoff = std::chrono::duration_cast<std::chrono::milliseconds>(
+      spill_until_ - std::chrono::steady_clock::now());
+  delay_ms = std::max<int>(delay_ms, backoff.count());
+  spill_drain_scheduled_ = true;
+  spill_timer_->Start(delay_ms);
+}
+
+void ReportBatch::DrainSpill() {
+  {
+    std::lock_guard<Mutex> lock(mutex_);
+    spill_drain_scheduled_ = false;
+    // Retried later while Mixer fails or is slow.
+    if (std::chrono::steady_clock::now() < spill_until_ ||
+        WindowFullWithLock()) {
+      ScheduleSpillDrainWithLock();
+      return;
+    }
+    std::string data;
+    while (spill_ring_->Pop(&data)) {
+      std::unique_ptr<ReportRequest> request(new ReportRequest);
+      if (request->ParseFromString(data)) {
+        held_.push_front({std::move(request), int64_t(data.size())});
+        buffered_bytes_ += data.size();
+        break;
+      }
+    }
+    ScheduleSpillDrainWithLock();
+  }
+  SendHeld(false);
+}
+
+void ReportBatch::BeginShutdown(int deadline_ms) {
+  {
+    std::lock_guard<Mutex> lock(mutex_);
+    if (shutting_down_) {
+      return;
+    }
+    shutting_down_ = true;
+  }
+  if (deadline_ms > 0 && timer_create_ && !options_.spill_file.empty()) {
+    std::weak_ptr<bool> alive = alive_;
+    shutdown_timer_ = timer_create_([this, alive]() {
+      if (!alive.expired()) {
+        FinishShutdown();
+      }
+    });
+    shutdown_timer_->Start(deadline_ms);
+  }
+  Flush();
+}
+
+void ReportBatch::FinishShutdown() {
+  if (options_.spill_file.empty()) {
+    return;
+  }
+  if (options_.pipeline_queue_size > 0) {
+    Drain();
+  }
+  std::string data;
+  size_t num_batches = 0;
+  {
+    std::lock_guard<Mutex> lock(mutex_);
+    if (shutdown_finished_) {
+      return;
+    }
+    shutdown_finished_ = true;
+    AddFoldedWithLock();
+    FinishAllWithLock(TIMED);
+    SnapshotWriter writer(&data);
+    for (const auto& batch : held_) {
+      writer.WriteString(batch.request->SerializeAsString());
+      buffered_bytes_ -= batch.bytes;
+    }
+    num_batches = held_.size();
+    held_.clear();
+    // The ones in flight may still be received by Mixer, they are sent
+    // again at the risk of a duplicate rather than lost.
+    for (const auto& it : unacknowledged_) {
+      writer.WriteString(it.second.request->SerializeAsString());
+    }
+    num_batches += unacknowledged_.size();
+  }
+  if (num_batches == 0) {
+    return;
+  }
+  // Written to a temporary file first, and linked to the spill file once
+  // complete, so that a client claiming it never reads a partial file. If
+  // a spill file is still not claimed, the batches are appended to it.
+  std::string temp_file = options_.spill_file + ".tmp";
+  if (!WriteFile(temp_file, data, "wb") ||
+      (link(temp_file.c_str(), options_.spill_file.c_str()) != 0 &&
+       !WriteFile(options_.spill_file, data, "ab"))) {
+    GOOGLE_LOG(ERROR) << "Failed to save " << num_batches
+                      << " report batches to " << options_.spill_file;
+  }
+  remove(temp_file.c_str());
+}
+
+bool ReportBatch::LoadSpillWithLock() {
+  // Renamed first, so that the batches are only sent once.
+  std::string claimed = options_.spill_file + ".loading";
+  if (rename(options_.spill_file.c_str(), claimed.c_str()) != 0) {
+    return false;
+  }
+  std::string data;
+  {
+    std::ifstream in(claimed, std::ios::binary);
+    data.assign(std::istreambuf_iterator<char>(in),
+                std::istreambuf_iterator<char>());
+  }
+  remove(claimed.c_str());
+
+  SnapshotReader reader(data);
+  std::string record;
+  // A truncated last record is skipped.
+  while (reader.ReadString(&record)) {
+    std::unique_ptr<ReportRequest> request(new ReportRequest);
+    if (request->ParseFromString(record)) {
+      int64_t bytes = record.size();
+      held_.push_back({std::move(request), bytes});
+      buffered_bytes_ += bytes;
+    }
+  }
+  return true;
+}
 
 void ReportBatch::Report(const Attributes& request) {
-  std::lock_guard<std::mutex> lock(mutex_);
-  ++total_report_calls_;
-  if (!batch_compressor_) {
-    batch_compressor_ = compressor_.CreateBatchCompressor();
+  utils::ScopedAllocTag alloc_tag(utils::AllocTag::MIXER_REPORT);
+  if (options_.pipeline_queue_size > 0) {
+    Report(Attributes(request));
+    return;
+  }
+  if (DropOverloaded()) {
+    return;
   }
 
-  if (!batch_compressor_->Add(request)) {
-    FlushWithLock();
+  {
+    std::lock_guard<Mutex> lock(mutex_);
+    IncrementCounter(StatsCounter::REPORT_CALLS, &total_report_calls_);
+    ReportWithLock(request);
+    FinishShutdownBatchesWithLock();
+  }
+  SendHeld(false);
+}
 
-    batch_compressor_ = compressor_.CreateBatchCompressor();
-    batch_compressor_->Add(request);
+void ReportBatch::Report(Attributes&& request) {
+  utils::ScopedAllocTag alloc_tag(utils::AllocTag::MIXER_REPORT);
+  if (options_.pipeline_queue_size <= 0) {
+    Report(static_cast<const Attributes&>(request));
+    return;
+  }
+  if (DropOverloaded()) {
+    return;
   }
 
-  if (batch_compressor_->size() >= options_.max_batch_entries) {
-    FlushWithLock();
+  bool drain_now = false;
+  {
+    std::lock_guard<Mutex> lock(queue_mutex_);
+    IncrementCounter(StatsCounter::REPORT_CALLS, &total_report_calls_);
+    queue_.emplace_back();
+    queue_.back().Swap(&request);
+    if (static_cast<int>(queue_.size()) >= options_.pipeline_queue_size ||
+        !timer_create_) {
+      drain_now = true;
+    } else if (queue_.size() == 1) {
+      if (!drain_timer_) {
+        drain_timer_ = timer_create_([this]() { Drain(); });
+      }
+      drain_timer_->Start(0);
+    }
+  }
+  if (drain_now) {
+    Drain();
+  }
+}
+
+void ReportBatch::Drain() {
+  {
+    std::lock_guard<Mutex> lock(mutex_);
+    {
+      std::lock_guard<Mutex> queue_lock(queue_mutex_);
+      draining_.swap(queue_);
+    }
+    for (const auto& request : draining_) {
+      ReportWithLock(request);
+    }
+    draining_.clear();
+    FinishShutdownBatchesWithLock();
+  }
+  SendHeld(false);
+}
+
+bool ReportBatch::WindowFullWithLock() const {
+  return !shutting_down_ && options_.max_inflight_batches > 0 &&
+         inflight_batches_ >= options_.max_inflight_batches;
+}
+
+void ReportBatch::ReportWithLock(const Attributes& request) {
+  if (options_.aggregation_keys.empty()) {
+    AddWithLock(request);
+    return;
+  }
+
+  FoldWithLock(request);
+  if (options_.full_report_sample_rate > 0 &&
+      folded_count_ % options_.full_report_sample_rate == 0) {
+    AddWithLock(request);
+  }
+  // Bound the folded reports by the batch size.
+  if (static_cast<int>(folded_.size()) >= batch_entries_) {
+    AddFoldedWithLock();
+  }
+}
+
+void ReportBatch::FoldWithLock(const Attributes& request) {
+  const auto& attributes = request.attributes();
+  std::string key;
+  for (const std::string& name : options_.aggregation_keys) {
+    const auto it = attributes.find(name);
+    if (it != attributes.end()) {
+      key += it->second.SerializeAsString();
+    }
+    // Separate the values, an absent one is empty.
+    key.push_back('\0');
+  }
+
+  ++folded_count_;
+  auto it = folded_.find(key);
+  if (it == folded_.end()) {
+    Attributes& folded = folded_[key];
+    auto* folded_attributes = folded.mutable_attributes();
+    for (const std::string& name : options_.aggregation_keys) {
+      const auto value_it = attributes.find(name);
+      if (value_it != attributes.end()) {
+        (*folded_attributes)[name] = value_it->second;
+      }
+    }
+    for (const std::string& name : options_.aggregation_sums) {
+      const auto value_it = attributes.find(name);
+      if (value_it != attributes.end()) {
+        (*folded_attributes)[name] = value_it->second;
+      }
+    }
+    if (!options_.aggregation_count_attribute.empty()) {
+      (*folded_attributes)[options_.aggregation_count_attribute]
+          .set_int64_value(1);
+    }
+    if (folded_.size() == 1 && open_batches_.empty() && timer_create_) {
+      if (!timer_) {
+        timer_ = timer_create_([this]() { Flush(); });
+      }
+      timer_->Start(batch_time_ms_);
+    }
+    return;
+  }
+
+  auto* folded_attributes = it->second.mutable_attributes();
+  for (const std::string& name : options_.aggregation_sums) {
+    const auto value_it = attributes.find(name);
+    if (value_it == attributes.end()) {
+      continue;
+    }
+    const Attributes_AttributeValue& value = value_it->second;
+    Attributes_AttributeValue& sum = (*folded_attributes)[name];
+    if (value.value_case() == Attributes_AttributeValue::kInt64Value &&
+        sum.value_case() != Attributes_AttributeValue::kDurationValue) {
+      sum.set_int64_value(sum.int64_value() + value.int64_value());
+    } else if (value.value_case() ==
+                   Attributes_AttributeValue::kDurationValue &&
+               sum.value_case() != Attributes_AttributeValue::kInt64Value) {
+      auto* duration = sum.mutable_duration_value();
+      int64_t nanos = static_cast<int64_t>(duration->nanos()) +
+                      value.duration_value().nanos();
+      duration->set_seconds(duration->seconds() +
+                            value.duration_value().seconds() +
+                            nanos / 1000000000);
+      duration->set_nanos(nanos % 1000000000);
+    }
+  }
+  if (!options_.aggregation_count_attribute.empty()) {
+    Attributes_AttributeValue& count =
+        (*folded_attributes)[options_.aggregation_count_attribute];
+    count.set_int64_value(count.int64_value() + 1);
+  }
+}
+
+void ReportBatch::AddFoldedWithLock() {
+  std::unordered_map<std::string, Attributes> folded;
+  folded.swap(folded_);
+  for (const auto& it : folded) {
+    AddWithLock(it.second);
+  }
+}
+
+void ReportBatch::AddWithLock(const Attributes& request) {
+  if (WindowFullWithLock() || !held_.empty()) {
+    // Mixer is slow, merge the reports into a bigger batch, sample them,
+    // or drop them once the buffer is full. Or spill the oldest held
+    // batches to make room.
+    ++overflow_reports_;
+    while (spill_ring_ && options_.max_buffered_bytes > 0 &&
+           buffered_bytes_ >= options_.max_buffered_bytes && !held_.empty()) {
+      SpillWithLock(*held_.front().request);
+      buffered_bytes_ -= held_.front().bytes;
+      held_.pop_front();
+    }
+    if ((options_.max_buffered_bytes > 0 &&
+         buffered_bytes_ >= options_.max_buffered_bytes) ||
+        (options_.overflow_sample_rate > 1 &&
+         overflow_reports_ % options_.overflow_sample_rate != 0)) {
+      IncrementCounter(StatsCounter::DROPPED_REPORT_CALLS,
+                       &total_dropped_report_calls_);
+      return;
+    }
+  }
+
+  int64_t bytes = request.ByteSize();
+  // With several open batches, a report is added to the batch of the
+  // reports with the same attribute names, which always delta encode.
+  uint64_t shape = options_.max_open_batches > 1 ? Shape(request) : 0;
+  size_t index = 0;
+  while (index < open_batches_.size() && open_batches_[index].shape != shape) {
+    ++index;
+  }
+  if (index < open_batches_.size() &&
+      !open_batches_[index].compressor->Add(request)) {
+    FinishWithLock(index, DELTA_BREAK);
+    index = open_batches_.size();
+  }
+  if (index == open_batches_.size()) {
+    if (static_cast<int>(open_batches_.size()) >=
+        std::max(1, options_.max_open_batches)) {
+      FinishWithLock(0, EVICTED);
+    }
+    compressor_.MaybeRestoreGlobalDictionary();
+    open_batches_.push_back({compressor_.CreateBatchCompressor(), 0, shape});
+    open_batches_.back().compressor->Add(request);
+    index = open_batches_.size() - 1;
+  }
+  OpenBatch& batch = open_batches_[index];
+  batch.bytes += bytes;
+  buffered_bytes_ += bytes;
+
+  if (options_.max_batch_bytes > 0 &&
+      batch.compressor->byte_size() >= options_.max_batch_bytes) {
+    FinishWithLock(index, FULL_BYTES);
+  } else if (batch.compressor->size() >= batch_entries_) {
+    // Keep merging into the batch while the in-flight window is full.
+    if (!WindowFullWithLock()) {
+      FinishWithLock(index, FULL_ENTRIES);
+    }
   } else {
-    if (batch_compressor_->size() == 1 && timer_create_) {
+    if (batch.compressor->size() == 1 && open_batches_.size() == 1 &&
+        timer_create_) {
       if (!timer_) {
         timer_ = timer_create_([this]() { Flush(); });
       }
-      timer_->Start(options_.max_batch_time_ms);
+      timer_->Start(batch_time_ms_);
     }
   }
 }
 
-void ReportBatch::FlushWithLock() {
-  if (!batch_compressor_) {
+void ReportBatch::FinishWithLock(size_t index, FinishReason reason) {
+  static const StatsCounter kCounters[kNumFinishReasons] = {
+      StatsCounter::REPORT_BATCHES_FULL_ENTRIES,
+      StatsCounter::REPORT_BATCHES_FULL_BYTES,
+      StatsCounter::REPORT_BATCHES_TIMED,
+      StatsCounter::REPORT_BATCHES_DELTA_BREAK,
+      StatsCounter::REPORT_BATCHES_EVICTED,
+  };
+  IncrementCounter(kCounters[reason], &total_finished_batches_[reason]);
+  OpenBatch& batch = open_batches_[index];
+  if (options_.target_report_calls_per_second > 0) {
+    AdaptWithLock(batch);
+  }
+  held_.push_back({batch.compressor->Finish(), batch.bytes});
+  open_batches_.erase(open_batches_.begin() + index);
+  if (open_batches_.empty() && folded_.empty() && timer_) {
+    timer_->Stop();
+  }
+}
+
+void ReportBatch::AdaptWithLock(const OpenBatch& batch) {
+  int size = batch.compressor->size();
+  if (size == 0) {
     return;
   }
+  auto now = std::chrono::steady_clock::now();
+  // At least a millisecond, not to overestimate the rate of the batches
+  // finished together.
+  int64_t elapsed_us = std::max<int64_t>(
+      1000,
+      std::chrono::duration_cast<std::chrono::microseconds>(now - adapt_time_)
+          .count());
+  adapt_time_ = now;
+  report_rate_ = MovingAverage(report_rate_, size * 1e6 / elapsed_us);
+  report_bytes_ = MovingAverage(
+      report_bytes_, static_cast<double>(batch.compressor->byte_size()) / size);
+  UpdateBatchLimitsWithLock();
+}
 
-  ++total_remote_report_calls_;
-  std::unique_ptr<ReportRequest> request = batch_compressor_->Finish();
-  batch_compressor_.reset();
-  if (timer_) {
-    timer_->Stop();
+void ReportBatch::AdaptLatencyWithLock(int64_t latency_us) {
+  latency_us_ = MovingAverage(latency_us_, latency_us);
+  UpdateBatchLimitsWithLock();
+}
+
+void ReportBatch::UpdateBatchLimitsWithLock() {
+  double rate = options_.target_report_calls_per_second;
+  // A slow transport would keep more calls in flight than the target
+  // rate needs, the window is widened to its latency.
+  double time_ms = std::max(1000 / rate, latency_us_ / 1000);
+  batch_time_ms_ = std::max(
+      options_.min_batch_time_ms,
+      static_cast<int>(std::min<double>(options_.max_batch_time_ms, time_ms)));
+
+  double entries = report_rate_ * batch_time_ms_ / 1000;
+  if (options_.target_batch_bytes > 0 && report_bytes_ > 0) {
+    entries = std::min(entries, options_.target_batch_bytes / report_bytes_);
+  }
+  entries = std::min<double>(options_.max_batch_entries, entries);
+  batch_entries_ = std::max(1, static_cast<int>(entries));
+  if (report_rate_ == 0) {
+    // Nothing observed yet.
+    batch_entries_ = options_.max_batch_entries;
   }
+}
 
-  ReportResponse* response = new ReportResponse;
-  transport_(*request, response, [this, response](const Status& status) {
-    delete response;
-    if (!status.ok()) {
-      GOOGLE_LOG(ERROR) << "Mixer Report failed with: " << status.ToString();
-      if (utils::InvalidDictionaryStatus(status)) {
-        compressor_.ShrinkGlobalDictionary();
+void ReportBatch::FinishAllWithLock(FinishReason reason) {
+  while (!open_batches_.empty()) {
+    FinishWithLock(0, reason);
+  }
+}
+
+void ReportBatch::FinishShutdownBatchesWithLock() {
+  if (shutting_down_) {
+    AddFoldedWithLock();
+    FinishAllWithLock(TIMED);
+  }
+}
+
+void ReportBatch::SendHeld(bool ignore_window) {
+  while (true) {
+    HeldBatch batch;
+    const ReportRequest* request;
+    int64_t bytes;
+    uint64_t sequence = 0;
+    int channel;
+    {
+      std::lock_guard<Mutex> lock(mutex_);
+      if (!ignore_window && WindowFullWithLock()) {
+        return;
+      }
+      // The batches merged while the window was full can be sent now.
+      if (held_.empty()) {
+        for (size_t i = 0; i < open_batches_.size();) {
+          if (open_batches_[i].compressor->size() >= batch_entries_) {
+            FinishWithLock(i, FULL_ENTRIES);
+          } else {
+            ++i;
+          }
+        }
+      }
+      if (held_.empty()) {
+        return;
+      }
+      batch = std::move(held_.front());
+      held_.pop_front();
+      buffered_bytes_ -= batch.bytes;
+      // Not to call a failing Mixer again before the back-off ends.
+      if (spill_ring_ && std::chrono::steady_clock::now() < spill_until_) {
+        SpillWithLock(*batch.request);
+        continue;
+      }
+      ++inflight_batches_;
+      request = batch.request.get();
+      bytes = batch.bytes;
+      channel = PickChannelWithLock();
+      // Kept until acknowledged, to be saved by a shutdown or spilled.
+      if (!options_.spill_file.empty() || spill_ring_) {
+        sequence = ++next_sequence_;
+        unacknowledged_[sequence] = std::move(batch);
       }
     }
-  });
+
+    IncrementCounter(StatsCounter::REMOTE_REPORT_CALLS,
+                     &total_remote_report_calls_);
+    ISTIO_TRACEPOINT2(report_batch_flush, request->attributes_size(), bytes);
+    ReportResponse* response = new ReportResponse;
+    const TransportReportFunc& transport =
+        channel < 0 ? transport_ : channels_[channel].transport;
+    bool adaptive = options_.target_report_calls_per_second > 0;
+    auto start = adaptive ? std::chrono::steady_clock::now()
+                          : std::chrono::steady_clock::time_point();
+    std::weak_ptr<bool> alive = alive_;
+    transport(*request, response,
+              [this, alive, response, sequence, channel, adaptive,
+               start](const Status& status) {
+                delete response;
+                if (alive.expired()) {
+                  return;
+                }
+                if (!status.ok()) {
+                  GOOGLE_LOG(ERROR) << "Mixer Report failed with: "
+                                    << status.ToString();
+                  if (utils::InvalidDictionaryStatus(status)) {
+                    compressor_.ShrinkGlobalDictionary();
+                  }
+                }
+                if (sequence > 0 || channel >= 0 || adaptive ||
+                    !options_.spill_ring_file.empty()) {
+                  std::lock_guard<Mutex> lock(mutex_);
+                  if (adaptive && status.ok()) {
+                    AdaptLatencyWithLock(
+                        std::chrono::duration_cast<std::chrono::microseconds>(
+                            std::chrono::steady_clock::now() - start)
+                            .count());
+                  }
+                  if (channel >= 0) {
+                    UpdateChannelWithLock(channel, status.ok());
+                  }
+                  // A failed batch is saved to the spill file if shutting
+                  // down, or else spilled to the ring. Mixer rejects the
+                  // words of an invalid dictionary again.
+                  bool failed = !status.ok() &&
+                                !utils::InvalidDictionaryStatus(status);
+                  auto it = unacknowledged_.find(sequence);
+                  if (it != unacknowledged_.end() &&
+                      (status.ok() || !shutting_down_ ||
+                       options_.spill_file.empty())) {
+                    if (failed && spill_ring_) {
+                      SpillWithLock(*it->second.request);
+                    }
+                    unacknowledged_.erase(it);
+                  }
+                  if (spill_ring_) {
+                    UpdateSpillWithLock(!failed);
+                  }
+                }
+                --inflight_batches_;
+                SendHeld(false);
+              });
+  }
 }
 
 void ReportBatch::Flush() {
-  std::lock_guard<std::mutex> lock(mutex_);
-  FlushWithLock();
+  if (options_.pipeline_queue_size > 0) {
+    Drain();
+  }
+  if (!options_.spill_ring_file.empty() && timer_create_) {
+    // The ring may be locked by the old process of a hot restart until it
+    // exits. Its batches are sent once it is opened.
+    std::lock_guard<Mutex> lock(mutex_);
+    if (!spill_ring_ && !shutting_down_) {
+      spill_ring_ = ReportSpillRing::Open(options_.spill_ring_file,
+                                          options_.spill_ring_bytes);
+    }
+    if (spill_ring_) {
+      ScheduleSpillDrainWithLock();
+    }
+  }
+  if (!options_.spill_file.empty()) {
+    // A hot restart saves the batches of the old process once the clients
+    // of the new one already run.
+    std::lock_guard<Mutex> lock(mutex_);
+    if (!spill_loaded_ && !shutting_down_) {
+      spill_loaded_ = LoadSpillWithLock();
+    }
+  }
+
+  {
+    std::lock_guard<Mutex> lock(mutex_);
+    AddFoldedWithLock();
+    FinishAllWithLock(TIMED);
+  }
+  SendHeld(false);
+}
+
+void ReportBatch::GetOpenBatches(uint64_t* batches, uint64_t* entries) {
+  std::lock_guard<Mutex> lock(mutex_);
+  *batches = open_batches_.size();
+  *entries = 0;
+  for (const auto& batch : open_batches_) {
+    *entries += batch.compressor->size();
+  }
+}
+
+void ReportBatch::IncrementCounter(StatsCounter counter,
+                                   std::atomic_int_fast64_t* total) {
+  ++*total;
+  if (stats_sink_) {
+    stats_sink_->AddCounter(counter, 1);
+  }
+}
+
+bool ReportBatch::DropOverloaded() {
+  if (!overloaded_ || options_.overload_sample_rate <= 1 ||
+      ++overload_reports_ % options_.overload_sample_rate == 0) {
+    return false;
+  }
+  IncrementCounter(StatsCounter::REPORT_CALLS, &total_report_calls_);
+  IncrementCounter(StatsCounter::OVERLOAD_DROPPED_REPORT_CALLS,
+                   &total_overload_dropped_report_calls_);
+  return true;
 }
 
 }  // namespace mixerclient
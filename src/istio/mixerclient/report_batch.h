@@ -17,60 +17,318 @@
 #define ISTIO_MIXERCLIENT_REPORT_BATCH_H
 
 #include "include/istio/mixerclient/client.h"
+#include "include/istio/utils/optional_mutex.h"
 #include "src/istio/mixerclient/attribute_compressor.h"
+#include "src/istio/mixerclient/report_spill_ring.h"
 
 #include <atomic>
+#include <chrono>
+#include <deque>
+#include <memory>
 #include <mutex>
+#include <unordered_map>
+#include <vector>
 
 namespace istio {
 namespace mixerclient {
 
-// Report batch, this interface is thread safe.
+// Report batch, this interface is thread safe unless the batch is
+// THREAD_CONFINED.
 class ReportBatch {
  public:
+  // The counters are pushed to stats_sink, if not nullptr. It has to
+  // outlive the batch.
   ReportBatch(const ReportOptions& options, TransportReportFunc transport,
-              TimerCreateFunc timer_create, AttributeCompressor& compressor);
+              TimerCreateFunc timer_create, AttributeCompressor& compressor,
+              StatsSink* stats_sink = nullptr,
+              ThreadingModel threading_model = ThreadingModel::SHARED);
 
   virtual ~ReportBatch();
 
   // Make batched report call.
   void Report(const ::istio::mixer::v1::Attributes& request);
+  // Make batched report call, taking the content of the request.
+  void Report(::istio::mixer::v1::Attributes&& request);
 
   // Flush out batched reports.
   void Flush();
 
+  // Spreads the batches over transport and these, see
+  // ReportOptions::channel_max_backoff_ms. Called before any report.
+  void AddChannels(const std::vector<TransportReportFunc>& transports);
+
+  // Starts draining before a shutdown: the pending reports are sent now,
+  // and the next ones right away, ignoring the in-flight window. After
+  // deadline_ms, or at destruction, the batches not acknowledged yet are
+  // saved to ReportOptions::spill_file, if set.
+  void BeginShutdown(int deadline_ms);
+
+  // While overloaded, reports are sampled by
+  // ReportOptions::overload_sample_rate before they are batched.
+  void SetOverloaded(bool overloaded) { overloaded_ = overloaded; }
+
   uint64_t total_report_calls() const { return total_report_calls_; }
   uint64_t total_remote_report_calls() const {
     return total_remote_report_calls_;
   }
+  uint64_t total_dropped_report_calls() const {
+    return total_dropped_report_calls_;
+  }
+  uint64_t total_overload_dropped_report_calls() const {
+    return total_overload_dropped_report_calls_;
+  }
+  uint64_t total_spilled_report_batches() const {
+    return total_spilled_report_batches_;
+  }
+  uint64_t inflight_report_batches() const { return inflight_batches_; }
+
+  // The current batch entry cap and window, adapted to the load if
+  // ReportOptions::target_report_calls_per_second is set.
+  int batch_entries() const { return batch_entries_; }
+  int batch_time_ms() const { return batch_time_ms_; }
+  uint64_t buffered_report_bytes() const { return buffered_bytes_; }
+
+  // The reasons a batch is finished.
+  enum FinishReason {
+    FULL_ENTRIES = 0,
+    FULL_BYTES,
+    TIMED,
+    DELTA_BREAK,
+    EVICTED,
+  };
+
+  // Returns the total number of batches finished for a reason.
+  uint64_t total_finished_batches(FinishReason reason) const {
+    return total_finished_batches_[reason];
+  }
+
+  // Gets the number of open batches and of the reports in them.
+  void GetOpenBatches(uint64_t* batches, uint64_t* entries);
 
  private:
-  void FlushWithLock();
+  // The mutexes are disabled if the batch is THREAD_CONFINED.
+  using Mutex = utils::OptionalMutex<std::mutex>;
+
+  // A finished batch waiting for the in-flight window.
+  struct HeldBatch {
+    std::unique_ptr<::istio::mixer::v1::ReportRequest> request;
+    // The bytes of its reports counted in buffered_bytes_.
+    int64_t bytes;
+  };
+
+  // Returns true if max_inflight_batches remote calls are in flight.
+  bool WindowFullWithLock() const;
+
+  // An open batch.
+  struct OpenBatch {
+    std::unique_ptr<BatchCompressor> compressor;
+    // The bytes of its reports counted in buffered_bytes_.
+    int64_t bytes;
+    // The hash of the attribute names of its reports, if there are
+    // several open batches.
+    uint64_t shape;
+  };
+
+  // Folds a report if aggregation is enabled, or adds it to a batch.
+  void ReportWithLock(const ::istio::mixer::v1::Attributes& request);
+
+  // Folds a report into the folded report with the same key values.
+  void FoldWithLock(const ::istio::mixer::v1::Attributes& request);
+
+  // Adds the folded reports to the batches.
+  void AddFoldedWithLock();
+
+  // Adds a report to an open batch, or drops it if the buffer is full.
+  void AddWithLock(const ::istio::mixer::v1::Attributes& request);
+
+  // Moves an open batch to the held batches.
+  void FinishWithLock(size_t index, FinishReason reason);
+
+  // Updates the observed report rate and size from a finished batch, and
+  // adapts the batch entry cap and window to them.
+  void AdaptWithLock(const OpenBatch& batch);
+
+  // Updates the observed transport latency and adapts the batch window.
+  void AdaptLatencyWithLock(int64_t latency_us);
+
+  // Sets the batch entry cap and window from the observed load.
+  void UpdateBatchLimitsWithLock();
+
+  // Moves all open batches to the held batches.
+  void FinishAllWithLock(FinishReason reason);
+
+  // Sends out the held batches the in-flight window allows, or all of
+  // them if ignore_window is true. Called without any lock.
+  void SendHeld(bool ignore_window);
+
+  // Compresses the queued reports into the batch.
+  void Drain();
+
+  // Increments a total counter and pushes it to the stats sink, if any.
+  void IncrementCounter(StatsCounter counter,
+                        std::atomic_int_fast64_t* total);
+
+  // Returns true if a report is sampled out while overloaded, it is
+  // counted as a report call.
+  bool DropOverloaded();
+
+  // Sends the reports added while shutting down without batching them.
+  void FinishShutdownBatchesWithLock();
+
+  // Saves the batches not acknowledged yet to the spill file, once.
+  void FinishShutdown();
+
+  // Holds the batches saved to the spill file by the client of the same
+  // name of another process, e.g. the one being drained by a hot restart.
+  // The file is claimed by renaming it. Returns true once a file is
+  // claimed, after that it is not looked up again.
+  bool LoadSpillWithLock();
+
+  // Returns the channel of the next batch, -1 if there are no channels.
+  int PickChannelWithLock();
+
+  // Resets or extends the back-off of a channel after a call.
+  void UpdateChannelWithLock(int channel, bool ok);
+
+  // Appends a batch to the spill ring, and schedules its drain.
+  void SpillWithLock(const ::istio::mixer::v1::ReportRequest& request);
+
+  // Resets or extends the back-off of the spilling after a call.
+  void UpdateSpillWithLock(bool ok);
+
+  // Starts the timer to send a spilled batch, if any, at the drain rate
+  // and after the back-off.
+  void ScheduleSpillDrainWithLock();
+
+  // Moves the oldest spilled batch to the held ones, and sends it.
+  void DrainSpill();
 
   // The quota options.
   ReportOptions options_;
 
+  // Released at the end of the destructor. The done functions of the
+  // remote calls only see a weak pointer, a call done after that just
+  // frees its response.
+  std::shared_ptr<bool> alive_;
+
   // The quota transport
   TransportReportFunc transport_;
 
+  // The report channels, empty if all batches go to transport_. Guarded
+  // by mutex_.
+  struct Channel {
+    TransportReportFunc transport;
+    // 0 if the last call succeeded.
+    int backoff_ms;
+    // The channel is skipped until then.
+    std::chrono::steady_clock::time_point retry_time;
+  };
+  std::vector<Channel> channels_;
+  // The channel tried first for the next batch.
+  size_t next_channel_;
+
   // timer create func
   TimerCreateFunc timer_create_;
 
   // Attribute compressor.
   AttributeCompressor& compressor_;
 
+  // The optional stats sink.
+  StatsSink* stats_sink_;
+
   // Mutex guarding the access of batch data;
-  std::mutex mutex_;
+  Mutex mutex_;
 
   // timer to flush out batched data.
   std::unique_ptr<Timer> timer_;
 
-  // batched report compressor
-  std::unique_ptr<BatchCompressor> batch_compressor_;
+  // The open batches, from the oldest one.
+  std::vector<OpenBatch> open_batches_;
+
+  // The batch entry cap and window, the options unless adaptive. Only
+  // written with mutex_.
+  std::atomic<int> batch_entries_;
+  std::atomic<int> batch_time_ms_;
+  // The observed reports per second, encoded bytes per report and
+  // transport latency, moving averages for the adaptive batching. Guarded
+  // by mutex_.
+  double report_rate_;
+  double report_bytes_;
+  double latency_us_;
+  // When the last batch was finished, the report rate is measured between
+  // the finished batches.
+  std::chrono::steady_clock::time_point adapt_time_;
+
+  // The folded reports by their serialized key values.
+  std::unordered_map<std::string, ::istio::mixer::v1::Attributes> folded_;
+
+  // The number of folded reports, to sample the full ones.
+  uint64_t folded_count_;
+
+  // Mutex guarding the queued reports, only held to queue a report or to
+  // swap the queue out.
+  Mutex queue_mutex_;
+
+  // The reports queued by Report(), and the ones being compressed by
+  // Drain(). They are swapped to keep both buffers allocated.
+  std::vector<::istio::mixer::v1::Attributes> queue_;
+  std::vector<::istio::mixer::v1::Attributes> draining_;
+
+  // timer to run Drain() for queued reports.
+  std::unique_ptr<Timer> drain_timer_;
+
+  // The finished batches not sent yet.
+  std::deque<HeldBatch> held_;
+
+  // The number of reports seen while the in-flight window is full.
+  uint64_t overflow_reports_;
+
+  // The bytes of the reports in the open and the held batches.
+  std::atomic<int64_t> buffered_bytes_;
+  // The number of remote report calls in flight.
+  std::atomic<int> inflight_batches_;
+
+  std::atomic_int_fast64_t total_dropped_report_calls_;
+
+  // True once BeginShutdown() is called, and once the unacknowledged
+  // batches are saved. Guarded by mutex_.
+  bool shutting_down_;
+  bool shutdown_finished_;
+  // The timer of the shutdown deadline.
+  std::unique_ptr<Timer> shutdown_timer_;
+
+  // The batches sent but not acknowledged yet, by a sequence number. Only
+  // kept if the spill file is set. Guarded by mutex_.
+  std::unordered_map<uint64_t, HeldBatch> unacknowledged_;
+  uint64_t next_sequence_;
+  // True once the spill file of another process is claimed. Guarded by
+  // mutex_.
+  bool spill_loaded_;
+
+  // The ring of the batches spilled while Mixer fails, nullptr if not
+  // enabled or not opened yet, and the timer sending them back. Guarded by
+  // mutex_.
+  std::unique_ptr<ReportSpillRing> spill_ring_;
+  std::unique_ptr<Timer> spill_timer_;
+  bool spill_drain_scheduled_;
+  // 0 if the last call succeeded. The batches are spilled without a call
+  // until spill_until_.
+  int spill_backoff_ms_;
+  std::chrono::steady_clock::time_point spill_until_;
+  std::atomic_int_fast64_t total_spilled_report_batches_;
+
+  // True while overloaded, and the number of reports seen since.
+  std::atomic<bool> overloaded_;
+  std::atomic<uint64_t> overload_reports_;
+  std::atomic_int_fast64_t total_overload_dropped_report_calls_;
 
   std::atomic_int_fast64_t total_report_calls_;
   std::atomic_int_fast64_t total_remote_report_calls_;
 
+  // The number of finished batches, by FinishReason.
+  static const int kNumFinishReasons = EVICTED + 1;
+  std::atomic_int_fast64_t total_finished_batches_[kNumFinishReasons];
+
   GOOGLE_DISALLOW_EVIL_CONSTRUCTORS(ReportBatch);
 };
 
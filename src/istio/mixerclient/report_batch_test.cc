@@ -17,6 +17,12 @@
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
 #include "include/istio/utils/attributes_builder.h"
+#include "src/istio/mixerclient/report_spill_ring.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <algorithm>
 
 using ::google::protobuf::util::Status;
 using ::google::protobuf::util::error::Code;
@@ -51,7 +57,7 @@ class MockTimer : public Timer {
 
 class ReportBatchTest : public ::testing::Test {
  public:
-  ReportBatchTest() : mock_timer_(nullptr), compressor_({}) {
+  ReportBatchTest() : mock_timer_(nullptr), compressor_() {
     batch_.reset(new ReportBatch(ReportOptions(3, 1000),
                                  mock_report_transport_.GetFunc(),
                                  GetTimerFunc(), compressor_));
@@ -104,6 +110,8 @@ TEST_F(ReportBatchTest, TestBatchReport) {
 
   batch_->Flush();
   EXPECT_EQ(report_call_count, 4);
+  EXPECT_EQ(batch_->total_finished_batches(ReportBatch::FULL_ENTRIES), 3);
+  EXPECT_EQ(batch_->total_finished_batches(ReportBatch::TIMED), 1);
 }
 
 TEST_F(ReportBatchTest, TestNoDeltaUpdate) {
@@ -124,6 +132,7 @@ TEST_F(ReportBatchTest, TestNoDeltaUpdate) {
   report.mutable_attributes()->erase("key");
   batch_->Report(report);
   EXPECT_EQ(report_call_count, 1);
+  EXPECT_EQ(batch_->total_finished_batches(ReportBatch::DELTA_BREAK), 1);
 
   batch_->Flush();
   EXPECT_EQ(report_call_count, 2);
@@ -151,5 +160,501 @@ TEST_F(ReportBatchTest, TestBatchReportWithTimeout) {
   EXPECT_EQ(report_call_count, 1);
 }
 
+TEST_F(ReportBatchTest, TestPipelinedReport) {
+  int report_call_count = 0;
+  int report_count = 0;
+  EXPECT_CALL(mock_report_transport_, Report(_, _, _))
+      .WillRepeatedly(Invoke([&](const ReportRequest& request,
+                                 ReportResponse* response, DoneFunc on_done) {
+        report_call_count++;
+        report_count += request.attributes_size();
+        on_done(Status::OK);
+      }));
+
+  // Keep all timers, the first one created drains the queue.
+  std::vector<MockTimer*> timers;
+  ReportOptions options(3, 1000);
+  options.pipeline_queue_size = 5;
+  batch_.reset(new ReportBatch(
+      options, mock_report_transport_.GetFunc(),
+      [&timers](std::function<void()> cb) -> std::unique_ptr<Timer> {
+        MockTimer* timer = new MockTimer;
+        timer->cb_ = cb;
+        timers.push_back(timer);
+        return std::unique_ptr<Timer>(timer);
+      },
+      compressor_));
+
+  // Reports are only queued.
+  Attributes report;
+  utils::AttributesBuilder(&report).AddString("key", "value");
+  for (int i = 0; i < 4; ++i) {
+    Attributes copy(report);
+    batch_->Report(std::move(copy));
+  }
+  EXPECT_EQ(report_call_count, 0);
+  ASSERT_EQ(timers.size(), 1);
+
+  // The drain timer compresses the queued reports into batches.
+  timers[0]->cb_();
+  EXPECT_EQ(report_call_count, 1);
+  EXPECT_EQ(report_count, 3);
+
+  // A full queue is drained right away.
+  for (int i = 0; i < 5; ++i) {
+    batch_->Report(report);
+  }
+  EXPECT_EQ(report_call_count, 3);
+  EXPECT_EQ(report_count, 9);
+
+  batch_->Flush();
+  EXPECT_EQ(report_call_count, 3);
+  EXPECT_EQ(batch_->total_report_calls(), 9);
+  EXPECT_EQ(batch_->total_remote_report_calls(), 3);
+}
+
+TEST_F(ReportBatchTest, TestInflightWindow) {
+  // Keep the remote calls in flight.
+  std::vector<DoneFunc> inflight;
+  std::vector<int> batch_sizes;
+  EXPECT_CALL(mock_report_transport_, Report(_, _, _))
+      .WillRepeatedly(Invoke([&](const ReportRequest& request,
+                                 ReportResponse* response, DoneFunc on_done) {
+        batch_sizes.push_back(request.attributes_size());
+        inflight.push_back(on_done);
+      }));
+
+  ReportOptions options(2, 1000);
+  options.max_inflight_batches = 1;
+  batch_.reset(new ReportBatch(options, mock_report_transport_.GetFunc(),
+                               nullptr, compressor_));
+
+  Attributes report;
+  for (int i = 0; i < 7; ++i) {
+    batch_->Report(report);
+  }
+  // The reports after the first batch are merged into one batch.
+  EXPECT_EQ(batch_sizes, std::vector<int>({2}));
+  EXPECT_EQ(batch_->inflight_report_batches(), 1);
+
+  // The merged batch is sent once the window has room.
+  inflight[0](Status::OK);
+  EXPECT_EQ(batch_sizes, std::vector<int>({2, 5}));
+  inflight[1](Status::OK);
+  EXPECT_EQ(batch_->inflight_report_batches(), 0);
+  EXPECT_EQ(batch_->total_dropped_report_calls(), 0);
+}
+
+TEST_F(ReportBatchTest, TestDropOverflowReports) {
+  std::vector<DoneFunc> inflight;
+  std::vector<int> batch_sizes;
+  EXPECT_CALL(mock_report_transport_, Report(_, _, _))
+      .WillRepeatedly(Invoke([&](const ReportRequest& request,
+                                 ReportResponse* response, DoneFunc on_done) {
+        batch_sizes.push_back(request.attributes_size());
+        inflight.push_back(on_done);
+      }));
+
+  ReportOptions options(1, 1000);
+  options.max_inflight_batches = 1;
+  options.max_buffered_bytes = 1;
+  batch_.reset(new ReportBatch(options, mock_report_transport_.GetFunc(),
+                               nullptr, compressor_));
+
+  Attributes report;
+  utils::AttributesBuilder(&report).AddString("key", "value");
+  for (int i = 0; i < 5; ++i) {
+    batch_->Report(report);
+  }
+  // One report fills the buffer while the first batch is in flight.
+  EXPECT_EQ(batch_sizes, std::vector<int>({1}));
+  EXPECT_EQ(batch_->total_dropped_report_calls(), 3);
+  EXPECT_GT(batch_->buffered_report_bytes(), 0);
+
+  inflight[0](Status::OK);
+  EXPECT_EQ(batch_sizes, std::vector<int>({1, 1}));
+  EXPECT_EQ(batch_->buffered_report_bytes(), 0);
+  inflight[1](Status::OK);
+}
+
+TEST_F(ReportBatchTest, TestDestroyedWithInflightBatch) {
+  std::vector<DoneFunc> inflight;
+  EXPECT_CALL(mock_report_transport_, Report(_, _, _))
+      .WillRepeatedly(Invoke([&](const ReportRequest& request,
+                                 ReportResponse* response, DoneFunc on_done) {
+        inflight.push_back(on_done);
+      }));
+
+  ReportOptions options(1, 1000);
+  options.max_inflight_batches = 1;
+  batch_.reset(new ReportBatch(options, mock_report_transport_.GetFunc(),
+                               nullptr, compressor_));
+
+  Attributes report;
+  utils::AttributesBuilder(&report).AddString("key", "value");
+  batch_->Report(report);
+  batch_->Report(report);
+  // The held bytes are counted without max_buffered_bytes.
+  EXPECT_GT(batch_->buffered_report_bytes(), 0);
+
+  // The destructor sends the held batch, both calls are done after it.
+  batch_.reset();
+  ASSERT_EQ(inflight.size(), 2);
+  inflight[0](Status::OK);
+  inflight[1](Status(Code::UNAVAILABLE, "unavailable"));
+}
+
+TEST_F(ReportBatchTest, TestBatchBytes) {
+  std::vector<int> batch_sizes;
+  EXPECT_CALL(mock_report_transport_, Report(_, _, _))
+      .WillRepeatedly(Invoke([&](const ReportRequest& request,
+                                 ReportResponse* response, DoneFunc on_done) {
+        batch_sizes.push_back(request.attributes_size());
+        on_done(Status::OK);
+      }));
+
+  ReportOptions options(100, 1000);
+  options.max_batch_bytes = 1000;
+  batch_.reset(new ReportBatch(options, mock_report_transport_.GetFunc(),
+                               nullptr, compressor_));
+
+  // Each report changes a 300 bytes value.
+  for (int i = 0; i < 7; ++i) {
+    Attributes report;
+    utils::AttributesBuilder(&report).AddBytes("key",
+                                               std::string(300, 'a' + i));
+    batch_->Report(report);
+  }
+  EXPECT_EQ(batch_sizes, std::vector<int>({4}));
+  EXPECT_EQ(batch_->total_finished_batches(ReportBatch::FULL_BYTES), 1);
+
+  batch_->Flush();
+  EXPECT_EQ(batch_sizes, std::vector<int>({4, 3}));
+}
+
+TEST_F(ReportBatchTest, TestOpenBatches) {
+  std::vector<int> batch_sizes;
+  EXPECT_CALL(mock_report_transport_, Report(_, _, _))
+      .WillRepeatedly(Invoke([&](const ReportRequest& request,
+                                 ReportResponse* response, DoneFunc on_done) {
+        batch_sizes.push_back(request.attributes_size());
+        on_done(Status::OK);
+      }));
+
+  ReportOptions options(4, 1000);
+  options.max_open_batches = 2;
+  batch_.reset(new ReportBatch(options, mock_report_transport_.GetFunc(),
+                               nullptr, compressor_));
+
+  // Reports with and without an optional attribute come in turn.
+  Attributes report;
+  utils::AttributesBuilder(&report).AddString("key", "value");
+  Attributes optional_report(report);
+  utils::AttributesBuilder(&optional_report).AddString("optional", "value");
+  for (int i = 0; i < 8; ++i) {
+    batch_->Report(i % 2 ? optional_report : report);
+  }
+  // Each kind of report fills its own batch.
+  EXPECT_EQ(batch_sizes, std::vector<int>({4, 4}));
+
+  uint64_t batches, entries;
+  batch_->Report(report);
+  batch_->Report(optional_report);
+  batch_->Report(report);
+  batch_->GetOpenBatches(&batches, &entries);
+  EXPECT_EQ(batches, 2);
+  EXPECT_EQ(entries, 3);
+  // Flushed while batch_sizes is still alive.
+  batch_.reset();
+}
+
+TEST_F(ReportBatchTest, TestAggregation) {
+  std::vector<ReportRequest> requests;
+  EXPECT_CALL(mock_report_transport_, Report(_, _, _))
+      .WillRepeatedly(Invoke([&](const ReportRequest& request,
+                                 ReportResponse* response, DoneFunc on_done) {
+        requests.push_back(request);
+        on_done(Status::OK);
+      }));
+
+  ReportOptions options(10, 1000);
+  options.aggregation_keys = {"key"};
+  options.aggregation_sums = {"size"};
+  options.aggregation_count_attribute = "count";
+  options.full_report_sample_rate = 4;
+  options.max_open_batches = 2;
+  batch_.reset(new ReportBatch(options, mock_report_transport_.GetFunc(),
+                               nullptr, compressor_));
+
+  for (int i = 0; i < 8; ++i) {
+    Attributes report;
+    utils::AttributesBuilder builder(&report);
+    builder.AddString("key", i % 2 ? "odd" : "even");
+    builder.AddString("path", "/path");
+    builder.AddInt64("size", 100 + i);
+    batch_->Report(report);
+  }
+  EXPECT_TRUE(requests.empty());
+  batch_->Flush();
+
+  // Full and folded reports go to their own batches.
+  ASSERT_EQ(requests.size(), 2);
+  std::vector<int64_t> folded;
+  int full_reports = 0;
+  for (const ReportRequest& request : requests) {
+    for (const auto& attributes : request.attributes()) {
+      if (attributes.strings_size() == 1) {
+        for (const auto& it : attributes.int64s()) {
+          folded.push_back(it.second);
+        }
+      } else {
+        ++full_reports;
+      }
+    }
+  }
+  // One in four reports is also sent in full.
+  EXPECT_EQ(full_reports, 2);
+  std::sort(folded.begin(), folded.end());
+  // Sums of 100, 102, 104, 106 and 101, 103, 105, 107 with a count of 4,
+  // which the second folded report carries over from the first one.
+  EXPECT_EQ(folded, std::vector<int64_t>({4, 412, 416}));
+}
+
+TEST_F(ReportBatchTest, TestShutdownSpill) {
+  std::vector<DoneFunc> inflight;
+  std::vector<int> batch_sizes;
+  EXPECT_CALL(mock_report_transport_, Report(_, _, _))
+      .WillRepeatedly(Invoke([&](const ReportRequest& request,
+                                 ReportResponse* response, DoneFunc on_done) {
+        batch_sizes.push_back(request.attributes_size());
+        inflight.push_back(on_done);
+      }));
+
+  const char* dir = getenv("TEST_TMPDIR");
+  ReportOptions options(3, 1000);
+  options.max_inflight_batches = 1;
+  options.spill_file = std::string(dir ? dir : "/tmp") + "/report_spill";
+  remove(options.spill_file.c_str());
+  batch_.reset(new ReportBatch(options, mock_report_transport_.GetFunc(),
+                               GetTimerFunc(), compressor_));
+
+  Attributes report;
+  for (int i = 0; i < 3; ++i) {
+    batch_->Report(report);
+  }
+  EXPECT_EQ(batch_sizes, std::vector<int>({3}));
+
+  // While shutting down, reports are sent right away, ignoring the window.
+  batch_->BeginShutdown(5000);
+  MockTimer* deadline_timer = mock_timer_;
+  batch_->Report(report);
+  EXPECT_EQ(batch_sizes, std::vector<int>({3, 1}));
+
+  // The failed batch is saved at the deadline, the acknowledged one is not.
+  inflight[0](Status(Code::UNAVAILABLE, ""));
+  inflight[1](Status::OK);
+  deadline_timer->cb_();
+  batch_.reset();
+
+  // The saved batch is sent by the next client once.
+  batch_sizes.clear();
+  batch_.reset(new ReportBatch(options, mock_report_transport_.GetFunc(),
+                               GetTimerFunc(), compressor_));
+  // Claimed at construction, with the bytes of the batch.
+  EXPECT_FALSE(fopen(options.spill_file.c_str(), "rb"));
+  EXPECT_GT(batch_->buffered_report_bytes(), 0);
+  batch_->Flush();
+  EXPECT_EQ(batch_sizes, std::vector<int>({3}));
+  EXPECT_EQ(batch_->buffered_report_bytes(), 0);
+  inflight[2](Status::OK);
+  batch_->Flush();
+  EXPECT_EQ(batch_sizes, std::vector<int>({3}));
+
+  // A hot restart saves the batches once the next client already runs.
+  std::unique_ptr<ReportBatch> next(new ReportBatch(
+      options, mock_report_transport_.GetFunc(), GetTimerFunc(), compressor_));
+  batch_->Report(report);
+  batch_->BeginShutdown(5000);
+  deadline_timer = mock_timer_;
+  EXPECT_EQ(batch_sizes, std::vector<int>({3, 1}));
+  deadline_timer->cb_();
+  batch_.reset();
+  // Done after the client is destroyed.
+  inflight[3](Status::OK);
+
+  next->Flush();
+  EXPECT_EQ(batch_sizes, std::vector<int>({3, 1, 1}));
+  inflight[4](Status::OK);
+  next->Flush();
+  EXPECT_EQ(batch_sizes, std::vector<int>({3, 1, 1}));
+  EXPECT_FALSE(fopen(options.spill_file.c_str(), "rb"));
+}
+
+TEST_F(ReportBatchTest, TestSpillRing) {
+  std::vector<int> batch_sizes;
+  Status status(Code::UNAVAILABLE, "");
+  EXPECT_CALL(mock_report_transport_, Report(_, _, _))
+      .WillRepeatedly(Invoke([&](const ReportRequest& request,
+                                 ReportResponse* response, DoneFunc on_done) {
+        batch_sizes.push_back(request.attributes_size());
+        on_done(status);
+      }));
+
+  const char* dir = getenv("TEST_TMPDIR");
+  ReportOptions options(3, 1000);
+  options.spill_ring_file = std::string(dir ? dir : "/tmp") + "/report_ring";
+  options.spill_ring_bytes = 4096;
+  // Retried on the next drain.
+  options.channel_initial_backoff_ms = 0;
+  options.channel_max_backoff_ms = 0;
+  remove(options.spill_ring_file.c_str());
+  batch_.reset(new ReportBatch(options, mock_report_transport_.GetFunc(),
+                               GetTimerFunc(), compressor_));
+
+  // The failed batch is spilled.
+  Attributes report;
+  for (int i = 0; i < 3; ++i) {
+    batch_->Report(report);
+  }
+  EXPECT_EQ(batch_sizes, std::vector<int>({3}));
+  EXPECT_EQ(batch_->total_spilled_report_batches(), 1);
+  MockTimer* drain_timer = mock_timer_;
+  ASSERT_TRUE(drain_timer != nullptr);
+
+  // Spilled again while Mixer fails.
+  drain_timer->cb_();
+  EXPECT_EQ(batch_sizes, std::vector<int>({3, 3}));
+  EXPECT_EQ(batch_->total_spilled_report_batches(), 2);
+
+  // Dropped once sent.
+  status = Status::OK;
+  drain_timer->cb_();
+  EXPECT_EQ(batch_sizes, std::vector<int>({3, 3, 3}));
+  drain_timer->cb_();
+  EXPECT_EQ(batch_sizes, std::vector<int>({3, 3, 3}));
+  EXPECT_EQ(batch_->total_remote_report_calls(), 3);
+  EXPECT_EQ(batch_->total_spilled_report_batches(), 2);
+}
+
+TEST_F(ReportBatchTest, TestLockedSpillRing) {
+  std::vector<int> batch_sizes;
+  EXPECT_CALL(mock_report_transport_, Report(_, _, _))
+      .WillRepeatedly(Invoke([&](const ReportRequest& request,
+                                 ReportResponse* response, DoneFunc on_done) {
+        batch_sizes.push_back(request.attributes_size());
+        on_done(Status::OK);
+      }));
+
+  const char* dir = getenv("TEST_TMPDIR");
+  ReportOptions options(3, 1000);
+  options.spill_ring_file =
+      std::string(dir ? dir : "/tmp") + "/report_locked_ring";
+  options.spill_ring_bytes = 4096;
+  remove(options.spill_ring_file.c_str());
+
+  // The ring of the old process of a hot restart, still draining.
+  auto old_ring =
+      ReportSpillRing::Open(options.spill_ring_file, options.spill_ring_bytes);
+  ASSERT_TRUE(old_ring != nullptr);
+  ReportRequest spilled;
+  spilled.add_attributes();
+  spilled.add_attributes();
+  old_ring->Push(spilled.SerializeAsString());
+  batch_.reset(new ReportBatch(options, mock_report_transport_.GetFunc(),
+                               GetTimerFunc(), compressor_));
+  mock_timer_ = nullptr;
+  batch_->Flush();
+  EXPECT_TRUE(batch_sizes.empty());
+  EXPECT_TRUE(mock_timer_ == nullptr);
+
+  // Opened by a flush once the old process released it.
+  old_ring.reset();
+  batch_->Flush();
+  ASSERT_TRUE(mock_timer_ != nullptr);
+  mock_timer_->cb_();
+  EXPECT_EQ(batch_sizes, std::vector<int>({2}));
+  EXPECT_EQ(batch_->buffered_report_bytes(), 0);
+}
+
+TEST_F(ReportBatchTest, TestChannels) {
+  std::vector<int> channels;
+  // The first call through channel 1 fails.
+  auto channel_func = [&channels](int channel) -> TransportReportFunc {
+    return [&channels, channel](const ReportRequest&, ReportResponse*,
+                                DoneFunc on_done) -> CancelFunc {
+      bool first = std::count(channels.begin(), channels.end(), channel) == 0;
+      channels.push_back(channel);
+      on_done(channel == 1 && first ? Status(Code::UNAVAILABLE, "")
+                                    : Status::OK);
+      return nullptr;
+    };
+  };
+  ReportOptions options(1, 1000);
+  options.channel_initial_backoff_ms = 60000;
+  batch_.reset(
+      new ReportBatch(options, channel_func(0), nullptr, compressor_));
+  batch_->AddChannels({channel_func(1), channel_func(2)});
+
+  Attributes report;
+  for (int i = 0; i < 6; ++i) {
+    batch_->Report(report);
+  }
+  // The batches go to each channel in turn, skipping the one backing off.
+  EXPECT_EQ(channels, std::vector<int>({0, 1, 2, 0, 2, 0}));
+}
+
+TEST_F(ReportBatchTest, TestAdaptiveBatching) {
+  std::vector<DoneFunc> pending;
+  EXPECT_CALL(mock_report_transport_, Report(_, _, _))
+      .WillRepeatedly(Invoke([&](const ReportRequest& request,
+                                 ReportResponse* response, DoneFunc on_done) {
+        pending.push_back(on_done);
+      }));
+  ReportOptions options(1000, 1000);
+  options.target_report_calls_per_second = 10;
+  batch_.reset(new ReportBatch(options, mock_report_transport_.GetFunc(),
+                               GetTimerFunc(), compressor_));
+  // Nothing observed yet.
+  EXPECT_EQ(batch_->batch_entries(), 1000);
+  EXPECT_EQ(batch_->batch_time_ms(), 100);
+
+  // A burst is sent in large batches.
+  Attributes report;
+  utils::AttributesBuilder(&report).AddString("key", "value");
+  for (int i = 0; i < 500; ++i) {
+    batch_->Report(report);
+  }
+  batch_->Flush();
+  ASSERT_EQ(pending.size(), 1);
+  EXPECT_GT(batch_->batch_entries(), 10);
+
+  // A slow transport widens the window.
+  usleep(300 * 1000);
+  pending[0](Status::OK);
+  EXPECT_GE(batch_->batch_time_ms(), 300);
+  EXPECT_LE(batch_->batch_time_ms(), 1000);
+  batch_.reset();
+}
+
+TEST_F(ReportBatchTest, TestAdaptiveBatchBytes) {
+  EXPECT_CALL(mock_report_transport_, Report(_, _, _))
+      .WillRepeatedly(Invoke([&](const ReportRequest& request,
+                                 ReportResponse* response,
+                                 DoneFunc on_done) { on_done(Status::OK); }));
+  ReportOptions options(1000, 1000);
+  options.target_report_calls_per_second = 10;
+  options.target_batch_bytes = 100;
+  batch_.reset(new ReportBatch(options, mock_report_transport_.GetFunc(),
+                               GetTimerFunc(), compressor_));
+
+  // The entry cap is bounded by the batch bytes.
+  Attributes report;
+  utils::AttributesBuilder(&report).AddString("key", std::string(50, 'v'));
+  batch_->Report(report);
+  batch_->Flush();
+  EXPECT_LE(batch_->batch_entries(), 2);
+  EXPECT_EQ(batch_->batch_time_ms(), 100);
+}
+
 }  // namespace mixerclient
 }  // namespace istio
@@ -0,0 +1,186 @@
+/* Copyright 2018 Istio Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/istio/mixerclient/report_spill_ring.h"
+#include "google/protobuf/stubs/logging.h"
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace istio {
+namespace mixerclient {
+namespace {
+
+// The magic number of the ring files.
+const uint64_t kMagic = 0x495354494f525352ull;
+
+// A record is its 4 byte size followed by the serialized batch. This size
+// tells the next record is at the start of the ring.
+const uint32_t kWrapMarker = 0xffffffff;
+const uint64_t kRecordHeaderSize = sizeof(uint32_t);
+
+}  // namespace
+
+// The ring state, kept at the start of the file. head and tail are the
+// offsets of the oldest record and of the end of the newest one.
+struct ReportSpillRing::Header {
+  uint64_t magic;
+  uint64_t capacity;
+  uint64_t head;
+  uint64_t tail;
+  uint64_t count;
+  char padding[24];
+};
+
+std::unique_ptr<ReportSpillRing> ReportSpillRing::Open(const std::string& file,
+                                                       int64_t capacity) {
+  if (capacity <= int64_t(kRecordHeaderSize)) {
+    return nullptr;
+  }
+  size_t size = sizeof(Header) + capacity;
+  int fd = open(file.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+  if (fd < 0) {
+    GOOGLE_LOG(ERROR) << "Failed to open the report spill ring " << file;
+    return nullptr;
+  }
+  // Used by another ring.
+  if (flock(fd, LOCK_EX | LOCK_NB) != 0) {
+    close(fd);
+    return nullptr;
+  }
+  struct stat st;
+  void* mapped = MAP_FAILED;
+  if (fstat(fd, &st) == 0 &&
+      (st.st_size == off_t(size) || ftruncate(fd, size) == 0)) {
+    mapped = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  }
+  if (mapped == MAP_FAILED) {
+    GOOGLE_LOG(ERROR) << "Failed to map the report spill ring " << file;
+    close(fd);
+    return nullptr;
+  }
+  return std::unique_ptr<ReportSpillRing>(
+      new ReportSpillRing(file, fd, mapped, size));
+}
+
+ReportSpillRing::ReportSpillRing(const std::string& file, int fd,
+                                 void* mapped, size_t mapped_size)
+    : file_(file),
+      fd_(fd),
+      mapped_(mapped),
+      mapped_size_(mapped_size),
+      header_(static_cast<Header*>(mapped)),
+      data_(static_cast<char*>(mapped) + sizeof(Header)) {
+  static_assert(sizeof(Header) == 64, "header size");
+  uint64_t capacity = mapped_size - sizeof(Header);
+  // A new file, or one of another capacity, starts empty.
+  if (header_->magic != kMagic || header_->capacity != capacity ||
+      header_->head > capacity || header_->tail > capacity) {
+    header_->capacity = capacity;
+    header_->head = 0;
+    header_->tail = 0;
+    header_->count = 0;
+    header_->magic = kMagic;
+  }
+}
+
+ReportSpillRing::~ReportSpillRing() {
+  munmap(mapped_, mapped_size_);
+  // Also releases the lock.
+  close(fd_);
+}
+
+uint64_t ReportSpillRing::size() const { return header_->count; }
+
+int64_t ReportSpillRing::FindSpace(uint64_t size) const {
+  const Header& h = *header_;
+  if (h.count == 0) {
+    return size <= h.capacity ? 0 : -1;
+  }
+  if (h.tail > h.head) {
+    if (h.tail + size <= h.capacity) {
+      return h.tail;
+    }
+    // Wraps to the start.
+    return size <= h.head ? 0 : -1;
+  }
+  // Already wrapped, full if tail == head.
+  return h.tail + size <= h.head ? h.tail : -1;
+}
+
+int ReportSpillRing::Push(const std::string& batch) {
+  uint64_t size = kRecordHeaderSize + batch.size();
+  if (size > header_->capacity || batch.size() >= kWrapMarker) {
+    return -1;
+  }
+  int dropped = 0;
+  int64_t offset;
+  while ((offset = FindSpace(size)) < 0) {
+    Pop(nullptr);
+    ++dropped;
+  }
+  Header& h = *header_;
+  if (offset == 0 && h.count > 0 &&
+      h.tail + kRecordHeaderSize <= h.capacity) {
+    memcpy(data_ + h.tail, &kWrapMarker, kRecordHeaderSize);
+  }
+  uint32_t batch_size = batch.size();
+  memcpy(data_ + offset, &batch_size, kRecordHeaderSize);
+  memcpy(data_ + offset + kRecordHeaderSize, batch.data(), batch.size());
+  // The record is written before it is counted, a crash loses it at
+  // worst.
+  h.tail = offset + size;
+  ++h.count;
+  return dropped;
+}
+
+bool ReportSpillRing::Pop(std::string* batch) {
+  Header& h = *header_;
+  if (h.count == 0) {
+    return false;
+  }
+  uint32_t batch_size = kWrapMarker;
+  if (h.head + kRecordHeaderSize <= h.capacity) {
+    memcpy(&batch_size, data_ + h.head, kRecordHeaderSize);
+  }
+  if (batch_size == kWrapMarker) {
+    h.head = 0;
+    memcpy(&batch_size, data_, kRecordHeaderSize);
+  }
+  if (h.head + kRecordHeaderSize + batch_size > h.capacity) {
+    GOOGLE_LOG(ERROR) << "The report spill ring " << file_
+                      << " is corrupted, dropping " << h.count << " batches";
+    h.head = 0;
+    h.tail = 0;
+    h.count = 0;
+    return false;
+  }
+  if (batch) {
+    batch->assign(data_ + h.head + kRecordHeaderSize, batch_size);
+  }
+  h.head += kRecordHeaderSize + batch_size;
+  if (--h.count == 0) {
+    h.head = 0;
+    h.tail = 0;
+  }
+  return true;
+}
+
+}  // namespace mixerclient
+}  // namespace istio
@@ -0,0 +1,83 @@
+/* Copyright 2018 Istio Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ISTIO_MIXERCLIENT_REPORT_SPILL_RING_H
+#define ISTIO_MIXERCLIENT_REPORT_SPILL_RING_H
+
+#include "google/protobuf/stubs/common.h"
+
+#include <stdint.h>
+#include <memory>
+#include <string>
+
+namespace istio {
+namespace mixerclient {
+
+// A bounded ring of serialized report batches in a memory mapped file, so
+// that the batches Mixer could not take survive an outage, and a restart
+// of the proxy. Once full, the oldest batches are dropped. A file is
+// locked by its ring, it is only used by one ring at a time. It is not
+// thread safe.
+class ReportSpillRing {
+ public:
+  // Maps a ring of capacity bytes. A ring left by a previous process is
+  // kept if it has the same capacity. Returns nullptr if the file can't be
+  // mapped, or if it is locked by another ring, e.g. of the old process of
+  // a hot restart still draining.
+  static std::unique_ptr<ReportSpillRing> Open(const std::string& file,
+                                               int64_t capacity);
+
+  ~ReportSpillRing();
+
+  // Appends a batch, dropping the oldest ones to make room. Returns the
+  // number of batches dropped, or -1 if the batch doesn't fit in the ring.
+  int Push(const std::string& batch);
+
+  // Takes the oldest batch, returns false if empty.
+  bool Pop(std::string* batch);
+
+  // The number of batches in the ring.
+  uint64_t size() const;
+  bool empty() const { return size() == 0; }
+
+  // The file used.
+  const std::string& file() const { return file_; }
+
+ private:
+  struct Header;
+
+  ReportSpillRing(const std::string& file, int fd, void* mapped,
+                  size_t mapped_size);
+
+  // Returns the offset to write a record of size bytes at, or -1 if the
+  // free space can't hold it.
+  int64_t FindSpace(uint64_t size) const;
+
+  const std::string file_;
+  // The locked file, and its mapping.
+  const int fd_;
+  void* const mapped_;
+  const size_t mapped_size_;
+  Header* header_;
+  // The records after the header.
+  char* data_;
+
+  GOOGLE_DISALLOW_EVIL_CONSTRUCTORS(ReportSpillRing);
+};
+
+}  // namespace mixerclient
+}  // namespace istio
+
+#endif  // ISTIO_MIXERCLIENT_REPORT_SPILL_RING_H
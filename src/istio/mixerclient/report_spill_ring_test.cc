@@ -0,0 +1,116 @@
+/* Copyright 2018 Istio Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/istio/mixerclient/report_spill_ring.h"
+#include "gtest/gtest.h"
+
+#include <stdio.h>
+
+namespace istio {
+namespace mixerclient {
+namespace {
+
+std::string TempFile(const std::string& name) {
+  const char* dir = getenv("TEST_TMPDIR");
+  std::string file = std::string(dir ? dir : "/tmp") + "/" + name;
+  remove(file.c_str());
+  return file;
+}
+
+TEST(ReportSpillRingTest, TestPushPop) {
+  auto ring = ReportSpillRing::Open(TempFile("spill_ring"), 1024);
+  ASSERT_TRUE(ring != nullptr);
+  EXPECT_TRUE(ring->empty());
+
+  std::string batch;
+  EXPECT_FALSE(ring->Pop(&batch));
+  EXPECT_EQ(ring->Push("a"), 0);
+  EXPECT_EQ(ring->Push("bb"), 0);
+  EXPECT_EQ(ring->size(), 2);
+  EXPECT_TRUE(ring->Pop(&batch));
+  EXPECT_EQ(batch, "a");
+  EXPECT_TRUE(ring->Pop(&batch));
+  EXPECT_EQ(batch, "bb");
+  EXPECT_TRUE(ring->empty());
+}
+
+TEST(ReportSpillRingTest, TestDropOldest) {
+  // Each record takes 4 + 30 bytes, 3 of them fit.
+  auto ring = ReportSpillRing::Open(TempFile("spill_ring"), 110);
+  ASSERT_TRUE(ring != nullptr);
+
+  for (int i = 0; i < 3; ++i) {
+    EXPECT_EQ(ring->Push(std::string(30, '0' + i)), 0);
+  }
+  // Wraps to the start, dropping the oldest one.
+  EXPECT_EQ(ring->Push(std::string(30, '3')), 1);
+  EXPECT_EQ(ring->size(), 3);
+  // Too big for the ring.
+  EXPECT_EQ(ring->Push(std::string(200, 'x')), -1);
+
+  std::string batch;
+  for (int i = 1; i < 4; ++i) {
+    EXPECT_TRUE(ring->Pop(&batch));
+    EXPECT_EQ(batch, std::string(30, '0' + i));
+  }
+  EXPECT_FALSE(ring->Pop(&batch));
+}
+
+TEST(ReportSpillRingTest, TestWrapAround) {
+  auto ring = ReportSpillRing::Open(TempFile("spill_ring"), 100);
+  ASSERT_TRUE(ring != nullptr);
+
+  std::string batch;
+  for (int i = 0; i < 20; ++i) {
+    EXPECT_EQ(ring->Push(std::string(20 + i % 7, 'a' + i)), 0);
+    if (i > 0) {
+      EXPECT_TRUE(ring->Pop(&batch));
+      EXPECT_EQ(batch, std::string(20 + (i - 1) % 7, 'a' + i - 1));
+    }
+  }
+  EXPECT_EQ(ring->size(), 1);
+}
+
+TEST(ReportSpillRingTest, TestReopen) {
+  std::string file = TempFile("spill_ring");
+  {
+    auto ring = ReportSpillRing::Open(file, 1024);
+    ASSERT_TRUE(ring != nullptr);
+    ring->Push("a");
+    ring->Push("b");
+
+    // The file is locked, another ring can't use it until it is released.
+    EXPECT_TRUE(ReportSpillRing::Open(file, 1024) == nullptr);
+  }
+
+  // The batches survive the ring.
+  auto ring = ReportSpillRing::Open(file, 1024);
+  ASSERT_TRUE(ring != nullptr);
+  EXPECT_EQ(ring->file(), file);
+  std::string batch;
+  EXPECT_TRUE(ring->Pop(&batch));
+  EXPECT_EQ(batch, "a");
+  EXPECT_EQ(ring->size(), 1);
+
+  // A ring of another capacity starts empty.
+  ring.reset();
+  ring = ReportSpillRing::Open(file, 2048);
+  ASSERT_TRUE(ring != nullptr);
+  EXPECT_TRUE(ring->empty());
+}
+
+}  // namespace
+}  // namespace mixerclient
+}  // namespace istio
@@ -0,0 +1,86 @@
+/* Copyright 2018 Istio Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ISTIO_MIXERCLIENT_SNAPSHOT_CODER_H
+#define ISTIO_MIXERCLIENT_SNAPSHOT_CODER_H
+
+#include <stdint.h>
+#include <string.h>
+#include <string>
+
+namespace istio {
+namespace mixerclient {
+
+// Appends fixed size integers and length-prefixed strings to a buffer for
+// the check cache snapshot. Integers are written in host byte order since a
+// snapshot is only read by the same binary on the same host.
+class SnapshotWriter {
+ public:
+  SnapshotWriter(std::string* data) : data_(data) {}
+
+  template <class T>
+  void Write(T value) {
+    data_->append(reinterpret_cast<const char*>(&value), sizeof(value));
+  }
+
+  void WriteString(const std::string& str) {
+    Write<uint32_t>(str.size());
+    data_->append(str);
+  }
+
+ private:
+  std::string* data_;
+};
+
+// Reads the data written by SnapshotWriter. Once a read runs out of data,
+// all following reads fail.
+class SnapshotReader {
+ public:
+  SnapshotReader(const std::string& data) : data_(data), pos_(0) {}
+
+  template <class T>
+  bool Read(T* value) {
+    if (pos_ + sizeof(T) > data_.size()) {
+      pos_ = data_.size() + 1;
+      return false;
+    }
+    memcpy(value, data_.data() + pos_, sizeof(T));
+    pos_ += sizeof(T);
+    return true;
+  }
+
+  bool ReadString(std::string* str) {
+    uint32_t size;
+    if (!Read(&size) || pos_ + size > data_.size()) {
+      pos_ = data_.size() + 1;
+      return false;
+    }
+    str->assign(data_.data() + pos_, size);
+    pos_ += size;
+    return true;
+  }
+
+  // Returns true if all data has been read without error.
+  bool AtEnd() const { return pos_ == data_.size(); }
+
+ private:
+  const std::string& data_;
+  size_t pos_;
+};
+
+}  // namespace mixerclient
+}  // namespace istio
+
+#endif  // ISTIO_MIXERCLIENT_SNAPSHOT_CODER_H
@@ -0,0 +1,197 @@
+/* Copyright 2018 Istio Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "include/istio/mixerclient/traffic_capture.h"
+#include "src/istio/mixerclient/snapshot_coder.h"
+
+#include <stdio.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <thread>
+
+using ::istio::mixer::v1::Attributes;
+using ::istio::quota_config::Requirement;
+
+namespace istio {
+namespace mixerclient {
+namespace {
+
+// The header of a capture file, it changes with the record format.
+const char kCaptureHeader[] = "istio-mixer-capture-1";
+
+class TrafficCaptureImpl : public TrafficCapture {
+ public:
+  TrafficCaptureImpl(const TrafficCaptureOptions& options, FILE* file)
+      : options_(options),
+        file_(file),
+        start_(std::chrono::steady_clock::now()) {
+    if (options_.sample_every == 0) {
+      options_.sample_every = 1;
+    }
+    std::string header;
+    SnapshotWriter(&header).WriteString(kCaptureHeader);
+    fwrite(header.data(), 1, header.size(), file_);
+    writer_ = std::thread([this]() { WriteLoop(); });
+  }
+
+  ~TrafficCaptureImpl() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stopped_ = true;
+    }
+    cv_.notify_one();
+    writer_.join();
+    fclose(file_);
+  }
+
+  void Capture(TrafficCaptureType type, const Attributes& attributes,
+               const std::vector<Requirement>& quotas) override {
+    if (calls_.fetch_add(1) % options_.sample_every != 0) {
+      return;
+    }
+    // Counted when queued, so that no more than max_records are queued.
+    if (queued_records_.fetch_add(1) >= options_.max_records) {
+      return;
+    }
+    std::string record;
+    SnapshotWriter writer(&record);
+    writer.Write<uint32_t>(static_cast<uint32_t>(type));
+    writer.Write<uint64_t>(
+        std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - start_)
+            .count());
+    writer.WriteString(attributes.SerializeAsString());
+    writer.Write<uint32_t>(quotas.size());
+    for (const auto& quota : quotas) {
+      writer.WriteString(quota.quota);
+      writer.Write<int64_t>(quota.charge);
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (pending_.size() >= options_.max_pending_records) {
+        ++dropped_records_;
+        return;
+      }
+      pending_.push_back(std::move(record));
+    }
+    cv_.notify_one();
+  }
+
+  uint64_t written_records() const override { return written_records_; }
+  uint64_t dropped_records() const override { return dropped_records_; }
+
+ private:
+  // Writes the queued records until stopped, then the remaining ones.
+  void WriteLoop() {
+    std::deque<std::string> records;
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+      cv_.wait(lock, [this]() { return stopped_ || !pending_.empty(); });
+      records.swap(pending_);
+      bool stopped = stopped_;
+      lock.unlock();
+      for (const auto& record : records) {
+        fwrite(record.data(), 1, record.size(), file_);
+      }
+      fflush(file_);
+      written_records_ += records.size();
+      records.clear();
+      lock.lock();
+      if (stopped && pending_.empty()) {
+        return;
+      }
+    }
+  }
+
+  TrafficCaptureOptions options_;
+  FILE* file_;
+  const std::chrono::steady_clock::time_point start_;
+
+  // The number of calls, for the sampling.
+  std::atomic<uint64_t> calls_{0};
+  // The number of records queued, including the dropped ones.
+  std::atomic<uint64_t> queued_records_{0};
+  std::atomic<uint64_t> written_records_{0};
+  std::atomic<uint64_t> dropped_records_{0};
+
+  // Protects pending_ and stopped_.
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  // The serialized records waiting for the writer thread.
+  std::deque<std::string> pending_;
+  bool stopped_{false};
+
+  std::thread writer_;
+};
+
+}  // namespace
+
+std::shared_ptr<TrafficCapture> CreateTrafficCapture(
+    const TrafficCaptureOptions& options) {
+  FILE* file = fopen(options.file.c_str(), "wb");
+  if (file == nullptr) {
+    return nullptr;
+  }
+  return std::make_shared<TrafficCaptureImpl>(options, file);
+}
+
+bool ReadTrafficCapture(const std::string& file,
+                        std::vector<TrafficCaptureRecord>* records) {
+  std::ifstream in(file, std::ios::binary);
+  if (!in) {
+    return false;
+  }
+  std::stringstream buffer;
+  buffer << in.rdbuf();
+  const std::string data = buffer.str();
+
+  SnapshotReader reader(data);
+  std::string header;
+  if (!reader.ReadString(&header) || header != kCaptureHeader) {
+    return false;
+  }
+  while (!reader.AtEnd()) {
+    TrafficCaptureRecord record;
+    uint32_t type;
+    std::string attributes;
+    uint32_t num_quotas;
+    if (!reader.Read(&type) || !reader.Read(&record.time_us) ||
+        !reader.ReadString(&attributes) || !reader.Read(&num_quotas)) {
+      return false;
+    }
+    for (uint32_t i = 0; i < num_quotas; ++i) {
+      Requirement quota;
+      if (!reader.ReadString(&quota.quota) || !reader.Read(&quota.charge)) {
+        return false;
+      }
+      record.quotas.push_back(std::move(quota));
+    }
+    if (!record.attributes.ParseFromString(attributes)) {
+      return false;
+    }
+    record.type = static_cast<TrafficCaptureType>(type);
+    records->push_back(std::move(record));
+  }
+  return true;
+}
+
+}  // namespace mixerclient
+}  // namespace istio
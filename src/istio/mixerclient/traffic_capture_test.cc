@@ -0,0 +1,126 @@
+/* Copyright 2018 Istio Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "include/istio/mixerclient/traffic_capture.h"
+#include "google/protobuf/util/message_differencer.h"
+#include "gtest/gtest.h"
+#include "include/istio/utils/attributes_builder.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <fstream>
+
+using ::google::protobuf::util::MessageDifferencer;
+using ::istio::mixer::v1::Attributes;
+using ::istio::quota_config::Requirement;
+
+namespace istio {
+namespace mixerclient {
+namespace {
+
+std::string CaptureFile(const std::string& name) {
+  const char* dir = getenv("TEST_TMPDIR");
+  return std::string(dir ? dir : "/tmp") + "/" + name;
+}
+
+Attributes MakeAttributes(int i) {
+  Attributes attributes;
+  utils::AttributesBuilder builder(&attributes);
+  builder.AddString("destination.service", "service" + std::to_string(i));
+  builder.AddInt64("response.code", 200);
+  return attributes;
+}
+
+TEST(TrafficCaptureTest, TestCaptureAndRead) {
+  TrafficCaptureOptions options;
+  options.file = CaptureFile("capture_and_read");
+  options.sample_every = 1;
+  std::vector<Requirement> quotas = {{"RequestCount", 1}};
+  {
+    auto capture = CreateTrafficCapture(options);
+    ASSERT_TRUE(capture);
+    capture->Capture(TrafficCaptureType::CHECK, MakeAttributes(0), quotas);
+    capture->Capture(TrafficCaptureType::REPORT, MakeAttributes(1), {});
+  }
+
+  std::vector<TrafficCaptureRecord> records;
+  ASSERT_TRUE(ReadTrafficCapture(options.file, &records));
+  ASSERT_EQ(records.size(), 2);
+  EXPECT_EQ(records[0].type, TrafficCaptureType::CHECK);
+  EXPECT_TRUE(
+      MessageDifferencer::Equals(records[0].attributes, MakeAttributes(0)));
+  ASSERT_EQ(records[0].quotas.size(), 1);
+  EXPECT_EQ(records[0].quotas[0].quota, "RequestCount");
+  EXPECT_EQ(records[0].quotas[0].charge, 1);
+  EXPECT_EQ(records[1].type, TrafficCaptureType::REPORT);
+  EXPECT_TRUE(records[1].quotas.empty());
+  EXPECT_LE(records[0].time_us, records[1].time_us);
+  remove(options.file.c_str());
+}
+
+TEST(TrafficCaptureTest, TestSampleAndLimit) {
+  TrafficCaptureOptions options;
+  options.file = CaptureFile("sample_and_limit");
+  options.sample_every = 3;
+  options.max_records = 3;
+  {
+    auto capture = CreateTrafficCapture(options);
+    ASSERT_TRUE(capture);
+    // Calls 0, 3, 6 and 9 are sampled, the last one is over the limit.
+    for (int i = 0; i < 10; ++i) {
+      capture->Capture(TrafficCaptureType::REPORT, MakeAttributes(i), {});
+    }
+  }
+
+  std::vector<TrafficCaptureRecord> records;
+  ASSERT_TRUE(ReadTrafficCapture(options.file, &records));
+  ASSERT_EQ(records.size(), 3);
+  EXPECT_TRUE(
+      MessageDifferencer::Equals(records[1].attributes, MakeAttributes(3)));
+  remove(options.file.c_str());
+}
+
+TEST(TrafficCaptureTest, TestCorruptedFile) {
+  std::vector<TrafficCaptureRecord> records;
+  EXPECT_FALSE(ReadTrafficCapture(CaptureFile("not_found"), &records));
+
+  TrafficCaptureOptions options;
+  options.file = CaptureFile("corrupted");
+  options.sample_every = 1;
+  {
+    auto capture = CreateTrafficCapture(options);
+    ASSERT_TRUE(capture);
+    capture->Capture(TrafficCaptureType::REPORT, MakeAttributes(0), {});
+    capture->Capture(TrafficCaptureType::REPORT, MakeAttributes(1), {});
+  }
+  std::string data;
+  {
+    std::ifstream in(options.file, std::ios::binary);
+    data.assign(std::istreambuf_iterator<char>(in),
+                std::istreambuf_iterator<char>());
+  }
+  {
+    std::ofstream out(options.file, std::ios::binary | std::ios::trunc);
+    out << data.substr(0, data.size() - 1);
+  }
+  // The truncated last record is not read.
+  EXPECT_FALSE(ReadTrafficCapture(options.file, &records));
+  EXPECT_EQ(records.size(), 1);
+  remove(options.file.c_str());
+}
+
+}  // namespace
+}  // namespace mixerclient
+}  // namespace istio
@@ -0,0 +1,200 @@
+/* Copyright 2018 Istio Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Replays a traffic capture through a mixer client, with a simulated Mixer
+// answering each Check with the same cache directives, and reports the
+// cache hit ratios, the remote calls and the CPU time per call.
+// Usage: traffic_replay capture_file [valid_duration_ms] [valid_use_count]
+//            [referenced_attributes]
+// referenced_attributes is a comma separated list of the attributes the
+// simulated policies reference exactly, it defaults to
+// destination.service,source.user,request.method,request.path.
+//
+// The calls are replayed as fast as possible, so valid_duration_ms is in
+// replay time, which is usually much shorter than the capture time.
+
+#include "include/istio/mixerclient/client.h"
+#include "include/istio/mixerclient/traffic_capture.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+#include <ctime>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace std::chrono;
+using ::google::protobuf::util::Status;
+using ::istio::mixer::v1::Attributes;
+using ::istio::mixer::v1::CheckRequest;
+using ::istio::mixer::v1::CheckResponse;
+using ::istio::mixer::v1::ReferencedAttributes;
+using ::istio::mixer::v1::ReportRequest;
+using ::istio::mixer::v1::ReportResponse;
+
+namespace istio {
+namespace mixerclient {
+namespace {
+
+// The cache sizes of the replayed client.
+const int kCheckCacheEntries = 10000;
+const int kQuotaCacheEntries = 10000;
+
+// The cache directives of the simulated Mixer.
+struct MixerDirectives {
+  int valid_duration_ms = 60000;
+  int valid_use_count = 10000;
+  std::vector<std::string> referenced = {
+      "destination.service", "source.user", "request.method", "request.path"};
+};
+
+// Fills the response of the simulated Mixer to a Check of attributes. Like
+// Mixer, it references the attributes missing from the request as absent.
+void FillResponse(const MixerDirectives& directives,
+                  const Attributes& attributes, const CheckRequest& request,
+                  CheckResponse* response) {
+  auto precondition = response->mutable_precondition();
+  precondition->mutable_valid_duration()->set_seconds(
+      directives.valid_duration_ms / 1000);
+  precondition->mutable_valid_duration()->set_nanos(
+      directives.valid_duration_ms % 1000 * 1000000);
+  precondition->set_valid_use_count(directives.valid_use_count);
+  auto referenced = precondition->mutable_referenced_attributes();
+  for (const auto& name : directives.referenced) {
+    referenced->add_words(name);
+    auto match = referenced->add_attribute_matches();
+    match->set_condition(attributes.attributes().count(name) > 0
+                             ? ReferencedAttributes::EXACT
+                             : ReferencedAttributes::ABSENCE);
+    match->set_name(-referenced->words_size());
+  }
+  for (const auto& it : request.quotas()) {
+    auto& result = (*response->mutable_quotas())[it.first];
+    result.set_granted_amount(it.second.amount());
+    *result.mutable_valid_duration() = precondition->valid_duration();
+  }
+}
+
+double Percent(uint64_t part, uint64_t total) {
+  return total == 0 ? 0 : 100.0 * part / total;
+}
+
+int Replay(const std::vector<TrafficCaptureRecord>& records,
+           const MixerDirectives& directives) {
+  // No timers, the batched reports are flushed when full and at the end.
+  MixerClientOptions options(CheckOptions(kCheckCacheEntries),
+                             ReportOptions(),
+                             QuotaOptions(kQuotaCacheEntries, 600000));
+  // The attributes of the Check being replayed.
+  const Attributes* attributes = nullptr;
+  options.env.check_transport = [&directives, &attributes](
+                                    const CheckRequest& request,
+                                    CheckResponse* response,
+                                    DoneFunc on_done) {
+    FillResponse(directives, *attributes, request, response);
+    on_done(Status::OK);
+    return CancelFunc();
+  };
+  uint64_t report_batches = 0;
+  options.env.report_transport = [&report_batches](const ReportRequest&,
+                                                   ReportResponse*,
+                                                   DoneFunc on_done) {
+    ++report_batches;
+    on_done(Status::OK);
+    return CancelFunc();
+  };
+  auto client = CreateMixerClient(options);
+
+  int num_checks = 0, num_reports = 0;
+  TransportCheckFunc transport;
+  auto on_done = [](const CheckResponseInfo&) {};
+  auto start_wall = steady_clock::now();
+  std::clock_t start_cpu = std::clock();
+  for (const auto& record : records) {
+    if (record.type == TrafficCaptureType::CHECK) {
+      attributes = &record.attributes;
+      client->Check(record.attributes, record.quotas, transport, on_done);
+      ++num_checks;
+    } else {
+      client->Report(record.attributes);
+      ++num_reports;
+    }
+  }
+  Statistics stat;
+  client->GetStatistics(&stat);
+  // Destroying the client flushes the batched reports.
+  client.reset();
+  double cpu_ns = (std::clock() - start_cpu) * 1e9 / CLOCKS_PER_SEC;
+  double wall_ns =
+      duration_cast<nanoseconds>(steady_clock::now() - start_wall).count();
+
+  printf("records %zu checks %d reports %d\n", records.size(), num_checks,
+         num_reports);
+  printf("check calls %" PRIu64 " remote %" PRIu64 " hit ratio %.1f%%\n",
+         stat.total_check_calls, stat.total_remote_check_calls,
+         100 - Percent(stat.total_remote_check_calls, stat.total_check_calls));
+  printf("quota calls %" PRIu64 " remote %" PRIu64 " hit ratio %.1f%%\n",
+         stat.total_quota_calls, stat.total_remote_quota_calls,
+         100 - Percent(stat.total_remote_quota_calls, stat.total_quota_calls));
+  printf("report calls %" PRIu64 " remote batches %" PRIu64 "\n",
+         stat.total_report_calls, report_batches);
+  if (!records.empty()) {
+    printf("cpu %.1f ns/call wall %.1f ns/call\n", cpu_ns / records.size(),
+           wall_ns / records.size());
+  }
+  return 0;
+}
+
+}  // namespace
+}  // namespace mixerclient
+}  // namespace istio
+
+int main(int argc, char** argv) {
+  if (argc < 2) {
+    fprintf(stderr,
+            "Usage: %s capture_file [valid_duration_ms] [valid_use_count] "
+            "[referenced_attributes]\n",
+            argv[0]);
+    return 1;
+  }
+  std::vector<::istio::mixerclient::TrafficCaptureRecord> records;
+  if (!::istio::mixerclient::ReadTrafficCapture(argv[1], &records)) {
+    fprintf(stderr, "Failed to read capture %s, %zu records read\n", argv[1],
+            records.size());
+    if (records.empty()) {
+      return 1;
+    }
+  }
+  ::istio::mixerclient::MixerDirectives directives;
+  if (argc > 2) {
+    directives.valid_duration_ms = atoi(argv[2]);
+  }
+  if (argc > 3) {
+    directives.valid_use_count = atoi(argv[3]);
+  }
+  if (argc > 4) {
+    directives.referenced.clear();
+    std::stringstream names(argv[4]);
+    std::string name;
+    while (std::getline(names, name, ',')) {
+      if (!name.empty()) {
+        directives.referenced.push_back(name);
+      }
+    }
+  }
+  return ::istio::mixerclient::Replay(records, directives);
+}
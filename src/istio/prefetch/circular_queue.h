@@ -16,6 +16,7 @@
 #ifndef ISTIO_PREFETCH_CIRCULAR_QUEUE_H_
 #define ISTIO_PREFETCH_CIRCULAR_QUEUE_H_
 
+#include <algorithm>
 #include <functional>
 #include <vector>
 
@@ -24,7 +25,9 @@ namespace prefetch {
 
 // Define a circular FIFO queue
 // Supported classes should support copy operator.
-template <class T>
+// The first N nodes are stored inside the object, the queue only allocates
+// nodes if it grows beyond them.
+template <class T, int N = 0>
 class CircularQueue {
  public:
   explicit CircularQueue(int size);
@@ -41,53 +44,88 @@ class CircularQueue {
   // Calls the fn function for each element from head to tail.
   void Iterate(std::function<bool(T&)> fn);
 
+  // The number of items.
+  int Count() const { return count_; }
+
+  // Allow modifying the item at the index from the head.
+  T* At(int index);
+
+  // The memory size of allocated nodes in bytes, not including the nodes
+  // stored inside the object.
+  size_t ByteSize() const { return heap_nodes_.capacity() * sizeof(T); }
+
  private:
-  std::vector<T> nodes_;
+  // The nodes are referred by nodes_, the object can not be copied.
+  CircularQueue(const CircularQueue&) = delete;
+  CircularQueue& operator=(const CircularQueue&) = delete;
+
+  T inline_nodes_[N > 0 ? N : 1];
+  std::vector<T> heap_nodes_;
+  // Points to inline_nodes_ or heap_nodes_.
+  T* nodes_;
+  int size_;
   int head_;
   int tail_;
   int count_;
 };
 
-template <class T>
-CircularQueue<T>::CircularQueue(int size)
-    : nodes_(size), head_(0), tail_(0), count_(0) {}
-
-template <class T>
-void CircularQueue<T>::Push(const T& v) {
-  if (head_ == tail_ && count_ > 0) {
-    size_t size = nodes_.size();
-    nodes_.resize(size * 2);
-    for (int i = 0; i <= head_; i++) {
-      // Use the copy operator of class T
-      nodes_[size + i] = nodes_[i];
+template <class T, int N>
+CircularQueue<T, N>::CircularQueue(int size)
+    : size_(std::max(size, 1)), head_(0), tail_(0), count_(0) {
+  if (size_ <= N) {
+    nodes_ = inline_nodes_;
+  } else {
+    heap_nodes_.resize(size_);
+    nodes_ = heap_nodes_.data();
+  }
+}
+
+template <class T, int N>
+void CircularQueue<T, N>::Push(const T& v) {
+  if (count_ == size_) {
+    // Use the copy operator of class T, move the items from head to the
+    // beginning.
+    std::vector<T> nodes(size_ * 2);
+    for (int i = 0; i < count_; i++) {
+      nodes[i] = nodes_[(head_ + i) % size_];
     }
-    tail_ += size;
+    heap_nodes_.swap(nodes);
+    nodes_ = heap_nodes_.data();
+    size_ *= 2;
+    head_ = 0;
+    tail_ = count_;
   }
   nodes_[tail_] = v;
-  tail_ = (tail_ + 1) % nodes_.size();
+  tail_ = (tail_ + 1) % size_;
   count_++;
 }
 
-template <class T>
-void CircularQueue<T>::Pop() {
+template <class T, int N>
+void CircularQueue<T, N>::Pop() {
   if (count_ == 0) return;
-  head_ = (head_ + 1) % nodes_.size();
+  head_ = (head_ + 1) % size_;
   count_--;
 }
 
-template <class T>
-T* CircularQueue<T>::Head() {
+template <class T, int N>
+T* CircularQueue<T, N>::Head() {
   if (count_ == 0) return nullptr;
   return &nodes_[head_];
 }
 
-template <class T>
-void CircularQueue<T>::Iterate(std::function<bool(T&)> fn) {
-  if (count_ == 0) return;
+template <class T, int N>
+T* CircularQueue<T, N>::At(int index) {
+  if (index < 0 || index >= count_) return nullptr;
+  return &nodes_[(head_ + index) % size_];
+}
+
+template <class T, int N>
+void CircularQueue<T, N>::Iterate(std::function<bool(T&)> fn) {
+  // Iterate by count, head_ == tail_ if the queue is full.
   int i = head_;
-  while (i != tail_) {
+  for (int n = 0; n < count_; n++) {
     if (!fn(nodes_[i])) return;
-    i = (i + 1) % nodes_.size();
+    i = (i + 1) % size_;
   }
 }
 
@@ -68,6 +68,51 @@ TEST(CircularQueueTest, TestResize2) {
   ASSERT_RESULT(q, {3, 4, 5, 6, 7, 8, 9});
 }
 
+
+TEST(CircularQueueTest, TestFullQueue) {
+  CircularQueue<int> q(3);
+  q.Push(1);
+  q.Push(2);
+  q.Push(3);
+  ASSERT_RESULT(q, {1, 2, 3});
+  ASSERT_EQ(q.Count(), 3);
+}
+
+TEST(CircularQueueTest, TestAt) {
+  CircularQueue<int> q(3);
+  q.Push(1);
+  q.Push(2);
+  q.Pop();
+  q.Push(3);
+  q.Push(4);
+  ASSERT_EQ(*q.At(0), 2);
+  ASSERT_EQ(*q.At(2), 4);
+  ASSERT_EQ(q.At(3), nullptr);
+
+  // After resize.
+  q.Push(5);
+  ASSERT_EQ(*q.At(0), 2);
+  ASSERT_EQ(*q.At(3), 5);
+}
+
+TEST(CircularQueueTest, TestInlineNodes) {
+  CircularQueue<int, 3> q(3);
+  q.Push(1);
+  q.Push(2);
+  q.Pop();
+  q.Push(3);
+  q.Push(4);
+  ASSERT_EQ(q.ByteSize(), 0);
+  ASSERT_EQ(*q.At(0), 2);
+  ASSERT_EQ(*q.At(2), 4);
+
+  // Nodes are allocated after it grows.
+  q.Push(5);
+  ASSERT_EQ(q.ByteSize(), 6 * sizeof(int));
+  ASSERT_EQ(*q.At(0), 2);
+  ASSERT_EQ(*q.At(3), 5);
+}
+
 }  // namespace
 }  // namespace prefetch
 }  // namespace istio
@@ -0,0 +1,73 @@
+/* Copyright 2018 Istio Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ISTIO_PREFETCH_FAST_BUDGET_H_
+#define ISTIO_PREFETCH_FAST_BUDGET_H_
+
+#include <stdint.h>
+#include <atomic>
+
+namespace istio {
+namespace prefetch {
+
+// A budget of units taken without a lock, and revoked with the amount taken
+// from it. The budget, in the high 32 bits, and the taken amount, in the low
+// ones, share one atomic word: revoking the budget collects every unit taken
+// from it, and no unit can be taken from a revoked budget.
+// The word type is a parameter for the tests to interleave the operations.
+template <typename Word>
+class BasicFastBudget {
+ public:
+  BasicFastBudget() : state_(0) {}
+
+  // Set the budget. The previous one must have been revoked.
+  void Grant(int budget) { state_.store(budget * kUnit); }
+
+  // Take one unit. Return false if the budget is exhausted or revoked.
+  bool Take() {
+    int64_t state = state_.load();
+    while (Budget(state) > 0) {
+      // Move one unit from the budget to the taken amount.
+      if (state_.compare_exchange_weak(state, state - kUnit + 1)) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // Revoke the budget, and return the amount taken from it.
+  int Revoke() { return Taken(state_.exchange(0)); }
+
+  // The amount taken from the budget, not revoked yet.
+  int taken() const { return Taken(state_.load()); }
+
+ private:
+  static constexpr int64_t kUnit = int64_t(1) << 32;
+
+  static int Budget(int64_t state) { return static_cast<int>(state >> 32); }
+  static int Taken(int64_t state) {
+    return static_cast<int>(state & (kUnit - 1));
+  }
+
+ protected:
+  Word state_;
+};
+
+using FastBudget = BasicFastBudget<std::atomic<int64_t>>;
+
+}  // namespace prefetch
+}  // namespace istio
+
+#endif  // ISTIO_PREFETCH_FAST_BUDGET_H_
@@ -0,0 +1,161 @@
+/* Copyright 2018 Istio Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/istio/prefetch/fast_budget.h"
+#include "gtest/gtest.h"
+
+#include <atomic>
+#include <functional>
+#include <thread>
+#include <vector>
+
+namespace istio {
+namespace prefetch {
+namespace {
+
+TEST(FastBudgetTest, TestTakeAndRevoke) {
+  FastBudget budget;
+  EXPECT_FALSE(budget.Take());
+
+  budget.Grant(2);
+  EXPECT_TRUE(budget.Take());
+  EXPECT_TRUE(budget.Take());
+  EXPECT_FALSE(budget.Take());
+  EXPECT_EQ(budget.taken(), 2);
+  EXPECT_EQ(budget.Revoke(), 2);
+
+  // Nothing is taken from a revoked budget.
+  budget.Grant(2);
+  EXPECT_TRUE(budget.Take());
+  EXPECT_EQ(budget.Revoke(), 1);
+  EXPECT_FALSE(budget.Take());
+  EXPECT_EQ(budget.taken(), 0);
+  EXPECT_EQ(budget.Revoke(), 0);
+}
+
+// An atomic word running functions before and after its next compare and
+// exchange.
+class InterleavedWord {
+ public:
+  explicit InterleavedWord(int64_t value) : value_(value) {}
+
+  void set_before_exchange(std::function<void()> fn) { before_exchange_ = fn; }
+  void set_after_exchange(std::function<void()> fn) { after_exchange_ = fn; }
+
+  int64_t load() const { return value_.load(); }
+  void store(int64_t value) { value_.store(value); }
+  int64_t exchange(int64_t value) { return value_.exchange(value); }
+  bool compare_exchange_weak(int64_t& expected, int64_t value) {
+    Run(&before_exchange_);
+    bool exchanged = value_.compare_exchange_weak(expected, value);
+    Run(&after_exchange_);
+    return exchanged;
+  }
+
+ private:
+  static void Run(std::function<void()>* fn) {
+    if (*fn) {
+      auto run = *fn;
+      *fn = nullptr;
+      run();
+    }
+  }
+
+  std::atomic<int64_t> value_;
+  std::function<void()> before_exchange_;
+  std::function<void()> after_exchange_;
+};
+
+class InterleavedFastBudget : public BasicFastBudget<InterleavedWord> {
+ public:
+  InterleavedWord& word() { return state_; }
+};
+
+TEST(FastBudgetTest, TestRevokeAfterTake) {
+  InterleavedFastBudget budget;
+  budget.Grant(2);
+  // The budget is revoked right after a check took a unit: the revoke
+  // returns it, nothing is left to be counted later.
+  int revoked = -1;
+  budget.word().set_after_exchange(
+      [&budget, &revoked]() { revoked = budget.Revoke(); });
+  EXPECT_TRUE(budget.Take());
+  EXPECT_EQ(revoked, 1);
+  EXPECT_EQ(budget.taken(), 0);
+  EXPECT_FALSE(budget.Take());
+}
+
+TEST(FastBudgetTest, TestRevokeBetweenReadAndTake) {
+  InterleavedFastBudget budget;
+  budget.Grant(1);
+  // The budget is revoked after a check read it, before it takes a unit.
+  int revoked = -1;
+  budget.word().set_before_exchange(
+      [&budget, &revoked]() { revoked = budget.Revoke(); });
+  EXPECT_FALSE(budget.Take());
+  EXPECT_EQ(revoked, 0);
+  // No unit is left to be counted by a later revoke.
+  EXPECT_EQ(budget.taken(), 0);
+  budget.Grant(1);
+  EXPECT_EQ(budget.Revoke(), 0);
+
+  // Revoked after a unit was taken, it returns it.
+  budget.Grant(2);
+  EXPECT_TRUE(budget.Take());
+  budget.word().set_before_exchange(
+      [&budget, &revoked]() { revoked = budget.Revoke(); });
+  EXPECT_FALSE(budget.Take());
+  EXPECT_EQ(revoked, 1);
+  EXPECT_EQ(budget.taken(), 0);
+}
+
+TEST(FastBudgetTest, TestTakeRacingRevoke) {
+  FastBudget budget;
+  std::atomic<bool> done(false);
+  std::atomic<int> taken(0);
+  std::vector<std::thread> threads;
+  for (int i = 0; i < 4; ++i) {
+    threads.emplace_back([&budget, &done, &taken]() {
+      while (!done) {
+        if (budget.Take()) {
+          ++taken;
+        }
+      }
+    });
+  }
+
+  // Each revoke returns every unit taken from its budget: no unit taken
+  // from a revoked budget is counted after it.
+  int revoked = 0;
+  for (int i = 0; i < 100000; ++i) {
+    budget.Grant(1);
+    int n = budget.Revoke();
+    ASSERT_LE(n, 1);
+    revoked += n;
+    for (int j = 0; j < 100; ++j) {
+      ASSERT_EQ(budget.taken(), 0);
+    }
+  }
+  done = true;
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  EXPECT_EQ(budget.Revoke(), 0);
+  EXPECT_EQ(revoked, taken);
+}
+
+}  // namespace
+}  // namespace prefetch
+}  // namespace istio
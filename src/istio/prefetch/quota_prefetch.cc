@@ -14,30 +14,20 @@
  */
 
 #include "include/istio/prefetch/quota_prefetch.h"
+#include "include/istio/utils/optional_mutex.h"
+#include "include/istio/utils/tracepoint.h"
 #include "src/istio/prefetch/circular_queue.h"
+#include "src/istio/prefetch/fast_budget.h"
 #include "src/istio/prefetch/time_based_counter.h"
 
+#include <atomic>
 #include <mutex>
+#include <queue>
+#include <sstream>
+#include <vector>
 
 using namespace std::chrono;
 
-// Turn this on to debug for quota_prefetch_test.cc
-// Not for debugging in production.
-#if 0
-#include <iostream>
-#define LOG(t)                                                           \
-  std::cerr << "("                                                       \
-            << duration_cast<milliseconds>(t.time_since_epoch()).count() \
-            << "):"
-#else
-// Pipe to stringstream to disable logging.
-#include <sstream>
-std::ostringstream os;
-#define LOG(t) \
-  os.clear();  \
-  os
-#endif
-
 namespace istio {
 namespace prefetch {
 namespace {
@@ -57,6 +47,16 @@ const int kInitQueueSize = 10;
 // TimeBasedCounter window size
 const int kTimeBasedWindowSize = 20;
 
+// Default number of round trips the available amount should cover in the
+// adaptive mode.
+const double kRttSafetyFactor = 2.0;
+
+// Default maximum adaptive window in milliseconds.
+const int kMaxAdaptiveWindowInMs = 10000;
+
+// The weight of a new latency sample in the smoothed latency, as TCP does.
+const double kRttSampleWeight = 0.125;
+
 // Maximum expiration for prefetch amount.
 // It is only used when a prefetch amount is added to the pool
 // before it is granted. Usually is 1 minute.
@@ -76,6 +76,33 @@ class QuotaPrefetchImpl : public QuotaPrefetch {
     Tick expire_time;
     // the always increment ID to detect if a Slot has been re-cycled.
     SlotId id;
+    // true if the amount has been removed from the available total.
+    bool expired;
+  };
+
+  // An expiration of a slot. It is stale if the slot expiration is changed.
+  typedef std::pair<Tick, SlotId> Expiration;
+
+  // The traced event types.
+  enum EventType {
+    PREFETCH = 0,
+    RESPONSE,
+    EXPIRED,
+    REJECTED,
+  };
+
+  // A traced event, formatted only by DumpTrace().
+  struct Event {
+    Tick time;
+    EventType type;
+    // The prefetch, expired or rejected amount, or the requested amount
+    // of a response.
+    int amount;
+    // The granted amount of a response.
+    int resp_amount;
+    // The expiration of a response.
+    milliseconds expiration;
+    SlotId slot_id;
   };
 
   // The mode.
@@ -91,15 +118,52 @@ class QuotaPrefetchImpl : public QuotaPrefetch {
         inflight_count_(0),
         transport_(transport),
         options_(options),
-        next_slot_id_(0) {}
+        next_slot_id_(0),
+        available_(0),
+        rtt_ms_(0),
+        predict_scale_(1.0),
+        last_prefetch_amount_(0),
+        prefetch_calls_(0),
+        granted_amount_(0),
+        used_amount_(0),
+        expired_amount_(0),
+        inflight_checks_(0),
+        inflight_rejections_(0),
+        close_time_(0),
+        trace_(std::max(options.trace_size, 0)),
+        trace_count_(0),
+        fast_deadline_(0) {
+    mutex_.set_enabled(options.thread_safe);
+  }
 
   bool Check(int amount, Tick t) override;
 
+  size_t ByteSize() override;
+
+  void GetStats(Stats* stats) override;
+
+  std::string DumpTrace() override;
+
  private:
+  // Record an event if tracing is enabled.
+  void Trace(EventType type, Tick t, int amount, int resp_amount = 0,
+             milliseconds expiration = milliseconds(0), SlotId slot_id = 0) {
+    if (!trace_.empty()) {
+      trace_[trace_count_++ % trace_.size()] =
+          Event{t, type, amount, resp_amount, expiration, slot_id};
+    }
+  }
+
   // Count available token
   int CountAvailable(Tick t);
   // Check available count is bigger than minimum
   int CheckMinAvailable(int min, Tick t);
+  // The prefetch amount for the pass count in the predict window.
+  int Desired(int pass_count) const;
+  // Update the latency estimate and the predict scale with a sample.
+  void UpdateRtt(milliseconds rtt);
+  // Change the mode, and count the time in the close mode.
+  void SetMode(Mode mode, Tick t);
   // Check to see if need to do a prefetch.
   void AttemptPrefetch(int amount, Tick t);
   // Make a prefetch call.
@@ -111,14 +175,27 @@ class QuotaPrefetchImpl : public QuotaPrefetch {
   int Substract(int delta, Tick t);
   // On quota allocation response.
   void OnResponse(SlotId slot_id, int req_amount, int resp_amount,
-                  milliseconds expiration, Tick t);
+                  milliseconds expiration, Tick sent, Tick t);
   // Find the slot by id.
   Slot* FindSlotById(SlotId id);
-
-  // The mutex guarding all member variables.
-  std::mutex mutex_;
+  // Remove the amounts of expired slots from the available total.
+  void Expire(Tick t);
+  // Take the amount from a slot, and update the available total.
+  void Take(Slot* slot, int amount);
+  // Take one unit from the fast path budget without the lock.
+  bool FastCheck(Tick t);
+  // Revoke the fast path budget, and apply the amount taken by the fast
+  // path to the queue and the counter.
+  void FoldFastPath();
+  // Set the fast path budget to the amount that can be taken without
+  // changing any prefetch decision.
+  void UpdateFastBudget(Tick t);
+
+  // The mutex guarding all member variables, disabled unless thread safe.
+  using Mutex = utils::OptionalMutex<std::mutex>;
+  Mutex mutex_;
   // The FIFO queue to store prefetched amount.
-  CircularQueue<Slot> queue_;
+  CircularQueue<Slot, kInitQueueSize> queue_;
   // The counter to count number of requests in the pass window.
   TimeBasedCounter counter_;
   // The current mode.
@@ -133,29 +210,124 @@ class QuotaPrefetchImpl : public QuotaPrefetch {
   Options options_;
   // next slot id
   SlotId next_slot_id_;
+  // The total available amount of non-expired slots. Expired amounts are
+  // removed lazily by Expire().
+  int available_;
+  // The slot expirations, the earliest one at the top.
+  std::priority_queue<Expiration, std::vector<Expiration>,
+                      std::greater<Expiration>>
+      expirations_;
+  // The smoothed latency of quota allocations in milliseconds.
+  double rtt_ms_;
+  // The ratio of the adaptive window to the predict window. It is 1 if not
+  // adaptive, or before any latency sample.
+  double predict_scale_;
+  // The amount of the last prefetch.
+  int last_prefetch_amount_;
+  // The counters for GetStats().
+  uint64_t prefetch_calls_;
+  uint64_t granted_amount_;
+  uint64_t used_amount_;
+  uint64_t expired_amount_;
+  uint64_t inflight_checks_;
+  uint64_t inflight_rejections_;
+  // The total time in the close mode, and the time the mode was closed.
+  milliseconds close_time_;
+  Tick close_since_;
+  // The ring buffer of traced events, empty if tracing is disabled.
+  std::vector<Event> trace_;
+  // The number of traced events.
+  uint64_t trace_count_;
+
+  // The lock free fast path for checks of amount 1. The slow path grants a
+  // budget from the head slot, fast checks take it with one atomic update
+  // until the deadline. The taken amount is applied by the next slow path,
+  // which revokes the budget with every unit taken from it.
+  FastBudget fast_budget_;
+  std::atomic<Tick::rep> fast_deadline_;
+  // The time the budget was granted.
+  Tick fast_budget_time_;
 };
 
-int QuotaPrefetchImpl::CountAvailable(Tick t) {
-  int avail = 0;
-  queue_.Iterate([&](Slot& slot) -> bool {
-    if (t < slot.expire_time) {
-      avail += slot.available;
+void QuotaPrefetchImpl::Expire(Tick t) {
+  while (!expirations_.empty() && t >= expirations_.top().first) {
+    Slot* slot = FindSlotById(expirations_.top().second);
+    // Skip a stale expiration, or the one of a removed slot.
+    if (slot != nullptr && !slot->expired &&
+        slot->expire_time == expirations_.top().first) {
+      slot->expired = true;
+      available_ -= slot->available;
+      expired_amount_ += slot->available;
     }
-    return true;
-  });
-  return avail;
+    expirations_.pop();
+  }
+}
+
+void QuotaPrefetchImpl::Take(Slot* slot, int amount) {
+  slot->available -= amount;
+  if (!slot->expired) {
+    available_ -= amount;
+  }
+}
+
+int QuotaPrefetchImpl::CountAvailable(Tick t) {
+  Expire(t);
+  return available_;
 }
 
 int QuotaPrefetchImpl::CheckMinAvailable(int min, Tick t) {
-  int avail = 0;
-  queue_.Iterate([&](Slot& slot) -> bool {
-    if (t < slot.expire_time) {
-      avail += slot.available;
-      if (avail >= min) return false;
-    }
-    return true;
-  });
-  return avail >= min;
+  return CountAvailable(t) >= min;
+}
+
+int QuotaPrefetchImpl::Desired(int pass_count) const {
+  return std::max(static_cast<int>(pass_count * predict_scale_),
+                  options_.min_prefetch_amount);
+}
+
+void QuotaPrefetchImpl::UpdateRtt(milliseconds rtt) {
+  if (rtt_ms_ == 0) {
+    rtt_ms_ = rtt.count();
+  } else {
+    rtt_ms_ += kRttSampleWeight * (rtt.count() - rtt_ms_);
+  }
+  if (!options_.adaptive || options_.predict_window.count() <= 0) {
+    return;
+  }
+  // A prefetch is made when avail < desired / 2, so the desired amount
+  // covers twice the window the available amount should cover.
+  double window = 2 * options_.rtt_safety_factor * rtt_ms_;
+  window = std::min(window,
+                    static_cast<double>(options_.max_adaptive_window.count()));
+  predict_scale_ = window / options_.predict_window.count();
+}
+
+void QuotaPrefetchImpl::SetMode(Mode mode, Tick t) {
+  if (mode == mode_) {
+    return;
+  }
+  if (mode == CLOSE) {
+    close_since_ = t;
+  } else {
+    close_time_ += duration_cast<milliseconds>(t - close_since_);
+  }
+  mode_ = mode;
+}
+
+void QuotaPrefetchImpl::GetStats(Stats* stats) {
+  std::lock_guard<Mutex> lock(mutex_);
+  stats->queue_depth = queue_.Count();
+  stats->prefetch_calls = prefetch_calls_;
+  stats->granted_amount = granted_amount_;
+  // Include the amount taken by the fast path but not folded yet.
+  stats->used_amount = used_amount_ + fast_budget_.taken();
+  stats->expired_amount = expired_amount_;
+  stats->inflight_checks = inflight_checks_;
+  stats->inflight_rejections = inflight_rejections_;
+  stats->close_time = close_time_;
+  stats->rtt = milliseconds(static_cast<milliseconds::rep>(rtt_ms_));
+  stats->predict_window = milliseconds(static_cast<milliseconds::rep>(
+      options_.predict_window.count() * predict_scale_));
+  stats->last_prefetch_amount = last_prefetch_amount_;
 }
 
 void QuotaPrefetchImpl::AttemptPrefetch(int amount, Tick t) {
@@ -167,7 +339,7 @@ void QuotaPrefetchImpl::AttemptPrefetch(int amount, Tick t) {
 
   int avail = CountAvailable(t);
   int pass_count = counter_.Count(t);
-  int desired = std::max(pass_count, options_.min_prefetch_amount);
+  int desired = Desired(pass_count);
   if ((avail < desired / 2 && inflight_count_ == 0) || avail < amount) {
     bool use_not_granted = (avail == 0 && mode_ == OPEN);
     Prefetch(std::max(amount, desired), use_not_granted, t);
@@ -181,33 +353,48 @@ void QuotaPrefetchImpl::Prefetch(int req_amount, bool use_not_granted, Tick t) {
     slot_id = Add(req_amount, t + milliseconds(kMaxExpirationInMs));
   }
 
-  LOG(t) << "Prefetch: " << req_amount << ", id: " << slot_id << std::endl;
+  Trace(PREFETCH, t, req_amount, 0, milliseconds(0), slot_id);
 
   last_prefetch_time_ = t;
+  last_prefetch_amount_ = req_amount;
+  ++prefetch_calls_;
   ++inflight_count_;
+  // The send time identifies the call.
+  ISTIO_TRACEPOINT2(quota_prefetch_request, t.time_since_epoch().count(),
+                    req_amount);
   transport_(req_amount,
-             [this, slot_id, req_amount](int resp_amount,
-                                         milliseconds expiration, Tick t1) {
-               OnResponse(slot_id, req_amount, resp_amount, expiration, t1);
+             [this, slot_id, req_amount, t](int resp_amount,
+                                            milliseconds expiration, Tick t1) {
+               ISTIO_TRACEPOINT2(quota_prefetch_response,
+                                 t.time_since_epoch().count(), resp_amount);
+               OnResponse(slot_id, req_amount, resp_amount, expiration, t, t1);
              },
              t);
 }
 
 QuotaPrefetchImpl::Slot* QuotaPrefetchImpl::FindSlotById(SlotId id) {
-  Slot* found = nullptr;
-  queue_.Iterate([&](Slot& slot) -> bool {
-    if (slot.id == id) {
-      found = &slot;
-      return false;
+  // Slots are added with increasing ids, binary search it.
+  int low = 0, high = queue_.Count();
+  while (low < high) {
+    int mid = low + (high - low) / 2;
+    Slot* slot = queue_.At(mid);
+    if (slot->id == id) {
+      return slot;
     }
-    return true;
-  });
-  return found;
+    if (slot->id < id) {
+      low = mid + 1;
+    } else {
+      high = mid;
+    }
+  }
+  return nullptr;
 }
 
 QuotaPrefetchImpl::SlotId QuotaPrefetchImpl::Add(int amount, Tick expire_time) {
   SlotId id = ++next_slot_id_;
-  queue_.Push(Slot{amount, expire_time, id});
+  queue_.Push(Slot{amount, expire_time, id, false});
+  available_ += amount;
+  expirations_.push(Expiration(expire_time, id));
   return id;
 }
 
@@ -217,7 +404,7 @@ int QuotaPrefetchImpl::Substract(int delta, Tick t) {
     if (t < n->expire_time) {
       if (n->available > 0) {
         int d = std::min(n->available, delta);
-        n->available -= d;
+        Take(n, d);
         delta -= d;
       }
       if (n->available > 0) {
@@ -225,9 +412,14 @@ int QuotaPrefetchImpl::Substract(int delta, Tick t) {
       }
     } else {
       if (n->available > 0) {
-        LOG(t) << "Expired:" << n->available << std::endl;
+        Trace(EXPIRED, t, n->available);
+        if (!n->expired) {
+          expired_amount_ += n->available;
+        }
       }
     }
+    // Its amount is not available any more.
+    Take(n, n->available);
     queue_.Pop();
     n = queue_.Head();
   }
@@ -236,13 +428,16 @@ int QuotaPrefetchImpl::Substract(int delta, Tick t) {
 
 void QuotaPrefetchImpl::OnResponse(SlotId slot_id, int req_amount,
                                    int resp_amount, milliseconds expiration,
-                                   Tick t) {
-  std::lock_guard<std::mutex> lock(mutex_);
+                                   Tick sent, Tick t) {
+  std::lock_guard<Mutex> lock(mutex_);
+  FoldFastPath();
   --inflight_count_;
+  // Network failures may be timeouts, not a latency sample.
+  if (resp_amount != -1 && t >= sent) {
+    UpdateRtt(duration_cast<milliseconds>(t - sent));
+  }
 
-  LOG(t) << "OnResponse: req:" << req_amount << ", resp: " << resp_amount
-         << ", expire: " << expiration.count() << ", id: " << slot_id
-         << std::endl;
+  Trace(RESPONSE, t, req_amount, resp_amount, expiration, slot_id);
 
   // resp_amount of -1 indicates any network failures.
   // Use fail open policy to handle any netowrk failures.
@@ -250,6 +445,7 @@ void QuotaPrefetchImpl::OnResponse(SlotId slot_id, int req_amount,
     resp_amount = req_amount;
     expiration = milliseconds(kMaxExpirationInMs);
   }
+  granted_amount_ += std::max(resp_amount, 0);
 
   Slot* slot = nullptr;
   if (slot_id != 0) {
@@ -260,7 +456,7 @@ void QuotaPrefetchImpl::OnResponse(SlotId slot_id, int req_amount,
       // Substract it from its own request node.
       if (slot != nullptr) {
         int d = std::min(slot->available, delta);
-        slot->available -= d;
+        Take(slot, d);
         delta -= d;
       }
       if (delta > 0) {
@@ -271,6 +467,12 @@ void QuotaPrefetchImpl::OnResponse(SlotId slot_id, int req_amount,
     // Adjust the expiration
     if (slot != nullptr && slot->available > 0) {
       slot->expire_time = t + expiration;
+      expirations_.push(Expiration(slot->expire_time, slot->id));
+      if (slot->expired && t < slot->expire_time) {
+        slot->expired = false;
+        available_ += slot->available;
+        expired_amount_ -= slot->available;
+      }
     }
   } else {
     // prefetched amount was NOT added to the pool yet.
@@ -279,16 +481,69 @@ void QuotaPrefetchImpl::OnResponse(SlotId slot_id, int req_amount,
     }
   }
 
-  if (resp_amount == req_amount) {
-    mode_ = OPEN;
-  } else {
-    mode_ = CLOSE;
+  SetMode(resp_amount == req_amount ? OPEN : CLOSE, t);
+  UpdateFastBudget(t);
+}
+
+bool QuotaPrefetchImpl::FastCheck(Tick t) {
+  if (t.time_since_epoch().count() >= fast_deadline_.load()) {
+    return false;
+  }
+  return fast_budget_.Take();
+}
+
+void QuotaPrefetchImpl::FoldFastPath() {
+  int taken = fast_budget_.Revoke();
+  if (taken > 0) {
+    // Apply it as of the budget time, the head slot was not expired then.
+    counter_.Inc(taken, fast_budget_time_);
+    Substract(taken, fast_budget_time_);
+    used_amount_ += taken;
   }
 }
 
+void QuotaPrefetchImpl::UpdateFastBudget(Tick t) {
+  // While a prefetch is inflight, the amount not granted yet may be in the
+  // queue, and prefetch decisions depend on its response.
+  Slot* head = queue_.Head();
+  if (inflight_count_ > 0 || head == nullptr || t >= head->expire_time ||
+      head->available <= 0) {
+    return;
+  }
+  // AttemptPrefetch() prefetches if avail < max(pass * scale, min) / 2, or
+  // avail is less than 1. Taking b units in the same counter slot changes
+  // avail to avail - b, and pass to pass + b. The budget expires with the
+  // counter slot so the counts of fast checks fall in the same counter
+  // slot. It also expires with the first expiring slot, since avail drops
+  // then.
+  int pass = counter_.Count(t);
+  int avail = CountAvailable(t);
+  Tick deadline = counter_.SlotEndTime();
+  if (!expirations_.empty()) {
+    deadline = std::min(deadline, expirations_.top().first);
+  }
+  int budget = std::min(
+      head->available,
+      static_cast<int>((2 * avail - pass * predict_scale_) /
+                       (2 + predict_scale_)));
+  budget = std::min(
+      budget, avail - std::max(1, (options_.min_prefetch_amount + 1) / 2));
+  if (budget <= 0) {
+    return;
+  }
+  fast_budget_time_ = t;
+  fast_deadline_ = deadline.time_since_epoch().count();
+  fast_budget_.Grant(budget);
+}
+
 bool QuotaPrefetchImpl::Check(int amount, Tick t) {
-  std::lock_guard<std::mutex> lock(mutex_);
+  if (amount == 1 && FastCheck(t)) {
+    return true;
+  }
+  std::lock_guard<Mutex> lock(mutex_);
+  FoldFastPath();
 
+  bool inflight = inflight_count_ > 0;
   AttemptPrefetch(amount, t);
   counter_.Inc(amount, t);
   bool ret;
@@ -300,19 +555,71 @@ bool QuotaPrefetchImpl::Check(int amount, Tick t) {
       Substract(amount, t);
     }
   }
-  if (!ret) {
-    LOG(t) << "Rejected amount: " << amount << std::endl;
+  if (ret) {
+    used_amount_ += amount;
+  } else {
+    Trace(REJECTED, t, amount);
+  }
+  if (inflight) {
+    ++inflight_checks_;
+    if (!ret) {
+      ++inflight_rejections_;
+    }
   }
+  UpdateFastBudget(t);
   return ret;
 }
 
+size_t QuotaPrefetchImpl::ByteSize() {
+  std::lock_guard<Mutex> lock(mutex_);
+  return sizeof(*this) + queue_.ByteSize() + counter_.ByteSize() +
+         trace_.capacity() * sizeof(Event);
+}
+
+std::string QuotaPrefetchImpl::DumpTrace() {
+  std::lock_guard<Mutex> lock(mutex_);
+  std::ostringstream os;
+  uint64_t begin = trace_count_ > trace_.size() ? trace_count_ - trace_.size()
+                                                 : 0;
+  for (uint64_t i = begin; i < trace_count_; ++i) {
+    const Event& event = trace_[i % trace_.size()];
+    os << "("
+       << duration_cast<milliseconds>(event.time.time_since_epoch()).count()
+       << "):";
+    switch (event.type) {
+      case PREFETCH:
+        os << "Prefetch: " << event.amount << ", id: " << event.slot_id;
+        break;
+      case RESPONSE:
+        os << "OnResponse: req:" << event.amount
+           << ", resp: " << event.resp_amount
+           << ", expire: " << event.expiration.count()
+           << ", id: " << event.slot_id;
+        break;
+      case EXPIRED:
+        os << "Expired:" << event.amount;
+        break;
+      case REJECTED:
+        os << "Rejected amount: " << event.amount;
+        break;
+    }
+    os << std::endl;
+  }
+  return os.str();
+}
+
 }  // namespace
 
 // Constructor with default values.
 QuotaPrefetch::Options::Options()
     : predict_window(kPredictWindowInMs),
       min_prefetch_amount(kMinPrefetchAmount),
-      close_wait_window(kCloseWaitWindowInMs) {}
+      close_wait_window(kCloseWaitWindowInMs),
+      adaptive(false),
+      rtt_safety_factor(kRttSafetyFactor),
+      max_adaptive_window(kMaxAdaptiveWindowInMs),
+      trace_size(0),
+      thread_safe(true) {}
 
 std::unique_ptr<QuotaPrefetch> QuotaPrefetch::Create(TransportFunc transport,
                                                      const Options& options,
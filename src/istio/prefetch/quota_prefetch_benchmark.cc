@@ -0,0 +1,90 @@
+/* Copyright 2018 Istio Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// A micro-benchmark for QuotaPrefetch::Check against the queue depth.
+// Checks of amount 1 mostly take the lock free fast path, checks of
+// amount 2 always take the locked path. The arguments are the amount and
+// the queue depth.
+
+#include "benchmark/benchmark.h"
+#include "include/istio/prefetch/quota_prefetch.h"
+
+#include <utility>
+#include <vector>
+
+using namespace std::chrono;
+using DoneFunc = ::istio::prefetch::QuotaPrefetch::DoneFunc;
+using Tick = ::istio::prefetch::QuotaPrefetch::Tick;
+
+namespace istio {
+namespace prefetch {
+namespace {
+
+// The amount granted for each prefetch, big enough to keep the queue depth
+// during the benchmark.
+const int kGrantAmount = 1000000;
+
+void BM_QuotaPrefetchCheck(benchmark::State& state) {
+  const int amount = state.range(0);
+  const int queue_depth = state.range(1);
+  // Pending prefetches are fully granted.
+  std::vector<std::pair<int, DoneFunc>> pending;
+  auto grant = [&pending](Tick t) {
+    for (size_t i = 0; i < pending.size(); ++i) {
+      pending[i].second(pending[i].first, milliseconds(600000), t);
+    }
+    pending.clear();
+  };
+  auto transport = [&pending](int amount, DoneFunc fn, Tick t) {
+    pending.push_back(std::make_pair(amount, fn));
+  };
+  Tick t = system_clock::now();
+  auto client = QuotaPrefetch::Create(transport, QuotaPrefetch::Options(), t);
+
+  // The first check adds a not granted amount to the queue. Checks with an
+  // amount bigger than available are rejected, but each of them sends a
+  // prefetch. Each granted prefetch is added to the queue as a new slot.
+  client->Check(1, t);
+  for (int i = 1; i < queue_depth; ++i) {
+    client->Check(kGrantAmount, t);
+  }
+  grant(t);
+
+  int64_t passed = 0;
+  while (state.KeepRunning()) {
+    t += microseconds(10);
+    if (client->Check(amount, t)) {
+      ++passed;
+    }
+    // Grant new prefetches right away.
+    grant(t);
+  }
+  state.counters["passed"] = passed;
+}
+BENCHMARK(BM_QuotaPrefetchCheck)
+    ->ArgPair(1, 1)
+    ->ArgPair(1, 10)
+    ->ArgPair(1, 100)
+    ->ArgPair(1, 1000)
+    ->ArgPair(2, 1)
+    ->ArgPair(2, 10)
+    ->ArgPair(2, 100)
+    ->ArgPair(2, 1000);
+
+}  // namespace
+}  // namespace prefetch
+}  // namespace istio
+
+BENCHMARK_MAIN();
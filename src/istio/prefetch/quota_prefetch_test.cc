@@ -16,8 +16,11 @@
 #include "include/istio/prefetch/quota_prefetch.h"
 #include "gtest/gtest.h"
 
+#include <atomic>
 #include <list>
+#include <thread>
 #include <utility>
+#include <vector>
 
 using namespace std::chrono;
 using Tick = ::istio::prefetch::QuotaPrefetch::Tick;
@@ -417,6 +420,158 @@ TEST_F(QuotaPrefetchTest, TestNotEnoughAmount) {
   delay_.OnTimer(t);
 }
 
+
+TEST_F(QuotaPrefetchTest, TestFastPathFromMultipleThreads) {
+  Tick t;
+  QuotaPrefetch::Options options;
+  rate_server_ = std::unique_ptr<RateServer>(
+      new RollingWindow(100, milliseconds(60000), t));
+  auto run = [this, &t](QuotaPrefetch& client, int num_threads) -> int {
+    std::atomic<int> passed(0);
+    // Responses are delivered between the rounds.
+    for (int round = 0; round < 10; ++round) {
+      std::vector<std::thread> threads;
+      for (int i = 0; i < num_threads; ++i) {
+        threads.emplace_back([&client, &passed, &t, num_threads]() {
+          for (int j = 0; j < 100 / num_threads; ++j) {
+            if (client.Check(1, t)) {
+              ++passed;
+            }
+          }
+        });
+      }
+      for (auto& thread : threads) {
+        thread.join();
+      }
+      t += milliseconds(1000);
+      delay_.OnTimer(t);
+    }
+    return passed;
+  };
+
+  // Concurrent checks pass the same amount as sequential ones.
+  auto client1 = QuotaPrefetch::Create(GetTransportFunc(), options, t);
+  int expected = run(*client1, 1);
+  EXPECT_LT(expected, 1000);
+  t += milliseconds(60000);
+  auto client2 = QuotaPrefetch::Create(GetTransportFunc(), options, t);
+  EXPECT_EQ(run(*client2, 4), expected);
+}
+
+TEST_F(QuotaPrefetchTest, TestAdaptiveWindow) {
+  Tick t;
+  rate_server_ = std::unique_ptr<RateServer>(
+      new RollingWindow(1000000, milliseconds(60000), t));
+  delay_.set_delay(milliseconds(10));
+  int max_amount = 0;
+  auto transport = GetTransportFunc();
+  auto run = [this, &t](QuotaPrefetch& client) -> int {
+    // 1000 rps for one second.
+    int passed = 0;
+    for (int i = 0; i < 1000; ++i) {
+      t += milliseconds(1);
+      if (client.Check(1, t)) {
+        ++passed;
+      }
+      delay_.OnTimer(t);
+    }
+    return passed;
+  };
+  auto record = [&max_amount, transport](int amount, DoneFunc fn, Tick t) {
+    max_amount = std::max(max_amount, amount);
+    transport(amount, fn, t);
+  };
+
+  QuotaPrefetch::Options options;
+  auto client = QuotaPrefetch::Create(record, options, t);
+  EXPECT_EQ(run(*client), 1000);
+  // It prefetches for the requests in a second.
+  EXPECT_GT(max_amount, 500);
+
+  t += milliseconds(60000);
+  max_amount = 0;
+  options.adaptive = true;
+  client = QuotaPrefetch::Create(record, options, t);
+  EXPECT_EQ(run(*client), 1000);
+  // It prefetches for the requests in 2 * 2 round trips.
+  EXPECT_LE(max_amount, 50);
+
+  QuotaPrefetch::Stats stats;
+  client->GetStats(&stats);
+  EXPECT_EQ(stats.rtt.count(), 10);
+  EXPECT_EQ(stats.predict_window.count(), 40);
+  EXPECT_GT(stats.last_prefetch_amount, 0);
+}
+
+TEST_F(QuotaPrefetchTest, TestTrace) {
+  Tick t;
+  rate_server_ =
+      std::unique_ptr<RateServer>(new RollingWindow(5, milliseconds(1000), t));
+  QuotaPrefetch::Options options;
+  auto client = QuotaPrefetch::Create(GetTransportFunc(), options, t);
+  client->Check(1, t);
+  delay_.OnTimer(t);
+  // Disabled by default.
+  EXPECT_EQ(client->DumpTrace(), "");
+
+  options.trace_size = 2;
+  rate_server_ =
+      std::unique_ptr<RateServer>(new RollingWindow(5, milliseconds(1000), t));
+  client = QuotaPrefetch::Create(GetTransportFunc(), options, t);
+  // Prefetch 10, only 5 are granted.
+  EXPECT_TRUE(client->Check(1, t));
+  delay_.OnTimer(t);
+  EXPECT_EQ(client->DumpTrace(),
+            "(0):Prefetch: 10, id: 1\n"
+            "(0):OnResponse: req:10, resp: 5, expire: 1000, id: 1\n");
+
+  // Only the last 2 events are kept.
+  EXPECT_FALSE(client->Check(5, t));
+  EXPECT_EQ(client->DumpTrace(),
+            "(0):OnResponse: req:10, resp: 5, expire: 1000, id: 1\n"
+            "(0):Rejected amount: 5\n");
+}
+
+TEST_F(QuotaPrefetchTest, TestStats) {
+  Tick t;
+  rate_server_ =
+      std::unique_ptr<RateServer>(new RollingWindow(5, milliseconds(1000), t));
+  auto client =
+      QuotaPrefetch::Create(GetTransportFunc(), QuotaPrefetch::Options(), t);
+
+  // Prefetch 10, only 5 are granted.
+  EXPECT_TRUE(client->Check(1, t));
+  delay_.OnTimer(t);
+
+  // The 4 left are expired, the new prefetch is in flight.
+  delay_.set_delay(milliseconds(10));
+  t += milliseconds(2000);
+  EXPECT_FALSE(client->Check(1, t));
+  t += milliseconds(10);
+  delay_.OnTimer(t);
+
+  // Pass with the 5 granted. The second check prefetches 10, all of them
+  // are granted.
+  rate_server_ = std::unique_ptr<RateServer>(
+      new RollingWindow(100, milliseconds(1000), t));
+  t += milliseconds(500);
+  EXPECT_TRUE(client->Check(1, t));
+  EXPECT_TRUE(client->Check(1, t));
+  t += milliseconds(10);
+  delay_.OnTimer(t);
+
+  QuotaPrefetch::Stats stats;
+  client->GetStats(&stats);
+  EXPECT_EQ(stats.prefetch_calls, 3);
+  EXPECT_EQ(stats.granted_amount, 20);
+  EXPECT_EQ(stats.used_amount, 3);
+  EXPECT_EQ(stats.expired_amount, 4);
+  EXPECT_EQ(stats.inflight_checks, 0);
+  // Closed after the first response, opened after the third one.
+  EXPECT_EQ(stats.close_time.count(), 2520);
+  EXPECT_EQ(stats.queue_depth, 2);
+}
+
 }  // namespace
 }  // namespace prefetch
 }  // namespace istio
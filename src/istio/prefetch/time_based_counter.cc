@@ -22,15 +22,23 @@ namespace prefetch {
 
 TimeBasedCounter::TimeBasedCounter(int window_size, milliseconds duration,
                                    Tick t)
-    : slots_(window_size),
+    : window_size_(window_size),
       slot_duration_(duration / window_size),
       count_(0),
       tail_(0),
-      last_time_(t) {}
+      last_time_(t) {
+  if (window_size <= kInlineSlots) {
+    slots_ = inline_slots_;
+  } else {
+    heap_slots_.resize(window_size);
+    slots_ = heap_slots_.data();
+  }
+  Clear(t);
+}
 
 void TimeBasedCounter::Clear(Tick t) {
   last_time_ = t;
-  for (size_t i = 0; i < slots_.size(); i++) {
+  for (uint32_t i = 0; i < window_size_; i++) {
     slots_[i] = 0;
   }
   tail_ = count_ = 0;
@@ -39,13 +47,13 @@ void TimeBasedCounter::Clear(Tick t) {
 void TimeBasedCounter::Roll(Tick t) {
   auto d = duration_cast<milliseconds>(t - last_time_);
   uint32_t n = uint32_t(d.count() / slot_duration_.count());
-  if (n >= slots_.size()) {
+  if (n >= window_size_) {
     Clear(t);
     return;
   }
 
   for (uint32_t i = 0; i < n; i++) {
-    tail_ = (tail_ + 1) % slots_.size();
+    tail_ = (tail_ + 1) % window_size_;
     count_ -= slots_[tail_];
     slots_[tail_] = 0;
     last_time_ += slot_duration_;
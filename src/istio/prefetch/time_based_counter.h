@@ -16,6 +16,7 @@
 #ifndef ISTIO_PREFETCH_TIME_BASED_COUNTER_H_
 #define ISTIO_PREFETCH_TIME_BASED_COUNTER_H_
 
+#include <stdint.h>
 #include <chrono>
 #include <vector>
 
@@ -41,13 +42,31 @@ class TimeBasedCounter {
   // Get the count.
   int Count(Tick t);
 
+  // The end time of the current slot, as of the last Inc() or Count().
+  Tick SlotEndTime() const { return last_time_ + slot_duration_; }
+
+  // The memory size of allocated slots in bytes, not including the slots
+  // stored inside the object.
+  size_t ByteSize() const { return heap_slots_.capacity() * sizeof(int); }
+
  private:
+  // The slots are referred by slots_, the object can not be copied.
+  TimeBasedCounter(const TimeBasedCounter&) = delete;
+  TimeBasedCounter& operator=(const TimeBasedCounter&) = delete;
+
   // Clear the whole window
   void Clear(Tick t);
   // Roll the window
   void Roll(Tick t);
 
-  std::vector<int> slots_;
+  // The window sizes up to it are stored inside the object.
+  static const int kInlineSlots = 20;
+
+  int inline_slots_[kInlineSlots];
+  std::vector<int> heap_slots_;
+  // Points to inline_slots_ or heap_slots_.
+  int* slots_;
+  uint32_t window_size_;
   std::chrono::milliseconds slot_duration_;
   int count_;
   int tail_;
@@ -0,0 +1,151 @@
+/* Copyright 2018 Istio Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// A micro-benchmark for the quota ConfigParser with a QuotaSpec of many
+// rules mixing exact, prefix and regex clauses, many of them shared across
+// rules. Measures building the parser, and GetRequirements for requests
+// matching a few rules and for requests matching none. The argument is the
+// number of rules.
+
+#include "benchmark/benchmark.h"
+#include "include/istio/quota_config/config_parser.h"
+#include "include/istio/utils/attributes_builder.h"
+
+#include <string>
+#include <vector>
+
+using ::istio::mixer::v1::Attributes;
+using ::istio::mixer::v1::config::client::QuotaSpec;
+using ::istio::mixer::v1::config::client::StringMatch;
+using ::istio::utils::AttributesBuilder;
+
+namespace istio {
+namespace quota_config {
+namespace {
+
+// The number of services, each rule matches one of them.
+const int kNumServices = 10;
+
+void AddClause(const std::string& key, StringMatch::MatchTypeCase type,
+               const std::string& pattern,
+               ::istio::mixer::v1::config::client::AttributeMatch* match) {
+  StringMatch& value = (*match->mutable_clause())[key];
+  switch (type) {
+    case StringMatch::kExact:
+      value.set_exact(pattern);
+      break;
+    case StringMatch::kPrefix:
+      value.set_prefix(pattern);
+      break;
+    default:
+      value.set_regex(pattern);
+      break;
+  }
+}
+
+QuotaSpec BuildSpec(int num_rules) {
+  QuotaSpec spec;
+  const char* methods[] = {"GET", "POST", "PUT", "DELETE"};
+  for (int i = 0; i < num_rules; ++i) {
+    auto* rule = spec.add_rules();
+    auto* match = rule->add_match();
+    AddClause("destination.service", StringMatch::kExact,
+              "svc" + std::to_string(i % kNumServices) + ".default", match);
+    AddClause("request.http_method", StringMatch::kExact, methods[i % 4],
+              match);
+    switch (i % 3) {
+      case 0:
+        AddClause("request.path", StringMatch::kPrefix,
+                  "/v1/resource" + std::to_string(i), match);
+        break;
+      case 1:
+        AddClause("request.path", StringMatch::kRegex,
+                  "/v1/resource" + std::to_string(i) + "/[0-9]+", match);
+        break;
+      default:
+        AddClause("request.headers.user", StringMatch::kExact,
+                  "user" + std::to_string(i), match);
+        break;
+    }
+    // A second match shared by all rules of a service.
+    AddClause("source.user", StringMatch::kPrefix,
+              "admin" + std::to_string(i % kNumServices),
+              rule->add_match());
+    auto* quota = rule->add_quotas();
+    quota->set_quota("quota" + std::to_string(i));
+    quota->set_charge(1);
+  }
+  return spec;
+}
+
+Attributes BuildRequest(const std::string& service, const std::string& method,
+                        const std::string& path) {
+  Attributes attributes;
+  AttributesBuilder builder(&attributes);
+  builder.AddString("destination.service", service);
+  builder.AddString("request.http_method", method);
+  builder.AddString("request.path", path);
+  builder.AddString("request.headers.user", "user");
+  builder.AddString("source.user", "user@example.com");
+  return attributes;
+}
+
+void BM_BuildParser(benchmark::State& state) {
+  QuotaSpec spec = BuildSpec(state.range(0));
+  while (state.KeepRunning()) {
+    auto parser = ConfigParser::Create(spec);
+  }
+}
+BENCHMARK(BM_BuildParser)->Arg(100)->Arg(1000)->Unit(benchmark::kMillisecond);
+
+void RunGetRequirements(benchmark::State& state,
+                        const std::vector<Attributes>& requests) {
+  auto parser = ConfigParser::Create(BuildSpec(state.range(0)));
+  size_t num_requirements = 0;
+  std::vector<Requirement> results;
+  size_t i = 0;
+  while (state.KeepRunning()) {
+    results.clear();
+    parser->GetRequirements(requests[i++ % requests.size()], &results);
+    num_requirements += results.size();
+  }
+  state.counters["requirements"] =
+      num_requirements * 1.0 / state.iterations();
+}
+
+void BM_GetRequirementsMatched(benchmark::State& state) {
+  const char* methods[] = {"GET", "POST", "PUT", "DELETE"};
+  std::vector<Attributes> requests;
+  for (int i = 0; i < 30 && i < state.range(0); ++i) {
+    requests.push_back(BuildRequest(
+        "svc" + std::to_string(i % kNumServices) + ".default", methods[i % 4],
+        "/v1/resource" + std::to_string(i) + "/42"));
+  }
+  RunGetRequirements(state, requests);
+}
+BENCHMARK(BM_GetRequirementsMatched)->Arg(100)->Arg(1000);
+
+void BM_GetRequirementsUnmatched(benchmark::State& state) {
+  RunGetRequirements(
+      state, {BuildRequest("other.default", "GET", "/v1/resource1/42"),
+              BuildRequest("svc1.default", "PATCH", "/healthz")});
+}
+BENCHMARK(BM_GetRequirementsUnmatched)->Arg(100)->Arg(1000);
+
+}  // namespace
+}  // namespace quota_config
+}  // namespace istio
+
+BENCHMARK_MAIN();
@@ -18,89 +18,168 @@
 using ::istio::mixer::v1::Attributes;
 using ::istio::mixer::v1::Attributes_AttributeValue;
 using ::istio::mixer::v1::config::client::AttributeMatch;
-using ::istio::mixer::v1::config::client::QuotaRule;
 using ::istio::mixer::v1::config::client::QuotaSpec;
 using ::istio::mixer::v1::config::client::StringMatch;
 
 namespace istio {
 namespace quota_config {
 
-ConfigParserImpl::ConfigParserImpl(const QuotaSpec& spec_pb)
-    : spec_pb_(spec_pb) {
-  // Build regex map
-  for (const auto& rule : spec_pb_.rules()) {
+struct ConfigParserImpl::State {
+  State(const Attributes& attributes, size_t num_attributes,
+        size_t num_clauses)
+      : attributes(attributes),
+        values_found(num_attributes, false),
+        values(num_attributes, nullptr),
+        results(num_clauses, kUnknown) {}
+
+  enum Result : char { kUnknown, kTrue, kFalse };
+
+  const Attributes& attributes;
+  // If the value of an attribute has been looked up, nullptr if it does not
+  // exist with string type.
+  std::vector<bool> values_found;
+  std::vector<const std::string*> values;
+  std::vector<Result> results;
+};
+
+ConfigParserImpl::ConfigParserImpl(const QuotaSpec& spec_pb) {
+  for (const auto& rule : spec_pb.rules()) {
+    Rule compiled;
     for (const auto& match : rule.match()) {
+      std::vector<int> clauses;
       for (const auto& map_it : match.clause()) {
-        const auto& match = map_it.second;
-        if (match.match_type_case() == StringMatch::kRegex) {
-          regex_map_[match.regex()] = std::regex(match.regex());
-        }
+        clauses.push_back(AddClause(map_it.first, map_it.second));
       }
+      compiled.matches.push_back(std::move(clauses));
+    }
+    for (const auto& quota : rule.quotas()) {
+      compiled.requirements.push_back({quota.quota(), quota.charge()});
     }
+    rules_.push_back(std::move(compiled));
   }
 }
 
+int ConfigParserImpl::AddClause(const std::string& name,
+                                const StringMatch& match) {
+  int attribute = 0;
+  while (attribute < static_cast<int>(attribute_names_.size()) &&
+         attribute_names_[attribute] != name) {
+    ++attribute;
+  }
+  if (attribute == static_cast<int>(attribute_names_.size())) {
+    attribute_names_.push_back(name);
+  }
+
+  Clause clause{attribute, match.match_type_case(), "", nullptr};
+  switch (match.match_type_case()) {
+    case StringMatch::kExact:
+      clause.pattern = match.exact();
+      break;
+    case StringMatch::kPrefix:
+      clause.pattern = match.prefix();
+      break;
+    case StringMatch::kRegex: {
+      clause.pattern = match.regex();
+      auto it = regex_map_.find(clause.pattern);
+      if (it == regex_map_.end()) {
+        it = regex_map_
+                 .emplace(clause.pattern, std::regex(clause.pattern))
+                 .first;
+      }
+      clause.regex = &it->second;
+    } break;
+    default:
+      break;
+  }
+
+  for (size_t i = 0; i < clauses_.size(); ++i) {
+    const Clause& other = clauses_[i];
+    if (other.attribute == clause.attribute && other.type == clause.type &&
+        other.pattern == clause.pattern) {
+      return i;
+    }
+  }
+  clauses_.push_back(std::move(clause));
+  return clauses_.size() - 1;
+}
+
 void ConfigParserImpl::GetRequirements(
     const Attributes& attributes, std::vector<Requirement>* results) const {
-  for (const auto& rule : spec_pb_.rules()) {
+  State state(attributes, attribute_names_.size(), clauses_.size());
+  for (const auto& rule : rules_) {
     bool matched = false;
-    for (const auto& match : rule.match()) {
-      if (MatchAttributes(match, attributes)) {
-        matched = true;
+    for (const auto& match : rule.matches) {
+      matched = true;
+      for (int clause : match) {
+        if (!MatchClause(clause, &state)) {
+          matched = false;
+          break;
+        }
+      }
+      if (matched) {
         break;
       }
     }
     // If not match, applies to all requests.
-    if (matched || rule.match_size() == 0) {
-      for (const auto& quota : rule.quotas()) {
-        results->push_back({quota.quota(), quota.charge()});
-      }
+    if (matched || rule.matches.empty()) {
+      results->insert(results->end(), rule.requirements.begin(),
+                      rule.requirements.end());
     }
   }
 }
 
-bool ConfigParserImpl::MatchAttributes(const AttributeMatch& match,
-                                       const Attributes& attributes) const {
-  const auto& attributes_map = attributes.attributes();
-  for (const auto& map_it : match.clause()) {
-    // map is attribute_name to StringMatch.
-    const std::string& name = map_it.first;
-    const auto& match = map_it.second;
+bool ConfigParserImpl::GetUnconditionalRequirements(
+    std::vector<Requirement>* results) const {
+  for (const auto& rule : rules_) {
+    if (!rule.matches.empty()) {
+      return false;
+    }
+  }
+  for (const auto& rule : rules_) {
+    results->insert(results->end(), rule.requirements.begin(),
+                    rule.requirements.end());
+  }
+  return true;
+}
 
+bool ConfigParserImpl::MatchClause(int index, State* state) const {
+  if (state->results[index] != State::kUnknown) {
+    return state->results[index] == State::kTrue;
+  }
+
+  const Clause& clause = clauses_[index];
+  if (!state->values_found[clause.attribute]) {
+    state->values_found[clause.attribute] = true;
     // Check if required attribure exists with string type.
-    const auto& it = attributes_map.find(name);
-    if (it == attributes_map.end() ||
-        it->second.value_case() != Attributes_AttributeValue::kStringValue) {
-      return false;
+    const auto& attributes_map = state->attributes.attributes();
+    const auto& it = attributes_map.find(attribute_names_[clause.attribute]);
+    if (it != attributes_map.end() &&
+        it->second.value_case() == Attributes_AttributeValue::kStringValue) {
+      state->values[clause.attribute] = &it->second.string_value();
     }
-    const std::string& value = it->second.string_value();
+  }
 
-    switch (match.match_type_case()) {
+  const std::string* value = state->values[clause.attribute];
+  bool matched = value != nullptr;
+  if (matched) {
+    switch (clause.type) {
       case StringMatch::kExact:
-        if (value != match.exact()) {
-          return false;
-        }
+        matched = *value == clause.pattern;
         break;
       case StringMatch::kPrefix:
-        if (value.length() < match.prefix().length() ||
-            value.compare(0, match.prefix().length(), match.prefix()) != 0) {
-          return false;
-        }
+        matched = value->compare(0, clause.pattern.length(),
+                                 clause.pattern) == 0;
+        break;
+      case StringMatch::kRegex:
+        matched = std::regex_match(*value, *clause.regex);
         break;
-      case StringMatch::kRegex: {
-        const auto& reg_it = regex_map_.find(match.regex());
-        // All regex should be pre-build.
-        GOOGLE_CHECK(reg_it != regex_map_.end());
-        if (!std::regex_match(value, reg_it->second)) {
-          return false;
-        }
-      } break;
       default:
         // match_type not set case, an empty StringMatch, ignore it.
         break;
     }
   }
-  return true;
+  state->results[index] = matched ? State::kTrue : State::kFalse;
+  return matched;
 }
 
 std::unique_ptr<ConfigParser> ConfigParser::Create(
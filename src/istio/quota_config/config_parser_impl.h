@@ -19,12 +19,16 @@
 #include "include/istio/quota_config/config_parser.h"
 
 #include <regex>
+#include <string>
 #include <unordered_map>
+#include <vector>
 
 namespace istio {
 namespace quota_config {
 
-// An object to implement ConfigParser interface.
+// An object to implement ConfigParser interface. The spec is compiled into
+// clauses deduplicated across its rules, so each attribute is looked up
+// and each distinct clause evaluated at most once per request.
 class ConfigParserImpl : public ConfigParser {
  public:
   ConfigParserImpl(
@@ -34,13 +38,44 @@ class ConfigParserImpl : public ConfigParser {
   void GetRequirements(const ::istio::mixer::v1::Attributes& attributes,
                        std::vector<Requirement>* results) const override;
 
+  bool GetUnconditionalRequirements(
+      std::vector<Requirement>* results) const override;
+
  private:
-  // Check one attribute match.
-  bool MatchAttributes(
-      const ::istio::mixer::v1::config::client::AttributeMatch& match,
-      const ::istio::mixer::v1::Attributes& attributes) const;
-  // the spec proto.
-  const ::istio::mixer::v1::config::client::QuotaSpec& spec_pb_;
+  // A string match on the value of an attribute.
+  struct Clause {
+    // The index of the attribute name in attribute_names_.
+    int attribute;
+    ::istio::mixer::v1::config::client::StringMatch::MatchTypeCase type;
+    std::string pattern;
+    // The compiled pattern of a regex match.
+    const std::regex* regex;
+  };
+
+  // A rule applies its quotas if all clauses of any of its matches are
+  // true, or if it has no match.
+  struct Rule {
+    // The clause indexes of each match.
+    std::vector<std::vector<int>> matches;
+    std::vector<Requirement> requirements;
+  };
+
+  // The per-request state of the attribute values and clause results.
+  struct State;
+
+  // Returns the index of a clause, adding it if it is new.
+  int AddClause(const std::string& name,
+                const ::istio::mixer::v1::config::client::StringMatch& match);
+
+  // Evaluates a clause, or returns its result evaluated for the request.
+  bool MatchClause(int index, State* state) const;
+
+  // The attribute names used by the clauses.
+  std::vector<std::string> attribute_names_;
+  // The distinct clauses of all rules.
+  std::vector<Clause> clauses_;
+  // The compiled rules.
+  std::vector<Rule> rules_;
 
   // Stored regex objects.
   std::unordered_map<std::string, std::regex> regex_map_;
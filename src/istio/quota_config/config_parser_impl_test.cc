@@ -89,6 +89,51 @@ rules {
 }
 )";
 
+const char kQuotaSharedClauses[] = R"(
+rules {
+  match {
+    clause {
+      key: "request.path"
+      value {
+        regex: "/shelves/.*"
+      }
+    }
+  }
+  quotas {
+    quota: "quota1"
+    charge: 1
+  }
+}
+rules {
+  match {
+    clause {
+      key: "request.http_method"
+      value {
+        exact: "POST"
+      }
+    }
+  }
+  match {
+    clause {
+      key: "request.path"
+      value {
+        regex: "/shelves/.*"
+      }
+    }
+    clause {
+      key: "request.http_method"
+      value {
+        exact: "GET"
+      }
+    }
+  }
+  quotas {
+    quota: "quota2"
+    charge: 2
+  }
+}
+)";
+
 // Define similar data structure for quota requirement
 // But this one has operator== for comparison so that EXPECT_EQ
 // can directly use its vector.
@@ -125,12 +170,22 @@ TEST(ConfigParserTest, TestEmptyMatch) {
   // If match clause is empty, it matches all requests.
   ASSERT_EQ(GetRequirements(*parser, attributes),
             QV({{"quota1", 1}, {"quota2", 2}}));
+
+  // They are the unconditional requirements.
+  std::vector<Requirement> requirements;
+  ASSERT_TRUE(parser->GetUnconditionalRequirements(&requirements));
+  ASSERT_EQ(requirements.size(), 2);
+  EXPECT_EQ(requirements[1].quota, "quota2");
+  EXPECT_EQ(requirements[1].charge, 2);
 }
 
 TEST(ConfigParserTest, TestMatch) {
   QuotaSpec quota_spec;
   ASSERT_TRUE(TextFormat::ParseFromString(kQuotaMatch, &quota_spec));
   auto parser = ConfigParser::Create(quota_spec);
+  std::vector<Requirement> requirements;
+  EXPECT_FALSE(parser->GetUnconditionalRequirements(&requirements));
+  EXPECT_TRUE(requirements.empty());
 
   Attributes attributes;
   AttributesBuilder builder(&attributes);
@@ -171,6 +226,31 @@ TEST(ConfigParserTest, TestRegexMatch) {
   ASSERT_EQ(GetRequirements(*parser, attributes), QV({{"quota-name", 1}}));
 }
 
+TEST(ConfigParserTest, TestSharedClauses) {
+  QuotaSpec quota_spec;
+  ASSERT_TRUE(TextFormat::ParseFromString(kQuotaSharedClauses, &quota_spec));
+  auto parser = ConfigParser::Create(quota_spec);
+
+  Attributes attributes;
+  AttributesBuilder builder(&attributes);
+  builder.AddString("request.path", "/shelves/1");
+  ASSERT_EQ(GetRequirements(*parser, attributes), QV({{"quota1", 1}}));
+
+  // The second match of the second rule.
+  builder.AddString("request.http_method", "GET");
+  ASSERT_EQ(GetRequirements(*parser, attributes),
+            QV({{"quota1", 1}, {"quota2", 2}}));
+
+  // The first match of the second rule.
+  builder.AddString("request.http_method", "POST");
+  builder.AddString("request.path", "/books");
+  ASSERT_EQ(GetRequirements(*parser, attributes), QV({{"quota2", 2}}));
+
+  // Not a string attribute.
+  builder.AddInt64("request.http_method", 1);
+  ASSERT_EQ(GetRequirements(*parser, attributes), QV());
+}
+
 }  // namespace
 }  // namespace quota_config
 }  // namespace istio
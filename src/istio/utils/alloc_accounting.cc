@@ -0,0 +1,111 @@
+/* Copyright 2018 Istio Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "include/istio/utils/alloc_accounting.h"
+
+#ifdef ISTIO_ALLOC_ACCOUNTING
+
+#include <stdlib.h>
+#include <new>
+
+#ifdef ISTIO_ALLOC_ACCOUNTING_MALLOC_HOOK
+#include "gperftools/malloc_hook.h"
+#endif
+
+namespace istio {
+namespace utils {
+namespace {
+
+// Thread local so that counting needs neither atomics nor locks. Both
+// are trivially constructed, they can be used by operator new at any time.
+thread_local AllocTag current_tag = AllocTag::UNTAGGED;
+thread_local AllocStats thread_stats[kNumAllocTags];
+
+void Count(size_t size) {
+  AllocStats& stats = thread_stats[static_cast<int>(current_tag)];
+  ++stats.allocations;
+  stats.bytes += size;
+}
+
+#ifdef ISTIO_ALLOC_ACCOUNTING_MALLOC_HOOK
+
+// tcmalloc calls it for each allocation, of operator new and malloc.
+void NewHook(const void* ptr, size_t size) { Count(size); }
+
+const bool new_hook_added = MallocHook::AddNewHook(&NewHook);
+
+#else
+
+void* Allocate(size_t size) {
+  Count(size);
+  // malloc(0) may return nullptr, operator new must not.
+  return malloc(size == 0 ? 1 : size);
+}
+
+#endif  // ISTIO_ALLOC_ACCOUNTING_MALLOC_HOOK
+
+}  // namespace
+
+ScopedAllocTag::ScopedAllocTag(AllocTag tag) : prev_(current_tag) {
+  current_tag = tag;
+  ++thread_stats[static_cast<int>(tag)].scopes;
+}
+
+ScopedAllocTag::~ScopedAllocTag() { current_tag = prev_; }
+
+void GetThreadAllocStats(AllocTag tag, AllocStats* stats) {
+  *stats = thread_stats[static_cast<int>(tag)];
+}
+
+}  // namespace utils
+}  // namespace istio
+
+#ifndef ISTIO_ALLOC_ACCOUNTING_MALLOC_HOOK
+
+using ::istio::utils::Allocate;
+
+void* operator new(size_t size) {
+  void* p = Allocate(size);
+  if (p == nullptr) {
+    throw std::bad_alloc();
+  }
+  return p;
+}
+
+void* operator new[](size_t size) { return operator new(size); }
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+  return Allocate(size);
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) noexcept {
+  return Allocate(size);
+}
+
+void operator delete(void* p) noexcept { free(p); }
+
+void operator delete[](void* p) noexcept { free(p); }
+
+void operator delete(void* p, const std::nothrow_t&) noexcept { free(p); }
+
+void operator delete[](void* p, const std::nothrow_t&) noexcept { free(p); }
+
+void operator delete(void* p, size_t) noexcept { free(p); }
+
+void operator delete[](void* p, size_t) noexcept { free(p); }
+
+#endif  // ISTIO_ALLOC_ACCOUNTING_MALLOC_HOOK
+
+#endif  // ISTIO_ALLOC_ACCOUNTING
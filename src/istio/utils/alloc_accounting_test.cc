@@ -0,0 +1,110 @@
+/* Copyright 2018 Istio Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "include/istio/utils/alloc_accounting.h"
+
+#include <stdlib.h>
+#include <memory>
+#include <thread>
+
+#include "gtest/gtest.h"
+
+namespace istio {
+namespace utils {
+namespace {
+
+// Keeps the compiler from eliding the allocations of the tests.
+const void* volatile escaped;
+void Escape(const void* p) { escaped = p; }
+
+TEST(AllocAccountingTest, TestScopedTags) {
+  AllocStats before, after, report;
+  GetThreadAllocStats(AllocTag::MIXER_CHECK, &before);
+  {
+    ScopedAllocTag tag(AllocTag::MIXER_CHECK);
+    std::unique_ptr<char[]> data(new char[100]);
+    Escape(data.get());
+    {
+      // The innermost tag is used.
+      ScopedAllocTag inner(AllocTag::MIXER_REPORT);
+      std::unique_ptr<int> value(new int(1));
+      Escape(value.get());
+    }
+    std::unique_ptr<int> value(new int(2));
+    Escape(value.get());
+  }
+  std::unique_ptr<int> untagged(new int(3));
+  Escape(untagged.get());
+  GetThreadAllocStats(AllocTag::MIXER_CHECK, &after);
+  GetThreadAllocStats(AllocTag::MIXER_REPORT, &report);
+
+  EXPECT_EQ(after.scopes - before.scopes, 1);
+  EXPECT_EQ(after.allocations - before.allocations, 2);
+  EXPECT_EQ(after.bytes - before.bytes, 100 + sizeof(int));
+  EXPECT_GE(report.allocations, 1);
+}
+
+TEST(AllocAccountingTest, TestMalloc) {
+  AllocStats before, after;
+  GetThreadAllocStats(AllocTag::AUTHN, &before);
+  {
+    ScopedAllocTag tag(AllocTag::AUTHN);
+    void* p = malloc(64);
+    Escape(p);
+    free(p);
+  }
+  GetThreadAllocStats(AllocTag::AUTHN, &after);
+#ifdef ISTIO_ALLOC_ACCOUNTING_MALLOC_HOOK
+  // The tcmalloc hook sees the malloc calls too.
+  EXPECT_EQ(after.allocations - before.allocations, 1);
+  EXPECT_EQ(after.bytes - before.bytes, 64);
+#else
+  // Only operator new is replaced.
+  EXPECT_EQ(after.allocations, before.allocations);
+#endif
+}
+
+TEST(AllocAccountingTest, TestTotal) {
+  AllocStats before, after;
+  GetThreadTotalAllocStats(&before);
+  {
+    ScopedAllocTag tag(AllocTag::MIXER_CHECK);
+    std::unique_ptr<int> value(new int(1));
+    Escape(value.get());
+  }
+  std::unique_ptr<int> untagged(new int(2));
+  Escape(untagged.get());
+  GetThreadTotalAllocStats(&after);
+  EXPECT_EQ(after.allocations - before.allocations, 2);
+  EXPECT_EQ(after.bytes - before.bytes, 2 * sizeof(int));
+}
+
+TEST(AllocAccountingTest, TestPerThread) {
+  AllocStats before, after;
+  GetThreadAllocStats(AllocTag::JWT_VERIFY, &before);
+  std::thread thread([]() {
+    ScopedAllocTag tag(AllocTag::JWT_VERIFY);
+    std::unique_ptr<int> value(new int(1));
+    Escape(value.get());
+  });
+  thread.join();
+  // The allocations of the other thread are not counted for this thread.
+  GetThreadAllocStats(AllocTag::JWT_VERIFY, &after);
+  EXPECT_EQ(after.allocations, before.allocations);
+}
+
+}  // namespace
+}  // namespace utils
+}  // namespace istio
@@ -0,0 +1,146 @@
+/* Copyright 2018 Istio Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "include/istio/utils/base64.h"
+
+#include <stdint.h>
+#include <string.h>
+
+namespace istio {
+namespace utils {
+namespace {
+
+const char kAlphabet[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+const char kUrlAlphabet[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+
+// The value of each letter of an alphabet, 64 for the other characters so
+// that 4 letters are validated by a single test of their or'ed values.
+class DecodeTable {
+ public:
+  explicit DecodeTable(const char* alphabet) {
+    memset(values_, 64, sizeof(values_));
+    for (uint8_t i = 0; i < 64; ++i) {
+      values_[static_cast<uint8_t>(alphabet[i])] = i;
+    }
+  }
+
+  uint32_t operator[](uint8_t c) const { return values_[c]; }
+
+ private:
+  uint8_t values_[256];
+};
+
+const DecodeTable kDecodeTable(kAlphabet);
+const DecodeTable kUrlDecodeTable(kUrlAlphabet);
+
+// Decodes 4 letters to 3 bytes at once. The optional padding is removed by
+// the caller, a valid input never has 4n+1 letters.
+bool Decode(absl::string_view data, const DecodeTable& table,
+            std::string* output) {
+  output->clear();
+  if (data.size() % 4 == 1) {
+    return false;
+  }
+  output->resize(data.size() / 4 * 3 + (data.size() % 4) * 3 / 4);
+  const uint8_t* in = reinterpret_cast<const uint8_t*>(data.data());
+  char* out = &(*output)[0];
+  size_t i = 0;
+  for (; i + 4 <= data.size(); i += 4) {
+    uint32_t a = table[in[i]];
+    uint32_t b = table[in[i + 1]];
+    uint32_t c = table[in[i + 2]];
+    uint32_t d = table[in[i + 3]];
+    if ((a | b | c | d) & 64) {
+      output->clear();
+      return false;
+    }
+    uint32_t bits = (a << 18) | (b << 12) | (c << 6) | d;
+    *out++ = bits >> 16;
+    *out++ = bits >> 8;
+    *out++ = bits;
+  }
+  if (i < data.size()) {
+    uint32_t a = table[in[i]];
+    uint32_t b = table[in[i + 1]];
+    uint32_t c = i + 2 < data.size() ? table[in[i + 2]] : 0;
+    if ((a | b | c) & 64) {
+      output->clear();
+      return false;
+    }
+    uint32_t bits = (a << 18) | (b << 12) | (c << 6);
+    *out++ = bits >> 16;
+    if (i + 2 < data.size()) {
+      *out++ = bits >> 8;
+    }
+  }
+  return true;
+}
+
+// Removes at most 2 padding letters when the size is a multiple of 4.
+absl::string_view RemovePadding(absl::string_view data) {
+  if (!data.empty() && data.size() % 4 == 0 && data.back() == '=') {
+    data.remove_suffix(1);
+    if (data.back() == '=') {
+      data.remove_suffix(1);
+    }
+  }
+  return data;
+}
+
+}  // namespace
+
+std::string Base64Encode(absl::string_view data) {
+  std::string output((data.size() + 2) / 3 * 4, '=');
+  const unsigned char* p = reinterpret_cast<const unsigned char*>(data.data());
+  char* out = &output[0];
+  size_t i = 0;
+  for (; i + 2 < data.size(); i += 3) {
+    uint32_t n = (p[i] << 16) | (p[i + 1] << 8) | p[i + 2];
+    *out++ = kAlphabet[(n >> 18) & 0x3f];
+    *out++ = kAlphabet[(n >> 12) & 0x3f];
+    *out++ = kAlphabet[(n >> 6) & 0x3f];
+    *out++ = kAlphabet[n & 0x3f];
+  }
+  // The padding letters are already in place.
+  if (i < data.size()) {
+    uint32_t n = p[i] << 16;
+    if (i + 1 < data.size()) {
+      n |= p[i + 1] << 8;
+    }
+    *out++ = kAlphabet[(n >> 18) & 0x3f];
+    *out++ = kAlphabet[(n >> 12) & 0x3f];
+    if (i + 1 < data.size()) {
+      *out = kAlphabet[(n >> 6) & 0x3f];
+    }
+  }
+  return output;
+}
+
+bool Base64Decode(absl::string_view data, std::string* output) {
+  if (data.size() % 4 != 0) {
+    output->clear();
+    return false;
+  }
+  return Decode(RemovePadding(data), kDecodeTable, output);
+}
+
+bool Base64UrlDecode(absl::string_view data, std::string* output) {
+  return Decode(RemovePadding(data), kUrlDecodeTable, output);
+}
+
+}  // namespace utils
+}  // namespace istio
@@ -0,0 +1,91 @@
+/* Copyright 2018 Istio Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "include/istio/utils/base64.h"
+#include "gtest/gtest.h"
+
+namespace istio {
+namespace utils {
+namespace {
+
+TEST(Base64Test, TestEncode) {
+  EXPECT_EQ("", Base64Encode(""));
+  EXPECT_EQ("Zg==", Base64Encode("f"));
+  EXPECT_EQ("Zm8=", Base64Encode("fo"));
+  EXPECT_EQ("Zm9v", Base64Encode("foo"));
+  EXPECT_EQ("Zm9vYg==", Base64Encode("foob"));
+  EXPECT_EQ("Zm9vYmE=", Base64Encode("fooba"));
+  EXPECT_EQ("Zm9vYmFy", Base64Encode("foobar"));
+}
+
+TEST(Base64Test, TestEncodeBinary) {
+  EXPECT_EQ("AP8Q", Base64Encode(std::string("\x00\xff\x10", 3)));
+  EXPECT_EQ("+/8=", Base64Encode(std::string("\xfb\xff", 2)));
+}
+
+TEST(Base64Test, TestDecode) {
+  std::string output;
+  EXPECT_TRUE(Base64Decode("", &output));
+  EXPECT_EQ("", output);
+  EXPECT_TRUE(Base64Decode("Zg==", &output));
+  EXPECT_EQ("f", output);
+  EXPECT_TRUE(Base64Decode("Zm8=", &output));
+  EXPECT_EQ("fo", output);
+  EXPECT_TRUE(Base64Decode("Zm9vYmFy", &output));
+  EXPECT_EQ("foobar", output);
+  EXPECT_TRUE(Base64Decode("+/8=", &output));
+  EXPECT_EQ(std::string("\xfb\xff", 2), output);
+}
+
+TEST(Base64Test, TestDecodeInvalid) {
+  std::string output = "foo";
+  // Standard base64 must be padded.
+  EXPECT_FALSE(Base64Decode("Zg", &output));
+  EXPECT_EQ("", output);
+  EXPECT_FALSE(Base64Decode("Zm9v-_8=", &output));
+  EXPECT_FALSE(Base64Decode("Zm9=Zm9v", &output));
+  EXPECT_FALSE(Base64Decode("Zm9vY===", &output));
+  EXPECT_EQ("", output);
+}
+
+TEST(Base64Test, TestUrlDecode) {
+  std::string output;
+  EXPECT_TRUE(Base64UrlDecode("Zg", &output));
+  EXPECT_EQ("f", output);
+  EXPECT_TRUE(Base64UrlDecode("Zg==", &output));
+  EXPECT_EQ("f", output);
+  EXPECT_TRUE(Base64UrlDecode("-_8", &output));
+  EXPECT_EQ(std::string("\xfb\xff", 2), output);
+  EXPECT_FALSE(Base64UrlDecode("+/8=", &output));
+  EXPECT_FALSE(Base64UrlDecode("Zm9vY", &output));
+  EXPECT_EQ("", output);
+}
+
+TEST(Base64Test, TestRoundTrip) {
+  std::string data;
+  for (int i = 0; i < 256; ++i) {
+    data.push_back(static_cast<char>(i));
+  }
+  std::string output;
+  for (size_t size = 0; size < data.size(); ++size) {
+    std::string input = data.substr(0, size);
+    EXPECT_TRUE(Base64Decode(Base64Encode(input), &output));
+    EXPECT_EQ(input, output);
+  }
+}
+
+}  // namespace
+}  // namespace utils
+}  // namespace istio
@@ -0,0 +1,152 @@
+/* Copyright 2017 Istio Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "include/istio/utils/fast_hash.h"
+#include <assert.h>
+#include <stdio.h>
+
+namespace istio {
+namespace utils {
+namespace {
+
+const uint64_t kC1 = 0x87c37b91114253d5ULL;
+const uint64_t kC2 = 0x4cf5ad432745937fULL;
+
+inline uint64_t Rotl64(uint64_t x, int r) { return (x << r) | (x >> (64 - r)); }
+
+inline uint64_t Load64(const uint8_t* p) {
+  uint64_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+inline uint64_t Mix64(uint64_t k) {
+  k ^= k >> 33;
+  k *= 0xff51afd7ed558ccdULL;
+  k ^= k >> 33;
+  k *= 0xc4ceb9fe1a85ec53ULL;
+  k ^= k >> 33;
+  return k;
+}
+
+inline uint64_t MixK1(uint64_t k1) {
+  k1 *= kC1;
+  k1 = Rotl64(k1, 31);
+  k1 *= kC2;
+  return k1;
+}
+
+inline uint64_t MixK2(uint64_t k2) {
+  k2 *= kC2;
+  k2 = Rotl64(k2, 33);
+  k2 *= kC1;
+  return k2;
+}
+
+}  // namespace
+
+FastHash::FastHash()
+    : h1_(0), h2_(0), length_(0), buffer_size_(0), finalized_(false) {}
+
+void FastHash::ProcessBlock(const uint8_t* block) {
+  h1_ ^= MixK1(Load64(block));
+  h1_ = Rotl64(h1_, 27);
+  h1_ += h2_;
+  h1_ = h1_ * 5 + 0x52dce729;
+
+  h2_ ^= MixK2(Load64(block + 8));
+  h2_ = Rotl64(h2_, 31);
+  h2_ += h1_;
+  h2_ = h2_ * 5 + 0x38495ab5;
+}
+
+FastHash& FastHash::Update(const void* data, size_t size) {
+  // Not update after finalized.
+  assert(!finalized_);
+  const uint8_t* p = static_cast<const uint8_t*>(data);
+  length_ += size;
+
+  if (buffer_size_ > 0) {
+    size_t n = kBlockSize - buffer_size_;
+    if (n > size) {
+      n = size;
+    }
+    memcpy(buffer_ + buffer_size_, p, n);
+    buffer_size_ += n;
+    p += n;
+    size -= n;
+    if (buffer_size_ < kBlockSize) {
+      return *this;
+    }
+    ProcessBlock(buffer_);
+    buffer_size_ = 0;
+  }
+
+  for (; size >= kBlockSize; p += kBlockSize, size -= kBlockSize) {
+    ProcessBlock(p);
+  }
+
+  if (size > 0) {
+    memcpy(buffer_, p, size);
+    buffer_size_ = size;
+  }
+  return *this;
+}
+
+FastHash::Key FastHash::Digest() {
+  if (finalized_) {
+    return digest_;
+  }
+
+  uint8_t tail[kBlockSize] = {0};
+  memcpy(tail, buffer_, buffer_size_);
+  uint64_t k1 = Load64(tail);
+  uint64_t k2 = Load64(tail + 8);
+  if (buffer_size_ > 8) {
+    h2_ ^= MixK2(k2);
+  }
+  if (buffer_size_ > 0) {
+    h1_ ^= MixK1(k1);
+  }
+
+  h1_ ^= length_;
+  h2_ ^= length_;
+  h1_ += h2_;
+  h2_ += h1_;
+  h1_ = Mix64(h1_);
+  h2_ = Mix64(h2_);
+  h1_ += h2_;
+  h2_ += h1_;
+
+  digest_.high = h1_;
+  digest_.low = h2_;
+  finalized_ = true;
+  return digest_;
+}
+
+FastHash::Key FastHash::operator()(const void* data, size_t size) {
+  return Update(data, size).Digest();
+}
+
+std::string FastHash::DebugString(const Key& digest) {
+  char buf[33];
+  snprintf(buf, sizeof(buf), "%016llx%016llx",
+           static_cast<unsigned long long>(digest.high),
+           static_cast<unsigned long long>(digest.low));
+  return std::string(buf, 32);
+}
+
+}  // namespace utils
+}  // namespace istio
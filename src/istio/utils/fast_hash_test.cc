@@ -0,0 +1,54 @@
+/* Copyright 2017 Istio Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "include/istio/utils/fast_hash.h"
+#include "gtest/gtest.h"
+
+namespace istio {
+namespace utils {
+namespace {
+
+TEST(FastHashTest, TestPrintableDigest) {
+  static const char data[] = "The quick brown fox jumps over the lazy dog";
+  ASSERT_EQ("e34bbc7bbc071b6c7a433ca9c49a9347",
+            FastHash::DebugString(FastHash()(data, strlen(data))));
+  ASSERT_EQ("00000000000000000000000000000000",
+            FastHash::DebugString(FastHash()("", 0)));
+}
+
+TEST(FastHashTest, TestDigestEqual) {
+  static const char data1[] = "Test Data1";
+  static const char data2[] = "Test Data2";
+  auto d1 = FastHash()(data1, sizeof(data1));
+  auto d11 = FastHash()(data1, sizeof(data1));
+  auto d2 = FastHash()(data2, sizeof(data2));
+  ASSERT_EQ(d11, d1);
+  ASSERT_NE(d1, d2);
+}
+
+TEST(FastHashTest, TestMultipleUpdates) {
+  static const char data[] = "The quick brown fox jumps over the lazy dog";
+  auto expected = FastHash()(data, sizeof(data));
+  for (size_t i = 0; i <= sizeof(data); ++i) {
+    FastHash hasher;
+    hasher.Update(data, i);
+    hasher.Update(data + i, sizeof(data) - i);
+    ASSERT_EQ(expected, hasher.Digest());
+  }
+}
+
+}  // namespace
+}  // namespace utils
+}  // namespace istio
@@ -14,6 +14,8 @@
  */
 
 #include "include/istio/utils/protobuf.h"
+#include "google/protobuf/io/coded_stream.h"
+#include "google/protobuf/io/zero_copy_stream_impl_lite.h"
 
 using namespace std::chrono;
 
@@ -60,5 +62,17 @@ bool InvalidDictionaryStatus(const Status& status) {
          status.error_message().starts_with(kInvalidDictionaryErrorPrefix);
 }
 
+std::string SerializeDeterministic(
+    const ::google::protobuf::MessageLite& message) {
+  std::string data;
+  {
+    ::google::protobuf::io::StringOutputStream stream(&data);
+    ::google::protobuf::io::CodedOutputStream output(&stream);
+    output.SetSerializationDeterministic(true);
+    message.SerializeToCodedStream(&output);
+  }
+  return data;
+}
+
 }  // namespace utils
 }  // namespace istio
@@ -0,0 +1,193 @@
+/* Copyright 2017 Istio Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "include/istio/utils/sharded_lru_cache.h"
+
+#include <unistd.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace istio {
+namespace utils {
+namespace {
+
+// A value counting the live instances.
+struct TestValue {
+  TestValue(int v) : value(v) { ++live; }
+  ~TestValue() { --live; }
+
+  int value;
+  static std::atomic<int> live;
+};
+std::atomic<int> TestValue::live(0);
+
+typedef ShardedLRUCache<int, TestValue> TestCache;
+
+bool Contains(TestCache* cache, int key) {
+  TestCache::ScopedLookup lookup(cache, key);
+  return lookup.Found() && lookup.value()->value == key;
+}
+
+class ShardedLRUCacheTest : public ::testing::Test {
+ protected:
+  void TearDown() override { EXPECT_EQ(TestValue::live, 0); }
+};
+
+TEST_F(ShardedLRUCacheTest, InsertAndLookup) {
+  TestCache cache(100, 4);
+  EXPECT_EQ(cache.NumShards(), 4);
+  for (int i = 0; i < 20; ++i) {
+    cache.Insert(i, new TestValue(i), 1);
+  }
+  EXPECT_EQ(cache.Entries(), 20);
+  EXPECT_EQ(cache.Size(), 20);
+  for (int i = 0; i < 20; ++i) {
+    EXPECT_TRUE(Contains(&cache, i));
+  }
+  EXPECT_FALSE(Contains(&cache, 20));
+
+  // Replaces the old value.
+  cache.Insert(1, new TestValue(1), 3);
+  EXPECT_EQ(cache.Entries(), 20);
+  EXPECT_EQ(cache.Size(), 22);
+  EXPECT_EQ(TestValue::live, 20);
+}
+
+TEST_F(ShardedLRUCacheTest, LRUEviction) {
+  TestCache cache(3, 1);
+  cache.Insert(1, new TestValue(1), 1);
+  cache.Insert(2, new TestValue(2), 1);
+  cache.Insert(3, new TestValue(3), 1);
+  // The hit makes 1 the most recently used.
+  EXPECT_TRUE(Contains(&cache, 1));
+  cache.Insert(4, new TestValue(4), 1);
+  EXPECT_TRUE(Contains(&cache, 1));
+  EXPECT_FALSE(Contains(&cache, 2));
+  EXPECT_TRUE(Contains(&cache, 3));
+  EXPECT_TRUE(Contains(&cache, 4));
+}
+
+TEST_F(ShardedLRUCacheTest, ApproximateRecencyEviction) {
+  TestCache cache(3, 1, true);
+  cache.Insert(1, new TestValue(1), 1);
+  cache.Insert(2, new TestValue(2), 1);
+  cache.Insert(3, new TestValue(3), 1);
+  // 1 is referenced, it gets a second chance and 2 is evicted.
+  EXPECT_TRUE(Contains(&cache, 1));
+  cache.Insert(4, new TestValue(4), 1);
+  EXPECT_FALSE(Contains(&cache, 2));
+  EXPECT_EQ(cache.Entries(), 3);
+
+  // 3 and 4 are referenced, 1 has used up its second chance.
+  EXPECT_TRUE(Contains(&cache, 3));
+  EXPECT_TRUE(Contains(&cache, 4));
+  cache.Insert(5, new TestValue(5), 1);
+  EXPECT_EQ(cache.Entries(), 3);
+  EXPECT_FALSE(Contains(&cache, 1));
+  EXPECT_TRUE(Contains(&cache, 3));
+  EXPECT_TRUE(Contains(&cache, 4));
+  EXPECT_TRUE(Contains(&cache, 5));
+}
+
+TEST_F(ShardedLRUCacheTest, PinnedEntries) {
+  TestCache cache(2, 1);
+  cache.Insert(1, new TestValue(1), 1);
+  {
+    TestCache::ScopedLookup lookup(&cache, 1);
+    ASSERT_TRUE(lookup.Found());
+
+    // The pinned entry is skipped by the eviction.
+    cache.Insert(2, new TestValue(2), 1);
+    cache.Insert(3, new TestValue(3), 1);
+    EXPECT_FALSE(Contains(&cache, 2));
+    EXPECT_EQ(cache.Entries(), 2);
+
+    // A removed pinned value is deleted when it is released.
+    cache.Remove(1);
+    EXPECT_FALSE(Contains(&cache, 1));
+    EXPECT_EQ(lookup.value()->value, 1);
+    EXPECT_EQ(TestValue::live, 2);
+  }
+  EXPECT_EQ(TestValue::live, 1);
+  EXPECT_TRUE(Contains(&cache, 3));
+
+  cache.RemoveAll();
+  EXPECT_EQ(cache.Entries(), 0);
+  EXPECT_EQ(TestValue::live, 0);
+}
+
+TEST_F(ShardedLRUCacheTest, IdleExpiration) {
+  TestCache cache(10, 1);
+  cache.SetMaxIdleSeconds(0.1);
+  cache.Insert(1, new TestValue(1), 1);
+  cache.Insert(2, new TestValue(2), 1);
+  usleep(60 * 1000);
+  EXPECT_TRUE(Contains(&cache, 1));
+  usleep(60 * 1000);
+  // 2 has not been used for 120ms.
+  EXPECT_FALSE(Contains(&cache, 2));
+  EXPECT_TRUE(Contains(&cache, 1));
+  cache.RemoveExpiredEntries();
+  EXPECT_EQ(cache.Entries(), 1);
+}
+
+TEST_F(ShardedLRUCacheTest, AgeBasedExpiration) {
+  TestCache cache(10, 1);
+  cache.SetAgeBasedEviction(0.1);
+  cache.Insert(1, new TestValue(1), 1);
+  usleep(60 * 1000);
+  cache.Insert(2, new TestValue(2), 1);
+  EXPECT_TRUE(Contains(&cache, 1));
+  usleep(60 * 1000);
+  // Lookups don't extend the age.
+  EXPECT_FALSE(Contains(&cache, 1));
+  EXPECT_TRUE(Contains(&cache, 2));
+  // The insert removes the expired entry.
+  cache.Insert(3, new TestValue(3), 1);
+  EXPECT_EQ(cache.Entries(), 2);
+}
+
+TEST_F(ShardedLRUCacheTest, ConcurrentAccess) {
+  for (bool approximate_recency : {false, true}) {
+    TestCache cache(64, 8, approximate_recency);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t) {
+      threads.emplace_back([&cache, t]() {
+        for (int i = 0; i < 10000; ++i) {
+          int key = (i * 7 + t) % 100;
+          TestCache::ScopedLookup lookup(&cache, key);
+          if (lookup.Found()) {
+            EXPECT_EQ(lookup.value()->value, key);
+          } else if (i % 3 == 0) {
+            cache.Remove(key);
+          } else {
+            cache.Insert(key, new TestValue(key), 1);
+          }
+        }
+      });
+    }
+    for (auto& thread : threads) {
+      thread.join();
+    }
+    EXPECT_LE(cache.Size(), 64);
+  }
+}
+
+}  // namespace
+}  // namespace utils
+}  // namespace istio
@@ -18,6 +18,7 @@
 
 #include "include/istio/utils/simple_lru_cache.h"
 #include "include/istio/utils/simple_lru_cache_inl.h"
+#include "include/istio/utils/string_key.h"
 
 #include <math.h>
 #include <unistd.h>
@@ -1108,5 +1109,157 @@ TEST_F(SimpleLRUCacheTest, LookupWithoutEvictionOrderUpdateAndRemove) {
   EXPECT_THAT(TestCache::ScopedLookup(cache_.get(), 2).value(), NotNull());
 }
 
+TEST_F(SimpleLRUCacheTest, InOrderEvictionsClock) {
+  cache_.reset(new TestCache(kCacheSize));
+  cache_->SetEvictionPolicy(SimpleLRUEvictionPolicy::CLOCK);
+  TestInOrderEvictions(kCacheSize);
+}
+
+TEST_F(SimpleLRUCacheTest, InOrderEvictionsSegmentedLRU) {
+  cache_.reset(new TestCache(kCacheSize));
+  cache_->SetEvictionPolicy(SimpleLRUEvictionPolicy::SEGMENTED_LRU);
+  TestInOrderEvictions(kCacheSize);
+}
+
+TEST_F(SimpleLRUCacheTest, ClockEviction) {
+  cache_.reset(new TestCache(3));
+  cache_->SetEvictionPolicy(SimpleLRUEvictionPolicy::CLOCK);
+  for (int i = 0; i < 3; i++) {
+    in_cache[i] = true;
+    cache_->Insert(i, new TestValue(i), 1);
+  }
+
+  // The hit on 0 gives it a second chance, 1 is evicted.
+  { TestCache::ScopedLookup lookup(cache_.get(), 0); }
+  in_cache[3] = true;
+  cache_->Insert(3, new TestValue(3), 1);
+  EXPECT_TRUE(in_cache[0]);
+  EXPECT_FALSE(in_cache[1]);
+  EXPECT_TRUE(in_cache[2]);
+
+  // A pinned entry stays on the list but is not evicted.
+  TestValue* v = cache_->Lookup(2);
+  ASSERT_TRUE(v != nullptr);
+  in_cache[4] = true;
+  cache_->Insert(4, new TestValue(4), 1);
+  in_cache[5] = true;
+  cache_->Insert(5, new TestValue(5), 1);
+  EXPECT_TRUE(in_cache[2]);
+  EXPECT_EQ(cache_->Entries(), 3);
+  cache_->Release(2, v);
+  EXPECT_TRUE(in_cache[2]);
+}
+
+TEST_F(SimpleLRUCacheTest, ClockIdleExpiration) {
+  cache_.reset(new TestCache(kCacheSize));
+  cache_->SetEvictionPolicy(SimpleLRUEvictionPolicy::CLOCK);
+  cache_->SetMaxIdleSeconds(0.2);  // 200 milliseconds
+  for (int i = 0; i < 2; i++) {
+    in_cache[i] = true;
+    cache_->Insert(i, new TestValue(i), 1);
+  }
+  usleep(110 * 1000);
+  { TestCache::ScopedLookup lookup(cache_.get(), 0); }
+  usleep(110 * 1000);
+
+  // 1 is not at the end of the list, but it is expired on lookup.
+  EXPECT_FALSE(TestCache::ScopedLookup(cache_.get(), 1).Found());
+  EXPECT_FALSE(in_cache[1]);
+  EXPECT_TRUE(TestCache::ScopedLookup(cache_.get(), 0).Found());
+}
+
+TEST_F(SimpleLRUCacheTest, SweepExpiredEntries) {
+  cache_.reset(new TestCache(kCacheSize));
+  EXPECT_EQ(cache_->SweepExpiredEntries(kCacheSize), 0);
+  cache_->SetMaxIdleSeconds(0.1);  // 100 milliseconds
+  for (int i = 0; i < kCacheSize - 1; i++) {
+    in_cache[i] = true;
+    cache_->Insert(i, new TestValue(i), 1);
+  }
+  usleep(110 * 1000);
+  in_cache[kCacheSize - 1] = true;
+  cache_->Insert(kCacheSize - 1, new TestValue(kCacheSize - 1), 1);
+
+  // Each sweep removes a bounded number of the oldest entries.
+  EXPECT_EQ(cache_->SweepExpiredEntries(2), 2);
+  EXPECT_FALSE(in_cache[0]);
+  EXPECT_FALSE(in_cache[1]);
+  EXPECT_TRUE(in_cache[2]);
+  EXPECT_EQ(cache_->Entries(), kCacheSize - 2);
+
+  // The sweep stops at the first unexpired entry.
+  EXPECT_EQ(cache_->SweepExpiredEntries(kElems), kCacheSize - 3);
+  EXPECT_EQ(cache_->Entries(), 1);
+  EXPECT_TRUE(in_cache[kCacheSize - 1]);
+  EXPECT_EQ(cache_->SweepExpiredEntries(kElems), 0);
+}
+
+TEST_F(SimpleLRUCacheTest, SegmentedLRUScanResistance) {
+  cache_.reset(new TestCache(kCacheSize));
+  cache_->SetEvictionPolicy(SimpleLRUEvictionPolicy::SEGMENTED_LRU);
+  for (int i = 0; i < 5; i++) {
+    in_cache[i] = true;
+    cache_->Insert(i, new TestValue(i), 1);
+    TestCache::ScopedLookup lookup(cache_.get(), i);
+  }
+
+  // One-off entries only evict each other.
+  for (int i = 5; i < kElems; i++) {
+    in_cache[i] = true;
+    cache_->Insert(i, new TestValue(i), 1);
+  }
+  for (int i = 0; i < 5; i++) {
+    EXPECT_TRUE(in_cache[i]) << i;
+  }
+  EXPECT_EQ(cache_->Entries(), kCacheSize);
+}
+
+TEST_F(SimpleLRUCacheTest, SegmentedLRUDemotion) {
+  cache_.reset(new TestCache(kCacheSize));
+  cache_->SetEvictionPolicy(SimpleLRUEvictionPolicy::SEGMENTED_LRU);
+  for (int i = 0; i < kCacheSize; i++) {
+    in_cache[i] = true;
+    cache_->Insert(i, new TestValue(i), 1);
+  }
+  for (int i = 0; i < kCacheSize; i++) {
+    TestCache::ScopedLookup lookup(cache_.get(), i);
+  }
+
+  // The protected segment holds 8 units, 0 and 1 went back to probation
+  // and 0 is evicted first.
+  in_cache[kCacheSize] = true;
+  cache_->Insert(kCacheSize, new TestValue(kCacheSize), 1);
+  EXPECT_FALSE(in_cache[0]);
+  for (int i = 1; i <= kCacheSize; i++) {
+    EXPECT_TRUE(in_cache[i]) << i;
+  }
+}
+
+TEST_F(SimpleLRUCacheTest, StringKey) {
+  SimpleLRUCache<StringKey, std::string, StringKey::Hash> cache(kCacheSize);
+  std::string buffer = "key1";
+  cache.Insert(StringKey::Ref(buffer), new std::string("value1"), 1);
+
+  // The cache keeps its own copy of the key.
+  buffer = "key2";
+  EXPECT_FALSE(decltype(cache)::ScopedLookup(&cache, StringKey::Ref(buffer))
+                   .Found());
+  buffer = "key1";
+  {
+    decltype(cache)::ScopedLookup lookup(&cache, StringKey::Ref(buffer));
+    ASSERT_TRUE(lookup.Found());
+    EXPECT_EQ(*lookup.value(), "value1");
+    EXPECT_EQ(cache.begin()->first.view(), "key1");
+    EXPECT_NE(cache.begin()->first.view().data(), buffer.data());
+  }
+
+  // Owning and reference keys are equal for the same string.
+  EXPECT_TRUE(
+      decltype(cache)::ScopedLookup(&cache, StringKey("key1")).Found());
+  EXPECT_EQ(StringKey::Hash()(StringKey("key1")),
+            StringKey::Hash()(StringKey::Ref(buffer)));
+  cache.Clear();
+}
+
 }  // namespace utils
 }  // namespace istio